@@ -19,17 +19,19 @@
 #include <limits>
 #include <string>
 
+#include "../lib/simdispatch.h"
+
 #include "../lib/circuit_qsim_parser.h"
 #include "../lib/formux.h"
 #include "../lib/fuser_mqubit.h"
 #include "../lib/gates_qsim.h"
 #include "../lib/io_file.h"
 #include "../lib/run_qsim.h"
-#include "../lib/simmux.h"
 #include "../lib/util_cpu.h"
 
 constexpr char usage[] = "usage:\n  ./qsim_base -c circuit -d maxtime "
                          "-s seed -t threads -f max_fused_size "
+                         "-b tile_qubits -r reorder_qubits -n numa_policy "
                          "-v verbosity -z\n";
 
 struct Options {
@@ -38,6 +40,9 @@ struct Options {
   unsigned seed = 1;
   unsigned num_threads = 1;
   unsigned max_fused_size = 2;
+  unsigned tile_qubits = 0;
+  unsigned reorder_qubits = 0;
+  unsigned numa_policy = 0;
   unsigned verbosity = 0;
   bool denormals_are_zeros = false;
 };
@@ -47,7 +52,7 @@ Options GetOptions(int argc, char* argv[]) {
 
   int k;
 
-  while ((k = getopt(argc, argv, "c:d:s:t:f:v:z")) != -1) {
+  while ((k = getopt(argc, argv, "c:d:s:t:f:b:r:n:v:z")) != -1) {
     switch (k) {
       case 'c':
         opt.circuit_file = optarg;
@@ -64,6 +69,15 @@ Options GetOptions(int argc, char* argv[]) {
       case 'f':
         opt.max_fused_size = std::atoi(optarg);
         break;
+      case 'b':
+        opt.tile_qubits = std::atoi(optarg);
+        break;
+      case 'r':
+        opt.reorder_qubits = std::atoi(optarg);
+        break;
+      case 'n':
+        opt.numa_policy = std::atoi(optarg);
+        break;
       case 'v':
         opt.verbosity = std::atoi(optarg);
         break;
@@ -86,6 +100,11 @@ bool ValidateOptions(const Options& opt) {
     return false;
   }
 
+  if (opt.numa_policy > qsim::kNumaFirstTouch) {
+    qsim::IO::errorf("numa_policy should be 0, 1 or 2.\n");
+    return false;
+  }
+
   return true;
 }
 
@@ -106,6 +125,46 @@ void PrintAmplitudes(
   }
 }
 
+// Runs the circuit with the simulator provided by factory.
+struct RunCircuit {
+  template <typename Factory>
+  bool operator()(const Factory& factory, const Options& opt,
+                  const qsim::Circuit<qsim::GateQSim<float>>& circuit) const {
+    using namespace qsim;
+
+    using StateSpace = typename Factory::StateSpace;
+    using State = typename StateSpace::State;
+    using Fuser = MultiQubitGateFuser<IO, GateQSim<float>>;
+    using Runner = QSimRunner<IO, Fuser, Factory>;
+
+    StateSpace state_space = factory.CreateStateSpace();
+    State state = state_space.Create(circuit.num_qubits,
+                                     NumaPolicy(opt.numa_policy));
+
+    if (state_space.IsNull(state)) {
+      IO::errorf("not enough memory: is the number of qubits too large?\n");
+      return false;
+    }
+
+    state_space.SetStateZero(state);
+
+    typename Runner::Parameter param;
+    param.max_fused_size = opt.max_fused_size;
+    param.tile_qubits = opt.tile_qubits;
+    param.reorder_qubits = opt.reorder_qubits;
+    param.seed = opt.seed;
+    param.verbosity = opt.verbosity;
+
+    if (!Runner::Run(param, factory, circuit, state)) {
+      return false;
+    }
+
+    PrintAmplitudes(circuit.num_qubits, state_space, state);
+
+    return true;
+  }
+};
+
 int main(int argc, char* argv[]) {
   using namespace qsim;
 
@@ -124,47 +183,14 @@ int main(int argc, char* argv[]) {
     SetFlushToZeroAndDenormalsAreZeros();
   }
 
-  struct Factory {
-    Factory(unsigned num_threads) : num_threads(num_threads) {}
-
-    using Simulator = qsim::Simulator<For>;
-    using StateSpace = Simulator::StateSpace;
-
-    StateSpace CreateStateSpace() const {
-      return StateSpace(num_threads);
-    }
-
-    Simulator CreateSimulator() const {
-      return Simulator(num_threads);
-    }
-
-    unsigned num_threads;
-  };
-
-  using Simulator = Factory::Simulator;
-  using StateSpace = Simulator::StateSpace;
-  using State = StateSpace::State;
-  using Fuser = MultiQubitGateFuser<IO, GateQSim<float>>;
-  using Runner = QSimRunner<IO, Fuser, Factory>;
-
-  StateSpace state_space = Factory(opt.num_threads).CreateStateSpace();
-  State state = state_space.Create(circuit.num_qubits);
-
-  if (state_space.IsNull(state)) {
-    IO::errorf("not enough memory: is the number of qubits too large?\n");
-    return 1;
-  }
-
-  state_space.SetStateZero(state);
+  using Dispatch = SimulatorDispatch<For>;
 
-  Runner::Parameter param;
-  param.max_fused_size = opt.max_fused_size;
-  param.seed = opt.seed;
-  param.verbosity = opt.verbosity;
-
-  if (Runner::Run(param, Factory(opt.num_threads), circuit, state)) {
-    PrintAmplitudes(circuit.num_qubits, state_space, state);
+  if (opt.verbosity > 0) {
+    static constexpr char const* names[4] = {
+      "basic", "SSE4.1", "AVX2", "AVX512F",
+    };
+    IO::messagef("simulator: %s\n", names[GetSimdInstructions()]);
   }
 
-  return 0;
+  return Dispatch::Run(opt.num_threads, RunCircuit(), opt, circuit) ? 0 : 1;
 }
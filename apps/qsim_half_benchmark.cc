@@ -0,0 +1,255 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <complex>
+#include <limits>
+#include <string>
+
+#include "../lib/circuit_qsim_parser.h"
+#include "../lib/formux.h"
+#include "../lib/fuser_mqubit.h"
+#include "../lib/gates_qsim.h"
+#include "../lib/io_file.h"
+#include "../lib/run_qsim.h"
+#include "../lib/simmux.h"
+#include "../lib/util.h"
+#include "../lib/util_cpu.h"
+
+#if defined(__AVX2__) && defined(__F16C__)
+# include "../lib/half.h"
+# ifdef __AVX512F__
+#  include "../lib/simulator_half_avx512.h"
+   namespace qsim {
+     template <typename For, typename Half>
+     using SimulatorHalf = SimulatorHalfAVX512<For, Half>;
+   }
+# else
+#  include "../lib/simulator_half_avx.h"
+   namespace qsim {
+     template <typename For, typename Half>
+     using SimulatorHalf = SimulatorHalfAVX<For, Half>;
+   }
+# endif
+#endif
+
+constexpr char usage[] = "usage:\n  ./qsim_half_benchmark -c circuit "
+                         "-d maxtime -p precision -t threads "
+                         "-f max_fused_size -v verbosity -z\n";
+
+struct Options {
+  std::string circuit_file;
+  std::string precision = "fp16";
+  unsigned maxtime = std::numeric_limits<unsigned>::max();
+  unsigned num_threads = 1;
+  unsigned max_fused_size = 2;
+  unsigned verbosity = 0;
+  bool denormals_are_zeros = false;
+};
+
+Options GetOptions(int argc, char* argv[]) {
+  Options opt;
+
+  int k;
+
+  while ((k = getopt(argc, argv, "c:d:p:t:f:v:z")) != -1) {
+    switch (k) {
+      case 'c':
+        opt.circuit_file = optarg;
+        break;
+      case 'd':
+        opt.maxtime = std::atoi(optarg);
+        break;
+      case 'p':
+        opt.precision = optarg;
+        break;
+      case 't':
+        opt.num_threads = std::atoi(optarg);
+        break;
+      case 'f':
+        opt.max_fused_size = std::atoi(optarg);
+        break;
+      case 'v':
+        opt.verbosity = std::atoi(optarg);
+        break;
+      case 'z':
+        opt.denormals_are_zeros = true;
+        break;
+      default:
+        qsim::IO::errorf(usage);
+        exit(1);
+    }
+  }
+
+  return opt;
+}
+
+bool ValidateOptions(const Options& opt) {
+  if (opt.circuit_file.empty()) {
+    qsim::IO::errorf("circuit file is not provided.\n");
+    qsim::IO::errorf(usage);
+    return false;
+  }
+
+  if (opt.precision != "fp16" && opt.precision != "bf16") {
+    qsim::IO::errorf("precision should be fp16 or bf16.\n");
+    qsim::IO::errorf(usage);
+    return false;
+  }
+
+  return true;
+}
+
+#if defined(__AVX2__) && defined(__F16C__)
+
+template <typename Simulator_>
+struct Factory {
+  Factory(unsigned num_threads) : num_threads(num_threads) {}
+
+  using Simulator = Simulator_;
+  using StateSpace = typename Simulator::StateSpace;
+
+  StateSpace CreateStateSpace() const {
+    return StateSpace(num_threads);
+  }
+
+  Simulator CreateSimulator() const {
+    return Simulator(num_threads);
+  }
+
+  unsigned num_threads;
+};
+
+// Runs the circuit from |0> and returns the final state and the runtime.
+template <typename Simulator, typename Circuit>
+bool Run(const Options& opt, const Circuit& circuit,
+         typename Simulator::StateSpace::State& state, double& time) {
+  using namespace qsim;
+
+  using StateSpace = typename Simulator::StateSpace;
+  using Fuser = MultiQubitGateFuser<IO, GateQSim<float>>;
+  using Runner = QSimRunner<IO, Fuser, Factory<Simulator>>;
+
+  StateSpace state_space = Factory<Simulator>(opt.num_threads)
+      .CreateStateSpace();
+
+  state = state_space.Create(circuit.num_qubits);
+
+  if (state_space.IsNull(state)) {
+    IO::errorf("not enough memory: is the number of qubits too large?\n");
+    return false;
+  }
+
+  state_space.SetStateZero(state);
+
+  typename Runner::Parameter param;
+  param.max_fused_size = opt.max_fused_size;
+  param.verbosity = opt.verbosity;
+
+  double t0 = GetTime();
+  bool rc = Runner::Run(param, Factory<Simulator>(opt.num_threads),
+                        circuit, state);
+  time = GetTime() - t0;
+
+  return rc;
+}
+
+template <typename Half, typename Circuit>
+int Benchmark(const Options& opt, const Circuit& circuit) {
+  using namespace qsim;
+
+  using Simulator = qsim::Simulator<For>;
+  using StateSpace = typename Simulator::StateSpace;
+  using HalfSimulator = SimulatorHalf<For, Half>;
+  using HalfStateSpace = typename HalfSimulator::StateSpace;
+
+  typename StateSpace::State state = StateSpace::Null();
+  typename HalfStateSpace::State hstate = HalfStateSpace::Null();
+
+  double time = 0;
+  double htime = 0;
+
+  if (!Run<Simulator>(opt, circuit, state, time)
+      || !Run<HalfSimulator>(opt, circuit, hstate, htime)) {
+    return 1;
+  }
+
+  // Compare the normal-order amplitudes of the two states.
+  std::complex<double> ip = 0;
+  double norm = 0;
+  double hnorm = 0;
+  double max_error = 0;
+
+  uint64_t size = uint64_t{1} << circuit.num_qubits;
+
+  for (uint64_t i = 0; i < size; ++i) {
+    std::complex<double> a = StateSpace::GetAmpl(state, i);
+    std::complex<double> b = HalfStateSpace::GetAmpl(hstate, i);
+
+    ip += std::conj(a) * b;
+    norm += std::norm(a);
+    hnorm += std::norm(b);
+    max_error = std::max(max_error, std::abs(a - b));
+  }
+
+  double gib = 1.0 / (1 << 30);
+  double bytes = sizeof(float) * StateSpace::MinSize(circuit.num_qubits);
+  double hbytes = sizeof(Half) * HalfStateSpace::MinSize(circuit.num_qubits);
+
+  IO::messagef("precision:            %s\n", opt.precision.c_str());
+  IO::messagef("float state (GiB):    %g\n", bytes * gib);
+  IO::messagef("half state (GiB):     %g\n", hbytes * gib);
+  IO::messagef("float time (s):       %g\n", time);
+  IO::messagef("half time (s):        %g\n", htime);
+  IO::messagef("half norm:            %.8f\n", hnorm);
+  IO::messagef("fidelity:             %.8f\n",
+               std::norm(ip) / (norm * hnorm));
+  IO::messagef("max amplitude error:  %g\n", max_error);
+
+  return 0;
+}
+
+#endif  // defined(__AVX2__) && defined(__F16C__)
+
+int main(int argc, char* argv[]) {
+  using namespace qsim;
+
+  auto opt = GetOptions(argc, argv);
+  if (!ValidateOptions(opt)) {
+    return 1;
+  }
+
+#if defined(__AVX2__) && defined(__F16C__)
+  Circuit<GateQSim<float>> circuit;
+  if (!CircuitQsimParser<IOFile>::FromFile(opt.maxtime, opt.circuit_file,
+                                           circuit)) {
+    return 1;
+  }
+
+  if (opt.denormals_are_zeros) {
+    SetFlushToZeroAndDenormalsAreZeros();
+  }
+
+  if (opt.precision == "fp16") {
+    return Benchmark<float16>(opt, circuit);
+  } else {
+    return Benchmark<bfloat16>(opt, circuit);
+  }
+#else
+  IO::errorf("half-precision storage requires AVX2 and F16C.\n");
+  return 1;
+#endif
+}
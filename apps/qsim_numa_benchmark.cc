@@ -0,0 +1,215 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <unistd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <map>
+#include <vector>
+
+#include "../lib/io.h"
+#include "../lib/numa.h"
+#include "../lib/poolfor.h"
+#include "../lib/simmux.h"
+#include "../lib/util.h"
+#include "../lib/vectorspace.h"
+
+constexpr char usage[] = "usage:\n  ./qsim_numa_benchmark -q num_qubits "
+                         "-t threads -r repetitions -p pin_threads\n";
+
+struct Options {
+  unsigned num_qubits = 26;
+  unsigned num_threads = 1;
+  unsigned repetitions = 4;
+  bool pin_threads = true;
+};
+
+Options GetOptions(int argc, char* argv[]) {
+  Options opt;
+
+  int k;
+
+  while ((k = getopt(argc, argv, "q:t:r:p:")) != -1) {
+    switch (k) {
+      case 'q':
+        opt.num_qubits = std::atoi(optarg);
+        break;
+      case 't':
+        opt.num_threads = std::atoi(optarg);
+        break;
+      case 'r':
+        opt.repetitions = std::atoi(optarg);
+        break;
+      case 'p':
+        opt.pin_threads = std::atoi(optarg) != 0;
+        break;
+      default:
+        qsim::IO::errorf(usage);
+        exit(1);
+    }
+  }
+
+  return opt;
+}
+
+bool ValidateOptions(const Options& opt) {
+  if (opt.num_qubits < 10 || opt.num_qubits > 40) {
+    qsim::IO::errorf("num_qubits should be between 10 and 40.\n");
+    return false;
+  }
+
+  if (opt.num_threads == 0 || opt.repetitions == 0) {
+    qsim::IO::errorf("threads and repetitions should be positive.\n");
+    qsim::IO::errorf(usage);
+    return false;
+  }
+
+  return true;
+}
+
+// The NUMA nodes of the threads of the pool.
+std::vector<unsigned> ThreadNodes(const Options& opt) {
+  std::vector<unsigned> nodes(opt.num_threads, 0);
+
+  auto f = [&nodes](unsigned m) {
+    nodes[m] = qsim::NumaNodeOfCpu(qsim::CurrentCpu());
+  };
+
+  qsim::ThreadPool::Get(opt.num_threads, opt.pin_threads).Execute(f);
+
+  return nodes;
+}
+
+// Runs sweeps of one-qubit gates over all the qubits and reports the total
+// bandwidth and the bandwidth served by the memory of each NUMA node.
+// The per-node numbers are estimated from the placement of the pages that
+// each thread works on; no hardware counters are read.
+template <typename Simulator>
+void Benchmark(const Options& opt, qsim::NumaPolicy policy,
+               const std::vector<unsigned>& thread_nodes) {
+  using namespace qsim;
+
+  using For = PoolFor;
+  using StateSpace = typename Simulator::StateSpace;
+  using fp_type = typename StateSpace::fp_type;
+
+  For for_(opt.num_threads, opt.pin_threads);
+  StateSpace state_space(opt.num_threads, opt.pin_threads);
+  Simulator simulator(opt.num_threads, opt.pin_threads);
+
+  auto state = state_space.Create(opt.num_qubits, policy);
+  if (state_space.IsNull(state)) {
+    IO::errorf("not enough memory: is the number of qubits too large?\n");
+    return;
+  }
+
+  state_space.SetStateZero(state);
+
+  uint64_t size = StateSpace::MinSize(opt.num_qubits);
+  double bytes = sizeof(fp_type) * size;
+
+  // Sample the pages of the part of the state of each thread.
+  constexpr uint64_t kPageSize = 4096;
+  constexpr uint64_t kMaxSamples = 256;
+
+  std::map<int, double> node_share;
+  std::vector<std::map<int, double>> thread_share(opt.num_threads);
+
+  for (unsigned m = 0; m < opt.num_threads; ++m) {
+    uint64_t i0 = for_.GetIndex0(size, m) * sizeof(fp_type);
+    uint64_t i1 = for_.GetIndex1(size, m) * sizeof(fp_type);
+    uint64_t num_pages = (i1 - i0 + kPageSize - 1) / kPageSize;
+    uint64_t num_samples = std::min(num_pages, kMaxSamples);
+
+    for (uint64_t k = 0; k < num_samples; ++k) {
+      uint64_t offset = i0 + (k * num_pages / num_samples) * kPageSize;
+      int node = NumaNodeOfAddress((const char*) state.get() + offset);
+
+      thread_share[m][node] += 1.0 / num_samples;
+      node_share[node] += double(i1 - i0) / bytes / num_samples;
+    }
+  }
+
+  fp_type r = 1 / std::sqrt(2.0);
+  std::vector<fp_type> matrix = {r, 0, r, 0, r, 0, -r, 0};
+
+  double t0 = GetTime();
+
+  for (unsigned k = 0; k < opt.repetitions; ++k) {
+    for (unsigned q = 0; q < opt.num_qubits; ++q) {
+      simulator.ApplyGate({q}, matrix.data(), state);
+    }
+  }
+
+  double time = GetTime() - t0;
+
+  // Each gate reads and writes the whole state once.
+  double traffic = 2 * bytes * opt.repetitions * opt.num_qubits;
+  double gb = 1e-9;
+
+  std::map<int, double> node_traffic;
+  double local_traffic = 0;
+
+  for (unsigned m = 0; m < opt.num_threads; ++m) {
+    for (const auto& p : thread_share[m]) {
+      double t = p.second * traffic / opt.num_threads;
+      node_traffic[p.first] += t;
+      if (p.first == int(thread_nodes[m])) {
+        local_traffic += t;
+      }
+    }
+  }
+
+  static const char* policies[] = {"default", "interleave", "first touch"};
+
+  IO::messagef("\npolicy: %s\n", policies[policy]);
+  IO::messagef("time (s): %g  bandwidth (GB/s): %g  local traffic: %.1f%%\n",
+               time, traffic * gb / time, 100 * local_traffic / traffic);
+  IO::messagef("  node  threads  state share  bandwidth (GB/s)\n");
+
+  for (unsigned node : NumaNodes()) {
+    unsigned num_threads = std::count(thread_nodes.begin(),
+                                      thread_nodes.end(), node);
+    IO::messagef("%6u%9u%12.1f%%%18g\n", node, num_threads,
+                 100 * node_share[node], node_traffic[node] * gb / time);
+  }
+
+  if (node_share.find(-1) != node_share.end()) {
+    IO::messagef("  unknown placement: %.1f%%\n", 100 * node_share[-1]);
+  }
+}
+
+int main(int argc, char* argv[]) {
+  using namespace qsim;
+
+  auto opt = GetOptions(argc, argv);
+  if (!ValidateOptions(opt)) {
+    return 1;
+  }
+
+  using Simulator = qsim::Simulator<PoolFor>;
+
+  auto thread_nodes = ThreadNodes(opt);
+
+  IO::messagef("qubits: %u  threads: %u  NUMA nodes: %u\n",
+               opt.num_qubits, opt.num_threads, unsigned(NumaNodes().size()));
+
+  for (auto policy : {kNumaDefault, kNumaInterleave, kNumaFirstTouch}) {
+    Benchmark<Simulator>(opt, policy, thread_nodes);
+  }
+
+  return 0;
+}
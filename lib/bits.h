@@ -15,6 +15,7 @@
 #ifndef BITS_H_
 #define BITS_H_
 
+#include <cstdint>
 #include <vector>
 
 #ifdef __BMI2__
@@ -100,6 +101,20 @@ inline Integer PermuteBits(
   return pbits;
 }
 
+inline unsigned Parity(uint64_t bits) {
+#if defined(__GNUC__) || defined(__clang__)
+  return __builtin_parityll(bits);
+#else
+  bits ^= bits >> 32;
+  bits ^= bits >> 16;
+  bits ^= bits >> 8;
+  bits ^= bits >> 4;
+  bits ^= bits >> 2;
+  bits ^= bits >> 1;
+  return bits & 1;
+#endif
+}
+
 }  // namespace bits
 }  // namespace qsim
 
@@ -15,6 +15,7 @@
 #ifndef CHANNEL_H_
 #define CHANNEL_H_
 
+#include <cstddef>
 #include <set>
 #include <vector>
 
@@ -144,6 +145,73 @@ Channel<Gate> MakeChannelFromGate(unsigned time, const Gate& gate) {
   return channel;
 }
 
+/**
+ * Samples a Kraus operator of a "normal" channel using the lower bounds
+ * kop.prob of the sampling probabilities.
+ * @param channel The channel.
+ * @param r A random number in [0, 1).
+ * @param cp Output: the sum of the lower bounds if no Kraus operator is
+ *   sampled.
+ * @return The index of the sampled Kraus operator or channel.size() if
+ *   r is not less than the sum of the lower bounds.
+ */
+template <typename Gate>
+inline std::size_t SampleKrausOperator(const Channel<Gate>& channel,
+                                       double r, double& cp) {
+  for (std::size_t i = 0; i < channel.size(); ++i) {
+    cp += channel[i].prob;
+
+    if (r < cp) {
+      return i;
+    }
+  }
+
+  return channel.size();
+}
+
+/**
+ * Samples a Kraus operator of a "normal" channel using the actual sampling
+ * probabilities of the non-unitary Kraus operators; should be called if
+ * the previous function does not sample any operator.
+ * @param channel The channel.
+ * @param r A random number in [0, 1).
+ * @param cp The sum of the lower bounds of the sampling probabilities.
+ * @param prob Function that returns the actual sampling probability of
+ *   the non-unitary Kraus operator with the given index.
+ * @return The index of the sampled Kraus operator or channel.size() if
+ *   no operator is sampled.
+ */
+template <typename Gate, typename ProbFunc>
+inline std::size_t SampleKrausOperator(const Channel<Gate>& channel,
+                                       double r, double cp, ProbFunc&& prob) {
+  double max_prob = 0;
+  std::size_t max_prob_index = 0;
+
+  for (std::size_t i = 0; i < channel.size(); ++i) {
+    const auto& kop = channel[i];
+
+    if (kop.unitary) continue;
+
+    double p = prob(i);
+
+    if (p > max_prob) {
+      max_prob = p;
+      max_prob_index = i;
+    }
+
+    cp += p - kop.prob;
+
+    if (r < cp || i == channel.size() - 1) {
+      // Sample ith Kraus operator if r < cp
+      // Sample the highest probability Kraus operator if r is greater
+      // than the sum of all probablities due to round-off errors.
+      return r < cp ? i : max_prob_index;
+    }
+  }
+
+  return channel.size();
+}
+
 }  // namespace qsim
 
 #endif  // CHANNEL_H_
@@ -0,0 +1,500 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef CHANNEL_MERGER_H_
+#define CHANNEL_MERGER_H_
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <iterator>
+#include <vector>
+
+#include "channel.h"
+#include "circuit_noisy.h"
+#include "gate.h"
+#include "matrix.h"
+#include "qubit_map.h"
+
+namespace qsim {
+
+/**
+ * Merges channels of noisy circuits to reduce the number of channels that
+ * are sampled in quantum trajectory simulations. Adjacent channels that act
+ * on the same qubits are composed into one channel; the Kraus operators of
+ * the composed channel are the products of the Kraus operators of the
+ * original channels. Vanishing Kraus operators are dropped and Kraus
+ * operators that are proportional to each other are combined into one
+ * operator. Noiseless unitary channels (gates) are merged into adjacent
+ * gates that act on the same or on a larger set of qubits; identity gates
+ * are removed.
+ *
+ * Gates are not merged into noisy channels, so that Pauli channels stay
+ * Pauli channels. Channels with measurement gates, controlled gates,
+ * Pauli rotation gates and swap gates are not merged.
+ *
+ * The operations of merged channels are matrix gates of kind gate::kMatrix,
+ * so the gate set should define GateKind::kMatrix; unmodified channels are
+ * copied as is.
+ *
+ * The merged circuit represents the same quantum operation as the original
+ * circuit. However, quantum trajectories with a given seed are in general
+ * different for the two circuits.
+ */
+template <typename Gate>
+struct ChannelMerger {
+  using fp_type = typename Gate::fp_type;
+
+  /**
+   * User-specified parameters for channel merging.
+   */
+  struct Parameter {
+    /**
+     * Maximum number of qubits of merged channels.
+     */
+    unsigned max_qubits = 2;
+    /**
+     * Maximum number of Kraus operators of merged channels. Channels are not
+     * merged if the composed channel has more Kraus operators.
+     */
+    unsigned max_kraus_operators = 16;
+    /**
+     * Tolerance to detect vanishing and proportional Kraus operators.
+     */
+    double tolerance = 1e-6;
+  };
+
+  /**
+   * Merges channels of the noisy circuit.
+   * @param param Options for channel merging.
+   * @param ncircuit The input noisy circuit.
+   * @return The output noisy circuit.
+   */
+  static NoisyCircuit<Gate> MergeChannels(const Parameter& param,
+                                          const NoisyCircuit<Gate>& ncircuit) {
+    std::vector<MChannel> mchannels;
+    mchannels.reserve(ncircuit.channels.size());
+
+    // The last channel (plus one) that acts on a given qubit.
+    std::vector<std::size_t> last(ncircuit.num_qubits, 0);
+
+    for (std::size_t i = 0; i < ncircuit.channels.size(); ++i) {
+      const auto& channel = ncircuit.channels[i];
+
+      if (!IsMergeable(param, channel)) {
+        mchannels.push_back({i, false, false, 0, {}, {}});
+
+        for (const auto& kop : channel) {
+          for (const auto& op : kop.ops) {
+            for (unsigned q : op.qubits) {
+              last[q] = mchannels.size();
+            }
+
+            for (unsigned q : op.controlled_by) {
+              last[q] = mchannels.size();
+            }
+          }
+        }
+
+        continue;
+      }
+
+      auto mchannel = Convert(param, i, channel);
+
+      std::size_t j = 0;
+      for (unsigned q : mchannel.qubits) {
+        j = std::max(j, last[q]);
+      }
+
+      // The channels can be merged if no other channel acts on their qubits
+      // in between or after them.
+      bool adjacent = j > 0;
+      if (adjacent) {
+        for (unsigned q : mchannels[j - 1].qubits) {
+          adjacent = adjacent && last[q] == j;
+        }
+      }
+
+      if (adjacent && Merge(param, mchannel, mchannels[j - 1])) {
+        for (unsigned q : mchannels[j - 1].qubits) {
+          last[q] = j;
+        }
+      } else {
+        mchannels.push_back(std::move(mchannel));
+
+        for (unsigned q : mchannels.back().qubits) {
+          last[q] = mchannels.size();
+        }
+      }
+    }
+
+    NoisyCircuit<Gate> mcircuit;
+    mcircuit.num_qubits = ncircuit.num_qubits;
+    mcircuit.channels.reserve(mchannels.size());
+
+    for (const auto& mchannel : mchannels) {
+      if (!mchannel.mergeable || !mchannel.modified) {
+        mcircuit.channels.push_back(ncircuit.channels[mchannel.index]);
+      } else if (!IsIdentityGate(param, mchannel)) {
+        mcircuit.channels.push_back(MakeChannel(param, mchannel));
+      }
+    }
+
+    return mcircuit;
+  }
+
+ private:
+  // Kraus operator as a matrix that acts on the channel qubits.
+  struct MKrausOperator {
+    bool unitary;
+    double prob;
+    // U for unitary Kraus operators K = sqrt(prob) U and K otherwise.
+    Matrix<double> matrix;
+  };
+
+  struct MChannel {
+    // Index of the (first) original channel.
+    std::size_t index;
+    bool mergeable;
+    bool modified;
+    unsigned time;
+    // Sorted qubits.
+    std::vector<unsigned> qubits;
+    std::vector<MKrausOperator> kops;
+  };
+
+  static bool IsMergeable(const Parameter& param,
+                          const Channel<Gate>& channel) {
+    if (channel.size() == 0) return false;
+
+    std::vector<unsigned> qubits;
+
+    for (const auto& kop : channel) {
+      if (kop.kind != KrausOperator<Gate>::kNormal) return false;
+
+      for (const auto& op : kop.ops) {
+        if (op.kind == gate::kMeasurement || op.kind == gate::kDecomp
+            || op.kind == gate::kPauliRotation || op.controlled_by.size() > 0
+            || op.matrix.size() != (std::size_t{2} << (2 * op.qubits.size()))
+            || IsSwapGate(op)) {
+          return false;
+        }
+
+        qubits.insert(qubits.end(), op.qubits.begin(), op.qubits.end());
+      }
+    }
+
+    std::sort(qubits.begin(), qubits.end());
+    qubits.erase(std::unique(qubits.begin(), qubits.end()), qubits.end());
+
+    return qubits.size() > 0 && qubits.size() <= param.max_qubits;
+  }
+
+  static MChannel Convert(const Parameter& param, std::size_t index,
+                          const Channel<Gate>& channel) {
+    MChannel mchannel = {index, true, false, 0, {}, {}};
+
+    auto& qubits = mchannel.qubits;
+
+    for (const auto& kop : channel) {
+      for (const auto& op : kop.ops) {
+        if (qubits.empty()) {
+          mchannel.time = op.time;
+        }
+
+        qubits.insert(qubits.end(), op.qubits.begin(), op.qubits.end());
+      }
+    }
+
+    std::sort(qubits.begin(), qubits.end());
+    qubits.erase(std::unique(qubits.begin(), qubits.end()), qubits.end());
+
+    unsigned num_qubits = qubits.size();
+
+    mchannel.kops.reserve(channel.size());
+
+    for (const auto& kop : channel) {
+      MKrausOperator mkop = {kop.unitary, kop.prob, {}};
+      MatrixIdentity(unsigned{1} << num_qubits, mkop.matrix);
+
+      for (const auto& op : kop.ops) {
+        MatrixMultiply(GetMask(op.qubits, qubits), op.qubits.size(),
+                       op.matrix, num_qubits, mkop.matrix);
+      }
+
+      AddKrausOperator(param, num_qubits, std::move(mkop), mchannel.kops);
+    }
+
+    mchannel.modified = mchannel.kops.size() != channel.size();
+
+    return mchannel;
+  }
+
+  // Tries to merge mchannel1 into the preceding channel mchannel0.
+  static bool Merge(const Parameter& param,
+                    const MChannel& mchannel1, MChannel& mchannel0) {
+    if (!mchannel0.mergeable) return false;
+
+    bool gate0 = IsGate(mchannel0);
+    bool gate1 = IsGate(mchannel1);
+
+    const auto& qubits0 = mchannel0.qubits;
+    const auto& qubits1 = mchannel1.qubits;
+
+    std::vector<unsigned> qubits;
+    std::set_union(qubits0.begin(), qubits0.end(),
+                   qubits1.begin(), qubits1.end(),
+                   std::back_inserter(qubits));
+
+    if (gate0 && gate1) {
+      if (qubits.size() != std::max(qubits0.size(), qubits1.size())) {
+        return false;
+      }
+    } else if (gate0 || gate1 || qubits0 != qubits1) {
+      return false;
+    }
+
+    unsigned num_qubits = qubits.size();
+
+    auto kops0 = Expand(num_qubits, qubits, mchannel0);
+    auto kops1 = Expand(num_qubits, qubits, mchannel1);
+
+    std::vector<MKrausOperator> kops;
+    kops.reserve(kops0.size() * kops1.size());
+
+    for (const auto& kop0 : kops0) {
+      for (const auto& kop1 : kops1) {
+        MKrausOperator kop;
+
+        kop.unitary = kop0.unitary && kop1.unitary;
+        // For non-unitary Kraus operators, the product of the lower bounds
+        // is a lower bound.
+        kop.prob = kop0.prob * kop1.prob;
+
+        if (kop.unitary) {
+          kop.matrix = kop0.matrix;
+          MatrixMultiply(num_qubits, kop1.matrix, kop.matrix);
+        } else {
+          kop.matrix = ScaledMatrix(kop0);
+          MatrixMultiply(num_qubits, ScaledMatrix(kop1), kop.matrix);
+        }
+
+        AddKrausOperator(param, num_qubits, std::move(kop), kops);
+
+        if (kops.size() > param.max_kraus_operators) return false;
+      }
+    }
+
+    mchannel0.modified = true;
+    mchannel0.time = std::max(mchannel0.time, mchannel1.time);
+    mchannel0.qubits = std::move(qubits);
+    mchannel0.kops = std::move(kops);
+
+    return true;
+  }
+
+  static bool IsGate(const MChannel& mchannel) {
+    return mchannel.kops.size() == 1 && mchannel.kops[0].unitary;
+  }
+
+  static bool IsIdentityGate(const Parameter& param,
+                             const MChannel& mchannel) {
+    return IsGate(mchannel)
+        && std::abs(mchannel.kops[0].prob - 1) <= param.tolerance
+        && IsIdentity(param, mchannel.kops[0].matrix);
+  }
+
+  static bool IsIdentity(const Parameter& param, const Matrix<double>& m) {
+    unsigned size = unsigned(std::sqrt(m.size() / 2));
+
+    for (unsigned i = 0; i < size; ++i) {
+      for (unsigned j = 0; j < size; ++j) {
+        double re = m[2 * (size * i + j)] - (i == j ? 1 : 0);
+        double im = m[2 * (size * i + j) + 1];
+
+        if (std::abs(re) > param.tolerance || std::abs(im) > param.tolerance) {
+          return false;
+        }
+      }
+    }
+
+    return true;
+  }
+
+  // Gets the mask of qubits in the (sorted) set of all qubits.
+  static unsigned GetMask(const std::vector<unsigned>& qubits,
+                          const std::vector<unsigned>& all_qubits) {
+    unsigned mask = 0;
+
+    for (unsigned q : qubits) {
+      for (unsigned i = 0; i < all_qubits.size(); ++i) {
+        if (q == all_qubits[i]) {
+          mask |= unsigned{1} << i;
+          break;
+        }
+      }
+    }
+
+    return mask;
+  }
+
+  // Gets the Kraus operators of mchannel that act on the given qubits.
+  static std::vector<MKrausOperator> Expand(
+      unsigned num_qubits, const std::vector<unsigned>& qubits,
+      const MChannel& mchannel) {
+    if (mchannel.qubits.size() == num_qubits) return mchannel.kops;
+
+    unsigned mask = GetMask(mchannel.qubits, qubits);
+
+    std::vector<MKrausOperator> kops;
+    kops.reserve(mchannel.kops.size());
+
+    for (const auto& kop : mchannel.kops) {
+      kops.push_back({kop.unitary, kop.prob, {}});
+      MatrixIdentity(unsigned{1} << num_qubits, kops.back().matrix);
+      MatrixMultiply(mask, mchannel.qubits.size(), kop.matrix,
+                     num_qubits, kops.back().matrix);
+    }
+
+    return kops;
+  }
+
+  static Matrix<double> ScaledMatrix(const MKrausOperator& kop) {
+    auto matrix = kop.matrix;
+
+    if (kop.unitary) {
+      MatrixScalarMultiply(std::sqrt(kop.prob), matrix);
+    }
+
+    return matrix;
+  }
+
+  // Adds the Kraus operator to kops unless it vanishes. Combines the Kraus
+  // operator with a proportional operator in kops if there is one.
+  static void AddKrausOperator(const Parameter& param, unsigned num_qubits,
+                               MKrausOperator&& kop,
+                               std::vector<MKrausOperator>& kops) {
+    double tol2 = param.tolerance * param.tolerance;
+
+    // The squared Frobenius norm of K.
+    double norm2 = 0;
+
+    if (kop.unitary) {
+      norm2 = kop.prob * (uint64_t{1} << num_qubits);
+    } else {
+      for (auto v : kop.matrix) {
+        norm2 += v * v;
+      }
+    }
+
+    if (norm2 <= tol2) return;
+
+    for (auto& kop0 : kops) {
+      bool unitary = kop0.unitary && kop.unitary;
+
+      const auto& m0 = unitary ? kop0.matrix : ScaledMatrix(kop0);
+      const auto& m1 = unitary ? kop.matrix : ScaledMatrix(kop);
+
+      std::complex<double> c;
+      if (!IsProportional(param, m0, m1, c)) continue;
+
+      if (unitary) {
+        // sqrt(p0) U + sqrt(p1) c U with |c| = 1.
+        kop0.prob += kop.prob;
+      } else {
+        // K0^\dagger K0 + K1^\dagger K1 = (1 + |c|^2) K0^\dagger K0.
+        kop0.matrix = m0;
+        MatrixScalarMultiply(std::sqrt(1 + std::norm(c)), kop0.matrix);
+        kop0.prob += kop.prob;
+        kop0.unitary = false;
+      }
+
+      return;
+    }
+
+    kops.push_back(std::move(kop));
+  }
+
+  // Checks if m1 = c m0.
+  static bool IsProportional(const Parameter& param, const Matrix<double>& m0,
+                             const Matrix<double>& m1,
+                             std::complex<double>& c) {
+    std::size_t k = 0;
+    double max0 = 0;
+    double max1 = 0;
+
+    for (std::size_t i = 0; i < m0.size(); i += 2) {
+      double a0 = std::norm(std::complex<double>(m0[i], m0[i + 1]));
+      double a1 = std::norm(std::complex<double>(m1[i], m1[i + 1]));
+
+      if (a0 > max0) {
+        max0 = a0;
+        k = i;
+      }
+
+      max1 = std::max(max1, a1);
+    }
+
+    if (max0 == 0) return false;
+
+    c = std::complex<double>(m1[k], m1[k + 1])
+        / std::complex<double>(m0[k], m0[k + 1]);
+
+    double tol = param.tolerance * std::sqrt(max1);
+
+    for (std::size_t i = 0; i < m0.size(); i += 2) {
+      auto d = std::complex<double>(m1[i], m1[i + 1])
+          - c * std::complex<double>(m0[i], m0[i + 1]);
+
+      if (std::abs(d) > tol) return false;
+    }
+
+    return true;
+  }
+
+  static Channel<Gate> MakeChannel(const Parameter& param,
+                                   const MChannel& mchannel) {
+    Channel<Gate> channel;
+    channel.reserve(mchannel.kops.size());
+
+    for (const auto& mkop : mchannel.kops) {
+      channel.push_back({KrausOperator<Gate>::kNormal, mkop.unitary,
+                         mkop.prob, {}});
+      auto& kop = channel.back();
+
+      if (!mkop.unitary || !IsIdentity(param, mkop.matrix)) {
+        kop.ops.push_back({Gate::GateKind::kMatrix, mchannel.time,
+                           mchannel.qubits, {}, 0, {}, {}, false, false});
+
+        auto& op = kop.ops.back();
+        op.matrix.resize(mkop.matrix.size());
+
+        for (std::size_t i = 0; i < mkop.matrix.size(); ++i) {
+          op.matrix[i] = mkop.matrix[i];
+        }
+      }
+
+      if (!mkop.unitary) {
+        kop.CalculateKdKMatrix();
+      }
+    }
+
+    return channel;
+  }
+};
+
+}  // namespace qsim
+
+#endif  // CHANNEL_MERGER_H_
@@ -0,0 +1,537 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DENSITY_MATRIX_H_
+#define DENSITY_MATRIX_H_
+
+#include <algorithm>
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+#include "bits.h"
+#include "channel.h"
+#include "circuit_noisy.h"
+#include "expect.h"
+#include "gate.h"
+#include "gate_appl.h"
+#include "matrix.h"
+#include "util.h"
+
+namespace qsim {
+
+/**
+ * Density matrix simulator for noisy circuits. The density matrix rho of
+ * n qubits is stored as a state vector of 2n qubits ("vectorized" rho):
+ * the element rho_{rc} is the amplitude with index r + 2^n c. A gate U is
+ * applied as U to qubits 0, ..., n - 1 and as its complex conjugate U* to
+ * qubits n, ..., 2n - 1, which gives U rho U^dagger; the gates are fused
+ * and applied by the usual state vector kernels. A channel with Kraus
+ * operators K_k is applied as the sum sum_k K_k rho K_k^dagger, that is,
+ * as the superoperator sum_k K_k (x) K_k* if it acts on at most three
+ * qubits. Measurement gates dephase the measured qubits (the measurement
+ * results are discarded). The results are exact; the simulation of a noisy
+ * circuit takes one pass, but the memory requirements are those of
+ * a state vector of 2n qubits, which limits the number of qubits to about
+ * fourteen.
+ */
+template <typename IO, typename Gate,
+          template <typename, typename> class FuserT, typename Simulator>
+class DensityMatrixSimulator {
+ public:
+  using Fuser = FuserT<IO, const Gate*>;
+  using StateSpace = typename Simulator::StateSpace;
+  using State = typename Simulator::State;
+  using fp_type = typename Gate::fp_type;
+
+  /**
+   * User-specified parameters for gate fusion.
+   */
+  using Parameter = typename Fuser::Parameter;
+
+  /**
+   * Creates a density matrix of num_qubits qubits.
+   * @param num_qubits The number of qubits.
+   * @param state_space StateSpace object required to allocate the state
+   *   vector of 2 * num_qubits qubits.
+   * @return The density matrix; null if there is not enough memory.
+   */
+  static State Create(unsigned num_qubits, const StateSpace& state_space) {
+    auto state = state_space.Create(2 * num_qubits);
+    if (state_space.IsNull(state)) {
+      IO::errorf("not enough memory: is the number of qubits too large?\n");
+    }
+
+    return state;
+  }
+
+  /**
+   * Sets the density matrix to the pure state |i><i| of the computational
+   * basis.
+   * @param state_space StateSpace object required to modify the state.
+   * @param i The index of the basis state.
+   * @param state The density matrix to be set.
+   */
+  static void SetBasisState(const StateSpace& state_space, uint64_t i,
+                            State& state) {
+    unsigned num_qubits = state.num_qubits() / 2;
+
+    state_space.SetAllZeros(state);
+    state_space.SetAmpl(state, i | (i << num_qubits), 1, 0);
+  }
+
+  /**
+   * Runs the given noisy circuit.
+   * @param param Options for gate fusion.
+   * @param circuit The noisy circuit to be simulated.
+   * @param state_space StateSpace object required to manipulate the state.
+   * @param simulator Simulator object. Provides specific implementations for
+   *   applying gates.
+   * @param state The density matrix (created by Create) to be updated by
+   *   this method.
+   * @return True if the simulation completed successfully; false otherwise.
+   */
+  static bool Run(const Parameter& param, const NoisyCircuit<Gate>& circuit,
+                  const StateSpace& state_space, const Simulator& simulator,
+                  State& state) {
+    return Run(param, circuit.num_qubits, circuit.channels.begin(),
+               circuit.channels.end(), state_space, simulator, state);
+  }
+
+  /**
+   * Runs the given noisy circuit.
+   * @param param Options for gate fusion.
+   * @param num_qubits The number of qubits acted on by the circuit.
+   * @param cbeg, cend The range of channels [cbeg, cend) to run the circuit.
+   * @param state_space StateSpace object required to manipulate the state.
+   * @param simulator Simulator object. Provides specific implementations for
+   *   applying gates.
+   * @param state The density matrix (created by Create) to be updated by
+   *   this method.
+   * @return True if the simulation completed successfully; false otherwise.
+   */
+  static bool Run(const Parameter& param, unsigned num_qubits,
+                  ncircuit_iterator<Gate> cbeg, ncircuit_iterator<Gate> cend,
+                  const StateSpace& state_space, const Simulator& simulator,
+                  State& state) {
+    if (state.num_qubits() != 2 * num_qubits) {
+      IO::errorf("density matrix and circuit sizes do not match.\n");
+      return false;
+    }
+
+    // Conjugate gates of the unitary channels; the vector is not resized
+    // after this, so that the gate pointers stay valid.
+    std::vector<Gate> cgates;
+
+    for (auto it = cbeg; it != cend; ++it) {
+      if (IsUnitaryChannel(*it)) {
+        for (const auto& op : (*it)[0].ops) {
+          cgates.push_back(ConjugateGate(num_qubits, op));
+        }
+      }
+    }
+
+    std::vector<const Gate*> gates;
+    gates.reserve(2 * cgates.size());
+
+    std::size_t num_cgates = 0;
+
+    // Scratch states for channels that are applied as sums.
+    State tmp = state_space.Null();
+    State sum = state_space.Null();
+
+    for (auto it = cbeg; it != cend; ++it) {
+      const auto& channel = *it;
+
+      if (channel.size() == 0) continue;
+
+      if (IsUnitaryChannel(channel)) {
+        for (const auto& op : channel[0].ops) {
+          gates.push_back(&op);
+          gates.push_back(&cgates[num_cgates++]);
+        }
+
+        continue;
+      }
+
+      if (!ApplyGates(param, num_qubits, simulator, gates, state)) {
+        return false;
+      }
+
+      if (channel[0].kind == gate::kMeasurement) {
+        ApplyDephasing(num_qubits, simulator, channel[0].ops[0].qubits, state);
+      } else if (!ApplySuperoperator(num_qubits, simulator, channel, state)) {
+        if (state_space.IsNull(tmp)) {
+          tmp = Create(num_qubits, state_space);
+          sum = Create(num_qubits, state_space);
+
+          if (state_space.IsNull(tmp) || state_space.IsNull(sum)) {
+            return false;
+          }
+        }
+
+        ApplyKrausSum(num_qubits, state_space, simulator, channel,
+                      tmp, sum, state);
+      }
+    }
+
+    return ApplyGates(param, num_qubits, simulator, gates, state);
+  }
+
+  /**
+   * @param state_space StateSpace object required to access the state.
+   * @param state The density matrix.
+   * @return The trace of the density matrix.
+   */
+  static std::complex<double> Trace(const StateSpace& state_space,
+                                    const State& state) {
+    unsigned num_qubits = state.num_qubits() / 2;
+    uint64_t size = uint64_t{1} << num_qubits;
+
+    std::complex<double> trace = 0;
+
+    for (uint64_t i = 0; i < size; ++i) {
+      trace += state_space.GetAmpl(state, i | (i << num_qubits));
+    }
+
+    return trace;
+  }
+
+  /**
+   * @param state_space StateSpace object required to access the state.
+   * @param state The density matrix.
+   * @param r, c The row and column indices.
+   * @return The density matrix element rho_{rc}.
+   */
+  static std::complex<fp_type> GetElement(const StateSpace& state_space,
+                                          const State& state,
+                                          uint64_t r, uint64_t c) {
+    return state_space.GetAmpl(state, r | (c << (state.num_qubits() / 2)));
+  }
+
+  /**
+   * Samples bitstrings from the diagonal of the density matrix.
+   * @param state_space StateSpace object required to access the state.
+   * @param state The density matrix.
+   * @param num_samples The number of samples.
+   * @param seed The seed of the random number generator.
+   * @return Sampled bitstrings in ascending order.
+   */
+  static std::vector<uint64_t> Sample(const StateSpace& state_space,
+                                      const State& state,
+                                      uint64_t num_samples, unsigned seed) {
+    std::vector<uint64_t> bitstrings;
+
+    if (num_samples == 0) return bitstrings;
+
+    unsigned num_qubits = state.num_qubits() / 2;
+    uint64_t size = uint64_t{1} << num_qubits;
+
+    std::vector<double> probs;
+    probs.reserve(size);
+
+    double norm = 0;
+
+    for (uint64_t i = 0; i < size; ++i) {
+      // Round-off errors can make diagonal elements slightly negative.
+      double p = std::real(
+          state_space.GetAmpl(state, i | (i << num_qubits)));
+      probs.push_back(std::max(p, 0.0));
+      norm += probs.back();
+    }
+
+    auto rs = GenerateRandomValues<double>(num_samples, seed, norm);
+
+    uint64_t m = 0;
+    double csum = 0;
+    bitstrings.reserve(num_samples);
+
+    for (uint64_t i = 0; i < size; ++i) {
+      csum += probs[i];
+      while (m < num_samples && rs[m] < csum) {
+        bitstrings.emplace_back(i);
+        ++m;
+      }
+    }
+
+    // Round-off errors.
+    while (m++ < num_samples) {
+      bitstrings.emplace_back(size - 1);
+    }
+
+    return bitstrings;
+  }
+
+  /**
+   * Computes the expectation value Tr(O rho) of the sum O of operator
+   * strings (operator sequences). Operators can act on any qubits and they
+   * can be any supported gates.
+   * @param param Options for gate fusion.
+   * @param strings Operator strings.
+   * @param state_space StateSpace object required to copy the state.
+   * @param simulator Simulator object. Provides specific implementations for
+   *   applying gates.
+   * @param state The density matrix.
+   * @param ket Temporary state; it is allocated if it is null.
+   * @return The computed expectation value.
+   */
+  static std::complex<double> ExpectationValue(
+      const Parameter& param, const std::vector<OpString<Gate>>& strings,
+      const StateSpace& state_space, const Simulator& simulator,
+      const State& state, State& ket) {
+    std::complex<double> eval = 0;
+
+    if (state_space.IsNull(ket) || ket.num_qubits() != state.num_qubits()) {
+      ket = Create(state.num_qubits() / 2, state_space);
+      if (state_space.IsNull(ket)) {
+        return eval;
+      }
+    }
+
+    for (const auto& str : strings) {
+      if (str.ops.size() == 0) {
+        eval += str.weight * Trace(state_space, state);
+        continue;
+      }
+
+      state_space.Copy(state, ket);
+
+      // O rho; the operators act on the row qubits.
+      std::vector<const Gate*> gates;
+      gates.reserve(str.ops.size());
+
+      for (const auto& op : str.ops) {
+        gates.push_back(&op);
+      }
+
+      if (!ApplyGates(param, state.num_qubits() / 2, simulator, gates, ket)) {
+        return 0;
+      }
+
+      eval += str.weight * Trace(state_space, ket);
+    }
+
+    return eval;
+  }
+
+ private:
+  static bool IsUnitaryChannel(const Channel<Gate>& channel) {
+    return channel.size() == 1 && channel[0].kind != gate::kMeasurement
+        && channel[0].unitary;
+  }
+
+  /**
+   * Unitary Kraus operators are sqrt(kop.prob) times the product of
+   * the operator gates; the gates of non-unitary Kraus operators are
+   * normalized already.
+   */
+  static double KrausOperatorWeight(const KrausOperator<Gate>& kop) {
+    return kop.unitary ? kop.prob : 1;
+  }
+
+  /**
+   * Returns the complex conjugate of the gate acting on the column qubits.
+   */
+  static Gate ConjugateGate(unsigned num_qubits, const Gate& gate) {
+    Gate cgate = gate;
+
+    for (auto& q : cgate.qubits) {
+      q += num_qubits;
+    }
+
+    for (auto& q : cgate.controlled_by) {
+      q += num_qubits;
+    }
+
+    for (std::size_t i = 1; i < cgate.matrix.size(); i += 2) {
+      cgate.matrix[i] = -cgate.matrix[i];
+    }
+
+    if (cgate.kind == gate::kPauliRotation) {
+      // exp(-i theta P)* = exp(i theta P*) and Y* = -Y.
+      fp_type theta = -cgate.params[0];
+
+      for (std::size_t i = 1; i < cgate.params.size(); ++i) {
+        if (unsigned(cgate.params[i]) == 2) {
+          theta = -theta;
+        }
+      }
+
+      cgate.params[0] = theta;
+    }
+
+    return cgate;
+  }
+
+  static bool ApplyGates(const Parameter& param, unsigned num_qubits,
+                         const Simulator& simulator,
+                         std::vector<const Gate*>& gates, State& state) {
+    if (gates.size() > 0) {
+      auto fgates = Fuser::FuseGates(LimitFusedSize<Simulator>(param),
+                                     2 * num_qubits, gates);
+
+      if (fgates.size() == 0) {
+        return false;
+      }
+
+      for (const auto& fgate : fgates) {
+        ApplyFusedGate(simulator, fgate, state);
+      }
+    }
+
+    gates.resize(0);
+
+    return true;
+  }
+
+  /**
+   * Zeroes the density matrix elements that are off-diagonal in
+   * the measured qubits.
+   */
+  static void ApplyDephasing(unsigned num_qubits, const Simulator& simulator,
+                             const std::vector<unsigned>& qubits,
+                             State& state) {
+    // |0><0| (x) |0><0| + |1><1| (x) |1><1|.
+    Matrix<fp_type> matrix = {1, 0, 0, 0, 0, 0, 0, 0,
+                              0, 0, 0, 0, 0, 0, 0, 0,
+                              0, 0, 0, 0, 0, 0, 0, 0,
+                              0, 0, 0, 0, 0, 0, 1, 0};
+
+    for (auto q : qubits) {
+      detail::ApplyGateMatrix(simulator, {q, q + num_qubits}, {}, 0,
+                              matrix, state);
+    }
+  }
+
+  /**
+   * Applies the channel as the superoperator sum_k K_k (x) K_k* if all
+   * the Kraus operators are products of uncontrolled matrix gates acting on
+   * at most three qubits.
+   * @return True if the channel is applied; false otherwise.
+   */
+  static bool ApplySuperoperator(unsigned num_qubits,
+                                 const Simulator& simulator,
+                                 const Channel<Gate>& channel, State& state) {
+    std::vector<unsigned> qubits;
+
+    for (const auto& kop : channel) {
+      for (const auto& op : kop.ops) {
+        if (op.controlled_by.size() > 0 || op.kind == gate::kPauliRotation) {
+          return false;
+        }
+
+        qubits.insert(qubits.end(), op.qubits.begin(), op.qubits.end());
+      }
+    }
+
+    std::sort(qubits.begin(), qubits.end());
+    qubits.erase(std::unique(qubits.begin(), qubits.end()), qubits.end());
+
+    unsigned m = qubits.size();
+
+    if (m == 0 || m > 3) return false;
+
+    unsigned d = unsigned{1} << m;
+    unsigned dd = d * d;
+
+    std::vector<std::complex<double>> superop(dd * dd, 0);
+
+    Matrix<fp_type> kmatrix;
+
+    for (const auto& kop : channel) {
+      double weight = KrausOperatorWeight(kop);
+
+      MatrixIdentity(d, kmatrix);
+
+      for (const auto& op : kop.ops) {
+        unsigned mask = 0;
+
+        for (auto q : op.qubits) {
+          auto j = std::lower_bound(qubits.begin(), qubits.end(), q)
+              - qubits.begin();
+          mask |= unsigned{1} << j;
+        }
+
+        MatrixMultiply(mask, op.qubits.size(), op.matrix, m, kmatrix);
+      }
+
+      // The row index is r1 + d * c1 and the column index is r2 + d * c2.
+      for (unsigned r1 = 0; r1 < d; ++r1) {
+        for (unsigned r2 = 0; r2 < d; ++r2) {
+          std::complex<double> k1(kmatrix[2 * (d * r1 + r2)],
+                                  kmatrix[2 * (d * r1 + r2) + 1]);
+          if (k1 == 0.0) continue;
+
+          for (unsigned c1 = 0; c1 < d; ++c1) {
+            for (unsigned c2 = 0; c2 < d; ++c2) {
+              std::complex<double> k2(kmatrix[2 * (d * c1 + c2)],
+                                      -kmatrix[2 * (d * c1 + c2) + 1]);
+
+              superop[dd * (r1 + d * c1) + r2 + d * c2] += weight * k1 * k2;
+            }
+          }
+        }
+      }
+    }
+
+    Matrix<fp_type> matrix;
+    matrix.reserve(2 * superop.size());
+
+    for (const auto& s : superop) {
+      matrix.push_back(std::real(s));
+      matrix.push_back(std::imag(s));
+    }
+
+    std::vector<unsigned> qs = qubits;
+    for (auto q : qubits) {
+      qs.push_back(q + num_qubits);
+    }
+
+    detail::ApplyGateMatrix(simulator, qs, {}, 0, matrix, state);
+
+    return true;
+  }
+
+  /**
+   * Applies the channel as the sum sum_k K_k rho K_k^dagger.
+   */
+  static void ApplyKrausSum(unsigned num_qubits, const StateSpace& state_space,
+                            const Simulator& simulator,
+                            const Channel<Gate>& channel,
+                            State& tmp, State& sum, State& state) {
+    state_space.SetAllZeros(sum);
+
+    for (const auto& kop : channel) {
+      state_space.Copy(state, tmp);
+
+      for (const auto& op : kop.ops) {
+        ApplyGate(simulator, op, tmp);
+        ApplyGate(simulator, ConjugateGate(num_qubits, op), tmp);
+      }
+
+      double weight = KrausOperatorWeight(kop);
+      if (weight != 1) {
+        state_space.Multiply(weight, tmp);
+      }
+
+      state_space.Add(tmp, sum);
+    }
+
+    state_space.Copy(sum, state);
+  }
+};
+
+}  // namespace qsim
+
+#endif  // DENSITY_MATRIX_H_
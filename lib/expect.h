@@ -16,6 +16,11 @@
 #define EXPECT_H_
 
 #include <complex>
+#include <cstdint>
+#include <map>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
 #include "fuser.h"
 #include "gate_appl.h"
@@ -28,6 +33,27 @@ struct OpString {
   std::vector<Gate> ops;
 };
 
+/**
+ * A weighted Pauli string: the product of the Pauli operators paulis[k]
+ * (0 for I, 1 for X, 2 for Y and 3 for Z) acting on the qubits qubits[k].
+ */
+struct PauliString {
+  std::complex<double> weight;
+  std::vector<unsigned> qubits;
+  std::vector<unsigned> paulis;
+};
+
+// Checks if the simulator provides Pauli expectation value kernels.
+template <typename Simulator>
+struct HasPauliExpectationKernel {
+  template <typename S>
+  static std::true_type Test(decltype(&S::ExpectationValuesPauli));
+  template <typename S>
+  static std::false_type Test(...);
+
+  static constexpr bool value = decltype(Test<Simulator>(nullptr))::value;
+};
+
 /**
  * Computes the expectation value of the sum of operator strings (operator
  * sequences). Operators can act on any qubits and they can be any supported
@@ -68,7 +94,8 @@ std::complex<double> ExpectationValue(
       const auto& op = str.ops[0];
       simulator.ApplyGate(op.qubits, op.matrix.data(), ket);
     } else {
-      auto fused_gates = Fuser::FuseGates(param, state.num_qubits(), str.ops);
+      auto fused_gates = Fuser::FuseGates(LimitFusedSize<Simulator>(param),
+                                          state.num_qubits(), str.ops);
       if (fused_gates.size() == 0) {
         eval = 0;
         break;
@@ -141,6 +168,75 @@ std::complex<double> ExpectationValue(
   return eval;
 }
 
+/**
+ * Computes the expectation value of the sum of Pauli strings. Pauli strings
+ * can act on any number of qubits. The strings are grouped by their X and Y
+ * operators; the strings in each group share the amplitude pair products
+ * and are evaluated together in read-only passes over the state vector.
+ * Computation is performed in place. No additional state vectors are
+ * allocated.
+ * @param strings Pauli strings.
+ * @param simulator Simulator object. Provides specific implementations for
+ *   computing expectation values of Pauli strings.
+ * @param state The state of the system.
+ * @return The computed expectation value.
+ */
+template <typename IO, typename Simulator>
+std::complex<double> ExpectationValue(
+    const std::vector<PauliString>& strings,
+    const Simulator& simulator, const typename Simulator::State& state) {
+  // Indices of the strings and their Y or Z masks grouped by X or Y masks.
+  std::map<uint64_t, std::pair<std::vector<std::size_t>,
+                               std::vector<uint64_t>>> groups;
+
+  for (std::size_t i = 0; i < strings.size(); ++i) {
+    const auto& str = strings[i];
+
+    if (str.qubits.size() != str.paulis.size()) {
+      IO::errorf("numbers of qubits and Pauli operators do not match; "
+                 "cannot compute the expectation value.\n");
+      return 0;
+    }
+
+    uint64_t mask = 0;
+    uint64_t xmask = 0;
+    uint64_t zmask = 0;
+
+    for (std::size_t k = 0; k < str.qubits.size(); ++k) {
+      unsigned q = str.qubits[k];
+      unsigned p = str.paulis[k];
+
+      if (q >= state.num_qubits() || ((mask >> q) & 1) != 0 || p > 3) {
+        IO::errorf("invalid Pauli string; "
+                   "cannot compute the expectation value.\n");
+        return 0;
+      }
+
+      mask |= uint64_t{1} << q;
+      if (p == 1 || p == 2) xmask |= uint64_t{1} << q;
+      if (p == 2 || p == 3) zmask |= uint64_t{1} << q;
+    }
+
+    auto& group = groups[xmask];
+    group.first.push_back(i);
+    group.second.push_back(zmask);
+  }
+
+  std::complex<double> eval = 0;
+
+  for (const auto& group : groups) {
+    const auto& indices = group.second.first;
+    auto r = simulator.ExpectationValuesPauli(
+        group.first, group.second.second, state);
+
+    for (std::size_t k = 0; k < indices.size(); ++k) {
+      eval += strings[indices[k]].weight * r[k];
+    }
+  }
+
+  return eval;
+}
+
 }  // namespace qsim
 
 #endif  // EXPECT_H_
@@ -15,7 +15,12 @@
 #ifndef FORMUX_H_
 #define FORMUX_H_
 
-#ifdef _OPENMP
+#if defined(QSIM_USE_THREAD_POOL)
+# include "poolfor.h"
+  namespace qsim {
+    using For = PoolFor;
+  }
+#elif defined(_OPENMP)
 # include "parfor.h"
   namespace qsim {
     using For = ParallelFor;
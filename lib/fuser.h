@@ -18,6 +18,7 @@
 #include <cstdint>
 #include <vector>
 
+#include "bits.h"
 #include "gate.h"
 #include "matrix.h"
 
@@ -135,28 +136,109 @@ class Fuser {
   }
 };
 
+namespace detail {
+
+/**
+ * Gets the mask of component gate qubits in the fused gate qubit space.
+ */
+template <typename FusedGate, typename Gate>
+inline unsigned GetFusedQubitMask(const FusedGate& gate, const Gate& pgate) {
+  unsigned mask = 0;
+
+  for (auto q : pgate.qubits) {
+    for (std::size_t i = 0; i < gate.qubits.size(); ++i) {
+      if (q == gate.qubits[i]) {
+        mask |= unsigned{1} << i;
+        break;
+      }
+    }
+  }
+
+  return mask;
+}
+
+/**
+ * Multiplies component gate matrices of a fused gate if all of them are
+ * generalized permutation matrices. The product is calculated in permutation
+ * form, which is much cheaper than dense matrix multiplication.
+ * @param gate Fused gate.
+ * @return True if the fused matrix was calculated; false otherwise.
+ */
+template <typename FusedGate>
+inline bool CalculateFusedPermutationMatrix(FusedGate& gate) {
+  using fp_type = typename decltype(gate.matrix)::value_type;
+
+  unsigned q = gate.qubits.size();
+  unsigned n = unsigned{1} << q;
+
+  std::vector<unsigned> perm(n);
+  std::vector<fp_type> phases(2 * n, 0);
+
+  for (unsigned i = 0; i < n; ++i) {
+    perm[i] = i;
+    phases[2 * i] = 1;
+  }
+
+  std::vector<unsigned> perm1;
+  std::vector<fp_type> phases1;
+  std::vector<unsigned> perm2(n);
+  std::vector<fp_type> phases2(2 * n);
+
+  for (auto pgate : gate.gates) {
+    unsigned q1 = pgate->qubits.size();
+
+    if (!MatrixGetPermutation(unsigned{1} << q1, pgate->matrix,
+                              perm1, phases1)) {
+      return false;
+    }
+
+    unsigned mask = GetFusedQubitMask(gate, *pgate);
+
+    // Row i of the product has the nonzero element in the column of row k
+    // of the previous product, where k is obtained from i by the component
+    // gate permutation.
+    for (unsigned i = 0; i < n; ++i) {
+      unsigned si = bits::CompressBits(i, q, mask);
+      unsigned k = bits::ExpandBits(perm1[si], q, mask) | (i & ~mask);
+
+      fp_type r1 = phases1[2 * si];
+      fp_type i1 = phases1[2 * si + 1];
+      fp_type r2 = phases[2 * k];
+      fp_type i2 = phases[2 * k + 1];
+
+      perm2[i] = perm[k];
+      phases2[2 * i] = r1 * r2 - i1 * i2;
+      phases2[2 * i + 1] = r1 * i2 + i1 * r2;
+    }
+
+    perm.swap(perm2);
+    phases.swap(phases2);
+  }
+
+  MatrixFromPermutation(n, perm, phases, gate.matrix);
+
+  return true;
+}
+
+}  // namespace detail
+
 /**
  * Multiplies component gate matrices of a fused gate.
  * @param gate Fused gate.
  */
 template <typename FusedGate>
 inline void CalculateFusedMatrix(FusedGate& gate) {
+  if (detail::CalculateFusedPermutationMatrix(gate)) {
+    return;
+  }
+
   MatrixIdentity(unsigned{1} << gate.qubits.size(), gate.matrix);
 
   for (auto pgate : gate.gates) {
     if (gate.qubits.size() == pgate->qubits.size()) {
       MatrixMultiply(gate.qubits.size(), pgate->matrix, gate.matrix);
     } else {
-      unsigned mask = 0;
-
-      for (auto q : pgate->qubits) {
-        for (std::size_t i = 0; i < gate.qubits.size(); ++i) {
-          if (q == gate.qubits[i]) {
-            mask |= unsigned{1} << i;
-            break;
-          }
-        }
-      }
+      unsigned mask = detail::GetFusedQubitMask(gate, *pgate);
 
       MatrixMultiply(mask, pgate->qubits.size(), pgate->matrix,
                      gate.qubits.size(), gate.matrix);
@@ -171,7 +253,7 @@ inline void CalculateFusedMatrix(FusedGate& gate) {
 template <typename Iterator>
 inline void CalculateFusedMatrices(Iterator gbeg, Iterator gend) {
   for (auto g = gbeg; g != gend; ++g) {
-    if (g->kind != gate::kMeasurement) {
+    if (g->kind != gate::kMeasurement && g->kind != gate::kPauliRotation) {
       CalculateFusedMatrix(*g);
     }
   }
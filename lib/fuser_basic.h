@@ -28,8 +28,9 @@ namespace qsim {
 /**
  * Stateless object with methods for aggregating `Gate`s into `GateFused`.
  * Measurement gates with equal times are fused together.
- * User-defined controlled gates (controlled_by.size() > 0) and gates acting on
- * more than two qubits are not fused.
+ * User-defined controlled gates (controlled_by.size() > 0), Pauli rotation
+ * gates (see gate::PauliRotation) and gates acting on more than two qubits
+ * are not fused.
  * The template parameter Gate can be Gate type or a pointer to Gate type.
  * This class is deprecated. It is recommended to use MultiQubitGateFuser
  * from fuser_mqubit.h.
@@ -195,7 +196,8 @@ class BasicGateFuser final : public Fuser<IO, Gate> {
           }
 
           mea_gates_at_time.push_back(&gate);
-        } else if (gate.controlled_by.size() > 0 || gate.qubits.size() > 2) {
+        } else if (gate.controlled_by.size() > 0 || gate.qubits.size() > 2
+                   || gate.kind == gate::kPauliRotation) {
           for (auto q : gate.qubits) {
             gates_lat[q].push_back(&gate);
           }
@@ -224,8 +226,9 @@ class BasicGateFuser final : public Fuser<IO, Gate> {
         if (pgate->kind == gate::kMeasurement) {
           delayed_measurement_gate = pgate;
         } else if (pgate->qubits.size() > 2
-                   || pgate->controlled_by.size() > 0) {
-          // Multi-qubit or controlled gate.
+                   || pgate->controlled_by.size() > 0
+                   || pgate->kind == gate::kPauliRotation) {
+          // Multi-qubit, controlled or Pauli rotation gate.
 
           for (auto q : pgate->qubits) {
             unsigned l = last[q];
@@ -311,7 +314,8 @@ class BasicGateFuser final : public Fuser<IO, Gate> {
 
     if (fuse_matrix) {
       for (auto& gate_f : gates_fused) {
-        if (gate_f.kind != gate::kMeasurement && gate_f.kind != gate::kDecomp) {
+        if (gate_f.kind != gate::kMeasurement && gate_f.kind != gate::kDecomp
+            && gate_f.kind != gate::kPauliRotation) {
           CalculateFusedMatrix(gate_f);
         }
       }
@@ -324,7 +328,8 @@ class BasicGateFuser final : public Fuser<IO, Gate> {
   static unsigned Advance(unsigned k, const std::vector<const RGate*>& wl,
                           std::vector<const RGate*>& gates) {
     while (k < wl.size() && wl[k]->qubits.size() == 1
-           && wl[k]->controlled_by.size() == 0 && !wl[k]->unfusible) {
+           && wl[k]->controlled_by.size() == 0 && !wl[k]->unfusible
+           && wl[k]->kind != gate::kPauliRotation) {
       gates.push_back(wl[k++]);
     }
 
@@ -339,7 +344,8 @@ class BasicGateFuser final : public Fuser<IO, Gate> {
   static bool NextGate(unsigned k1, const std::vector<const RGate*>& wl1,
                        unsigned k2, const std::vector<const RGate*>& wl2) {
     return k1 < wl1.size() && k2 < wl2.size() && wl1[k1] == wl2[k2]
-        && wl1[k1]->qubits.size() < 3 && wl1[k1]->controlled_by.size() == 0;
+        && wl1[k1]->qubits.size() < 3 && wl1[k1]->controlled_by.size() == 0
+        && wl1[k1]->kind != gate::kPauliRotation;
   }
 
   template <typename GatesLat>
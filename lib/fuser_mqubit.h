@@ -17,6 +17,7 @@
 
 #include <algorithm>
 #include <cstdint>
+#include <deque>
 #include <limits>
 #include <type_traits>
 #include <utility>
@@ -31,6 +32,7 @@ namespace qsim {
  * Multi-qubit gate fuser.
  * Measurement gates with equal times are fused together.
  * User-defined controlled gates (controlled_by.size() > 0) are not fused.
+ * Pauli rotation gates (see gate::PauliRotation) are not fused.
  * The template parameter Gate can be Gate type or a pointer to Gate type.
  */
 template <typename IO, typename Gate>
@@ -113,6 +115,7 @@ class MultiQubitGateFuser final : public Fuser<IO, Gate> {
     unsigned num_fused_mea_gates = 0;
     unsigned num_fused_gates = 0;
     unsigned num_controlled_gates = 0;
+    unsigned num_pauli_rotation_gates = 0;
     std::vector<unsigned> num_gates;
   };
 
@@ -123,12 +126,15 @@ class MultiQubitGateFuser final : public Fuser<IO, Gate> {
     std::vector<Link*> links;      // Added lattice links.
   };
 
+  // The maximum number of "next" and "prev" gate pairs that are added to
+  // a gate sequence (see FindLongestGateSequence).
+  static constexpr unsigned kMaxSequenceDepth = 3;
+
   struct Scratch {
-    std::vector<GateA> data;
-    std::vector<GateA*> prev1;
-    std::vector<GateA*> prev2;
-    std::vector<GateA*> next1;
-    std::vector<GateA*> next2;
+    // Elements are referenced by pointers; a deque does not invalidate them.
+    std::deque<GateA> data;
+    std::vector<GateA*> prev[kMaxSequenceDepth];
+    std::vector<GateA*> next[kMaxSequenceDepth];
     std::vector<GateA*> longest_seq;
     std::vector<GateA*> stack;
     std::vector<GateF*> gates;
@@ -144,8 +150,10 @@ class MultiQubitGateFuser final : public Fuser<IO, Gate> {
   struct Parameter {
     /**
      * Maximum number of qubits in a fused gate. It can take values from 2 to
-     * 6 (0 and 1 are equivalent to 2). It is not recommended to use 5 or 6 as
-     * that might degrade performance for not very fast machines.
+     * 8 (0 and 1 are equivalent to 2). It is not recommended to use 5 or more
+     * as that might degrade performance for not very fast machines. Values 7
+     * and 8 are supported by CPU simulators only; the simulation runners
+     * limit the size of fused gates to six qubits for GPU simulators.
      */
     unsigned max_fused_size = 2;
     unsigned verbosity = 0;
@@ -268,18 +276,17 @@ class MultiQubitGateFuser final : public Fuser<IO, Gate> {
 
     Scratch scratch;
 
-    scratch.data.reserve(1024);
-    scratch.prev1.reserve(32);
-    scratch.prev2.reserve(32);
-    scratch.next1.reserve(32);
-    scratch.next2.reserve(32);
+    for (unsigned i = 0; i < kMaxSequenceDepth; ++i) {
+      scratch.prev[i].reserve(32);
+      scratch.next[i].reserve(32);
+    }
     scratch.longest_seq.reserve(8);
     scratch.stack.reserve(8);
 
     Stat stat;
     stat.num_gates.resize(max_qubit1 + 1, 0);
 
-    unsigned max_fused_size = std::min(unsigned{6}, param.max_fused_size);
+    unsigned max_fused_size = std::min(unsigned{8}, param.max_fused_size);
     max_fused_size = std::min(max_fused_size, max_qubit1);
 
     auto gate_it = gfirst;
@@ -338,7 +345,8 @@ class MultiQubitGateFuser final : public Fuser<IO, Gate> {
           gates_seq.push_back({&gate, {}, {}, {}, 0, kZero});
           auto& fgate = gates_seq.back();
 
-          if (gate.controlled_by.size() == 0) {
+          if (gate.controlled_by.size() == 0
+              && gate.kind != gate::kPauliRotation) {
             if (max_gate_size < gate.qubits.size()) {
               max_gate_size = gate.qubits.size();
             }
@@ -358,8 +366,8 @@ class MultiQubitGateFuser final : public Fuser<IO, Gate> {
 
             ++stat.num_gates[num_gate_qubits];
           } else {
-            // Controlled gate.
-            // Controlled gates are not fused with other gates.
+            // Controlled gate or Pauli rotation gate.
+            // These gates are not fused with other gates.
 
             uint64_t size = gate.qubits.size() + gate.controlled_by.size();
 
@@ -369,7 +377,11 @@ class MultiQubitGateFuser final : public Fuser<IO, Gate> {
             fgate.visited = kMeaCnt;
             fgate.gates.push_back(&gate);
 
-            ++stat.num_controlled_gates;
+            if (gate.kind == gate::kPauliRotation) {
+              ++stat.num_pauli_rotation_gates;
+            } else {
+              ++stat.num_controlled_gates;
+            }
           }
 
           for (auto q : gate.qubits) {
@@ -436,7 +448,8 @@ class MultiQubitGateFuser final : public Fuser<IO, Gate> {
 
     if (fuse_matrix) {
       for (auto& fgate : fused_gates) {
-        if (fgate.kind != gate::kMeasurement && fgate.kind != gate::kDecomp) {
+        if (fgate.kind != gate::kMeasurement && fgate.kind != gate::kDecomp
+            && fgate.kind != gate::kPauliRotation) {
           CalculateFusedMatrix(fgate);
         }
       }
@@ -481,6 +494,10 @@ class MultiQubitGateFuser final : public Fuser<IO, Gate> {
   // max_fused_size = 5: _-_-  or  -_-_
   //
   // max_fused_size = 6: _-_-_
+  //
+  // max_fused_size = 7: _-_-_-  or  -_-_-_
+  //
+  // max_fused_size = 8: _-_-_-_
   static void FuseGateSequences(unsigned max_fused_size,
                                 unsigned max_qubit1, Scratch& scratch,
                                 std::vector<GateF>& gates_seq, Stat& stat,
@@ -623,6 +640,10 @@ class MultiQubitGateFuser final : public Fuser<IO, Gate> {
       p->gate->visited = kCompress;
 
       for (auto q : p->qubits) {
+        // Added qubits are computed relative to adjacent gates only; skip
+        // qubits that are already acted on by other gates of the sequence.
+        if ((fgate.mask & (uint64_t{1} << q)) != 0) continue;
+
         fgate.qubits.push_back(q);
         fgate.mask |= uint64_t{1} << q;
       }
@@ -647,22 +668,13 @@ class MultiQubitGateFuser final : public Fuser<IO, Gate> {
       p->gate->visited = level;
     }
 
-    if (longest_seq.size() >= 3) {
-      AddGatesFromNext(longest_seq[2]->gate->gates, fgate);
-    }
-
-    if (longest_seq.size() >= 5) {
-      AddGatesFromNext(longest_seq[4]->gate->gates, fgate);
+    for (std::size_t i = 2; i < longest_seq.size(); i += 2) {
+      AddGatesFromNext(longest_seq[i]->gate->gates, fgate);
     }
 
-    if (longest_seq.size() >= 2) {
+    for (std::size_t i = 1; i < longest_seq.size(); i += 2) {
       // May call MakeGateSequence recursively.
-      AddGatesFromPrev(max_fused_size, *longest_seq[1]->gate, scratch, fgate);
-    }
-
-    if (longest_seq.size() >= 4) {
-      // May call MakeGateSequence recursively.
-      AddGatesFromPrev(max_fused_size, *longest_seq[3]->gate, scratch, fgate);
+      AddGatesFromPrev(max_fused_size, *longest_seq[i]->gate, scratch, fgate);
     }
 
     for (auto p : longest_seq) {
@@ -712,90 +724,84 @@ class MultiQubitGateFuser final : public Fuser<IO, Gate> {
 
     unsigned max_size = cur_size;
 
+    // Sequences of up to six qubits need two "next" and "prev" gate pairs:
+    // _-_-_; longer sequences need three pairs: _-_-_-_.
+    unsigned depth = max_fused_size > 6 ? 3 : 2;
+
     GetNextAvailableGates(max_fused_size, cur_size, fgate, nullptr,
-                          scratch.data, scratch.next1);
+                          scratch.data, scratch.next[0]);
 
-    for (auto n1 : scratch.next1) {
-      unsigned cur_size2 = cur_size + n1->qubits.size();
+    ExtendGateSequence(max_fused_size, level, 0, depth, cur_size, max_size,
+                       fgate, scratch);
+  }
+
+  // Extends the sequence in scratch.stack by a "next" gate from
+  // scratch.next[k] and by a "prev" gate of that "next" gate, then recurses
+  // to the following pair. ngate is the "next" gate of the previous pair (the
+  // first gate of the sequence for k = 0). Returns true if a sequence of
+  // max_fused_size qubits is found; it is stored in scratch.longest_seq.
+  static bool ExtendGateSequence(unsigned max_fused_size, unsigned level,
+                                 unsigned k, unsigned depth, unsigned& cur_size,
+                                 unsigned& max_size, const GateF& ngate,
+                                 Scratch& scratch) {
+    for (auto n : scratch.next[k]) {
+      unsigned cur_size2 = cur_size + n->qubits.size();
       if (cur_size2 > max_fused_size) continue;
 
       bool feasible = GetPrevAvailableGates(max_fused_size, cur_size,
-                                            level, *n1->gate, nullptr,
-                                            scratch.data, scratch.prev1);
+                                            level, *n->gate,
+                                            k == 0 ? nullptr : &ngate,
+                                            scratch.data, scratch.prev[k]);
 
       if (!feasible) continue;
 
-      if (scratch.prev1.size() == 0 && max_fused_size > 3) continue;
+      if (k == 0 && scratch.prev[k].size() == 0 && max_fused_size > 3) {
+        continue;
+      }
 
       if (cur_size2 == max_fused_size) {
         std::swap(scratch.longest_seq, scratch.stack);
-        scratch.longest_seq.push_back(n1);
-        return;
+        scratch.longest_seq.push_back(n);
+        return true;
       }
 
-      Push(level, cur_size2, cur_size, max_size, scratch, n1);
+      Push(level, cur_size2, cur_size, max_size, scratch, n);
 
-      for (auto p1 : scratch.prev1) {
-        unsigned cur_size2 = cur_size + p1->qubits.size();
+      for (auto p : scratch.prev[k]) {
+        unsigned cur_size2 = cur_size + p->qubits.size();
 
         if (cur_size2 > max_fused_size) {
           continue;
         } else if (cur_size2 == max_fused_size) {
           std::swap(scratch.longest_seq, scratch.stack);
-          scratch.longest_seq.push_back(p1);
-          return;
+          scratch.longest_seq.push_back(p);
+          return true;
         }
 
-        Push(level, cur_size2, cur_size, max_size, scratch, p1);
-
-        GetNextAvailableGates(max_fused_size, cur_size, *p1->gate, &fgate,
-                              scratch.data, scratch.next2);
-
-        for (auto n2 : scratch.next2) {
-          unsigned cur_size2 = cur_size + n2->qubits.size();
-          if (cur_size2 > max_fused_size) continue;
-
-          bool feasible = GetPrevAvailableGates(max_fused_size, cur_size,
-                                                level, *n2->gate, n1->gate,
-                                                scratch.data, scratch.prev2);
+        if (k + 1 < depth) {
+          Push(level, cur_size2, cur_size, max_size, scratch, p);
 
-          if (!feasible) continue;
+          GetNextAvailableGates(max_fused_size, cur_size, *p->gate, &ngate,
+                                scratch.data, scratch.next[k + 1]);
 
-          if (cur_size2 == max_fused_size) {
-            std::swap(scratch.longest_seq, scratch.stack);
-            scratch.longest_seq.push_back(n2);
-            return;
+          if (ExtendGateSequence(max_fused_size, level, k + 1, depth,
+                                 cur_size, max_size, *n->gate, scratch)) {
+            return true;
           }
 
-          Push(level, cur_size2, cur_size, max_size, scratch, n2);
-
-          for (auto p2 : scratch.prev2) {
-            unsigned cur_size2 = cur_size + p2->qubits.size();
-
-            if (cur_size2 > max_fused_size) {
-              continue;
-            } else if (cur_size2 == max_fused_size) {
-              std::swap(scratch.longest_seq, scratch.stack);
-              scratch.longest_seq.push_back(p2);
-              return;
-            }
-
-            if (cur_size2 > max_size) {
-              scratch.stack.push_back(p2);
-              scratch.longest_seq = scratch.stack;
-              scratch.stack.pop_back();
-              max_size = cur_size2;
-            }
-          }
-
-          Pop(cur_size, scratch, n2);
+          Pop(cur_size, scratch, p);
+        } else if (cur_size2 > max_size) {
+          scratch.stack.push_back(p);
+          scratch.longest_seq = scratch.stack;
+          scratch.stack.pop_back();
+          max_size = cur_size2;
         }
-
-        Pop(cur_size, scratch, p1);
       }
 
-      Pop(cur_size, scratch, n1);
+      Pop(cur_size, scratch, n);
     }
+
+    return false;
   }
 
   static void Push(unsigned level, unsigned cur_size2, unsigned& cur_size,
@@ -818,7 +824,7 @@ class MultiQubitGateFuser final : public Fuser<IO, Gate> {
 
   static void GetNextAvailableGates(unsigned max_fused_size, unsigned cur_size,
                                     const GateF& pgate1, const GateF* pgate2,
-                                    std::vector<GateA>& scratch,
+                                    std::deque<GateA>& scratch,
                                     std::vector<GateA*>& next_gates) {
     next_gates.resize(0);
 
@@ -845,7 +851,7 @@ class MultiQubitGateFuser final : public Fuser<IO, Gate> {
   static bool GetPrevAvailableGates(unsigned max_fused_size,
                                     unsigned cur_size, unsigned level,
                                     const GateF& ngate1, const GateF* ngate2,
-                                    std::vector<GateA>& scratch,
+                                    std::deque<GateA>& scratch,
                                     std::vector<GateA*>& prev_gates) {
     prev_gates.resize(0);
 
@@ -1005,6 +1011,11 @@ class MultiQubitGateFuser final : public Fuser<IO, Gate> {
       IO::messagef("%lu controlled gates\n", stat.num_controlled_gates);
     }
 
+    if (stat.num_pauli_rotation_gates > 0) {
+      IO::messagef("%lu Pauli rotation gates\n",
+                   stat.num_pauli_rotation_gates);
+    }
+
     if (stat.num_mea_gates > 0) {
       IO::messagef("%lu measurement gates", stat.num_mea_gates);
       if (stat.num_fused_mea_gates == stat.num_mea_gates) {
@@ -16,10 +16,12 @@
 #define GATE_H_
 
 #include <algorithm>
+#include <cmath>
 #include <cstdint>
 #include <utility>
 #include <vector>
 
+#include "bits.h"
 #include "matrix.h"
 
 namespace qsim {
@@ -111,6 +113,9 @@ namespace gate {
 
 constexpr int kDecomp = 100001;       // gate from Schmidt decomposition
 constexpr int kMeasurement = 100002;  // measurement gate
+constexpr int kPauliRotation = 100003;  // rotation about a Pauli string
+constexpr int kMatrix = 100004;  // matrix gate that is not of a specific kind,
+                                 // for instance, a product of gates
 
 }  // namespace gate
 
@@ -202,6 +207,123 @@ struct Measurement {
   }
 };
 
+/**
+ * The rotation exp(-i theta P) about a Pauli string P (a tensor product of
+ * Pauli operators) of arbitrary weight. The gate parameters are theta
+ * followed by the Pauli operators acting on the gate qubits: 1 for X,
+ * 2 for Y and 3 for Z. The gate matrix is set only for gates that act
+ * on at most kMaxMatrixQubits qubits. Simulators that provide
+ * ApplyPauliRotation apply the gate in one pass over the state vector;
+ * see ApplyGate in gate_appl.h. Pauli rotations are not fused with
+ * other gates.
+ */
+template <typename Gate>
+struct PauliRotation {
+  using GateKind = typename Gate::GateKind;
+  using fp_type = typename Gate::fp_type;
+
+  static constexpr GateKind kind = GateKind::kPauliRotation;
+  static constexpr char name[] = "pauli_rotation";
+  static constexpr bool symmetric = false;
+
+  static constexpr unsigned kMaxMatrixQubits = 6;
+
+  /**
+   * @param time The time to place the gate at.
+   * @param qubits The qubits the Pauli operators act on.
+   * @param paulis The Pauli operators: 0 for I, 1 for X, 2 for Y and 3 for Z.
+   *   Identities are dropped. At least one operator should not be
+   *   the identity.
+   * @param theta The rotation angle.
+   */
+  static Gate Create(unsigned time, const std::vector<unsigned>& qubits,
+                     const std::vector<unsigned>& paulis, fp_type theta) {
+    // Assume qubits.size() == paulis.size().
+
+    std::vector<std::pair<unsigned, unsigned>> ops;
+    ops.reserve(qubits.size());
+
+    for (std::size_t i = 0; i < qubits.size(); ++i) {
+      if (paulis[i] != 0) {
+        ops.push_back({qubits[i], paulis[i]});
+      }
+    }
+
+    std::sort(ops.begin(), ops.end());
+
+    std::vector<unsigned> qs;
+    std::vector<unsigned> ps;
+    qs.reserve(ops.size());
+    ps.reserve(ops.size());
+
+    for (const auto& op : ops) {
+      qs.push_back(op.first);
+      ps.push_back(op.second);
+    }
+
+    std::vector<fp_type> params;
+    params.reserve(ps.size() + 1);
+    params.push_back(theta);
+
+    for (auto p : ps) {
+      params.push_back(p);
+    }
+
+    Matrix<fp_type> matrix;
+
+    if (qs.size() <= kMaxMatrixQubits) {
+      CalculateMatrix(ps, theta, matrix);
+    }
+
+    return {kind, time, std::move(qs), {}, 0, std::move(params),
+            std::move(matrix), false, false};
+  }
+
+  /**
+   * Calculates the matrix of exp(-i theta P) = cos(theta) I - i sin(theta) P.
+   * @param paulis The Pauli operators (1 for X, 2 for Y and 3 for Z); the k-th
+   *   operator acts on the k-th (least significant) bit of the matrix index.
+   * @param theta The rotation angle.
+   * @param matrix The output matrix.
+   */
+  static void CalculateMatrix(const std::vector<unsigned>& paulis,
+                              fp_type theta, Matrix<fp_type>& matrix) {
+    unsigned n = paulis.size();
+    unsigned size = 1 << n;
+
+    unsigned xmask = 0;
+    unsigned zmask = 0;
+    unsigned ny = 0;
+
+    for (unsigned k = 0; k < n; ++k) {
+      if (paulis[k] == 1 || paulis[k] == 2) xmask |= 1 << k;
+      if (paulis[k] == 2 || paulis[k] == 3) zmask |= 1 << k;
+      if (paulis[k] == 2) ++ny;
+    }
+
+    fp_type c = std::cos(theta);
+    fp_type s = std::sin(theta);
+
+    // P|i> = i^ny (-1)^popcount(i & zmask) |i ^ xmask>; -i^(ny + 1) is
+    // the phase of the off-diagonal part for even popcount(i & zmask).
+    fp_type pr = (ny & 1) == 0 ? 0 : ((ny & 2) == 0 ? s : -s);
+    fp_type pi = (ny & 1) == 1 ? 0 : ((ny & 2) == 0 ? -s : s);
+
+    matrix.resize(0);
+    matrix.resize(2 * size * size, 0);
+
+    for (unsigned i = 0; i < size; ++i) {
+      unsigned j = i ^ xmask;
+      fp_type sign = bits::Parity(i & zmask) == 0 ? 1 : -1;
+
+      matrix[2 * (size * j + i)] = sign * pr;
+      matrix[2 * (size * j + i) + 1] = sign * pi;
+
+      matrix[2 * (size * i + i)] += c;
+    }
+  }
+};
+
 }  // namespace gate
 
 template <typename fp_type>
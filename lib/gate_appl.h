@@ -15,15 +15,437 @@
 #ifndef GATE_APPL_H_
 #define GATE_APPL_H_
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iterator>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
+#include "bits.h"
 #include "fuser.h"
 #include "gate.h"
 #include "matrix.h"
 
 namespace qsim {
 
+namespace detail {
+
+// Checks if the simulator provides a dedicated diagonal gate kernel.
+template <typename Simulator>
+struct HasDiagonalGateKernel {
+  template <typename S>
+  static std::true_type Test(decltype(&S::ApplyDiagonalGate));
+  template <typename S>
+  static std::false_type Test(...);
+
+  static constexpr bool value = decltype(Test<Simulator>(nullptr))::value;
+};
+
+// Checks if the simulator provides a dedicated permutation gate kernel.
+template <typename Simulator>
+struct HasPermutationGateKernel {
+  template <typename S>
+  static std::true_type Test(decltype(&S::ApplyPermutationGate));
+  template <typename S>
+  static std::false_type Test(...);
+
+  static constexpr bool value = decltype(Test<Simulator>(nullptr))::value;
+};
+
+// Checks if the simulator provides a dedicated Pauli rotation kernel.
+template <typename Simulator>
+struct HasPauliRotationKernel {
+  template <typename S>
+  static std::true_type Test(decltype(&S::ApplyPauliRotation));
+  template <typename S>
+  static std::false_type Test(...);
+
+  static constexpr bool value = decltype(Test<Simulator>(nullptr))::value;
+};
+
+// Checks if the gate has parameters. Pauli rotation gates keep their Pauli
+// operators in the gate parameters.
+template <typename Gate>
+struct HasGateParams {
+  template <typename G>
+  static std::true_type Test(decltype(&G::params));
+  template <typename G>
+  static std::false_type Test(...);
+
+  static constexpr bool value = decltype(Test<Gate>(nullptr))::value;
+};
+
+// The maximum number of qubits of gates that the simulator can apply.
+// Simulators that apply gates on fewer than eight qubits define
+// kMaxGateQubits.
+template <typename Simulator>
+struct MaxGateQubits {
+  template <typename S>
+  static std::integral_constant<unsigned, S::kMaxGateQubits> Test(
+      decltype(&S::kMaxGateQubits));
+  template <typename S>
+  static std::integral_constant<unsigned, 8> Test(...);
+
+  static constexpr unsigned value = decltype(Test<Simulator>(nullptr))::value;
+};
+
+// Checks if the fuser parameters limit the size of fused gates.
+template <typename Parameter>
+struct HasMaxFusedSize {
+  template <typename P>
+  static std::true_type Test(decltype(&P::max_fused_size));
+  template <typename P>
+  static std::false_type Test(...);
+
+  static constexpr bool value = decltype(Test<Parameter>(nullptr))::value;
+};
+
+// The maximum number of qubits of gates that are applied by permutation
+// gate kernels and of controlled gates (target and control qubits) that are
+// applied by diagonal or permutation gate kernels. Uncontrolled diagonal
+// gates are applied by diagonal gate kernels regardless of their size.
+constexpr unsigned kMaxControlledPermutationGateQubits = 6;
+
+template <typename Simulator, typename fp_type>
+inline bool ApplyDiagonalGate(std::false_type, const Simulator& simulator,
+                              const std::vector<unsigned>& qs,
+                              const std::vector<fp_type>& phases,
+                              typename Simulator::State& state) {
+  return false;
+}
+
+template <typename Simulator, typename fp_type>
+inline bool ApplyDiagonalGate(std::true_type, const Simulator& simulator,
+                              const std::vector<unsigned>& qs,
+                              const std::vector<fp_type>& phases,
+                              typename Simulator::State& state) {
+  simulator.ApplyDiagonalGate(qs, phases.data(), state);
+  return true;
+}
+
+template <typename Simulator, typename fp_type>
+inline bool ApplyPermutationGate(std::false_type, const Simulator& simulator,
+                                 const std::vector<unsigned>& qs,
+                                 const std::vector<unsigned>& perm,
+                                 const std::vector<fp_type>& phases,
+                                 typename Simulator::State& state) {
+  return false;
+}
+
+template <typename Simulator, typename fp_type>
+inline bool ApplyPermutationGate(std::true_type, const Simulator& simulator,
+                                 const std::vector<unsigned>& qs,
+                                 const std::vector<unsigned>& perm,
+                                 const std::vector<fp_type>& phases,
+                                 typename Simulator::State& state) {
+  simulator.ApplyPermutationGate(qs, perm.data(), phases.data(), state);
+  return true;
+}
+
+// Applies generalized permutation matrices (including diagonal matrices)
+// by the diagonal or permutation gate kernels. Returns false if the matrix
+// is not a generalized permutation matrix or if the simulator doesn't
+// provide the corresponding kernel.
+template <typename Simulator, typename fp_type>
+inline bool ApplyPermutationGateMatrix(
+    std::false_type, const Simulator& simulator,
+    const std::vector<unsigned>& qubits,
+    const std::vector<unsigned>& controlled_by, uint64_t cmask,
+    const Matrix<fp_type>& matrix, typename Simulator::State& state) {
+  return false;
+}
+
+template <typename Simulator, typename fp_type>
+inline bool ApplyPermutationGateMatrix(
+    std::true_type, const Simulator& simulator,
+    const std::vector<unsigned>& qubits,
+    const std::vector<unsigned>& controlled_by, uint64_t cmask,
+    const Matrix<fp_type>& matrix, typename Simulator::State& state) {
+  using HasDiagonalKernel =
+      std::integral_constant<bool, HasDiagonalGateKernel<Simulator>::value>;
+  using HasPermutationKernel =
+      std::integral_constant<bool, HasPermutationGateKernel<Simulator>::value>;
+
+  unsigned num_qubits = qubits.size() + controlled_by.size();
+
+  if (controlled_by.size() > 0
+      && num_qubits > kMaxControlledPermutationGateQubits) {
+    return false;
+  }
+
+  std::vector<unsigned> perm;
+  std::vector<typename Simulator::fp_type> phases;
+
+  if (!MatrixGetPermutation(unsigned{1} << qubits.size(), matrix,
+                            perm, phases)) {
+    return false;
+  }
+
+  std::vector<unsigned> qs;
+
+  if (controlled_by.size() == 0) {
+    qs = qubits;
+  } else {
+    // A controlled gate is a gate on the target and control qubits that acts
+    // as identity if the control values are not matched.
+
+    qs.reserve(num_qubits);
+
+    std::merge(qubits.begin(), qubits.end(), controlled_by.begin(),
+               controlled_by.end(), std::back_inserter(qs));
+
+    unsigned qmask = 0;
+    unsigned cmaskq = 0;
+
+    for (unsigned i = 0; i < num_qubits; ++i) {
+      if (std::binary_search(qubits.begin(), qubits.end(), qs[i])) {
+        qmask |= 1 << i;
+      } else {
+        cmaskq |= 1 << i;
+      }
+    }
+
+    unsigned size = unsigned{1} << num_qubits;
+
+    std::vector<unsigned> cperm;
+    std::vector<typename Simulator::fp_type> cphases;
+
+    cperm.reserve(size);
+    cphases.reserve(2 * size);
+
+    for (unsigned i = 0; i < size; ++i) {
+      if (bits::CompressBits(i, num_qubits, cmaskq) == cmask) {
+        unsigned k = bits::CompressBits(i, num_qubits, qmask);
+        cperm.push_back(bits::ExpandBits(perm[k], num_qubits, qmask)
+                        | (i & cmaskq));
+        cphases.push_back(phases[2 * k]);
+        cphases.push_back(phases[2 * k + 1]);
+      } else {
+        cperm.push_back(i);
+        cphases.push_back(1);
+        cphases.push_back(0);
+      }
+    }
+
+    perm.swap(cperm);
+    phases.swap(cphases);
+  }
+
+  bool diagonal = true;
+
+  for (std::size_t i = 0; i < perm.size(); ++i) {
+    if (perm[i] != i) {
+      diagonal = false;
+      break;
+    }
+  }
+
+  if (diagonal
+      && ApplyDiagonalGate(HasDiagonalKernel{}, simulator, qs, phases, state)) {
+    return true;
+  }
+
+  if (num_qubits > kMaxControlledPermutationGateQubits) {
+    return false;
+  }
+
+  return ApplyPermutationGate(
+      HasPermutationKernel{}, simulator, qs, perm, phases, state);
+}
+
+// Applies the gate matrix. Diagonal and permutation matrices are applied by
+// the diagonal and permutation gate kernels if the simulator provides them.
+template <typename Simulator, typename fp_type>
+inline void ApplyGateMatrix(const Simulator& simulator,
+                            const std::vector<unsigned>& qubits,
+                            const std::vector<unsigned>& controlled_by,
+                            uint64_t cmask, const Matrix<fp_type>& matrix,
+                            typename Simulator::State& state) {
+  constexpr bool has_kernel = HasDiagonalGateKernel<Simulator>::value
+                              || HasPermutationGateKernel<Simulator>::value;
+  using HasKernel = std::integral_constant<bool, has_kernel>;
+
+  if (ApplyPermutationGateMatrix(HasKernel{}, simulator, qubits,
+                                 controlled_by, cmask, matrix, state)) {
+    return;
+  }
+
+  if (controlled_by.size() == 0) {
+    simulator.ApplyGate(qubits, matrix.data(), state);
+  } else {
+    simulator.ApplyControlledGate(qubits, controlled_by, cmask,
+                                  matrix.data(), state);
+  }
+}
+
+template <typename Simulator, typename fp_type>
+inline bool ApplyPauliRotation(std::false_type, const Simulator& simulator,
+                               const std::vector<unsigned>& qs,
+                               const std::vector<unsigned>& paulis,
+                               fp_type theta,
+                               typename Simulator::State& state) {
+  return false;
+}
+
+template <typename Simulator, typename fp_type>
+inline bool ApplyPauliRotation(std::true_type, const Simulator& simulator,
+                               const std::vector<unsigned>& qs,
+                               const std::vector<unsigned>& paulis,
+                               fp_type theta,
+                               typename Simulator::State& state) {
+  simulator.ApplyPauliRotation(qs, paulis.data(), theta, state);
+  return true;
+}
+
+// Applies exp(-i theta P) as a sequence of one- and two-qubit gates. Basis
+// changes map P to a product of Z operators, a CNOT ladder computes
+// the parity of the qubits on the last qubit and a Z rotation of the last
+// qubit applies the phase. Control qubits control only the Z rotation.
+template <typename Simulator, typename fp_type>
+inline void ApplyPauliRotationGates(const Simulator& simulator,
+                                    const std::vector<unsigned>& qubits,
+                                    const std::vector<unsigned>& controlled_by,
+                                    uint64_t cmask,
+                                    const std::vector<unsigned>& paulis,
+                                    fp_type theta,
+                                    typename Simulator::State& state) {
+  constexpr fp_type is2 = 0.7071067811865475;
+
+  // H maps X to Z.
+  Matrix<fp_type> mh = {is2, 0, is2, 0, is2, 0, -is2, 0};
+  // H S^dagger maps Y to Z.
+  Matrix<fp_type> my = {is2, 0, 0, -is2, is2, 0, 0, is2};
+  Matrix<fp_type> myd = {is2, 0, is2, 0, 0, is2, 0, -is2};
+  Matrix<fp_type> mcx = {1, 0, 0, 0, 0, 0, 0, 0,
+                         0, 0, 0, 0, 0, 0, 1, 0,
+                         0, 0, 0, 0, 1, 0, 0, 0,
+                         0, 0, 1, 0, 0, 0, 0, 0};
+
+  fp_type c = std::cos(theta);
+  fp_type s = std::sin(theta);
+  Matrix<fp_type> mrz = {c, -s, 0, 0, 0, 0, c, s};
+
+  unsigned n = qubits.size();
+  std::vector<unsigned> none;
+
+  for (unsigned k = 0; k < n; ++k) {
+    if (paulis[k] == 1) {
+      ApplyGateMatrix(simulator, {qubits[k]}, none, 0, mh, state);
+    } else if (paulis[k] == 2) {
+      ApplyGateMatrix(simulator, {qubits[k]}, none, 0, my, state);
+    }
+  }
+
+  for (unsigned k = 1; k < n; ++k) {
+    ApplyGateMatrix(simulator, {qubits[k - 1], qubits[k]}, none, 0,
+                    mcx, state);
+  }
+
+  ApplyGateMatrix(simulator, {qubits[n - 1]}, controlled_by, cmask,
+                  mrz, state);
+
+  for (unsigned k = n - 1; k > 0; --k) {
+    ApplyGateMatrix(simulator, {qubits[k - 1], qubits[k]}, none, 0,
+                    mcx, state);
+  }
+
+  for (unsigned k = 0; k < n; ++k) {
+    if (paulis[k] == 1) {
+      ApplyGateMatrix(simulator, {qubits[k]}, none, 0, mh, state);
+    } else if (paulis[k] == 2) {
+      ApplyGateMatrix(simulator, {qubits[k]}, none, 0, myd, state);
+    }
+  }
+}
+
+template <typename Simulator, typename Gate>
+inline void ApplyPauliRotationGate(std::false_type, const Simulator& simulator,
+                                   const Gate& gate, bool dagger,
+                                   typename Simulator::State& state) {}
+
+template <typename Simulator, typename Gate>
+inline void ApplyPauliRotationGate(std::true_type, const Simulator& simulator,
+                                   const Gate& gate, bool dagger,
+                                   typename Simulator::State& state) {
+  using fp_type = typename Gate::fp_type;
+  using HasKernel =
+      std::integral_constant<bool, HasPauliRotationKernel<Simulator>::value>;
+
+  fp_type theta = dagger ? -gate.params[0] : gate.params[0];
+
+  std::vector<unsigned> paulis;
+  paulis.reserve(gate.qubits.size());
+
+  for (std::size_t i = 1; i < gate.params.size(); ++i) {
+    paulis.push_back(unsigned(gate.params[i]));
+  }
+
+  if (gate.controlled_by.size() == 0
+      && ApplyPauliRotation(HasKernel{}, simulator, gate.qubits, paulis,
+                            theta, state)) {
+    return;
+  }
+
+  if (gate.matrix.size() > 0) {
+    if (dagger) {
+      auto matrix = gate.matrix;
+      MatrixDagger(unsigned{1} << gate.qubits.size(), matrix);
+
+      ApplyGateMatrix(simulator, gate.qubits, gate.controlled_by,
+                      gate.cmask, matrix, state);
+    } else {
+      ApplyGateMatrix(simulator, gate.qubits, gate.controlled_by,
+                      gate.cmask, gate.matrix, state);
+    }
+  } else {
+    ApplyPauliRotationGates(simulator, gate.qubits, gate.controlled_by,
+                            gate.cmask, paulis, theta, state);
+  }
+}
+
+// Applies the Pauli rotation gate (see gate::PauliRotation) or its dagger.
+// Uncontrolled gates are applied by the Pauli rotation kernel if
+// the simulator provides it. Otherwise the gate matrix is applied or,
+// if the gate has too many qubits to have a matrix, the gate is applied
+// as a sequence of one- and two-qubit gates.
+template <typename Simulator, typename Gate>
+inline void ApplyPauliRotationGate(const Simulator& simulator,
+                                   const Gate& gate, bool dagger,
+                                   typename Simulator::State& state) {
+  using HasParams = std::integral_constant<bool, HasGateParams<Gate>::value>;
+  ApplyPauliRotationGate(HasParams{}, simulator, gate, dagger, state);
+}
+
+template <typename Parameter>
+inline void LimitFusedSize(unsigned max_gate_qubits, Parameter& param,
+                           std::true_type) {
+  param.max_fused_size = std::min(param.max_fused_size, max_gate_qubits);
+}
+
+template <typename Parameter>
+inline void LimitFusedSize(unsigned max_gate_qubits, Parameter& param,
+                           std::false_type) {}
+
+}  // namespace detail
+
+/**
+ * Limits the size of fused gates to the largest gates that the simulator
+ *   can apply.
+ * @param param Parameters for gate fusion.
+ * @return A copy of param with max_fused_size (if any) limited accordingly.
+ */
+template <typename Simulator, typename Parameter>
+inline Parameter LimitFusedSize(Parameter param) {
+  using HasMaxFusedSize =
+      std::integral_constant<bool, detail::HasMaxFusedSize<Parameter>::value>;
+
+  detail::LimitFusedSize(detail::MaxGateQubits<Simulator>::value, param,
+                         HasMaxFusedSize{});
+  return param;
+}
+
 /**
  * Applies the given gate to the simulator state. Ignores measurement gates.
  * @param simulator Simulator object. Provides specific implementations for
@@ -34,13 +456,11 @@ namespace qsim {
 template <typename Simulator, typename Gate>
 inline void ApplyGate(const Simulator& simulator, const Gate& gate,
                       typename Simulator::State& state) {
-  if (gate.kind != gate::kMeasurement) {
-    if (gate.controlled_by.size() == 0) {
-      simulator.ApplyGate(gate.qubits, gate.matrix.data(), state);
-    } else {
-      simulator.ApplyControlledGate(gate.qubits, gate.controlled_by,
-                                    gate.cmask, gate.matrix.data(), state);
-    }
+  if (gate.kind == gate::kPauliRotation) {
+    detail::ApplyPauliRotationGate(simulator, gate, false, state);
+  } else if (gate.kind != gate::kMeasurement) {
+    detail::ApplyGateMatrix(simulator, gate.qubits, gate.controlled_by,
+                            gate.cmask, gate.matrix, state);
   }
 }
 
@@ -56,16 +476,14 @@ inline void ApplyGate(const Simulator& simulator, const Gate& gate,
 template <typename Simulator, typename Gate>
 inline void ApplyGateDagger(const Simulator& simulator, const Gate& gate,
                             typename Simulator::State& state) {
-  if (gate.kind != gate::kMeasurement) {
+  if (gate.kind == gate::kPauliRotation) {
+    detail::ApplyPauliRotationGate(simulator, gate, true, state);
+  } else if (gate.kind != gate::kMeasurement) {
     auto matrix = gate.matrix;
     MatrixDagger(unsigned{1} << gate.qubits.size(), matrix);
 
-    if (gate.controlled_by.size() == 0) {
-      simulator.ApplyGate(gate.qubits, matrix.data(), state);
-    } else {
-      simulator.ApplyControlledGate(gate.qubits, gate.controlled_by,
-                                    gate.cmask, matrix.data(), state);
-    }
+    detail::ApplyGateMatrix(simulator, gate.qubits, gate.controlled_by,
+                            gate.cmask, matrix, state);
   }
 }
 
@@ -135,14 +553,13 @@ inline bool ApplyGate(const typename Simulator::StateSpace& state_space,
 template <typename Simulator, typename Gate>
 inline void ApplyFusedGate(const Simulator& simulator, const Gate& gate,
                            typename Simulator::State& state) {
-  if (gate.kind != gate::kMeasurement) {
-    if (gate.parent->controlled_by.size() == 0) {
-      simulator.ApplyGate(gate.qubits, gate.matrix.data(), state);
-    } else {
-      simulator.ApplyControlledGate(gate.qubits, gate.parent->controlled_by,
-                                    gate.parent->cmask, gate.matrix.data(),
-                                    state);
-    }
+  if (gate.kind == gate::kPauliRotation) {
+    // Pauli rotation gates are not fused with other gates.
+    detail::ApplyPauliRotationGate(simulator, *gate.parent, false, state);
+  } else if (gate.kind != gate::kMeasurement) {
+    detail::ApplyGateMatrix(simulator, gate.qubits,
+                            gate.parent->controlled_by, gate.parent->cmask,
+                            gate.matrix, state);
   }
 }
 
@@ -158,16 +575,16 @@ inline void ApplyFusedGate(const Simulator& simulator, const Gate& gate,
 template <typename Simulator, typename Gate>
 inline void ApplyFusedGateDagger(const Simulator& simulator, const Gate& gate,
                                  typename Simulator::State& state) {
-  if (gate.kind != gate::kMeasurement) {
+  if (gate.kind == gate::kPauliRotation) {
+    // Pauli rotation gates are not fused with other gates.
+    detail::ApplyPauliRotationGate(simulator, *gate.parent, true, state);
+  } else if (gate.kind != gate::kMeasurement) {
     auto matrix = gate.matrix;
     MatrixDagger(unsigned{1} << gate.qubits.size(), matrix);
 
-    if (gate.parent->controlled_by.size() == 0) {
-      simulator.ApplyGate(gate.qubits, matrix.data(), state);
-    } else {
-      simulator.ApplyControlledGate(gate.qubits, gate.parent->controlled_by,
-                                    gate.parent->cmask, matrix.data(), state);
-    }
+    detail::ApplyGateMatrix(simulator, gate.qubits,
+                            gate.parent->controlled_by, gate.parent->cmask,
+                            matrix, state);
   }
 }
 
@@ -76,6 +76,8 @@ enum GateKind {
   kMatrixGate,   // Multi-qubit matrix gate.
   kDecomp = gate::kDecomp,
   kMeasurement = gate::kMeasurement,
+  kPauliRotation = gate::kPauliRotation,
+  kMatrix = gate::kMatrix,
 };
 
 template <typename fp_type>
@@ -1558,6 +1560,15 @@ struct MatrixGate {
   }
 };
 
+// Gates from cirq/ops/pauli_string_phasor.py:
+
+/**
+ * The rotation exp(-i theta P) about a Pauli string P of arbitrary weight;
+ * see gate::PauliRotation in gate.h.
+ */
+template <typename fp_type>
+using PauliRotation = gate::PauliRotation<GateCirq<fp_type>>;
+
 }  // namesapce Cirq
 
 template <typename fp_type>
@@ -50,6 +50,8 @@ enum GateKind {
   kGateMatrix2, // Two-qubit matrix gate.
   kDecomp = gate::kDecomp,
   kMeasurement = gate::kMeasurement,
+  kPauliRotation = gate::kPauliRotation,
+  kMatrix = gate::kMatrix,
 };
 
 // Specialization of Gate (defined in gate.h) for the qsim gate set.
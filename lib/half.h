@@ -0,0 +1,96 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef HALF_H_
+#define HALF_H_
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+namespace qsim {
+
+/**
+ * IEEE 754 half-precision storage type: 1 sign bit, 5 exponent bits and
+ * 10 mantissa bits. Only used for storage; arithmetic is done in float.
+ */
+struct float16 {
+  uint16_t bits;
+};
+
+/**
+ * Brain floating-point storage type: the upper 16 bits of a float
+ * (1 sign bit, 8 exponent bits and 7 mantissa bits). Only used for storage;
+ * arithmetic is done in float.
+ */
+struct bfloat16 {
+  uint16_t bits;
+};
+
+inline float HalfToFloat(float16 h) {
+  return _cvtsh_ss(h.bits);
+}
+
+inline float HalfToFloat(bfloat16 h) {
+  uint32_t u = uint32_t{h.bits} << 16;
+  float x;
+  std::memcpy(&x, &u, sizeof(x));
+  return x;
+}
+
+template <typename Half>
+Half FloatToHalf(float x);
+
+// Rounds to nearest even.
+template <>
+inline float16 FloatToHalf<float16>(float x) {
+  return float16{uint16_t(_cvtss_sh(x, _MM_FROUND_TO_NEAREST_INT))};
+}
+
+// Rounds to nearest even; does not preserve NaN payloads.
+template <>
+inline bfloat16 FloatToHalf<bfloat16>(float x) {
+  uint32_t u;
+  std::memcpy(&u, &x, sizeof(u));
+  u += 0x7fff + ((u >> 16) & 1);
+  return bfloat16{uint16_t(u >> 16)};
+}
+
+/**
+ * Returns the factor by which amplitudes of num_qubits-qubit states are
+ * multiplied when stored in Half numbers. Typical amplitudes are of the
+ * order of 2^(-num_qubits/2); float16 numbers lose precision below 2^-14,
+ * so float16 amplitudes are scaled up (by at most 2^14 to avoid overflow
+ * at 65504). bfloat16 numbers have the same range as float numbers and
+ * are not scaled.
+ */
+template <typename Half>
+float StorageScale(unsigned num_qubits);
+
+template <>
+inline float StorageScale<float16>(unsigned num_qubits) {
+  return std::ldexp(1.0f, std::min(num_qubits / 2, 14u));
+}
+
+template <>
+inline float StorageScale<bfloat16>(unsigned num_qubits) {
+  return 1;
+}
+
+}  // namespace qsim
+
+#endif  // HALF_H_
@@ -59,6 +59,89 @@ inline void MatrixIdentity(unsigned n, Matrix<fp_type>& m) {
   }
 }
 
+/**
+ * Checks if all the off-diagonal matrix elements are zero.
+ * @n Number of matrix rows (columns).
+ * @m Matrix to be checked.
+ * @return True if the matrix is diagonal; false otherwise.
+ */
+template <typename fp_type>
+inline bool MatrixIsDiagonal(unsigned n, const Matrix<fp_type>& m) {
+  for (unsigned i = 0; i < n; ++i) {
+    for (unsigned j = 0; j < n; ++j) {
+      if (i != j && (m[2 * (n * i + j)] != 0 || m[2 * (n * i + j) + 1] != 0)) {
+        return false;
+      }
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Gets the permutation and the phases of a generalized permutation matrix
+ *   (a matrix with exactly one nonzero element in each row and each column).
+ *   The nonzero element of row i is in column perm[i]; its real and imaginary
+ *   parts are phases[2 * i] and phases[2 * i + 1], respectively.
+ * @n Number of matrix rows (columns).
+ * @m Matrix to be checked.
+ * @perm Output permutation.
+ * @phases Output nonzero matrix elements.
+ * @return True if the matrix is a generalized permutation matrix; false
+ *   otherwise.
+ */
+template <typename fp_type1, typename fp_type2>
+inline bool MatrixGetPermutation(unsigned n, const Matrix<fp_type1>& m,
+                                 std::vector<unsigned>& perm,
+                                 std::vector<fp_type2>& phases) {
+  perm.assign(n, n);
+  phases.resize(2 * n);
+
+  std::vector<bool> used(n, false);
+
+  for (unsigned i = 0; i < n; ++i) {
+    for (unsigned j = 0; j < n; ++j) {
+      if (m[2 * (n * i + j)] != 0 || m[2 * (n * i + j) + 1] != 0) {
+        if (perm[i] != n || used[j]) {
+          return false;
+        }
+
+        perm[i] = j;
+        used[j] = true;
+        phases[2 * i] = m[2 * (n * i + j)];
+        phases[2 * i + 1] = m[2 * (n * i + j) + 1];
+      }
+    }
+
+    if (perm[i] == n) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+/**
+ * Sets a generalized permutation matrix.
+ * @n Number of matrix rows (columns).
+ * @perm Permutation; the nonzero element of row i is in column perm[i].
+ * @phases Nonzero matrix elements; real parts are followed by imaginary parts.
+ * @m Output matrix.
+ */
+template <typename fp_type1, typename fp_type2>
+inline void MatrixFromPermutation(unsigned n, const std::vector<unsigned>& perm,
+                                  const std::vector<fp_type1>& phases,
+                                  Matrix<fp_type2>& m) {
+  m.resize(2 * n * n);
+
+  MatrixClear(m);
+
+  for (unsigned i = 0; i < n; ++i) {
+    m[2 * (n * i + perm[i])] = phases[2 * i];
+    m[2 * (n * i + perm[i]) + 1] = phases[2 * i + 1];
+  }
+}
+
 /**
  * Multiplies two gate matrices of equal size: m2 = m1 m2.
  * @q Number of gate qubits. The number of matrix rows (columns) is 2^q.
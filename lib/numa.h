@@ -0,0 +1,231 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef NUMA_H_
+#define NUMA_H_
+
+#ifdef __linux__
+# include <sched.h>
+# include <sys/syscall.h>
+# include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Minimal NUMA helpers for Linux. The system calls are used directly, so
+// there is no dependency on libnuma. On other platforms, all the memory is
+// reported to be on node 0 and the placement functions do nothing.
+
+namespace qsim {
+
+namespace detail {
+
+// Parses lists like "0-3,8,10-11" as used in /sys/devices/system.
+inline std::vector<unsigned> ParseIndexList(const std::string& s) {
+  std::vector<unsigned> indices;
+
+  unsigned long i0, i1;
+  std::size_t pos = 0;
+  int len = 0;
+
+  while (pos < s.size()) {
+    if (std::sscanf(s.c_str() + pos, "%lu%n", &i0, &len) != 1) {
+      break;
+    }
+
+    pos += len;
+    i1 = i0;
+
+    if (pos < s.size() && s[pos] == '-') {
+      ++pos;
+      if (std::sscanf(s.c_str() + pos, "%lu%n", &i1, &len) != 1) {
+        break;
+      }
+      pos += len;
+    }
+
+    for (unsigned long i = i0; i <= i1; ++i) {
+      indices.push_back(i);
+    }
+
+    if (pos < s.size() && s[pos] == ',') {
+      ++pos;
+    } else {
+      break;
+    }
+  }
+
+  return indices;
+}
+
+inline std::vector<unsigned> ReadIndexList(const std::string& file) {
+  std::ifstream fs(file);
+  std::string line;
+
+  if (fs && std::getline(fs, line)) {
+    return ParseIndexList(line);
+  }
+
+  return {};
+}
+
+}  // namespace detail
+
+/**
+ * Returns the online NUMA nodes; {0} if the information is not available.
+ */
+inline std::vector<unsigned> NumaNodes() {
+#ifdef __linux__
+  auto nodes = detail::ReadIndexList("/sys/devices/system/node/online");
+  if (!nodes.empty()) {
+    return nodes;
+  }
+#endif
+
+  return {0};
+}
+
+/**
+ * Returns the CPUs of the given NUMA node.
+ */
+inline std::vector<unsigned> NumaNodeCpus(unsigned node) {
+  return detail::ReadIndexList("/sys/devices/system/node/node"
+                               + std::to_string(node) + "/cpulist");
+}
+
+/**
+ * Returns the NUMA node of the given CPU; 0 if it is not known.
+ */
+inline unsigned NumaNodeOfCpu(unsigned cpu) {
+  for (unsigned node : NumaNodes()) {
+    auto cpus = NumaNodeCpus(node);
+    if (std::find(cpus.begin(), cpus.end(), cpu) != cpus.end()) {
+      return node;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Returns the CPUs available to the process, ordered by NUMA node. Threads
+ * that are pinned to evenly spaced entries of this list are spread evenly
+ * over the nodes, and threads with consecutive indices share a node.
+ */
+inline std::vector<unsigned> AvailableCpusByNode() {
+  std::vector<unsigned> cpus;
+
+#ifdef __linux__
+  cpu_set_t available;
+  if (sched_getaffinity(0, sizeof(available), &available) != 0) {
+    return cpus;
+  }
+
+  std::vector<std::pair<unsigned, unsigned>> node_cpus;
+
+  for (unsigned cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &available)) {
+      node_cpus.emplace_back(0, cpu);
+    }
+  }
+
+  for (unsigned node : NumaNodes()) {
+    for (unsigned cpu : NumaNodeCpus(node)) {
+      for (auto& p : node_cpus) {
+        if (p.second == cpu) {
+          p.first = node;
+        }
+      }
+    }
+  }
+
+  std::sort(node_cpus.begin(), node_cpus.end());
+
+  cpus.reserve(node_cpus.size());
+  for (const auto& p : node_cpus) {
+    cpus.push_back(p.second);
+  }
+#endif
+
+  return cpus;
+}
+
+/**
+ * Interleaves the pages of [p, p + size) across all the online NUMA nodes.
+ * Only pages that are not touched yet are affected. p should be page
+ * aligned.
+ * @return true on success.
+ */
+inline bool InterleaveMemory(void* p, uint64_t size) {
+#if defined(__linux__) && defined(SYS_mbind)
+  constexpr int kMpolInterleave = 3;
+  constexpr unsigned kBitsPerWord = 8 * sizeof(unsigned long);
+
+  auto nodes = NumaNodes();
+  unsigned max_node = *std::max_element(nodes.begin(), nodes.end());
+
+  std::vector<unsigned long> mask(max_node / kBitsPerWord + 1, 0);
+  for (unsigned node : nodes) {
+    mask[node / kBitsPerWord] |= 1UL << (node % kBitsPerWord);
+  }
+
+  return syscall(SYS_mbind, p, size, kMpolInterleave, mask.data(),
+                 kBitsPerWord * mask.size(), 0) == 0;
+#else
+  return false;
+#endif
+}
+
+/**
+ * Returns the NUMA node of the page that contains p or -1 if the page is
+ * not mapped or the node is not known.
+ */
+inline int NumaNodeOfAddress(const void* p) {
+#if defined(__linux__) && defined(SYS_get_mempolicy)
+  constexpr unsigned long kMpolFNode = 1;
+  constexpr unsigned long kMpolFAddr = 2;
+
+  int node = -1;
+  if (syscall(SYS_get_mempolicy, &node, nullptr, 0, p,
+              kMpolFNode | kMpolFAddr) != 0) {
+    return -1;
+  }
+
+  return node;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * Returns the CPU the calling thread is running on or 0 if it is not known.
+ */
+inline unsigned CurrentCpu() {
+#ifdef __linux__
+  int cpu = sched_getcpu();
+  return cpu >= 0 ? cpu : 0;
+#else
+  return 0;
+#endif
+}
+
+}  // namespace qsim
+
+#endif  // NUMA_H_
@@ -0,0 +1,376 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef POOLFOR_H_
+#define POOLFOR_H_
+
+#ifdef __linux__
+# include <pthread.h>
+#endif
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+# include <immintrin.h>
+#endif
+
+#include "numa.h"
+
+namespace qsim {
+
+/**
+ * Persistent pool of worker threads. If the threads are not pinned, the
+ * thread that calls Execute works as thread 0 and the workers are threads
+ * 1 to num_threads - 1. If the threads are pinned, all num_threads threads
+ * are pinned workers and the calling thread only waits for them, so that
+ * every part of the index range is always processed on the same CPU
+ * (the calling thread can migrate between CPUs and nodes). Idle workers
+ * spin for a short while before they go to sleep, so back-to-back calls
+ * (one per gate) do not pay for waking up sleeping threads.
+ */
+class ThreadPool {
+ public:
+  /**
+   * Returns the pool for num_threads threads. Pools are created on first
+   * use and live until the program exits; all the callers with the same
+   * arguments share the same pool.
+   * @param num_threads The number of threads including the calling thread.
+   * @param pin_threads If true, the workers are pinned to CPUs that are
+   *   spread evenly over the NUMA nodes, see AvailableCpusByNode (Linux
+   *   only). Threads with consecutive indices share a node, so each node
+   *   gets a contiguous part of the index range of every loop. This is
+   *   required for NUMA first-touch placement (kNumaFirstTouch) to be useful.
+   */
+  static ThreadPool& Get(unsigned num_threads, bool pin_threads) {
+    static std::mutex mutex;
+    static std::map<std::pair<unsigned, bool>,
+                    std::unique_ptr<ThreadPool>> pools;
+
+    std::lock_guard<std::mutex> lock(mutex);
+
+    auto& pool = pools[std::make_pair(num_threads, pin_threads)];
+    if (!pool) {
+      pool.reset(new ThreadPool(num_threads, pin_threads));
+    }
+
+    return *pool;
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+
+    work_cv_.notify_all();
+
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  unsigned num_threads() const {
+    return num_threads_;
+  }
+
+  /**
+   * Calls func(m) for m = 0, ..., num_threads - 1 in parallel and returns
+   * when all the calls have returned. Calls from a function that is
+   * already executed by a pool run sequentially on the calling thread.
+   */
+  template <typename Function>
+  void Execute(Function&& func) {
+    if (num_threads_ == 1 || InPool()) {
+      for (unsigned m = 0; m < num_threads_; ++m) {
+        func(m);
+      }
+
+      return;
+    }
+
+    std::lock_guard<std::mutex> run_lock(run_mutex_);
+
+    using F = typename std::remove_reference<Function>::type;
+
+    task_ = &Invoke<F>;
+    context_ = &func;
+    pending_.store(num_threads_ - first_worker_, std::memory_order_relaxed);
+    generation_.fetch_add(1, std::memory_order_release);
+
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (num_sleeping_ > 0) {
+        work_cv_.notify_all();
+      }
+    }
+
+    if (first_worker_ > 0) {
+      InPool() = true;
+      func(0);
+      InPool() = false;
+    }
+
+    for (unsigned k = 0; k < kSpinCount; ++k) {
+      if (pending_.load(std::memory_order_acquire) == 0) {
+        return;
+      }
+      Pause(k);
+    }
+
+    std::unique_lock<std::mutex> lock(mutex_);
+    caller_sleeping_ = true;
+    done_cv_.wait(lock, [this]() {
+      return pending_.load(std::memory_order_acquire) == 0;
+    });
+    caller_sleeping_ = false;
+  }
+
+ private:
+  // The number of iterations idle threads spin before going to sleep.
+  static constexpr unsigned kSpinCount = 1 << 10;
+
+  ThreadPool(unsigned num_threads, bool pin_threads)
+      : num_threads_(num_threads), generation_(0), pending_(0) {
+    std::vector<unsigned> cpus;
+    if (pin_threads) {
+      cpus = AvailableCpusByNode();
+    }
+
+    // Thread 0 is a pinned worker if the threads are pinned.
+    first_worker_ = cpus.empty() ? 1 : 0;
+
+    workers_.reserve(num_threads - first_worker_);
+
+    for (unsigned m = first_worker_; m < num_threads; ++m) {
+      workers_.emplace_back(&ThreadPool::WorkerLoop, this, m);
+      if (!cpus.empty()) {
+        Pin(workers_.back(), cpus[(uint64_t{m} * cpus.size()) / num_threads]);
+      }
+    }
+  }
+
+  template <typename F>
+  static void Invoke(void* context, unsigned m) {
+    (*static_cast<F*>(context))(m);
+  }
+
+  static bool& InPool() {
+    static thread_local bool in_pool = false;
+    return in_pool;
+  }
+
+  // Spin-wait hint; yields now and then in case the threads outnumber
+  // the cores.
+  static void Pause(unsigned k) {
+    if (k % 64 == 63) {
+      std::this_thread::yield();
+    } else {
+#if defined(__SSE2__) || defined(_M_X64)
+      _mm_pause();
+#endif
+    }
+  }
+
+  static void Pin(std::thread& thread, unsigned cpu) {
+#ifdef __linux__
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    pthread_setaffinity_np(thread.native_handle(), sizeof(cpus), &cpus);
+#endif
+  }
+
+  void WorkerLoop(unsigned m) {
+    InPool() = true;
+
+    uint64_t generation = 0;
+
+    while (true) {
+      unsigned k = 0;
+      while (k < kSpinCount
+             && generation_.load(std::memory_order_acquire) == generation) {
+        Pause(k);
+        ++k;
+      }
+
+      if (k == kSpinCount) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        ++num_sleeping_;
+        work_cv_.wait(lock, [this, generation]() {
+          return stop_
+              || generation_.load(std::memory_order_acquire) != generation;
+        });
+        --num_sleeping_;
+
+        if (stop_) {
+          return;
+        }
+      }
+
+      generation = generation_.load(std::memory_order_acquire);
+
+      task_(context_, m);
+
+      if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (caller_sleeping_) {
+          done_cv_.notify_one();
+        }
+      }
+    }
+  }
+
+  unsigned num_threads_;
+  // 0 if all the threads are workers; 1 if the calling thread is thread 0.
+  unsigned first_worker_;
+  std::vector<std::thread> workers_;
+
+  // Serializes calls to Execute from different threads.
+  std::mutex run_mutex_;
+
+  void (*task_)(void*, unsigned) = nullptr;
+  void* context_ = nullptr;
+
+  std::atomic<uint64_t> generation_;
+  std::atomic<unsigned> pending_;
+
+  // Protects the fields below; used to put threads to sleep.
+  std::mutex mutex_;
+  std::condition_variable work_cv_;
+  std::condition_variable done_cv_;
+  unsigned num_sleeping_ = 0;
+  bool caller_sleeping_ = false;
+  bool stop_ = false;
+};
+
+/**
+ * Helper struct for executing for-loops in parallel across multiple threads
+ * of a persistent ThreadPool. This is a drop-in replacement for
+ * ParallelForT: work is divided between threads in the same way, but
+ * the threads are not created and joined for every loop as with OpenMP
+ * parallel regions. Threads are pinned to CPUs only if requested, see
+ * ThreadPool::Get; pinning can hurt on shared hosts or when the affinity
+ * is managed externally (taskset, container CPU sets).
+ */
+template <uint64_t MIN_SIZE>
+struct PoolForT {
+  explicit PoolForT(unsigned num_threads, bool pin_threads = false)
+      : num_threads(num_threads),
+        pool(num_threads > 1
+             ? &ThreadPool::Get(num_threads, pin_threads) : nullptr) {}
+
+  // GetIndex0 and GetIndex1 are useful when we need to know how work was
+  // divided between threads, for instance, for reusing partial sums obtained
+  // by RunReduceP.
+  uint64_t GetIndex0(uint64_t size, unsigned thread_id) const {
+    return size >= MIN_SIZE ? size * thread_id / num_threads : 0;
+  }
+
+  uint64_t GetIndex1(uint64_t size, unsigned thread_id) const {
+    return size >= MIN_SIZE ? size * (thread_id + 1) / num_threads : size;
+  }
+
+  template <typename Function, typename... Args>
+  void Run(uint64_t size, Function&& func, Args&&... args) const {
+    if (num_threads > 1 && size >= MIN_SIZE) {
+      unsigned n = num_threads;
+
+      auto f = [&](unsigned m) {
+        uint64_t i0 = GetIndex0(size, m);
+        uint64_t i1 = GetIndex1(size, m);
+
+        for (uint64_t i = i0; i < i1; ++i) {
+          func(n, m, i, args...);
+        }
+      };
+
+      pool->Execute(f);
+    } else {
+      for (uint64_t i = 0; i < size; ++i) {
+        func(1, 0, i, args...);
+      }
+    }
+  }
+
+  template <typename Function, typename Op, typename... Args>
+  std::vector<typename Op::result_type> RunReduceP(
+      uint64_t size, Function&& func, Op&& op, Args&&... args) const {
+    std::vector<typename Op::result_type> partial_results;
+
+    if (num_threads > 1 && size >= MIN_SIZE) {
+      partial_results.resize(num_threads, 0);
+
+      unsigned n = num_threads;
+
+      auto f = [&](unsigned m) {
+        uint64_t i0 = GetIndex0(size, m);
+        uint64_t i1 = GetIndex1(size, m);
+
+        typename Op::result_type partial_result = 0;
+
+        for (uint64_t i = i0; i < i1; ++i) {
+          partial_result = op(partial_result, func(n, m, i, args...));
+        }
+
+        partial_results[m] = partial_result;
+      };
+
+      pool->Execute(f);
+    } else if (num_threads > 0) {
+      typename Op::result_type result = 0;
+      for (uint64_t i = 0; i < size; ++i) {
+        result = op(result, func(1, 0, i, args...));
+      }
+
+      partial_results.resize(1, result);
+    }
+
+    return partial_results;
+  }
+
+  template <typename Function, typename Op, typename... Args>
+  typename Op::result_type RunReduce(uint64_t size, Function&& func,
+                                     Op&& op, Args&&... args) const {
+    auto partial_results = RunReduceP(size, func, std::move(op), args...);
+
+    typename Op::result_type result = 0;
+
+    for (auto partial_result : partial_results) {
+      result = op(result, partial_result);
+    }
+
+    return result;
+  }
+
+  unsigned num_threads;
+  ThreadPool* pool;
+};
+
+using PoolFor = PoolForT<1024>;
+
+}  // namespace qsim
+
+#endif  // POOLFOR_H_
@@ -15,18 +15,35 @@
 #ifndef QTRAJECTORY_H_
 #define QTRAJECTORY_H_
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
 #include <cmath>
 #include <complex>
 #include <cstdint>
+#include <map>
 #include <random>
+#include <type_traits>
 #include <vector>
 
 #include "circuit_noisy.h"
 #include "gate.h"
 #include "gate_appl.h"
+#include "qubit_map.h"
 
 namespace qsim {
 
+// Checks if the simulator provides reduced density matrix kernels.
+template <typename Simulator>
+struct HasReducedDensityMatrixKernel {
+  template <typename S>
+  static std::true_type Test(decltype(&S::ReducedDensityMatrix));
+  template <typename S>
+  static std::false_type Test(...);
+
+  static constexpr bool value = decltype(Test<Simulator>(nullptr))::value;
+};
+
 /**
  * Quantum trajectory simulator.
  */
@@ -66,13 +83,96 @@ class QuantumTrajectorySimulator {
      * the primary trajectory results. There is an additional condition for
      * RunBatch. In this case, the deferred operators after the main loop are
      * still applied for the first occurence of the primary trajectory.
+     * RunBatchParallel applies them for the first occurence of the primary
+     * trajectory on each thread, so each thread can collect the primary
+     * trajectory results independently.
      * The primary Kraus operators should have the highest sampling
      * probabilities to achieve the highest speedup.
      *
      * It is the client's responsibility to collect the primary trajectory
-     * results and to reuse them.
+     * results and to reuse them; PrimaryTrajectoryCache can be used for
+     * that.
      */
     bool apply_last_deferred_ops = true;
+    /**
+     * If true, SWAP gates (channels that consist of one SWAP gate) are not
+     * applied to the state vector. Instead, the subsequent operators are
+     * relabeled to act on swapped qubits. The final state vector is brought
+     * to the logical qubit order. Measured bitstrings refer to logical qubits.
+     * Note that the last deferred operators are always applied in this case,
+     * see apply_last_deferred_ops.
+     */
+    bool relabel_swap_gates = false;
+    /**
+     * The maximum number of circuit segments for which fused gates are
+     * cached by RunBatch and RunBatchParallel. A segment is a run of
+     * channels between two points where deferred operators are applied
+     * (measurements, sampling of non-unitary channels and the end of
+     * the circuit). Repetitions that sample the same Kraus operators in
+     * a segment (for instance, the primary ones) reuse the cached fused
+     * gates instead of fusing the segment again. RunBatchParallel has
+     * a separate cache for each thread. Zero disables caching.
+     */
+    unsigned max_fusion_cache_size = 64;
+    /**
+     * If true, Pauli channels are not part of the cache keys of circuit
+     * segments (see max_fusion_cache_size). A Pauli channel is a channel
+     * of unitary Kraus operators that are products of uncontrolled
+     * single-qubit generalized permutation gates (X, Y, Z, etc), such as
+     * depolarizing, bit flip and phase flip channels. Sampled Pauli errors
+     * are folded into the cached fused gates that contain the respective
+     * qubits: the component gates of these fused gates are replaced and
+     * their matrices are multiplied again, which is cheap for products of
+     * permutation matrices. Segments are fused only once in the absence of
+     * other kinds of noise. This has no effect if fusion caching is
+     * disabled.
+     */
+    bool fold_pauli_errors = true;
+    /**
+     * If max_checkpoints is positive, RunBatch and RunBatchParallel first
+     * simulate the primary trajectory up to the first measurement and save
+     * up to max_checkpoints copies of the state vector at evenly spaced
+     * channels (the last one after the last channel before the first
+     * measurement or after the last channel of the circuit). Each
+     * repetition then starts from a copy of the latest checkpoint before
+     * the first channel where it departs from the primary trajectory.
+     * Repetitions that do not depart from the primary trajectory before
+     * the end of the circuit get a copy of the final primary state. This
+     * speeds up simulations of circuits with weak noise at the cost of
+     * max_checkpoints additional state vectors. The results are the same
+     * as without checkpoints up to round-off errors. Checkpoints are
+     * disabled by default.
+     */
+    unsigned max_checkpoints = 0;
+    /**
+     * Importance sampling of errors. A mixed unitary channel is a channel
+     * of unitary Kraus operators, such as depolarizing and bit flip channels;
+     * sampling any Kraus operator other than the first (primary) one is an
+     * error. If error_bias is not one, the odds of an error in each mixed
+     * unitary channel are multiplied by error_bias, so rare errors are
+     * sampled more often for error_bias > 1. The errors are distributed
+     * between the non-primary Kraus operators in proportion to their
+     * probabilities. Stat::weight is the likelihood ratio of the sampled
+     * trajectory; the mean of the weighted measurement results over
+     * repetitions is an unbiased estimate of the expectation value. Dividing
+     * the sum of the weighted results by the sum of the weights instead of
+     * the number of repetitions usually gives a much lower variance at
+     * the cost of a small bias. Other channels are sampled with their
+     * natural probabilities.
+     */
+    double error_bias = 1;
+    /**
+     * If num_error_strata is greater than one, the repetitions are
+     * stratified by the number of errors in mixed unitary channels (see
+     * error_bias). Repetition r samples trajectories with exactly
+     * r % num_error_strata errors; the last stratum takes trajectories with
+     * num_error_strata - 1 or more errors. Stat::weight is the probability
+     * of the stratum times num_error_strata, so the weighted mean of
+     * the measurement results is an unbiased estimate of the expectation
+     * value if the number of repetitions is a multiple of num_error_strata.
+     * This takes precedence over error_bias.
+     */
+    unsigned num_error_strata = 0;
   };
 
   /**
@@ -87,6 +187,12 @@ class QuantumTrajectorySimulator {
      * True if the "primary" noise trajectory is sampled, false otherwise.
      */
     bool primary;
+    /**
+     * The likelihood ratio of the sampled noise trajectory, see
+     * Parameter::error_bias and Parameter::num_error_strata; one if
+     * importance sampling is disabled.
+     */
+    double weight;
   };
 
   /**
@@ -142,15 +248,95 @@ class QuantumTrajectorySimulator {
                        uint64_t r0, uint64_t r1, const StateSpace& state_space,
                        const Simulator& simulator, MeasurementFunc&& measure,
                        Args&&... args) {
+    auto stop = [r1](uint64_t r) { return r >= r1; };
+    return RunBatchUntil(param, num_qubits, cbeg, cend, r0, stop, state_space,
+                         simulator, measure, args...);
+  }
+
+  /**
+   * Runs the given noisy circuit performing repetitions r0, r0 + 1, ...
+   * until the given stop condition is met. Each repetition is seeded by
+   * repetition ID. This can be used to stop as soon as the measurement
+   * results converge, see TrajectoryEstimator.
+   * @param param Options for the quantum trajectory simulator.
+   * @param circuit The noisy circuit to be simulated.
+   * @param r0 The ID of the first repetition.
+   * @param stop Function that takes the ID of the next repetition and
+   *   returns true if no more repetitions should be performed. It is called
+   *   before each repetition.
+   * @param state_space StateSpace object required to manipulate state vector.
+   * @param simulator Simulator object. Provides specific implementations for
+   *   applying gates.
+   * @param measure Function that performs measurements; see RunBatch.
+   * @param args Optional arguments for the 'measure' function.
+   * @return True if the simulation completed successfully; false otherwise.
+   */
+  template <typename StopFunc, typename MeasurementFunc, typename... Args>
+  static bool RunBatchUntil(const Parameter& param,
+                            const NoisyCircuit<Gate>& circuit, uint64_t r0,
+                            StopFunc&& stop, const StateSpace& state_space,
+                            const Simulator& simulator,
+                            MeasurementFunc&& measure, Args&&... args) {
+    return RunBatchUntil(param, circuit.num_qubits, circuit.channels.begin(),
+                         circuit.channels.end(), r0, stop, state_space,
+                         simulator, measure, args...);
+  }
+
+  /**
+   * Runs the given noisy circuit performing repetitions r0, r0 + 1, ...
+   * until the given stop condition is met. See the previous overload for
+   * details.
+   * @param param Options for the quantum trajectory simulator.
+   * @param num_qubits The number of qubits acted on by the circuit.
+   * @param cbeg, cend The range of channels [cbeg, cend) to run the circuit.
+   * @param r0 The ID of the first repetition.
+   * @param stop Function that takes the ID of the next repetition and
+   *   returns true if no more repetitions should be performed.
+   * @param state_space StateSpace object required to manipulate state vector.
+   * @param simulator Simulator object. Provides specific implementations for
+   *   applying gates.
+   * @param measure Function that performs measurements; see RunBatch.
+   * @param args Optional arguments for the 'measure' function.
+   * @return True if the simulation completed successfully; false otherwise.
+   */
+  template <typename StopFunc, typename MeasurementFunc, typename... Args>
+  static bool RunBatchUntil(const Parameter& param, unsigned num_qubits,
+                            ncircuit_iterator<Gate> cbeg,
+                            ncircuit_iterator<Gate> cend, uint64_t r0,
+                            StopFunc&& stop, const StateSpace& state_space,
+                            const Simulator& simulator,
+                            MeasurementFunc&& measure, Args&&... args) {
+    RelabeledChannels rchannels;
+
+    if (param.relabel_swap_gates) {
+      rchannels = RelabelSwapGates(num_qubits, cbeg, cend);
+      cbeg = rchannels.channels.cbegin();
+      cend = rchannels.channels.cend();
+    }
+
     std::vector<const Gate*> gates;
     gates.reserve(4 * std::size_t(cend - cbeg));
 
     State state = state_space.Null();
 
+    FusionCache cache(param.max_fusion_cache_size);
+
+    auto pchannels = FindPauliChannels(param, cbeg, cend);
+    auto esampling = PrepareErrorSampling(param, cbeg, cend);
+
+    Prefix prefix;
+
+    if (param.max_checkpoints > 0) {
+      if (!BuildPrefix(param, num_qubits, cbeg, cend, rchannels, state_space,
+                       simulator, prefix)) {
+        return false;
+      }
+    }
+
     Stat stat;
     bool had_primary_realization = false;
 
-    for (uint64_t r = r0; r < r1; ++r) {
+    for (uint64_t r = r0; !stop(r); ++r) {
       if (!state_space.IsNull(state)) {
         state_space.SetStateZero(state);
       }
@@ -159,7 +345,8 @@ class QuantumTrajectorySimulator {
           param.apply_last_deferred_ops || !had_primary_realization;
 
       if (!RunIteration(param, apply_last_deferred_ops, num_qubits, cbeg, cend,
-                        r, state_space, simulator, gates, state, stat)) {
+                        rchannels, pchannels, esampling, prefix, r,
+                        state_space, simulator, gates, cache, state, stat)) {
         return false;
       }
 
@@ -173,6 +360,135 @@ class QuantumTrajectorySimulator {
     return true;
   }
 
+  /**
+   * Runs the given noisy circuit performing repetitions on multiple threads.
+   * Each thread has its own state vector as well as single-threaded state
+   * space and simulator objects (constructed as StateSpace(1) and
+   * Simulator(1)). Repetitions are distributed between the threads
+   * dynamically, so threads that get short repetitions (for instance, due to
+   * measurements or non-unitary Kraus operators) take more of them. Each
+   * repetition is seeded by repetition ID, so the results do not depend on
+   * the number of threads. This is faster than RunBatch for circuits with
+   * a small number of qubits, where parallelism within each gate does not
+   * pay off. If param.apply_last_deferred_ops is false, the deferred
+   * operators after the main loop are applied for the first occurence of
+   * the primary trajectory on each thread (see
+   * Parameter::apply_last_deferred_ops); the 'measure' function can use
+   * a per-thread PrimaryTrajectoryCache (indexed by omp_get_thread_num())
+   * to reuse the primary trajectory results.
+   * @param param Options for the quantum trajectory simulator.
+   * @param circuit The noisy circuit to be simulated.
+   * @param r0, r1 The range of repetition IDs [r0, r1) to perform repetitions.
+   * @param num_threads The number of threads to perform repetitions.
+   * @param measure Function that performs measurements (in the sense of
+   *   computing expectation values, etc). This function has the same
+   *   parameters as in RunBatch. It is called concurrently from multiple
+   *   threads and in no particular order of repetition IDs, so it should be
+   *   thread-safe; for instance, it can store the results of each repetition
+   *   at the position given by repetition ID.
+   * @param args Optional arguments for the 'measure' function.
+   * @return True if the simulation completed successfully; false otherwise.
+   */
+  template <typename MeasurementFunc, typename... Args>
+  static bool RunBatchParallel(const Parameter& param,
+                               const NoisyCircuit<Gate>& circuit,
+                               uint64_t r0, uint64_t r1, unsigned num_threads,
+                               MeasurementFunc&& measure, Args&&... args) {
+    return RunBatchParallel(param, circuit.num_qubits, circuit.channels.begin(),
+                            circuit.channels.end(), r0, r1, num_threads,
+                            measure, args...);
+  }
+
+  /**
+   * Runs the given noisy circuit performing repetitions on multiple threads.
+   * See the previous overload for details.
+   * @param param Options for the quantum trajectory simulator.
+   * @param num_qubits The number of qubits acted on by the circuit.
+   * @param cbeg, cend The range of channels [cbeg, cend) to run the circuit.
+   * @param r0, r1 The range of repetition IDs [r0, r1) to perform repetitions.
+   * @param num_threads The number of threads to perform repetitions.
+   * @param measure Function that performs measurements (in the sense of
+   *   computing expectation values, etc). It should be thread-safe.
+   * @param args Optional arguments for the 'measure' function.
+   * @return True if the simulation completed successfully; false otherwise.
+   */
+  template <typename MeasurementFunc, typename... Args>
+  static bool RunBatchParallel(const Parameter& param, unsigned num_qubits,
+                               ncircuit_iterator<Gate> cbeg,
+                               ncircuit_iterator<Gate> cend,
+                               uint64_t r0, uint64_t r1, unsigned num_threads,
+                               MeasurementFunc&& measure, Args&&... args) {
+    RelabeledChannels rchannels;
+
+    if (param.relabel_swap_gates) {
+      rchannels = RelabelSwapGates(num_qubits, cbeg, cend);
+      cbeg = rchannels.channels.cbegin();
+      cend = rchannels.channels.cend();
+    }
+
+    Prefix prefix;
+
+    if (param.max_checkpoints > 0) {
+      StateSpace state_space(num_threads);
+      Simulator simulator(num_threads);
+
+      if (!BuildPrefix(param, num_qubits, cbeg, cend, rchannels, state_space,
+                       simulator, prefix)) {
+        return false;
+      }
+    }
+
+    auto pchannels = FindPauliChannels(param, cbeg, cend);
+    auto esampling = PrepareErrorSampling(param, cbeg, cend);
+
+    std::atomic<bool> success(true);
+
+    #pragma omp parallel num_threads(num_threads)
+    {
+      StateSpace state_space(1);
+      Simulator simulator(1);
+
+      std::vector<const Gate*> gates;
+      gates.reserve(4 * std::size_t(cend - cbeg));
+
+      State state = state_space.Null();
+
+      FusionCache cache(param.max_fusion_cache_size);
+
+      Stat stat;
+      bool had_primary_realization = false;
+
+      #pragma omp for schedule(dynamic)
+      for (uint64_t r = r0; r < r1; ++r) {
+        // A parallel loop cannot be left early; skip the remaining
+        // repetitions if some repetition failed.
+        if (!success.load(std::memory_order_relaxed)) continue;
+
+        if (!state_space.IsNull(state)) {
+          state_space.SetStateZero(state);
+        }
+
+        bool apply_last_deferred_ops =
+            param.apply_last_deferred_ops || !had_primary_realization;
+
+        if (!RunIteration(param, apply_last_deferred_ops, num_qubits, cbeg,
+                          cend, rchannels, pchannels, esampling, prefix, r,
+                          state_space, simulator, gates, cache, state, stat)) {
+          success.store(false, std::memory_order_relaxed);
+          continue;
+        }
+
+        if (stat.primary) {
+          had_primary_realization = true;
+        }
+
+        measure(r, state, stat, args...);
+      }
+    }
+
+    return success.load();
+  }
+
   /**
    * Runs the given noisy circuit one time.
    * @param param Options for the quantum trajectory simulator.
@@ -215,11 +531,27 @@ class QuantumTrajectorySimulator {
                       ncircuit_iterator<Gate> cend,
                       uint64_t r, const StateSpace& state_space,
                       const Simulator& simulator, State& state, Stat& stat) {
+    RelabeledChannels rchannels;
+
+    if (param.relabel_swap_gates) {
+      rchannels = RelabelSwapGates(num_qubits, cbeg, cend);
+      cbeg = rchannels.channels.cbegin();
+      cend = rchannels.channels.cend();
+    }
+
     std::vector<const Gate*> gates;
     gates.reserve(4 * std::size_t(cend - cbeg));
 
+    // Segments and checkpoints are not reused within one repetition, so
+    // there is nothing to cache.
+    FusionCache cache(0);
+    std::vector<PauliChannel> pchannels;
+    auto esampling = PrepareErrorSampling(param, cbeg, cend);
+    Prefix prefix;
+
     if (!RunIteration(param, param.apply_last_deferred_ops, num_qubits, cbeg,
-                      cend, r, state_space, simulator, gates, state, stat)) {
+                      cend, rchannels, pchannels, esampling, prefix, r,
+                      state_space, simulator, gates, cache, state, stat)) {
       return false;
     }
 
@@ -227,14 +559,343 @@ class QuantumTrajectorySimulator {
   }
 
  private:
+  /**
+   * Noisy circuit with SWAP channels removed by relabeling qubits.
+   */
+  struct RelabeledChannels {
+    /**
+     * Channels; SWAP channels are replaced by channels with one empty Kraus
+     * operator to keep Kraus operator statistics intact.
+     */
+    std::vector<Channel<Gate>> channels;
+    /**
+     * Qubit maps to perform measurements in, one map per measurement channel.
+     */
+    std::vector<QubitMap> mea_maps;
+    /**
+     * Qubit map to be resolved after the last channel.
+     */
+    QubitMap map;
+  };
+
+  /**
+   * Fused gates of the circuit segments that were already applied, see
+   * Parameter::max_fusion_cache_size. A segment is identified by the indices
+   * of its channels and of the Kraus operators sampled for them.
+   */
+  struct FusionCache {
+    using GateFused = typename Fuser::GateFused;
+
+    /**
+     * The position of a deferred Pauli channel gate in the fused gates,
+     * see Parameter::fold_pauli_errors.
+     */
+    struct PauliSlot {
+      /**
+       * The index of the fused gate.
+       */
+      std::size_t fgate;
+      /**
+       * The index of the component gate in the fused gate.
+       */
+      std::size_t gate;
+      /**
+       * The index of the gate in the deferred gates of the segment.
+       */
+      std::size_t deferred;
+    };
+
+    struct Segment {
+      std::vector<GateFused> fgates;
+      /**
+       * Pauli slots ordered by fused gate index.
+       */
+      std::vector<PauliSlot> slots;
+    };
+
+    explicit FusionCache(std::size_t max_size) : max_size(max_size) {}
+
+    /**
+     * The key of the current segment: the channel index (upper 32 bits)
+     * and the Kraus operator index (lower 32 bits; kPauliKop for Pauli
+     * channels) of each deferred Kraus operator.
+     */
+    std::vector<uint64_t> key;
+    /**
+     * The indices of the deferred Pauli channel gates of the current segment.
+     */
+    std::vector<std::size_t> pauli_gates;
+    std::map<std::vector<uint64_t>, Segment> segments;
+    std::size_t max_size;
+  };
+
+  /**
+   * Kraus operator index in the cache keys of Pauli channels.
+   */
+  static constexpr uint64_t kPauliKop = 0xffffffff;
+
+  /**
+   * A Pauli channel, see Parameter::fold_pauli_errors. Each Kraus operator
+   * is represented by one gate per qubit of the channel, so that all the
+   * Kraus operators are fused in the same way.
+   */
+  struct PauliChannel {
+    /**
+     * Identity gates for the qubits that are not acted on by a Kraus
+     * operator.
+     */
+    std::vector<Gate> identities;
+    /**
+     * The gates of each Kraus operator; empty if the channel is not a Pauli
+     * channel.
+     */
+    std::vector<std::vector<const Gate*>> kops;
+  };
+
+  /**
+   * A copy of the state vector of the primary trajectory.
+   */
+  struct Checkpoint {
+    /**
+     * The index of the channel before which the state is saved. If this is
+     * the number of channels, the state is the final primary state.
+     */
+    std::size_t channel;
+    /**
+     * The number of random numbers drawn before the channel.
+     */
+    std::size_t num_draws;
+    State state;
+  };
+
+  /**
+   * The part of the primary trajectory before the first measurement, see
+   * Parameter::max_checkpoints.
+   */
+  struct Prefix {
+    /**
+     * The number of channels before the first measurement.
+     */
+    std::size_t size = 0;
+    /**
+     * The actual sampling probabilities of the non-unitary Kraus operators
+     * for each channel of the prefix; empty for unitary channels.
+     */
+    std::vector<std::vector<double>> probs;
+    /**
+     * Checkpoints ordered by channel index.
+     */
+    std::vector<Checkpoint> checkpoints;
+  };
+
+  /**
+   * Proposal distributions of errors in mixed unitary channels, see
+   * Parameter::error_bias and Parameter::num_error_strata.
+   */
+  struct ErrorSampling {
+    /**
+     * The probability of an error for each channel; zero if the channel is
+     * not a mixed unitary channel. Empty if importance sampling is disabled.
+     */
+    std::vector<double> perrs;
+    /**
+     * The proposal probability of an error for each channel if errors are
+     * biased; the same as perrs if repetitions are stratified.
+     */
+    std::vector<double> qerrs;
+    /**
+     * The likelihood ratio of sampling the primary Kraus operators of
+     * channels [0, i) at position i.
+     */
+    std::vector<double> primary_weights;
+    /**
+     * The number of strata; zero if repetitions are not stratified.
+     */
+    unsigned num_strata = 0;
+    /**
+     * The probability of each stratum.
+     */
+    std::vector<double> strata_probs;
+    /**
+     * For each stratum, the probability that channels [i, end) take
+     * the number of errors from c (capped at num_strata - 1) to the stratum
+     * at position i * num_strata + c.
+     */
+    std::vector<std::vector<double>> tails;
+  };
+
+  /**
+   * The error state of a repetition, see ErrorSampling.
+   */
+  struct ErrorTrajectory {
+    /**
+     * The stratum of the repetition; num_strata if the repetition is not
+     * stratified.
+     */
+    unsigned stratum;
+    /**
+     * The number of errors sampled so far, capped at num_strata - 1.
+     */
+    unsigned num_errors;
+  };
+
+  static RelabeledChannels RelabelSwapGates(unsigned num_qubits,
+                                            ncircuit_iterator<Gate> cbeg,
+                                            ncircuit_iterator<Gate> cend) {
+    RelabeledChannels rchannels;
+    rchannels.channels.reserve(std::size_t(cend - cbeg));
+    rchannels.map = IdentityQubitMap(num_qubits);
+
+    auto& map = rchannels.map;
+
+    for (auto it = cbeg; it != cend; ++it) {
+      const auto& channel = *it;
+
+      if (channel.size() > 0 && channel[0].kind == gate::kMeasurement) {
+        rchannels.mea_maps.push_back(map);
+        rchannels.channels.push_back(channel);
+      } else if (channel.size() == 1 && channel[0].unitary
+                 && channel[0].ops.size() == 1
+                 && IsSwapGate(channel[0].ops[0])) {
+        const auto& qubits = channel[0].ops[0].qubits;
+        std::swap(map[qubits[0]], map[qubits[1]]);
+
+        rchannels.channels.push_back({{KrausOperator<Gate>::kNormal, true,
+                                       channel[0].prob, {}, {}, {}}});
+      } else {
+        rchannels.channels.push_back(channel);
+
+        for (auto& kop : rchannels.channels.back()) {
+          for (auto& op : kop.ops) {
+            RelabelGate(map, op);
+          }
+
+          if (!kop.kd_k.empty()) {
+            kop.CalculateKdKMatrix();
+          } else {
+            for (auto& q : kop.qubits) {
+              q = map[q];
+            }
+
+            std::sort(kop.qubits.begin(), kop.qubits.end());
+          }
+        }
+      }
+    }
+
+    return rchannels;
+  }
+
+  /**
+   * Finds Pauli channels, see Parameter::fold_pauli_errors.
+   * @return Pauli channels indexed by channel index or an empty vector if
+   *   Pauli errors are not folded.
+   */
+  static std::vector<PauliChannel> FindPauliChannels(
+      const Parameter& param, ncircuit_iterator<Gate> cbeg,
+      ncircuit_iterator<Gate> cend) {
+    std::vector<PauliChannel> pchannels;
+
+    if (!param.fold_pauli_errors || param.max_fusion_cache_size == 0) {
+      return pchannels;
+    }
+
+    // Gate pointers are taken after all the channels are allocated.
+    pchannels.resize(std::size_t(cend - cbeg));
+
+    std::vector<unsigned> perm;
+    std::vector<typename Gate::fp_type> phases;
+
+    for (std::size_t i = 0; i < pchannels.size(); ++i) {
+      const auto& channel = cbeg[i];
+
+      std::vector<const Gate*> ops;
+      bool pauli = channel.size() > 1;
+
+      for (const auto& kop : channel) {
+        if (!pauli) break;
+
+        pauli = kop.kind == KrausOperator<Gate>::kNormal && kop.unitary;
+
+        for (const auto& op : kop.ops) {
+          if (!pauli) break;
+
+          pauli = op.kind != gate::kMeasurement && op.qubits.size() == 1
+              && op.controlled_by.size() == 0
+              && MatrixGetPermutation(2, op.matrix, perm, phases);
+
+          ops.push_back(&op);
+        }
+      }
+
+      if (!pauli || ops.size() == 0) continue;
+
+      std::vector<unsigned> qubits;
+      for (const auto* op : ops) {
+        qubits.push_back(op->qubits[0]);
+      }
+
+      std::sort(qubits.begin(), qubits.end());
+      qubits.erase(std::unique(qubits.begin(), qubits.end()), qubits.end());
+
+      auto& pchannel = pchannels[i];
+      pchannel.identities.reserve(qubits.size());
+
+      for (unsigned q : qubits) {
+        for (const auto* op : ops) {
+          if (op->qubits[0] == q) {
+            // A copy of a gate on the same qubit at the same time.
+            pchannel.identities.push_back(*op);
+            MatrixIdentity(2, pchannel.identities.back().matrix);
+            break;
+          }
+        }
+      }
+
+      pchannel.kops.resize(channel.size());
+
+      for (std::size_t k = 0; k < channel.size(); ++k) {
+        auto& kop = pchannel.kops[k];
+
+        for (std::size_t j = 0; j < qubits.size(); ++j) {
+          kop.push_back(&pchannel.identities[j]);
+        }
+
+        for (const auto& op : channel[k].ops) {
+          auto j = std::lower_bound(qubits.begin(), qubits.end(),
+                                    op.qubits[0]) - qubits.begin();
+
+          if (kop[j] != &pchannel.identities[j]) {
+            // Several gates on the same qubit.
+            pauli = false;
+            break;
+          }
+
+          kop[j] = &op;
+        }
+      }
+
+      if (!pauli) {
+        pchannel.identities.resize(0);
+        pchannel.kops.resize(0);
+      }
+    }
+
+    return pchannels;
+  }
+
   static bool RunIteration(const Parameter& param,
                            bool apply_last_deferred_ops, unsigned num_qubits,
                            ncircuit_iterator<Gate> cbeg,
                            ncircuit_iterator<Gate> cend,
+                           const RelabeledChannels& rchannels,
+                           const std::vector<PauliChannel>& pchannels,
+                           const ErrorSampling& esampling,
+                           const Prefix& prefix,
                            uint64_t rep, const StateSpace& state_space,
                            const Simulator& simulator,
                            std::vector<const Gate*>& gates,
-                           State& state, Stat& stat) {
+                           FusionCache& cache, State& state, Stat& stat) {
     if (param.collect_kop_stat || param.collect_mea_stat) {
       stat.samples.reserve(std::size_t(cend - cbeg));
       stat.samples.resize(0);
@@ -250,6 +911,7 @@ class QuantumTrajectorySimulator {
     }
 
     gates.resize(0);
+    cache.key.resize(0);
 
     RGen rgen(rep);
     std::uniform_real_distribution<double> distr(0.0, 1.0);
@@ -257,7 +919,41 @@ class QuantumTrajectorySimulator {
     bool unitary = true;
     stat.primary = true;
 
-    for (auto it = cbeg; it != cend; ++it) {
+    ErrorTrajectory etrajectory;
+    StartErrorTrajectory(esampling, rep, etrajectory, stat.weight);
+
+    std::size_t mea_index = 0;
+
+    auto cfirst = cbeg;
+
+    if (!prefix.checkpoints.empty()) {
+      const auto* checkpoint = FindCheckpoint(cbeg, esampling, prefix, rep);
+
+      if (checkpoint != nullptr) {
+        state_space.Copy(checkpoint->state, state);
+
+        if (!esampling.perrs.empty()) {
+          stat.weight *= esampling.primary_weights[checkpoint->channel];
+        }
+
+        if (param.collect_kop_stat) {
+          stat.samples.resize(checkpoint->num_draws, 0);
+        }
+
+        if (checkpoint->channel == std::size_t(cend - cbeg)) {
+          // The primary trajectory.
+          return true;
+        }
+
+        for (std::size_t i = 0; i < checkpoint->num_draws; ++i) {
+          distr(rgen);
+        }
+
+        cfirst = cbeg + checkpoint->channel;
+      }
+    }
+
+    for (auto it = cfirst; it != cend; ++it) {
       const auto& channel = *it;
 
       if (channel.size() == 0) continue;
@@ -265,15 +961,19 @@ class QuantumTrajectorySimulator {
       if (channel[0].kind == gate::kMeasurement) {
         // Measurement channel.
 
-        if (!ApplyDeferredOps(param, num_qubits, simulator, gates, state)) {
+        if (!ApplyDeferredOps(param, num_qubits, simulator, gates, cache,
+                              state)) {
           return false;
         }
 
         bool normalize = !unitary && param.normalize_before_mea_gates;
         NormalizeState(normalize, state_space, unitary, state);
 
+        const QubitMap* map = param.relabel_swap_gates ?
+            &rchannels.mea_maps[mea_index++] : nullptr;
+
         auto mresult = ApplyMeasurementGate(state_space, channel[0].ops[0],
-                                            rgen, state);
+                                            map, rgen, state);
 
         if (!mresult.valid) {
           return false;
@@ -288,79 +988,558 @@ class QuantumTrajectorySimulator {
 
       // "Normal" channel.
 
+      std::size_t i = it - cbeg;
+
       double r = distr(rgen);
       double cp = 0;
 
-      // Perform sampling of Kraus operators using probability bounds.
-      for (std::size_t i = 0; i < channel.size(); ++i) {
-        const auto& kop = channel[i];
-
-        cp += kop.prob;
+      // Perform sampling of Kraus operators using probability bounds or
+      // the proposal distribution of errors.
+      std::size_t k = IsErrorSampled(esampling, i) ?
+          SampleError(channel, esampling, i, r, etrajectory, stat.weight) :
+          SampleKrausOperator(channel, r, cp);
+
+      if (k < channel.size()) {
+        if (!pchannels.empty() && !pchannels[i].kops.empty()) {
+          DeferPauliOps(i, pchannels[i].kops[k], gates, cache);
+        } else {
+          DeferOps(i, k, channel[k].ops, gates, cache);
+        }
 
-        if (r < cp) {
-          DeferOps(kop.ops, gates);
-          CollectStat(param.collect_kop_stat, i, stat);
+        CollectStat(param.collect_kop_stat, k, stat);
 
-          unitary = unitary && kop.unitary;
+        unitary = unitary && channel[k].unitary;
 
-          break;
-        }
+        continue;
       }
 
-      if (r < cp) continue;
-
-      if (!ApplyDeferredOps(param, num_qubits, simulator, gates, state)) {
+      if (!ApplyDeferredOps(param, num_qubits, simulator, gates, cache,
+                            state)) {
         return false;
       }
 
       NormalizeState(!unitary, state_space, unitary, state);
 
-      double max_prob = 0;
-      std::size_t max_prob_index = 0;
+      std::vector<double> probs;
+      bool one_pass =
+          ComputeKrausProbabilities(channel, simulator, state, probs);
+
+      auto prob = [one_pass, &probs, &channel, &simulator, &state](
+          std::size_t i) {
+        return one_pass ? probs[i] : KrausProbability(channel[i], simulator,
+                                                      state);
+      };
 
       // Perform sampling of Kraus operators using norms of updated states.
-      for (std::size_t i = 0; i < channel.size(); ++i) {
-        const auto& kop = channel[i];
+      k = SampleKrausOperator(channel, r, cp, prob);
 
-        if (kop.unitary) continue;
+      if (k < channel.size()) {
+        DeferOps(it - cbeg, k, channel[k].ops, gates, cache);
+        CollectStat(param.collect_kop_stat, k, stat);
 
-        double prob = std::real(
-            simulator.ExpectationValue(kop.qubits, kop.kd_k.data(), state));
+        unitary = false;
+      }
+    }
 
-        if (prob > max_prob) {
-          max_prob = prob;
-          max_prob_index = i;
-        }
+    // The relabeled deferred operators cannot be applied by the caller, so
+    // they are always applied if qubits are relabeled.
+    if (apply_last_deferred_ops || !stat.primary
+        || param.relabel_swap_gates) {
+      if (!ApplyDeferredOps(param, num_qubits, simulator, gates, cache,
+                            state)) {
+        return false;
+      }
 
-        cp += prob - kop.prob;
+      NormalizeState(!unitary, state_space, unitary, state);
+
+      if (param.relabel_swap_gates) {
+        ResolveQubitMap(simulator, rchannels.map, state);
+      }
+    }
+
+    return true;
+  }
+
+  /**
+   * Simulates the primary trajectory up to the first measurement and saves
+   * checkpoints, see Parameter::max_checkpoints.
+   */
+  static bool BuildPrefix(const Parameter& param, unsigned num_qubits,
+                          ncircuit_iterator<Gate> cbeg,
+                          ncircuit_iterator<Gate> cend,
+                          const RelabeledChannels& rchannels,
+                          const StateSpace& state_space,
+                          const Simulator& simulator, Prefix& prefix) {
+    std::size_t num_channels = cend - cbeg;
+
+    prefix.size = 0;
+    while (prefix.size < num_channels) {
+      const auto& channel = cbeg[prefix.size];
+      if (channel.size() > 0 && channel[0].kind == gate::kMeasurement) break;
+      ++prefix.size;
+    }
 
-        if (r < cp || i == channel.size() - 1) {
-          // Sample ith Kraus operator if r < cp
-          // Sample the highest probability Kraus operator if r is greater
-          // than the sum of all probablities due to round-off errors.
-          uint64_t k = r < cp ? i : max_prob_index;
+    prefix.probs.resize(prefix.size);
+    prefix.checkpoints.reserve(param.max_checkpoints);
 
-          DeferOps(channel[k].ops, gates);
-          CollectStat(param.collect_kop_stat, k, stat);
+    if (prefix.size == 0) {
+      return true;
+    }
+
+    State state = CreateState(num_qubits, state_space);
+    if (state_space.IsNull(state)) {
+      return false;
+    }
 
-          unitary = false;
+    state_space.SetStateZero(state);
 
-          break;
+    std::vector<const Gate*> gates;
+    gates.reserve(4 * prefix.size);
+
+    FusionCache cache(0);
+
+    bool unitary = true;
+    std::size_t num_draws = 0;
+    unsigned k = 1;
+
+    for (std::size_t i = 0; i <= prefix.size; ++i) {
+      // Checkpoints are saved before channels k * size / max_checkpoints.
+      if (i > 0 && k <= param.max_checkpoints
+          && i >= k * prefix.size / param.max_checkpoints) {
+        while (k <= param.max_checkpoints
+               && k * prefix.size / param.max_checkpoints <= i) {
+          ++k;
         }
+
+        if (!ApplyDeferredOps(param, num_qubits, simulator, gates, cache,
+                              state)) {
+          return false;
+        }
+
+        NormalizeState(!unitary, state_space, unitary, state);
+
+        if (i == num_channels && param.relabel_swap_gates) {
+          ResolveQubitMap(simulator, rchannels.map, state);
+        }
+
+        State checkpoint = CreateState(num_qubits, state_space);
+        if (state_space.IsNull(checkpoint)) {
+          return false;
+        }
+
+        state_space.Copy(state, checkpoint);
+        prefix.checkpoints.push_back({i, num_draws, std::move(checkpoint)});
       }
+
+      if (i == prefix.size) break;
+
+      const auto& channel = cbeg[i];
+
+      if (channel.size() == 0) continue;
+
+      ++num_draws;
+
+      bool has_non_unitary_kops = false;
+      for (const auto& kop : channel) {
+        has_non_unitary_kops = has_non_unitary_kops || !kop.unitary;
+      }
+
+      if (has_non_unitary_kops) {
+        if (!ApplyDeferredOps(param, num_qubits, simulator, gates, cache,
+                              state)) {
+          return false;
+        }
+
+        NormalizeState(!unitary, state_space, unitary, state);
+
+        if (!ComputeKrausProbabilities(channel, simulator, state,
+                                       prefix.probs[i])) {
+          prefix.probs[i].resize(channel.size(), 0);
+
+          for (std::size_t j = 0; j < channel.size(); ++j) {
+            const auto& kop = channel[j];
+            if (kop.unitary) continue;
+
+            prefix.probs[i][j] = KrausProbability(kop, simulator, state);
+          }
+        }
+      }
+
+      DeferOps(i, 0, channel[0].ops, gates, cache);
+      unitary = unitary && channel[0].unitary;
     }
 
-    if (apply_last_deferred_ops || !stat.primary) {
-      if (!ApplyDeferredOps(param, num_qubits, simulator, gates, state)) {
-        return false;
+    return true;
+  }
+
+  /**
+   * Finds the latest checkpoint before the first channel where the given
+   * repetition departs from the primary trajectory.
+   * @return A pointer to the checkpoint or nullptr if there is no such
+   *   checkpoint.
+   */
+  static const Checkpoint* FindCheckpoint(ncircuit_iterator<Gate> cbeg,
+                                          const ErrorSampling& esampling,
+                                          const Prefix& prefix, uint64_t rep) {
+    RGen rgen(rep);
+    std::uniform_real_distribution<double> distr(0.0, 1.0);
+
+    ErrorTrajectory etrajectory;
+    double weight;
+    StartErrorTrajectory(esampling, rep, etrajectory, weight);
+
+    // The first channel of the repetition that is not on the primary
+    // trajectory.
+    std::size_t first = prefix.size;
+
+    for (std::size_t i = 0; i < prefix.size; ++i) {
+      const auto& channel = cbeg[i];
+
+      if (channel.size() == 0) continue;
+
+      double r = distr(rgen);
+      double cp = 0;
+
+      std::size_t k = IsErrorSampled(esampling, i) ?
+          SampleError(channel, esampling, i, r, etrajectory, weight) :
+          SampleKrausOperator(channel, r, cp);
+
+      if (k == channel.size()) {
+        const auto& probs = prefix.probs[i];
+        auto prob = [&probs](std::size_t j) { return probs[j]; };
+
+        k = SampleKrausOperator(channel, r, cp, prob);
       }
 
-      NormalizeState(!unitary, state_space, unitary, state);
+      if (k != 0) {
+        first = i;
+        break;
+      }
+    }
+
+    const Checkpoint* checkpoint = nullptr;
+
+    for (const auto& c : prefix.checkpoints) {
+      if (c.channel > first) break;
+      checkpoint = &c;
+    }
+
+    return checkpoint;
+  }
+
+  /**
+   * Computes the actual sampling probability <state|K^\dagger K|state> of
+   * a non-unitary Kraus operator K in one pass over the state vector.
+   */
+  static double KrausProbability(const KrausOperator<Gate>& kop,
+                                 const Simulator& simulator,
+                                 const State& state) {
+    return std::real(
+        simulator.ExpectationValue(kop.qubits, kop.kd_k.data(), state));
+  }
+
+  /**
+   * Computes the actual sampling probabilities of all the non-unitary Kraus
+   * operators of a channel in one pass over the state vector. The reduced
+   * density matrix rho of the qubits the operators act on is computed first
+   * and then each probability is Tr(K^\dagger K rho). This is done only if
+   * the simulator provides the reduced density matrix kernel, the channel has
+   * at least two non-unitary Kraus operators (otherwise evaluating them one
+   * by one takes at most one pass) and the kernel supports the number of
+   * qubits.
+   * @param channel The channel.
+   * @param simulator Simulator object.
+   * @param state The state of the system.
+   * @param probs Output: the sampling probabilities of the Kraus operators;
+   *   zero for the unitary operators.
+   * @return true if the probabilities are computed; false otherwise.
+   */
+  static bool ComputeKrausProbabilities(const Channel<Gate>& channel,
+                                        const Simulator& simulator,
+                                        const State& state,
+                                        std::vector<double>& probs) {
+    using HasKernel = std::integral_constant<
+        bool, HasReducedDensityMatrixKernel<Simulator>::value>;
+
+    return ComputeKrausProbabilities(
+        HasKernel{}, channel, simulator, state, probs);
+  }
+
+  static bool ComputeKrausProbabilities(std::false_type,
+                                        const Channel<Gate>& channel,
+                                        const Simulator& simulator,
+                                        const State& state,
+                                        std::vector<double>& probs) {
+    return false;
+  }
+
+  static bool ComputeKrausProbabilities(std::true_type,
+                                        const Channel<Gate>& channel,
+                                        const Simulator& simulator,
+                                        const State& state,
+                                        std::vector<double>& probs) {
+    std::vector<unsigned> qubits;
+    unsigned num_non_unitary_kops = 0;
+
+    for (const auto& kop : channel) {
+      if (kop.unitary) continue;
+
+      ++num_non_unitary_kops;
+      qubits.insert(qubits.end(), kop.qubits.begin(), kop.qubits.end());
+    }
+
+    if (num_non_unitary_kops < 2) return false;
+
+    std::sort(qubits.begin(), qubits.end());
+    qubits.erase(std::unique(qubits.begin(), qubits.end()), qubits.end());
+
+    auto rho = simulator.ReducedDensityMatrix(qubits, state);
+    if (rho.empty()) return false;
+
+    uint64_t dsize = uint64_t{1} << qubits.size();
+
+    probs.assign(channel.size(), 0);
+
+    for (std::size_t k = 0; k < channel.size(); ++k) {
+      const auto& kop = channel[k];
+      if (kop.unitary) continue;
+
+      // Bits of the reduced density matrix indices for the qubits of kop
+      // and for the other qubits.
+      unsigned nq = kop.qubits.size();
+      std::vector<uint64_t> bits(nq);
+      uint64_t mask = 0;
+
+      for (unsigned j = 0; j < nq; ++j) {
+        auto it = std::lower_bound(qubits.begin(), qubits.end(),
+                                   kop.qubits[j]);
+        bits[j] = uint64_t{1} << (it - qubits.begin());
+        mask |= bits[j];
+      }
+
+      auto index = [&bits, nq](uint64_t a) {
+        uint64_t i = 0;
+        for (unsigned j = 0; j < nq; ++j) {
+          if (((a >> j) & 1) != 0) i |= bits[j];
+        }
+        return i;
+      };
+
+      // Tr(K^\dagger K rho), where rho is traced over the other qubits.
+      uint64_t ksize = uint64_t{1} << nq;
+      const auto& kd_k = kop.kd_k;
+      double p = 0;
+
+      for (uint64_t a = 0; a < ksize; ++a) {
+        uint64_t ia = index(a);
+
+        for (uint64_t b = 0; b < ksize; ++b) {
+          uint64_t ib = index(b);
+          std::complex<double> m(kd_k[2 * (a * ksize + b)],
+                                 kd_k[2 * (a * ksize + b) + 1]);
+          std::complex<double> r = 0;
+
+          for (uint64_t e = 0; e < dsize; ++e) {
+            if ((e & mask) != 0) continue;
+            r += rho[(ib | e) * dsize + (ia | e)];
+          }
+
+          p += std::real(m * r);
+        }
+      }
+
+      probs[k] = p;
     }
 
     return true;
   }
 
+  /**
+   * Prepares importance sampling of errors, see Parameter::error_bias and
+   * Parameter::num_error_strata.
+   * @return The proposal distributions of errors; perrs is empty if
+   *   importance sampling is disabled.
+   */
+  static ErrorSampling PrepareErrorSampling(const Parameter& param,
+                                            ncircuit_iterator<Gate> cbeg,
+                                            ncircuit_iterator<Gate> cend) {
+    ErrorSampling esampling;
+
+    bool stratified = param.num_error_strata > 1;
+
+    if (!stratified && param.error_bias == 1) {
+      return esampling;
+    }
+
+    std::size_t num_channels = cend - cbeg;
+
+    esampling.perrs.resize(num_channels, 0);
+    esampling.qerrs.resize(num_channels, 0);
+    esampling.primary_weights.resize(num_channels + 1, 1);
+
+    double bias = param.error_bias;
+
+    for (std::size_t i = 0; i < num_channels; ++i) {
+      const auto& channel = cbeg[i];
+
+      bool mixed_unitary = channel.size() > 1;
+      double perr = 0;
+
+      for (std::size_t k = 0; k < channel.size(); ++k) {
+        const auto& kop = channel[k];
+
+        mixed_unitary = mixed_unitary && kop.unitary
+            && kop.kind == KrausOperator<Gate>::kNormal;
+
+        if (k > 0) {
+          perr += kop.prob;
+        }
+      }
+
+      double w = 1;
+
+      if (mixed_unitary) {
+        perr = std::min(perr, 1.0);
+
+        double qerr = stratified ?
+            perr : bias * perr / (1 + (bias - 1) * perr);
+
+        esampling.perrs[i] = perr;
+        esampling.qerrs[i] = qerr;
+
+        if (qerr < 1) {
+          w = (1 - perr) / (1 - qerr);
+        }
+      }
+
+      esampling.primary_weights[i + 1] = esampling.primary_weights[i] * w;
+    }
+
+    if (!stratified) {
+      return esampling;
+    }
+
+    unsigned num_strata = param.num_error_strata;
+
+    esampling.num_strata = num_strata;
+    esampling.strata_probs.resize(num_strata);
+    esampling.tails.resize(num_strata);
+
+    for (unsigned t = 0; t < num_strata; ++t) {
+      auto& tail = esampling.tails[t];
+      tail.resize((num_channels + 1) * num_strata, 0);
+
+      tail[num_channels * num_strata + t] = 1;
+
+      for (std::size_t i = num_channels; i-- > 0;) {
+        double perr = esampling.perrs[i];
+
+        for (unsigned c = 0; c < num_strata; ++c) {
+          unsigned c1 = std::min(c + 1, num_strata - 1);
+          tail[i * num_strata + c] = (1 - perr) * tail[(i + 1) * num_strata + c]
+              + perr * tail[(i + 1) * num_strata + c1];
+        }
+      }
+
+      esampling.strata_probs[t] = tail[0];
+    }
+
+    return esampling;
+  }
+
+  /**
+   * Sets the stratum and the initial likelihood ratio of a repetition, see
+   * ErrorSampling.
+   */
+  static void StartErrorTrajectory(const ErrorSampling& esampling,
+                                   uint64_t rep, ErrorTrajectory& etrajectory,
+                                   double& weight) {
+    unsigned num_strata = esampling.num_strata;
+
+    etrajectory.stratum = num_strata;
+    etrajectory.num_errors = 0;
+    weight = 1;
+
+    if (num_strata > 0) {
+      unsigned stratum = rep % num_strata;
+      double prob = esampling.strata_probs[stratum];
+
+      weight = prob * num_strata;
+
+      // Trajectories of empty strata are sampled naturally; their weights
+      // are zero.
+      if (prob > 0) {
+        etrajectory.stratum = stratum;
+      }
+    }
+  }
+
+  static bool IsErrorSampled(const ErrorSampling& esampling, std::size_t i) {
+    return !esampling.perrs.empty() && esampling.perrs[i] > 0;
+  }
+
+  /**
+   * Samples a Kraus operator of a mixed unitary channel using the proposal
+   * distribution of errors and updates the likelihood ratio.
+   * @param channel The channel.
+   * @param esampling The proposal distributions of errors.
+   * @param i The index of the channel.
+   * @param r A random number in [0, 1).
+   * @param etrajectory The error state of the repetition.
+   * @param weight The likelihood ratio of the repetition.
+   * @return The index of the sampled Kraus operator.
+   */
+  static std::size_t SampleError(const Channel<Gate>& channel,
+                                 const ErrorSampling& esampling,
+                                 std::size_t i, double r,
+                                 ErrorTrajectory& etrajectory,
+                                 double& weight) {
+    double perr = esampling.perrs[i];
+    double qerr = esampling.qerrs[i];
+
+    bool stratified = etrajectory.stratum < esampling.num_strata;
+
+    if (stratified) {
+      // The probability of an error conditioned on the stratum.
+      unsigned num_strata = esampling.num_strata;
+      unsigned c = etrajectory.num_errors;
+      unsigned c1 = std::min(c + 1, num_strata - 1);
+      const auto& tail = esampling.tails[etrajectory.stratum];
+      double p = tail[i * num_strata + c];
+
+      qerr = p > 0 ? perr * tail[(i + 1) * num_strata + c1] / p : 0;
+    }
+
+    if (r >= qerr) {
+      if (!stratified) {
+        weight *= (1 - perr) / (1 - qerr);
+      }
+
+      return 0;
+    }
+
+    if (stratified) {
+      etrajectory.num_errors =
+          std::min(etrajectory.num_errors + 1, esampling.num_strata - 1);
+    } else {
+      weight *= perr / qerr;
+    }
+
+    // Sample one of the errors with the natural probabilities.
+    double cp = 0;
+    r *= perr / qerr;
+
+    for (std::size_t k = 1; k < channel.size(); ++k) {
+      cp += channel[k].prob;
+
+      if (r < cp || k == channel.size() - 1) {
+        return k;
+      }
+    }
+
+    return channel.size() - 1;
+  }
+
   static State CreateState(unsigned num_qubits, const StateSpace& state_space) {
     auto state = state_space.Create(num_qubits);
     if (state_space.IsNull(state)) {
@@ -373,28 +1552,115 @@ class QuantumTrajectorySimulator {
 
   static bool ApplyDeferredOps(
       const Parameter& param, unsigned num_qubits, const Simulator& simulator,
-      std::vector<const Gate*>& gates, State& state) {
+      std::vector<const Gate*>& gates, FusionCache& cache, State& state) {
     if (gates.size() > 0) {
-      auto fgates = Fuser::FuseGates(param, num_qubits, gates);
+      std::vector<typename FusionCache::GateFused> fgates;
 
-      gates.resize(0);
+      auto it = cache.segments.find(cache.key);
 
-      if (fgates.size() == 0) {
-        return false;
+      if (it == cache.segments.end()) {
+        fgates = Fuser::FuseGates(LimitFusedSize<Simulator>(param),
+                                  num_qubits, gates);
+
+        if (fgates.size() == 0) {
+          return false;
+        }
+
+        if (cache.segments.size() < cache.max_size) {
+          auto slots = FindPauliSlots(gates, cache.pauli_gates, fgates);
+          it = cache.segments.emplace(
+              cache.key, typename FusionCache::Segment{
+                  std::move(fgates), std::move(slots)}).first;
+        }
+      } else {
+        FoldPauliErrors(gates, it->second);
       }
 
-      for (const auto& fgate : fgates) {
+      const auto& fgates_to_apply =
+          it != cache.segments.end() ? it->second.fgates : fgates;
+
+      for (const auto& fgate : fgates_to_apply) {
         ApplyFusedGate(simulator, fgate, state);
       }
     }
 
+    gates.resize(0);
+    cache.key.resize(0);
+    cache.pauli_gates.resize(0);
+
     return true;
   }
 
+  /**
+   * Finds the positions of the deferred Pauli channel gates in the fused
+   * gates.
+   */
+  static std::vector<typename FusionCache::PauliSlot> FindPauliSlots(
+      const std::vector<const Gate*>& gates,
+      const std::vector<std::size_t>& pauli_gates,
+      const std::vector<typename FusionCache::GateFused>& fgates) {
+    std::vector<typename FusionCache::PauliSlot> slots;
+
+    if (pauli_gates.size() == 0) return slots;
+
+    std::map<const Gate*, std::size_t> deferred;
+    for (auto i : pauli_gates) {
+      deferred.emplace(gates[i], i);
+    }
+
+    slots.reserve(pauli_gates.size());
+
+    for (std::size_t i = 0; i < fgates.size(); ++i) {
+      const auto& fgate_gates = fgates[i].gates;
+
+      for (std::size_t j = 0; j < fgate_gates.size(); ++j) {
+        auto it = deferred.find(fgate_gates[j]);
+        if (it != deferred.end()) {
+          slots.push_back({i, j, it->second});
+        }
+      }
+    }
+
+    return slots;
+  }
+
+  /**
+   * Replaces the Pauli channel gates of the cached fused gates with
+   * the deferred ones and updates the matrices of the modified fused gates.
+   */
+  static void FoldPauliErrors(const std::vector<const Gate*>& gates,
+                              typename FusionCache::Segment& segment) {
+    std::size_t modified = segment.fgates.size();
+
+    for (const auto& slot : segment.slots) {
+      auto& fgate = segment.fgates[slot.fgate];
+      const Gate* gate = gates[slot.deferred];
+
+      if (fgate.gates[slot.gate] == gate) continue;
+
+      if (modified != slot.fgate && modified < segment.fgates.size()) {
+        CalculateFusedMatrix(segment.fgates[modified]);
+      }
+
+      if (fgate.parent == fgate.gates[slot.gate]) {
+        fgate.parent = gate;
+      }
+
+      fgate.gates[slot.gate] = gate;
+      modified = slot.fgate;
+    }
+
+    if (modified < segment.fgates.size()) {
+      CalculateFusedMatrix(segment.fgates[modified]);
+    }
+  }
+
   static MeasurementResult ApplyMeasurementGate(
-      const StateSpace& state_space, const Gate& gate,
+      const StateSpace& state_space, const Gate& gate, const QubitMap* map,
       RGen& rgen, State& state) {
-    auto result = state_space.Measure(gate.qubits, rgen, state);
+    auto result = map == nullptr ?
+        state_space.Measure(gate.qubits, rgen, state) :
+        MeasureRelabeled(state_space, *map, gate.qubits, rgen, state);
 
     if (!result.valid) {
       IO::errorf("measurement failed.\n");
@@ -403,11 +1669,28 @@ class QuantumTrajectorySimulator {
     return result;
   }
 
-  static void DeferOps(
-      const std::vector<Gate>& ops, std::vector<const Gate*>& gates) {
+  static void DeferOps(uint64_t channel_index, uint64_t kop_index,
+                       const std::vector<Gate>& ops,
+                       std::vector<const Gate*>& gates, FusionCache& cache) {
     for (const auto& op : ops) {
       gates.push_back(&op);
     }
+
+    if (cache.max_size > 0) {
+      cache.key.push_back((channel_index << 32) | kop_index);
+    }
+  }
+
+  static void DeferPauliOps(uint64_t channel_index,
+                            const std::vector<const Gate*>& ops,
+                            std::vector<const Gate*>& gates,
+                            FusionCache& cache) {
+    for (const auto* op : ops) {
+      cache.pauli_gates.push_back(gates.size());
+      gates.push_back(op);
+    }
+
+    cache.key.push_back((channel_index << 32) | kPauliKop);
   }
 
   static void CollectStat(bool collect_stat, uint64_t i, Stat& stat) {
@@ -430,6 +1713,289 @@ class QuantumTrajectorySimulator {
   }
 };
 
+/**
+ * Caches the measurement results (expectation values, etc) of the primary
+ * noise trajectory and reuses them for later repetitions that sample
+ * the primary trajectory, see
+ * QuantumTrajectorySimulator::Parameter::apply_last_deferred_ops. This class
+ * is not thread-safe.
+ */
+template <typename Result>
+class PrimaryTrajectoryCache {
+ public:
+  /**
+   * Returns the measurement results of a repetition.
+   * @param primary True if the primary trajectory is sampled (Stat::primary).
+   * @param measure Function without parameters that performs measurements on
+   *   the final state of the repetition and returns the results. It is not
+   *   called if the primary trajectory results are cached already.
+   * @return The measurement results.
+   */
+  template <typename MeasurementFunc>
+  Result Get(bool primary, MeasurementFunc&& measure) {
+    ++num_repetitions_;
+
+    if (!primary) {
+      return measure();
+    }
+
+    ++num_primary_;
+
+    if (has_result_) {
+      ++num_hits_;
+    } else {
+      result_ = measure();
+      has_result_ = true;
+    }
+
+    return result_;
+  }
+
+  /**
+   * @return True if the primary trajectory results are cached. The last
+   *   deferred operators need not be applied for the primary trajectory
+   *   after that.
+   */
+  bool HasResult() const {
+    return has_result_;
+  }
+
+  /**
+   * @return The number of repetitions passed to Get.
+   */
+  uint64_t NumRepetitions() const {
+    return num_repetitions_;
+  }
+
+  /**
+   * @return The number of repetitions that sampled the primary trajectory.
+   */
+  uint64_t NumPrimary() const {
+    return num_primary_;
+  }
+
+  /**
+   * @return The number of repetitions that reused the cached results.
+   */
+  uint64_t NumHits() const {
+    return num_hits_;
+  }
+
+  /**
+   * @return The fraction of repetitions that reused the cached results.
+   */
+  double HitRate() const {
+    return num_repetitions_ > 0 ? double(num_hits_) / num_repetitions_ : 0;
+  }
+
+ private:
+  Result result_;
+  bool has_result_ = false;
+  uint64_t num_repetitions_ = 0;
+  uint64_t num_primary_ = 0;
+  uint64_t num_hits_ = 0;
+};
+
+/**
+ * Streaming estimator of expectation values from the measurement results of
+ * noisy repetitions. It keeps running weighted means and variances of each
+ * value (Welford's algorithm generalized to weighted samples) and decides
+ * when to stop: when the standard errors of all the values reach the target
+ * or when the repetition or time budget is exhausted. The weights are
+ * the likelihood ratios of importance sampling (see
+ * QuantumTrajectorySimulator::Stat::weight), one otherwise; the weighted
+ * sums are normalized by the sum of the weights. This can be used with
+ * QuantumTrajectorySimulator::RunBatchUntil. This class is not thread-safe.
+ */
+class TrajectoryEstimator {
+ public:
+  struct Parameter {
+    /**
+     * The target standard error of each value; zero if there is no target.
+     */
+    double target_std_error = 0;
+    /**
+     * The minimum number of repetitions before the target standard error
+     * is checked. This should be large enough to sample rare trajectories:
+     * the estimated standard errors are zero until the first repetition
+     * that departs from the primary trajectory.
+     */
+    uint64_t min_repetitions = 100;
+    /**
+     * The maximum number of repetitions; zero if there is no limit.
+     */
+    uint64_t max_repetitions = 0;
+    /**
+     * The time budget in seconds, measured from the construction of
+     * the estimator; zero if there is no limit.
+     */
+    double max_time = 0;
+    /**
+     * The estimator stops only after multiples of block_size repetitions
+     * (except for max_repetitions), for instance, to keep error strata
+     * balanced, see QuantumTrajectorySimulator::Parameter::num_error_strata.
+     */
+    uint64_t block_size = 1;
+  };
+
+  TrajectoryEstimator(unsigned num_values, const Parameter& param)
+      : param_(param), values_(num_values),
+        start_time_(std::chrono::steady_clock::now()) {}
+
+  /**
+   * Adds the measurement results of a repetition.
+   * @param values The values measured in the repetition (expectation values,
+   *   etc); the number of values should be the same as in the constructor.
+   * @param weight The weight of the repetition.
+   */
+  template <typename Values>
+  void Add(const Values& values, double weight = 1) {
+    ++num_repetitions_;
+
+    double u = weight * weight;
+
+    sum_weights_ += weight;
+    sum_weights2_ += u;
+
+    for (std::size_t i = 0; i < values_.size(); ++i) {
+      auto& v = values_[i];
+      std::complex<double> x = values[i];
+
+      if (sum_weights_ != 0) {
+        v.mean += (weight / sum_weights_) * (x - v.mean);
+      }
+
+      if (sum_weights2_ > 0) {
+        auto d = x - v.mean2;
+        v.mean2 += (u / sum_weights2_) * d;
+        v.m2 += u * std::real(std::conj(d) * (x - v.mean2));
+      }
+    }
+  }
+
+  /**
+   * @return True if no more repetitions should be performed.
+   */
+  bool Done() const {
+    uint64_t n = num_repetitions_;
+
+    if (param_.max_repetitions > 0 && n >= param_.max_repetitions) {
+      return true;
+    }
+
+    if (param_.block_size > 1 && n % param_.block_size != 0) {
+      return false;
+    }
+
+    if (param_.max_time > 0 && ElapsedTime() >= param_.max_time) {
+      return true;
+    }
+
+    return param_.target_std_error > 0 && n >= param_.min_repetitions
+        && n > 1 && MaxStdError() <= param_.target_std_error;
+  }
+
+  /**
+   * @return The estimate of the ith value.
+   */
+  std::complex<double> Mean(unsigned i) const {
+    return values_[i].mean;
+  }
+
+  /**
+   * @return The standard error of the estimate of the ith value; the real
+   *   and imaginary parts contribute to the variance.
+   */
+  double StdError(unsigned i) const {
+    uint64_t n = num_repetitions_;
+
+    if (n < 2 || sum_weights_ == 0) return 0;
+
+    const auto& v = values_[i];
+
+    // The sum of u * |x - mean|^2 with u = weight^2.
+    double s = v.m2 + sum_weights2_ * std::norm(v.mean2 - v.mean);
+    double var = s / (sum_weights_ * sum_weights_) * n / (n - 1);
+
+    return std::sqrt(std::max(var, 0.0));
+  }
+
+  /**
+   * @return The maximum standard error over all the values.
+   */
+  double MaxStdError() const {
+    double max_error = 0;
+    for (unsigned i = 0; i < values_.size(); ++i) {
+      max_error = std::max(max_error, StdError(i));
+    }
+
+    return max_error;
+  }
+
+  std::vector<std::complex<double>> Means() const {
+    std::vector<std::complex<double>> means;
+    means.reserve(values_.size());
+
+    for (unsigned i = 0; i < values_.size(); ++i) {
+      means.push_back(Mean(i));
+    }
+
+    return means;
+  }
+
+  std::vector<double> StdErrors() const {
+    std::vector<double> errors;
+    errors.reserve(values_.size());
+
+    for (unsigned i = 0; i < values_.size(); ++i) {
+      errors.push_back(StdError(i));
+    }
+
+    return errors;
+  }
+
+  /**
+   * @return The number of repetitions passed to Add.
+   */
+  uint64_t NumRepetitions() const {
+    return num_repetitions_;
+  }
+
+  /**
+   * @return The effective number of repetitions of importance sampling,
+   *   (sum of weights)^2 / (sum of squared weights); the number of
+   *   repetitions if all the weights are equal.
+   */
+  double EffectiveSampleSize() const {
+    return sum_weights2_ > 0 ? sum_weights_ * sum_weights_ / sum_weights2_ : 0;
+  }
+
+  /**
+   * @return The time in seconds since the construction of the estimator.
+   */
+  double ElapsedTime() const {
+    std::chrono::duration<double> elapsed =
+        std::chrono::steady_clock::now() - start_time_;
+    return elapsed.count();
+  }
+
+ private:
+  struct Value {
+    // The running mean with weights w.
+    std::complex<double> mean = 0;
+    // The running mean and the sum of squared deviations with weights w^2.
+    std::complex<double> mean2 = 0;
+    double m2 = 0;
+  };
+
+  Parameter param_;
+  std::vector<Value> values_;
+  uint64_t num_repetitions_ = 0;
+  double sum_weights_ = 0;
+  double sum_weights2_ = 0;
+  std::chrono::steady_clock::time_point start_time_;
+};
+
 }  // namespace qsim
 
 #endif  // QTRAJECTORY_H_
@@ -0,0 +1,627 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef QTRAJECTORY_BATCH_H_
+#define QTRAJECTORY_BATCH_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <deque>
+#include <map>
+#include <random>
+#include <vector>
+
+#include "channel.h"
+#include "circuit_noisy.h"
+#include "gate.h"
+#include "fuser.h"
+#include "gate_appl.h"
+#include "matrix.h"
+
+namespace qsim {
+
+/**
+ * Quantum trajectory simulator that runs batches of trajectories in one
+ * vectorized state, see SimulatorBatch and StateSpaceBatch. This is meant
+ * for small noisy circuits, where the batch of state vectors fits in
+ * the L2 cache and the per-gate overhead dominates; circuits with more than
+ * MaxNumQubits() qubits are rejected, QuantumTrajectorySimulator is faster
+ * for them. Kraus
+ * operators sampled by all the trajectories of a batch (gates, in
+ * particular) are deferred and fused, and each fused gate is applied to all
+ * the trajectories in one pass. Kraus operators that differ between
+ * trajectories are deferred as gates with per-lane matrices and fused with
+ * the other deferred operators, so they do not break fusion (Kraus
+ * operators with controlled gates are applied to the respective lanes with
+ * per-lane masks instead).
+ * Repetition r is seeded by r and samples the same Kraus operators as
+ * QuantumTrajectorySimulator, so the results are the same up to round-off
+ * errors. Measurement gates are not supported. Fused gates are limited to
+ * Simulator::kMaxGateQubits qubits (max_fused_size is reduced if needed);
+ * circuits with Kraus operators on more qubits are rejected.
+ */
+template <typename IO, typename Gate,
+          template <typename, typename> class FuserT, typename Simulator,
+          typename RGen = std::mt19937>
+class BatchedTrajectorySimulator {
+ public:
+  using Fuser = FuserT<IO, const Gate*>;
+  using StateSpace = typename Simulator::StateSpace;
+  using State = typename Simulator::State;
+  using fp_type = typename Simulator::fp_type;
+
+  static constexpr unsigned kBatchSize = Simulator::kBatchSize;
+
+  /**
+   * The maximum size of the batch of state vectors in bytes. Larger batches
+   * do not fit in the L2 cache, and the batched simulator is slower than
+   * QuantumTrajectorySimulator for them.
+   */
+  static constexpr uint64_t kMaxBatchStateSize = 512 * 1024;
+
+  /**
+   * @return The maximum number of qubits of circuits that can be simulated;
+   *   the batch of state vectors is not larger than kMaxBatchStateSize.
+   */
+  static unsigned MaxNumQubits() {
+    unsigned num_qubits = 0;
+
+    while (StateSpace::MinSize(num_qubits + 1) * sizeof(fp_type)
+           <= kMaxBatchStateSize) {
+      ++num_qubits;
+    }
+
+    return num_qubits;
+  }
+
+  /**
+   * User-specified parameters for the simulator.
+   */
+  struct Parameter : public Fuser::Parameter {
+    /**
+     * The maximum number of circuit segments for which fused gates are
+     * cached, as in QuantumTrajectorySimulator. A segment is a run of
+     * channels in which all the trajectories of a batch sample the same
+     * Kraus operators. Zero disables caching.
+     */
+    unsigned max_fusion_cache_size = 64;
+  };
+
+  /**
+   * Runs the given noisy circuit performing repetitions in batches of
+   * kBatchSize. Each repetition is seeded by repetition ID.
+   * @param param Options for the simulator.
+   * @param circuit The noisy circuit to be simulated.
+   * @param r0, r1 The range of repetition IDs [r0, r1) to perform repetitions.
+   * @param state_space StateSpace object required to manipulate the batch of
+   *   state vectors.
+   * @param simulator Simulator object. Provides specific implementations for
+   *   applying gates.
+   * @param measure Function that performs measurements (in the sense of
+   *   computing expectation values, etc) once per batch. This function should
+   *   have three required parameters [repetition ID of lane 0 (uint64_t),
+   *   the number of lanes that hold repetitions in [r0, r1) (unsigned),
+   *   final batch of state vectors (const State&)] and any number of optional
+   *   parameters; lane l holds repetition l + (repetition ID of lane 0).
+   * @param args Optional arguments for the 'measure' function.
+   * @return True if the simulation completed successfully; false otherwise.
+   */
+  template <typename MeasurementFunc, typename... Args>
+  static bool RunBatch(const Parameter& param,
+                       const NoisyCircuit<Gate>& circuit,
+                       uint64_t r0, uint64_t r1, const StateSpace& state_space,
+                       const Simulator& simulator, MeasurementFunc&& measure,
+                       Args&&... args) {
+    return RunBatch(param, circuit.num_qubits, circuit.channels.begin(),
+                    circuit.channels.end(), r0, r1, state_space, simulator,
+                    measure, args...);
+  }
+
+  /**
+   * Runs the given noisy circuit performing repetitions in batches of
+   * kBatchSize. Each repetition is seeded by repetition ID.
+   * @param param Options for the simulator.
+   * @param num_qubits The number of qubits acted on by the circuit.
+   * @param cbeg, cend The range of channels [cbeg, cend) to run the circuit.
+   * @param r0, r1 The range of repetition IDs [r0, r1) to perform repetitions.
+   * @param state_space StateSpace object required to manipulate the batch of
+   *   state vectors.
+   * @param simulator Simulator object. Provides specific implementations for
+   *   applying gates.
+   * @param measure Function that performs measurements, see above.
+   * @param args Optional arguments for the 'measure' function.
+   * @return True if the simulation completed successfully; false otherwise.
+   */
+  template <typename MeasurementFunc, typename... Args>
+  static bool RunBatch(const Parameter& param, unsigned num_qubits,
+                       ncircuit_iterator<Gate> cbeg,
+                       ncircuit_iterator<Gate> cend,
+                       uint64_t r0, uint64_t r1, const StateSpace& state_space,
+                       const Simulator& simulator, MeasurementFunc&& measure,
+                       Args&&... args) {
+    if (num_qubits > MaxNumQubits()) {
+      IO::errorf("circuits with more than %u qubits are not supported by "
+                 "BatchedTrajectorySimulator; use QuantumTrajectorySimulator "
+                 "instead.\n", MaxNumQubits());
+      return false;
+    }
+
+    if (!CheckChannels(cbeg, cend)) {
+      return false;
+    }
+
+    Parameter bparam = LimitFusedSize<Simulator>(param);
+
+    State state = state_space.Create(num_qubits);
+    if (state_space.IsNull(state)) {
+      IO::errorf("not enough memory: is the number of qubits too large?\n");
+      return false;
+    }
+
+    std::vector<const Gate*> gates;
+    gates.reserve(4 * std::size_t(cend - cbeg));
+
+    FusionCache cache(param.max_fusion_cache_size);
+
+    for (uint64_t r = r0; r < r1; r += kBatchSize) {
+      unsigned num_reps = r1 - r < kBatchSize ? r1 - r : kBatchSize;
+
+      if (!RunOnce(bparam, num_qubits, cbeg, cend, r, state_space, simulator,
+                   gates, cache, state)) {
+        return false;
+      }
+
+      measure(r, num_reps, state, args...);
+    }
+
+    return true;
+  }
+
+ private:
+  using GateFused = typename Fuser::GateFused;
+
+  // Kraus operators of a channel that differ between the lanes. The gate
+  // acts on the qubits of all the sampled Kraus operators and stands for
+  // them in fusion; its matrix is the identity.
+  struct LaneGate {
+    Gate gate;
+    // Matrices of the sampled Kraus operators, indexed by Kraus operator.
+    std::vector<Matrix<fp_type>> matrices;
+    // Kraus operator sampled by each lane; matrices.size() for the identity.
+    std::size_t ks[kBatchSize];
+  };
+
+  // Fused gates of circuit segments; the key of a segment is the channel
+  // index (upper 32 bits) and the Kraus operator index (lower 32 bits) of
+  // each deferred Kraus operator. Segments with lane gates are not cached.
+  struct FusionCache {
+    explicit FusionCache(std::size_t max_size) : max_size(max_size) {}
+
+    std::vector<uint64_t> key;
+    std::map<std::vector<uint64_t>, std::vector<GateFused>> segments;
+    std::size_t max_size;
+    // Lane gates of the current segment.
+    std::deque<LaneGate> lane_gates;
+  };
+
+  static bool CheckChannels(ncircuit_iterator<Gate> cbeg,
+                            ncircuit_iterator<Gate> cend) {
+    constexpr unsigned max_qubits = Simulator::kMaxGateQubits;
+
+    for (auto it = cbeg; it != cend; ++it) {
+      for (const auto& kop : *it) {
+        if (!kop.unitary && kop.qubits.size() > max_qubits) {
+          IO::errorf("non-unitary Kraus operators on more than %u qubits "
+                     "are not supported by BatchedTrajectorySimulator.\n",
+                     max_qubits);
+          return false;
+        }
+
+        for (const auto& op : kop.ops) {
+          if (op.qubits.size() > max_qubits) {
+            IO::errorf("gates on more than %u qubits are not supported by "
+                       "BatchedTrajectorySimulator.\n", max_qubits);
+            return false;
+          }
+
+          if (op.kind == gate::kMeasurement) {
+            IO::errorf("measurement gates are not supported by "
+                       "BatchedTrajectorySimulator.\n");
+            return false;
+          }
+
+          if (op.matrix.size() == 0 && it->size() > 1) {
+            IO::errorf("Kraus operators without gate matrices are not "
+                       "supported by BatchedTrajectorySimulator.\n");
+            return false;
+          }
+        }
+      }
+    }
+
+    return true;
+  }
+
+  // Runs one batch of trajectories. The Kraus operators sampled by all
+  // the trajectories (gates, in particular) are deferred and fused. Kraus
+  // operators that differ between trajectories are applied with per-lane
+  // masks after the deferred operators. The trajectories are normalized
+  // before the actual sampling probabilities are needed and at the end.
+  static bool RunOnce(const Parameter& param, unsigned num_qubits,
+                      ncircuit_iterator<Gate> cbeg,
+                      ncircuit_iterator<Gate> cend, uint64_t rep,
+                      const StateSpace& state_space,
+                      const Simulator& simulator,
+                      std::vector<const Gate*>& gates, FusionCache& cache,
+                      State& state) {
+    std::vector<RGen> rgens;
+    rgens.reserve(kBatchSize);
+
+    for (unsigned l = 0; l < kBatchSize; ++l) {
+      rgens.emplace_back(rep + l);
+    }
+
+    std::uniform_real_distribution<double> distr(0.0, 1.0);
+
+    gates.resize(0);
+    cache.key.resize(0);
+
+    state_space.SetStateZero(state);
+
+    double rs[kBatchSize];
+    double cps[kBatchSize];
+    std::size_t ks[kBatchSize];
+    bool unitary[kBatchSize];
+    fp_type mask[kBatchSize];
+
+    for (unsigned l = 0; l < kBatchSize; ++l) {
+      unitary[l] = true;
+    }
+
+    for (auto it = cbeg; it != cend; ++it) {
+      const auto& channel = *it;
+
+      if (channel.size() == 0) continue;
+
+      bool sample_norms = false;
+
+      // Perform sampling of Kraus operators using probability bounds.
+      for (unsigned l = 0; l < kBatchSize; ++l) {
+        rs[l] = distr(rgens[l]);
+        cps[l] = 0;
+        ks[l] = SampleKrausOperator(channel, rs[l], cps[l]);
+        sample_norms = sample_norms || ks[l] == channel.size();
+      }
+
+      if (sample_norms) {
+        if (!ApplyDeferredOps(param, num_qubits, simulator, gates, cache,
+                              state)) {
+          return false;
+        }
+
+        NormalizeState(state_space, unitary, state);
+
+        SampleKrausOperators(channel, rs, cps, simulator, state, ks);
+      }
+
+      bool same_kops = true;
+      for (unsigned l = 1; l < kBatchSize; ++l) {
+        same_kops = same_kops && ks[l] == ks[0];
+      }
+
+      if (same_kops) {
+        if (ks[0] < channel.size()) {
+          DeferOps(it - cbeg, ks[0], channel[ks[0]].ops, gates, cache);
+        }
+      } else if (!DeferLaneOps(channel, ks, gates, cache)) {
+        if (!ApplyDeferredOps(param, num_qubits, simulator, gates, cache,
+                              state)) {
+          return false;
+        }
+
+        for (std::size_t k = 0; k < channel.size(); ++k) {
+          bool sampled = false;
+
+          for (unsigned l = 0; l < kBatchSize; ++l) {
+            mask[l] = ks[l] == k ? 1 : 0;
+            sampled = sampled || ks[l] == k;
+          }
+
+          if (!sampled) continue;
+
+          for (const auto& op : channel[k].ops) {
+            simulator.ApplyGateMasked(op.qubits, op.controlled_by, op.cmask,
+                                      op.matrix.data(), mask, state);
+          }
+        }
+      }
+
+      for (unsigned l = 0; l < kBatchSize; ++l) {
+        if (ks[l] < channel.size()) {
+          unitary[l] = unitary[l] && channel[ks[l]].unitary;
+        }
+      }
+    }
+
+    if (!ApplyDeferredOps(param, num_qubits, simulator, gates, cache,
+                          state)) {
+      return false;
+    }
+
+    NormalizeState(state_space, unitary, state);
+
+    return true;
+  }
+
+  // Samples Kraus operators using the actual sampling probabilities of
+  // the non-unitary Kraus operators in the lanes where the lower bounds do
+  // not suffice; the probabilities are evaluated for all the lanes at once
+  // and only if needed.
+  static void SampleKrausOperators(const Channel<Gate>& channel,
+                                   const double* rs, const double* cps,
+                                   const Simulator& simulator,
+                                   const State& state, std::size_t* ks) {
+    std::vector<std::vector<double>> probs(channel.size());
+
+    for (unsigned l = 0; l < kBatchSize; ++l) {
+      if (ks[l] < channel.size()) continue;
+
+      auto prob = [l, &probs, &channel, &simulator, &state](std::size_t i) {
+        if (probs[i].empty()) {
+          const auto& kop = channel[i];
+          auto evs = simulator.ExpectationValues(
+              kop.qubits, kop.kd_k.data(), state);
+
+          probs[i].reserve(kBatchSize);
+          for (const auto& ev : evs) {
+            probs[i].push_back(std::real(ev));
+          }
+        }
+
+        return probs[i][l];
+      };
+
+      // Perform sampling of Kraus operators using norms of updated states.
+      ks[l] = SampleKrausOperator(channel, rs[l], cps[l], prob);
+    }
+  }
+
+  static bool ApplyDeferredOps(
+      const Parameter& param, unsigned num_qubits, const Simulator& simulator,
+      std::vector<const Gate*>& gates, FusionCache& cache, State& state) {
+    if (gates.size() > 0) {
+      std::vector<GateFused> fgates;
+
+      bool cacheable = cache.lane_gates.empty();
+
+      auto it = cacheable ? cache.segments.find(cache.key)
+                          : cache.segments.end();
+
+      if (it == cache.segments.end()) {
+        fgates = Fuser::FuseGates(param, num_qubits, gates);
+
+        if (fgates.size() == 0) {
+          return false;
+        }
+
+        if (cacheable && cache.segments.size() < cache.max_size) {
+          it = cache.segments.emplace(cache.key, std::move(fgates)).first;
+        }
+      }
+
+      const auto& fgates_to_apply =
+          it != cache.segments.end() ? it->second : fgates;
+
+      std::vector<fp_type> matrices;
+
+      for (const auto& fgate : fgates_to_apply) {
+        if (cacheable || !CalculateLaneMatrices(fgate, cache, matrices)) {
+          ApplyFusedGate(simulator, fgate, state);
+        } else {
+          simulator.ApplyLaneGate(fgate.qubits, matrices.data(), state);
+        }
+      }
+    }
+
+    gates.resize(0);
+    cache.key.resize(0);
+    cache.lane_gates.clear();
+
+    return true;
+  }
+
+  // Defers the Kraus operators sampled by the lanes as a lane gate. Returns
+  // false if the Kraus operators contain controlled gates or act on too many
+  // qubits; they should be applied with per-lane masks then.
+  static bool DeferLaneOps(const Channel<Gate>& channel, const std::size_t* ks,
+                           std::vector<const Gate*>& gates,
+                           FusionCache& cache) {
+    std::vector<unsigned> qubits;
+    const Gate* first_op = nullptr;
+
+    for (unsigned l = 0; l < kBatchSize; ++l) {
+      if (ks[l] >= channel.size()) continue;
+
+      for (const auto& op : channel[ks[l]].ops) {
+        if (op.controlled_by.size() > 0 || op.kind == gate::kPauliRotation) {
+          return false;
+        }
+
+        if (first_op == nullptr) {
+          first_op = &op;
+        }
+
+        qubits.insert(qubits.end(), op.qubits.begin(), op.qubits.end());
+      }
+    }
+
+    std::sort(qubits.begin(), qubits.end());
+    qubits.erase(std::unique(qubits.begin(), qubits.end()), qubits.end());
+
+    if (qubits.size() > Simulator::kMaxGateQubits) {
+      return false;
+    }
+
+    // All the lanes sampled Kraus operators without gates (the identity).
+    if (first_op == nullptr) return true;
+
+    unsigned num_qubits = qubits.size();
+
+    cache.lane_gates.push_back({{Gate::GateKind::kMatrix, first_op->time,
+                                 qubits, {}, 0, {}, {}, false, false},
+                                std::vector<Matrix<fp_type>>(channel.size()),
+                                {}});
+    auto& lgate = cache.lane_gates.back();
+
+    MatrixIdentity(unsigned{1} << num_qubits, lgate.gate.matrix);
+
+    for (unsigned l = 0; l < kBatchSize; ++l) {
+      std::size_t k = ks[l];
+      lgate.ks[l] = k < channel.size() ? k : channel.size();
+
+      if (k >= channel.size() || lgate.matrices[k].size() > 0) continue;
+
+      auto& matrix = lgate.matrices[k];
+      MatrixIdentity(unsigned{1} << num_qubits, matrix);
+
+      for (const auto& op : channel[k].ops) {
+        unsigned mask = 0;
+        for (auto q : op.qubits) {
+          auto pos = std::find(qubits.begin(), qubits.end(), q);
+          mask |= unsigned{1} << (pos - qubits.begin());
+        }
+
+        MatrixMultiply(mask, op.qubits.size(), op.matrix, num_qubits, matrix);
+      }
+    }
+
+    gates.push_back(&lgate.gate);
+
+    return true;
+  }
+
+  // Calculates the matrices of the fused gate in all the lanes if the fused
+  // gate contains lane gates; element j of the matrix in lane l is
+  // matrices[kBatchSize * j + l]. Lanes that sampled the same Kraus
+  // operators share the calculation. Returns false if there are no lane
+  // gates in the fused gate.
+  static bool CalculateLaneMatrices(const GateFused& fgate,
+                                    const FusionCache& cache,
+                                    std::vector<fp_type>& matrices) {
+    std::vector<const LaneGate*> lgates(fgate.gates.size(), nullptr);
+    bool has_lane_gates = false;
+
+    for (std::size_t i = 0; i < fgate.gates.size(); ++i) {
+      for (const auto& lgate : cache.lane_gates) {
+        if (fgate.gates[i] == &lgate.gate) {
+          lgates[i] = &lgate;
+          has_lane_gates = true;
+          break;
+        }
+      }
+    }
+
+    if (!has_lane_gates) return false;
+
+    unsigned num_qubits = fgate.qubits.size();
+    std::size_t size = std::size_t{2} << (2 * num_qubits);
+
+    matrices.resize(kBatchSize * size);
+
+    Matrix<fp_type> matrix;
+
+    for (unsigned l = 0; l < kBatchSize; ++l) {
+      // Reuse the matrix of a previous lane with the same Kraus operators.
+      unsigned l0 = 0;
+      for (; l0 < l; ++l0) {
+        bool same = true;
+        for (const auto lgate : lgates) {
+          same = same && (lgate == nullptr || lgate->ks[l0] == lgate->ks[l]);
+        }
+
+        if (same) break;
+      }
+
+      if (l0 < l) {
+        for (std::size_t j = 0; j < size; ++j) {
+          matrices[kBatchSize * j + l] = matrices[kBatchSize * j + l0];
+        }
+
+        continue;
+      }
+
+      MatrixIdentity(unsigned{1} << num_qubits, matrix);
+
+      for (std::size_t i = 0; i < fgate.gates.size(); ++i) {
+        const auto& pgate = *fgate.gates[i];
+
+        if (lgates[i] != nullptr) {
+          std::size_t k = lgates[i]->ks[l];
+          if (k == lgates[i]->matrices.size()) continue;
+
+          unsigned mask = detail::GetFusedQubitMask(fgate, pgate);
+          MatrixMultiply(mask, pgate.qubits.size(), lgates[i]->matrices[k],
+                         num_qubits, matrix);
+        } else {
+          unsigned mask = detail::GetFusedQubitMask(fgate, pgate);
+          MatrixMultiply(mask, pgate.qubits.size(), pgate.matrix,
+                         num_qubits, matrix);
+        }
+      }
+
+      for (std::size_t j = 0; j < size; ++j) {
+        matrices[kBatchSize * j + l] = matrix[j];
+      }
+    }
+
+    return true;
+  }
+
+  static void DeferOps(uint64_t channel_index, uint64_t kop_index,
+                       const std::vector<Gate>& ops,
+                       std::vector<const Gate*>& gates, FusionCache& cache) {
+    for (const auto& op : ops) {
+      gates.push_back(&op);
+    }
+
+    cache.key.push_back((channel_index << 32) | kop_index);
+  }
+
+  // Normalizes the trajectories in which non-unitary Kraus operators were
+  // sampled since the last normalization.
+  static void NormalizeState(const StateSpace& state_space, bool* unitary,
+                             State& state) {
+    bool normalize = false;
+    for (unsigned l = 0; l < kBatchSize; ++l) {
+      normalize = normalize || !unitary[l];
+    }
+
+    if (!normalize) return;
+
+    auto norms = state_space.Norms(state);
+
+    fp_type factors[kBatchSize];
+    for (unsigned l = 0; l < kBatchSize; ++l) {
+      factors[l] = unitary[l] ? 1 : 1 / std::sqrt(norms[l]);
+      unitary[l] = true;
+    }
+
+    state_space.Multiply(factors, state);
+  }
+};
+
+}  // namespace qsim
+
+#endif  // QTRAJECTORY_BATCH_H_
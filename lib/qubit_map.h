@@ -0,0 +1,525 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef QUBIT_MAP_H_
+#define QUBIT_MAP_H_
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "gate.h"
+#include "gate_appl.h"
+#include "matrix.h"
+
+namespace qsim {
+
+/**
+ * Logical-to-physical qubit map: logical qubit q is stored in the state
+ * vector as physical qubit map[q].
+ */
+using QubitMap = std::vector<unsigned>;
+
+inline QubitMap IdentityQubitMap(unsigned num_qubits) {
+  QubitMap map(num_qubits);
+
+  for (unsigned q = 0; q < num_qubits; ++q) {
+    map[q] = q;
+  }
+
+  return map;
+}
+
+/**
+ * Checks if the gate is an uncontrolled SWAP gate. Gates are identified
+ * by their matrices, so this works for any gate set.
+ * @param gate The gate to be checked.
+ * @return True if the gate is a SWAP gate; false otherwise.
+ */
+template <typename Gate>
+inline bool IsSwapGate(const Gate& gate) {
+  using fp_type = typename Gate::fp_type;
+
+  if (gate.kind == gate::kMeasurement || gate.qubits.size() != 2
+      || gate.controlled_by.size() > 0 || gate.matrix.size() != 32) {
+    return false;
+  }
+
+  const fp_type swap[32] = {1, 0, 0, 0, 0, 0, 0, 0,
+                            0, 0, 0, 0, 1, 0, 0, 0,
+                            0, 0, 1, 0, 0, 0, 0, 0,
+                            0, 0, 0, 0, 0, 0, 1, 0};
+
+  for (unsigned i = 0; i < 32; ++i) {
+    if (std::abs(gate.matrix[i] - swap[i]) > 1e-6) return false;
+  }
+
+  return true;
+}
+
+/**
+ * Relabels gate qubits (including control qubits) according to the given
+ * qubit map. Gate matrices are shuffled to keep the qubits sorted.
+ * @param map Qubit map.
+ * @param gate The gate to be relabeled.
+ */
+template <typename Gate>
+inline void RelabelGate(const QubitMap& map, Gate& gate) {
+  for (auto& q : gate.qubits) {
+    q = map[q];
+  }
+
+  if (gate.kind != gate::kMeasurement) {
+    for (std::size_t i = 1; i < gate.qubits.size(); ++i) {
+      if (gate.qubits[i - 1] > gate.qubits[i]) {
+        auto perm = NormalToGateOrderPermutation(gate.qubits);
+        MatrixShuffle(perm, gate.qubits.size(), gate.matrix);
+
+        if (gate.kind == gate::kPauliRotation) {
+          // The Pauli operators follow the gate qubits.
+          std::vector<std::pair<unsigned, unsigned>> ops;
+          ops.reserve(gate.qubits.size());
+
+          for (std::size_t j = 0; j < gate.qubits.size(); ++j) {
+            ops.push_back({gate.qubits[j], unsigned(gate.params[j + 1])});
+          }
+
+          std::sort(ops.begin(), ops.end());
+
+          for (std::size_t j = 0; j < ops.size(); ++j) {
+            gate.params[j + 1] = ops[j].second;
+          }
+        }
+
+        std::sort(gate.qubits.begin(), gate.qubits.end());
+        break;
+      }
+    }
+  }
+
+  if (gate.controlled_by.size() > 0) {
+    std::vector<unsigned> controlled_by;
+    std::vector<unsigned> control_values;
+
+    controlled_by.reserve(gate.controlled_by.size());
+    control_values.reserve(gate.controlled_by.size());
+
+    for (std::size_t i = 0; i < gate.controlled_by.size(); ++i) {
+      controlled_by.push_back(map[gate.controlled_by[i]]);
+      control_values.push_back((gate.cmask >> i) & 1);
+    }
+
+    gate.controlled_by.resize(0);
+    MakeControlledGate(std::move(controlled_by), control_values, gate);
+  }
+}
+
+/**
+ * Permutes physical qubits of the state vector. If at most six qubits move,
+ * this is done in a single pass by applying a permutation gate; otherwise
+ * physical SWAP gates are applied.
+ * @param simulator Simulator object. Provides specific implementations for
+ *   applying gates.
+ * @param perm Qubit permutation: physical qubit p moves to physical qubit
+ *   perm[p].
+ * @param state The state of the system, to be updated by this method.
+ */
+template <typename Simulator>
+inline void PermuteQubits(const Simulator& simulator, QubitMap perm,
+                          typename Simulator::State& state) {
+  using fp_type = typename Simulator::fp_type;
+
+  std::vector<unsigned> qubits;
+
+  for (unsigned p = 0; p < perm.size(); ++p) {
+    if (perm[p] != p) {
+      qubits.push_back(p);
+    }
+  }
+
+  if (qubits.size() == 0) return;
+
+  if (qubits.size() <= detail::kMaxControlledPermutationGateQubits) {
+    unsigned n = qubits.size();
+    unsigned size = unsigned{1} << n;
+
+    // dest[i] is the gate-local index of the destination of qubits[i].
+    std::vector<unsigned> dest(n);
+
+    for (unsigned i = 0; i < n; ++i) {
+      dest[i] = std::lower_bound(qubits.begin(), qubits.end(),
+                                 perm[qubits[i]]) - qubits.begin();
+    }
+
+    std::vector<unsigned> iperm(size);
+    std::vector<fp_type> phases(2 * size, 0);
+
+    for (unsigned k = 0; k < size; ++k) {
+      unsigned j = 0;
+
+      for (unsigned i = 0; i < n; ++i) {
+        j |= ((k >> dest[i]) & 1) << i;
+      }
+
+      iperm[k] = j;
+      phases[2 * k] = 1;
+    }
+
+    Matrix<fp_type> matrix;
+    MatrixFromPermutation(size, iperm, phases, matrix);
+
+    detail::ApplyGateMatrix(simulator, qubits, {}, 0, matrix, state);
+
+    return;
+  }
+
+  const Matrix<fp_type> swap = {1, 0, 0, 0, 0, 0, 0, 0,
+                                0, 0, 0, 0, 1, 0, 0, 0,
+                                0, 0, 1, 0, 0, 0, 0, 0,
+                                0, 0, 0, 0, 0, 0, 1, 0};
+
+  // inv[p] is the physical qubit that moves to physical qubit p.
+  QubitMap inv(perm.size());
+
+  for (unsigned p = 0; p < perm.size(); ++p) {
+    inv[perm[p]] = p;
+  }
+
+  for (unsigned p = 0; p < perm.size(); ++p) {
+    unsigned r = inv[p];
+    if (r == p) continue;
+
+    // The qubit that is at physical qubit r moves to its destination p, and
+    // the qubit that is at p moves to r.
+    std::vector<unsigned> qs = {std::min(p, r), std::max(p, r)};
+    detail::ApplyGateMatrix(simulator, qs, {}, 0, swap, state);
+
+    unsigned d = perm[p];
+    perm[r] = d;
+    inv[d] = r;
+    perm[p] = p;
+    inv[p] = p;
+  }
+}
+
+/**
+ * Permutes the state vector such that physical qubits coincide with logical
+ * qubits, see PermuteQubits.
+ * @param simulator Simulator object. Provides specific implementations for
+ *   applying gates.
+ * @param map Qubit map that the state is stored in.
+ * @param state The state of the system, to be updated by this method.
+ */
+template <typename Simulator>
+inline void ResolveQubitMap(const Simulator& simulator, const QubitMap& map,
+                            typename Simulator::State& state) {
+  QubitMap perm(map.size());
+
+  for (unsigned q = 0; q < map.size(); ++q) {
+    perm[map[q]] = q;
+  }
+
+  PermuteQubits(simulator, std::move(perm), state);
+}
+
+/**
+ * Measures the given logical qubits of the state that is stored in the given
+ * qubit map. The measured bits are reported for the logical qubits.
+ * @param state_space StateSpace object required to perform measurements.
+ * @param map Qubit map that the state is stored in.
+ * @param qubits Logical qubits to be measured.
+ * @param rgen Random number generator.
+ * @param state The state of the system, to be updated by this method.
+ * @return The measurement result.
+ */
+template <typename StateSpace, typename RGen>
+inline typename StateSpace::MeasurementResult MeasureRelabeled(
+    const StateSpace& state_space, const QubitMap& map,
+    const std::vector<unsigned>& qubits, RGen& rgen,
+    typename StateSpace::State& state) {
+  std::vector<unsigned> pqubits;
+  pqubits.reserve(qubits.size());
+
+  for (unsigned q : qubits) {
+    pqubits.push_back(map[q]);
+  }
+
+  auto result = state_space.Measure(pqubits, rgen, state);
+
+  if (result.valid) {
+    result.mask = 0;
+    result.bits = 0;
+
+    for (std::size_t i = 0; i < qubits.size(); ++i) {
+      result.mask |= uint64_t{1} << qubits[i];
+      result.bits |= uint64_t{result.bitstring[i]} << qubits[i];
+    }
+  }
+
+  return result;
+}
+
+/**
+ * A circuit with relabeled qubits, see RelabelCircuit below.
+ */
+template <typename Gate>
+struct RelabeledCircuit {
+  /**
+   * Circuit gates (without SWAP gates if they are relabeled). Measurement
+   * gates act on logical qubits; all the other gates act on physical qubits.
+   */
+  std::vector<Gate> gates;
+  /**
+   * Qubit maps to measure in, one map per measurement time (in time order).
+   * Only entries for the qubits measured at that time are meaningful.
+   */
+  std::vector<QubitMap> mea_maps;
+  /**
+   * Qubit maps to be resolved at the requested measurement times (the
+   * 'times' argument of RelabelCircuit) followed by the qubit map to be
+   * resolved after the last gate. Each map is relative to the previous one;
+   * qubits are relabeled from scratch after each resolution.
+   */
+  std::vector<QubitMap> maps;
+  /**
+   * The requested measurement times. A time at which only SWAP gates were
+   * applied is replaced by the time of the last preceding gate since
+   * the fusers expect measurement times to be gate times.
+   */
+  std::vector<unsigned> times;
+  /**
+   * Times at which physical qubits are reordered (in ascending order).
+   * Reordering is performed after all the gates up to that time and before
+   * the qubit map is resolved at the same time (if any).
+   */
+  std::vector<unsigned> reorder_times;
+  /**
+   * Physical qubit permutations to be performed at reorder_times, see
+   * PermuteQubits.
+   */
+  std::vector<QubitMap> reorder_perms;
+};
+
+namespace detail {
+
+/**
+ * Finds a physical qubit permutation that moves the qubits acted on most
+ * often by the given gates to the lowest physical positions.
+ */
+template <typename Gate>
+inline QubitMap FindQubitReordering(
+    const QubitMap& map, unsigned num_low_qubits, bool skip_swap_gates,
+    typename std::vector<Gate>::const_iterator gbeg,
+    typename std::vector<Gate>::const_iterator gend) {
+  unsigned num_qubits = map.size();
+
+  // The number of gates that act on each physical qubit.
+  std::vector<unsigned> counts(num_qubits, 0);
+
+  for (auto it = gbeg; it != gend; ++it) {
+    if (it->kind == gate::kMeasurement
+        || (skip_swap_gates && IsSwapGate(*it))) {
+      continue;
+    }
+
+    for (unsigned q : it->qubits) {
+      ++counts[map[q]];
+    }
+  }
+
+  num_low_qubits = std::min(num_low_qubits, num_qubits);
+
+  std::vector<unsigned> low(num_low_qubits);
+  std::vector<unsigned> high(num_qubits - num_low_qubits);
+
+  for (unsigned p = 0; p < num_qubits; ++p) {
+    if (p < num_low_qubits) {
+      low[p] = p;
+    } else {
+      high[p - num_low_qubits] = p;
+    }
+  }
+
+  // The least used low qubits are replaced by the most used high qubits.
+  std::stable_sort(low.begin(), low.end(), [&counts](unsigned a, unsigned b) {
+    return counts[a] < counts[b];
+  });
+  std::stable_sort(high.begin(), high.end(), [&counts](unsigned a, unsigned b) {
+    return counts[a] > counts[b];
+  });
+
+  QubitMap perm = IdentityQubitMap(num_qubits);
+
+  for (std::size_t i = 0; i < std::min(low.size(), high.size()); ++i) {
+    if (counts[high[i]] <= counts[low[i]]) break;
+
+    perm[high[i]] = low[i];
+    perm[low[i]] = high[i];
+  }
+
+  return perm;
+}
+
+}  // namespace detail
+
+/**
+ * Relabels circuit qubits by tracking a logical-to-physical qubit map.
+ * SWAP gates can be removed from the circuit; the subsequent gates are then
+ * relabeled accordingly. Also, physical qubits can be reordered periodically
+ * such that the qubits acted on most often by the upcoming gates occupy
+ * the lowest physical positions. The state is then stored in the physical
+ * qubit order. It should be reordered by PermuteQubits at reorder_times,
+ * it should be measured by MeasureRelabeled and it should be brought to
+ * the logical qubit order by ResolveQubitMap at the requested measurement
+ * times and after the last gate.
+ * @param num_qubits The number of circuit qubits.
+ * @param gates Circuit gates. Gates should not cross the requested
+ *   measurement times, see Fuser::FuseGates.
+ * @param times Times at which the state is to be brought to the logical qubit
+ *   order (in ascending order). This can be empty.
+ * @param relabel_swap_gates If true, SWAP gates are removed.
+ * @param reorder_qubits The number of the lowest physical qubits to be
+ *   occupied by the most used qubits; zero disables reordering.
+ * @param reorder_window The number of gates between reorderings; the gates
+ *   in the next window determine the qubits to be moved.
+ * @return The relabeled circuit.
+ */
+template <typename Gate>
+inline RelabeledCircuit<Gate> RelabelCircuit(
+    unsigned num_qubits, const std::vector<Gate>& gates,
+    const std::vector<unsigned>& times, bool relabel_swap_gates,
+    unsigned reorder_qubits, unsigned reorder_window) {
+  RelabeledCircuit<Gate> rcircuit;
+  rcircuit.gates.reserve(gates.size());
+  rcircuit.maps.reserve(times.size() + 1);
+  rcircuit.times = times;
+
+  QubitMap map = IdentityQubitMap(num_qubits);
+
+  // min_times[i] is the minimum time of the gates starting from gate i.
+  std::vector<unsigned> min_times;
+
+  if (reorder_qubits > 0) {
+    min_times.resize(gates.size() + 1, std::numeric_limits<unsigned>::max());
+
+    for (std::size_t i = gates.size(); i-- > 0;) {
+      min_times[i] = std::min(gates[i].time, min_times[i + 1]);
+    }
+  }
+
+  reorder_window = std::max(reorder_window, 1u);
+
+  std::size_t k = 0;
+  unsigned mea_time = 0;
+  // The maximum time of the gates that are kept.
+  unsigned max_time = 0;
+  // Qubits can be reordered before this gate or later.
+  std::size_t next_reorder = reorder_window;
+  // True if gates were kept after the last reordering.
+  bool reorder = false;
+
+  for (std::size_t i = 0; i < gates.size(); ++i) {
+    const auto& gate = gates[i];
+    bool resolved = false;
+
+    while (k < times.size() && times[k] < gate.time) {
+      if (rcircuit.gates.size() > 0) {
+        rcircuit.times[k] = std::min(times[k], max_time);
+      }
+
+      rcircuit.maps.push_back(std::move(map));
+      map = IdentityQubitMap(num_qubits);
+      resolved = true;
+      ++k;
+    }
+
+    // Qubits can be reordered only if all the preceding gates are applied
+    // before all the subsequent gates.
+    if (reorder_qubits > 0 && reorder && !resolved && i >= next_reorder
+        && max_time < min_times[i]) {
+      std::size_t i1 = std::min(gates.size(), i + reorder_window);
+
+      auto perm = detail::FindQubitReordering<Gate>(
+          map, reorder_qubits, relabel_swap_gates,
+          gates.begin() + i, gates.begin() + i1);
+
+      if (perm != IdentityQubitMap(num_qubits)) {
+        for (auto& p : map) {
+          p = perm[p];
+        }
+
+        rcircuit.reorder_times.push_back(max_time);
+        rcircuit.reorder_perms.push_back(std::move(perm));
+      }
+
+      next_reorder = i + reorder_window;
+      reorder = false;
+    }
+
+    if (gate.kind == gate::kMeasurement) {
+      if (rcircuit.mea_maps.size() == 0 || mea_time != gate.time) {
+        rcircuit.mea_maps.push_back(QubitMap(num_qubits, 0));
+        mea_time = gate.time;
+      }
+
+      for (unsigned q : gate.qubits) {
+        rcircuit.mea_maps.back()[q] = map[q];
+      }
+
+      rcircuit.gates.push_back(gate);
+    } else if (relabel_swap_gates && IsSwapGate(gate)) {
+      std::swap(map[gate.qubits[0]], map[gate.qubits[1]]);
+      continue;
+    } else {
+      rcircuit.gates.push_back(gate);
+      RelabelGate(map, rcircuit.gates.back());
+    }
+
+    max_time = std::max(max_time, gate.time);
+    reorder = true;
+  }
+
+  for (; k < times.size(); ++k) {
+    rcircuit.maps.push_back(std::move(map));
+    map = IdentityQubitMap(num_qubits);
+  }
+
+  rcircuit.maps.push_back(std::move(map));
+
+  return rcircuit;
+}
+
+/**
+ * Removes SWAP gates from the circuit by relabeling qubits, see
+ * RelabelCircuit.
+ * @param num_qubits The number of circuit qubits.
+ * @param gates Circuit gates. Gates should not cross the requested
+ *   measurement times, see Fuser::FuseGates.
+ * @param times Times at which the state is to be brought to the logical qubit
+ *   order (in ascending order). This can be empty.
+ * @return The relabeled circuit.
+ */
+template <typename Gate>
+inline RelabeledCircuit<Gate> RelabelSwapGates(
+    unsigned num_qubits, const std::vector<Gate>& gates,
+    const std::vector<unsigned>& times = {}) {
+  return RelabelCircuit(num_qubits, gates, times, true, 0, 0);
+}
+
+}  // namespace qsim
+
+#endif  // QUBIT_MAP_H_
@@ -15,12 +15,18 @@
 #ifndef RUN_QSIM_H_
 #define RUN_QSIM_H_
 
+#include <algorithm>
+#include <cstdint>
+#include <iterator>
+#include <limits>
 #include <random>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include "gate.h"
 #include "gate_appl.h"
+#include "qubit_map.h"
 #include "util.h"
 
 namespace qsim {
@@ -45,6 +51,39 @@ struct QSimRunner final {
      * Random number generator seed to apply measurement gates.
      */
     uint64_t seed;
+    /**
+     * If tile_qubits is at least 6 and less than the number of qubits, then
+     * consecutive fused gates that act only on qubits below tile_qubits are
+     * applied together to blocks (tiles) of 2^tile_qubits amplitudes, one
+     * tile at a time. This reduces memory traffic if a tile fits into
+     * the CPU cache. Gates that act on other qubits are applied to the whole
+     * state as usual. Tiling is disabled by default.
+     */
+    unsigned tile_qubits = 0;
+    /**
+     * If true, SWAP gates are not applied to the state vector. Instead,
+     * the subsequent gates are relabeled to act on swapped qubits.
+     * The state vector is brought to the logical qubit order before it is
+     * passed to the caller. Measurement results refer to logical qubits.
+     */
+    bool relabel_swap_gates = false;
+    /**
+     * If reorder_qubits is positive, then physical qubits are periodically
+     * reordered such that the qubits acted on most often by the next
+     * reorder_window gates occupy the lowest reorder_qubits positions,
+     * where the simulator kernels access memory with the smallest strides.
+     * The subsequent gates are relabeled accordingly. Reordering is done in
+     * a single pass over the state vector if at most six qubits move (at
+     * most three low qubits are replaced). The state vector is brought to
+     * the logical qubit order before it is passed to the caller.
+     * Measurement results refer to logical qubits. Reordering is disabled
+     * by default.
+     */
+    unsigned reorder_qubits = 0;
+    /**
+     * The number of gates between qubit reorderings, see reorder_qubits.
+     */
+    unsigned reorder_window = 100;
   };
 
   /**
@@ -102,10 +141,19 @@ struct QSimRunner final {
       t0 = GetTime();
     }
 
-    auto fused_gates = Fuser::FuseGates(param, circuit.num_qubits,
-                                        circuit.gates, times_to_measure_at);
+    using Gate = typename decltype(Circuit::gates)::value_type;
+
+    RelabeledCircuit<Gate> rcircuit;
+    const auto& gates = GetGates(param, circuit.num_qubits, circuit.gates,
+                                 times_to_measure_at, rcircuit);
+    const auto& times = IsRelabeled(param) ?
+        rcircuit.times : times_to_measure_at;
 
-    if (fused_gates.size() == 0 && circuit.gates.size() > 0) {
+    auto fused_gates = Fuser::FuseGates(LimitFusedSize<Simulator>(param),
+                                        circuit.num_qubits, gates,
+                                        GetFuserTimes(times, rcircuit));
+
+    if (fused_gates.size() == 0 && gates.size() > 0) {
       return false;
     }
 
@@ -118,33 +166,71 @@ struct QSimRunner final {
       t0 = GetTime();
     }
 
+    constexpr unsigned max_time = std::numeric_limits<unsigned>::max();
+
     unsigned cur_time_index = 0;
+    std::size_t mea_index = 0;
+    std::size_t reorder_index = 0;
+    std::vector<MeasurementResult> discarded_results;
 
     // Apply fused gates.
-    for (std::size_t i = 0; i < fused_gates.size(); ++i) {
+    for (std::size_t i = 0; i < fused_gates.size();) {
       if (param.verbosity > 3) {
         t1 = GetTime();
       }
 
-      if (!ApplyFusedGate(state_space, simulator, fused_gates[i], rgen,
-                          state)) {
+      unsigned t = cur_time_index < times.size() ?
+          times[cur_time_index] : max_time;
+      unsigned tr = GetReorderTime(rcircuit, reorder_index);
+      std::size_t i1 = FindTileLocalGates(param, state.num_qubits(),
+                                          fused_gates, i, std::min(t, tr));
+
+      if (i1 - i > 1) {
+        ApplyFusedGatesToTiles(param, state_space, simulator, fused_gates,
+                               i, i1, state);
+      } else if (!ApplyRelabeledFusedGate(param, state_space, simulator,
+                                          fused_gates[i], rcircuit, mea_index,
+                                          rgen, state, discarded_results)) {
         IO::errorf("measurement failed.\n");
         return false;
       }
 
+      discarded_results.resize(0);
+
       if (param.verbosity > 3) {
         state_space.DeviceSync();
         double t2 = GetTime();
-        IO::messagef("gate %lu done in %g seconds.\n", i, t2 - t1);
+        PrintGateTime(i, i1, t2 - t1);
       }
 
-      unsigned t = times_to_measure_at[cur_time_index];
+      bool last = i1 == fused_gates.size();
+      unsigned next_time = last ? max_time : fused_gates[i1].time;
+
+      while (true) {
+        // Qubits are reordered before the map is resolved at the same time.
+        if (tr <= t && tr < next_time) {
+          PermuteQubits(simulator, rcircuit.reorder_perms[reorder_index++],
+                        state);
+          tr = GetReorderTime(rcircuit, reorder_index);
+          continue;
+        }
+
+        if (!last && t >= next_time) break;
+
+        if (IsRelabeled(param)) {
+          ResolveQubitMap(simulator, rcircuit.maps[cur_time_index], state);
+        }
 
-      if (i == fused_gates.size() - 1 || t < fused_gates[i + 1].time) {
         // Call back to perform measurements.
         measure(cur_time_index, state_space, state);
         ++cur_time_index;
+
+        if (last) break;
+
+        t = cur_time_index < times.size() ? times[cur_time_index] : max_time;
       }
+
+      i = i1;
     }
 
     if (param.verbosity > 0) {
@@ -192,10 +278,17 @@ struct QSimRunner final {
       t0 = GetTime();
     }
 
-    auto fused_gates = Fuser::FuseGates(param, circuit.num_qubits,
-                                        circuit.gates);
+    using Gate = typename decltype(Circuit::gates)::value_type;
+
+    RelabeledCircuit<Gate> rcircuit;
+    const auto& gates = GetGates(param, circuit.num_qubits, circuit.gates,
+                                 {}, rcircuit);
+
+    auto fused_gates = Fuser::FuseGates(LimitFusedSize<Simulator>(param),
+                                        circuit.num_qubits, gates,
+                                        rcircuit.reorder_times);
 
-    if (fused_gates.size() == 0 && circuit.gates.size() > 0) {
+    if (fused_gates.size() == 0 && gates.size() > 0) {
       return false;
     }
 
@@ -210,14 +303,27 @@ struct QSimRunner final {
       t0 = GetTime();
     }
 
+    constexpr unsigned max_time = std::numeric_limits<unsigned>::max();
+
+    std::size_t mea_index = 0;
+    std::size_t reorder_index = 0;
+
     // Apply fused gates.
-    for (std::size_t i = 0; i < fused_gates.size(); ++i) {
+    for (std::size_t i = 0; i < fused_gates.size();) {
       if (param.verbosity > 3) {
         t1 = GetTime();
       }
 
-      if (!ApplyFusedGate(state_space, simulator, fused_gates[i], rgen, state,
-                          measure_results)) {
+      unsigned tr = GetReorderTime(rcircuit, reorder_index);
+      std::size_t i1 = FindTileLocalGates(param, state.num_qubits(),
+                                          fused_gates, i, tr);
+
+      if (i1 - i > 1) {
+        ApplyFusedGatesToTiles(param, state_space, simulator, fused_gates,
+                               i, i1, state);
+      } else if (!ApplyRelabeledFusedGate(param, state_space, simulator,
+                                          fused_gates[i], rcircuit, mea_index,
+                                          rgen, state, measure_results)) {
         IO::errorf("measurement failed.\n");
         return false;
       }
@@ -225,8 +331,22 @@ struct QSimRunner final {
       if (param.verbosity > 3) {
         state_space.DeviceSync();
         double t2 = GetTime();
-        IO::messagef("gate %lu done in %g seconds.\n", i, t2 - t1);
+        PrintGateTime(i, i1, t2 - t1);
+      }
+
+      unsigned next_time = i1 == fused_gates.size() ?
+          max_time : fused_gates[i1].time;
+
+      for (; tr < next_time; tr = GetReorderTime(rcircuit, reorder_index)) {
+        PermuteQubits(simulator, rcircuit.reorder_perms[reorder_index++],
+                      state);
       }
+
+      i = i1;
+    }
+
+    if (IsRelabeled(param)) {
+      ResolveQubitMap(simulator, rcircuit.maps.back(), state);
     }
 
     if (param.verbosity > 0) {
@@ -255,6 +375,208 @@ struct QSimRunner final {
     std::vector<MeasurementResult> discarded_results;
     return Run(param, factory, circuit, state, discarded_results);
   }
+
+ private:
+  static bool IsRelabeled(const Parameter& param) {
+    return param.relabel_swap_gates || param.reorder_qubits > 0;
+  }
+
+  template <typename Gate>
+  static const std::vector<Gate>& GetGates(
+      const Parameter& param, unsigned num_qubits,
+      const std::vector<Gate>& gates, const std::vector<unsigned>& times,
+      RelabeledCircuit<Gate>& rcircuit) {
+    if (!IsRelabeled(param)) return gates;
+
+    rcircuit = RelabelCircuit(num_qubits, gates, times,
+                              param.relabel_swap_gates, param.reorder_qubits,
+                              param.reorder_window);
+
+    return rcircuit.gates;
+  }
+
+  // Returns the measurement times merged with the qubit reordering times.
+  template <typename Gate>
+  static std::vector<unsigned> GetFuserTimes(
+      const std::vector<unsigned>& times,
+      const RelabeledCircuit<Gate>& rcircuit) {
+    const auto& reorder_times = rcircuit.reorder_times;
+
+    std::vector<unsigned> fuser_times;
+    fuser_times.reserve(times.size() + reorder_times.size());
+
+    std::merge(times.begin(), times.end(), reorder_times.begin(),
+               reorder_times.end(), std::back_inserter(fuser_times));
+
+    return fuser_times;
+  }
+
+  template <typename Gate>
+  static unsigned GetReorderTime(const RelabeledCircuit<Gate>& rcircuit,
+                                 std::size_t reorder_index) {
+    return reorder_index < rcircuit.reorder_times.size() ?
+        rcircuit.reorder_times[reorder_index] :
+        std::numeric_limits<unsigned>::max();
+  }
+
+  template <typename FusedGate, typename Gate>
+  static bool ApplyRelabeledFusedGate(
+      const Parameter& param, const StateSpace& state_space,
+      const Simulator& simulator, const FusedGate& gate,
+      const RelabeledCircuit<Gate>& rcircuit, std::size_t& mea_index,
+      RGen& rgen, State& state, std::vector<MeasurementResult>& mresults) {
+    if (IsRelabeled(param) && gate.kind == gate::kMeasurement) {
+      auto mresult = MeasureRelabeled(state_space, rcircuit.mea_maps[mea_index],
+                                      gate.qubits, rgen, state);
+      ++mea_index;
+
+      if (!mresult.valid) return false;
+
+      mresults.push_back(std::move(mresult));
+
+      return true;
+    }
+
+    return ApplyFusedGate(state_space, simulator, gate, rgen, state, mresults);
+  }
+
+  static constexpr unsigned kMinTileQubits = 6;
+
+  template <typename FusedGate>
+  static bool IsTileLocal(unsigned tile_qubits, const FusedGate& gate) {
+    if (gate.kind == gate::kMeasurement) return false;
+
+    for (unsigned q : gate.qubits) {
+      if (q >= tile_qubits) return false;
+    }
+
+    for (unsigned q : gate.parent->controlled_by) {
+      if (q >= tile_qubits) return false;
+    }
+
+    return true;
+  }
+
+  // Returns the end of the run of tile-local fused gates that starts at i0.
+  // The run does not extend past gates with times greater than max_time.
+  // Returns i0 + 1 if tiling is disabled.
+  template <typename FusedGates>
+  static std::size_t FindTileLocalGates(const Parameter& param,
+                                        unsigned num_qubits,
+                                        const FusedGates& fused_gates,
+                                        std::size_t i0, unsigned max_time) {
+    unsigned tile_qubits = param.tile_qubits;
+
+    if (tile_qubits < kMinTileQubits || tile_qubits >= num_qubits
+        || !IsTileLocal(tile_qubits, fused_gates[i0])) {
+      return i0 + 1;
+    }
+
+    std::size_t i = i0 + 1;
+
+    for (; i < fused_gates.size(); ++i) {
+      if (fused_gates[i].time > max_time
+          || !IsTileLocal(tile_qubits, fused_gates[i])) {
+        break;
+      }
+    }
+
+    return i;
+  }
+
+  // Checks if the simulator exposes its parallel-for object (CPU simulators).
+  template <typename S>
+  struct HasFor {
+    template <typename T>
+    static std::true_type Test(decltype(&T::GetFor));
+    template <typename T>
+    static std::false_type Test(...);
+
+    static constexpr bool value = decltype(Test<S>(nullptr))::value;
+  };
+
+  // Applies fused gates [i0, i1) to all the tiles. A tile of 2^tile_qubits
+  // consecutive amplitudes is itself a valid state for all the state-space
+  // layouts since tile_qubits >= kMinTileQubits.
+  template <typename FusedGates>
+  static void ApplyFusedGatesToTiles(const Parameter& param,
+                                     const StateSpace& state_space,
+                                     const Simulator& simulator,
+                                     const FusedGates& fused_gates,
+                                     std::size_t i0, std::size_t i1,
+                                     State& state) {
+    using CanSplit = std::integral_constant<bool, HasFor<Simulator>::value>;
+
+    ApplyFusedGatesToTiles(CanSplit{}, param, state_space, simulator,
+                           fused_gates, i0, i1, state);
+  }
+
+  // Tiles are distributed over the threads of the simulator's parallel-for
+  // object. Each thread applies all the gates to a tile with
+  // a single-threaded simulator before it moves on to the next tile. If
+  // the loop over tiles is not split between threads (too few tiles or
+  // a single thread), the gates are applied to each tile by the given
+  // simulator.
+  template <typename FusedGates>
+  static void ApplyFusedGatesToTiles(std::true_type, const Parameter& param,
+                                     const StateSpace& state_space,
+                                     const Simulator& simulator,
+                                     const FusedGates& fused_gates,
+                                     std::size_t i0, std::size_t i1,
+                                     State& state) {
+    unsigned tile_qubits = param.tile_qubits;
+    uint64_t num_tiles = uint64_t{1} << (state.num_qubits() - tile_qubits);
+    uint64_t tile_size = uint64_t{2} << tile_qubits;
+
+    auto f = [&](unsigned n, unsigned m, uint64_t k) {
+      State tile = state_space.Create(state.get() + k * tile_size,
+                                      tile_qubits);
+
+      if (n > 1) {
+        Simulator tile_simulator(1);
+
+        for (std::size_t i = i0; i < i1; ++i) {
+          ApplyFusedGate(tile_simulator, fused_gates[i], tile);
+        }
+      } else {
+        for (std::size_t i = i0; i < i1; ++i) {
+          ApplyFusedGate(simulator, fused_gates[i], tile);
+        }
+      }
+    };
+
+    simulator.GetFor().Run(num_tiles, f);
+  }
+
+  // Tiles are processed one at a time with the given simulator.
+  template <typename FusedGates>
+  static void ApplyFusedGatesToTiles(std::false_type, const Parameter& param,
+                                     const StateSpace& state_space,
+                                     const Simulator& simulator,
+                                     const FusedGates& fused_gates,
+                                     std::size_t i0, std::size_t i1,
+                                     State& state) {
+    unsigned tile_qubits = param.tile_qubits;
+    uint64_t num_tiles = uint64_t{1} << (state.num_qubits() - tile_qubits);
+    uint64_t tile_size = uint64_t{2} << tile_qubits;
+
+    for (uint64_t k = 0; k < num_tiles; ++k) {
+      State tile = state_space.Create(state.get() + k * tile_size,
+                                      tile_qubits);
+
+      for (std::size_t i = i0; i < i1; ++i) {
+        ApplyFusedGate(simulator, fused_gates[i], tile);
+      }
+    }
+  }
+
+  static void PrintGateTime(std::size_t i0, std::size_t i1, double t) {
+    if (i1 - i0 > 1) {
+      IO::messagef("gates %lu-%lu done in %g seconds.\n", i0, i1 - 1, t);
+    } else {
+      IO::messagef("gate %lu done in %g seconds.\n", i0, t);
+    }
+  }
 };
 
 }  // namespace qsim
@@ -82,12 +82,15 @@ struct QSimHRunner final {
       PrintInfo(param, hd);
     }
 
-    auto fgates0 = Fuser::FuseGates(param, hd.num_qubits0, hd.gates0);
+    using Simulator = typename Factory::Simulator;
+    const auto fparam = LimitFusedSize<Simulator>(param);
+
+    auto fgates0 = Fuser::FuseGates(fparam, hd.num_qubits0, hd.gates0);
     if (fgates0.size() == 0 && hd.gates0.size() > 0) {
       return false;
     }
 
-    auto fgates1 = Fuser::FuseGates(param, hd.num_qubits1, hd.gates1);
+    auto fgates1 = Fuser::FuseGates(fparam, hd.num_qubits1, hd.gates1);
     if (fgates1.size() == 0 && hd.gates1.size() > 0) {
       return false;
     }
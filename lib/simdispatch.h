@@ -0,0 +1,230 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMDISPATCH_H_
+#define SIMDISPATCH_H_
+
+// Runtime-dispatched alternative to simmux.h. All the state-vector
+// simulators are compiled into the same binary; the SIMD simulators are
+// compiled for their instruction sets through target pragmas, so the
+// binary itself can be built for the baseline instruction set. This header
+// should be included before simmux.h or any simulator_*.h header, as the
+// pragmas only apply to code that is parsed after them.
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "bits.h"
+#include "simulator.h"
+#include "simulator_basic.h"
+#include "statespace.h"
+#include "statespace_basic.h"
+#include "util.h"
+#include "util_cpu.h"
+#include "vectorspace.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+# include <immintrin.h>
+# define QSIM_SIMDISPATCH_X86
+#endif
+
+#if defined(QSIM_SIMDISPATCH_X86) && !defined(_MSC_VER)
+# if defined(__clang__)
+#  define QSIM_TARGET_PUSH(isa) \
+     _Pragma(QSIM_TARGET_STR(clang attribute push( \
+         __attribute__((target(isa))), apply_to = function)))
+#  define QSIM_TARGET_POP _Pragma("clang attribute pop")
+# else
+#  define QSIM_TARGET_PUSH(isa) \
+     _Pragma("GCC push_options") _Pragma(QSIM_TARGET_STR(GCC target(isa)))
+#  define QSIM_TARGET_POP _Pragma("GCC pop_options")
+# endif
+# define QSIM_TARGET_STR(x) #x
+#else
+// MSVC allows all intrinsics without target options.
+# define QSIM_TARGET_PUSH(isa)
+# define QSIM_TARGET_POP
+#endif
+
+// Wraps For such that the loop bodies are called from a function that is
+// compiled for the enclosing target. This keeps SIMD arguments of the loop
+// bodies out of the baseline-compiled For, which would pass them with
+// a different calling convention and could not inline the bodies.
+#define QSIM_DEFINE_TARGET_FOR                                               \
+  template <typename For>                                                    \
+  struct TargetFor : public For {                                            \
+    template <typename... ForArgs>                                           \
+    explicit TargetFor(ForArgs&&... args) : For(args...) {}                  \
+                                                                             \
+    template <typename Function, typename... Args>                           \
+    void Run(uint64_t size, Function&& func, Args&&... args) const {         \
+      auto f = [&](unsigned n, unsigned m, uint64_t i) {                     \
+        func(n, m, i, args...);                                              \
+      };                                                                     \
+      For::Run(size, f);                                                     \
+    }                                                                        \
+                                                                             \
+    template <typename Function, typename Op, typename... Args>              \
+    std::vector<typename Op::result_type> RunReduceP(                        \
+        uint64_t size, Function&& func, Op&& op, Args&&... args) const {     \
+      auto f = [&](unsigned n, unsigned m, uint64_t i)                       \
+          -> typename Op::result_type {                                      \
+        return func(n, m, i, args...);                                       \
+      };                                                                     \
+      return For::RunReduceP(size, f, std::forward<Op>(op));                 \
+    }                                                                        \
+                                                                             \
+    template <typename Function, typename Op, typename... Args>              \
+    typename Op::result_type RunReduce(uint64_t size, Function&& func,       \
+                                       Op&& op, Args&&... args) const {      \
+      auto f = [&](unsigned n, unsigned m, uint64_t i)                       \
+          -> typename Op::result_type {                                      \
+        return func(n, m, i, args...);                                       \
+      };                                                                     \
+      return For::RunReduce(size, f, std::forward<Op>(op));                  \
+    }                                                                        \
+  };
+
+#ifdef QSIM_SIMDISPATCH_X86
+
+QSIM_TARGET_PUSH("sse4.1")
+#include "simulator_sse.h"
+namespace qsim {
+namespace sse {
+QSIM_DEFINE_TARGET_FOR
+}  // namespace sse
+}  // namespace qsim
+QSIM_TARGET_POP
+
+QSIM_TARGET_PUSH("avx2,fma,bmi2")
+#include "simulator_avx.h"
+namespace qsim {
+namespace avx {
+QSIM_DEFINE_TARGET_FOR
+}  // namespace avx
+}  // namespace qsim
+QSIM_TARGET_POP
+
+QSIM_TARGET_PUSH("avx512f,avx2,fma,bmi2")
+#include "simulator_avx512.h"
+namespace qsim {
+namespace avx512 {
+QSIM_DEFINE_TARGET_FOR
+}  // namespace avx512
+}  // namespace qsim
+QSIM_TARGET_POP
+
+#endif  // QSIM_SIMDISPATCH_X86
+
+#undef QSIM_DEFINE_TARGET_FOR
+#undef QSIM_TARGET_PUSH
+#undef QSIM_TARGET_POP
+#undef QSIM_TARGET_STR
+
+namespace qsim {
+
+/**
+ * Factory for state spaces and simulators of type Simulator, as required
+ * by the runners (see run_qsim.h).
+ */
+template <typename Simulator_>
+struct SimulatorFactory {
+  using Simulator = Simulator_;
+  using StateSpace = typename Simulator::StateSpace;
+
+  explicit SimulatorFactory(unsigned num_threads) : num_threads(num_threads) {}
+
+  StateSpace CreateStateSpace() const {
+    return StateSpace(num_threads);
+  }
+
+  Simulator CreateSimulator() const {
+    return Simulator(num_threads);
+  }
+
+  unsigned num_threads;
+};
+
+/**
+ * Runtime-dispatched state-vector simulator. Run calls a function with
+ * a SimulatorFactory for the simulator that matches the given (by default,
+ * the widest supported) SIMD instruction set.
+ */
+template <typename For>
+struct SimulatorDispatch {
+  using BasicSimulator = SimulatorBasic<For, float>;
+
+#ifdef QSIM_SIMDISPATCH_X86
+  using SSESimulator = SimulatorSSE<sse::TargetFor<For>>;
+  using AVXSimulator = SimulatorAVX<avx::TargetFor<For>, float>;
+  using AVX512Simulator = SimulatorAVX512<avx512::TargetFor<For>, float>;
+#endif
+
+  /**
+   * Calls func(factory, args...), where factory is a SimulatorFactory
+   * for the simulator that matches the SIMD instruction set `instructions`
+   * or the widest instruction set supported by qsim on this platform if
+   * `instructions` is wider. func is instantiated for all the simulators;
+   * the return type should not depend on the simulator.
+   * @param instructions The SIMD instruction set.
+   * @param num_threads The number of threads passed to For.
+   * @param func The function to call.
+   * @param args Additional arguments passed to func.
+   * @return The value returned by func.
+   */
+  template <typename Function, typename... Args>
+  static auto Run(SimdInstructions instructions, unsigned num_threads,
+                  Function&& func, Args&&... args)
+      -> decltype(func(SimulatorFactory<BasicSimulator>(num_threads),
+                       args...)) {
+    switch (instructions) {
+#ifdef QSIM_SIMDISPATCH_X86
+    case kAVX512F:
+      return func(SimulatorFactory<AVX512Simulator>(num_threads), args...);
+    case kAVX2:
+      return func(SimulatorFactory<AVXSimulator>(num_threads), args...);
+    case kSSE4_1:
+      return func(SimulatorFactory<SSESimulator>(num_threads), args...);
+#endif
+    default:
+      return func(SimulatorFactory<BasicSimulator>(num_threads), args...);
+    }
+  }
+
+  /**
+   * Calls func(factory, args...), where factory is a SimulatorFactory
+   * for the simulator that matches the widest SIMD instruction set
+   * supported by the CPU.
+   */
+  template <typename Function, typename... Args>
+  static auto Run(unsigned num_threads, Function&& func, Args&&... args)
+      -> decltype(func(SimulatorFactory<BasicSimulator>(num_threads),
+                       args...)) {
+    return Run(GetSimdInstructions(), num_threads,
+               std::forward<Function>(func), std::forward<Args>(args)...);
+  }
+};
+
+}  // namespace qsim
+
+#ifdef QSIM_SIMDISPATCH_X86
+# undef QSIM_SIMDISPATCH_X86
+#endif
+
+#endif  // SIMDISPATCH_H_
@@ -18,26 +18,31 @@
 #ifdef __AVX512F__
 # include "simulator_avx512.h"
   namespace qsim {
-    template <typename For>
-    using Simulator = SimulatorAVX512<For>;
+    template <typename For, typename FP = float>
+    using Simulator = SimulatorAVX512<For, FP>;
   }
 #elif __AVX2__
 # include "simulator_avx.h"
   namespace qsim {
-    template <typename For>
-    using Simulator = SimulatorAVX<For>;
+    template <typename For, typename FP = float>
+    using Simulator = SimulatorAVX<For, FP>;
   }
 #elif __SSE4_1__
+# include <type_traits>
+# include "simulator_basic.h"
 # include "simulator_sse.h"
   namespace qsim {
-    template <typename For>
-    using Simulator = SimulatorSSE<For>;
+    // There is no double-precision SSE simulator; fall back to the basic one.
+    template <typename For, typename FP = float>
+    using Simulator = typename std::conditional<
+        std::is_same<FP, float>::value,
+        SimulatorSSE<For>, SimulatorBasic<For, FP>>::type;
   }
 #else
 # include "simulator_basic.h"
   namespace qsim {
-    template <typename For>
-    using Simulator = SimulatorBasic<For>;
+    template <typename For, typename FP = float>
+    using Simulator = SimulatorBasic<For, FP>;
   }
 #endif
 
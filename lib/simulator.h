@@ -15,17 +15,34 @@
 #ifndef SIMULATOR_H_
 #define SIMULATOR_H_
 
+#ifdef _WIN32
+  #include <malloc.h>
+#endif
+
+#include <cmath>
+#include <complex>
+#include <cstddef>
 #include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <vector>
 
 #include "bits.h"
 
 namespace qsim {
 
+// Defined in half.h.
+template <typename Half>
+Half FloatToHalf(float x);
+
 /**
  * Base class for simulator classes.
  */
 class SimulatorBase {
  protected:
+  // The largest expanded gate matrix (in bytes) that is kept on the stack.
+  static constexpr std::size_t kMaxStackMatrixSize = 262144;
+
   // The follwoing template parameters are used for functions below.
   // H - the number of high (target) qubits.
   // L - the number of low (target) qubits.
@@ -89,6 +106,188 @@ class SimulatorBase {
     }
   }
 
+  // Storage for gate matrices expanded by FillMatrix (Size is in bytes).
+  // Small matrices are kept on the stack. Expanded matrices of seven- and
+  // eight-qubit gates take up to several megabytes; they are allocated on
+  // the heap.
+  template <std::size_t Size, bool OnStack = (Size <= kMaxStackMatrixSize)>
+  class MatrixBuffer {
+   public:
+    void* get() { return data_; }
+
+   private:
+    alignas(64) char data_[Size];
+  };
+
+  template <std::size_t Size>
+  class MatrixBuffer<Size, false> {
+   public:
+    MatrixBuffer() : data_(nullptr) {
+#ifdef _WIN32
+      data_ = _aligned_malloc(Size, 64);
+#else
+      if (posix_memalign(&data_, 64, Size) != 0) {
+        data_ = nullptr;
+      }
+#endif
+    }
+
+    ~MatrixBuffer() {
+#ifdef _WIN32
+      _aligned_free(data_);
+#else
+      ::free(data_);
+#endif
+    }
+
+    MatrixBuffer(const MatrixBuffer&) = delete;
+    MatrixBuffer& operator=(const MatrixBuffer&) = delete;
+
+    void* get() { return data_; }
+
+   private:
+    void* data_;
+  };
+
+  // Applies a gate to a state vector stored in SIMD blocks of 2^R real parts
+  // followed by 2^R imaginary parts without expanding the gate matrix.
+  // The SIMD kernels fall back to this if the heap-allocated expanded matrix
+  // (see MatrixBuffer) cannot be allocated. This is much slower than the SIMD
+  // kernels. There should be at most eight qubits.
+  template <unsigned R, typename For, typename fp_type, typename storage_type>
+  static void ApplyGateUnexpanded(const For& for_, unsigned num_qubits,
+                                  const std::vector<unsigned>& qs,
+                                  const fp_type* matrix,
+                                  storage_type* rstate) {
+    auto f = [](unsigned n, unsigned m, uint64_t i, unsigned num_qubits,
+                const std::vector<unsigned>& qs, const fp_type* matrix,
+                storage_type* rstate) {
+      uint64_t ps[256];
+      fp_type rs[256], is[256];
+
+      unsigned gsize = LoadGroup<R>(i, num_qubits, qs, rstate, ps, rs, is);
+
+      for (unsigned k = 0; k < gsize; ++k) {
+        fp_type rn = 0;
+        fp_type in = 0;
+
+        for (unsigned l = 0; l < gsize; ++l) {
+          fp_type ru = matrix[2 * (gsize * k + l)];
+          fp_type iu = matrix[2 * (gsize * k + l) + 1];
+
+          rn += rs[l] * ru - is[l] * iu;
+          in += rs[l] * iu + is[l] * ru;
+        }
+
+        StoreAmplitude(rn, rstate[ps[k]]);
+        StoreAmplitude(in, rstate[ps[k] + (1 << R)]);
+      }
+    };
+
+    uint64_t size = uint64_t{1} << (num_qubits - qs.size());
+
+    for_.Run(size, f, num_qubits, qs, matrix, rstate);
+  }
+
+  // Computes the expectation value of an operator without expanding the
+  // operator matrix, see ApplyGateUnexpanded.
+  template <unsigned R, typename For, typename fp_type, typename storage_type>
+  static std::complex<double> ExpectationValueUnexpanded(
+      const For& for_, unsigned num_qubits, const std::vector<unsigned>& qs,
+      const fp_type* matrix, const storage_type* rstate) {
+    auto f = [](unsigned n, unsigned m, uint64_t i, unsigned num_qubits,
+                const std::vector<unsigned>& qs, const fp_type* matrix,
+                const storage_type* rstate) -> std::complex<double> {
+      uint64_t ps[256];
+      fp_type rs[256], is[256];
+
+      unsigned gsize = LoadGroup<R>(i, num_qubits, qs, rstate, ps, rs, is);
+
+      double re = 0;
+      double im = 0;
+
+      for (unsigned k = 0; k < gsize; ++k) {
+        fp_type rn = 0;
+        fp_type in = 0;
+
+        for (unsigned l = 0; l < gsize; ++l) {
+          fp_type ru = matrix[2 * (gsize * k + l)];
+          fp_type iu = matrix[2 * (gsize * k + l) + 1];
+
+          rn += rs[l] * ru - is[l] * iu;
+          in += rs[l] * iu + is[l] * ru;
+        }
+
+        re += rs[k] * rn + is[k] * in;
+        im += rs[k] * in - is[k] * rn;
+      }
+
+      return std::complex<double>{re, im};
+    };
+
+    uint64_t size = uint64_t{1} << (num_qubits - qs.size());
+
+    using Op = std::plus<std::complex<double>>;
+    return for_.RunReduce(size, f, Op(), num_qubits, qs, matrix, rstate);
+  }
+
+  // Loads the amplitudes of the i-th group of ApplyGateUnexpanded and
+  // ExpectationValueUnexpanded; ps are the positions of the real parts.
+  // Returns the group size.
+  template <unsigned R, typename fp_type, typename storage_type>
+  static unsigned LoadGroup(uint64_t i, unsigned num_qubits,
+                            const std::vector<unsigned>& qs,
+                            const storage_type* rstate, uint64_t* ps,
+                            fp_type* rs, fp_type* is) {
+    constexpr uint64_t rmask = (uint64_t{1} << R) - 1;
+
+    uint64_t qmask = 0;
+    for (unsigned q : qs) {
+      qmask |= uint64_t{1} << q;
+    }
+
+    uint64_t mask = ((uint64_t{1} << num_qubits) - 1) ^ qmask;
+    uint64_t a0 = bits::ExpandBits(i, num_qubits, mask);
+
+    unsigned gsize = 1 << qs.size();
+
+    for (unsigned k = 0; k < gsize; ++k) {
+      uint64_t a = a0 | bits::ExpandBits(uint64_t{k}, num_qubits, qmask);
+      ps[k] = 2 * (a & ~rmask) + (a & rmask);
+      rs[k] = LoadAmplitude(rstate[ps[k]]);
+      is[k] = LoadAmplitude(rstate[ps[k] + (1 << R)]);
+    }
+
+    return gsize;
+  }
+
+  static float LoadAmplitude(float v) {
+    return v;
+  }
+
+  static double LoadAmplitude(double v) {
+    return v;
+  }
+
+  // Half-precision amplitudes, see half.h.
+  template <typename Half>
+  static float LoadAmplitude(Half v) {
+    return HalfToFloat(v);
+  }
+
+  static void StoreAmplitude(float v, float& r) {
+    r = v;
+  }
+
+  static void StoreAmplitude(double v, double& r) {
+    r = v;
+  }
+
+  template <typename Half>
+  static void StoreAmplitude(float v, Half& r) {
+    r = FloatToHalf<Half>(v);
+  }
+
   // Fills gate matrix entries for controlled gates with high target qubits
   // and low control qubits.
   template <unsigned H, unsigned R, typename fp_type>
@@ -480,6 +679,625 @@ class SimulatorBase {
     unsigned c = bits::CompressBits(a, R, mask);
     return bits::ExpandBits((c + b) % lsize, R, mask);
   }
+
+  // Fills the table of diagonal entries (w) that is used in diagonal gate
+  // kernels. The table has one row per value of the high target qubits.
+  // Each row contains 2^R real parts followed by 2^R imaginary parts
+  // (one value per SIMD lane); the lane values are set according to the low
+  // target qubits. Returns the mask of high target qubits in the SIMD block
+  // index space (bit q - R is set for each target qubit q >= R).
+  template <unsigned R, typename fp_type>
+  static uint64_t FillDiagonalMatrix(const std::vector<unsigned>& qs,
+                                     const fp_type* diag,
+                                     std::vector<fp_type>& w) {
+    constexpr unsigned rsize = 1 << R;
+
+    unsigned kl = 0;
+    unsigned qmaskl = 0;
+    uint64_t qmaskh = 0;
+
+    for (auto q : qs) {
+      if (q < R) {
+        ++kl;
+        qmaskl |= 1 << q;
+      } else {
+        qmaskh |= uint64_t{1} << (q - R);
+      }
+    }
+
+    uint64_t hsize = uint64_t{1} << (qs.size() - kl);
+
+    w.resize(2 * rsize * hsize);
+
+    for (uint64_t i = 0; i < hsize; ++i) {
+      for (unsigned l = 0; l < rsize; ++l) {
+        uint64_t k = (i << kl) | bits::CompressBits(l, R, qmaskl);
+
+        w[2 * rsize * i + l] = diag[2 * k];
+        w[2 * rsize * i + rsize + l] = diag[2 * k + 1];
+      }
+    }
+
+    return qmaskh;
+  }
+
+  // Gathers the bits of i selected by mask into the low bits of the result.
+  // This is used to get the row index of the diagonal entry table in
+  // diagonal gate kernels.
+  static uint64_t GetDiagonalIndex(uint64_t i, uint64_t mask) {
+#ifdef __BMI2__
+    return _pext_u64(i, mask);
+#else
+    uint64_t k = 0;
+
+    for (unsigned j = 0; mask != 0; ++j) {
+      uint64_t b = mask & (~mask + 1);
+      k |= uint64_t{(i & b) != 0} << j;
+      mask ^= b;
+    }
+
+    return k;
+#endif
+  }
+
+  // Tables that are used in permutation gate kernels.
+  template <typename fp_type>
+  struct PermutationMatrix {
+    // Masks (ms) to calculate base state indices and offset indices (xss)
+    // of SIMD blocks (see FillIndices).
+    std::vector<uint64_t> ms;
+    std::vector<uint64_t> xss;
+    // The entries for the k-th destination SIMD block of a group of blocks
+    // are in the range [offsets[k], offsets[k + 1]). Each entry has the index
+    // of the source block in the group (sources), the source lane for each
+    // destination lane (lanes) and the phase for each destination lane
+    // (phases; 2^R real parts are followed by 2^R imaginary parts). The phase
+    // is zero if the lane doesn't get its amplitude from this source block.
+    std::vector<unsigned> offsets;
+    std::vector<unsigned> sources;
+    std::vector<unsigned> lanes;
+    std::vector<fp_type> phases;
+  };
+
+  // Fills the tables that are used in permutation gate kernels. A gate maps
+  // the amplitude of the basis state perm[k] to the amplitude of the basis
+  // state k multiplied by the k-th phase. Returns the number of high target
+  // qubits.
+  template <unsigned R, typename fp_type>
+  static unsigned FillPermutationMatrix(unsigned num_qubits,
+                                        const std::vector<unsigned>& qs,
+                                        const unsigned* perm,
+                                        const fp_type* phases,
+                                        PermutationMatrix<fp_type>& pm) {
+    constexpr unsigned rsize = 1 << R;
+
+    unsigned kl = 0;
+    unsigned qmaskl = 0;
+
+    for (auto q : qs) {
+      if (q < R) {
+        ++kl;
+        qmaskl |= 1 << q;
+      }
+    }
+
+    unsigned kh = qs.size() - kl;
+    unsigned hsize = 1 << kh;
+    unsigned lmask = (1 << kl) - 1;
+
+    pm.ms.resize(kh + 1);
+    pm.xss.resize(hsize);
+
+    uint64_t xs = 1;
+    pm.ms[0] = (uint64_t{1} << num_qubits) - 1;
+
+    for (unsigned i = 0; i < kh; ++i) {
+      unsigned q = qs[kl + i];
+      pm.ms[i] &= (uint64_t{1} << q) - 1;
+      xs = uint64_t{1} << (q + 1);
+      pm.ms[i + 1] = ((uint64_t{1} << num_qubits) - 1) ^ (xs - 1);
+    }
+
+    for (unsigned i = 0; i < hsize; ++i) {
+      uint64_t a = 0;
+      for (unsigned k = 0; k < kh; ++k) {
+        a += (uint64_t{2} << qs[kl + k]) * ((i >> k) & 1);
+      }
+      pm.xss[i] = a;
+    }
+
+    pm.offsets.resize(0);
+    pm.sources.resize(0);
+    pm.lanes.resize(0);
+    pm.phases.resize(0);
+
+    pm.offsets.reserve(hsize + 1);
+
+    for (unsigned i = 0; i < hsize; ++i) {
+      pm.offsets.push_back(pm.sources.size());
+
+      for (unsigned j = 0; j < hsize; ++j) {
+        bool empty = true;
+
+        for (unsigned l = 0; l < rsize; ++l) {
+          unsigned k = (i << kl) | bits::CompressBits(l, R, qmaskl);
+          if ((perm[k] >> kl) == j) {
+            empty = false;
+            break;
+          }
+        }
+
+        if (empty) continue;
+
+        unsigned s = pm.lanes.size();
+
+        pm.sources.push_back(j);
+        pm.lanes.resize(s + rsize);
+        pm.phases.resize(2 * (s + rsize));
+
+        for (unsigned l = 0; l < rsize; ++l) {
+          unsigned k = (i << kl) | bits::CompressBits(l, R, qmaskl);
+
+          if ((perm[k] >> kl) == j) {
+            unsigned ls = bits::ExpandBits(perm[k] & lmask, R, qmaskl);
+            pm.lanes[s + l] = (l & ~qmaskl) | ls;
+            pm.phases[2 * s + l] = phases[2 * k];
+            pm.phases[2 * s + rsize + l] = phases[2 * k + 1];
+          } else {
+            pm.lanes[s + l] = l;
+            pm.phases[2 * s + l] = 0;
+            pm.phases[2 * s + rsize + l] = 0;
+          }
+        }
+      }
+    }
+
+    pm.offsets.push_back(pm.sources.size());
+
+    return kh;
+  }
+
+  // Tables that are used in Pauli rotation kernels.
+  template <typename fp_type>
+  struct PauliRotationMatrix {
+    // Masks of the X or Y operators (xmaskh) and of the Y or Z operators
+    // (zmaskh) in the SIMD block index space.
+    uint64_t xmaskh;
+    uint64_t zmaskh;
+    // Mask to insert a zero bit at the highest bit of xmaskh into block
+    // indices; all ones if xmaskh is zero.
+    uint64_t mlow;
+    // cos(theta).
+    fp_type c;
+    // The source lane for each destination lane.
+    std::vector<unsigned> lanes;
+    // The factors -i sin(theta) i^ny (-1)^popcount(ls & zmaskl) for each
+    // destination lane with the source lane ls (2^R real parts followed by
+    // 2^R imaginary parts) followed by the negated factors; ny is
+    // the number of Y operators.
+    std::vector<fp_type> w;
+  };
+
+  // Fills the tables that are used in Pauli rotation kernels. A kernel
+  // applies exp(-i theta P) = cos(theta) I - i sin(theta) P, where
+  // P|k> = i^ny (-1)^popcount(k & zmask) |k ^ xmask>, by pairing the SIMD
+  // blocks t and t ^ xmaskh. The negated factors are used for the source
+  // blocks s with odd popcount(s & zmaskh).
+  template <unsigned R, typename fp_type>
+  static void FillPauliRotationMatrix(const std::vector<unsigned>& qs,
+                                      const unsigned* paulis, fp_type theta,
+                                      PauliRotationMatrix<fp_type>& pr) {
+    constexpr unsigned rsize = 1 << R;
+
+    uint64_t xmask = 0;
+    uint64_t zmask = 0;
+    unsigned ny = 0;
+
+    for (std::size_t k = 0; k < qs.size(); ++k) {
+      if (paulis[k] == 1 || paulis[k] == 2) xmask |= uint64_t{1} << qs[k];
+      if (paulis[k] == 2 || paulis[k] == 3) zmask |= uint64_t{1} << qs[k];
+      if (paulis[k] == 2) ++ny;
+    }
+
+    unsigned xmaskl = xmask & (rsize - 1);
+    unsigned zmaskl = zmask & (rsize - 1);
+
+    pr.xmaskh = xmask >> R;
+    pr.zmaskh = zmask >> R;
+    pr.mlow = ~uint64_t{0};
+
+    if (pr.xmaskh != 0) {
+      unsigned h = 0;
+      while ((pr.xmaskh >> (h + 1)) != 0) ++h;
+      pr.mlow = (uint64_t{1} << h) - 1;
+    }
+
+    fp_type s = std::sin(theta);
+    pr.c = std::cos(theta);
+
+    // -i sin(theta) i^ny.
+    fp_type kr = (ny & 1) == 0 ? 0 : ((ny & 2) == 0 ? s : -s);
+    fp_type ki = (ny & 1) == 1 ? 0 : ((ny & 2) == 0 ? -s : s);
+
+    pr.lanes.resize(rsize);
+    pr.w.resize(4 * rsize);
+
+    for (unsigned l = 0; l < rsize; ++l) {
+      unsigned ls = l ^ xmaskl;
+      fp_type sign = bits::Parity(ls & zmaskl) == 0 ? 1 : -1;
+
+      pr.lanes[l] = ls;
+      pr.w[l] = sign * kr;
+      pr.w[rsize + l] = sign * ki;
+      pr.w[2 * rsize + l] = -sign * kr;
+      pr.w[3 * rsize + l] = -sign * ki;
+    }
+  }
+
+  // Tables that are used in Pauli expectation value kernels. The tables
+  // describe a group of Pauli strings with the same X and Y operators.
+  template <typename fp_type>
+  struct PauliExpectationMatrix {
+    // Mask of the X or Y operators in the SIMD block index space.
+    uint64_t xmaskh;
+    // Mask to insert a zero bit at the highest bit of xmaskh into block
+    // indices; all ones if xmaskh is zero.
+    uint64_t mlow;
+    // The source lane for each lane.
+    std::vector<unsigned> lanes;
+    // Masks of the Y or Z operators in the SIMD block index space, one mask
+    // per Pauli string.
+    std::vector<uint64_t> zmaskh;
+    // The weights of the real parts (2^R entries) and of the imaginary parts
+    // (2^R entries) of the pair products conj(a_k) a_(k ^ xmask), one set of
+    // weights per Pauli string.
+    std::vector<fp_type> w;
+  };
+
+  // Fills the tables that are used in Pauli expectation value kernels.
+  // For a Hermitian Pauli string P, <psi|P|psi> is the sum over the
+  // amplitudes k of (-1)^popcount(k & zmask) times the real part of
+  // (-i)^ny conj(a_k) a_(k ^ xmask); ny is the number of Y operators.
+  // A kernel pairs the SIMD blocks t and t ^ xmaskh and visits each pair
+  // of different blocks once, so the weights include a factor of two in
+  // that case. The pair products depend only on xmask; they are computed
+  // once for all the strings in the group. The kernel negates the sum over
+  // the block t for odd popcount(t & zmaskh).
+  template <unsigned R, typename fp_type>
+  static void FillPauliExpectationMatrix(uint64_t xmask,
+                                         const std::vector<uint64_t>& zmasks,
+                                         PauliExpectationMatrix<fp_type>& pe) {
+    constexpr unsigned rsize = 1 << R;
+
+    unsigned xmaskl = xmask & (rsize - 1);
+
+    pe.xmaskh = xmask >> R;
+    pe.mlow = ~uint64_t{0};
+
+    if (pe.xmaskh != 0) {
+      unsigned h = 0;
+      while ((pe.xmaskh >> (h + 1)) != 0) ++h;
+      pe.mlow = (uint64_t{1} << h) - 1;
+    }
+
+    pe.lanes.resize(rsize);
+
+    for (unsigned l = 0; l < rsize; ++l) {
+      pe.lanes[l] = l ^ xmaskl;
+    }
+
+    fp_type c = pe.xmaskh != 0 ? 2 : 1;
+
+    pe.zmaskh.resize(zmasks.size());
+    pe.w.resize(2 * rsize * zmasks.size());
+
+    for (std::size_t k = 0; k < zmasks.size(); ++k) {
+      unsigned zmaskl = zmasks[k] & (rsize - 1);
+      pe.zmaskh[k] = zmasks[k] >> R;
+
+      unsigned ny = 0;
+      for (uint64_t y = xmask & zmasks[k]; y != 0; y &= y - 1) ++ny;
+
+      // The real part of (-i)^ny (re + i im) is re, im, -re or -im.
+      fp_type kr = (ny & 1) == 1 ? 0 : ((ny & 2) == 0 ? c : -c);
+      fp_type ki = (ny & 1) == 0 ? 0 : ((ny & 2) == 0 ? c : -c);
+
+      auto w = pe.w.data() + 2 * rsize * k;
+
+      for (unsigned l = 0; l < rsize; ++l) {
+        fp_type sign = bits::Parity(l & zmaskl) == 0 ? 1 : -1;
+
+        w[l] = sign * kr;
+        w[rsize + l] = sign * ki;
+      }
+    }
+  }
+
+  // Gets the masks of the X or Y operators (xmask) and of the Y or Z
+  // operators (zmask) of a Pauli string.
+  static void GetPauliMasks(const std::vector<unsigned>& qs,
+                            const unsigned* paulis,
+                            uint64_t& xmask, uint64_t& zmask) {
+    xmask = 0;
+    zmask = 0;
+
+    for (std::size_t k = 0; k < qs.size(); ++k) {
+      if (paulis[k] == 1 || paulis[k] == 2) xmask |= uint64_t{1} << qs[k];
+      if (paulis[k] == 2 || paulis[k] == 3) zmask |= uint64_t{1} << qs[k];
+    }
+  }
+
+  // Partial sums of expectation values of N Pauli strings.
+  template <unsigned N>
+  struct PauliExpectationSums {
+    PauliExpectationSums(double v = 0) {
+      for (unsigned k = 0; k < N; ++k) {
+        s[k] = v;
+      }
+    }
+
+    double s[N];
+  };
+
+  // Reduction operation for the partial sums of expectation values.
+  template <unsigned N>
+  struct PauliExpectationSumsPlus {
+    using result_type = PauliExpectationSums<N>;
+
+    result_type operator()(const result_type& a, const result_type& b) const {
+      result_type r;
+
+      for (unsigned k = 0; k < N; ++k) {
+        r.s[k] = a.s[k] + b.s[k];
+      }
+
+      return r;
+    }
+  };
+
+  // Returns the index of the first SIMD block of the k-th pair of blocks
+  // in Pauli rotation and Pauli expectation value kernels.
+  static uint64_t GetPauliRotationIndex(uint64_t k, uint64_t mlow) {
+    return (k & mlow) | ((k & ~mlow) << 1);
+  }
+
+  // The largest number of qubits of reduced density matrices.
+  static constexpr unsigned kMaxReducedDensityMatrixQubits = 4;
+
+  // Partial sums of the upper triangle of the reduced density matrix of
+  // K qubits; the real and imaginary parts are interleaved.
+  template <unsigned K>
+  struct DensityMatrixSums {
+    static constexpr unsigned kSize = (1 << K) * ((1 << K) + 1);
+
+    DensityMatrixSums(double v = 0) {
+      for (unsigned k = 0; k < kSize; ++k) {
+        s[k] = v;
+      }
+    }
+
+    double s[kSize];
+  };
+
+  // Reduction operation for the partial sums of density matrix elements.
+  template <unsigned K>
+  struct DensityMatrixSumsPlus {
+    using result_type = DensityMatrixSums<K>;
+
+    result_type operator()(const result_type& a, const result_type& b) const {
+      result_type r;
+
+      for (unsigned k = 0; k < result_type::kSize; ++k) {
+        r.s[k] = a.s[k] + b.s[k];
+      }
+
+      return r;
+    }
+  };
+
+  // Indices of the amplitudes in the reduced density matrix kernel.
+  template <unsigned R, unsigned K>
+  struct DensityMatrixIndices {
+    // Block offsets and lane offsets of the 2^K values of the qubits.
+    uint64_t boffsets[1 << K];
+    unsigned loffsets[1 << K];
+    // Lanes that are not addressed by the low qubits.
+    unsigned lanes[1 << R];
+    unsigned num_lanes;
+    // High qubits relative to the block index.
+    unsigned hqs[K > 0 ? K : 1];
+    unsigned num_hqs;
+  };
+
+  // Accumulates the products of amplitudes for 2^c groups of blocks in the
+  // reduced density matrix kernel. If Full is true, all the lanes are
+  // used in the natural order (there are no low qubits), which lets the
+  // compiler vectorize the inner loops.
+  template <unsigned R, unsigned K, bool Full, typename fp_type>
+  static DensityMatrixSums<K> AccumulateDensityMatrix(
+      uint64_t i, unsigned c, const DensityMatrixIndices<R, K>& ind,
+      const fp_type* rstate) {
+    constexpr unsigned rsize = 1 << R;
+    constexpr unsigned dsize = 1 << K;
+    constexpr unsigned psize = dsize * (dsize + 1) / 2;
+
+    fp_type re[dsize][rsize];
+    fp_type im[dsize][rsize];
+    fp_type accr[psize][rsize];
+    fp_type acci[psize][rsize];
+
+    unsigned num_lanes = Full ? rsize : ind.num_lanes;
+
+    for (unsigned p = 0; p < psize; ++p) {
+      for (unsigned l = 0; l < num_lanes; ++l) {
+        accr[p][l] = 0;
+        acci[p][l] = 0;
+      }
+    }
+
+    for (uint64_t j = i << c; j < (i + 1) << c; ++j) {
+      uint64_t t = j;
+      for (unsigned k = 0; k < ind.num_hqs; ++k) {
+        uint64_t mask = (uint64_t{1} << ind.hqs[k]) - 1;
+        t = ((t & ~mask) << 1) | (t & mask);
+      }
+
+      for (unsigned k = 0; k < dsize; ++k) {
+        auto p = rstate + 2 * rsize * (t | ind.boffsets[k]) + ind.loffsets[k];
+
+        for (unsigned l = 0; l < num_lanes; ++l) {
+          unsigned lane = Full ? l : ind.lanes[l];
+          re[k][l] = p[lane];
+          im[k][l] = p[lane + rsize];
+        }
+      }
+
+      unsigned p = 0;
+      for (unsigned k1 = 0; k1 < dsize; ++k1) {
+        for (unsigned k2 = k1; k2 < dsize; ++k2) {
+          for (unsigned l = 0; l < num_lanes; ++l) {
+            // a_k1 conj(a_k2).
+            accr[p][l] += re[k1][l] * re[k2][l] + im[k1][l] * im[k2][l];
+            acci[p][l] += im[k1][l] * re[k2][l] - re[k1][l] * im[k2][l];
+          }
+          ++p;
+        }
+      }
+    }
+
+    DensityMatrixSums<K> sums;
+
+    for (unsigned p = 0; p < psize; ++p) {
+      double sr = 0;
+      double si = 0;
+
+      for (unsigned l = 0; l < num_lanes; ++l) {
+        sr += accr[p][l];
+        si += acci[p][l];
+      }
+
+      sums.s[2 * p] = sr;
+      sums.s[2 * p + 1] = si;
+    }
+
+    return sums;
+  }
+
+  // Computes the reduced density matrix rho of the qubits qs in one
+  // read-only pass over the state vector; rho[c1 * 2^K + c2] is the sum of
+  // a_c1 conj(a_c2) over the other qubits, where bit j of c1 and c2
+  // corresponds to qs[j] (qs[0] < qs[1] < ...). The state vector is stored in
+  // SIMD blocks of 2^R real parts followed by 2^R imaginary parts (R = 0 for
+  // interleaved storage). The amplitudes of all the 2^K values of the qubits
+  // are loaded once per group of blocks and all the products are accumulated
+  // per lane.
+  template <unsigned R, unsigned K, typename For, typename fp_type>
+  static void ReducedDensityMatrixK(const For& for_, unsigned num_qubits,
+                                    const std::vector<unsigned>& qs,
+                                    const fp_type* rstate,
+                                    std::complex<double>* rho) {
+    constexpr unsigned dsize = 1 << K;
+
+    unsigned nl = num_qubits < R ? num_qubits : R;
+    unsigned nh = num_qubits - nl;
+
+    DensityMatrixIndices<R, K> ind{};
+    unsigned lmask = 0;
+
+    ind.num_hqs = 0;
+    for (unsigned j = 0; j < K; ++j) {
+      if (qs[j] < nl) {
+        lmask |= 1 << qs[j];
+      } else {
+        ind.hqs[ind.num_hqs++] = qs[j] - R;
+      }
+    }
+
+    for (unsigned c = 0; c < dsize; ++c) {
+      ind.boffsets[c] = 0;
+      ind.loffsets[c] = 0;
+
+      for (unsigned j = 0; j < K; ++j) {
+        if (((c >> j) & 1) == 0) continue;
+
+        if (qs[j] < nl) {
+          ind.loffsets[c] |= 1 << qs[j];
+        } else {
+          ind.boffsets[c] |= uint64_t{1} << (qs[j] - R);
+        }
+      }
+    }
+
+    ind.num_lanes = 0;
+    for (unsigned l = 0; l < (1u << nl); ++l) {
+      if ((l & lmask) == 0) ind.lanes[ind.num_lanes++] = l;
+    }
+
+    auto f1 = [](unsigned n, unsigned m, uint64_t i, unsigned c,
+                 const DensityMatrixIndices<R, K>* ind,
+                 const fp_type* rstate) -> DensityMatrixSums<K> {
+      return AccumulateDensityMatrix<R, K, true>(i, c, *ind, rstate);
+    };
+
+    auto f2 = [](unsigned n, unsigned m, uint64_t i, unsigned c,
+                 const DensityMatrixIndices<R, K>* ind,
+                 const fp_type* rstate) -> DensityMatrixSums<K> {
+      return AccumulateDensityMatrix<R, K, false>(i, c, *ind, rstate);
+    };
+
+    // Each iteration processes 2^c of the 2^nb groups of blocks.
+    unsigned nb = nh - ind.num_hqs;
+    unsigned c = nb > 6 ? 6 : nb;
+    uint64_t size = uint64_t{1} << (nb - c);
+
+    using Op = DensityMatrixSumsPlus<K>;
+    auto sums = ind.num_lanes == (1u << R) ?
+        for_.RunReduce(size, f1, Op(), c, &ind, rstate) :
+        for_.RunReduce(size, f2, Op(), c, &ind, rstate);
+
+    unsigned p = 0;
+    for (unsigned k1 = 0; k1 < dsize; ++k1) {
+      for (unsigned k2 = k1; k2 < dsize; ++k2) {
+        std::complex<double> v(sums.s[2 * p], sums.s[2 * p + 1]);
+        rho[k1 * dsize + k2] = v;
+        rho[k2 * dsize + k1] = std::conj(v);
+        ++p;
+      }
+    }
+  }
+
+  // Computes the reduced density matrix of at most
+  // kMaxReducedDensityMatrixQubits qubits, see ReducedDensityMatrixK.
+  // Returns an empty vector if there are too many qubits.
+  template <unsigned R, typename For, typename fp_type>
+  static std::vector<std::complex<double>> ComputeReducedDensityMatrix(
+      const For& for_, unsigned num_qubits, const std::vector<unsigned>& qs,
+      const fp_type* rstate) {
+    if (qs.size() > kMaxReducedDensityMatrixQubits) return {};
+
+    uint64_t dsize = uint64_t{1} << qs.size();
+    std::vector<std::complex<double>> rho(dsize * dsize);
+
+    switch (qs.size()) {
+    case 0:
+      ReducedDensityMatrixK<R, 0>(for_, num_qubits, qs, rstate, rho.data());
+      break;
+    case 1:
+      ReducedDensityMatrixK<R, 1>(for_, num_qubits, qs, rstate, rho.data());
+      break;
+    case 2:
+      ReducedDensityMatrixK<R, 2>(for_, num_qubits, qs, rstate, rho.data());
+      break;
+    case 3:
+      ReducedDensityMatrixK<R, 3>(for_, num_qubits, qs, rstate, rho.data());
+      break;
+    case 4:
+      ReducedDensityMatrixK<R, 4>(for_, num_qubits, qs, rstate, rho.data());
+      break;
+    }
+
+    return rho;
+  }
 };
 
 template <>
@@ -27,18 +27,47 @@
 
 namespace qsim {
 
+template <typename For, typename FP = float>
+class SimulatorAVX;
+
 /**
- * Quantum circuit simulator with AVX vectorization.
+ * Load/store policy for single-precision state vectors. StorageScale returns
+ * the factor the stored amplitudes are multiplied by.
  */
 template <typename For>
-class SimulatorAVX final : public SimulatorBase {
+struct FloatLoadStoreAVX {
+  using StateSpace = StateSpaceAVX<For, float>;
+  using storage_type = float;
+
+  static __m256 Load(const float* p) {
+    return _mm256_load_ps(p);
+  }
+
+  static void Store(float* p, __m256 v) {
+    _mm256_store_ps(p, v);
+  }
+
+  static float StorageScale(unsigned num_qubits) {
+    return 1;
+  }
+};
+
+/**
+ * Quantum circuit simulator with AVX vectorization and single-precision
+ * kernels. The load/store policy LoadStore defines the state space and how
+ * amplitudes are loaded into __m256 registers and stored back; see
+ * FloatLoadStoreAVX and HalfLoadStoreAVX (simulator_half_avx.h).
+ */
+template <typename For, typename LoadStore>
+class SimulatorAVXFloat : public SimulatorBase {
  public:
-  using StateSpace = StateSpaceAVX<For>;
+  using StateSpace = typename LoadStore::StateSpace;
   using State = typename StateSpace::State;
   using fp_type = typename StateSpace::fp_type;
+  using storage_type = typename LoadStore::storage_type;
 
   template <typename... ForArgs>
-  explicit SimulatorAVX(ForArgs&&... args) : for_(args...) {}
+  explicit SimulatorAVXFloat(ForArgs&&... args) : for_(args...) {}
 
   /**
    * Applies a gate using AVX instructions.
@@ -111,6 +140,28 @@ class SimulatorAVX final : public SimulatorBase {
         ApplyGateL<3, 3>(qs, matrix, state);
       }
       break;
+    case 7:
+      if (qs[0] > 2) {
+        ApplyGateH<7>(qs, matrix, state);
+      } else if (qs[1] > 2) {
+        ApplyGateL<6, 1>(qs, matrix, state);
+      } else if (qs[2] > 2) {
+        ApplyGateL<5, 2>(qs, matrix, state);
+      } else {
+        ApplyGateL<4, 3>(qs, matrix, state);
+      }
+      break;
+    case 8:
+      if (qs[0] > 2) {
+        ApplyGateH<8>(qs, matrix, state);
+      } else if (qs[1] > 2) {
+        ApplyGateL<7, 1>(qs, matrix, state);
+      } else if (qs[2] > 2) {
+        ApplyGateL<6, 2>(qs, matrix, state);
+      } else {
+        ApplyGateL<5, 3>(qs, matrix, state);
+      }
+      break;
     default:
       // Not implemented.
       break;
@@ -233,6 +284,168 @@ class SimulatorAVX final : public SimulatorBase {
     }
   }
 
+  /**
+   * Applies a diagonal gate using AVX instructions.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param diag Diagonal entries of the gate matrix; the real part of each
+   *   entry is followed by its imaginary part.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyDiagonalGate(const std::vector<unsigned>& qs,
+                         const fp_type* diag, State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* w,
+                uint64_t qmaskh, storage_type* rstate) {
+      auto v = w + 16 * GetDiagonalIndex(i, qmaskh);
+      auto p = rstate + 16 * i;
+
+      __m256 ru = _mm256_loadu_ps(v);
+      __m256 iu = _mm256_loadu_ps(v + 8);
+      __m256 rs = LoadStore::Load(p);
+      __m256 is = LoadStore::Load(p + 8);
+
+      __m256 rn = _mm256_fnmadd_ps(is, iu, _mm256_mul_ps(rs, ru));
+      __m256 in = _mm256_fmadd_ps(is, ru, _mm256_mul_ps(rs, iu));
+
+      LoadStore::Store(p, rn);
+      LoadStore::Store(p + 8, in);
+    };
+
+    std::vector<fp_type> w;
+    uint64_t qmaskh = FillDiagonalMatrix<3>(qs, diag, w);
+
+    unsigned k = 3;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, w.data(), qmaskh, state.get());
+  }
+
+  /**
+   * Applies a permutation gate using AVX instructions. Permutation gates
+   * (X, Y, CNOT, SWAP, ISWAP, CCX, CSWAP, ...) have exactly one nonzero
+   * element in each row and each column of the gate matrix.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param perm Permutation; the nonzero element of the k-th row of the gate
+   *   matrix is in column perm[k].
+   * @param phases Nonzero elements of the gate matrix; the real part of each
+   *   element is followed by its imaginary part.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyPermutationGate(const std::vector<unsigned>& qs,
+                            const unsigned* perm, const fp_type* phases,
+                            State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    PermutationMatrix<fp_type> pm;
+    unsigned h = FillPermutationMatrix<3>(
+        state.num_qubits(), qs, perm, phases, pm);
+
+    switch (h) {
+    case 0:
+      ApplyPermutationGateH<0>(pm, state);
+      break;
+    case 1:
+      ApplyPermutationGateH<1>(pm, state);
+      break;
+    case 2:
+      ApplyPermutationGateH<2>(pm, state);
+      break;
+    case 3:
+      ApplyPermutationGateH<3>(pm, state);
+      break;
+    case 4:
+      ApplyPermutationGateH<4>(pm, state);
+      break;
+    case 5:
+      ApplyPermutationGateH<5>(pm, state);
+      break;
+    case 6:
+      ApplyPermutationGateH<6>(pm, state);
+      break;
+    default:
+      // Not implemented.
+      break;
+    }
+  }
+
+  /**
+   * Applies the rotation exp(-i theta P) about a Pauli string P using
+   * AVX instructions; see gate::PauliRotation in gate.h. The amplitudes
+   * are paired by the X and Y operators and updated in one pass over
+   * the state vector.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param paulis Pauli operators acting on the qubits: 1 for X, 2 for Y and
+   *   3 for Z.
+   * @param theta The rotation angle.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyPauliRotation(const std::vector<unsigned>& qs,
+                          const unsigned* paulis, fp_type theta,
+                          State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, uint64_t xmaskh,
+                uint64_t zmaskh, uint64_t mlow, fp_type c,
+                const unsigned* lanes, const fp_type* w, storage_type* rstate) {
+      uint64_t t = GetPauliRotationIndex(i, mlow);
+      uint64_t s = t ^ xmaskh;
+
+      auto pt = rstate + 16 * t;
+      auto ps = rstate + 16 * s;
+
+      __m256i idx = _mm256_loadu_si256((const __m256i*) lanes);
+      __m256 cc = _mm256_set1_ps(c);
+
+      __m256 rt = LoadStore::Load(pt);
+      __m256 it = LoadStore::Load(pt + 8);
+      __m256 rs = LoadStore::Load(ps);
+      __m256 is = LoadStore::Load(ps + 8);
+
+      auto wt = w + 16 * bits::Parity(s & zmaskh);
+
+      __m256 ru = _mm256_loadu_ps(wt);
+      __m256 iu = _mm256_loadu_ps(wt + 8);
+      __m256 rp = _mm256_permutevar8x32_ps(rs, idx);
+      __m256 ip = _mm256_permutevar8x32_ps(is, idx);
+
+      __m256 rn = _mm256_fmadd_ps(rp, ru, _mm256_mul_ps(rt, cc));
+      __m256 in = _mm256_fmadd_ps(rp, iu, _mm256_mul_ps(it, cc));
+      rn = _mm256_fnmadd_ps(ip, iu, rn);
+      in = _mm256_fmadd_ps(ip, ru, in);
+
+      if (s != t) {
+        auto ws = w + 16 * bits::Parity(t & zmaskh);
+
+        ru = _mm256_loadu_ps(ws);
+        iu = _mm256_loadu_ps(ws + 8);
+        rp = _mm256_permutevar8x32_ps(rt, idx);
+        ip = _mm256_permutevar8x32_ps(it, idx);
+
+        __m256 rm = _mm256_fmadd_ps(rp, ru, _mm256_mul_ps(rs, cc));
+        __m256 im = _mm256_fmadd_ps(rp, iu, _mm256_mul_ps(is, cc));
+        rm = _mm256_fnmadd_ps(ip, iu, rm);
+        im = _mm256_fmadd_ps(ip, ru, im);
+
+        LoadStore::Store(ps, rm);
+        LoadStore::Store(ps + 8, im);
+      }
+
+      LoadStore::Store(pt, rn);
+      LoadStore::Store(pt + 8, in);
+    };
+
+    PauliRotationMatrix<fp_type> pr;
+    FillPauliRotationMatrix<3>(qs, paulis, theta, pr);
+
+    unsigned k = 3;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    if (pr.xmaskh != 0) --n;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, pr.xmaskh, pr.zmaskh, pr.mlow, pr.c, pr.lanes.data(),
+             pr.w.data(), state.get());
+  }
+
   /**
    * Computes the expectation value of an operator using AVX instructions.
    * @param qs Indices of the qubits the operator acts on.
@@ -245,6 +458,17 @@ class SimulatorAVX final : public SimulatorBase {
                                         const State& state) const {
     // Assume qs[0] < qs[1] < qs[2] < ... .
 
+    // Compensate for the storage scale of the amplitudes.
+    fp_type s = LoadStore::StorageScale(state.num_qubits());
+    std::vector<fp_type> smatrix;
+    if (s != 1) {
+      smatrix.assign(matrix, matrix + (2 << (2 * qs.size())));
+      for (auto& v : smatrix) {
+        v /= s * s;
+      }
+      matrix = smatrix.data();
+    }
+
     switch (qs.size()) {
     case 1:
       if (qs[0] > 2) {
@@ -306,6 +530,28 @@ class SimulatorAVX final : public SimulatorBase {
         return ExpectationValueL<3, 3>(qs, matrix, state);
       }
       break;
+    case 7:
+      if (qs[0] > 2) {
+        return ExpectationValueH<7>(qs, matrix, state);
+      } else if (qs[1] > 2) {
+        return ExpectationValueL<6, 1>(qs, matrix, state);
+      } else if (qs[2] > 2) {
+        return ExpectationValueL<5, 2>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<4, 3>(qs, matrix, state);
+      }
+      break;
+    case 8:
+      if (qs[0] > 2) {
+        return ExpectationValueH<8>(qs, matrix, state);
+      } else if (qs[1] > 2) {
+        return ExpectationValueL<7, 1>(qs, matrix, state);
+      } else if (qs[2] > 2) {
+        return ExpectationValueL<6, 2>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<5, 3>(qs, matrix, state);
+      }
+      break;
     default:
       // Not implemented.
       break;
@@ -314,6 +560,76 @@ class SimulatorAVX final : public SimulatorBase {
     return 0;
   }
 
+  /**
+   * Computes the expectation value of a Pauli string P using AVX instructions.
+   * The amplitudes are paired by the X and Y operators and the expectation
+   * value is computed in one read-only pass over the state vector; there is
+   * no limit on the number of qubits.
+   * @param qs Indices of the qubits the Pauli string acts on; should be
+   *   distinct.
+   * @param paulis Pauli operators acting on the qubits: 1 for X, 2 for Y and
+   *   3 for Z.
+   * @param state The state of the system.
+   * @return The computed expectation value <state|P|state>.
+   */
+  double ExpectationValuePauli(const std::vector<unsigned>& qs,
+                               const unsigned* paulis,
+                               const State& state) const {
+    uint64_t xmask, zmask;
+    GetPauliMasks(qs, paulis, xmask, zmask);
+
+    return ExpectationValuesPauli(xmask, {zmask}, state)[0];
+  }
+
+  /**
+   * Computes the expectation values of Pauli strings with the same X and Y
+   * operators using AVX instructions. The amplitude pair products are shared by
+   * all the strings; up to 16 strings are evaluated in one read-only pass over
+   * the state vector.
+   * @param xmask Mask of the qubits acted on by X or Y operators; the same
+   *   for all the Pauli strings.
+   * @param zmasks Masks of the qubits acted on by Y or Z operators, one mask
+   *   per Pauli string.
+   * @param state The state of the system.
+   * @return The computed expectation values, one value per Pauli string.
+   */
+  std::vector<double> ExpectationValuesPauli(
+      uint64_t xmask, const std::vector<uint64_t>& zmasks,
+      const State& state) const {
+    PauliExpectationMatrix<fp_type> pe;
+    FillPauliExpectationMatrix<3>(xmask, zmasks, pe);
+
+    // Compensate for the storage scale of the amplitudes.
+    fp_type s = LoadStore::StorageScale(state.num_qubits());
+    if (s != 1) {
+      for (auto& v : pe.w) {
+        v /= s * s;
+      }
+    }
+
+    unsigned k = 3;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    if (pe.xmaskh != 0) --n;
+
+    std::vector<double> results(zmasks.size(), 0);
+
+    std::size_t i = 0;
+
+    for (; i + 16 <= zmasks.size(); i += 16) {
+      ExpectationValuesPauliN<16>(n, pe, i, state, results.data());
+    }
+
+    for (; i + 4 <= zmasks.size(); i += 4) {
+      ExpectationValuesPauliN<4>(n, pe, i, state, results.data());
+    }
+
+    for (; i < zmasks.size(); ++i) {
+      ExpectationValuesPauliN<1>(n, pe, i, state, results.data());
+    }
+
+    return results;
+  }
+
   /**
    * @return The size of SIMD register if applicable.
    */
@@ -321,6 +637,13 @@ class SimulatorAVX final : public SimulatorBase {
     return 8;
   }
 
+  /**
+   * @return The object that runs the parallel loops of this simulator.
+   */
+  const For& GetFor() const {
+    return for_;
+  }
+
  private:
 
 #ifdef __BMI2__
@@ -329,7 +652,7 @@ class SimulatorAVX final : public SimulatorBase {
   void ApplyGateH(const std::vector<unsigned>& qs,
                   const fp_type* matrix, State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* v,
-                uint64_t imaskh, uint64_t qmaskh, fp_type* rstate) {
+                uint64_t imaskh, uint64_t qmaskh, storage_type* rstate) {
       constexpr unsigned hsize = 1 << H;
 
       __m256 ru, iu, rn, in;
@@ -340,8 +663,8 @@ class SimulatorAVX final : public SimulatorBase {
       for (unsigned k = 0; k < hsize; ++k) {
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        rs[k] = _mm256_load_ps(p0 + p);
-        is[k] = _mm256_load_ps(p0 + p + 8);
+        rs[k] = LoadStore::Load(p0 + p);
+        is[k] = LoadStore::Load(p0 + p + 8);
       }
 
       uint64_t j = 0;
@@ -369,8 +692,8 @@ class SimulatorAVX final : public SimulatorBase {
 
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        _mm256_store_ps(p0 + p, rn);
-        _mm256_store_ps(p0 + p + 8, in);
+        LoadStore::Store(p0 + p, rn);
+        LoadStore::Store(p0 + p + 8, in);
       }
     };
 
@@ -388,7 +711,7 @@ class SimulatorAVX final : public SimulatorBase {
                   const fp_type* matrix, State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const __m256* w,
                 uint64_t imaskh, uint64_t qmaskh, const __m256i* idx,
-                fp_type* rstate) {
+                storage_type* rstate) {
       constexpr unsigned gsize = 1 << (H + L);
       constexpr unsigned hsize = 1 << H;
       constexpr unsigned lsize = 1 << L;
@@ -402,8 +725,8 @@ class SimulatorAVX final : public SimulatorBase {
         unsigned k2 = lsize * k;
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        rs[k2] = _mm256_load_ps(p0 + p);
-        is[k2] = _mm256_load_ps(p0 + p + 8);
+        rs[k2] = LoadStore::Load(p0 + p);
+        is[k2] = LoadStore::Load(p0 + p + 8);
 
         for (unsigned l = 1; l < lsize; ++l) {
           rs[k2 + l] = _mm256_permutevar8x32_ps(rs[k2], idx[l - 1]);
@@ -432,13 +755,21 @@ class SimulatorAVX final : public SimulatorBase {
 
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        _mm256_store_ps(p0 + p, rn);
-        _mm256_store_ps(p0 + p + 8, in);
+        LoadStore::Store(p0 + p, rn);
+        LoadStore::Store(p0 + p + 8, in);
       }
     };
 
     __m256i idx[1 << L];
-    __m256 w[1 << (1 + 2 * H + L)];
+    MatrixBuffer<sizeof(fp_type) << (1 + 2 * H + L + 3)> wbuf;
+    __m256* w = (__m256*) wbuf.get();
+
+    if (w == nullptr) {
+      // Not enough memory for the expanded matrix.
+      ApplyGateUnexpanded<3>(for_, state.num_qubits(), qs, matrix,
+                             state.get());
+      return;
+    }
 
     auto m = GetMasks2<H, L, 3>(qs);
     FillPermutationIndices<L>(m.qmaskl, idx);
@@ -457,7 +788,7 @@ class SimulatorAVX final : public SimulatorBase {
                              const fp_type* matrix, State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* v,
                 uint64_t imaskh, uint64_t qmaskh, uint64_t cvalsh,
-                fp_type* rstate) {
+                storage_type* rstate) {
       constexpr unsigned hsize = 1 << H;
 
       __m256 ru, iu, rn, in;
@@ -468,8 +799,8 @@ class SimulatorAVX final : public SimulatorBase {
       for (unsigned k = 0; k < hsize; ++k) {
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        rs[k] = _mm256_load_ps(p0 + p);
-        is[k] = _mm256_load_ps(p0 + p + 8);
+        rs[k] = LoadStore::Load(p0 + p);
+        is[k] = LoadStore::Load(p0 + p + 8);
       }
 
       uint64_t j = 0;
@@ -497,8 +828,8 @@ class SimulatorAVX final : public SimulatorBase {
 
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        _mm256_store_ps(p0 + p, rn);
-        _mm256_store_ps(p0 + p + 8, in);
+        LoadStore::Store(p0 + p, rn);
+        LoadStore::Store(p0 + p + 8, in);
       }
     };
 
@@ -517,7 +848,7 @@ class SimulatorAVX final : public SimulatorBase {
                              const fp_type* matrix, State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const __m256* w,
                 uint64_t imaskh, uint64_t qmaskh, uint64_t cvalsh,
-                fp_type* rstate) {
+                storage_type* rstate) {
       constexpr unsigned hsize = 1 << H;
 
       __m256 rn, in;
@@ -528,8 +859,8 @@ class SimulatorAVX final : public SimulatorBase {
       for (unsigned k = 0; k < hsize; ++k) {
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        rs[k] = _mm256_load_ps(p0 + p);
-        is[k] = _mm256_load_ps(p0 + p + 8);
+        rs[k] = LoadStore::Load(p0 + p);
+        is[k] = LoadStore::Load(p0 + p + 8);
       }
 
       uint64_t j = 0;
@@ -553,8 +884,8 @@ class SimulatorAVX final : public SimulatorBase {
 
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        _mm256_store_ps(p0 + p, rn);
-        _mm256_store_ps(p0 + p + 8, in);
+        LoadStore::Store(p0 + p, rn);
+        LoadStore::Store(p0 + p + 8, in);
       }
     };
 
@@ -576,7 +907,7 @@ class SimulatorAVX final : public SimulatorBase {
                             const fp_type* matrix, State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const __m256* w,
                 uint64_t imaskh, uint64_t qmaskh, uint64_t cvalsh,
-                const __m256i* idx, fp_type* rstate) {
+                const __m256i* idx, storage_type* rstate) {
       constexpr unsigned gsize = 1 << (H + L);
       constexpr unsigned hsize = 1 << H;
       constexpr unsigned lsize = 1 << L;
@@ -590,8 +921,8 @@ class SimulatorAVX final : public SimulatorBase {
         unsigned k2 = lsize * k;
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        rs[k2] = _mm256_load_ps(p0 + p);
-        is[k2] = _mm256_load_ps(p0 + p + 8);
+        rs[k2] = LoadStore::Load(p0 + p);
+        is[k2] = LoadStore::Load(p0 + p + 8);
 
         for (unsigned l = 1; l < lsize; ++l) {
           rs[k2 + l] = _mm256_permutevar8x32_ps(rs[k2], idx[l - 1]);
@@ -620,8 +951,8 @@ class SimulatorAVX final : public SimulatorBase {
 
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        _mm256_store_ps(p0 + p, rn);
-        _mm256_store_ps(p0 + p + 8, in);
+        LoadStore::Store(p0 + p, rn);
+        LoadStore::Store(p0 + p + 8, in);
       }
     };
 
@@ -657,7 +988,7 @@ class SimulatorAVX final : public SimulatorBase {
                                          const fp_type* matrix,
                                          const State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* v,
-                uint64_t imaskh, uint64_t qmaskh, const fp_type* rstate) {
+                uint64_t imaskh, uint64_t qmaskh, const storage_type* rstate) {
       constexpr unsigned hsize = 1 << H;
 
       __m256 ru, iu, rn, in;
@@ -668,8 +999,8 @@ class SimulatorAVX final : public SimulatorBase {
       for (unsigned k = 0; k < hsize; ++k) {
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        rs[k] = _mm256_load_ps(p0 + p);
-        is[k] = _mm256_load_ps(p0 + p + 8);
+        rs[k] = LoadStore::Load(p0 + p);
+        is[k] = LoadStore::Load(p0 + p + 8);
       }
 
       double re = 0;
@@ -724,7 +1055,7 @@ class SimulatorAVX final : public SimulatorBase {
                                          const State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const __m256* w,
                 uint64_t imaskh, uint64_t qmaskh, const __m256i* idx,
-                const fp_type* rstate) {
+                const storage_type* rstate) {
       constexpr unsigned gsize = 1 << (H + L);
       constexpr unsigned hsize = 1 << H;
       constexpr unsigned lsize = 1 << L;
@@ -738,8 +1069,8 @@ class SimulatorAVX final : public SimulatorBase {
         unsigned k2 = lsize * k;
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        rs[k2] = _mm256_load_ps(p0 + p);
-        is[k2] = _mm256_load_ps(p0 + p + 8);
+        rs[k2] = LoadStore::Load(p0 + p);
+        is[k2] = LoadStore::Load(p0 + p + 8);
 
         for (unsigned l = 1; l < lsize; ++l) {
           rs[k2 + l] = _mm256_permutevar8x32_ps(rs[k2], idx[l - 1]);
@@ -781,7 +1112,14 @@ class SimulatorAVX final : public SimulatorBase {
     };
 
     __m256i idx[1 << L];
-    __m256 w[1 << (1 + 2 * H + L)];
+    MatrixBuffer<sizeof(fp_type) << (1 + 2 * H + L + 3)> wbuf;
+    __m256* w = (__m256*) wbuf.get();
+
+    if (w == nullptr) {
+      // Not enough memory for the expanded matrix.
+      return ExpectationValueUnexpanded<3>(for_, state.num_qubits(), qs,
+                                            matrix, state.get());
+    }
 
     auto m = GetMasks2<H, L, 3>(qs);
     FillPermutationIndices<L>(m.qmaskl, idx);
@@ -802,7 +1140,7 @@ class SimulatorAVX final : public SimulatorBase {
   void ApplyGateH(const std::vector<unsigned>& qs,
                   const fp_type* matrix, State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* v,
-                const uint64_t* ms, const uint64_t* xss, fp_type* rstate) {
+                const uint64_t* ms, const uint64_t* xss, storage_type* rstate) {
       constexpr unsigned hsize = 1 << H;
 
       __m256 ru, iu, rn, in;
@@ -819,8 +1157,8 @@ class SimulatorAVX final : public SimulatorBase {
       auto p0 = rstate + 2 * ii;
 
       for (unsigned k = 0; k < hsize; ++k) {
-        rs[k] = _mm256_load_ps(p0 + xss[k]);
-        is[k] = _mm256_load_ps(p0 + xss[k] + 8);
+        rs[k] = LoadStore::Load(p0 + xss[k]);
+        is[k] = LoadStore::Load(p0 + xss[k] + 8);
       }
 
       uint64_t j = 0;
@@ -846,8 +1184,8 @@ class SimulatorAVX final : public SimulatorBase {
           j += 2;
         }
 
-        _mm256_store_ps(p0 + xss[k], rn);
-        _mm256_store_ps(p0 + xss[k] + 8, in);
+        LoadStore::Store(p0 + xss[k], rn);
+        LoadStore::Store(p0 + xss[k] + 8, in);
       }
     };
 
@@ -868,7 +1206,7 @@ class SimulatorAVX final : public SimulatorBase {
                   const fp_type* matrix, State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const __m256* w,
                 const uint64_t* ms, const uint64_t* xss, const __m256i* idx,
-                fp_type* rstate) {
+                storage_type* rstate) {
       constexpr unsigned gsize = 1 << (H + L);
       constexpr unsigned hsize = 1 << H;
       constexpr unsigned lsize = 1 << L;
@@ -888,8 +1226,8 @@ class SimulatorAVX final : public SimulatorBase {
 
       for (unsigned k = 0; k < hsize; ++k) {
         unsigned k2 = lsize * k;
-        rs[k2] = _mm256_load_ps(p0 + xss[k]);
-        is[k2] = _mm256_load_ps(p0 + xss[k] + 8);
+        rs[k2] = LoadStore::Load(p0 + xss[k]);
+        is[k2] = LoadStore::Load(p0 + xss[k] + 8);
 
         for (unsigned l = 1; l < lsize; ++l) {
           rs[k2 + l] = _mm256_permutevar8x32_ps(rs[k2], idx[l - 1]);
@@ -916,15 +1254,23 @@ class SimulatorAVX final : public SimulatorBase {
           j += 2;
         }
 
-        _mm256_store_ps(p0 + xss[k], rn);
-        _mm256_store_ps(p0 + xss[k] + 8, in);
+        LoadStore::Store(p0 + xss[k], rn);
+        LoadStore::Store(p0 + xss[k] + 8, in);
       }
     };
 
     uint64_t ms[H + 1];
     uint64_t xss[1 << H];
     __m256i idx[1 << L];
-    __m256 w[1 << (1 + 2 * H + L)];
+    MatrixBuffer<sizeof(fp_type) << (1 + 2 * H + L + 3)> wbuf;
+    __m256* w = (__m256*) wbuf.get();
+
+    if (w == nullptr) {
+      // Not enough memory for the expanded matrix.
+      ApplyGateUnexpanded<3>(for_, state.num_qubits(), qs, matrix,
+                             state.get());
+      return;
+    }
 
     auto m = GetMasks11<L>(qs);
 
@@ -945,7 +1291,7 @@ class SimulatorAVX final : public SimulatorBase {
                              const fp_type* matrix, State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* v,
                 const uint64_t* ms, const uint64_t* xss, uint64_t cvalsh,
-                uint64_t cmaskh, fp_type* rstate) {
+                uint64_t cmaskh, storage_type* rstate) {
       constexpr unsigned hsize = 1 << H;
 
       __m256 ru, iu, rn, in;
@@ -964,8 +1310,8 @@ class SimulatorAVX final : public SimulatorBase {
       auto p0 = rstate + 2 * ii;
 
       for (unsigned k = 0; k < hsize; ++k) {
-        rs[k] = _mm256_load_ps(p0 + xss[k]);
-        is[k] = _mm256_load_ps(p0 + xss[k] + 8);
+        rs[k] = LoadStore::Load(p0 + xss[k]);
+        is[k] = LoadStore::Load(p0 + xss[k] + 8);
       }
 
       uint64_t j = 0;
@@ -991,8 +1337,8 @@ class SimulatorAVX final : public SimulatorBase {
           j += 2;
         }
 
-        _mm256_store_ps(p0 + xss[k], rn);
-        _mm256_store_ps(p0 + xss[k] + 8, in);
+        LoadStore::Store(p0 + xss[k], rn);
+        LoadStore::Store(p0 + xss[k] + 8, in);
       }
     };
 
@@ -1015,7 +1361,7 @@ class SimulatorAVX final : public SimulatorBase {
                              const fp_type* matrix, State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const __m256* w,
                 const uint64_t* ms, const uint64_t* xss, uint64_t cvalsh,
-                uint64_t cmaskh, fp_type* rstate) {
+                uint64_t cmaskh, storage_type* rstate) {
       constexpr unsigned hsize = 1 << H;
 
       __m256 rn, in;
@@ -1034,8 +1380,8 @@ class SimulatorAVX final : public SimulatorBase {
       auto p0 = rstate + 2 * ii;
 
       for (unsigned k = 0; k < hsize; ++k) {
-        rs[k] = _mm256_load_ps(p0 + xss[k]);
-        is[k] = _mm256_load_ps(p0 + xss[k] + 8);
+        rs[k] = LoadStore::Load(p0 + xss[k]);
+        is[k] = LoadStore::Load(p0 + xss[k] + 8);
       }
 
       uint64_t j = 0;
@@ -1057,8 +1403,8 @@ class SimulatorAVX final : public SimulatorBase {
           j += 2;
         }
 
-        _mm256_store_ps(p0 + xss[k], rn);
-        _mm256_store_ps(p0 + xss[k] + 8, in);
+        LoadStore::Store(p0 + xss[k], rn);
+        LoadStore::Store(p0 + xss[k] + 8, in);
       }
     };
 
@@ -1083,7 +1429,7 @@ class SimulatorAVX final : public SimulatorBase {
                             const fp_type* matrix, State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const __m256* w,
                 const uint64_t* ms, const uint64_t* xss, uint64_t cvalsh,
-                uint64_t cmaskh, const __m256i* idx, fp_type* rstate) {
+                uint64_t cmaskh, const __m256i* idx, storage_type* rstate) {
       constexpr unsigned gsize = 1 << (H + L);
       constexpr unsigned hsize = 1 << H;
       constexpr unsigned lsize = 1 << L;
@@ -1106,8 +1452,8 @@ class SimulatorAVX final : public SimulatorBase {
       for (unsigned k = 0; k < hsize; ++k) {
         unsigned k2 = lsize * k;
 
-        rs[k2] = _mm256_load_ps(p0 + xss[k]);
-        is[k2] = _mm256_load_ps(p0 + xss[k] + 8);
+        rs[k2] = LoadStore::Load(p0 + xss[k]);
+        is[k2] = LoadStore::Load(p0 + xss[k] + 8);
 
         for (unsigned l = 1; l < lsize; ++l) {
           rs[k2 + l] = _mm256_permutevar8x32_ps(rs[k2], idx[l - 1]);
@@ -1134,8 +1480,8 @@ class SimulatorAVX final : public SimulatorBase {
           j += 2;
         }
 
-        _mm256_store_ps(p0 + xss[k], rn);
-        _mm256_store_ps(p0 + xss[k] + 8, in);
+        LoadStore::Store(p0 + xss[k], rn);
+        LoadStore::Store(p0 + xss[k] + 8, in);
       }
     };
 
@@ -1172,7 +1518,7 @@ class SimulatorAVX final : public SimulatorBase {
                                          const State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* v,
                 const uint64_t* ms, const uint64_t* xss,
-                const fp_type* rstate) {
+                const storage_type* rstate) {
       constexpr unsigned hsize = 1 << H;
 
       __m256 ru, iu, rn, in;
@@ -1189,8 +1535,8 @@ class SimulatorAVX final : public SimulatorBase {
       auto p0 = rstate + 2 * ii;
 
       for (unsigned k = 0; k < hsize; ++k) {
-        rs[k] = _mm256_load_ps(p0 + xss[k]);
-        is[k] = _mm256_load_ps(p0 + xss[k] + 8);
+        rs[k] = LoadStore::Load(p0 + xss[k]);
+        is[k] = LoadStore::Load(p0 + xss[k] + 8);
       }
 
       double re = 0;
@@ -1247,7 +1593,7 @@ class SimulatorAVX final : public SimulatorBase {
                                          const State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const __m256* w,
                 const uint64_t* ms, const uint64_t* xss, const __m256i* idx,
-                const fp_type* rstate) {
+                const storage_type* rstate) {
       constexpr unsigned gsize = 1 << (H + L);
       constexpr unsigned hsize = 1 << H;
       constexpr unsigned lsize = 1 << L;
@@ -1268,8 +1614,8 @@ class SimulatorAVX final : public SimulatorBase {
       for (unsigned k = 0; k < hsize; ++k) {
         unsigned k2 = lsize * k;
 
-        rs[k2] = _mm256_load_ps(p0 + xss[k]);
-        is[k2] = _mm256_load_ps(p0 + xss[k] + 8);
+        rs[k2] = LoadStore::Load(p0 + xss[k]);
+        is[k2] = LoadStore::Load(p0 + xss[k] + 8);
 
         for (unsigned l = 1; l < lsize; ++l) {
           rs[k2 + l] = _mm256_permutevar8x32_ps(rs[k2], idx[l - 1]);
@@ -1313,7 +1659,14 @@ class SimulatorAVX final : public SimulatorBase {
     uint64_t ms[H + 1];
     uint64_t xss[1 << H];
     __m256i idx[1 << L];
-    __m256 w[1 << (1 + 2 * H + L)];
+    MatrixBuffer<sizeof(fp_type) << (1 + 2 * H + L + 3)> wbuf;
+    __m256* w = (__m256*) wbuf.get();
+
+    if (w == nullptr) {
+      // Not enough memory for the expanded matrix.
+      return ExpectationValueUnexpanded<3>(for_, state.num_qubits(), qs,
+                                            matrix, state.get());
+    }
 
     auto m = GetMasks11<L>(qs);
 
@@ -1346,6 +1699,1445 @@ class SimulatorAVX final : public SimulatorBase {
     }
   }
 
+  template <unsigned H>
+  void ApplyPermutationGateH(const PermutationMatrix<fp_type>& pm,
+                             State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const uint64_t* ms,
+                const uint64_t* xss, const unsigned* offsets,
+                const unsigned* sources, const unsigned* lanes,
+                const fp_type* w, storage_type* rstate) {
+      constexpr unsigned hsize = 1 << H;
+
+      __m256 rn, in, rp, ip, ru, iu;
+      __m256 rs[hsize], is[hsize];
+
+      i *= 8;
+
+      uint64_t ii = i & ms[0];
+      for (unsigned j = 1; j <= H; ++j) {
+        i *= 2;
+        ii |= i & ms[j];
+      }
+
+      auto p0 = rstate + 2 * ii;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rs[k] = LoadStore::Load(p0 + xss[k]);
+        is[k] = LoadStore::Load(p0 + xss[k] + 8);
+      }
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rn = _mm256_setzero_ps();
+        in = _mm256_setzero_ps();
+
+        for (unsigned e = offsets[k]; e < offsets[k + 1]; ++e) {
+          __m256i idx = _mm256_loadu_si256((const __m256i*) (lanes + 8 * e));
+
+          rp = _mm256_permutevar8x32_ps(rs[sources[e]], idx);
+          ip = _mm256_permutevar8x32_ps(is[sources[e]], idx);
+          ru = _mm256_loadu_ps(w + 16 * e);
+          iu = _mm256_loadu_ps(w + 16 * e + 8);
+
+          rn = _mm256_fmadd_ps(rp, ru, rn);
+          in = _mm256_fmadd_ps(rp, iu, in);
+          rn = _mm256_fnmadd_ps(ip, iu, rn);
+          in = _mm256_fmadd_ps(ip, ru, in);
+        }
+
+        LoadStore::Store(p0 + xss[k], rn);
+        LoadStore::Store(p0 + xss[k] + 8, in);
+      }
+    };
+
+    unsigned k = 3 + H;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, pm.ms.data(), pm.xss.data(), pm.offsets.data(),
+             pm.sources.data(), pm.lanes.data(), pm.phases.data(),
+             state.get());
+  }
+
+  template <unsigned N>
+  void ExpectationValuesPauliN(unsigned nb,
+                               const PauliExpectationMatrix<fp_type>& pe,
+                               std::size_t i0, const State& state,
+                               double* results) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, unsigned c,
+                uint64_t xmaskh, uint64_t mlow, const unsigned* lanes,
+                const uint64_t* zmaskh, const fp_type* w,
+                const storage_type* rstate) -> PauliExpectationSums<N> {
+      __m256 acc[N];
+
+      for (unsigned k = 0; k < N; ++k) {
+        acc[k] = _mm256_setzero_ps();
+      }
+
+      __m256i idx = _mm256_loadu_si256((const __m256i*) lanes);
+
+      for (uint64_t j = i << c; j < (i + 1) << c; ++j) {
+        uint64_t t = GetPauliRotationIndex(j, mlow);
+        uint64_t s = t ^ xmaskh;
+
+        auto pt = rstate + 16 * t;
+        auto ps = rstate + 16 * s;
+
+        __m256 rt = LoadStore::Load(pt);
+        __m256 it = LoadStore::Load(pt + 8);
+        __m256 rs = LoadStore::Load(ps);
+        __m256 is = LoadStore::Load(ps + 8);
+        __m256 rp = _mm256_permutevar8x32_ps(rs, idx);
+        __m256 ip = _mm256_permutevar8x32_ps(is, idx);
+
+        // Real and imaginary parts of conj(a_t) a_s.
+        __m256 rq = _mm256_fmadd_ps(rt, rp, _mm256_mul_ps(it, ip));
+        __m256 iq = _mm256_fnmadd_ps(it, rp, _mm256_mul_ps(rt, ip));
+
+        for (unsigned k = 0; k < N; ++k) {
+          __m256 wr = _mm256_loadu_ps(w + 16 * k);
+          __m256 wi = _mm256_loadu_ps(w + 16 * k + 8);
+          __m256 v = _mm256_fmadd_ps(iq, wi, _mm256_mul_ps(rq, wr));
+          fp_type sign = 1 - 2 * fp_type(bits::Parity(t & zmaskh[k]));
+
+          acc[k] = _mm256_fmadd_ps(v, _mm256_set1_ps(sign), acc[k]);
+        }
+      }
+
+      PauliExpectationSums<N> sums;
+
+      for (unsigned k = 0; k < N; ++k) {
+        sums.s[k] = detail::HorizontalSumAVX(acc[k]);
+      }
+
+      return sums;
+    };
+
+    // Each iteration processes 2^c of the 2^nb pairs of blocks.
+    unsigned c = nb > 4 ? 4 : nb;
+    uint64_t size = uint64_t{1} << (nb - c);
+
+    using Op = PauliExpectationSumsPlus<N>;
+    auto sums = for_.RunReduce(size, f, Op(), c, pe.xmaskh, pe.mlow,
+                               pe.lanes.data(), pe.zmaskh.data() + i0,
+                               pe.w.data() + 16 * i0, state.get());
+
+    for (unsigned k = 0; k < N; ++k) {
+      results[i0 + k] = sums.s[k];
+    }
+  }
+
+ protected:
+  For for_;
+};
+
+/**
+ * Quantum circuit simulator with AVX vectorization.
+ */
+template <typename For>
+class SimulatorAVX<For, float> final
+    : public SimulatorAVXFloat<For, FloatLoadStoreAVX<For>> {
+ private:
+  using Base = SimulatorAVXFloat<For, FloatLoadStoreAVX<For>>;
+
+ public:
+  using State = typename Base::State;
+
+  template <typename... ForArgs>
+  explicit SimulatorAVX(ForArgs&&... args) : Base(args...) {}
+
+  /**
+   * Computes the reduced density matrix of the given qubits in one read-only
+   * pass over the state vector.
+   * @param qs Indices of the qubits; should be sorted in increasing order.
+   *   There should be at most four qubits.
+   * @param state The state of the system.
+   * @return The 2^k x 2^k reduced density matrix (k = qs.size()) in row-major
+   *   order; bit j of the row and column indices corresponds to qs[j].
+   *   The vector is empty if there are more than four qubits.
+   */
+  std::vector<std::complex<double>> ReducedDensityMatrix(
+      const std::vector<unsigned>& qs, const State& state) const {
+    return SimulatorBase::ComputeReducedDensityMatrix<3>(
+        this->for_, state.num_qubits(), qs, state.get());
+  }
+};
+
+/**
+ * Double-precision quantum circuit simulator with AVX vectorization.
+ */
+template <typename For>
+class SimulatorAVX<For, double> final : public SimulatorBase {
+ public:
+  using StateSpace = StateSpaceAVX<For, double>;
+  using State = typename StateSpace::State;
+  using fp_type = typename StateSpace::fp_type;
+
+  template <typename... ForArgs>
+  explicit SimulatorAVX(ForArgs&&... args) : for_(args...) {}
+
+  /**
+   * Applies a gate using AVX instructions.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param matrix Matrix representation of the gate to be applied.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyGate(const std::vector<unsigned>& qs,
+                 const fp_type* matrix, State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    switch (qs.size()) {
+    case 1:
+      if (qs[0] > 1) {
+        ApplyGateH<1>(qs, matrix, state);
+      } else {
+        ApplyGateL<0, 1>(qs, matrix, state);
+      }
+      break;
+    case 2:
+      if (qs[0] > 1) {
+        ApplyGateH<2>(qs, matrix, state);
+      } else if (qs[1] > 1) {
+        ApplyGateL<1, 1>(qs, matrix, state);
+      } else {
+        ApplyGateL<0, 2>(qs, matrix, state);
+      }
+      break;
+    case 3:
+      if (qs[0] > 1) {
+        ApplyGateH<3>(qs, matrix, state);
+      } else if (qs[1] > 1) {
+        ApplyGateL<2, 1>(qs, matrix, state);
+      } else {
+        ApplyGateL<1, 2>(qs, matrix, state);
+      }
+      break;
+    case 4:
+      if (qs[0] > 1) {
+        ApplyGateH<4>(qs, matrix, state);
+      } else if (qs[1] > 1) {
+        ApplyGateL<3, 1>(qs, matrix, state);
+      } else {
+        ApplyGateL<2, 2>(qs, matrix, state);
+      }
+      break;
+    case 5:
+      if (qs[0] > 1) {
+        ApplyGateH<5>(qs, matrix, state);
+      } else if (qs[1] > 1) {
+        ApplyGateL<4, 1>(qs, matrix, state);
+      } else {
+        ApplyGateL<3, 2>(qs, matrix, state);
+      }
+      break;
+    case 6:
+      if (qs[0] > 1) {
+        ApplyGateH<6>(qs, matrix, state);
+      } else if (qs[1] > 1) {
+        ApplyGateL<5, 1>(qs, matrix, state);
+      } else {
+        ApplyGateL<4, 2>(qs, matrix, state);
+      }
+      break;
+    case 7:
+      if (qs[0] > 1) {
+        ApplyGateH<7>(qs, matrix, state);
+      } else if (qs[1] > 1) {
+        ApplyGateL<6, 1>(qs, matrix, state);
+      } else {
+        ApplyGateL<5, 2>(qs, matrix, state);
+      }
+      break;
+    case 8:
+      if (qs[0] > 1) {
+        ApplyGateH<8>(qs, matrix, state);
+      } else if (qs[1] > 1) {
+        ApplyGateL<7, 1>(qs, matrix, state);
+      } else {
+        ApplyGateL<6, 2>(qs, matrix, state);
+      }
+      break;
+    default:
+      // Not implemented.
+      break;
+    }
+  }
+
+  /**
+   * Applies a controlled gate using AVX instructions.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param cqs Indices of control qubits.
+   * @param cvals Bit mask of control qubit values.
+   * @param matrix Matrix representation of the gate to be applied.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyControlledGate(const std::vector<unsigned>& qs,
+                           const std::vector<unsigned>& cqs, uint64_t cvals,
+                           const fp_type* matrix, State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+    // Assume cqs[0] < cqs[1] < cqs[2] < ... .
+
+    if (cqs.size() == 0) {
+      ApplyGate(qs, matrix, state);
+      return;
+    }
+
+    switch (qs.size()) {
+    case 1:
+      if (qs[0] > 1) {
+        if (cqs[0] > 1) {
+          ApplyControlledGateHH<1>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateHL<1>(qs, cqs, cvals, matrix, state);
+        }
+      } else {
+        if (cqs[0] > 1) {
+          ApplyControlledGateL<0, 1, 1>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateL<0, 1, 0>(qs, cqs, cvals, matrix, state);
+        }
+      }
+      break;
+    case 2:
+      if (qs[0] > 1) {
+        if (cqs[0] > 1) {
+          ApplyControlledGateHH<2>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateHL<2>(qs, cqs, cvals, matrix, state);
+        }
+      } else if (qs[1] > 1) {
+        if (cqs[0] > 1) {
+          ApplyControlledGateL<1, 1, 1>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateL<1, 1, 0>(qs, cqs, cvals, matrix, state);
+        }
+      } else {
+        if (cqs[0] > 1) {
+          ApplyControlledGateL<0, 2, 1>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateL<0, 2, 0>(qs, cqs, cvals, matrix, state);
+        }
+      }
+      break;
+    case 3:
+      if (qs[0] > 1) {
+        if (cqs[0] > 1) {
+          ApplyControlledGateHH<3>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateHL<3>(qs, cqs, cvals, matrix, state);
+        }
+      } else if (qs[1] > 1) {
+        if (cqs[0] > 1) {
+          ApplyControlledGateL<2, 1, 1>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateL<2, 1, 0>(qs, cqs, cvals, matrix, state);
+        }
+      } else {
+        if (cqs[0] > 1) {
+          ApplyControlledGateL<1, 2, 1>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateL<1, 2, 0>(qs, cqs, cvals, matrix, state);
+        }
+      }
+      break;
+    case 4:
+      if (qs[0] > 1) {
+        if (cqs[0] > 1) {
+          ApplyControlledGateHH<4>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateHL<4>(qs, cqs, cvals, matrix, state);
+        }
+      } else if (qs[1] > 1) {
+        if (cqs[0] > 1) {
+          ApplyControlledGateL<3, 1, 1>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateL<3, 1, 0>(qs, cqs, cvals, matrix, state);
+        }
+      } else {
+        if (cqs[0] > 1) {
+          ApplyControlledGateL<2, 2, 1>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateL<2, 2, 0>(qs, cqs, cvals, matrix, state);
+        }
+      }
+      break;
+    default:
+      // Not implemented.
+      break;
+    }
+  }
+
+  /**
+   * Applies a diagonal gate using AVX instructions.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param diag Diagonal entries of the gate matrix; the real part of each
+   *   entry is followed by its imaginary part.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyDiagonalGate(const std::vector<unsigned>& qs,
+                         const fp_type* diag, State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* w,
+                uint64_t qmaskh, fp_type* rstate) {
+      auto v = w + 8 * GetDiagonalIndex(i, qmaskh);
+      auto p = rstate + 8 * i;
+
+      __m256d ru = _mm256_loadu_pd(v);
+      __m256d iu = _mm256_loadu_pd(v + 4);
+      __m256d rs = _mm256_load_pd(p);
+      __m256d is = _mm256_load_pd(p + 4);
+
+      __m256d rn = _mm256_fnmadd_pd(is, iu, _mm256_mul_pd(rs, ru));
+      __m256d in = _mm256_fmadd_pd(is, ru, _mm256_mul_pd(rs, iu));
+
+      _mm256_store_pd(p, rn);
+      _mm256_store_pd(p + 4, in);
+    };
+
+    std::vector<fp_type> w;
+    uint64_t qmaskh = FillDiagonalMatrix<2>(qs, diag, w);
+
+    unsigned k = 2;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, w.data(), qmaskh, state.get());
+  }
+
+  /**
+   * Applies a permutation gate using AVX instructions. Permutation gates
+   * (X, Y, CNOT, SWAP, ISWAP, CCX, CSWAP, ...) have exactly one nonzero
+   * element in each row and each column of the gate matrix.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param perm Permutation; the nonzero element of the k-th row of the gate
+   *   matrix is in column perm[k].
+   * @param phases Nonzero elements of the gate matrix; the real part of each
+   *   element is followed by its imaginary part.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyPermutationGate(const std::vector<unsigned>& qs,
+                            const unsigned* perm, const fp_type* phases,
+                            State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    PermutationMatrix<fp_type> pm;
+    unsigned h = FillPermutationMatrix<2>(
+        state.num_qubits(), qs, perm, phases, pm);
+
+    // Convert the source lanes to the 32-bit element permutation indices.
+    std::vector<unsigned> lanes(2 * pm.lanes.size());
+    for (std::size_t i = 0; i < pm.lanes.size(); ++i) {
+      lanes[2 * i] = 2 * pm.lanes[i];
+      lanes[2 * i + 1] = 2 * pm.lanes[i] + 1;
+    }
+    pm.lanes.swap(lanes);
+
+    switch (h) {
+    case 0:
+      ApplyPermutationGateH<0>(pm, state);
+      break;
+    case 1:
+      ApplyPermutationGateH<1>(pm, state);
+      break;
+    case 2:
+      ApplyPermutationGateH<2>(pm, state);
+      break;
+    case 3:
+      ApplyPermutationGateH<3>(pm, state);
+      break;
+    case 4:
+      ApplyPermutationGateH<4>(pm, state);
+      break;
+    case 5:
+      ApplyPermutationGateH<5>(pm, state);
+      break;
+    case 6:
+      ApplyPermutationGateH<6>(pm, state);
+      break;
+    default:
+      // Not implemented.
+      break;
+    }
+  }
+
+  /**
+   * Applies the rotation exp(-i theta P) about a Pauli string P using
+   * AVX instructions; see gate::PauliRotation in gate.h. The amplitudes
+   * are paired by the X and Y operators and updated in one pass over
+   * the state vector.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param paulis Pauli operators acting on the qubits: 1 for X, 2 for Y and
+   *   3 for Z.
+   * @param theta The rotation angle.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyPauliRotation(const std::vector<unsigned>& qs,
+                          const unsigned* paulis, fp_type theta,
+                          State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, uint64_t xmaskh,
+                uint64_t zmaskh, uint64_t mlow, fp_type c,
+                const unsigned* lanes, const fp_type* w, fp_type* rstate) {
+      uint64_t t = GetPauliRotationIndex(i, mlow);
+      uint64_t s = t ^ xmaskh;
+
+      auto pt = rstate + 8 * t;
+      auto ps = rstate + 8 * s;
+
+      __m256i idx = _mm256_loadu_si256((const __m256i*) lanes);
+      __m256d cc = _mm256_set1_pd(c);
+
+      __m256d rt = _mm256_load_pd(pt);
+      __m256d it = _mm256_load_pd(pt + 4);
+      __m256d rs = _mm256_load_pd(ps);
+      __m256d is = _mm256_load_pd(ps + 4);
+
+      auto wt = w + 8 * bits::Parity(s & zmaskh);
+
+      __m256d ru = _mm256_loadu_pd(wt);
+      __m256d iu = _mm256_loadu_pd(wt + 4);
+      __m256d rp = _mm256_castps_pd(
+          _mm256_permutevar8x32_ps(_mm256_castpd_ps(rs), idx));
+      __m256d ip = _mm256_castps_pd(
+          _mm256_permutevar8x32_ps(_mm256_castpd_ps(is), idx));
+
+      __m256d rn = _mm256_fmadd_pd(rp, ru, _mm256_mul_pd(rt, cc));
+      __m256d in = _mm256_fmadd_pd(rp, iu, _mm256_mul_pd(it, cc));
+      rn = _mm256_fnmadd_pd(ip, iu, rn);
+      in = _mm256_fmadd_pd(ip, ru, in);
+
+      if (s != t) {
+        auto ws = w + 8 * bits::Parity(t & zmaskh);
+
+        ru = _mm256_loadu_pd(ws);
+        iu = _mm256_loadu_pd(ws + 4);
+        rp = _mm256_castps_pd(
+            _mm256_permutevar8x32_ps(_mm256_castpd_ps(rt), idx));
+        ip = _mm256_castps_pd(
+            _mm256_permutevar8x32_ps(_mm256_castpd_ps(it), idx));
+
+        __m256d rm = _mm256_fmadd_pd(rp, ru, _mm256_mul_pd(rs, cc));
+        __m256d im = _mm256_fmadd_pd(rp, iu, _mm256_mul_pd(is, cc));
+        rm = _mm256_fnmadd_pd(ip, iu, rm);
+        im = _mm256_fmadd_pd(ip, ru, im);
+
+        _mm256_store_pd(ps, rm);
+        _mm256_store_pd(ps + 4, im);
+      }
+
+      _mm256_store_pd(pt, rn);
+      _mm256_store_pd(pt + 4, in);
+    };
+
+    PauliRotationMatrix<fp_type> pr;
+    FillPauliRotationMatrix<2>(qs, paulis, theta, pr);
+
+    // Convert the source lanes to the 32-bit element permutation indices.
+    std::vector<unsigned> lanes(2 * pr.lanes.size());
+    for (std::size_t i = 0; i < pr.lanes.size(); ++i) {
+      lanes[2 * i] = 2 * pr.lanes[i];
+      lanes[2 * i + 1] = 2 * pr.lanes[i] + 1;
+    }
+    pr.lanes.swap(lanes);
+
+    unsigned k = 2;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    if (pr.xmaskh != 0) --n;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, pr.xmaskh, pr.zmaskh, pr.mlow, pr.c, pr.lanes.data(),
+             pr.w.data(), state.get());
+  }
+
+  /**
+   * Computes the expectation value of an operator using AVX instructions.
+   * @param qs Indices of the qubits the operator acts on.
+   * @param matrix The operator matrix.
+   * @param state The state of the system.
+   * @return The computed expectation value.
+   */
+  std::complex<double> ExpectationValue(const std::vector<unsigned>& qs,
+                                        const fp_type* matrix,
+                                        const State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    switch (qs.size()) {
+    case 1:
+      if (qs[0] > 1) {
+        return ExpectationValueH<1>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<0, 1>(qs, matrix, state);
+      }
+      break;
+    case 2:
+      if (qs[0] > 1) {
+        return ExpectationValueH<2>(qs, matrix, state);
+      } else if (qs[1] > 1) {
+        return ExpectationValueL<1, 1>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<0, 2>(qs, matrix, state);
+      }
+      break;
+    case 3:
+      if (qs[0] > 1) {
+        return ExpectationValueH<3>(qs, matrix, state);
+      } else if (qs[1] > 1) {
+        return ExpectationValueL<2, 1>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<1, 2>(qs, matrix, state);
+      }
+      break;
+    case 4:
+      if (qs[0] > 1) {
+        return ExpectationValueH<4>(qs, matrix, state);
+      } else if (qs[1] > 1) {
+        return ExpectationValueL<3, 1>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<2, 2>(qs, matrix, state);
+      }
+      break;
+    case 5:
+      if (qs[0] > 1) {
+        return ExpectationValueH<5>(qs, matrix, state);
+      } else if (qs[1] > 1) {
+        return ExpectationValueL<4, 1>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<3, 2>(qs, matrix, state);
+      }
+      break;
+    case 6:
+      if (qs[0] > 1) {
+        return ExpectationValueH<6>(qs, matrix, state);
+      } else if (qs[1] > 1) {
+        return ExpectationValueL<5, 1>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<4, 2>(qs, matrix, state);
+      }
+      break;
+    case 7:
+      if (qs[0] > 1) {
+        return ExpectationValueH<7>(qs, matrix, state);
+      } else if (qs[1] > 1) {
+        return ExpectationValueL<6, 1>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<5, 2>(qs, matrix, state);
+      }
+      break;
+    case 8:
+      if (qs[0] > 1) {
+        return ExpectationValueH<8>(qs, matrix, state);
+      } else if (qs[1] > 1) {
+        return ExpectationValueL<7, 1>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<6, 2>(qs, matrix, state);
+      }
+      break;
+    default:
+      // Not implemented.
+      break;
+    }
+
+    return 0;
+  }
+
+  /**
+   * Computes the expectation value of a Pauli string P using AVX instructions.
+   * The amplitudes are paired by the X and Y operators and the expectation
+   * value is computed in one read-only pass over the state vector; there is
+   * no limit on the number of qubits.
+   * @param qs Indices of the qubits the Pauli string acts on; should be
+   *   distinct.
+   * @param paulis Pauli operators acting on the qubits: 1 for X, 2 for Y and
+   *   3 for Z.
+   * @param state The state of the system.
+   * @return The computed expectation value <state|P|state>.
+   */
+  double ExpectationValuePauli(const std::vector<unsigned>& qs,
+                               const unsigned* paulis,
+                               const State& state) const {
+    uint64_t xmask, zmask;
+    GetPauliMasks(qs, paulis, xmask, zmask);
+
+    return ExpectationValuesPauli(xmask, {zmask}, state)[0];
+  }
+
+  /**
+   * Computes the expectation values of Pauli strings with the same X and Y
+   * operators using AVX instructions. The amplitude pair products are shared by
+   * all the strings; up to 16 strings are evaluated in one read-only pass over
+   * the state vector.
+   * @param xmask Mask of the qubits acted on by X or Y operators; the same
+   *   for all the Pauli strings.
+   * @param zmasks Masks of the qubits acted on by Y or Z operators, one mask
+   *   per Pauli string.
+   * @param state The state of the system.
+   * @return The computed expectation values, one value per Pauli string.
+   */
+  std::vector<double> ExpectationValuesPauli(
+      uint64_t xmask, const std::vector<uint64_t>& zmasks,
+      const State& state) const {
+    PauliExpectationMatrix<fp_type> pe;
+    FillPauliExpectationMatrix<2>(xmask, zmasks, pe);
+
+    // Convert the source lanes to the 32-bit element permutation indices.
+    std::vector<unsigned> lanes(2 * pe.lanes.size());
+    for (std::size_t i = 0; i < pe.lanes.size(); ++i) {
+      lanes[2 * i] = 2 * pe.lanes[i];
+      lanes[2 * i + 1] = 2 * pe.lanes[i] + 1;
+    }
+    pe.lanes.swap(lanes);
+
+    unsigned k = 2;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    if (pe.xmaskh != 0) --n;
+
+    std::vector<double> results(zmasks.size(), 0);
+
+    std::size_t i = 0;
+
+    for (; i + 16 <= zmasks.size(); i += 16) {
+      ExpectationValuesPauliN<16>(n, pe, i, state, results.data());
+    }
+
+    for (; i + 4 <= zmasks.size(); i += 4) {
+      ExpectationValuesPauliN<4>(n, pe, i, state, results.data());
+    }
+
+    for (; i < zmasks.size(); ++i) {
+      ExpectationValuesPauliN<1>(n, pe, i, state, results.data());
+    }
+
+    return results;
+  }
+
+  /**
+   * Computes the reduced density matrix of the given qubits in one read-only
+   * pass over the state vector.
+   * @param qs Indices of the qubits; should be sorted in increasing order.
+   *   There should be at most four qubits.
+   * @param state The state of the system.
+   * @return The 2^k x 2^k reduced density matrix (k = qs.size()) in row-major
+   *   order; bit j of the row and column indices corresponds to qs[j].
+   *   The vector is empty if there are more than four qubits.
+   */
+  std::vector<std::complex<double>> ReducedDensityMatrix(
+      const std::vector<unsigned>& qs, const State& state) const {
+    return ComputeReducedDensityMatrix<2>(for_, state.num_qubits(), qs,
+                                          state.get());
+  }
+
+  /**
+   * @return The size of SIMD register if applicable.
+   */
+  static unsigned SIMDRegisterSize() {
+    return 4;
+  }
+
+  /**
+   * @return The object that runs the parallel loops of this simulator.
+   */
+  const For& GetFor() const {
+    return for_;
+  }
+
+ private:
+  template <unsigned H>
+  void ApplyGateH(const std::vector<unsigned>& qs,
+                  const fp_type* matrix, State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* v,
+                const uint64_t* ms, const uint64_t* xss, fp_type* rstate) {
+      constexpr unsigned hsize = 1 << H;
+
+      __m256d ru, iu, rn, in;
+      __m256d rs[hsize], is[hsize];
+
+      i *= 4;
+
+      uint64_t ii = i & ms[0];
+      for (unsigned j = 1; j <= H; ++j) {
+        i *= 2;
+        ii |= i & ms[j];
+      }
+
+      auto p0 = rstate + 2 * ii;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rs[k] = _mm256_load_pd(p0 + xss[k]);
+        is[k] = _mm256_load_pd(p0 + xss[k] + 4);
+      }
+
+      uint64_t j = 0;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        ru = _mm256_set1_pd(v[j]);
+        iu = _mm256_set1_pd(v[j + 1]);
+        rn = _mm256_mul_pd(rs[0], ru);
+        in = _mm256_mul_pd(rs[0], iu);
+        rn = _mm256_fnmadd_pd(is[0], iu, rn);
+        in = _mm256_fmadd_pd(is[0], ru, in);
+
+        j += 2;
+
+        for (unsigned l = 1; l < hsize; ++l) {
+          ru = _mm256_set1_pd(v[j]);
+          iu = _mm256_set1_pd(v[j + 1]);
+          rn = _mm256_fmadd_pd(rs[l], ru, rn);
+          in = _mm256_fmadd_pd(rs[l], iu, in);
+          rn = _mm256_fnmadd_pd(is[l], iu, rn);
+          in = _mm256_fmadd_pd(is[l], ru, in);
+
+          j += 2;
+        }
+
+        _mm256_store_pd(p0 + xss[k], rn);
+        _mm256_store_pd(p0 + xss[k] + 4, in);
+      }
+    };
+
+    uint64_t ms[H + 1];
+    uint64_t xss[1 << H];
+
+    FillIndices<H>(state.num_qubits(), qs, ms, xss);
+
+    unsigned k = 2 + H;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, matrix, ms, xss, state.get());
+  }
+
+  template <unsigned H, unsigned L>
+  void ApplyGateL(const std::vector<unsigned>& qs,
+                  const fp_type* matrix, State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const __m256d* w,
+                const uint64_t* ms, const uint64_t* xss,
+                unsigned q0, fp_type* rstate) {
+      constexpr unsigned gsize = 1 << (H + L);
+      constexpr unsigned hsize = 1 << H;
+      constexpr unsigned lsize = 1 << L;
+
+      __m256d rn, in;
+      __m256d rs[gsize], is[gsize];
+
+      i *= 4;
+
+      uint64_t ii = i & ms[0];
+      for (unsigned j = 1; j <= H; ++j) {
+        i *= 2;
+        ii |= i & ms[j];
+      }
+
+      auto p0 = rstate + 2 * ii;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        unsigned k2 = lsize * k;
+
+        rs[k2] = _mm256_load_pd(p0 + xss[k]);
+        is[k2] = _mm256_load_pd(p0 + xss[k] + 4);
+
+        if (L == 1) {
+          rs[k2 + 1] = q0 == 0 ? _mm256_permute4x64_pd(rs[k2], 177)
+                               : _mm256_permute4x64_pd(rs[k2], 78);
+          is[k2 + 1] = q0 == 0 ? _mm256_permute4x64_pd(is[k2], 177)
+                               : _mm256_permute4x64_pd(is[k2], 78);
+        } else if (L == 2) {
+          rs[k2 + 1] = _mm256_permute4x64_pd(rs[k2], 57);
+          is[k2 + 1] = _mm256_permute4x64_pd(is[k2], 57);
+          rs[k2 + 2] = _mm256_permute4x64_pd(rs[k2], 78);
+          is[k2 + 2] = _mm256_permute4x64_pd(is[k2], 78);
+          rs[k2 + 3] = _mm256_permute4x64_pd(rs[k2], 147);
+          is[k2 + 3] = _mm256_permute4x64_pd(is[k2], 147);
+        }
+      }
+
+      uint64_t j = 0;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rn = _mm256_mul_pd(rs[0], w[j]);
+        in = _mm256_mul_pd(rs[0], w[j + 1]);
+        rn = _mm256_fnmadd_pd(is[0], w[j + 1], rn);
+        in = _mm256_fmadd_pd(is[0], w[j], in);
+
+        j += 2;
+
+        for (unsigned l = 1; l < gsize; ++l) {
+          rn = _mm256_fmadd_pd(rs[l], w[j], rn);
+          in = _mm256_fmadd_pd(rs[l], w[j + 1], in);
+          rn = _mm256_fnmadd_pd(is[l], w[j + 1], rn);
+          in = _mm256_fmadd_pd(is[l], w[j], in);
+
+          j += 2;
+        }
+
+        _mm256_store_pd(p0 + xss[k], rn);
+        _mm256_store_pd(p0 + xss[k] + 4, in);
+      }
+    };
+
+    uint64_t ms[H + 1];
+    uint64_t xss[1 << H];
+    MatrixBuffer<sizeof(fp_type) << (1 + 2 * H + L + 2)> wbuf;
+    __m256d* w = (__m256d*) wbuf.get();
+
+    if (w == nullptr) {
+      // Not enough memory for the expanded matrix.
+      ApplyGateUnexpanded<2>(for_, state.num_qubits(), qs, matrix,
+                             state.get());
+      return;
+    }
+
+    auto m = GetMasks11<L>(qs);
+
+    FillIndices<H, L>(state.num_qubits(), qs, ms, xss);
+    FillMatrix<H, L, 2>(m.qmaskl, matrix, (fp_type*) w);
+
+    unsigned k = 2 + H;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, w, ms, xss, qs[0], state.get());
+  }
+
+  template <unsigned H>
+  void ApplyControlledGateHH(const std::vector<unsigned>& qs,
+                             const std::vector<unsigned>& cqs, uint64_t cvals,
+                             const fp_type* matrix, State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* v,
+                const uint64_t* ms, const uint64_t* xss, uint64_t cvalsh,
+                uint64_t cmaskh, fp_type* rstate) {
+      constexpr unsigned hsize = 1 << H;
+
+      __m256d ru, iu, rn, in;
+      __m256d rs[hsize], is[hsize];
+
+      i *= 4;
+
+      uint64_t ii = i & ms[0];
+      for (unsigned j = 1; j <= H; ++j) {
+        i *= 2;
+        ii |= i & ms[j];
+      }
+
+      if ((ii & cmaskh) != cvalsh) return;
+
+      auto p0 = rstate + 2 * ii;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rs[k] = _mm256_load_pd(p0 + xss[k]);
+        is[k] = _mm256_load_pd(p0 + xss[k] + 4);
+      }
+
+      uint64_t j = 0;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        ru = _mm256_set1_pd(v[j]);
+        iu = _mm256_set1_pd(v[j + 1]);
+        rn = _mm256_mul_pd(rs[0], ru);
+        in = _mm256_mul_pd(rs[0], iu);
+        rn = _mm256_fnmadd_pd(is[0], iu, rn);
+        in = _mm256_fmadd_pd(is[0], ru, in);
+
+        j += 2;
+
+        for (unsigned l = 1; l < hsize; ++l) {
+          ru = _mm256_set1_pd(v[j]);
+          iu = _mm256_set1_pd(v[j + 1]);
+          rn = _mm256_fmadd_pd(rs[l], ru, rn);
+          in = _mm256_fmadd_pd(rs[l], iu, in);
+          rn = _mm256_fnmadd_pd(is[l], iu, rn);
+          in = _mm256_fmadd_pd(is[l], ru, in);
+
+          j += 2;
+        }
+
+        _mm256_store_pd(p0 + xss[k], rn);
+        _mm256_store_pd(p0 + xss[k] + 4, in);
+      }
+    };
+
+    uint64_t ms[H + 1];
+    uint64_t xss[1 << H];
+
+    auto m = GetMasks7(state.num_qubits(), qs, cqs, cvals);
+    FillIndices<H>(state.num_qubits(), qs, ms, xss);
+
+    unsigned k = 2 + H;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, matrix, ms, xss, m.cvalsh, m.cmaskh, state.get());
+  }
+
+  template <unsigned H>
+  void ApplyControlledGateHL(const std::vector<unsigned>& qs,
+                             const std::vector<unsigned>& cqs, uint64_t cvals,
+                             const fp_type* matrix, State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const __m256d* w,
+                const uint64_t* ms, const uint64_t* xss, uint64_t cvalsh,
+                uint64_t cmaskh, fp_type* rstate) {
+      constexpr unsigned hsize = 1 << H;
+
+      __m256d rn, in;
+      __m256d rs[hsize], is[hsize];
+
+      i *= 4;
+
+      uint64_t ii = i & ms[0];
+      for (unsigned j = 1; j <= H; ++j) {
+        i *= 2;
+        ii |= i & ms[j];
+      }
+
+      if ((ii & cmaskh) != cvalsh) return;
+
+      auto p0 = rstate + 2 * ii;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rs[k] = _mm256_load_pd(p0 + xss[k]);
+        is[k] = _mm256_load_pd(p0 + xss[k] + 4);
+      }
+
+      uint64_t j = 0;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rn = _mm256_mul_pd(rs[0], w[j]);
+        in = _mm256_mul_pd(rs[0], w[j + 1]);
+        rn = _mm256_fnmadd_pd(is[0], w[j + 1], rn);
+        in = _mm256_fmadd_pd(is[0], w[j], in);
+
+        j += 2;
+
+        for (unsigned l = 1; l < hsize; ++l) {
+          rn = _mm256_fmadd_pd(rs[l], w[j], rn);
+          in = _mm256_fmadd_pd(rs[l], w[j + 1], in);
+          rn = _mm256_fnmadd_pd(is[l], w[j + 1], rn);
+          in = _mm256_fmadd_pd(is[l], w[j], in);
+
+          j += 2;
+        }
+
+        _mm256_store_pd(p0 + xss[k], rn);
+        _mm256_store_pd(p0 + xss[k] + 4, in);
+      }
+    };
+
+    uint64_t ms[H + 1];
+    uint64_t xss[1 << H];
+    __m256d w[1 << (1 + 2 * H)];
+
+    auto m = GetMasks8<2>(state.num_qubits(), qs, cqs, cvals);
+    FillIndices<H>(state.num_qubits(), qs, ms, xss);
+    FillControlledMatrixH<H, 2>(m.cvalsl, m.cmaskl, matrix, (fp_type*) w);
+
+    unsigned r = 2 + H;
+    unsigned n = state.num_qubits() > r ? state.num_qubits() - r : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, w, ms, xss, m.cvalsh, m.cmaskh, state.get());
+  }
+
+  template <unsigned H, unsigned L, bool CH>
+  void ApplyControlledGateL(const std::vector<unsigned>& qs,
+                            const std::vector<unsigned>& cqs, uint64_t cvals,
+                            const fp_type* matrix, State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const __m256d* w,
+                const uint64_t* ms, const uint64_t* xss, uint64_t cvalsh,
+                uint64_t cmaskh, unsigned q0, fp_type* rstate) {
+      constexpr unsigned gsize = 1 << (H + L);
+      constexpr unsigned hsize = 1 << H;
+      constexpr unsigned lsize = 1 << L;
+
+      __m256d rn, in;
+      __m256d rs[gsize], is[gsize];
+
+      i *= 4;
+
+      uint64_t ii = i & ms[0];
+      for (unsigned j = 1; j <= H; ++j) {
+        i *= 2;
+        ii |= i & ms[j];
+      }
+
+      if ((ii & cmaskh) != cvalsh) return;
+
+      auto p0 = rstate + 2 * ii;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        unsigned k2 = lsize * k;
+
+        rs[k2] = _mm256_load_pd(p0 + xss[k]);
+        is[k2] = _mm256_load_pd(p0 + xss[k] + 4);
+
+        if (L == 1) {
+          rs[k2 + 1] = q0 == 0 ? _mm256_permute4x64_pd(rs[k2], 177)
+                               : _mm256_permute4x64_pd(rs[k2], 78);
+          is[k2 + 1] = q0 == 0 ? _mm256_permute4x64_pd(is[k2], 177)
+                               : _mm256_permute4x64_pd(is[k2], 78);
+        } else if (L == 2) {
+          rs[k2 + 1] = _mm256_permute4x64_pd(rs[k2], 57);
+          is[k2 + 1] = _mm256_permute4x64_pd(is[k2], 57);
+          rs[k2 + 2] = _mm256_permute4x64_pd(rs[k2], 78);
+          is[k2 + 2] = _mm256_permute4x64_pd(is[k2], 78);
+          rs[k2 + 3] = _mm256_permute4x64_pd(rs[k2], 147);
+          is[k2 + 3] = _mm256_permute4x64_pd(is[k2], 147);
+        }
+      }
+
+      uint64_t j = 0;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rn = _mm256_mul_pd(rs[0], w[j]);
+        in = _mm256_mul_pd(rs[0], w[j + 1]);
+        rn = _mm256_fnmadd_pd(is[0], w[j + 1], rn);
+        in = _mm256_fmadd_pd(is[0], w[j], in);
+
+        j += 2;
+
+        for (unsigned l = 1; l < gsize; ++l) {
+          rn = _mm256_fmadd_pd(rs[l], w[j], rn);
+          in = _mm256_fmadd_pd(rs[l], w[j + 1], in);
+          rn = _mm256_fnmadd_pd(is[l], w[j + 1], rn);
+          in = _mm256_fmadd_pd(is[l], w[j], in);
+
+          j += 2;
+        }
+
+        _mm256_store_pd(p0 + xss[k], rn);
+        _mm256_store_pd(p0 + xss[k] + 4, in);
+      }
+    };
+
+    uint64_t ms[H + 1];
+    uint64_t xss[1 << H];
+    __m256d w[1 << (1 + 2 * H + L)];
+
+    FillIndices<H, L>(state.num_qubits(), qs, ms, xss);
+
+    unsigned r = 2 + H;
+    unsigned n = state.num_qubits() > r ? state.num_qubits() - r : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    if (CH) {
+      auto m = GetMasks9<L>(state.num_qubits(), qs, cqs, cvals);
+      FillMatrix<H, L, 2>(m.qmaskl, matrix, (fp_type*) w);
+
+      for_.Run(size, f, w, ms, xss, m.cvalsh, m.cmaskh, qs[0], state.get());
+    } else {
+      auto m = GetMasks10<L, 2>(state.num_qubits(), qs, cqs, cvals);
+      FillControlledMatrixL<H, L, 2>(
+          m.cvalsl, m.cmaskl, m.qmaskl, matrix, (fp_type*) w);
+
+      for_.Run(size, f, w, ms, xss, m.cvalsh, m.cmaskh, qs[0], state.get());
+    }
+  }
+
+  template <unsigned H>
+  std::complex<double> ExpectationValueH(const std::vector<unsigned>& qs,
+                                         const fp_type* matrix,
+                                         const State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* v,
+                const uint64_t* ms, const uint64_t* xss,
+                const fp_type* rstate) {
+      constexpr unsigned hsize = 1 << H;
+
+      __m256d ru, iu, rn, in;
+      __m256d rs[hsize], is[hsize];
+
+      i *= 4;
+
+      uint64_t ii = i & ms[0];
+      for (unsigned j = 1; j <= H; ++j) {
+        i *= 2;
+        ii |= i & ms[j];
+      }
+
+      auto p0 = rstate + 2 * ii;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rs[k] = _mm256_load_pd(p0 + xss[k]);
+        is[k] = _mm256_load_pd(p0 + xss[k] + 4);
+      }
+
+      double re = 0;
+      double im = 0;
+      uint64_t j = 0;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        ru = _mm256_set1_pd(v[j]);
+        iu = _mm256_set1_pd(v[j + 1]);
+        rn = _mm256_mul_pd(rs[0], ru);
+        in = _mm256_mul_pd(rs[0], iu);
+        rn = _mm256_fnmadd_pd(is[0], iu, rn);
+        in = _mm256_fmadd_pd(is[0], ru, in);
+
+        j += 2;
+
+        for (unsigned l = 1; l < hsize; ++l) {
+          ru = _mm256_set1_pd(v[j]);
+          iu = _mm256_set1_pd(v[j + 1]);
+          rn = _mm256_fmadd_pd(rs[l], ru, rn);
+          in = _mm256_fmadd_pd(rs[l], iu, in);
+          rn = _mm256_fnmadd_pd(is[l], iu, rn);
+          in = _mm256_fmadd_pd(is[l], ru, in);
+
+          j += 2;
+        }
+
+        __m256d v_re = _mm256_fmadd_pd(is[k], in, _mm256_mul_pd(rs[k], rn));
+        __m256d v_im = _mm256_fnmadd_pd(is[k], rn, _mm256_mul_pd(rs[k], in));
+
+        re += detail::HorizontalSumAVX(v_re);
+        im += detail::HorizontalSumAVX(v_im);
+      }
+
+      return std::complex<double>{re, im};
+    };
+
+    uint64_t ms[H + 1];
+    uint64_t xss[1 << H];
+
+    FillIndices<H>(state.num_qubits(), qs, ms, xss);
+
+    unsigned k = 2 + H;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    using Op = std::plus<std::complex<double>>;
+    return for_.RunReduce(size, f, Op(), matrix, ms, xss, state.get());
+  }
+
+  template <unsigned H, unsigned L>
+  std::complex<double> ExpectationValueL(const std::vector<unsigned>& qs,
+                                         const fp_type* matrix,
+                                         const State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const __m256d* w,
+                const uint64_t* ms, const uint64_t* xss, unsigned q0,
+                const fp_type* rstate) {
+      constexpr unsigned gsize = 1 << (H + L);
+      constexpr unsigned hsize = 1 << H;
+      constexpr unsigned lsize = 1 << L;
+
+      __m256d rn, in;
+      __m256d rs[gsize], is[gsize];
+
+      i *= 4;
+
+      uint64_t ii = i & ms[0];
+      for (unsigned j = 1; j <= H; ++j) {
+        i *= 2;
+        ii |= i & ms[j];
+      }
+
+      auto p0 = rstate + 2 * ii;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        unsigned k2 = lsize * k;
+
+        rs[k2] = _mm256_load_pd(p0 + xss[k]);
+        is[k2] = _mm256_load_pd(p0 + xss[k] + 4);
+
+        if (L == 1) {
+          rs[k2 + 1] = q0 == 0 ? _mm256_permute4x64_pd(rs[k2], 177)
+                               : _mm256_permute4x64_pd(rs[k2], 78);
+          is[k2 + 1] = q0 == 0 ? _mm256_permute4x64_pd(is[k2], 177)
+                               : _mm256_permute4x64_pd(is[k2], 78);
+        } else if (L == 2) {
+          rs[k2 + 1] = _mm256_permute4x64_pd(rs[k2], 57);
+          is[k2 + 1] = _mm256_permute4x64_pd(is[k2], 57);
+          rs[k2 + 2] = _mm256_permute4x64_pd(rs[k2], 78);
+          is[k2 + 2] = _mm256_permute4x64_pd(is[k2], 78);
+          rs[k2 + 3] = _mm256_permute4x64_pd(rs[k2], 147);
+          is[k2 + 3] = _mm256_permute4x64_pd(is[k2], 147);
+        }
+      }
+
+      double re = 0;
+      double im = 0;
+      uint64_t j = 0;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rn = _mm256_mul_pd(rs[0], w[j]);
+        in = _mm256_mul_pd(rs[0], w[j + 1]);
+        rn = _mm256_fnmadd_pd(is[0], w[j + 1], rn);
+        in = _mm256_fmadd_pd(is[0], w[j], in);
+
+        j += 2;
+
+        for (unsigned l = 1; l < gsize; ++l) {
+          rn = _mm256_fmadd_pd(rs[l], w[j], rn);
+          in = _mm256_fmadd_pd(rs[l], w[j + 1], in);
+          rn = _mm256_fnmadd_pd(is[l], w[j + 1], rn);
+          in = _mm256_fmadd_pd(is[l], w[j], in);
+
+          j += 2;
+        }
+
+        unsigned m = lsize * k;
+
+        __m256d v_re = _mm256_fmadd_pd(is[m], in, _mm256_mul_pd(rs[m], rn));
+        __m256d v_im = _mm256_fnmadd_pd(is[m], rn, _mm256_mul_pd(rs[m], in));
+
+        re += detail::HorizontalSumAVX(v_re);
+        im += detail::HorizontalSumAVX(v_im);
+      }
+
+      return std::complex<double>{re, im};
+    };
+
+    uint64_t ms[H + 1];
+    uint64_t xss[1 << H];
+    MatrixBuffer<sizeof(fp_type) << (1 + 2 * H + L + 2)> wbuf;
+    __m256d* w = (__m256d*) wbuf.get();
+
+    if (w == nullptr) {
+      // Not enough memory for the expanded matrix.
+      return ExpectationValueUnexpanded<2>(for_, state.num_qubits(), qs,
+                                            matrix, state.get());
+    }
+
+    auto m = GetMasks11<L>(qs);
+
+    FillIndices<H, L>(state.num_qubits(), qs, ms, xss);
+    FillMatrix<H, L, 2>(m.qmaskl, matrix, (fp_type*) w);
+
+    unsigned k = 2 + H;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    using Op = std::plus<std::complex<double>>;
+    return for_.RunReduce(size, f, Op(), w, ms, xss, qs[0], state.get());
+  }
+
+  template <unsigned H>
+  void ApplyPermutationGateH(const PermutationMatrix<fp_type>& pm,
+                             State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const uint64_t* ms,
+                const uint64_t* xss, const unsigned* offsets,
+                const unsigned* sources, const unsigned* lanes,
+                const fp_type* w, fp_type* rstate) {
+      constexpr unsigned hsize = 1 << H;
+
+      __m256d rn, in, rp, ip, ru, iu;
+      __m256d rs[hsize], is[hsize];
+
+      i *= 4;
+
+      uint64_t ii = i & ms[0];
+      for (unsigned j = 1; j <= H; ++j) {
+        i *= 2;
+        ii |= i & ms[j];
+      }
+
+      auto p0 = rstate + 2 * ii;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rs[k] = _mm256_load_pd(p0 + xss[k]);
+        is[k] = _mm256_load_pd(p0 + xss[k] + 4);
+      }
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rn = _mm256_setzero_pd();
+        in = _mm256_setzero_pd();
+
+        for (unsigned e = offsets[k]; e < offsets[k + 1]; ++e) {
+          __m256i idx = _mm256_loadu_si256((const __m256i*) (lanes + 8 * e));
+
+          rp = _mm256_castps_pd(_mm256_permutevar8x32_ps(
+              _mm256_castpd_ps(rs[sources[e]]), idx));
+          ip = _mm256_castps_pd(_mm256_permutevar8x32_ps(
+              _mm256_castpd_ps(is[sources[e]]), idx));
+          ru = _mm256_loadu_pd(w + 8 * e);
+          iu = _mm256_loadu_pd(w + 8 * e + 4);
+
+          rn = _mm256_fmadd_pd(rp, ru, rn);
+          in = _mm256_fmadd_pd(rp, iu, in);
+          rn = _mm256_fnmadd_pd(ip, iu, rn);
+          in = _mm256_fmadd_pd(ip, ru, in);
+        }
+
+        _mm256_store_pd(p0 + xss[k], rn);
+        _mm256_store_pd(p0 + xss[k] + 4, in);
+      }
+    };
+
+    unsigned k = 2 + H;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, pm.ms.data(), pm.xss.data(), pm.offsets.data(),
+             pm.sources.data(), pm.lanes.data(), pm.phases.data(),
+             state.get());
+  }
+
+  template <unsigned N>
+  void ExpectationValuesPauliN(unsigned nb,
+                               const PauliExpectationMatrix<fp_type>& pe,
+                               std::size_t i0, const State& state,
+                               double* results) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, unsigned c,
+                uint64_t xmaskh, uint64_t mlow, const unsigned* lanes,
+                const uint64_t* zmaskh, const fp_type* w,
+                const fp_type* rstate) -> PauliExpectationSums<N> {
+      __m256d acc[N];
+
+      for (unsigned k = 0; k < N; ++k) {
+        acc[k] = _mm256_setzero_pd();
+      }
+
+      __m256i idx = _mm256_loadu_si256((const __m256i*) lanes);
+
+      for (uint64_t j = i << c; j < (i + 1) << c; ++j) {
+        uint64_t t = GetPauliRotationIndex(j, mlow);
+        uint64_t s = t ^ xmaskh;
+
+        auto pt = rstate + 8 * t;
+        auto ps = rstate + 8 * s;
+
+        __m256d rt = _mm256_load_pd(pt);
+        __m256d it = _mm256_load_pd(pt + 4);
+        __m256d rs = _mm256_load_pd(ps);
+        __m256d is = _mm256_load_pd(ps + 4);
+        __m256d rp = _mm256_castps_pd(
+          _mm256_permutevar8x32_ps(_mm256_castpd_ps(rs), idx));
+        __m256d ip = _mm256_castps_pd(
+          _mm256_permutevar8x32_ps(_mm256_castpd_ps(is), idx));
+
+        // Real and imaginary parts of conj(a_t) a_s.
+        __m256d rq = _mm256_fmadd_pd(rt, rp, _mm256_mul_pd(it, ip));
+        __m256d iq = _mm256_fnmadd_pd(it, rp, _mm256_mul_pd(rt, ip));
+
+        for (unsigned k = 0; k < N; ++k) {
+          __m256d wr = _mm256_loadu_pd(w + 8 * k);
+          __m256d wi = _mm256_loadu_pd(w + 8 * k + 4);
+          __m256d v = _mm256_fmadd_pd(iq, wi, _mm256_mul_pd(rq, wr));
+          fp_type sign = 1 - 2 * fp_type(bits::Parity(t & zmaskh[k]));
+
+          acc[k] = _mm256_fmadd_pd(v, _mm256_set1_pd(sign), acc[k]);
+        }
+      }
+
+      PauliExpectationSums<N> sums;
+
+      for (unsigned k = 0; k < N; ++k) {
+        sums.s[k] = detail::HorizontalSumAVX(acc[k]);
+      }
+
+      return sums;
+    };
+
+    // Each iteration processes 2^c of the 2^nb pairs of blocks.
+    unsigned c = nb > 4 ? 4 : nb;
+    uint64_t size = uint64_t{1} << (nb - c);
+
+    using Op = PauliExpectationSumsPlus<N>;
+    auto sums = for_.RunReduce(size, f, Op(), c, pe.xmaskh, pe.mlow,
+                               pe.lanes.data(), pe.zmaskh.data() + i0,
+                               pe.w.data() + 8 * i0, state.get());
+
+    for (unsigned k = 0; k < N; ++k) {
+      results[i0 + k] = sums.s[k];
+    }
+  }
+
   For for_;
 };
 
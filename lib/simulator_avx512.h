@@ -27,18 +27,47 @@
 
 namespace qsim {
 
+template <typename For, typename FP = float>
+class SimulatorAVX512;
+
 /**
- * Quantum circuit simulator with AVX512 vectorization.
+ * Load/store policy for single-precision state vectors. StorageScale returns
+ * the factor the stored amplitudes are multiplied by.
  */
 template <typename For>
-class SimulatorAVX512 final : public SimulatorBase {
+struct FloatLoadStoreAVX512 {
+  using StateSpace = StateSpaceAVX512<For, float>;
+  using storage_type = float;
+
+  static __m512 Load(const float* p) {
+    return _mm512_load_ps(p);
+  }
+
+  static void Store(float* p, __m512 v) {
+    _mm512_store_ps(p, v);
+  }
+
+  static float StorageScale(unsigned num_qubits) {
+    return 1;
+  }
+};
+
+/**
+ * Quantum circuit simulator with AVX512 vectorization and single-precision
+ * kernels. The load/store policy LoadStore defines the state space and how
+ * amplitudes are loaded into __m512 registers and stored back; see
+ * FloatLoadStoreAVX512 and HalfLoadStoreAVX512 (simulator_half_avx512.h).
+ */
+template <typename For, typename LoadStore>
+class SimulatorAVX512Float : public SimulatorBase {
  public:
-  using StateSpace = StateSpaceAVX512<For>;
+  using StateSpace = typename LoadStore::StateSpace;
   using State = typename StateSpace::State;
   using fp_type = typename StateSpace::fp_type;
+  using storage_type = typename LoadStore::storage_type;
 
   template <typename... ForArgs>
-  explicit SimulatorAVX512(ForArgs&&... args) : for_(args...) {}
+  explicit SimulatorAVX512Float(ForArgs&&... args) : for_(args...) {}
 
   /**
    * Applies a gate using AVX512 instructions.
@@ -117,6 +146,32 @@ class SimulatorAVX512 final : public SimulatorBase {
         ApplyGateL<2, 4>(qs, matrix, state);
       }
       break;
+    case 7:
+      if (qs[0] > 3) {
+        ApplyGateH<7>(qs, matrix, state);
+      } else if (qs[1] > 3) {
+        ApplyGateL<6, 1>(qs, matrix, state);
+      } else if (qs[2] > 3) {
+        ApplyGateL<5, 2>(qs, matrix, state);
+      } else if (qs[3] > 3) {
+        ApplyGateL<4, 3>(qs, matrix, state);
+      } else {
+        ApplyGateL<3, 4>(qs, matrix, state);
+      }
+      break;
+    case 8:
+      if (qs[0] > 3) {
+        ApplyGateH<8>(qs, matrix, state);
+      } else if (qs[1] > 3) {
+        ApplyGateL<7, 1>(qs, matrix, state);
+      } else if (qs[2] > 3) {
+        ApplyGateL<6, 2>(qs, matrix, state);
+      } else if (qs[3] > 3) {
+        ApplyGateL<5, 3>(qs, matrix, state);
+      } else {
+        ApplyGateL<4, 4>(qs, matrix, state);
+      }
+      break;
     default:
       // Not implemented.
       break;
@@ -245,6 +300,168 @@ class SimulatorAVX512 final : public SimulatorBase {
     }
   }
 
+  /**
+   * Applies a diagonal gate using AVX512 instructions.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param diag Diagonal entries of the gate matrix; the real part of each
+   *   entry is followed by its imaginary part.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyDiagonalGate(const std::vector<unsigned>& qs,
+                         const fp_type* diag, State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* w,
+                uint64_t qmaskh, storage_type* rstate) {
+      auto v = w + 32 * GetDiagonalIndex(i, qmaskh);
+      auto p = rstate + 32 * i;
+
+      __m512 ru = _mm512_loadu_ps(v);
+      __m512 iu = _mm512_loadu_ps(v + 16);
+      __m512 rs = LoadStore::Load(p);
+      __m512 is = LoadStore::Load(p + 16);
+
+      __m512 rn = _mm512_fnmadd_ps(is, iu, _mm512_mul_ps(rs, ru));
+      __m512 in = _mm512_fmadd_ps(is, ru, _mm512_mul_ps(rs, iu));
+
+      LoadStore::Store(p, rn);
+      LoadStore::Store(p + 16, in);
+    };
+
+    std::vector<fp_type> w;
+    uint64_t qmaskh = FillDiagonalMatrix<4>(qs, diag, w);
+
+    unsigned k = 4;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, w.data(), qmaskh, state.get());
+  }
+
+  /**
+   * Applies a permutation gate using AVX512 instructions. Permutation gates
+   * (X, Y, CNOT, SWAP, ISWAP, CCX, CSWAP, ...) have exactly one nonzero
+   * element in each row and each column of the gate matrix.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param perm Permutation; the nonzero element of the k-th row of the gate
+   *   matrix is in column perm[k].
+   * @param phases Nonzero elements of the gate matrix; the real part of each
+   *   element is followed by its imaginary part.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyPermutationGate(const std::vector<unsigned>& qs,
+                            const unsigned* perm, const fp_type* phases,
+                            State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    PermutationMatrix<fp_type> pm;
+    unsigned h = FillPermutationMatrix<4>(
+        state.num_qubits(), qs, perm, phases, pm);
+
+    switch (h) {
+    case 0:
+      ApplyPermutationGateH<0>(pm, state);
+      break;
+    case 1:
+      ApplyPermutationGateH<1>(pm, state);
+      break;
+    case 2:
+      ApplyPermutationGateH<2>(pm, state);
+      break;
+    case 3:
+      ApplyPermutationGateH<3>(pm, state);
+      break;
+    case 4:
+      ApplyPermutationGateH<4>(pm, state);
+      break;
+    case 5:
+      ApplyPermutationGateH<5>(pm, state);
+      break;
+    case 6:
+      ApplyPermutationGateH<6>(pm, state);
+      break;
+    default:
+      // Not implemented.
+      break;
+    }
+  }
+
+  /**
+   * Applies the rotation exp(-i theta P) about a Pauli string P using
+   * AVX512 instructions; see gate::PauliRotation in gate.h. The amplitudes
+   * are paired by the X and Y operators and updated in one pass over
+   * the state vector.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param paulis Pauli operators acting on the qubits: 1 for X, 2 for Y and
+   *   3 for Z.
+   * @param theta The rotation angle.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyPauliRotation(const std::vector<unsigned>& qs,
+                          const unsigned* paulis, fp_type theta,
+                          State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, uint64_t xmaskh,
+                uint64_t zmaskh, uint64_t mlow, fp_type c,
+                const unsigned* lanes, const fp_type* w, storage_type* rstate) {
+      uint64_t t = GetPauliRotationIndex(i, mlow);
+      uint64_t s = t ^ xmaskh;
+
+      auto pt = rstate + 32 * t;
+      auto ps = rstate + 32 * s;
+
+      __m512i idx = _mm512_loadu_si512((const __m512i*) lanes);
+      __m512 cc = _mm512_set1_ps(c);
+
+      __m512 rt = LoadStore::Load(pt);
+      __m512 it = LoadStore::Load(pt + 16);
+      __m512 rs = LoadStore::Load(ps);
+      __m512 is = LoadStore::Load(ps + 16);
+
+      auto wt = w + 32 * bits::Parity(s & zmaskh);
+
+      __m512 ru = _mm512_loadu_ps(wt);
+      __m512 iu = _mm512_loadu_ps(wt + 16);
+      __m512 rp = _mm512_permutexvar_ps(idx, rs);
+      __m512 ip = _mm512_permutexvar_ps(idx, is);
+
+      __m512 rn = _mm512_fmadd_ps(rp, ru, _mm512_mul_ps(rt, cc));
+      __m512 in = _mm512_fmadd_ps(rp, iu, _mm512_mul_ps(it, cc));
+      rn = _mm512_fnmadd_ps(ip, iu, rn);
+      in = _mm512_fmadd_ps(ip, ru, in);
+
+      if (s != t) {
+        auto ws = w + 32 * bits::Parity(t & zmaskh);
+
+        ru = _mm512_loadu_ps(ws);
+        iu = _mm512_loadu_ps(ws + 16);
+        rp = _mm512_permutexvar_ps(idx, rt);
+        ip = _mm512_permutexvar_ps(idx, it);
+
+        __m512 rm = _mm512_fmadd_ps(rp, ru, _mm512_mul_ps(rs, cc));
+        __m512 im = _mm512_fmadd_ps(rp, iu, _mm512_mul_ps(is, cc));
+        rm = _mm512_fnmadd_ps(ip, iu, rm);
+        im = _mm512_fmadd_ps(ip, ru, im);
+
+        LoadStore::Store(ps, rm);
+        LoadStore::Store(ps + 16, im);
+      }
+
+      LoadStore::Store(pt, rn);
+      LoadStore::Store(pt + 16, in);
+    };
+
+    PauliRotationMatrix<fp_type> pr;
+    FillPauliRotationMatrix<4>(qs, paulis, theta, pr);
+
+    unsigned k = 4;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    if (pr.xmaskh != 0) --n;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, pr.xmaskh, pr.zmaskh, pr.mlow, pr.c, pr.lanes.data(),
+             pr.w.data(), state.get());
+  }
+
   /**
    * Computes the expectation value of an operator using AVX512 instructions.
    * @param qs Indices of the qubits the operator acts on.
@@ -257,6 +474,17 @@ class SimulatorAVX512 final : public SimulatorBase {
                                         const State& state) const {
     // Assume qs[0] < qs[1] < qs[2] < ... .
 
+    // Compensate for the storage scale of the amplitudes.
+    fp_type s = LoadStore::StorageScale(state.num_qubits());
+    std::vector<fp_type> smatrix;
+    if (s != 1) {
+      smatrix.assign(matrix, matrix + (2 << (2 * qs.size())));
+      for (auto& v : smatrix) {
+        v /= s * s;
+      }
+      matrix = smatrix.data();
+    }
+
     switch (qs.size()) {
     case 1:
       if (qs[0] > 3) {
@@ -324,6 +552,32 @@ class SimulatorAVX512 final : public SimulatorBase {
         return ExpectationValueL<2, 4>(qs, matrix, state);
       }
       break;
+    case 7:
+      if (qs[0] > 3) {
+        return ExpectationValueH<7>(qs, matrix, state);
+      } else if (qs[1] > 3) {
+        return ExpectationValueL<6, 1>(qs, matrix, state);
+      } else if (qs[2] > 3) {
+        return ExpectationValueL<5, 2>(qs, matrix, state);
+      } else if (qs[3] > 3) {
+        return ExpectationValueL<4, 3>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<3, 4>(qs, matrix, state);
+      }
+      break;
+    case 8:
+      if (qs[0] > 3) {
+        return ExpectationValueH<8>(qs, matrix, state);
+      } else if (qs[1] > 3) {
+        return ExpectationValueL<7, 1>(qs, matrix, state);
+      } else if (qs[2] > 3) {
+        return ExpectationValueL<6, 2>(qs, matrix, state);
+      } else if (qs[3] > 3) {
+        return ExpectationValueL<5, 3>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<4, 4>(qs, matrix, state);
+      }
+      break;
     default:
       // Not implemented.
       break;
@@ -332,6 +586,77 @@ class SimulatorAVX512 final : public SimulatorBase {
     return 0;
   }
 
+  /**
+   * Computes the expectation value of a Pauli string P using AVX512
+   * instructions.
+   * The amplitudes are paired by the X and Y operators and the expectation
+   * value is computed in one read-only pass over the state vector; there is
+   * no limit on the number of qubits.
+   * @param qs Indices of the qubits the Pauli string acts on; should be
+   *   distinct.
+   * @param paulis Pauli operators acting on the qubits: 1 for X, 2 for Y and
+   *   3 for Z.
+   * @param state The state of the system.
+   * @return The computed expectation value <state|P|state>.
+   */
+  double ExpectationValuePauli(const std::vector<unsigned>& qs,
+                               const unsigned* paulis,
+                               const State& state) const {
+    uint64_t xmask, zmask;
+    GetPauliMasks(qs, paulis, xmask, zmask);
+
+    return ExpectationValuesPauli(xmask, {zmask}, state)[0];
+  }
+
+  /**
+   * Computes the expectation values of Pauli strings with the same X and Y
+   * operators using AVX512 instructions. The amplitude pair products are shared
+   * by all the strings; up to 16 strings are evaluated in one read-only pass
+   * over the state vector.
+   * @param xmask Mask of the qubits acted on by X or Y operators; the same
+   *   for all the Pauli strings.
+   * @param zmasks Masks of the qubits acted on by Y or Z operators, one mask
+   *   per Pauli string.
+   * @param state The state of the system.
+   * @return The computed expectation values, one value per Pauli string.
+   */
+  std::vector<double> ExpectationValuesPauli(
+      uint64_t xmask, const std::vector<uint64_t>& zmasks,
+      const State& state) const {
+    PauliExpectationMatrix<fp_type> pe;
+    FillPauliExpectationMatrix<4>(xmask, zmasks, pe);
+
+    // Compensate for the storage scale of the amplitudes.
+    fp_type s = LoadStore::StorageScale(state.num_qubits());
+    if (s != 1) {
+      for (auto& v : pe.w) {
+        v /= s * s;
+      }
+    }
+
+    unsigned k = 4;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    if (pe.xmaskh != 0) --n;
+
+    std::vector<double> results(zmasks.size(), 0);
+
+    std::size_t i = 0;
+
+    for (; i + 16 <= zmasks.size(); i += 16) {
+      ExpectationValuesPauliN<16>(n, pe, i, state, results.data());
+    }
+
+    for (; i + 4 <= zmasks.size(); i += 4) {
+      ExpectationValuesPauliN<4>(n, pe, i, state, results.data());
+    }
+
+    for (; i < zmasks.size(); ++i) {
+      ExpectationValuesPauliN<1>(n, pe, i, state, results.data());
+    }
+
+    return results;
+  }
+
   /**
    * @return The size of SIMD register if applicable.
    */
@@ -339,12 +664,19 @@ class SimulatorAVX512 final : public SimulatorBase {
     return 16;
   }
 
+  /**
+   * @return The object that runs the parallel loops of this simulator.
+   */
+  const For& GetFor() const {
+    return for_;
+  }
+
  private:
   template <unsigned H>
   void ApplyGateH(const std::vector<unsigned>& qs,
                   const fp_type* matrix, State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* v,
-                uint64_t imaskh, uint64_t qmaskh, fp_type* rstate) {
+                uint64_t imaskh, uint64_t qmaskh, storage_type* rstate) {
       constexpr unsigned hsize = 1 << H;
 
       __m512 ru, iu, rn, in;
@@ -355,8 +687,8 @@ class SimulatorAVX512 final : public SimulatorBase {
       for (unsigned k = 0; k < hsize; ++k) {
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        rs[k] = _mm512_load_ps(p0 + p);
-        is[k] = _mm512_load_ps(p0 + p + 16);
+        rs[k] = LoadStore::Load(p0 + p);
+        is[k] = LoadStore::Load(p0 + p + 16);
       }
 
       uint64_t j = 0;
@@ -384,8 +716,8 @@ class SimulatorAVX512 final : public SimulatorBase {
 
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        _mm512_store_ps(p0 + p, rn);
-        _mm512_store_ps(p0 + p + 16, in);
+        LoadStore::Store(p0 + p, rn);
+        LoadStore::Store(p0 + p + 16, in);
       }
     };
 
@@ -403,7 +735,7 @@ class SimulatorAVX512 final : public SimulatorBase {
                   const fp_type* matrix, State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const __m512* w,
                 uint64_t imaskh, uint64_t qmaskh, const __m512i* idx,
-                fp_type* rstate) {
+                storage_type* rstate) {
       constexpr unsigned gsize = 1 << (H + L);
       constexpr unsigned hsize = 1 << H;
       constexpr unsigned lsize = 1 << L;
@@ -417,8 +749,8 @@ class SimulatorAVX512 final : public SimulatorBase {
         unsigned k2 = lsize * k;
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        rs[k2] = _mm512_load_ps(p0 + p);
-        is[k2] = _mm512_load_ps(p0 + p + 16);
+        rs[k2] = LoadStore::Load(p0 + p);
+        is[k2] = LoadStore::Load(p0 + p + 16);
 
         for (unsigned l = 1; l < lsize; ++l) {
           rs[k2 + l] = _mm512_permutexvar_ps(idx[l - 1], rs[k2]);
@@ -447,13 +779,21 @@ class SimulatorAVX512 final : public SimulatorBase {
 
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        _mm512_store_ps(p0 + p, rn);
-        _mm512_store_ps(p0 + p + 16, in);
+        LoadStore::Store(p0 + p, rn);
+        LoadStore::Store(p0 + p + 16, in);
       }
     };
 
     __m512i idx[1 << L];
-    __m512 w[1 << (1 + 2 * H + L)];
+    MatrixBuffer<sizeof(fp_type) << (1 + 2 * H + L + 4)> wbuf;
+    __m512* w = (__m512*) wbuf.get();
+
+    if (w == nullptr) {
+      // Not enough memory for the expanded matrix.
+      ApplyGateUnexpanded<4>(for_, state.num_qubits(), qs, matrix,
+                             state.get());
+      return;
+    }
 
     auto m = GetMasks2<H, L, 4>(qs);
     FillPermutationIndices<L>(m.qmaskl, idx);
@@ -472,7 +812,7 @@ class SimulatorAVX512 final : public SimulatorBase {
                              const fp_type* matrix, State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* v,
                 uint64_t imaskh, uint64_t qmaskh, uint64_t cvalsh,
-                fp_type* rstate) {
+                storage_type* rstate) {
       constexpr unsigned hsize = 1 << H;
 
       __m512 ru, iu, rn, in;
@@ -483,8 +823,8 @@ class SimulatorAVX512 final : public SimulatorBase {
       for (unsigned k = 0; k < hsize; ++k) {
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        rs[k] = _mm512_load_ps(p0 + p);
-        is[k] = _mm512_load_ps(p0 + p + 16);
+        rs[k] = LoadStore::Load(p0 + p);
+        is[k] = LoadStore::Load(p0 + p + 16);
       }
 
       uint64_t j = 0;
@@ -512,8 +852,8 @@ class SimulatorAVX512 final : public SimulatorBase {
 
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        _mm512_store_ps(p0 + p, rn);
-        _mm512_store_ps(p0 + p + 16, in);
+        LoadStore::Store(p0 + p, rn);
+        LoadStore::Store(p0 + p + 16, in);
       }
     };
 
@@ -532,7 +872,7 @@ class SimulatorAVX512 final : public SimulatorBase {
                              const fp_type* matrix, State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const __m512* w,
                 uint64_t imaskh, uint64_t qmaskh, uint64_t cvalsh,
-                fp_type* rstate) {
+                storage_type* rstate) {
       constexpr unsigned hsize = 1 << H;
 
       __m512 rn, in;
@@ -543,8 +883,8 @@ class SimulatorAVX512 final : public SimulatorBase {
       for (unsigned k = 0; k < hsize; ++k) {
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        rs[k] = _mm512_load_ps(p0 + p);
-        is[k] = _mm512_load_ps(p0 + p + 16);
+        rs[k] = LoadStore::Load(p0 + p);
+        is[k] = LoadStore::Load(p0 + p + 16);
       }
 
       uint64_t j = 0;
@@ -568,8 +908,8 @@ class SimulatorAVX512 final : public SimulatorBase {
 
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        _mm512_store_ps(p0 + p, rn);
-        _mm512_store_ps(p0 + p + 16, in);
+        LoadStore::Store(p0 + p, rn);
+        LoadStore::Store(p0 + p + 16, in);
       }
     };
 
@@ -591,7 +931,7 @@ class SimulatorAVX512 final : public SimulatorBase {
                             const fp_type* matrix, State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const __m512* w,
                 uint64_t imaskh, uint64_t qmaskh, uint64_t cvalsh,
-                const __m512i* idx, fp_type* rstate) {
+                const __m512i* idx, storage_type* rstate) {
       constexpr unsigned gsize = 1 << (H + L);
       constexpr unsigned hsize = 1 << H;
       constexpr unsigned lsize = 1 << L;
@@ -605,8 +945,8 @@ class SimulatorAVX512 final : public SimulatorBase {
         unsigned k2 = lsize * k;
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        rs[k2] = _mm512_load_ps(p0 + p);
-        is[k2] = _mm512_load_ps(p0 + p + 16);
+        rs[k2] = LoadStore::Load(p0 + p);
+        is[k2] = LoadStore::Load(p0 + p + 16);
 
         for (unsigned l = 1; l < lsize; ++l) {
           rs[k2 + l] = _mm512_permutexvar_ps(idx[l - 1], rs[k2]);
@@ -635,8 +975,8 @@ class SimulatorAVX512 final : public SimulatorBase {
 
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        _mm512_store_ps(p0 + p, rn);
-        _mm512_store_ps(p0 + p + 16, in);
+        LoadStore::Store(p0 + p, rn);
+        LoadStore::Store(p0 + p + 16, in);
       }
     };
 
@@ -672,7 +1012,7 @@ class SimulatorAVX512 final : public SimulatorBase {
                                          const fp_type* matrix,
                                          const State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* v,
-                uint64_t imaskh, uint64_t qmaskh, const fp_type* rstate) {
+                uint64_t imaskh, uint64_t qmaskh, const storage_type* rstate) {
       constexpr unsigned hsize = 1 << H;
 
       __m512 ru, iu, rn, in;
@@ -683,8 +1023,8 @@ class SimulatorAVX512 final : public SimulatorBase {
       for (unsigned k = 0; k < hsize; ++k) {
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        rs[k] = _mm512_load_ps(p0 + p);
-        is[k] = _mm512_load_ps(p0 + p + 16);
+        rs[k] = LoadStore::Load(p0 + p);
+        is[k] = LoadStore::Load(p0 + p + 16);
       }
 
       double re = 0;
@@ -739,7 +1079,7 @@ class SimulatorAVX512 final : public SimulatorBase {
                                          const State& state) const {
     auto f = [](unsigned n, unsigned m, uint64_t i, const __m512* w,
                 uint64_t imaskh, uint64_t qmaskh, const __m512i* idx,
-                const fp_type* rstate) {
+                const storage_type* rstate) {
       constexpr unsigned gsize = 1 << (H + L);
       constexpr unsigned hsize = 1 << H;
       constexpr unsigned lsize = 1 << L;
@@ -753,8 +1093,8 @@ class SimulatorAVX512 final : public SimulatorBase {
         unsigned k2 = lsize * k;
         uint64_t p = _pdep_u64(k, qmaskh);
 
-        rs[k2] = _mm512_load_ps(p0 + p);
-        is[k2] = _mm512_load_ps(p0 + p + 16);
+        rs[k2] = LoadStore::Load(p0 + p);
+        is[k2] = LoadStore::Load(p0 + p + 16);
 
         for (unsigned l = 1; l < lsize; ++l) {
           rs[k2 + l] = _mm512_permutexvar_ps(idx[l - 1], rs[k2]);
@@ -796,7 +1136,14 @@ class SimulatorAVX512 final : public SimulatorBase {
     };
 
     __m512i idx[1 << L];
-    __m512 w[1 << (1 + 2 * H + L)];
+    MatrixBuffer<sizeof(fp_type) << (1 + 2 * H + L + 4)> wbuf;
+    __m512* w = (__m512*) wbuf.get();
+
+    if (w == nullptr) {
+      // Not enough memory for the expanded matrix.
+      return ExpectationValueUnexpanded<4>(for_, state.num_qubits(), qs,
+                                            matrix, state.get());
+    }
 
     auto m = GetMasks2<H, L, 4>(qs);
     FillPermutationIndices<L>(m.qmaskl, idx);
@@ -828,9 +1175,1392 @@ class SimulatorAVX512 final : public SimulatorBase {
     }
   }
 
+  template <unsigned H>
+  void ApplyPermutationGateH(const PermutationMatrix<fp_type>& pm,
+                             State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const uint64_t* ms,
+                const uint64_t* xss, const unsigned* offsets,
+                const unsigned* sources, const unsigned* lanes,
+                const fp_type* w, storage_type* rstate) {
+      constexpr unsigned hsize = 1 << H;
+
+      __m512 rn, in, rp, ip, ru, iu;
+      __m512 rs[hsize], is[hsize];
+
+      i *= 16;
+
+      uint64_t ii = i & ms[0];
+      for (unsigned j = 1; j <= H; ++j) {
+        i *= 2;
+        ii |= i & ms[j];
+      }
+
+      auto p0 = rstate + 2 * ii;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rs[k] = LoadStore::Load(p0 + xss[k]);
+        is[k] = LoadStore::Load(p0 + xss[k] + 16);
+      }
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rn = _mm512_setzero_ps();
+        in = _mm512_setzero_ps();
+
+        for (unsigned e = offsets[k]; e < offsets[k + 1]; ++e) {
+          __m512i idx = _mm512_loadu_si512((const __m512i*) (lanes + 16 * e));
+
+          rp = _mm512_permutexvar_ps(idx, rs[sources[e]]);
+          ip = _mm512_permutexvar_ps(idx, is[sources[e]]);
+          ru = _mm512_loadu_ps(w + 32 * e);
+          iu = _mm512_loadu_ps(w + 32 * e + 16);
+
+          rn = _mm512_fmadd_ps(rp, ru, rn);
+          in = _mm512_fmadd_ps(rp, iu, in);
+          rn = _mm512_fnmadd_ps(ip, iu, rn);
+          in = _mm512_fmadd_ps(ip, ru, in);
+        }
+
+        LoadStore::Store(p0 + xss[k], rn);
+        LoadStore::Store(p0 + xss[k] + 16, in);
+      }
+    };
+
+    unsigned k = 4 + H;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, pm.ms.data(), pm.xss.data(), pm.offsets.data(),
+             pm.sources.data(), pm.lanes.data(), pm.phases.data(),
+             state.get());
+  }
+
+  template <unsigned N>
+  void ExpectationValuesPauliN(unsigned nb,
+                               const PauliExpectationMatrix<fp_type>& pe,
+                               std::size_t i0, const State& state,
+                               double* results) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, unsigned c,
+                uint64_t xmaskh, uint64_t mlow, const unsigned* lanes,
+                const uint64_t* zmaskh, const fp_type* w,
+                const storage_type* rstate) -> PauliExpectationSums<N> {
+      __m512 acc[N];
+
+      for (unsigned k = 0; k < N; ++k) {
+        acc[k] = _mm512_setzero_ps();
+      }
+
+      __m512i idx = _mm512_loadu_si512((const __m512i*) lanes);
+
+      for (uint64_t j = i << c; j < (i + 1) << c; ++j) {
+        uint64_t t = GetPauliRotationIndex(j, mlow);
+        uint64_t s = t ^ xmaskh;
+
+        auto pt = rstate + 32 * t;
+        auto ps = rstate + 32 * s;
+
+        __m512 rt = LoadStore::Load(pt);
+        __m512 it = LoadStore::Load(pt + 16);
+        __m512 rs = LoadStore::Load(ps);
+        __m512 is = LoadStore::Load(ps + 16);
+        __m512 rp = _mm512_permutexvar_ps(idx, rs);
+        __m512 ip = _mm512_permutexvar_ps(idx, is);
+
+        // Real and imaginary parts of conj(a_t) a_s.
+        __m512 rq = _mm512_fmadd_ps(rt, rp, _mm512_mul_ps(it, ip));
+        __m512 iq = _mm512_fnmadd_ps(it, rp, _mm512_mul_ps(rt, ip));
+
+        for (unsigned k = 0; k < N; ++k) {
+          __m512 wr = _mm512_loadu_ps(w + 32 * k);
+          __m512 wi = _mm512_loadu_ps(w + 32 * k + 16);
+          __m512 v = _mm512_fmadd_ps(iq, wi, _mm512_mul_ps(rq, wr));
+          fp_type sign = 1 - 2 * fp_type(bits::Parity(t & zmaskh[k]));
+
+          acc[k] = _mm512_fmadd_ps(v, _mm512_set1_ps(sign), acc[k]);
+        }
+      }
+
+      PauliExpectationSums<N> sums;
+
+      for (unsigned k = 0; k < N; ++k) {
+        sums.s[k] = detail::HorizontalSumAVX512(acc[k]);
+      }
+
+      return sums;
+    };
+
+    // Each iteration processes 2^c of the 2^nb pairs of blocks.
+    unsigned c = nb > 4 ? 4 : nb;
+    uint64_t size = uint64_t{1} << (nb - c);
+
+    using Op = PauliExpectationSumsPlus<N>;
+    auto sums = for_.RunReduce(size, f, Op(), c, pe.xmaskh, pe.mlow,
+                               pe.lanes.data(), pe.zmaskh.data() + i0,
+                               pe.w.data() + 32 * i0, state.get());
+
+    for (unsigned k = 0; k < N; ++k) {
+      results[i0 + k] = sums.s[k];
+    }
+  }
+
+ protected:
   For for_;
 };
 
+/**
+ * Quantum circuit simulator with AVX512 vectorization.
+ */
+template <typename For>
+class SimulatorAVX512<For, float> final
+    : public SimulatorAVX512Float<For, FloatLoadStoreAVX512<For>> {
+ private:
+  using Base = SimulatorAVX512Float<For, FloatLoadStoreAVX512<For>>;
+
+ public:
+  using State = typename Base::State;
+
+  template <typename... ForArgs>
+  explicit SimulatorAVX512(ForArgs&&... args) : Base(args...) {}
+
+  /**
+   * Computes the reduced density matrix of the given qubits in one read-only
+   * pass over the state vector.
+   * @param qs Indices of the qubits; should be sorted in increasing order.
+   *   There should be at most four qubits.
+   * @param state The state of the system.
+   * @return The 2^k x 2^k reduced density matrix (k = qs.size()) in row-major
+   *   order; bit j of the row and column indices corresponds to qs[j].
+   *   The vector is empty if there are more than four qubits.
+   */
+  std::vector<std::complex<double>> ReducedDensityMatrix(
+      const std::vector<unsigned>& qs, const State& state) const {
+    return SimulatorBase::ComputeReducedDensityMatrix<4>(
+        this->for_, state.num_qubits(), qs, state.get());
+  }
+};
+
+/**
+ * Double-precision quantum circuit simulator with AVX512 vectorization.
+ */
+template <typename For>
+class SimulatorAVX512<For, double> final : public SimulatorBase {
+ public:
+  using StateSpace = StateSpaceAVX512<For, double>;
+  using State = typename StateSpace::State;
+  using fp_type = typename StateSpace::fp_type;
+
+  template <typename... ForArgs>
+  explicit SimulatorAVX512(ForArgs&&... args) : for_(args...) {}
+
+  /**
+   * Applies a gate using AVX512 instructions.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param matrix Matrix representation of the gate to be applied.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyGate(const std::vector<unsigned>& qs,
+                 const fp_type* matrix, State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    switch (qs.size()) {
+    case 1:
+      if (qs[0] > 2) {
+        ApplyGateH<1>(qs, matrix, state);
+      } else {
+        ApplyGateL<0, 1>(qs, matrix, state);
+      }
+      break;
+    case 2:
+      if (qs[0] > 2) {
+        ApplyGateH<2>(qs, matrix, state);
+      } else if (qs[1] > 2) {
+        ApplyGateL<1, 1>(qs, matrix, state);
+      } else {
+        ApplyGateL<0, 2>(qs, matrix, state);
+      }
+      break;
+    case 3:
+      if (qs[0] > 2) {
+        ApplyGateH<3>(qs, matrix, state);
+      } else if (qs[1] > 2) {
+        ApplyGateL<2, 1>(qs, matrix, state);
+      } else if (qs[2] > 2) {
+        ApplyGateL<1, 2>(qs, matrix, state);
+      } else {
+        ApplyGateL<0, 3>(qs, matrix, state);
+      }
+      break;
+    case 4:
+      if (qs[0] > 2) {
+        ApplyGateH<4>(qs, matrix, state);
+      } else if (qs[1] > 2) {
+        ApplyGateL<3, 1>(qs, matrix, state);
+      } else if (qs[2] > 2) {
+        ApplyGateL<2, 2>(qs, matrix, state);
+      } else {
+        ApplyGateL<1, 3>(qs, matrix, state);
+      }
+      break;
+    case 5:
+      if (qs[0] > 2) {
+        ApplyGateH<5>(qs, matrix, state);
+      } else if (qs[1] > 2) {
+        ApplyGateL<4, 1>(qs, matrix, state);
+      } else if (qs[2] > 2) {
+        ApplyGateL<3, 2>(qs, matrix, state);
+      } else {
+        ApplyGateL<2, 3>(qs, matrix, state);
+      }
+      break;
+    case 6:
+      if (qs[0] > 2) {
+        ApplyGateH<6>(qs, matrix, state);
+      } else if (qs[1] > 2) {
+        ApplyGateL<5, 1>(qs, matrix, state);
+      } else if (qs[2] > 2) {
+        ApplyGateL<4, 2>(qs, matrix, state);
+      } else {
+        ApplyGateL<3, 3>(qs, matrix, state);
+      }
+      break;
+    case 7:
+      if (qs[0] > 2) {
+        ApplyGateH<7>(qs, matrix, state);
+      } else if (qs[1] > 2) {
+        ApplyGateL<6, 1>(qs, matrix, state);
+      } else if (qs[2] > 2) {
+        ApplyGateL<5, 2>(qs, matrix, state);
+      } else {
+        ApplyGateL<4, 3>(qs, matrix, state);
+      }
+      break;
+    case 8:
+      if (qs[0] > 2) {
+        ApplyGateH<8>(qs, matrix, state);
+      } else if (qs[1] > 2) {
+        ApplyGateL<7, 1>(qs, matrix, state);
+      } else if (qs[2] > 2) {
+        ApplyGateL<6, 2>(qs, matrix, state);
+      } else {
+        ApplyGateL<5, 3>(qs, matrix, state);
+      }
+      break;
+    default:
+      // Not implemented.
+      break;
+    }
+  }
+
+  /**
+   * Applies a controlled gate using AVX512 instructions.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param cqs Indices of control qubits.
+   * @param cvals Bit mask of control qubit values.
+   * @param matrix Matrix representation of the gate to be applied.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyControlledGate(const std::vector<unsigned>& qs,
+                           const std::vector<unsigned>& cqs, uint64_t cvals,
+                           const fp_type* matrix, State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+    // Assume cqs[0] < cqs[1] < cqs[2] < ... .
+
+    if (cqs.size() == 0) {
+      ApplyGate(qs, matrix, state);
+      return;
+    }
+
+    switch (qs.size()) {
+    case 1:
+      if (qs[0] > 2) {
+        if (cqs[0] > 2) {
+          ApplyControlledGateHH<1>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateHL<1>(qs, cqs, cvals, matrix, state);
+        }
+      } else {
+        if (cqs[0] > 2) {
+          ApplyControlledGateL<0, 1, 1>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateL<0, 1, 0>(qs, cqs, cvals, matrix, state);
+        }
+      }
+      break;
+    case 2:
+      if (qs[0] > 2) {
+        if (cqs[0] > 2) {
+          ApplyControlledGateHH<2>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateHL<2>(qs, cqs, cvals, matrix, state);
+        }
+      } else if (qs[1] > 2) {
+        if (cqs[0] > 2) {
+          ApplyControlledGateL<1, 1, 1>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateL<1, 1, 0>(qs, cqs, cvals, matrix, state);
+        }
+      } else {
+        if (cqs[0] > 2) {
+          ApplyControlledGateL<0, 2, 1>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateL<0, 2, 0>(qs, cqs, cvals, matrix, state);
+        }
+      }
+      break;
+    case 3:
+      if (qs[0] > 2) {
+        if (cqs[0] > 2) {
+          ApplyControlledGateHH<3>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateHL<3>(qs, cqs, cvals, matrix, state);
+        }
+      } else if (qs[1] > 2) {
+        if (cqs[0] > 2) {
+          ApplyControlledGateL<2, 1, 1>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateL<2, 1, 0>(qs, cqs, cvals, matrix, state);
+        }
+      } else if (qs[2] > 2) {
+        if (cqs[0] > 2) {
+          ApplyControlledGateL<1, 2, 1>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateL<1, 2, 0>(qs, cqs, cvals, matrix, state);
+        }
+      } else {
+        if (cqs[0] > 2) {
+          ApplyControlledGateL<0, 3, 1>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateL<0, 3, 0>(qs, cqs, cvals, matrix, state);
+        }
+      }
+      break;
+    case 4:
+      if (qs[0] > 2) {
+        if (cqs[0] > 2) {
+          ApplyControlledGateHH<4>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateHL<4>(qs, cqs, cvals, matrix, state);
+        }
+      } else if (qs[1] > 2) {
+        if (cqs[0] > 2) {
+          ApplyControlledGateL<3, 1, 1>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateL<3, 1, 0>(qs, cqs, cvals, matrix, state);
+        }
+      } else if (qs[2] > 2) {
+        if (cqs[0] > 2) {
+          ApplyControlledGateL<2, 2, 1>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateL<2, 2, 0>(qs, cqs, cvals, matrix, state);
+        }
+      } else {
+        if (cqs[0] > 2) {
+          ApplyControlledGateL<1, 3, 1>(qs, cqs, cvals, matrix, state);
+        } else {
+          ApplyControlledGateL<1, 3, 0>(qs, cqs, cvals, matrix, state);
+        }
+      }
+      break;
+    default:
+      // Not implemented.
+      break;
+    }
+  }
+
+  /**
+   * Applies a diagonal gate using AVX512 instructions.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param diag Diagonal entries of the gate matrix; the real part of each
+   *   entry is followed by its imaginary part.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyDiagonalGate(const std::vector<unsigned>& qs,
+                         const fp_type* diag, State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* w,
+                uint64_t qmaskh, fp_type* rstate) {
+      auto v = w + 16 * GetDiagonalIndex(i, qmaskh);
+      auto p = rstate + 16 * i;
+
+      __m512d ru = _mm512_loadu_pd(v);
+      __m512d iu = _mm512_loadu_pd(v + 8);
+      __m512d rs = _mm512_load_pd(p);
+      __m512d is = _mm512_load_pd(p + 8);
+
+      __m512d rn = _mm512_fnmadd_pd(is, iu, _mm512_mul_pd(rs, ru));
+      __m512d in = _mm512_fmadd_pd(is, ru, _mm512_mul_pd(rs, iu));
+
+      _mm512_store_pd(p, rn);
+      _mm512_store_pd(p + 8, in);
+    };
+
+    std::vector<fp_type> w;
+    uint64_t qmaskh = FillDiagonalMatrix<3>(qs, diag, w);
+
+    unsigned k = 3;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, w.data(), qmaskh, state.get());
+  }
+
+  /**
+   * Applies a permutation gate using AVX512 instructions. Permutation gates
+   * (X, Y, CNOT, SWAP, ISWAP, CCX, CSWAP, ...) have exactly one nonzero
+   * element in each row and each column of the gate matrix.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param perm Permutation; the nonzero element of the k-th row of the gate
+   *   matrix is in column perm[k].
+   * @param phases Nonzero elements of the gate matrix; the real part of each
+   *   element is followed by its imaginary part.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyPermutationGate(const std::vector<unsigned>& qs,
+                            const unsigned* perm, const fp_type* phases,
+                            State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    PermutationMatrix<fp_type> pm;
+    unsigned h = FillPermutationMatrix<3>(
+        state.num_qubits(), qs, perm, phases, pm);
+
+    switch (h) {
+    case 0:
+      ApplyPermutationGateH<0>(pm, state);
+      break;
+    case 1:
+      ApplyPermutationGateH<1>(pm, state);
+      break;
+    case 2:
+      ApplyPermutationGateH<2>(pm, state);
+      break;
+    case 3:
+      ApplyPermutationGateH<3>(pm, state);
+      break;
+    case 4:
+      ApplyPermutationGateH<4>(pm, state);
+      break;
+    case 5:
+      ApplyPermutationGateH<5>(pm, state);
+      break;
+    case 6:
+      ApplyPermutationGateH<6>(pm, state);
+      break;
+    default:
+      // Not implemented.
+      break;
+    }
+  }
+
+  /**
+   * Applies the rotation exp(-i theta P) about a Pauli string P using
+   * AVX512 instructions; see gate::PauliRotation in gate.h. The amplitudes
+   * are paired by the X and Y operators and updated in one pass over
+   * the state vector.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param paulis Pauli operators acting on the qubits: 1 for X, 2 for Y and
+   *   3 for Z.
+   * @param theta The rotation angle.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyPauliRotation(const std::vector<unsigned>& qs,
+                          const unsigned* paulis, fp_type theta,
+                          State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, uint64_t xmaskh,
+                uint64_t zmaskh, uint64_t mlow, fp_type c,
+                const unsigned* lanes, const fp_type* w, fp_type* rstate) {
+      uint64_t t = GetPauliRotationIndex(i, mlow);
+      uint64_t s = t ^ xmaskh;
+
+      auto pt = rstate + 16 * t;
+      auto ps = rstate + 16 * s;
+
+      __m512i idx = _mm512_cvtepu32_epi64(
+          _mm256_loadu_si256((const __m256i*) lanes));
+      __m512d cc = _mm512_set1_pd(c);
+
+      __m512d rt = _mm512_load_pd(pt);
+      __m512d it = _mm512_load_pd(pt + 8);
+      __m512d rs = _mm512_load_pd(ps);
+      __m512d is = _mm512_load_pd(ps + 8);
+
+      auto wt = w + 16 * bits::Parity(s & zmaskh);
+
+      __m512d ru = _mm512_loadu_pd(wt);
+      __m512d iu = _mm512_loadu_pd(wt + 8);
+      __m512d rp = _mm512_permutexvar_pd(idx, rs);
+      __m512d ip = _mm512_permutexvar_pd(idx, is);
+
+      __m512d rn = _mm512_fmadd_pd(rp, ru, _mm512_mul_pd(rt, cc));
+      __m512d in = _mm512_fmadd_pd(rp, iu, _mm512_mul_pd(it, cc));
+      rn = _mm512_fnmadd_pd(ip, iu, rn);
+      in = _mm512_fmadd_pd(ip, ru, in);
+
+      if (s != t) {
+        auto ws = w + 16 * bits::Parity(t & zmaskh);
+
+        ru = _mm512_loadu_pd(ws);
+        iu = _mm512_loadu_pd(ws + 8);
+        rp = _mm512_permutexvar_pd(idx, rt);
+        ip = _mm512_permutexvar_pd(idx, it);
+
+        __m512d rm = _mm512_fmadd_pd(rp, ru, _mm512_mul_pd(rs, cc));
+        __m512d im = _mm512_fmadd_pd(rp, iu, _mm512_mul_pd(is, cc));
+        rm = _mm512_fnmadd_pd(ip, iu, rm);
+        im = _mm512_fmadd_pd(ip, ru, im);
+
+        _mm512_store_pd(ps, rm);
+        _mm512_store_pd(ps + 8, im);
+      }
+
+      _mm512_store_pd(pt, rn);
+      _mm512_store_pd(pt + 8, in);
+    };
+
+    PauliRotationMatrix<fp_type> pr;
+    FillPauliRotationMatrix<3>(qs, paulis, theta, pr);
+
+    unsigned k = 3;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    if (pr.xmaskh != 0) --n;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, pr.xmaskh, pr.zmaskh, pr.mlow, pr.c, pr.lanes.data(),
+             pr.w.data(), state.get());
+  }
+
+  /**
+   * Computes the expectation value of an operator using AVX512 instructions.
+   * @param qs Indices of the qubits the operator acts on.
+   * @param matrix The operator matrix.
+   * @param state The state of the system.
+   * @return The computed expectation value.
+   */
+  std::complex<double> ExpectationValue(const std::vector<unsigned>& qs,
+                                        const fp_type* matrix,
+                                        const State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    switch (qs.size()) {
+    case 1:
+      if (qs[0] > 2) {
+        return ExpectationValueH<1>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<0, 1>(qs, matrix, state);
+      }
+      break;
+    case 2:
+      if (qs[0] > 2) {
+        return ExpectationValueH<2>(qs, matrix, state);
+      } else if (qs[1] > 2) {
+        return ExpectationValueL<1, 1>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<0, 2>(qs, matrix, state);
+      }
+      break;
+    case 3:
+      if (qs[0] > 2) {
+        return ExpectationValueH<3>(qs, matrix, state);
+      } else if (qs[1] > 2) {
+        return ExpectationValueL<2, 1>(qs, matrix, state);
+      } else if (qs[2] > 2) {
+        return ExpectationValueL<1, 2>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<0, 3>(qs, matrix, state);
+      }
+      break;
+    case 4:
+      if (qs[0] > 2) {
+        return ExpectationValueH<4>(qs, matrix, state);
+      } else if (qs[1] > 2) {
+        return ExpectationValueL<3, 1>(qs, matrix, state);
+      } else if (qs[2] > 2) {
+        return ExpectationValueL<2, 2>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<1, 3>(qs, matrix, state);
+      }
+      break;
+    case 5:
+      if (qs[0] > 2) {
+        return ExpectationValueH<5>(qs, matrix, state);
+      } else if (qs[1] > 2) {
+        return ExpectationValueL<4, 1>(qs, matrix, state);
+      } else if (qs[2] > 2) {
+        return ExpectationValueL<3, 2>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<2, 3>(qs, matrix, state);
+      }
+      break;
+    case 6:
+      if (qs[0] > 2) {
+        return ExpectationValueH<6>(qs, matrix, state);
+      } else if (qs[1] > 2) {
+        return ExpectationValueL<5, 1>(qs, matrix, state);
+      } else if (qs[2] > 2) {
+        return ExpectationValueL<4, 2>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<3, 3>(qs, matrix, state);
+      }
+      break;
+    case 7:
+      if (qs[0] > 2) {
+        return ExpectationValueH<7>(qs, matrix, state);
+      } else if (qs[1] > 2) {
+        return ExpectationValueL<6, 1>(qs, matrix, state);
+      } else if (qs[2] > 2) {
+        return ExpectationValueL<5, 2>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<4, 3>(qs, matrix, state);
+      }
+      break;
+    case 8:
+      if (qs[0] > 2) {
+        return ExpectationValueH<8>(qs, matrix, state);
+      } else if (qs[1] > 2) {
+        return ExpectationValueL<7, 1>(qs, matrix, state);
+      } else if (qs[2] > 2) {
+        return ExpectationValueL<6, 2>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<5, 3>(qs, matrix, state);
+      }
+      break;
+    default:
+      // Not implemented.
+      break;
+    }
+
+    return 0;
+  }
+
+  /**
+   * Computes the expectation value of a Pauli string P using AVX512
+   * instructions.
+   * The amplitudes are paired by the X and Y operators and the expectation
+   * value is computed in one read-only pass over the state vector; there is
+   * no limit on the number of qubits.
+   * @param qs Indices of the qubits the Pauli string acts on; should be
+   *   distinct.
+   * @param paulis Pauli operators acting on the qubits: 1 for X, 2 for Y and
+   *   3 for Z.
+   * @param state The state of the system.
+   * @return The computed expectation value <state|P|state>.
+   */
+  double ExpectationValuePauli(const std::vector<unsigned>& qs,
+                               const unsigned* paulis,
+                               const State& state) const {
+    uint64_t xmask, zmask;
+    GetPauliMasks(qs, paulis, xmask, zmask);
+
+    return ExpectationValuesPauli(xmask, {zmask}, state)[0];
+  }
+
+  /**
+   * Computes the expectation values of Pauli strings with the same X and Y
+   * operators using AVX512 instructions. The amplitude pair products are shared
+   * by all the strings; up to 16 strings are evaluated in one read-only pass
+   * over the state vector.
+   * @param xmask Mask of the qubits acted on by X or Y operators; the same
+   *   for all the Pauli strings.
+   * @param zmasks Masks of the qubits acted on by Y or Z operators, one mask
+   *   per Pauli string.
+   * @param state The state of the system.
+   * @return The computed expectation values, one value per Pauli string.
+   */
+  std::vector<double> ExpectationValuesPauli(
+      uint64_t xmask, const std::vector<uint64_t>& zmasks,
+      const State& state) const {
+    PauliExpectationMatrix<fp_type> pe;
+    FillPauliExpectationMatrix<3>(xmask, zmasks, pe);
+
+    unsigned k = 3;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    if (pe.xmaskh != 0) --n;
+
+    std::vector<double> results(zmasks.size(), 0);
+
+    std::size_t i = 0;
+
+    for (; i + 16 <= zmasks.size(); i += 16) {
+      ExpectationValuesPauliN<16>(n, pe, i, state, results.data());
+    }
+
+    for (; i + 4 <= zmasks.size(); i += 4) {
+      ExpectationValuesPauliN<4>(n, pe, i, state, results.data());
+    }
+
+    for (; i < zmasks.size(); ++i) {
+      ExpectationValuesPauliN<1>(n, pe, i, state, results.data());
+    }
+
+    return results;
+  }
+
+  /**
+   * Computes the reduced density matrix of the given qubits in one read-only
+   * pass over the state vector.
+   * @param qs Indices of the qubits; should be sorted in increasing order.
+   *   There should be at most four qubits.
+   * @param state The state of the system.
+   * @return The 2^k x 2^k reduced density matrix (k = qs.size()) in row-major
+   *   order; bit j of the row and column indices corresponds to qs[j].
+   *   The vector is empty if there are more than four qubits.
+   */
+  std::vector<std::complex<double>> ReducedDensityMatrix(
+      const std::vector<unsigned>& qs, const State& state) const {
+    return ComputeReducedDensityMatrix<3>(for_, state.num_qubits(), qs,
+                                          state.get());
+  }
+
+  /**
+   * @return The size of SIMD register if applicable.
+   */
+  static unsigned SIMDRegisterSize() {
+    return 8;
+  }
+
+  /**
+   * @return The object that runs the parallel loops of this simulator.
+   */
+  const For& GetFor() const {
+    return for_;
+  }
+
+ private:
+  template <unsigned H>
+  void ApplyGateH(const std::vector<unsigned>& qs,
+                  const fp_type* matrix, State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* v,
+                uint64_t imaskh, uint64_t qmaskh, fp_type* rstate) {
+      constexpr unsigned hsize = 1 << H;
+
+      __m512d ru, iu, rn, in;
+      __m512d rs[hsize], is[hsize];
+
+      auto p0 = rstate + _pdep_u64(i, imaskh);
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        uint64_t p = _pdep_u64(k, qmaskh);
+
+        rs[k] = _mm512_load_pd(p0 + p);
+        is[k] = _mm512_load_pd(p0 + p + 8);
+      }
+
+      uint64_t j = 0;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        ru = _mm512_set1_pd(v[j]);
+        iu = _mm512_set1_pd(v[j + 1]);
+        rn = _mm512_mul_pd(rs[0], ru);
+        in = _mm512_mul_pd(rs[0], iu);
+        rn = _mm512_fnmadd_pd(is[0], iu, rn);
+        in = _mm512_fmadd_pd(is[0], ru, in);
+
+        j += 2;
+
+        for (unsigned l = 1; l < hsize; ++l) {
+          ru = _mm512_set1_pd(v[j]);
+          iu = _mm512_set1_pd(v[j + 1]);
+          rn = _mm512_fmadd_pd(rs[l], ru, rn);
+          in = _mm512_fmadd_pd(rs[l], iu, in);
+          rn = _mm512_fnmadd_pd(is[l], iu, rn);
+          in = _mm512_fmadd_pd(is[l], ru, in);
+
+          j += 2;
+        }
+
+        uint64_t p = _pdep_u64(k, qmaskh);
+
+        _mm512_store_pd(p0 + p, rn);
+        _mm512_store_pd(p0 + p + 8, in);
+      }
+    };
+
+    auto m = GetMasks1<H, 3>(qs);
+
+    unsigned k = 3 + H;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, matrix, m.imaskh, m.qmaskh, state.get());
+  }
+
+  template <unsigned H, unsigned L>
+  void ApplyGateL(const std::vector<unsigned>& qs,
+                  const fp_type* matrix, State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const __m512d* w,
+                uint64_t imaskh, uint64_t qmaskh, const __m512i* idx,
+                fp_type* rstate) {
+      constexpr unsigned gsize = 1 << (H + L);
+      constexpr unsigned hsize = 1 << H;
+      constexpr unsigned lsize = 1 << L;
+
+      __m512d rn, in;
+      __m512d rs[gsize], is[gsize];
+
+      auto p0 = rstate + _pdep_u64(i, imaskh);
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        unsigned k2 = lsize * k;
+        uint64_t p = _pdep_u64(k, qmaskh);
+
+        rs[k2] = _mm512_load_pd(p0 + p);
+        is[k2] = _mm512_load_pd(p0 + p + 8);
+
+        for (unsigned l = 1; l < lsize; ++l) {
+          rs[k2 + l] = _mm512_permutexvar_pd(idx[l - 1], rs[k2]);
+          is[k2 + l] = _mm512_permutexvar_pd(idx[l - 1], is[k2]);
+        }
+      }
+
+      uint64_t j = 0;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rn = _mm512_mul_pd(rs[0], w[j]);
+        in = _mm512_mul_pd(rs[0], w[j + 1]);
+        rn = _mm512_fnmadd_pd(is[0], w[j + 1], rn);
+        in = _mm512_fmadd_pd(is[0], w[j], in);
+
+        j += 2;
+
+        for (unsigned l = 1; l < gsize; ++l) {
+          rn = _mm512_fmadd_pd(rs[l], w[j], rn);
+          in = _mm512_fmadd_pd(rs[l], w[j + 1], in);
+          rn = _mm512_fnmadd_pd(is[l], w[j + 1], rn);
+          in = _mm512_fmadd_pd(is[l], w[j], in);
+
+          j += 2;
+        }
+
+        uint64_t p = _pdep_u64(k, qmaskh);
+
+        _mm512_store_pd(p0 + p, rn);
+        _mm512_store_pd(p0 + p + 8, in);
+      }
+    };
+
+    __m512i idx[1 << L];
+    MatrixBuffer<sizeof(fp_type) << (1 + 2 * H + L + 3)> wbuf;
+    __m512d* w = (__m512d*) wbuf.get();
+
+    if (w == nullptr) {
+      // Not enough memory for the expanded matrix.
+      ApplyGateUnexpanded<3>(for_, state.num_qubits(), qs, matrix,
+                             state.get());
+      return;
+    }
+
+    auto m = GetMasks2<H, L, 3>(qs);
+    FillPermutationIndices<L>(m.qmaskl, idx);
+    FillMatrix<H, L, 3>(m.qmaskl, matrix, (fp_type*) w);
+
+    unsigned r = 3 + H;
+    unsigned n = state.num_qubits() > r ? state.num_qubits() - r : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, w, m.imaskh, m.qmaskh, idx, state.get());
+  }
+
+  template <unsigned H>
+  void ApplyControlledGateHH(const std::vector<unsigned>& qs,
+                             const std::vector<unsigned>& cqs, uint64_t cvals,
+                             const fp_type* matrix, State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* v,
+                uint64_t imaskh, uint64_t qmaskh, uint64_t cvalsh,
+                fp_type* rstate) {
+      constexpr unsigned hsize = 1 << H;
+
+      __m512d ru, iu, rn, in;
+      __m512d rs[hsize], is[hsize];
+
+      auto p0 = rstate + (_pdep_u64(i, imaskh) | cvalsh);
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        uint64_t p = _pdep_u64(k, qmaskh);
+
+        rs[k] = _mm512_load_pd(p0 + p);
+        is[k] = _mm512_load_pd(p0 + p + 8);
+      }
+
+      uint64_t j = 0;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        ru = _mm512_set1_pd(v[j]);
+        iu = _mm512_set1_pd(v[j + 1]);
+        rn = _mm512_mul_pd(rs[0], ru);
+        in = _mm512_mul_pd(rs[0], iu);
+        rn = _mm512_fnmadd_pd(is[0], iu, rn);
+        in = _mm512_fmadd_pd(is[0], ru, in);
+
+        j += 2;
+
+        for (unsigned l = 1; l < hsize; ++l) {
+          ru = _mm512_set1_pd(v[j]);
+          iu = _mm512_set1_pd(v[j + 1]);
+          rn = _mm512_fmadd_pd(rs[l], ru, rn);
+          in = _mm512_fmadd_pd(rs[l], iu, in);
+          rn = _mm512_fnmadd_pd(is[l], iu, rn);
+          in = _mm512_fmadd_pd(is[l], ru, in);
+
+          j += 2;
+        }
+
+        uint64_t p = _pdep_u64(k, qmaskh);
+
+        _mm512_store_pd(p0 + p, rn);
+        _mm512_store_pd(p0 + p + 8, in);
+      }
+    };
+
+    auto m = GetMasks3<H, 3>(state.num_qubits(), qs, cqs, cvals);
+
+    unsigned k = 3 + H + cqs.size();
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, matrix, m.imaskh, m.qmaskh, m.cvalsh, state.get());
+  }
+
+  template <unsigned H>
+  void ApplyControlledGateHL(const std::vector<unsigned>& qs,
+                             const std::vector<unsigned>& cqs, uint64_t cvals,
+                             const fp_type* matrix, State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const __m512d* w,
+                uint64_t imaskh, uint64_t qmaskh, uint64_t cvalsh,
+                fp_type* rstate) {
+      constexpr unsigned hsize = 1 << H;
+
+      __m512d rn, in;
+      __m512d rs[hsize], is[hsize];
+
+      auto p0 = rstate + (_pdep_u64(i, imaskh) | cvalsh);
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        uint64_t p = _pdep_u64(k, qmaskh);
+
+        rs[k] = _mm512_load_pd(p0 + p);
+        is[k] = _mm512_load_pd(p0 + p + 8);
+      }
+
+      uint64_t j = 0;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rn = _mm512_mul_pd(rs[0], w[j]);
+        in = _mm512_mul_pd(rs[0], w[j + 1]);
+        rn = _mm512_fnmadd_pd(is[0], w[j + 1], rn);
+        in = _mm512_fmadd_pd(is[0], w[j], in);
+
+        j += 2;
+
+        for (unsigned l = 1; l < hsize; ++l) {
+          rn = _mm512_fmadd_pd(rs[l], w[j], rn);
+          in = _mm512_fmadd_pd(rs[l], w[j + 1], in);
+          rn = _mm512_fnmadd_pd(is[l], w[j + 1], rn);
+          in = _mm512_fmadd_pd(is[l], w[j], in);
+
+          j += 2;
+        }
+
+        uint64_t p = _pdep_u64(k, qmaskh);
+
+        _mm512_store_pd(p0 + p, rn);
+        _mm512_store_pd(p0 + p + 8, in);
+      }
+    };
+
+    __m512d w[1 << (1 + 2 * H)];
+
+    auto m = GetMasks4<H, 3>(state.num_qubits(), qs, cqs, cvals);
+    FillControlledMatrixH<H, 3>(m.cvalsl, m.cmaskl, matrix, (fp_type*) w);
+
+    unsigned r = 3 + H + cqs.size() - m.cl;
+    unsigned n = state.num_qubits() > r ? state.num_qubits() - r : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, w, m.imaskh, m.qmaskh, m.cvalsh, state.get());
+  }
+
+  template <unsigned H, unsigned L, bool CH>
+  void ApplyControlledGateL(const std::vector<unsigned>& qs,
+                            const std::vector<unsigned>& cqs, uint64_t cvals,
+                            const fp_type* matrix, State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const __m512d* w,
+                uint64_t imaskh, uint64_t qmaskh, uint64_t cvalsh,
+                const __m512i* idx, fp_type* rstate) {
+      constexpr unsigned gsize = 1 << (H + L);
+      constexpr unsigned hsize = 1 << H;
+      constexpr unsigned lsize = 1 << L;
+
+      __m512d rn, in;
+      __m512d rs[gsize], is[gsize];
+
+      auto p0 = rstate + (_pdep_u64(i, imaskh) | cvalsh);
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        unsigned k2 = lsize * k;
+        uint64_t p = _pdep_u64(k, qmaskh);
+
+        rs[k2] = _mm512_load_pd(p0 + p);
+        is[k2] = _mm512_load_pd(p0 + p + 8);
+
+        for (unsigned l = 1; l < lsize; ++l) {
+          rs[k2 + l] = _mm512_permutexvar_pd(idx[l - 1], rs[k2]);
+          is[k2 + l] = _mm512_permutexvar_pd(idx[l - 1], is[k2]);
+        }
+      }
+
+      uint64_t j = 0;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rn = _mm512_mul_pd(rs[0], w[j]);
+        in = _mm512_mul_pd(rs[0], w[j + 1]);
+        rn = _mm512_fnmadd_pd(is[0], w[j + 1], rn);
+        in = _mm512_fmadd_pd(is[0], w[j], in);
+
+        j += 2;
+
+        for (unsigned l = 1; l < gsize; ++l) {
+          rn = _mm512_fmadd_pd(rs[l], w[j], rn);
+          in = _mm512_fmadd_pd(rs[l], w[j + 1], in);
+          rn = _mm512_fnmadd_pd(is[l], w[j + 1], rn);
+          in = _mm512_fmadd_pd(is[l], w[j], in);
+
+          j += 2;
+        }
+
+        uint64_t p = _pdep_u64(k, qmaskh);
+
+        _mm512_store_pd(p0 + p, rn);
+        _mm512_store_pd(p0 + p + 8, in);
+      }
+    };
+
+    __m512i idx[1 << L];
+    __m512d w[1 << (1 + 2 * H + L)];
+
+    if (CH) {
+      auto m = GetMasks5<H, L, 3>(state.num_qubits(), qs, cqs, cvals);
+      FillPermutationIndices<L>(m.qmaskl, idx);
+      FillMatrix<H, L, 3>(m.qmaskl, matrix, (fp_type*) w);
+
+      unsigned r = 3 + H + cqs.size();
+      unsigned n = state.num_qubits() > r ? state.num_qubits() - r : 0;
+      uint64_t size = uint64_t{1} << n;
+
+      for_.Run(size, f, w, m.imaskh, m.qmaskh, m.cvalsh, idx, state.get());
+    } else {
+      auto m = GetMasks6<H, L, 3>(state.num_qubits(), qs, cqs, cvals);
+      FillPermutationIndices<L>(m.qmaskl, idx);
+      FillControlledMatrixL<H, L, 3>(
+          m.cvalsl, m.cmaskl, m.qmaskl, matrix, (fp_type*) w);
+
+      unsigned r = 3 + H + cqs.size() - m.cl;
+      unsigned n = state.num_qubits() > r ? state.num_qubits() - r : 0;
+      uint64_t size = uint64_t{1} << n;
+
+      for_.Run(size, f, w, m.imaskh, m.qmaskh, m.cvalsh, idx, state.get());
+    }
+  }
+
+  template <unsigned H>
+  std::complex<double> ExpectationValueH(const std::vector<unsigned>& qs,
+                                         const fp_type* matrix,
+                                         const State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* v,
+                uint64_t imaskh, uint64_t qmaskh, const fp_type* rstate) {
+      constexpr unsigned hsize = 1 << H;
+
+      __m512d ru, iu, rn, in;
+      __m512d rs[hsize], is[hsize];
+
+      auto p0 = rstate + _pdep_u64(i, imaskh);
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        uint64_t p = _pdep_u64(k, qmaskh);
+
+        rs[k] = _mm512_load_pd(p0 + p);
+        is[k] = _mm512_load_pd(p0 + p + 8);
+      }
+
+      double re = 0;
+      double im = 0;
+      uint64_t j = 0;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        ru = _mm512_set1_pd(v[j]);
+        iu = _mm512_set1_pd(v[j + 1]);
+        rn = _mm512_mul_pd(rs[0], ru);
+        in = _mm512_mul_pd(rs[0], iu);
+        rn = _mm512_fnmadd_pd(is[0], iu, rn);
+        in = _mm512_fmadd_pd(is[0], ru, in);
+
+        j += 2;
+
+        for (unsigned l = 1; l < hsize; ++l) {
+          ru = _mm512_set1_pd(v[j]);
+          iu = _mm512_set1_pd(v[j + 1]);
+          rn = _mm512_fmadd_pd(rs[l], ru, rn);
+          in = _mm512_fmadd_pd(rs[l], iu, in);
+          rn = _mm512_fnmadd_pd(is[l], iu, rn);
+          in = _mm512_fmadd_pd(is[l], ru, in);
+
+          j += 2;
+        }
+
+        __m512d v_re = _mm512_fmadd_pd(is[k], in, _mm512_mul_pd(rs[k], rn));
+        __m512d v_im = _mm512_fnmadd_pd(is[k], rn, _mm512_mul_pd(rs[k], in));
+
+        re += detail::HorizontalSumAVX512(v_re);
+        im += detail::HorizontalSumAVX512(v_im);
+      }
+
+      return std::complex<double>{re, im};
+    };
+
+    auto m = GetMasks1<H, 3>(qs);
+
+    unsigned k = 3 + H;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    using Op = std::plus<std::complex<double>>;
+    return
+        for_.RunReduce(size, f, Op(), matrix, m.imaskh, m.qmaskh, state.get());
+  }
+
+  template <unsigned H, unsigned L>
+  std::complex<double> ExpectationValueL(const std::vector<unsigned>& qs,
+                                         const fp_type* matrix,
+                                         const State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const __m512d* w,
+                uint64_t imaskh, uint64_t qmaskh, const __m512i* idx,
+                const fp_type* rstate) {
+      constexpr unsigned gsize = 1 << (H + L);
+      constexpr unsigned hsize = 1 << H;
+      constexpr unsigned lsize = 1 << L;
+
+      __m512d rn, in;
+      __m512d rs[gsize], is[gsize];
+
+      auto p0 = rstate + _pdep_u64(i, imaskh);
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        unsigned k2 = lsize * k;
+        uint64_t p = _pdep_u64(k, qmaskh);
+
+        rs[k2] = _mm512_load_pd(p0 + p);
+        is[k2] = _mm512_load_pd(p0 + p + 8);
+
+        for (unsigned l = 1; l < lsize; ++l) {
+          rs[k2 + l] = _mm512_permutexvar_pd(idx[l - 1], rs[k2]);
+          is[k2 + l] = _mm512_permutexvar_pd(idx[l - 1], is[k2]);
+        }
+      }
+
+      double re = 0;
+      double im = 0;
+      uint64_t j = 0;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rn = _mm512_mul_pd(rs[0], w[j]);
+        in = _mm512_mul_pd(rs[0], w[j + 1]);
+        rn = _mm512_fnmadd_pd(is[0], w[j + 1], rn);
+        in = _mm512_fmadd_pd(is[0], w[j], in);
+
+        j += 2;
+
+        for (unsigned l = 1; l < gsize; ++l) {
+          rn = _mm512_fmadd_pd(rs[l], w[j], rn);
+          in = _mm512_fmadd_pd(rs[l], w[j + 1], in);
+          rn = _mm512_fnmadd_pd(is[l], w[j + 1], rn);
+          in = _mm512_fmadd_pd(is[l], w[j], in);
+
+          j += 2;
+        }
+
+        unsigned m = lsize * k;
+
+        __m512d v_re = _mm512_fmadd_pd(is[m], in, _mm512_mul_pd(rs[m], rn));
+        __m512d v_im = _mm512_fnmadd_pd(is[m], rn, _mm512_mul_pd(rs[m], in));
+
+        re += detail::HorizontalSumAVX512(v_re);
+        im += detail::HorizontalSumAVX512(v_im);
+      }
+
+      return std::complex<double>{re, im};
+    };
+
+    __m512i idx[1 << L];
+    MatrixBuffer<sizeof(fp_type) << (1 + 2 * H + L + 3)> wbuf;
+    __m512d* w = (__m512d*) wbuf.get();
+
+    if (w == nullptr) {
+      // Not enough memory for the expanded matrix.
+      return ExpectationValueUnexpanded<3>(for_, state.num_qubits(), qs,
+                                            matrix, state.get());
+    }
+
+    auto m = GetMasks2<H, L, 3>(qs);
+    FillPermutationIndices<L>(m.qmaskl, idx);
+    FillMatrix<H, L, 3>(m.qmaskl, matrix, (fp_type*) w);
+
+    unsigned r = 3 + H;
+    unsigned n = state.num_qubits() > r ? state.num_qubits() - r : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    using Op = std::plus<std::complex<double>>;
+    return
+        for_.RunReduce(size, f, Op(), w, m.imaskh, m.qmaskh, idx, state.get());
+  }
+
+
+  template <unsigned L>
+  static void FillPermutationIndices(unsigned qmaskl, __m512i* idx) {
+    constexpr unsigned lsize = 1 << L;
+
+    for (unsigned i = 0; i < lsize - 1; ++i) {
+      unsigned p[8];
+
+      for (unsigned j = 0; j < 8; ++j) {
+        p[j] = MaskedAdd<3>(j, i + 1, qmaskl, lsize) | (j & (-1 ^ qmaskl));
+      }
+
+      idx[i] = _mm512_set_epi64(p[7], p[6], p[5], p[4], p[3], p[2], p[1], p[0]);
+    }
+  }
+
+  template <unsigned H>
+  void ApplyPermutationGateH(const PermutationMatrix<fp_type>& pm,
+                             State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const uint64_t* ms,
+                const uint64_t* xss, const unsigned* offsets,
+                const unsigned* sources, const unsigned* lanes,
+                const fp_type* w, fp_type* rstate) {
+      constexpr unsigned hsize = 1 << H;
+
+      __m512d rn, in, rp, ip, ru, iu;
+      __m512d rs[hsize], is[hsize];
+
+      i *= 8;
+
+      uint64_t ii = i & ms[0];
+      for (unsigned j = 1; j <= H; ++j) {
+        i *= 2;
+        ii |= i & ms[j];
+      }
+
+      auto p0 = rstate + 2 * ii;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rs[k] = _mm512_load_pd(p0 + xss[k]);
+        is[k] = _mm512_load_pd(p0 + xss[k] + 8);
+      }
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rn = _mm512_setzero_pd();
+        in = _mm512_setzero_pd();
+
+        for (unsigned e = offsets[k]; e < offsets[k + 1]; ++e) {
+          __m512i idx = _mm512_cvtepu32_epi64(
+              _mm256_loadu_si256((const __m256i*) (lanes + 8 * e)));
+
+          rp = _mm512_permutexvar_pd(idx, rs[sources[e]]);
+          ip = _mm512_permutexvar_pd(idx, is[sources[e]]);
+          ru = _mm512_loadu_pd(w + 16 * e);
+          iu = _mm512_loadu_pd(w + 16 * e + 8);
+
+          rn = _mm512_fmadd_pd(rp, ru, rn);
+          in = _mm512_fmadd_pd(rp, iu, in);
+          rn = _mm512_fnmadd_pd(ip, iu, rn);
+          in = _mm512_fmadd_pd(ip, ru, in);
+        }
+
+        _mm512_store_pd(p0 + xss[k], rn);
+        _mm512_store_pd(p0 + xss[k] + 8, in);
+      }
+    };
+
+    unsigned k = 3 + H;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, pm.ms.data(), pm.xss.data(), pm.offsets.data(),
+             pm.sources.data(), pm.lanes.data(), pm.phases.data(),
+             state.get());
+  }
+
+  template <unsigned N>
+  void ExpectationValuesPauliN(unsigned nb,
+                               const PauliExpectationMatrix<fp_type>& pe,
+                               std::size_t i0, const State& state,
+                               double* results) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, unsigned c,
+                uint64_t xmaskh, uint64_t mlow, const unsigned* lanes,
+                const uint64_t* zmaskh, const fp_type* w,
+                const fp_type* rstate) -> PauliExpectationSums<N> {
+      __m512d acc[N];
+
+      for (unsigned k = 0; k < N; ++k) {
+        acc[k] = _mm512_setzero_pd();
+      }
+
+      __m512i idx = _mm512_cvtepu32_epi64(
+          _mm256_loadu_si256((const __m256i*) lanes));
+
+      for (uint64_t j = i << c; j < (i + 1) << c; ++j) {
+        uint64_t t = GetPauliRotationIndex(j, mlow);
+        uint64_t s = t ^ xmaskh;
+
+        auto pt = rstate + 16 * t;
+        auto ps = rstate + 16 * s;
+
+        __m512d rt = _mm512_load_pd(pt);
+        __m512d it = _mm512_load_pd(pt + 8);
+        __m512d rs = _mm512_load_pd(ps);
+        __m512d is = _mm512_load_pd(ps + 8);
+        __m512d rp = _mm512_permutexvar_pd(idx, rs);
+        __m512d ip = _mm512_permutexvar_pd(idx, is);
+
+        // Real and imaginary parts of conj(a_t) a_s.
+        __m512d rq = _mm512_fmadd_pd(rt, rp, _mm512_mul_pd(it, ip));
+        __m512d iq = _mm512_fnmadd_pd(it, rp, _mm512_mul_pd(rt, ip));
+
+        for (unsigned k = 0; k < N; ++k) {
+          __m512d wr = _mm512_loadu_pd(w + 16 * k);
+          __m512d wi = _mm512_loadu_pd(w + 16 * k + 8);
+          __m512d v = _mm512_fmadd_pd(iq, wi, _mm512_mul_pd(rq, wr));
+          fp_type sign = 1 - 2 * fp_type(bits::Parity(t & zmaskh[k]));
+
+          acc[k] = _mm512_fmadd_pd(v, _mm512_set1_pd(sign), acc[k]);
+        }
+      }
+
+      PauliExpectationSums<N> sums;
+
+      for (unsigned k = 0; k < N; ++k) {
+        sums.s[k] = detail::HorizontalSumAVX512(acc[k]);
+      }
+
+      return sums;
+    };
+
+    // Each iteration processes 2^c of the 2^nb pairs of blocks.
+    unsigned c = nb > 4 ? 4 : nb;
+    uint64_t size = uint64_t{1} << (nb - c);
+
+    using Op = PauliExpectationSumsPlus<N>;
+    auto sums = for_.RunReduce(size, f, Op(), c, pe.xmaskh, pe.mlow,
+                               pe.lanes.data(), pe.zmaskh.data() + i0,
+                               pe.w.data() + 16 * i0, state.get());
+
+    for (unsigned k = 0; k < N; ++k) {
+      results[i0 + k] = sums.s[k];
+    }
+  }
+
+  For for_;
+};
+
+
 }  // namespace qsim
 
 #endif  // SIMULATOR_AVX512_H_
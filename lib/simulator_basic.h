@@ -67,6 +67,12 @@ class SimulatorBasic final : public SimulatorBase {
     case 6:
       ApplyGateH<6>(qs, matrix, state);
       break;
+    case 7:
+      ApplyGateH<7>(qs, matrix, state);
+      break;
+    case 8:
+      ApplyGateH<8>(qs, matrix, state);
+      break;
     default:
       // Not implemented.
       break;
@@ -110,6 +116,135 @@ class SimulatorBasic final : public SimulatorBase {
     }
   }
 
+  /**
+   * Applies a diagonal gate using non-vectorized instructions.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param diag Diagonal entries of the gate matrix; the real part of each
+   *   entry is followed by its imaginary part.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyDiagonalGate(const std::vector<unsigned>& qs,
+                         const fp_type* diag, State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* w,
+                uint64_t qmaskh, fp_type* rstate) {
+      uint64_t k = 2 * GetDiagonalIndex(i, qmaskh);
+
+      auto p = rstate + 2 * i;
+
+      fp_type rn = p[0] * w[k] - p[1] * w[k + 1];
+      fp_type in = p[0] * w[k + 1] + p[1] * w[k];
+
+      p[0] = rn;
+      p[1] = in;
+    };
+
+    std::vector<fp_type> w;
+    uint64_t qmaskh = FillDiagonalMatrix<0>(qs, diag, w);
+
+    uint64_t size = uint64_t{1} << state.num_qubits();
+
+    for_.Run(size, f, w.data(), qmaskh, state.get());
+  }
+
+  /**
+   * Applies a permutation gate using non-vectorized instructions. Permutation
+   * gates (X, Y, CNOT, SWAP, ISWAP, CCX, CSWAP, ...) have exactly one nonzero
+   * element in each row and each column of the gate matrix.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param perm Permutation; the nonzero element of the k-th row of the gate
+   *   matrix is in column perm[k].
+   * @param phases Nonzero elements of the gate matrix; the real part of each
+   *   element is followed by its imaginary part.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyPermutationGate(const std::vector<unsigned>& qs,
+                            const unsigned* perm, const fp_type* phases,
+                            State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    PermutationMatrix<fp_type> pm;
+    unsigned h = FillPermutationMatrix<0>(
+        state.num_qubits(), qs, perm, phases, pm);
+
+    switch (h) {
+    case 1:
+      ApplyPermutationGateH<1>(pm, state);
+      break;
+    case 2:
+      ApplyPermutationGateH<2>(pm, state);
+      break;
+    case 3:
+      ApplyPermutationGateH<3>(pm, state);
+      break;
+    case 4:
+      ApplyPermutationGateH<4>(pm, state);
+      break;
+    case 5:
+      ApplyPermutationGateH<5>(pm, state);
+      break;
+    case 6:
+      ApplyPermutationGateH<6>(pm, state);
+      break;
+    default:
+      // Not implemented.
+      break;
+    }
+  }
+
+  /**
+   * Applies the rotation exp(-i theta P) about a Pauli string P using
+   * non-vectorized instructions; see gate::PauliRotation in gate.h.
+   * The amplitudes are paired by the X and Y operators and updated in one
+   * pass over the state vector.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param paulis Pauli operators acting on the qubits: 1 for X, 2 for Y and
+   *   3 for Z.
+   * @param theta The rotation angle.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyPauliRotation(const std::vector<unsigned>& qs,
+                          const unsigned* paulis, fp_type theta,
+                          State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, uint64_t xmaskh,
+                uint64_t zmaskh, uint64_t mlow, fp_type c, const fp_type* w,
+                fp_type* rstate) {
+      uint64_t t = GetPauliRotationIndex(i, mlow);
+      uint64_t s = t ^ xmaskh;
+
+      auto pt = rstate + 2 * t;
+      auto ps = rstate + 2 * s;
+
+      fp_type rt = pt[0];
+      fp_type it = pt[1];
+      fp_type rs = ps[0];
+      fp_type is = ps[1];
+
+      auto wt = w + 2 * bits::Parity(s & zmaskh);
+
+      pt[0] = c * rt + rs * wt[0] - is * wt[1];
+      pt[1] = c * it + rs * wt[1] + is * wt[0];
+
+      if (s != t) {
+        auto ws = w + 2 * bits::Parity(t & zmaskh);
+
+        ps[0] = c * rs + rt * ws[0] - it * ws[1];
+        ps[1] = c * is + rt * ws[1] + it * ws[0];
+      }
+    };
+
+    PauliRotationMatrix<fp_type> pr;
+    FillPauliRotationMatrix<0>(qs, paulis, theta, pr);
+
+    unsigned n = state.num_qubits();
+    if (pr.xmaskh != 0) --n;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, pr.xmaskh, pr.zmaskh, pr.mlow, pr.c, pr.w.data(),
+             state.get());
+  }
+
   /**
    * Computes the expectation value of an operator using non-vectorized
    * instructions.
@@ -142,6 +277,12 @@ class SimulatorBasic final : public SimulatorBase {
     case 6:
       return ExpectationValueH<6>(qs, matrix, state);
       break;
+    case 7:
+      return ExpectationValueH<7>(qs, matrix, state);
+      break;
+    case 8:
+      return ExpectationValueH<8>(qs, matrix, state);
+      break;
     default:
       // Not implemented.
       break;
@@ -150,6 +291,84 @@ class SimulatorBasic final : public SimulatorBase {
     return 0;
   }
 
+  /**
+   * Computes the expectation value of a Pauli string P using non-vectorized
+   * instructions.
+   * The amplitudes are paired by the X and Y operators and the expectation
+   * value is computed in one read-only pass over the state vector; there is
+   * no limit on the number of qubits.
+   * @param qs Indices of the qubits the Pauli string acts on; should be
+   *   distinct.
+   * @param paulis Pauli operators acting on the qubits: 1 for X, 2 for Y and
+   *   3 for Z.
+   * @param state The state of the system.
+   * @return The computed expectation value <state|P|state>.
+   */
+  double ExpectationValuePauli(const std::vector<unsigned>& qs,
+                               const unsigned* paulis,
+                               const State& state) const {
+    uint64_t xmask, zmask;
+    GetPauliMasks(qs, paulis, xmask, zmask);
+
+    return ExpectationValuesPauli(xmask, {zmask}, state)[0];
+  }
+
+  /**
+   * Computes the expectation values of Pauli strings with the same X and Y
+   * operators using non-vectorized instructions. The amplitude pair products
+   * are shared by all the strings; up to 16 strings are evaluated in one
+   * read-only pass over the state vector.
+   * @param xmask Mask of the qubits acted on by X or Y operators; the same
+   *   for all the Pauli strings.
+   * @param zmasks Masks of the qubits acted on by Y or Z operators, one mask
+   *   per Pauli string.
+   * @param state The state of the system.
+   * @return The computed expectation values, one value per Pauli string.
+   */
+  std::vector<double> ExpectationValuesPauli(
+      uint64_t xmask, const std::vector<uint64_t>& zmasks,
+      const State& state) const {
+    PauliExpectationMatrix<fp_type> pe;
+    FillPauliExpectationMatrix<0>(xmask, zmasks, pe);
+
+    unsigned n = state.num_qubits();
+    if (pe.xmaskh != 0) --n;
+
+    std::vector<double> results(zmasks.size(), 0);
+
+    std::size_t i = 0;
+
+    for (; i + 16 <= zmasks.size(); i += 16) {
+      ExpectationValuesPauliN<16>(n, pe, i, state, results.data());
+    }
+
+    for (; i + 4 <= zmasks.size(); i += 4) {
+      ExpectationValuesPauliN<4>(n, pe, i, state, results.data());
+    }
+
+    for (; i < zmasks.size(); ++i) {
+      ExpectationValuesPauliN<1>(n, pe, i, state, results.data());
+    }
+
+    return results;
+  }
+
+  /**
+   * Computes the reduced density matrix of the given qubits in one read-only
+   * pass over the state vector.
+   * @param qs Indices of the qubits; should be sorted in increasing order.
+   *   There should be at most four qubits.
+   * @param state The state of the system.
+   * @return The 2^k x 2^k reduced density matrix (k = qs.size()) in row-major
+   *   order; bit j of the row and column indices corresponds to qs[j].
+   *   The vector is empty if there are more than four qubits.
+   */
+  std::vector<std::complex<double>> ReducedDensityMatrix(
+      const std::vector<unsigned>& qs, const State& state) const {
+    return ComputeReducedDensityMatrix<0>(for_, state.num_qubits(), qs,
+                                          state.get());
+  }
+
   /**
    * @return The size of SIMD register if applicable.
    */
@@ -157,6 +376,13 @@ class SimulatorBasic final : public SimulatorBase {
     return 1;
   }
 
+  /**
+   * @return The object that runs the parallel loops of this simulator.
+   */
+  const For& GetFor() const {
+    return for_;
+  }
+
  private:
   template <unsigned H>
   void ApplyGateH(const std::vector<unsigned>& qs,
@@ -335,6 +561,95 @@ class SimulatorBasic final : public SimulatorBase {
     return for_.RunReduce(size, f, Op(), matrix, ms, xss, state.get());
   }
 
+  template <unsigned H>
+  void ApplyPermutationGateH(const PermutationMatrix<fp_type>& pm,
+                             State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const uint64_t* ms,
+                const uint64_t* xss, const unsigned* sources,
+                const fp_type* w, fp_type* rstate) {
+      constexpr unsigned hsize = 1 << H;
+
+      fp_type rn, in;
+      fp_type rs[hsize], is[hsize];
+
+      uint64_t ii = i & ms[0];
+      for (unsigned j = 1; j <= H; ++j) {
+        i *= 2;
+        ii |= i & ms[j];
+      }
+
+      auto p0 = rstate + 2 * ii;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rs[k] = *(p0 + xss[k]);
+        is[k] = *(p0 + xss[k] + 1);
+      }
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        unsigned l = sources[k];
+
+        rn = rs[l] * w[2 * k] - is[l] * w[2 * k + 1];
+        in = rs[l] * w[2 * k + 1] + is[l] * w[2 * k];
+
+        *(p0 + xss[k]) = rn;
+        *(p0 + xss[k] + 1) = in;
+      }
+    };
+
+    unsigned n = state.num_qubits() > H ? state.num_qubits() - H : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, pm.ms.data(), pm.xss.data(), pm.sources.data(),
+             pm.phases.data(), state.get());
+  }
+
+  template <unsigned N>
+  void ExpectationValuesPauliN(unsigned nb,
+                               const PauliExpectationMatrix<fp_type>& pe,
+                               std::size_t i0, const State& state,
+                               double* results) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, unsigned c,
+                uint64_t xmaskh, uint64_t mlow, const unsigned* lanes,
+                const uint64_t* zmaskh, const fp_type* w,
+                const fp_type* rstate) -> PauliExpectationSums<N> {
+      PauliExpectationSums<N> sums;
+
+      for (uint64_t j = i << c; j < (i + 1) << c; ++j) {
+        uint64_t t = GetPauliRotationIndex(j, mlow);
+        uint64_t s = t ^ xmaskh;
+
+        auto pt = rstate + 2 * t;
+        auto ps = rstate + 2 * s;
+
+        // Real and imaginary parts of conj(a_t) a_s.
+        fp_type rq = pt[0] * ps[0] + pt[1] * ps[1];
+        fp_type iq = pt[0] * ps[1] - pt[1] * ps[0];
+
+        for (unsigned k = 0; k < N; ++k) {
+          fp_type v = rq * w[2 * k] + iq * w[2 * k + 1];
+          fp_type sign = 1 - 2 * fp_type(bits::Parity(t & zmaskh[k]));
+
+          sums.s[k] += sign * v;
+        }
+      }
+
+      return sums;
+    };
+
+    // Each iteration processes 2^c of the 2^nb pairs of blocks.
+    unsigned c = nb > 4 ? 4 : nb;
+    uint64_t size = uint64_t{1} << (nb - c);
+
+    using Op = PauliExpectationSumsPlus<N>;
+    auto sums = for_.RunReduce(size, f, Op(), c, pe.xmaskh, pe.mlow,
+                               pe.lanes.data(), pe.zmaskh.data() + i0,
+                               pe.w.data() + 2 * i0, state.get());
+
+    for (unsigned k = 0; k < N; ++k) {
+      results[i0 + k] = sums.s[k];
+    }
+  }
+
   For for_;
 };
 
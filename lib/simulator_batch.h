@@ -0,0 +1,563 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMULATOR_BATCH_H_
+#define SIMULATOR_BATCH_H_
+
+#if defined(__AVX2__) || defined(__AVX512F__)
+# include <immintrin.h>
+#endif
+
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+#include "simulator.h"
+#include "statespace_batch.h"
+
+namespace qsim {
+
+namespace detail {
+
+/**
+ * Vectors of B lanes of the batch kernels. The real (or imaginary) parts of
+ * an amplitude of all the lanes make up one vector. This generic version
+ * relies on the compiler to vectorize the loops over lanes; there are
+ * SIMD specializations below.
+ */
+template <typename FP, unsigned B>
+struct BatchLanes {
+  struct Vector {
+    FP v[B];
+  };
+
+  static Vector Load(const FP* p) {
+    Vector r;
+    for (unsigned l = 0; l < B; ++l) r.v[l] = p[l];
+    return r;
+  }
+
+  static Vector LoadU(const FP* p) {
+    return Load(p);
+  }
+
+  static void Store(FP* p, const Vector& a) {
+    for (unsigned l = 0; l < B; ++l) p[l] = a.v[l];
+  }
+
+  static Vector Set1(FP x) {
+    Vector r;
+    for (unsigned l = 0; l < B; ++l) r.v[l] = x;
+    return r;
+  }
+
+  static Vector Zero() {
+    return Set1(0);
+  }
+
+  static Vector Sub(const Vector& a, const Vector& b) {
+    Vector r;
+    for (unsigned l = 0; l < B; ++l) r.v[l] = a.v[l] - b.v[l];
+    return r;
+  }
+
+  static Vector Mul(const Vector& a, const Vector& b) {
+    Vector r;
+    for (unsigned l = 0; l < B; ++l) r.v[l] = a.v[l] * b.v[l];
+    return r;
+  }
+
+  // a * b + c.
+  static Vector FMAdd(const Vector& a, const Vector& b, const Vector& c) {
+    Vector r;
+    for (unsigned l = 0; l < B; ++l) r.v[l] = a.v[l] * b.v[l] + c.v[l];
+    return r;
+  }
+
+  // -a * b + c.
+  static Vector FNMAdd(const Vector& a, const Vector& b, const Vector& c) {
+    Vector r;
+    for (unsigned l = 0; l < B; ++l) r.v[l] = c.v[l] - a.v[l] * b.v[l];
+    return r;
+  }
+};
+
+#ifdef __AVX2__
+
+template <>
+struct BatchLanes<float, 8> {
+  using Vector = __m256;
+
+  static Vector Load(const float* p) { return _mm256_load_ps(p); }
+  static Vector LoadU(const float* p) { return _mm256_loadu_ps(p); }
+  static void Store(float* p, Vector a) { _mm256_store_ps(p, a); }
+  static Vector Set1(float x) { return _mm256_set1_ps(x); }
+  static Vector Zero() { return _mm256_setzero_ps(); }
+  static Vector Sub(Vector a, Vector b) { return _mm256_sub_ps(a, b); }
+  static Vector Mul(Vector a, Vector b) { return _mm256_mul_ps(a, b); }
+
+  static Vector FMAdd(Vector a, Vector b, Vector c) {
+    return _mm256_fmadd_ps(a, b, c);
+  }
+
+  static Vector FNMAdd(Vector a, Vector b, Vector c) {
+    return _mm256_fnmadd_ps(a, b, c);
+  }
+};
+
+template <>
+struct BatchLanes<double, 4> {
+  using Vector = __m256d;
+
+  static Vector Load(const double* p) { return _mm256_load_pd(p); }
+  static Vector LoadU(const double* p) { return _mm256_loadu_pd(p); }
+  static void Store(double* p, Vector a) { _mm256_store_pd(p, a); }
+  static Vector Set1(double x) { return _mm256_set1_pd(x); }
+  static Vector Zero() { return _mm256_setzero_pd(); }
+  static Vector Sub(Vector a, Vector b) { return _mm256_sub_pd(a, b); }
+  static Vector Mul(Vector a, Vector b) { return _mm256_mul_pd(a, b); }
+
+  static Vector FMAdd(Vector a, Vector b, Vector c) {
+    return _mm256_fmadd_pd(a, b, c);
+  }
+
+  static Vector FNMAdd(Vector a, Vector b, Vector c) {
+    return _mm256_fnmadd_pd(a, b, c);
+  }
+};
+
+#endif  // __AVX2__
+
+#ifdef __AVX512F__
+
+template <>
+struct BatchLanes<float, 16> {
+  using Vector = __m512;
+
+  static Vector Load(const float* p) { return _mm512_load_ps(p); }
+  static Vector LoadU(const float* p) { return _mm512_loadu_ps(p); }
+  static void Store(float* p, Vector a) { _mm512_store_ps(p, a); }
+  static Vector Set1(float x) { return _mm512_set1_ps(x); }
+  static Vector Zero() { return _mm512_setzero_ps(); }
+  static Vector Sub(Vector a, Vector b) { return _mm512_sub_ps(a, b); }
+  static Vector Mul(Vector a, Vector b) { return _mm512_mul_ps(a, b); }
+
+  static Vector FMAdd(Vector a, Vector b, Vector c) {
+    return _mm512_fmadd_ps(a, b, c);
+  }
+
+  static Vector FNMAdd(Vector a, Vector b, Vector c) {
+    return _mm512_fnmadd_ps(a, b, c);
+  }
+};
+
+template <>
+struct BatchLanes<double, 8> {
+  using Vector = __m512d;
+
+  static Vector Load(const double* p) { return _mm512_load_pd(p); }
+  static Vector LoadU(const double* p) { return _mm512_loadu_pd(p); }
+  static void Store(double* p, Vector a) { _mm512_store_pd(p, a); }
+  static Vector Set1(double x) { return _mm512_set1_pd(x); }
+  static Vector Zero() { return _mm512_setzero_pd(); }
+  static Vector Sub(Vector a, Vector b) { return _mm512_sub_pd(a, b); }
+  static Vector Mul(Vector a, Vector b) { return _mm512_mul_pd(a, b); }
+
+  static Vector FMAdd(Vector a, Vector b, Vector c) {
+    return _mm512_fmadd_pd(a, b, c);
+  }
+
+  static Vector FNMAdd(Vector a, Vector b, Vector c) {
+    return _mm512_fnmadd_pd(a, b, c);
+  }
+};
+
+#endif  // __AVX512F__
+
+}  // namespace detail
+
+/**
+ * Quantum circuit simulator for batches of B state vectors, see
+ * StateSpaceBatch. A gate common to all the lanes is applied in one pass;
+ * the kernels operate on vectors of B lanes (__m256 for eight floats with
+ * AVX2 and __m512 for sixteen floats with AVX512, see detail::BatchLanes).
+ * Gates can also be applied to a subset of lanes given by a per-lane mask,
+ * which is used for Kraus operators that differ between quantum
+ * trajectories.
+ */
+template <typename For, typename FP, unsigned B>
+class SimulatorBatch final : public SimulatorBase {
+ public:
+  using StateSpace = StateSpaceBatch<For, FP, B>;
+  using State = typename StateSpace::State;
+  using fp_type = typename StateSpace::fp_type;
+
+  static constexpr unsigned kBatchSize = B;
+
+  // The largest number of target qubits of gates.
+  static constexpr unsigned kMaxGateQubits = 6;
+
+  template <typename... ForArgs>
+  explicit SimulatorBatch(ForArgs&&... args) : for_(args...) {}
+
+  /**
+   * Applies a gate to all the lanes.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param matrix Matrix representation of the gate to be applied.
+   * @param state The batch of state vectors to be updated.
+   */
+  void ApplyGate(const std::vector<unsigned>& qs,
+                 const fp_type* matrix, State& state) const {
+    ApplyGateMasked(qs, {}, 0, matrix, nullptr, state);
+  }
+
+  /**
+   * Applies a controlled gate to all the lanes.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param cqs Indices of control qubits.
+   * @param cvals Bit mask of control qubit values.
+   * @param matrix Matrix representation of the gate to be applied.
+   * @param state The batch of state vectors to be updated.
+   */
+  void ApplyControlledGate(const std::vector<unsigned>& qs,
+                           const std::vector<unsigned>& cqs, uint64_t cvals,
+                           const fp_type* matrix, State& state) const {
+    ApplyGateMasked(qs, cqs, cvals, matrix, nullptr, state);
+  }
+
+  /**
+   * Applies a (controlled) gate to the lanes given by a mask.
+   * @param qs Indices of the qubits affected by this gate; should be sorted
+   *   in increasing order. There should be at most kMaxGateQubits qubits.
+   * @param cqs Indices of control qubits; can be empty.
+   * @param cvals Bit mask of control qubit values.
+   * @param matrix Matrix representation of the gate to be applied.
+   * @param mask B values, one per lane: one if the gate is applied to
+   *   the lane and zero otherwise; nullptr for all the lanes.
+   * @param state The batch of state vectors to be updated.
+   */
+  void ApplyGateMasked(const std::vector<unsigned>& qs,
+                       const std::vector<unsigned>& cqs, uint64_t cvals,
+                       const fp_type* matrix, const fp_type* mask,
+                       State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    switch (qs.size()) {
+    case 1:
+      ApplyGateH<1, false>(qs, cqs, cvals, matrix, mask, state);
+      break;
+    case 2:
+      ApplyGateH<2, false>(qs, cqs, cvals, matrix, mask, state);
+      break;
+    case 3:
+      ApplyGateH<3, false>(qs, cqs, cvals, matrix, mask, state);
+      break;
+    case 4:
+      ApplyGateH<4, false>(qs, cqs, cvals, matrix, mask, state);
+      break;
+    case 5:
+      ApplyGateH<5, false>(qs, cqs, cvals, matrix, mask, state);
+      break;
+    case 6:
+      ApplyGateH<6, false>(qs, cqs, cvals, matrix, mask, state);
+      break;
+    default:
+      // Not implemented.
+      break;
+    }
+  }
+
+  /**
+   * Applies a gate with a different matrix in each lane, for instance,
+   * a product of gates and of Kraus operators that differ between quantum
+   * trajectories.
+   * @param qs Indices of the qubits affected by this gate; should be sorted
+   *   in increasing order. There should be at most kMaxGateQubits qubits.
+   * @param matrices The gate matrices of all the lanes; element j of
+   *   the matrix in lane l is matrices[B * j + l].
+   * @param state The batch of state vectors to be updated.
+   */
+  void ApplyLaneGate(const std::vector<unsigned>& qs,
+                     const fp_type* matrices, State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    switch (qs.size()) {
+    case 1:
+      ApplyGateH<1, true>(qs, {}, 0, matrices, nullptr, state);
+      break;
+    case 2:
+      ApplyGateH<2, true>(qs, {}, 0, matrices, nullptr, state);
+      break;
+    case 3:
+      ApplyGateH<3, true>(qs, {}, 0, matrices, nullptr, state);
+      break;
+    case 4:
+      ApplyGateH<4, true>(qs, {}, 0, matrices, nullptr, state);
+      break;
+    case 5:
+      ApplyGateH<5, true>(qs, {}, 0, matrices, nullptr, state);
+      break;
+    case 6:
+      ApplyGateH<6, true>(qs, {}, 0, matrices, nullptr, state);
+      break;
+    default:
+      // Not implemented.
+      break;
+    }
+  }
+
+  /**
+   * Computes the expectation values <state|M|state> of a matrix M in all
+   * the lanes in one read-only pass over the batch of state vectors.
+   * @param qs Indices of the qubits the matrix acts on; should be sorted in
+   *   increasing order. There should be at most kMaxGateQubits qubits.
+   * @param matrix The matrix.
+   * @param state The batch of state vectors.
+   * @return The computed expectation values, one value per lane.
+   */
+  std::vector<std::complex<double>> ExpectationValues(
+      const std::vector<unsigned>& qs, const fp_type* matrix,
+      const State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    switch (qs.size()) {
+    case 1:
+      return ExpectationValuesH<1>(qs, matrix, state);
+      break;
+    case 2:
+      return ExpectationValuesH<2>(qs, matrix, state);
+      break;
+    case 3:
+      return ExpectationValuesH<3>(qs, matrix, state);
+      break;
+    case 4:
+      return ExpectationValuesH<4>(qs, matrix, state);
+      break;
+    case 5:
+      return ExpectationValuesH<5>(qs, matrix, state);
+      break;
+    case 6:
+      return ExpectationValuesH<6>(qs, matrix, state);
+      break;
+    default:
+      // Not implemented.
+      break;
+    }
+
+    return std::vector<std::complex<double>>(B, 0);
+  }
+
+  /**
+   * @return The number of lanes.
+   */
+  static unsigned SIMDRegisterSize() {
+    return B;
+  }
+
+ private:
+  using Lanes = detail::BatchLanes<fp_type, B>;
+  using Vector = typename Lanes::Vector;
+
+  template <bool LaneMatrices>
+  static Vector LoadMatrixElement(const fp_type* v, uint64_t j) {
+    return LaneMatrices ? Lanes::LoadU(v + B * j) : Lanes::Set1(v[j]);
+  }
+
+  // Applies a gate with the same matrix in all the lanes if LaneMatrices is
+  // false and with per-lane matrices (see ApplyLaneGate) otherwise.
+  template <unsigned H, bool LaneMatrices>
+  void ApplyGateH(const std::vector<unsigned>& qs,
+                  const std::vector<unsigned>& cqs, uint64_t cvals,
+                  const fp_type* matrix, const fp_type* mask,
+                  State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* v,
+                const uint64_t* ms, const uint64_t* xss, uint64_t cvalsh,
+                uint64_t cmaskh, const fp_type* mask, fp_type* rstate) {
+      constexpr unsigned hsize = 1 << H;
+
+      Vector ru, iu, rn, in;
+      Vector rs[hsize], is[hsize];
+
+      uint64_t ii = i & ms[0];
+      for (unsigned j = 1; j <= H; ++j) {
+        i *= 2;
+        ii |= i & ms[j];
+      }
+
+      if ((ii & cmaskh) != cvalsh) return;
+
+      auto p0 = rstate + 2 * B * ii;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        auto p = p0 + B * xss[k];
+
+        rs[k] = Lanes::Load(p);
+        is[k] = Lanes::Load(p + B);
+      }
+
+      uint64_t j = 0;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        ru = LoadMatrixElement<LaneMatrices>(v, j);
+        iu = LoadMatrixElement<LaneMatrices>(v, j + 1);
+        rn = Lanes::Mul(rs[0], ru);
+        in = Lanes::Mul(rs[0], iu);
+        rn = Lanes::FNMAdd(is[0], iu, rn);
+        in = Lanes::FMAdd(is[0], ru, in);
+
+        j += 2;
+
+        for (unsigned q = 1; q < hsize; ++q) {
+          ru = LoadMatrixElement<LaneMatrices>(v, j);
+          iu = LoadMatrixElement<LaneMatrices>(v, j + 1);
+          rn = Lanes::FMAdd(rs[q], ru, rn);
+          in = Lanes::FMAdd(rs[q], iu, in);
+          rn = Lanes::FNMAdd(is[q], iu, rn);
+          in = Lanes::FMAdd(is[q], ru, in);
+
+          j += 2;
+        }
+
+        auto p = p0 + B * xss[k];
+
+        if (mask != nullptr) {
+          // rs + mask * (rn - rs).
+          auto w = Lanes::LoadU(mask);
+          rn = Lanes::FMAdd(w, Lanes::Sub(rn, rs[k]), rs[k]);
+          in = Lanes::FMAdd(w, Lanes::Sub(in, is[k]), is[k]);
+        }
+
+        Lanes::Store(p, rn);
+        Lanes::Store(p + B, in);
+      }
+    };
+
+    uint64_t ms[H + 1];
+    uint64_t xss[1 << H];
+
+    FillIndices<H>(state.num_qubits(), qs, ms, xss);
+
+    uint64_t cmaskh = 0;
+    uint64_t cvalsh = 0;
+
+    for (std::size_t k = 0; k < cqs.size(); ++k) {
+      cmaskh |= uint64_t{1} << cqs[k];
+      cvalsh |= ((cvals >> k) & 1) << cqs[k];
+    }
+
+    unsigned n = state.num_qubits() > H ? state.num_qubits() - H : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, matrix, ms, xss, cvalsh, cmaskh, mask, state.get());
+  }
+
+  template <unsigned H>
+  std::vector<std::complex<double>> ExpectationValuesH(
+      const std::vector<unsigned>& qs, const fp_type* matrix,
+      const State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* v,
+                const uint64_t* ms, const uint64_t* xss,
+                const fp_type* rstate) -> BatchSums<2 * B> {
+      constexpr unsigned hsize = 1 << H;
+
+      Vector ru, iu, rn, in;
+      Vector rs[hsize], is[hsize];
+
+      uint64_t ii = i & ms[0];
+      for (unsigned j = 1; j <= H; ++j) {
+        i *= 2;
+        ii |= i & ms[j];
+      }
+
+      auto p0 = rstate + 2 * B * ii;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        auto p = p0 + B * xss[k];
+
+        rs[k] = Lanes::Load(p);
+        is[k] = Lanes::Load(p + B);
+      }
+
+      Vector re = Lanes::Zero();
+      Vector ie = Lanes::Zero();
+
+      uint64_t j = 0;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        ru = Lanes::Set1(v[j]);
+        iu = Lanes::Set1(v[j + 1]);
+        rn = Lanes::Mul(rs[0], ru);
+        in = Lanes::Mul(rs[0], iu);
+        rn = Lanes::FNMAdd(is[0], iu, rn);
+        in = Lanes::FMAdd(is[0], ru, in);
+
+        j += 2;
+
+        for (unsigned q = 1; q < hsize; ++q) {
+          ru = Lanes::Set1(v[j]);
+          iu = Lanes::Set1(v[j + 1]);
+          rn = Lanes::FMAdd(rs[q], ru, rn);
+          in = Lanes::FMAdd(rs[q], iu, in);
+          rn = Lanes::FNMAdd(is[q], iu, rn);
+          in = Lanes::FMAdd(is[q], ru, in);
+
+          j += 2;
+        }
+
+        // conj(a_k) (M a)_k.
+        re = Lanes::FMAdd(rs[k], rn, re);
+        re = Lanes::FMAdd(is[k], in, re);
+        ie = Lanes::FMAdd(rs[k], in, ie);
+        ie = Lanes::FNMAdd(is[k], rn, ie);
+      }
+
+      alignas(64) fp_type buf[2 * B];
+      Lanes::Store(buf, re);
+      Lanes::Store(buf + B, ie);
+
+      BatchSums<2 * B> sums;
+
+      for (unsigned l = 0; l < 2 * B; ++l) {
+        sums.s[l] = buf[l];
+      }
+
+      return sums;
+    };
+
+    uint64_t ms[H + 1];
+    uint64_t xss[1 << H];
+
+    FillIndices<H>(state.num_qubits(), qs, ms, xss);
+
+    unsigned n = state.num_qubits() > H ? state.num_qubits() - H : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    using Op = BatchSumsPlus<2 * B>;
+    auto sums = for_.RunReduce(size, f, Op(), matrix, ms, xss, state.get());
+
+    std::vector<std::complex<double>> results(B);
+
+    for (unsigned l = 0; l < B; ++l) {
+      results[l] = {sums.s[l], sums.s[B + l]};
+    }
+
+    return results;
+  }
+
+  For for_;
+};
+
+}  // namespace qsim
+
+#endif  // SIMULATOR_BATCH_H_
@@ -49,7 +49,10 @@ class SimulatorCUDA final {
   using State = typename StateSpace::State;
   using fp_type = typename StateSpace::fp_type;
 
-  SimulatorCUDA() : scratch_(nullptr), scratch_size_(0) {
+  // The maximum number of qubits of gates that ApplyGate can apply.
+  static constexpr unsigned kMaxGateQubits = 6;
+
+  SimulatorCUDA(): scratch_(nullptr), scratch_size_(0) {
     ErrorCheck(cudaMalloc(&d_ws, max_buf_size));
   }
 
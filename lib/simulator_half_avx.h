@@ -0,0 +1,66 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMULATOR_HALF_AVX_H_
+#define SIMULATOR_HALF_AVX_H_
+
+#include <immintrin.h>
+
+#include "simulator_avx.h"
+#include "statespace_half_avx.h"
+
+namespace qsim {
+
+/**
+ * Load/store policy for half-precision (float16 or bfloat16) state vectors.
+ * Amplitudes are widened to float when loaded into registers and narrowed
+ * when stored.
+ */
+template <typename For, typename Half>
+struct HalfLoadStoreAVX {
+  using StateSpace = StateSpaceHalfAVX<For, Half>;
+  using storage_type = Half;
+
+  static __m256 Load(const Half* p) {
+    return detail::LoadHalfAVX(p);
+  }
+
+  static void Store(Half* p, __m256 v) {
+    detail::StoreHalfAVX(p, v);
+  }
+
+  static float StorageScale(unsigned num_qubits) {
+    return StateSpace::StorageScale(num_qubits);
+  }
+};
+
+/**
+ * Quantum circuit simulator with AVX vectorization and half-precision
+ * (float16 or bfloat16) state-vector storage. The kernels are the kernels
+ * of SimulatorAVX<For, float> with the HalfLoadStoreAVX policy.
+ */
+template <typename For, typename Half>
+class SimulatorHalfAVX final
+    : public SimulatorAVXFloat<For, HalfLoadStoreAVX<For, Half>> {
+ private:
+  using Base = SimulatorAVXFloat<For, HalfLoadStoreAVX<For, Half>>;
+
+ public:
+  template <typename... ForArgs>
+  explicit SimulatorHalfAVX(ForArgs&&... args) : Base(args...) {}
+};
+
+}  // namespace qsim
+
+#endif  // SIMULATOR_HALF_AVX_H_
@@ -0,0 +1,66 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMULATOR_HALF_AVX512_H_
+#define SIMULATOR_HALF_AVX512_H_
+
+#include <immintrin.h>
+
+#include "simulator_avx512.h"
+#include "statespace_half_avx512.h"
+
+namespace qsim {
+
+/**
+ * Load/store policy for half-precision (float16 or bfloat16) state vectors.
+ * Amplitudes are widened to float when loaded into registers and narrowed
+ * when stored.
+ */
+template <typename For, typename Half>
+struct HalfLoadStoreAVX512 {
+  using StateSpace = StateSpaceHalfAVX512<For, Half>;
+  using storage_type = Half;
+
+  static __m512 Load(const Half* p) {
+    return detail::LoadHalfAVX512(p);
+  }
+
+  static void Store(Half* p, __m512 v) {
+    detail::StoreHalfAVX512(p, v);
+  }
+
+  static float StorageScale(unsigned num_qubits) {
+    return StateSpace::StorageScale(num_qubits);
+  }
+};
+
+/**
+ * Quantum circuit simulator with AVX512 vectorization and half-precision
+ * (float16 or bfloat16) state-vector storage. The kernels are the kernels
+ * of SimulatorAVX512<For, float> with the HalfLoadStoreAVX512 policy.
+ */
+template <typename For, typename Half>
+class SimulatorHalfAVX512 final
+    : public SimulatorAVX512Float<For, HalfLoadStoreAVX512<For, Half>> {
+ private:
+  using Base = SimulatorAVX512Float<For, HalfLoadStoreAVX512<For, Half>>;
+
+ public:
+  template <typename... ForArgs>
+  explicit SimulatorHalfAVX512(ForArgs&&... args) : Base(args...) {}
+};
+
+}  // namespace qsim
+
+#endif  // SIMULATOR_HALF_AVX512_H_
@@ -103,6 +103,24 @@ class SimulatorSSE final : public SimulatorBase {
         ApplyGateL<4, 2>(qs, matrix, state);
       }
       break;
+    case 7:
+      if (qs[0] > 1) {
+        ApplyGateH<7>(qs, matrix, state);
+      } else if (qs[1] > 1) {
+        ApplyGateL<6, 1>(qs, matrix, state);
+      } else {
+        ApplyGateL<5, 2>(qs, matrix, state);
+      }
+      break;
+    case 8:
+      if (qs[0] > 1) {
+        ApplyGateH<8>(qs, matrix, state);
+      } else if (qs[1] > 1) {
+        ApplyGateL<7, 1>(qs, matrix, state);
+      } else {
+        ApplyGateL<6, 2>(qs, matrix, state);
+      }
+      break;
     default:
       // Not implemented.
       break;
@@ -213,6 +231,182 @@ class SimulatorSSE final : public SimulatorBase {
     }
   }
 
+  /**
+   * Applies a diagonal gate using SSE instructions.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param diag Diagonal entries of the gate matrix; the real part of each
+   *   entry is followed by its imaginary part.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyDiagonalGate(const std::vector<unsigned>& qs,
+                         const fp_type* diag, State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, const fp_type* w,
+                uint64_t qmaskh, fp_type* rstate) {
+      auto v = w + 8 * GetDiagonalIndex(i, qmaskh);
+      auto p = rstate + 8 * i;
+
+      __m128 ru = _mm_loadu_ps(v);
+      __m128 iu = _mm_loadu_ps(v + 4);
+      __m128 rs = _mm_load_ps(p);
+      __m128 is = _mm_load_ps(p + 4);
+
+      __m128 rn = _mm_sub_ps(_mm_mul_ps(rs, ru), _mm_mul_ps(is, iu));
+      __m128 in = _mm_add_ps(_mm_mul_ps(rs, iu), _mm_mul_ps(is, ru));
+
+      _mm_store_ps(p, rn);
+      _mm_store_ps(p + 4, in);
+    };
+
+    std::vector<fp_type> w;
+    uint64_t qmaskh = FillDiagonalMatrix<2>(qs, diag, w);
+
+    unsigned k = 2;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, w.data(), qmaskh, state.get());
+  }
+
+  /**
+   * Applies a permutation gate using SSE instructions. Permutation gates
+   * (X, Y, CNOT, SWAP, ISWAP, CCX, CSWAP, ...) have exactly one nonzero
+   * element in each row and each column of the gate matrix.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param perm Permutation; the nonzero element of the k-th row of the gate
+   *   matrix is in column perm[k].
+   * @param phases Nonzero elements of the gate matrix; the real part of each
+   *   element is followed by its imaginary part.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyPermutationGate(const std::vector<unsigned>& qs,
+                            const unsigned* perm, const fp_type* phases,
+                            State& state) const {
+    // Assume qs[0] < qs[1] < qs[2] < ... .
+
+    PermutationMatrix<fp_type> pm;
+    unsigned h = FillPermutationMatrix<2>(
+        state.num_qubits(), qs, perm, phases, pm);
+
+    // Convert the source lanes to the byte shuffle control masks.
+    for (std::size_t i = 0; i < pm.lanes.size(); ++i) {
+      pm.lanes[i] = 0x03020100 + 0x04040404 * pm.lanes[i];
+    }
+
+    switch (h) {
+    case 0:
+      ApplyPermutationGateH<0>(pm, state);
+      break;
+    case 1:
+      ApplyPermutationGateH<1>(pm, state);
+      break;
+    case 2:
+      ApplyPermutationGateH<2>(pm, state);
+      break;
+    case 3:
+      ApplyPermutationGateH<3>(pm, state);
+      break;
+    case 4:
+      ApplyPermutationGateH<4>(pm, state);
+      break;
+    case 5:
+      ApplyPermutationGateH<5>(pm, state);
+      break;
+    case 6:
+      ApplyPermutationGateH<6>(pm, state);
+      break;
+    default:
+      // Not implemented.
+      break;
+    }
+  }
+
+  /**
+   * Applies the rotation exp(-i theta P) about a Pauli string P using
+   * SSE instructions; see gate::PauliRotation in gate.h. The amplitudes
+   * are paired by the X and Y operators and updated in one pass over
+   * the state vector.
+   * @param qs Indices of the qubits affected by this gate.
+   * @param paulis Pauli operators acting on the qubits: 1 for X, 2 for Y and
+   *   3 for Z.
+   * @param theta The rotation angle.
+   * @param state The state of the system, to be updated by this method.
+   */
+  void ApplyPauliRotation(const std::vector<unsigned>& qs,
+                          const unsigned* paulis, fp_type theta,
+                          State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, uint64_t xmaskh,
+                uint64_t zmaskh, uint64_t mlow, fp_type c,
+                const unsigned* lanes, const fp_type* w, fp_type* rstate) {
+      uint64_t t = GetPauliRotationIndex(i, mlow);
+      uint64_t s = t ^ xmaskh;
+
+      auto pt = rstate + 8 * t;
+      auto ps = rstate + 8 * s;
+
+      __m128i idx = _mm_loadu_si128((const __m128i*) lanes);
+      __m128 cc = _mm_set1_ps(c);
+
+      __m128 rt = _mm_load_ps(pt);
+      __m128 it = _mm_load_ps(pt + 4);
+      __m128 rs = _mm_load_ps(ps);
+      __m128 is = _mm_load_ps(ps + 4);
+
+      auto wt = w + 8 * bits::Parity(s & zmaskh);
+
+      __m128 ru = _mm_loadu_ps(wt);
+      __m128 iu = _mm_loadu_ps(wt + 4);
+      __m128 rp = _mm_castsi128_ps(
+          _mm_shuffle_epi8(_mm_castps_si128(rs), idx));
+      __m128 ip = _mm_castsi128_ps(
+          _mm_shuffle_epi8(_mm_castps_si128(is), idx));
+
+      __m128 rn = _mm_add_ps(_mm_mul_ps(rt, cc), _mm_mul_ps(rp, ru));
+      __m128 in = _mm_add_ps(_mm_mul_ps(it, cc), _mm_mul_ps(rp, iu));
+      rn = _mm_sub_ps(rn, _mm_mul_ps(ip, iu));
+      in = _mm_add_ps(in, _mm_mul_ps(ip, ru));
+
+      if (s != t) {
+        auto ws = w + 8 * bits::Parity(t & zmaskh);
+
+        ru = _mm_loadu_ps(ws);
+        iu = _mm_loadu_ps(ws + 4);
+        rp = _mm_castsi128_ps(
+            _mm_shuffle_epi8(_mm_castps_si128(rt), idx));
+        ip = _mm_castsi128_ps(
+            _mm_shuffle_epi8(_mm_castps_si128(it), idx));
+
+        __m128 rm = _mm_add_ps(_mm_mul_ps(rs, cc), _mm_mul_ps(rp, ru));
+        __m128 im = _mm_add_ps(_mm_mul_ps(is, cc), _mm_mul_ps(rp, iu));
+        rm = _mm_sub_ps(rm, _mm_mul_ps(ip, iu));
+        im = _mm_add_ps(im, _mm_mul_ps(ip, ru));
+
+        _mm_store_ps(ps, rm);
+        _mm_store_ps(ps + 4, im);
+      }
+
+      _mm_store_ps(pt, rn);
+      _mm_store_ps(pt + 4, in);
+    };
+
+    PauliRotationMatrix<fp_type> pr;
+    FillPauliRotationMatrix<2>(qs, paulis, theta, pr);
+
+    // Convert the source lanes to the byte shuffle control masks.
+    for (std::size_t i = 0; i < pr.lanes.size(); ++i) {
+      pr.lanes[i] = 0x03020100 + 0x04040404 * pr.lanes[i];
+    }
+
+    unsigned k = 2;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    if (pr.xmaskh != 0) --n;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, pr.xmaskh, pr.zmaskh, pr.mlow, pr.c, pr.lanes.data(),
+             pr.w.data(), state.get());
+  }
+
   /**
    * Computes the expectation value of an operator using SSE instructions.
    * @param qs Indices of the qubits the operator acts on.
@@ -278,6 +472,24 @@ class SimulatorSSE final : public SimulatorBase {
         return ExpectationValueL<4, 2>(qs, matrix, state);
       }
       break;
+    case 7:
+      if (qs[0] > 1) {
+        return ExpectationValueH<7>(qs, matrix, state);
+      } else if (qs[1] > 1) {
+        return ExpectationValueL<6, 1>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<5, 2>(qs, matrix, state);
+      }
+      break;
+    case 8:
+      if (qs[0] > 1) {
+        return ExpectationValueH<8>(qs, matrix, state);
+      } else if (qs[1] > 1) {
+        return ExpectationValueL<7, 1>(qs, matrix, state);
+      } else {
+        return ExpectationValueL<6, 2>(qs, matrix, state);
+      }
+      break;
     default:
       // Not implemented.
       break;
@@ -286,6 +498,89 @@ class SimulatorSSE final : public SimulatorBase {
     return 0;
   }
 
+  /**
+   * Computes the expectation value of a Pauli string P using SSE instructions.
+   * The amplitudes are paired by the X and Y operators and the expectation
+   * value is computed in one read-only pass over the state vector; there is
+   * no limit on the number of qubits.
+   * @param qs Indices of the qubits the Pauli string acts on; should be
+   *   distinct.
+   * @param paulis Pauli operators acting on the qubits: 1 for X, 2 for Y and
+   *   3 for Z.
+   * @param state The state of the system.
+   * @return The computed expectation value <state|P|state>.
+   */
+  double ExpectationValuePauli(const std::vector<unsigned>& qs,
+                               const unsigned* paulis,
+                               const State& state) const {
+    uint64_t xmask, zmask;
+    GetPauliMasks(qs, paulis, xmask, zmask);
+
+    return ExpectationValuesPauli(xmask, {zmask}, state)[0];
+  }
+
+  /**
+   * Computes the expectation values of Pauli strings with the same X and Y
+   * operators using SSE instructions. The amplitude pair products are shared by
+   * all the strings; up to 16 strings are evaluated in one read-only pass over
+   * the state vector.
+   * @param xmask Mask of the qubits acted on by X or Y operators; the same
+   *   for all the Pauli strings.
+   * @param zmasks Masks of the qubits acted on by Y or Z operators, one mask
+   *   per Pauli string.
+   * @param state The state of the system.
+   * @return The computed expectation values, one value per Pauli string.
+   */
+  std::vector<double> ExpectationValuesPauli(
+      uint64_t xmask, const std::vector<uint64_t>& zmasks,
+      const State& state) const {
+    PauliExpectationMatrix<fp_type> pe;
+    FillPauliExpectationMatrix<2>(xmask, zmasks, pe);
+
+    // Convert the source lanes to the byte shuffle control masks.
+    for (std::size_t i = 0; i < pe.lanes.size(); ++i) {
+      pe.lanes[i] = 0x03020100 + 0x04040404 * pe.lanes[i];
+    }
+
+    unsigned k = 2;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    if (pe.xmaskh != 0) --n;
+
+    std::vector<double> results(zmasks.size(), 0);
+
+    std::size_t i = 0;
+
+    for (; i + 16 <= zmasks.size(); i += 16) {
+      ExpectationValuesPauliN<16>(n, pe, i, state, results.data());
+    }
+
+    for (; i + 4 <= zmasks.size(); i += 4) {
+      ExpectationValuesPauliN<4>(n, pe, i, state, results.data());
+    }
+
+    for (; i < zmasks.size(); ++i) {
+      ExpectationValuesPauliN<1>(n, pe, i, state, results.data());
+    }
+
+    return results;
+  }
+
+  /**
+   * Computes the reduced density matrix of the given qubits in one read-only
+   * pass over the state vector.
+   * @param qs Indices of the qubits; should be sorted in increasing order.
+   *   There should be at most four qubits.
+   * @param state The state of the system.
+   * @return The 2^k x 2^k reduced density matrix (k = qs.size()) in row-major
+   *   order; bit j of the row and column indices corresponds to qs[j].
+   *   The vector is empty if there are more than four qubits.
+   */
+  std::vector<std::complex<double>> ReducedDensityMatrix(
+      const std::vector<unsigned>& qs, const State& state) const {
+    return ComputeReducedDensityMatrix<2>(for_, state.num_qubits(), qs,
+                                          state.get());
+  }
+
   /**
    * @return The size of SIMD register if applicable.
    */
@@ -293,6 +588,13 @@ class SimulatorSSE final : public SimulatorBase {
     return 4;
   }
 
+  /**
+   * @return The object that runs the parallel loops of this simulator.
+   */
+  const For& GetFor() const {
+    return for_;
+  }
+
  private:
   template <unsigned H>
   void ApplyGateH(const std::vector<unsigned>& qs,
@@ -429,7 +731,15 @@ class SimulatorSSE final : public SimulatorBase {
 
     uint64_t ms[H + 1];
     uint64_t xss[1 << H];
-    __m128 w[1 << (1 + 2 * H + L)];
+    MatrixBuffer<sizeof(fp_type) << (1 + 2 * H + L + 2)> wbuf;
+    __m128* w = (__m128*) wbuf.get();
+
+    if (w == nullptr) {
+      // Not enough memory for the expanded matrix.
+      ApplyGateUnexpanded<2>(for_, state.num_qubits(), qs, matrix,
+                             state.get());
+      return;
+    }
 
     auto m = GetMasks11<L>(qs);
 
@@ -831,7 +1141,14 @@ class SimulatorSSE final : public SimulatorBase {
 
     uint64_t ms[H + 1];
     uint64_t xss[1 << H];
-    __m128 w[1 << (1 + 2 * H + L)];
+    MatrixBuffer<sizeof(fp_type) << (1 + 2 * H + L + 2)> wbuf;
+    __m128* w = (__m128*) wbuf.get();
+
+    if (w == nullptr) {
+      // Not enough memory for the expanded matrix.
+      return ExpectationValueUnexpanded<2>(for_, state.num_qubits(), qs,
+                                            matrix, state.get());
+    }
 
     auto m = GetMasks11<L>(qs);
 
@@ -846,6 +1163,137 @@ class SimulatorSSE final : public SimulatorBase {
     return for_.RunReduce(size, f, Op(), w, ms, xss, qs[0], state.get());
   }
 
+  template <unsigned H>
+  void ApplyPermutationGateH(const PermutationMatrix<fp_type>& pm,
+                             State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, const uint64_t* ms,
+                const uint64_t* xss, const unsigned* offsets,
+                const unsigned* sources, const unsigned* lanes,
+                const fp_type* w, fp_type* rstate) {
+      constexpr unsigned hsize = 1 << H;
+
+      __m128 rn, in, rp, ip, ru, iu;
+      __m128 rs[hsize], is[hsize];
+
+      i *= 4;
+
+      uint64_t ii = i & ms[0];
+      for (unsigned j = 1; j <= H; ++j) {
+        i *= 2;
+        ii |= i & ms[j];
+      }
+
+      auto p0 = rstate + 2 * ii;
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rs[k] = _mm_load_ps(p0 + xss[k]);
+        is[k] = _mm_load_ps(p0 + xss[k] + 4);
+      }
+
+      for (unsigned k = 0; k < hsize; ++k) {
+        rn = _mm_setzero_ps();
+        in = _mm_setzero_ps();
+
+        for (unsigned e = offsets[k]; e < offsets[k + 1]; ++e) {
+          __m128i idx = _mm_loadu_si128((const __m128i*) (lanes + 4 * e));
+
+          rp = _mm_castsi128_ps(
+              _mm_shuffle_epi8(_mm_castps_si128(rs[sources[e]]), idx));
+          ip = _mm_castsi128_ps(
+              _mm_shuffle_epi8(_mm_castps_si128(is[sources[e]]), idx));
+          ru = _mm_loadu_ps(w + 8 * e);
+          iu = _mm_loadu_ps(w + 8 * e + 4);
+
+          rn = _mm_add_ps(rn, _mm_mul_ps(rp, ru));
+          in = _mm_add_ps(in, _mm_mul_ps(rp, iu));
+          rn = _mm_sub_ps(rn, _mm_mul_ps(ip, iu));
+          in = _mm_add_ps(in, _mm_mul_ps(ip, ru));
+        }
+
+        _mm_store_ps(p0 + xss[k], rn);
+        _mm_store_ps(p0 + xss[k] + 4, in);
+      }
+    };
+
+    unsigned k = 2 + H;
+    unsigned n = state.num_qubits() > k ? state.num_qubits() - k : 0;
+    uint64_t size = uint64_t{1} << n;
+
+    for_.Run(size, f, pm.ms.data(), pm.xss.data(), pm.offsets.data(),
+             pm.sources.data(), pm.lanes.data(), pm.phases.data(),
+             state.get());
+  }
+
+  template <unsigned N>
+  void ExpectationValuesPauliN(unsigned nb,
+                               const PauliExpectationMatrix<fp_type>& pe,
+                               std::size_t i0, const State& state,
+                               double* results) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, unsigned c,
+                uint64_t xmaskh, uint64_t mlow, const unsigned* lanes,
+                const uint64_t* zmaskh, const fp_type* w,
+                const fp_type* rstate) -> PauliExpectationSums<N> {
+      __m128 acc[N];
+
+      for (unsigned k = 0; k < N; ++k) {
+        acc[k] = _mm_setzero_ps();
+      }
+
+      __m128i idx = _mm_loadu_si128((const __m128i*) lanes);
+
+      for (uint64_t j = i << c; j < (i + 1) << c; ++j) {
+        uint64_t t = GetPauliRotationIndex(j, mlow);
+        uint64_t s = t ^ xmaskh;
+
+        auto pt = rstate + 8 * t;
+        auto ps = rstate + 8 * s;
+
+        __m128 rt = _mm_load_ps(pt);
+        __m128 it = _mm_load_ps(pt + 4);
+        __m128 rs = _mm_load_ps(ps);
+        __m128 is = _mm_load_ps(ps + 4);
+        __m128 rp = _mm_castsi128_ps(
+          _mm_shuffle_epi8(_mm_castps_si128(rs), idx));
+        __m128 ip = _mm_castsi128_ps(
+          _mm_shuffle_epi8(_mm_castps_si128(is), idx));
+
+        // Real and imaginary parts of conj(a_t) a_s.
+        __m128 rq = _mm_add_ps(_mm_mul_ps(it, ip), _mm_mul_ps(rt, rp));
+        __m128 iq = _mm_sub_ps(_mm_mul_ps(rt, ip), _mm_mul_ps(it, rp));
+
+        for (unsigned k = 0; k < N; ++k) {
+          __m128 wr = _mm_loadu_ps(w + 8 * k);
+          __m128 wi = _mm_loadu_ps(w + 8 * k + 4);
+          __m128 v = _mm_add_ps(_mm_mul_ps(rq, wr), _mm_mul_ps(iq, wi));
+          fp_type sign = 1 - 2 * fp_type(bits::Parity(t & zmaskh[k]));
+
+          acc[k] = _mm_add_ps(acc[k], _mm_mul_ps(v, _mm_set1_ps(sign)));
+        }
+      }
+
+      PauliExpectationSums<N> sums;
+
+      for (unsigned k = 0; k < N; ++k) {
+        sums.s[k] = detail::HorizontalSumSSE(acc[k]);
+      }
+
+      return sums;
+    };
+
+    // Each iteration processes 2^c of the 2^nb pairs of blocks.
+    unsigned c = nb > 4 ? 4 : nb;
+    uint64_t size = uint64_t{1} << (nb - c);
+
+    using Op = PauliExpectationSumsPlus<N>;
+    auto sums = for_.RunReduce(size, f, Op(), c, pe.xmaskh, pe.mlow,
+                               pe.lanes.data(), pe.zmaskh.data() + i0,
+                               pe.w.data() + 8 * i0, state.get());
+
+    for (unsigned k = 0; k < N; ++k) {
+      results[i0 + k] = sums.s[k];
+    }
+  }
+
   For for_;
 };
 
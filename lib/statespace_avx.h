@@ -56,8 +56,28 @@ inline double HorizontalSumAVX(__m256 s) {
   return _mm_cvtss_f32(_mm_add_ss(s2, _mm_movehl_ps(s1s, s2)));
 }
 
+inline __m256i GetZeroMaskAVXDouble(
+    uint64_t i, uint64_t mask, uint64_t bits) {
+  __m256i s = _mm256_setr_epi64x(i + 0, i + 1, i + 2, i + 3);
+  __m256i ma = _mm256_set1_epi64x(mask);
+  __m256i bi = _mm256_set1_epi64x(bits);
+
+  return _mm256_cmpeq_epi64(_mm256_and_si256(s, ma), bi);
+}
+
+inline double HorizontalSumAVX(__m256d s) {
+  __m128d l = _mm256_castpd256_pd128(s);
+  __m128d h = _mm256_extractf128_pd(s, 1);
+  __m128d s1 = _mm_add_pd(h, l);
+
+  return _mm_cvtsd_f64(_mm_add_sd(s1, _mm_unpackhi_pd(s1, s1)));
+}
+
 }  // namespace detail
 
+template <typename For, typename FP = float>
+class StateSpaceAVX;
+
 /**
  * Object containing context and routines for AVX state-vector manipulations.
  * State is a vectorized sequence of eight real components followed by eight
@@ -65,7 +85,7 @@ inline double HorizontalSumAVX(__m256 s) {
  * into an AVX register.
  */
 template <typename For>
-class StateSpaceAVX :
+class StateSpaceAVX<For, float> :
     public StateSpace<StateSpaceAVX<For>, VectorSpace, For, float> {
  private:
   using Base = StateSpace<StateSpaceAVX<For>, qsim::VectorSpace, For, float>;
@@ -488,6 +508,408 @@ class StateSpaceAVX :
   }
 };
 
+/**
+ * Object containing context and routines for double-precision AVX
+ * state-vector manipulations. State is a vectorized sequence of four real
+ * components followed by four imaginary components. Four double-precison
+ * floating numbers can be loaded into an AVX register.
+ */
+template <typename For>
+class StateSpaceAVX<For, double> :
+    public StateSpace<StateSpaceAVX<For, double>, VectorSpace, For, double> {
+ private:
+  using Base = StateSpace<StateSpaceAVX<For, double>,
+                          qsim::VectorSpace, For, double>;
+
+ public:
+  using State = typename Base::State;
+  using fp_type = typename Base::fp_type;
+
+  template <typename... ForArgs>
+  explicit StateSpaceAVX(ForArgs&&... args) : Base(args...) {}
+
+  static uint64_t MinSize(unsigned num_qubits) {
+    return std::max(uint64_t{8}, 2 * (uint64_t{1} << num_qubits));
+  };
+
+  void InternalToNormalOrder(State& state) const {
+    if (state.num_qubits() == 1) {
+      auto s = state.get();
+
+      s[2] = s[1];
+      s[1] = s[4];
+      s[3] = s[5];
+
+      for (uint64_t i = 4; i < 8; ++i) {
+        s[i] = 0;
+      }
+    } else {
+      auto f = [](unsigned n, unsigned m, uint64_t i, fp_type* p) {
+        auto s = p + 8 * i;
+
+        fp_type re[3];
+        fp_type im[3];
+
+        for (uint64_t i = 0; i < 3; ++i) {
+          re[i] = s[i + 1];
+          im[i] = s[i + 4];
+        }
+
+        for (uint64_t i = 0; i < 3; ++i) {
+          s[2 * i + 1] = im[i];
+          s[2 * i + 2] = re[i];
+        }
+      };
+
+      Base::for_.Run(MinSize(state.num_qubits()) / 8, f, state.get());
+    }
+  }
+
+  void NormalToInternalOrder(State& state) const {
+    if (state.num_qubits() == 1) {
+      auto s = state.get();
+
+      s[4] = s[1];
+      s[1] = s[2];
+      s[5] = s[3];
+
+      s[2] = 0;
+      s[3] = 0;
+      s[6] = 0;
+      s[7] = 0;
+    } else {
+      auto f = [](unsigned n, unsigned m, uint64_t i, fp_type* p) {
+        auto s = p + 8 * i;
+
+        fp_type re[3];
+        fp_type im[3];
+
+        for (uint64_t i = 0; i < 3; ++i) {
+          im[i] = s[2 * i + 1];
+          re[i] = s[2 * i + 2];
+        }
+
+        for (uint64_t i = 0; i < 3; ++i) {
+          s[i + 1] = re[i];
+          s[i + 4] = im[i];
+        }
+      };
+
+      Base::for_.Run(MinSize(state.num_qubits()) / 8, f, state.get());
+    }
+  }
+
+  void SetAllZeros(State& state) const {
+    __m256d val0 = _mm256_setzero_pd();
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, __m256d val0, fp_type* p) {
+      _mm256_store_pd(p + 8 * i, val0);
+      _mm256_store_pd(p + 8 * i + 4, val0);
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 8, f, val0, state.get());
+  }
+
+  // Uniform superposition.
+  void SetStateUniform(State& state) const {
+    __m256d val0 = _mm256_setzero_pd();
+    __m256d valu;
+
+    fp_type v = double{1} / std::sqrt(uint64_t{1} << state.num_qubits());
+
+    if (state.num_qubits() == 1) {
+      valu = _mm256_set_pd(0, 0, v, v);
+    } else {
+      valu = _mm256_set1_pd(v);
+    }
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                __m256d val0, __m256d valu, fp_type* p) {
+      _mm256_store_pd(p + 8 * i, valu);
+      _mm256_store_pd(p + 8 * i + 4, val0);
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 8, f, val0, valu, state.get());
+  }
+
+  // |0> state.
+  void SetStateZero(State& state) const {
+    SetAllZeros(state);
+    state.get()[0] = 1;
+  }
+
+  static std::complex<fp_type> GetAmpl(const State& state, uint64_t i) {
+    uint64_t p = (8 * (i / 4)) + (i % 4);
+    return std::complex<fp_type>(state.get()[p], state.get()[p + 4]);
+  }
+
+  static void SetAmpl(
+      State& state, uint64_t i, const std::complex<fp_type>& ampl) {
+    uint64_t p = (8 * (i / 4)) + (i % 4);
+    state.get()[p] = std::real(ampl);
+    state.get()[p + 4] = std::imag(ampl);
+  }
+
+  static void SetAmpl(State& state, uint64_t i, fp_type re, fp_type im) {
+    uint64_t p = (8 * (i / 4)) + (i % 4);
+    state.get()[p] = re;
+    state.get()[p + 4] = im;
+  }
+
+  // Sets state[i] = complex(re, im) where (i & mask) == bits.
+  // if `exclude` is true then the criteria becomes (i & mask) != bits.
+  void BulkSetAmpl(State& state, uint64_t mask, uint64_t bits,
+                   const std::complex<fp_type>& val,
+                   bool exclude = false) const {
+    BulkSetAmpl(state, mask, bits, std::real(val), std::imag(val), exclude);
+  }
+
+  // Sets state[i] = complex(re, im) where (i & mask) == bits.
+  // if `exclude` is true then the criteria becomes (i & mask) != bits.
+  void BulkSetAmpl(State& state, uint64_t mask, uint64_t bits, fp_type re,
+                   fp_type im, bool exclude = false) const {
+    __m256d re_reg = _mm256_set1_pd(re);
+    __m256d im_reg = _mm256_set1_pd(im);
+    __m256i exclude_reg = _mm256_setzero_si256();
+    if (exclude) {
+      exclude_reg = _mm256_cmpeq_epi64(exclude_reg, exclude_reg);
+    }
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, uint64_t maskv,
+                uint64_t bitsv, __m256d re_n, __m256d im_n, __m256i exclude_n,
+                fp_type* p) {
+      __m256d ml = _mm256_castsi256_pd(_mm256_xor_si256(
+          detail::GetZeroMaskAVXDouble(4 * i, maskv, bitsv), exclude_n));
+
+      __m256d re = _mm256_load_pd(p + 8 * i);
+      __m256d im = _mm256_load_pd(p + 8 * i + 4);
+
+      re = _mm256_blendv_pd(re, re_n, ml);
+      im = _mm256_blendv_pd(im, im_n, ml);
+
+      _mm256_store_pd(p + 8 * i, re);
+      _mm256_store_pd(p + 8 * i + 4, im);
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 8, f, mask, bits, re_reg,
+                   im_reg, exclude_reg, state.get());
+  }
+
+  // Does the equivalent of dest += src elementwise.
+  bool Add(const State& src, State& dest) const {
+    if (src.num_qubits() != dest.num_qubits()) {
+      return false;
+    }
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const fp_type* p1, fp_type* p2) {
+      __m256d re1 = _mm256_load_pd(p1 + 8 * i);
+      __m256d im1 = _mm256_load_pd(p1 + 8 * i + 4);
+      __m256d re2 = _mm256_load_pd(p2 + 8 * i);
+      __m256d im2 = _mm256_load_pd(p2 + 8 * i + 4);
+
+      _mm256_store_pd(p2 + 8 * i, _mm256_add_pd(re1, re2));
+      _mm256_store_pd(p2 + 8 * i + 4, _mm256_add_pd(im1, im2));
+    };
+
+    Base::for_.Run(MinSize(src.num_qubits()) / 8, f, src.get(), dest.get());
+
+    return true;
+  }
+
+  // Does the equivalent of state *= a elementwise.
+  void Multiply(fp_type a, State& state) const {
+    __m256d r = _mm256_set1_pd(a);
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, __m256d r, fp_type* p) {
+      __m256d re = _mm256_load_pd(p + 8 * i);
+      __m256d im = _mm256_load_pd(p + 8 * i + 4);
+
+      re = _mm256_mul_pd(re, r);
+      im = _mm256_mul_pd(im, r);
+
+      _mm256_store_pd(p + 8 * i, re);
+      _mm256_store_pd(p + 8 * i + 4, im);
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 8, f, r, state.get());
+  }
+
+  std::complex<double> InnerProduct(
+      const State& state1, const State& state2) const {
+    if (state1.num_qubits() != state2.num_qubits()) {
+      return std::nan("");
+    }
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const fp_type* p1, const fp_type* p2) -> std::complex<double> {
+      __m256d re1 = _mm256_load_pd(p1 + 8 * i);
+      __m256d im1 = _mm256_load_pd(p1 + 8 * i + 4);
+      __m256d re2 = _mm256_load_pd(p2 + 8 * i);
+      __m256d im2 = _mm256_load_pd(p2 + 8 * i + 4);
+
+      __m256d ip_re = _mm256_fmadd_pd(im1, im2, _mm256_mul_pd(re1, re2));
+      __m256d ip_im = _mm256_fnmadd_pd(im1, re2, _mm256_mul_pd(re1, im2));
+
+      double re = detail::HorizontalSumAVX(ip_re);
+      double im = detail::HorizontalSumAVX(ip_im);
+
+      return std::complex<double>{re, im};
+    };
+
+    using Op = std::plus<std::complex<double>>;
+    return Base::for_.RunReduce(
+        MinSize(state1.num_qubits()) / 8, f, Op(), state1.get(), state2.get());
+  }
+
+  double RealInnerProduct(const State& state1, const State& state2) const {
+    if (state1.num_qubits() != state2.num_qubits()) {
+      return std::nan("");
+    }
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const fp_type* p1, const fp_type* p2) -> double {
+      __m256d re1 = _mm256_load_pd(p1 + 8 * i);
+      __m256d im1 = _mm256_load_pd(p1 + 8 * i + 4);
+      __m256d re2 = _mm256_load_pd(p2 + 8 * i);
+      __m256d im2 = _mm256_load_pd(p2 + 8 * i + 4);
+
+      __m256d ip_re = _mm256_fmadd_pd(im1, im2, _mm256_mul_pd(re1, re2));
+
+      return detail::HorizontalSumAVX(ip_re);
+    };
+
+    using Op = std::plus<double>;
+    return Base::for_.RunReduce(
+        MinSize(state1.num_qubits()) / 8, f, Op(), state1.get(), state2.get());
+  }
+
+  template <typename DistrRealType = double>
+  std::vector<uint64_t> Sample(
+      const State& state, uint64_t num_samples, unsigned seed) const {
+    std::vector<uint64_t> bitstrings;
+
+    if (num_samples > 0) {
+      double norm = 0;
+      uint64_t size = MinSize(state.num_qubits()) / 8;
+      const fp_type* p = state.get();
+
+      for (uint64_t k = 0; k < size; ++k) {
+        for (unsigned j = 0; j < 4; ++j) {
+          auto re = p[8 * k + j];
+          auto im = p[8 * k + 4 + j];
+          norm += re * re + im * im;
+        }
+      }
+
+      auto rs = GenerateRandomValues<DistrRealType>(num_samples, seed, norm);
+
+      uint64_t m = 0;
+      double csum = 0;
+      bitstrings.reserve(num_samples);
+
+      for (uint64_t k = 0; k < size; ++k) {
+        for (unsigned j = 0; j < 4; ++j) {
+          auto re = p[8 * k + j];
+          auto im = p[8 * k + 4 + j];
+          csum += re * re + im * im;
+          while (rs[m] < csum && m < num_samples) {
+            bitstrings.emplace_back(4 * k + j);
+            ++m;
+          }
+        }
+      }
+    }
+
+    return bitstrings;
+  }
+
+  using MeasurementResult = typename Base::MeasurementResult;
+
+  void Collapse(const MeasurementResult& mr, State& state) const {
+    __m256d zero = _mm256_set1_pd(0);
+
+    auto f1 = [](unsigned n, unsigned m, uint64_t i, uint64_t mask,
+                 uint64_t bits, __m256d zero, const fp_type* p) -> double {
+      __m256d ml = _mm256_castsi256_pd(
+          detail::GetZeroMaskAVXDouble(4 * i, mask, bits));
+
+      __m256d re = _mm256_load_pd(p + 8 * i);
+      __m256d im = _mm256_load_pd(p + 8 * i + 4);
+      __m256d s1 = _mm256_fmadd_pd(im, im, _mm256_mul_pd(re, re));
+
+      s1 = _mm256_blendv_pd(zero, s1, ml);
+
+      return detail::HorizontalSumAVX(s1);
+    };
+
+    using Op = std::plus<double>;
+    double norm = Base::for_.RunReduce(MinSize(state.num_qubits()) / 8, f1,
+                                       Op(), mr.mask, mr.bits, zero,
+                                       state.get());
+
+    __m256d renorm = _mm256_set1_pd(1.0 / std::sqrt(norm));
+
+    auto f2 = [](unsigned n, unsigned m, uint64_t i, uint64_t mask,
+                 uint64_t bits, __m256d renorm, __m256d zero, fp_type* p) {
+      __m256d ml = _mm256_castsi256_pd(
+          detail::GetZeroMaskAVXDouble(4 * i, mask, bits));
+
+      __m256d re = _mm256_load_pd(p + 8 * i);
+      __m256d im = _mm256_load_pd(p + 8 * i + 4);
+
+      re = _mm256_blendv_pd(zero, _mm256_mul_pd(re, renorm), ml);
+      im = _mm256_blendv_pd(zero, _mm256_mul_pd(im, renorm), ml);
+
+      _mm256_store_pd(p + 8 * i, re);
+      _mm256_store_pd(p + 8 * i + 4, im);
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 8, f2,
+                   mr.mask, mr.bits, renorm, zero, state.get());
+  }
+
+  std::vector<double> PartialNorms(const State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const fp_type* p) -> double {
+      __m256d re = _mm256_load_pd(p + 8 * i);
+      __m256d im = _mm256_load_pd(p + 8 * i + 4);
+      __m256d s1 = _mm256_fmadd_pd(im, im, _mm256_mul_pd(re, re));
+
+      return detail::HorizontalSumAVX(s1);
+    };
+
+    using Op = std::plus<double>;
+    return Base::for_.RunReduceP(
+        MinSize(state.num_qubits()) / 8, f, Op(), state.get());
+  }
+
+  uint64_t FindMeasuredBits(
+      unsigned m, double r, uint64_t mask, const State& state) const {
+    double csum = 0;
+
+    uint64_t k0 = Base::for_.GetIndex0(MinSize(state.num_qubits()) / 8, m);
+    uint64_t k1 = Base::for_.GetIndex1(MinSize(state.num_qubits()) / 8, m);
+
+    const fp_type* p = state.get();
+
+    for (uint64_t k = k0; k < k1; ++k) {
+      for (uint64_t j = 0; j < 4; ++j) {
+        auto re = p[8 * k + j];
+        auto im = p[8 * k + 4 + j];
+        csum += re * re + im * im;
+        if (r < csum) {
+          return (4 * k + j) & mask;
+        }
+      }
+    }
+
+    // Return the last bitstring in the unlikely case of underflow.
+    return (4 * k1 - 1) & mask;
+  }
+};
+
+
 }  // namespace qsim
 
 #endif  // STATESPACE_AVX_H_
@@ -48,16 +48,6 @@ inline unsigned GetZeroMaskAVX512(uint64_t i, uint64_t mask, uint64_t bits) {
   return (m2 << 8) | m1;
 }
 
-inline double HorizontalSumAVX(__m256 s) {
-  __m128 l = _mm256_castps256_ps128(s);
-  __m128 h = _mm256_extractf128_ps(s, 1);
-  __m128 s1  = _mm_add_ps(h, l);
-  __m128 s1s = _mm_movehdup_ps(s1);
-  __m128 s2 = _mm_add_ps(s1, s1s);
-
-  return _mm_cvtss_f32(_mm_add_ss(s2, _mm_movehl_ps(s1s, s2)));
-}
-
 inline double HorizontalSumAVX512(__m512 s) {
   __m256 l = _mm512_castps512_ps256(s);
   __m512d sd = _mm512_castps_pd(s);
@@ -65,11 +55,34 @@ inline double HorizontalSumAVX512(__m512 s) {
   __m256 h = _mm256_castpd_ps(hd);
   __m256 p = _mm256_add_ps(h, l);
 
-  return HorizontalSumAVX(p);
+  __m128 pl = _mm256_castps256_ps128(p);
+  __m128 ph = _mm256_extractf128_ps(p, 1);
+  __m128 s1  = _mm_add_ps(ph, pl);
+  __m128 s1s = _mm_movehdup_ps(s1);
+  __m128 s2 = _mm_add_ps(s1, s1s);
+
+  return _mm_cvtss_f32(_mm_add_ss(s2, _mm_movehl_ps(s1s, s2)));
+}
+
+inline unsigned GetZeroMaskAVX512Double(
+    uint64_t i, uint64_t mask, uint64_t bits) {
+  __m512i s = _mm512_setr_epi64(
+      i + 0, i + 1, i + 2, i + 3, i + 4, i + 5, i + 6, i + 7);
+  __m512i ma = _mm512_set1_epi64(mask);
+  __m512i bi = _mm512_set1_epi64(bits);
+
+  return _mm512_cmpeq_epu64_mask(_mm512_and_si512(s, ma), bi);
+}
+
+inline double HorizontalSumAVX512(__m512d s) {
+  return _mm512_reduce_add_pd(s);
 }
 
 }  // namespace detail
 
+template <typename For, typename FP = float>
+class StateSpaceAVX512;
+
 /**
  * Object containing context and routines for AVX state-vector manipulations.
  * State is a vectorized sequence of sixteen real components followed by
@@ -77,7 +90,7 @@ inline double HorizontalSumAVX512(__m512 s) {
  * be loaded into an AVX512 register.
  */
 template <typename For>
-class StateSpaceAVX512 :
+class StateSpaceAVX512<For, float> :
     public StateSpace<StateSpaceAVX512<For>, VectorSpace, For, float> {
  private:
   using Base = StateSpace<StateSpaceAVX512<For>, qsim::VectorSpace, For, float>;
@@ -439,6 +452,370 @@ class StateSpaceAVX512 :
   }
 };
 
+/**
+ * Object containing context and routines for double-precision AVX512
+ * state-vector manipulations. State is a vectorized sequence of eight real
+ * components followed by eight imaginary components. Eight double-precison
+ * floating numbers can be loaded into an AVX512 register.
+ */
+template <typename For>
+class StateSpaceAVX512<For, double> :
+    public StateSpace<StateSpaceAVX512<For, double>,
+                      VectorSpace, For, double> {
+ private:
+  using Base = StateSpace<StateSpaceAVX512<For, double>,
+                          qsim::VectorSpace, For, double>;
+
+ public:
+  using State = typename Base::State;
+  using fp_type = typename Base::fp_type;
+
+  template <typename... ForArgs>
+  explicit StateSpaceAVX512(ForArgs&&... args) : Base(args...) {}
+
+  static uint64_t MinSize(unsigned num_qubits) {
+    return std::max(uint64_t{16}, 2 * (uint64_t{1} << num_qubits));
+  };
+
+  void InternalToNormalOrder(State& state) const {
+    __m512i idx1 = _mm512_setr_epi64(0, 8, 1, 9, 2, 10, 3, 11);
+    __m512i idx2 = _mm512_setr_epi64(4, 12, 5, 13, 6, 14, 7, 15);
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                __m512i idx1, __m512i idx2, fp_type* p) {
+      __m512d v1 = _mm512_load_pd(p + 16 * i);
+      __m512d v2 = _mm512_load_pd(p + 16 * i + 8);
+
+      _mm512_store_pd(p + 16 * i,  _mm512_permutex2var_pd(v1, idx1, v2));
+      _mm512_store_pd(p + 16 * i + 8,  _mm512_permutex2var_pd(v1, idx2, v2));
+    };
+
+    Base::for_.Run(
+        MinSize(state.num_qubits()) / 16, f, idx1, idx2, state.get());
+  }
+
+  void NormalToInternalOrder(State& state) const {
+    __m512i idx1 = _mm512_setr_epi64(0, 2, 4, 6, 8, 10, 12, 14);
+    __m512i idx2 = _mm512_setr_epi64(1, 3, 5, 7, 9, 11, 13, 15);
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                __m512i idx1, __m512i idx2, fp_type* p) {
+      __m512d re = _mm512_load_pd(p + 16 * i);
+      __m512d im = _mm512_load_pd(p + 16 * i + 8);
+
+      _mm512_store_pd(p + 16 * i,  _mm512_permutex2var_pd(re, idx1, im));
+      _mm512_store_pd(p + 16 * i + 8,  _mm512_permutex2var_pd(re, idx2, im));
+    };
+
+    Base::for_.Run(
+        MinSize(state.num_qubits()) / 16, f, idx1, idx2, state.get());
+  }
+
+  void SetAllZeros(State& state) const {
+    __m512d val0 = _mm512_setzero_pd();
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, __m512d val0, fp_type* p) {
+      _mm512_store_pd(p + 16 * i, val0);
+      _mm512_store_pd(p + 16 * i + 8, val0);
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 16, f, val0, state.get());
+  }
+
+  // Uniform superposition.
+  void SetStateUniform(State& state) const {
+    __m512d val0 = _mm512_setzero_pd();
+    __m512d valu;
+
+    fp_type v = double{1} / std::sqrt(uint64_t{1} << state.num_qubits());
+
+    switch (state.num_qubits()) {
+    case 1:
+      valu = _mm512_set_pd(0, 0, 0, 0, 0, 0, v, v);
+      break;
+    case 2:
+      valu = _mm512_set_pd(0, 0, 0, 0, v, v, v, v);
+      break;
+    default:
+      valu = _mm512_set1_pd(v);
+      break;
+    }
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const __m512d& val0, const __m512d& valu, fp_type* p) {
+      _mm512_store_pd(p + 16 * i, valu);
+      _mm512_store_pd(p + 16 * i + 8, val0);
+    };
+
+    Base::for_.Run(
+        MinSize(state.num_qubits()) / 16, f, val0, valu, state.get());
+  }
+
+  // |0> state.
+  void SetStateZero(State& state) const {
+    SetAllZeros(state);
+    state.get()[0] = 1;
+  }
+
+  static std::complex<fp_type> GetAmpl(const State& state, uint64_t i) {
+    uint64_t p = (16 * (i / 8)) + (i % 8);
+    return std::complex<fp_type>(state.get()[p], state.get()[p + 8]);
+  }
+
+  static void SetAmpl(
+      State& state, uint64_t i, const std::complex<fp_type>& ampl) {
+    uint64_t p = (16 * (i / 8)) + (i % 8);
+    state.get()[p] = std::real(ampl);
+    state.get()[p + 8] = std::imag(ampl);
+  }
+
+  static void SetAmpl(State& state, uint64_t i, fp_type re, fp_type im) {
+    uint64_t p = (16 * (i / 8)) + (i % 8);
+    state.get()[p] = re;
+    state.get()[p + 8] = im;
+  }
+
+  // Sets state[i] = complex(re, im) where (i & mask) == bits.
+  // if `exclude` is true then the criteria becomes (i & mask) != bits.
+  void BulkSetAmpl(State& state, uint64_t mask, uint64_t bits,
+                   const std::complex<fp_type>& val,
+                   bool exclude = false) const {
+    BulkSetAmpl(state, mask, bits, std::real(val), std::imag(val), exclude);
+  }
+
+  // Sets state[i] = complex(re, im) where (i & mask) == bits.
+  // if `exclude` is true then the criteria becomes (i & mask) != bits.
+  void BulkSetAmpl(State& state, uint64_t mask, uint64_t bits, fp_type re,
+                   fp_type im, bool exclude = false) const {
+    __m512d re_reg = _mm512_set1_pd(re);
+    __m512d im_reg = _mm512_set1_pd(im);
+
+    __mmask8 exclude_n = exclude ? 0xff : 0;
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, uint64_t maskv,
+                uint64_t bitsv, __m512d re_n, __m512d im_n,
+                __mmask8 exclude_n, fp_type* p) {
+      __m512d re = _mm512_load_pd(p + 16 * i);
+      __m512d im = _mm512_load_pd(p + 16 * i + 8);
+
+      __mmask8 ml =
+          detail::GetZeroMaskAVX512Double(8 * i, maskv, bitsv) ^ exclude_n;
+
+      re = _mm512_mask_blend_pd(ml, re, re_n);
+      im = _mm512_mask_blend_pd(ml, im, im_n);
+
+      _mm512_store_pd(p + 16 * i, re);
+      _mm512_store_pd(p + 16 * i + 8, im);
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 16, f, mask, bits,
+                   re_reg, im_reg, exclude_n, state.get());
+  }
+
+  // Does the equivalent of dest += src elementwise.
+  bool Add(const State& src, State& dest) const {
+    if (src.num_qubits() != dest.num_qubits()) {
+      return false;
+    }
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const fp_type* p1, fp_type* p2) {
+      __m512d re1 = _mm512_load_pd(p1 + 16 * i);
+      __m512d im1 = _mm512_load_pd(p1 + 16 * i + 8);
+      __m512d re2 = _mm512_load_pd(p2 + 16 * i);
+      __m512d im2 = _mm512_load_pd(p2 + 16 * i + 8);
+
+      _mm512_store_pd(p2 + 16 * i, _mm512_add_pd(re1, re2));
+      _mm512_store_pd(p2 + 16 * i + 8, _mm512_add_pd(im1, im2));
+    };
+
+    Base::for_.Run(MinSize(src.num_qubits()) / 16, f, src.get(), dest.get());
+
+    return true;
+  }
+
+  // Does the equivalent of state *= a elementwise.
+  void Multiply(fp_type a, State& state) const {
+    __m512d r = _mm512_set1_pd(a);
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, __m512d r, fp_type* p) {
+      __m512d re = _mm512_load_pd(p + 16 * i);
+      __m512d im = _mm512_load_pd(p + 16 * i + 8);
+
+      _mm512_store_pd(p + 16 * i, _mm512_mul_pd(re, r));
+      _mm512_store_pd(p + 16 * i + 8, _mm512_mul_pd(im, r));
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 16, f, r, state.get());
+  }
+
+  std::complex<double> InnerProduct(
+      const State& state1, const State& state2) const {
+    if (state1.num_qubits() != state2.num_qubits()) {
+      return std::nan("");
+    }
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const fp_type* p1, const fp_type* p2) -> std::complex<double> {
+      __m512d re1 = _mm512_load_pd(p1 + 16 * i);
+      __m512d im1 = _mm512_load_pd(p1 + 16 * i + 8);
+      __m512d re2 = _mm512_load_pd(p2 + 16 * i);
+      __m512d im2 = _mm512_load_pd(p2 + 16 * i + 8);
+
+      __m512d ip_re = _mm512_fmadd_pd(im1, im2, _mm512_mul_pd(re1, re2));
+      __m512d ip_im = _mm512_fnmadd_pd(im1, re2, _mm512_mul_pd(re1, im2));
+
+      double re = detail::HorizontalSumAVX512(ip_re);
+      double im = detail::HorizontalSumAVX512(ip_im);
+
+      return std::complex<double>{re, im};
+    };
+
+    using Op = std::plus<std::complex<double>>;
+    return Base::for_.RunReduce(MinSize(state1.num_qubits()) / 16, f,
+                                Op(), state1.get(), state2.get());
+  }
+
+  double RealInnerProduct(const State& state1, const State& state2) const {
+    if (state1.num_qubits() != state2.num_qubits()) {
+      return std::nan("");
+    }
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const fp_type* p1, const fp_type* p2) -> double {
+      __m512d re1 = _mm512_load_pd(p1 + 16 * i);
+      __m512d im1 = _mm512_load_pd(p1 + 16 * i + 8);
+      __m512d re2 = _mm512_load_pd(p2 + 16 * i);
+      __m512d im2 = _mm512_load_pd(p2 + 16 * i + 8);
+
+      __m512d ip_re = _mm512_fmadd_pd(im1, im2, _mm512_mul_pd(re1, re2));
+
+      return detail::HorizontalSumAVX512(ip_re);
+    };
+
+    using Op = std::plus<double>;
+    return Base::for_.RunReduce(MinSize(state1.num_qubits()) / 16, f,
+                                Op(), state1.get(), state2.get());
+  }
+
+  template <typename DistrRealType = double>
+  std::vector<uint64_t> Sample(
+      const State& state, uint64_t num_samples, unsigned seed) const {
+    std::vector<uint64_t> bitstrings;
+
+    if (num_samples > 0) {
+      double norm = 0;
+      uint64_t size = MinSize(state.num_qubits()) / 16;
+      const fp_type* p = state.get();
+
+      for (uint64_t k = 0; k < size; ++k) {
+        for (unsigned j = 0; j < 8; ++j) {
+          auto re = p[16 * k + j];
+          auto im = p[16 * k + 8 + j];
+          norm += re * re + im * im;
+        }
+      }
+
+      auto rs = GenerateRandomValues<DistrRealType>(num_samples, seed, norm);
+
+      uint64_t m = 0;
+      double csum = 0;
+      bitstrings.reserve(num_samples);
+
+      for (uint64_t k = 0; k < size; ++k) {
+        for (unsigned j = 0; j < 8; ++j) {
+          auto re = p[16 * k + j];
+          auto im = p[16 * k + 8 + j];
+          csum += re * re + im * im;
+          while (rs[m] < csum && m < num_samples) {
+            bitstrings.emplace_back(8 * k + j);
+            ++m;
+          }
+        }
+      }
+    }
+
+    return bitstrings;
+  }
+
+  using MeasurementResult = typename Base::MeasurementResult;
+
+  void Collapse(const MeasurementResult& mr, State& state) const {
+    auto f1 = [](unsigned n, unsigned m, uint64_t i,
+                 uint64_t mask, uint64_t bits, const fp_type* p) -> double {
+      __mmask8 ml = detail::GetZeroMaskAVX512Double(8 * i, mask, bits);
+
+      __m512d re = _mm512_maskz_load_pd(ml, p + 16 * i);
+      __m512d im = _mm512_maskz_load_pd(ml, p + 16 * i + 8);
+      __m512d s1 = _mm512_fmadd_pd(im, im, _mm512_mul_pd(re, re));
+
+      return detail::HorizontalSumAVX512(s1);
+    };
+
+    using Op = std::plus<double>;
+    double norm = Base::for_.RunReduce(MinSize(state.num_qubits()) / 16, f1,
+                                       Op(), mr.mask, mr.bits, state.get());
+
+    __m512d renorm = _mm512_set1_pd(1.0 / std::sqrt(norm));
+
+    auto f2 = [](unsigned n, unsigned m, uint64_t i,
+                 uint64_t mask, uint64_t bits, __m512d renorm, fp_type* p) {
+      __mmask8 ml = detail::GetZeroMaskAVX512Double(8 * i, mask, bits);
+
+      __m512d re = _mm512_maskz_load_pd(ml, p + 16 * i);
+      __m512d im = _mm512_maskz_load_pd(ml, p + 16 * i + 8);
+
+      re = _mm512_mul_pd(re, renorm);
+      im = _mm512_mul_pd(im, renorm);
+
+      _mm512_store_pd(p + 16 * i, re);
+      _mm512_store_pd(p + 16 * i + 8, im);
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 16, f2,
+                   mr.mask, mr.bits, renorm, state.get());
+  }
+
+  std::vector<double> PartialNorms(const State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const fp_type* p) -> double {
+      __m512d re = _mm512_load_pd(p + 16 * i);
+      __m512d im = _mm512_load_pd(p + 16 * i + 8);
+      __m512d s1 = _mm512_fmadd_pd(im, im, _mm512_mul_pd(re, re));
+
+      return detail::HorizontalSumAVX512(s1);
+    };
+
+    using Op = std::plus<double>;
+    return Base::for_.RunReduceP(
+        MinSize(state.num_qubits()) / 16, f, Op(), state.get());
+  }
+
+  uint64_t FindMeasuredBits(
+      unsigned m, double r, uint64_t mask, const State& state) const {
+    double csum = 0;
+
+    uint64_t k0 = Base::for_.GetIndex0(MinSize(state.num_qubits()) / 16, m);
+    uint64_t k1 = Base::for_.GetIndex1(MinSize(state.num_qubits()) / 16, m);
+
+    const fp_type* p = state.get();
+
+    for (uint64_t k = k0; k < k1; ++k) {
+      for (uint64_t j = 0; j < 8; ++j) {
+        auto re = p[16 * k + j];
+        auto im = p[16 * k + j + 8];
+        csum += re * re + im * im;
+        if (r < csum) {
+          return (8 * k + j) & mask;
+        }
+      }
+    }
+
+    // Return the last bitstring in the unlikely case of underflow.
+    return (8 * k1 - 1) & mask;
+  }
+};
+
 }  // namespace qsim
 
 #endif  // STATESPACE_AVX512_H_
@@ -0,0 +1,181 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef STATESPACE_BATCH_H_
+#define STATESPACE_BATCH_H_
+
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+#include "vectorspace.h"
+
+namespace qsim {
+
+// Per-lane partial sums of batched state vectors.
+template <unsigned N>
+struct BatchSums {
+  BatchSums(double v = 0) {
+    for (unsigned l = 0; l < N; ++l) {
+      s[l] = v;
+    }
+  }
+
+  double s[N];
+};
+
+// Reduction operation for per-lane partial sums.
+template <unsigned N>
+struct BatchSumsPlus {
+  using result_type = BatchSums<N>;
+
+  result_type operator()(const result_type& a, const result_type& b) const {
+    result_type r;
+
+    for (unsigned l = 0; l < N; ++l) {
+      r.s[l] = a.s[l] + b.s[l];
+    }
+
+    return r;
+  }
+};
+
+/**
+ * Object containing context and routines for batches of B state vectors of
+ * the same number of qubits, for instance, of B quantum trajectories. The
+ * batch index (lane) is the fastest dimension: amplitude i of all the state
+ * vectors is stored as B real parts followed by B imaginary parts, so that
+ * SimulatorBatch operates on SIMD vectors of B lanes.
+ */
+template <typename For, typename FP, unsigned B>
+class StateSpaceBatch :
+    public VectorSpace<StateSpaceBatch<For, FP, B>, For, FP> {
+ private:
+  using Base = VectorSpace<StateSpaceBatch<For, FP, B>, For, FP>;
+
+ public:
+  using State = typename Base::Vector;
+  using fp_type = typename Base::fp_type;
+
+  static constexpr unsigned kBatchSize = B;
+
+  template <typename... ForArgs>
+  explicit StateSpaceBatch(ForArgs&&... args) : Base(args...) {}
+
+  static uint64_t MinSize(unsigned num_qubits) {
+    return 2 * B * (uint64_t{1} << num_qubits);
+  };
+
+  void SetAllZeros(State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, fp_type* p) {
+      for (unsigned l = 0; l < 2 * B; ++l) {
+        p[2 * B * i + l] = 0;
+      }
+    };
+
+    Base::for_.Run(uint64_t{1} << state.num_qubits(), f, state.get());
+  }
+
+  // |0> state in all the lanes.
+  void SetStateZero(State& state) const {
+    SetAllZeros(state);
+
+    for (unsigned l = 0; l < B; ++l) {
+      state.get()[l] = 1;
+    }
+  }
+
+  static std::complex<fp_type> GetAmpl(const State& state, unsigned lane,
+                                       uint64_t i) {
+    auto p = state.get() + 2 * B * i + lane;
+    return std::complex<fp_type>(p[0], p[B]);
+  }
+
+  static void SetAmpl(State& state, unsigned lane, uint64_t i,
+                      const std::complex<fp_type>& ampl) {
+    auto p = state.get() + 2 * B * i + lane;
+    p[0] = std::real(ampl);
+    p[B] = std::imag(ampl);
+  }
+
+  /**
+   * Copies the state vector in the given lane to dest. It is the client's
+   * responsibility to make sure that dest has at least
+   * 2 * 2^state.num_qubits() elements.
+   * @param state The batch of state vectors.
+   * @param lane The lane.
+   * @param dest Output: the state vector as a sequence of one real part
+   *   followed by one imaginary part per amplitude ("normal" order, as in
+   *   StateSpace::Copy followed by NormalToInternalOrder).
+   */
+  void CopyLane(const State& state, unsigned lane, fp_type* dest) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i, unsigned lane,
+                const fp_type* src, fp_type* dest) {
+      dest[2 * i] = src[2 * B * i + lane];
+      dest[2 * i + 1] = src[2 * B * i + B + lane];
+    };
+
+    Base::for_.Run(uint64_t{1} << state.num_qubits(), f, lane, state.get(),
+                   dest);
+  }
+
+  /**
+   * @return The squared norms of the state vectors in all the lanes.
+   */
+  std::vector<double> Norms(const State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const fp_type* p) -> BatchSums<B> {
+      BatchSums<B> sums;
+
+      p += 2 * B * i;
+
+      for (unsigned l = 0; l < B; ++l) {
+        sums.s[l] = p[l] * p[l] + p[B + l] * p[B + l];
+      }
+
+      return sums;
+    };
+
+    using Op = BatchSumsPlus<B>;
+    auto sums = Base::for_.RunReduce(uint64_t{1} << state.num_qubits(), f,
+                                     Op(), state.get());
+
+    return std::vector<double>(sums.s, sums.s + B);
+  }
+
+  /**
+   * Multiplies the state vector in each lane by the respective factor.
+   * @param factors B factors, one per lane.
+   * @param state The batch of state vectors to be updated.
+   */
+  void Multiply(const fp_type* factors, State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const fp_type* factors, fp_type* p) {
+      p += 2 * B * i;
+
+      for (unsigned l = 0; l < B; ++l) {
+        p[l] *= factors[l];
+        p[B + l] *= factors[l];
+      }
+    };
+
+    Base::for_.Run(uint64_t{1} << state.num_qubits(), f, factors,
+                   state.get());
+  }
+};
+
+}  // namespace qsim
+
+#endif  // STATESPACE_BATCH_H_
@@ -0,0 +1,539 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef STATESPACE_HALF_AVX_H_
+#define STATESPACE_HALF_AVX_H_
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <functional>
+
+#include "half.h"
+#include "statespace.h"
+#include "statespace_avx.h"
+#include "util.h"
+#include "vectorspace.h"
+
+namespace qsim {
+
+namespace detail {
+
+inline __m256 LoadHalfAVX(const float16* p) {
+  return _mm256_cvtph_ps(_mm_load_si128((const __m128i*) p));
+}
+
+inline __m256 LoadHalfAVX(const bfloat16* p) {
+  __m256i u = _mm256_cvtepu16_epi32(_mm_load_si128((const __m128i*) p));
+  return _mm256_castsi256_ps(_mm256_slli_epi32(u, 16));
+}
+
+inline void StoreHalfAVX(float16* p, __m256 v) {
+  _mm_store_si128((__m128i*) p, _mm256_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+}
+
+inline void StoreHalfAVX(bfloat16* p, __m256 v) {
+#if defined(__AVX512BF16__) && defined(__AVX512VL__)
+  _mm_store_si128((__m128i*) p, (__m128i) _mm256_cvtneps_pbh(v));
+#else
+  // Round to nearest even; see FloatToHalf<bfloat16>.
+  __m256i u = _mm256_castps_si256(v);
+  __m256i b = _mm256_and_si256(_mm256_srli_epi32(u, 16),
+                               _mm256_set1_epi32(1));
+  u = _mm256_add_epi32(u, _mm256_add_epi32(b, _mm256_set1_epi32(0x7fff)));
+  u = _mm256_srli_epi32(u, 16);
+  u = _mm256_permute4x64_epi64(_mm256_packus_epi32(u, u), 8);
+  _mm_store_si128((__m128i*) p, _mm256_castsi256_si128(u));
+#endif
+}
+
+// Returns the sum of all the elements of s1 and s2 accumulated in double
+// precision.
+inline double HorizontalSumHalfAVX(__m256 s1, __m256 s2) {
+  __m256d l1 = _mm256_cvtps_pd(_mm256_castps256_ps128(s1));
+  __m256d h1 = _mm256_cvtps_pd(_mm256_extractf128_ps(s1, 1));
+  __m256d l2 = _mm256_cvtps_pd(_mm256_castps256_ps128(s2));
+  __m256d h2 = _mm256_cvtps_pd(_mm256_extractf128_ps(s2, 1));
+
+  return HorizontalSumAVX(
+      _mm256_add_pd(_mm256_add_pd(l1, h1), _mm256_add_pd(l2, h2)));
+}
+
+}  // namespace detail
+
+/**
+ * Object containing context and routines for AVX state-vector manipulations
+ * with half-precision storage. The state has the same layout as the state of
+ * StateSpaceAVX<For, float>, but amplitudes are stored as float16 or bfloat16
+ * numbers, which halves the memory footprint. Amplitudes are widened to
+ * float on load and narrowed on store; fp_type is float. Stored amplitudes
+ * are multiplied by StorageScale. Products of widened float16 numbers are
+ * exact in float; norms and inner products are summed in double precision.
+ */
+template <typename For, typename Half>
+class StateSpaceHalfAVX :
+    public StateSpace<StateSpaceHalfAVX<For, Half>, VectorSpace, For, Half> {
+ private:
+  using Base = StateSpace<StateSpaceHalfAVX<For, Half>,
+                          qsim::VectorSpace, For, Half>;
+
+ public:
+  using State = typename Base::State;
+  using fp_type = float;
+  using storage_type = Half;
+
+  template <typename... ForArgs>
+  explicit StateSpaceHalfAVX(ForArgs&&... args) : Base(args...) {}
+
+  static uint64_t MinSize(unsigned num_qubits) {
+    return std::max(uint64_t{16}, 2 * (uint64_t{1} << num_qubits));
+  };
+
+  // Amplitudes are stored multiplied by this factor.
+  static fp_type StorageScale(unsigned num_qubits) {
+    return qsim::StorageScale<Half>(num_qubits);
+  }
+
+  void InternalToNormalOrder(State& state) const {
+    if (state.num_qubits() == 1) {
+      Half* s = state.get();
+
+      s[2] = s[1];
+      s[1] = s[8];
+      s[3] = s[9];
+
+      for (uint64_t i = 4; i < 16; ++i) {
+        s[i] = Half{0};
+      }
+    } else if (state.num_qubits() == 2) {
+      Half* s = state.get();
+
+      s[6] = s[3];
+      s[4] = s[2];
+      s[2] = s[1];
+      s[1] = s[8];
+      s[3] = s[9];
+      s[5] = s[10];
+      s[7] = s[11];
+
+      for (uint64_t i = 8; i < 16; ++i) {
+        s[i] = Half{0};
+      }
+    } else {
+      auto f = [](unsigned n, unsigned m, uint64_t i, Half* p) {
+        Half* s = p + 16 * i;
+
+        Half re[7];
+        Half im[7];
+
+        for (uint64_t i = 0; i < 7; ++i) {
+          re[i] = s[i + 1];
+          im[i] = s[i + 8];
+        }
+
+        for (uint64_t i = 0; i < 7; ++i) {
+          s[2 * i + 1] = im[i];
+          s[2 * i + 2] = re[i];
+        }
+      };
+
+      Base::for_.Run(MinSize(state.num_qubits()) / 16, f, state.get());
+    }
+  }
+
+  void NormalToInternalOrder(State& state) const {
+    if (state.num_qubits() == 1) {
+      Half* s = state.get();
+
+      s[8] = s[1];
+      s[1] = s[2];
+      s[9] = s[3];
+
+      for (uint64_t i = 2; i < 8; ++i) {
+        s[i] = Half{0};
+        s[i + 8] = Half{0};
+      }
+    } else if (state.num_qubits() == 2) {
+      Half* s = state.get();
+
+      s[8] = s[1];
+      s[9] = s[3];
+      s[10] = s[5];
+      s[11] = s[7];
+      s[1] = s[2];
+      s[2] = s[4];
+      s[3] = s[6];
+
+      for (uint64_t i = 4; i < 8; ++i) {
+        s[i] = Half{0};
+        s[i + 8] = Half{0};
+      }
+    } else {
+      auto f = [](unsigned n, unsigned m, uint64_t i, Half* p) {
+        Half* s = p + 16 * i;
+
+        Half re[7];
+        Half im[7];
+
+        for (uint64_t i = 0; i < 7; ++i) {
+          im[i] = s[2 * i + 1];
+          re[i] = s[2 * i + 2];
+        }
+
+        for (uint64_t i = 0; i < 7; ++i) {
+          s[i + 1] = re[i];
+          s[i + 8] = im[i];
+        }
+      };
+
+      Base::for_.Run(MinSize(state.num_qubits()) / 16, f, state.get());
+    }
+  }
+
+  void SetAllZeros(State& state) const {
+    __m256i val0 = _mm256_setzero_si256();
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, __m256i& val, Half* p) {
+      _mm256_store_si256((__m256i*) (p + 16 * i), val);
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 16, f, val0, state.get());
+  }
+
+  // Uniform superposition.
+  void SetStateUniform(State& state) const {
+    __m256 val0 = _mm256_setzero_ps();
+    __m256 valu;
+
+    fp_type v = StorageScale(state.num_qubits())
+        / std::sqrt(uint64_t{1} << state.num_qubits());
+
+    switch (state.num_qubits()) {
+    case 1:
+      valu = _mm256_set_ps(0, 0, 0, 0, 0, 0, v, v);
+      break;
+    case 2:
+      valu = _mm256_set_ps(0, 0, 0, 0, v, v, v, v);
+      break;
+    default:
+      valu = _mm256_set1_ps(v);
+      break;
+    }
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                __m256& val0, __m256 valu, Half* p) {
+      detail::StoreHalfAVX(p + 16 * i, valu);
+      detail::StoreHalfAVX(p + 16 * i + 8, val0);
+    };
+
+    Base::for_.Run(
+        MinSize(state.num_qubits()) / 16, f, val0, valu, state.get());
+  }
+
+  // |0> state.
+  void SetStateZero(State& state) const {
+    SetAllZeros(state);
+    state.get()[0] = FloatToHalf<Half>(StorageScale(state.num_qubits()));
+  }
+
+  static std::complex<fp_type> GetAmpl(const State& state, uint64_t i) {
+    uint64_t k = (16 * (i / 8)) + (i % 8);
+    fp_type s = 1 / StorageScale(state.num_qubits());
+    return std::complex<fp_type>(s * HalfToFloat(state.get()[k]),
+                                 s * HalfToFloat(state.get()[k + 8]));
+  }
+
+  static void SetAmpl(
+      State& state, uint64_t i, const std::complex<fp_type>& ampl) {
+    SetAmpl(state, i, std::real(ampl), std::imag(ampl));
+  }
+
+  static void SetAmpl(State& state, uint64_t i, fp_type re, fp_type im) {
+    uint64_t k = (16 * (i / 8)) + (i % 8);
+    fp_type s = StorageScale(state.num_qubits());
+    state.get()[k] = FloatToHalf<Half>(s * re);
+    state.get()[k + 8] = FloatToHalf<Half>(s * im);
+  }
+
+  // Sets state[i] = complex(re, im) where (i & mask) == bits.
+  // if `exclude` is true then the criteria becomes (i & mask) != bits.
+  void BulkSetAmpl(State& state, uint64_t mask, uint64_t bits,
+                   const std::complex<fp_type>& val,
+                   bool exclude = false) const {
+    BulkSetAmpl(state, mask, bits, std::real(val), std::imag(val), exclude);
+  }
+
+  // Sets state[i] = complex(re, im) where (i & mask) == bits.
+  // if `exclude` is true then the criteria becomes (i & mask) != bits.
+  void BulkSetAmpl(State& state, uint64_t mask, uint64_t bits, fp_type re,
+                   fp_type im, bool exclude = false) const {
+    fp_type s = StorageScale(state.num_qubits());
+    __m256 re_reg = _mm256_set1_ps(s * re);
+    __m256 im_reg = _mm256_set1_ps(s * im);
+
+    __m256i exclude_reg = _mm256_setzero_si256();
+    if (exclude) {
+      exclude_reg = _mm256_cmpeq_epi32(exclude_reg, exclude_reg);
+    }
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, uint64_t maskv,
+                uint64_t bitsv, __m256 re_n, __m256 im_n, __m256i exclude_n,
+                Half* p) {
+      __m256 ml = _mm256_castsi256_ps(_mm256_xor_si256(
+          detail::GetZeroMaskAVX(8 * i, maskv, bitsv), exclude_n));
+
+      __m256 re = detail::LoadHalfAVX(p + 16 * i);
+      __m256 im = detail::LoadHalfAVX(p + 16 * i + 8);
+
+      re = _mm256_blendv_ps(re, re_n, ml);
+      im = _mm256_blendv_ps(im, im_n, ml);
+
+      detail::StoreHalfAVX(p + 16 * i, re);
+      detail::StoreHalfAVX(p + 16 * i + 8, im);
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 16, f, mask, bits, re_reg,
+                   im_reg, exclude_reg, state.get());
+  }
+
+  // Does the equivalent of dest += src elementwise.
+  bool Add(const State& src, State& dest) const {
+    if (src.num_qubits() != dest.num_qubits()) {
+      return false;
+    }
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const Half* p1, Half* p2) {
+      __m256 re1 = detail::LoadHalfAVX(p1 + 16 * i);
+      __m256 im1 = detail::LoadHalfAVX(p1 + 16 * i + 8);
+      __m256 re2 = detail::LoadHalfAVX(p2 + 16 * i);
+      __m256 im2 = detail::LoadHalfAVX(p2 + 16 * i + 8);
+
+      detail::StoreHalfAVX(p2 + 16 * i, _mm256_add_ps(re1, re2));
+      detail::StoreHalfAVX(p2 + 16 * i + 8, _mm256_add_ps(im1, im2));
+    };
+
+    Base::for_.Run(MinSize(src.num_qubits()) / 16, f, src.get(), dest.get());
+
+    return true;
+  }
+
+  // Does the equivalent of state *= a elementwise.
+  void Multiply(fp_type a, State& state) const {
+    __m256 r = _mm256_set1_ps(a);
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, __m256 r, Half* p) {
+      __m256 re = detail::LoadHalfAVX(p + 16 * i);
+      __m256 im = detail::LoadHalfAVX(p + 16 * i + 8);
+
+      re = _mm256_mul_ps(re, r);
+      im = _mm256_mul_ps(im, r);
+
+      detail::StoreHalfAVX(p + 16 * i, re);
+      detail::StoreHalfAVX(p + 16 * i + 8, im);
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 16, f, r, state.get());
+  }
+
+  std::complex<double> InnerProduct(
+      const State& state1, const State& state2) const {
+    if (state1.num_qubits() != state2.num_qubits()) {
+      return std::nan("");
+    }
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const Half* p1, const Half* p2) -> std::complex<double> {
+      __m256 re1 = detail::LoadHalfAVX(p1 + 16 * i);
+      __m256 im1 = detail::LoadHalfAVX(p1 + 16 * i + 8);
+      __m256 re2 = detail::LoadHalfAVX(p2 + 16 * i);
+      __m256 im2 = detail::LoadHalfAVX(p2 + 16 * i + 8);
+
+      double re = detail::HorizontalSumHalfAVX(
+          _mm256_mul_ps(re1, re2), _mm256_mul_ps(im1, im2));
+      double im = detail::HorizontalSumHalfAVX(
+          _mm256_mul_ps(re1, im2),
+          _mm256_sub_ps(_mm256_setzero_ps(), _mm256_mul_ps(im1, re2)));
+
+      return std::complex<double>{re, im};
+    };
+
+    double s = StorageScale(state1.num_qubits());
+
+    using Op = std::plus<std::complex<double>>;
+    return Base::for_.RunReduce(MinSize(state1.num_qubits()) / 16, f,
+                                Op(), state1.get(), state2.get()) / (s * s);
+  }
+
+  double RealInnerProduct(const State& state1, const State& state2) const {
+    if (state1.num_qubits() != state2.num_qubits()) {
+      return std::nan("");
+    }
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const Half* p1, const Half* p2) -> double {
+      __m256 re1 = detail::LoadHalfAVX(p1 + 16 * i);
+      __m256 im1 = detail::LoadHalfAVX(p1 + 16 * i + 8);
+      __m256 re2 = detail::LoadHalfAVX(p2 + 16 * i);
+      __m256 im2 = detail::LoadHalfAVX(p2 + 16 * i + 8);
+
+      return detail::HorizontalSumHalfAVX(
+          _mm256_mul_ps(re1, re2), _mm256_mul_ps(im1, im2));
+    };
+
+    double s = StorageScale(state1.num_qubits());
+
+    using Op = std::plus<double>;
+    return Base::for_.RunReduce(MinSize(state1.num_qubits()) / 16, f,
+                                Op(), state1.get(), state2.get()) / (s * s);
+  }
+
+  template <typename DistrRealType = double>
+  std::vector<uint64_t> Sample(
+      const State& state, uint64_t num_samples, unsigned seed) const {
+    std::vector<uint64_t> bitstrings;
+
+    if (num_samples > 0) {
+      double norm = 0;
+      uint64_t size = MinSize(state.num_qubits()) / 16;
+      const Half* p = state.get();
+
+      for (uint64_t k = 0; k < size; ++k) {
+        for (unsigned j = 0; j < 8; ++j) {
+          double re = HalfToFloat(p[16 * k + j]);
+          double im = HalfToFloat(p[16 * k + 8 + j]);
+          norm += re * re + im * im;
+        }
+      }
+
+      auto rs = GenerateRandomValues<DistrRealType>(num_samples, seed, norm);
+
+      uint64_t m = 0;
+      double csum = 0;
+      bitstrings.reserve(num_samples);
+
+      for (uint64_t k = 0; k < size; ++k) {
+        for (unsigned j = 0; j < 8; ++j) {
+          double re = HalfToFloat(p[16 * k + j]);
+          double im = HalfToFloat(p[16 * k + 8 + j]);
+          csum += re * re + im * im;
+          while (rs[m] < csum && m < num_samples) {
+            bitstrings.emplace_back(8 * k + j);
+            ++m;
+          }
+        }
+      }
+    }
+
+    return bitstrings;
+  }
+
+  using MeasurementResult = typename Base::MeasurementResult;
+
+  void Collapse(const MeasurementResult& mr, State& state) const {
+    auto f1 = [](unsigned n, unsigned m, uint64_t i,
+                 uint64_t mask, uint64_t bits, const Half* p) -> double {
+      __m256 ml = _mm256_castsi256_ps(
+          detail::GetZeroMaskAVX(8 * i, mask, bits));
+
+      __m256 re = _mm256_and_ps(detail::LoadHalfAVX(p + 16 * i), ml);
+      __m256 im = _mm256_and_ps(detail::LoadHalfAVX(p + 16 * i + 8), ml);
+
+      return detail::HorizontalSumHalfAVX(
+          _mm256_mul_ps(re, re), _mm256_mul_ps(im, im));
+    };
+
+    using Op = std::plus<double>;
+    double norm = Base::for_.RunReduce(MinSize(state.num_qubits()) / 16, f1,
+                                       Op(), mr.mask, mr.bits, state.get());
+
+    fp_type s = StorageScale(state.num_qubits());
+    __m256 renorm = _mm256_set1_ps(s / std::sqrt(norm));
+
+    auto f2 = [](unsigned n, unsigned m, uint64_t i,
+                 uint64_t mask, uint64_t bits, __m256 renorm, Half* p) {
+      __m256 ml = _mm256_castsi256_ps(
+          detail::GetZeroMaskAVX(8 * i, mask, bits));
+
+      __m256 re = _mm256_and_ps(detail::LoadHalfAVX(p + 16 * i), ml);
+      __m256 im = _mm256_and_ps(detail::LoadHalfAVX(p + 16 * i + 8), ml);
+
+      re = _mm256_mul_ps(re, renorm);
+      im = _mm256_mul_ps(im, renorm);
+
+      detail::StoreHalfAVX(p + 16 * i, re);
+      detail::StoreHalfAVX(p + 16 * i + 8, im);
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 16, f2,
+                   mr.mask, mr.bits, renorm, state.get());
+  }
+
+  std::vector<double> PartialNorms(const State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const Half* p) -> double {
+      __m256 re = detail::LoadHalfAVX(p + 16 * i);
+      __m256 im = detail::LoadHalfAVX(p + 16 * i + 8);
+
+      return detail::HorizontalSumHalfAVX(
+          _mm256_mul_ps(re, re), _mm256_mul_ps(im, im));
+    };
+
+    double s = StorageScale(state.num_qubits());
+
+    using Op = std::plus<double>;
+    auto partial_norms = Base::for_.RunReduceP(
+        MinSize(state.num_qubits()) / 16, f, Op(), state.get());
+
+    for (auto& norm : partial_norms) {
+      norm /= s * s;
+    }
+
+    return partial_norms;
+  }
+
+  uint64_t FindMeasuredBits(
+      unsigned m, double r, uint64_t mask, const State& state) const {
+    double s = StorageScale(state.num_qubits());
+    double csum = 0;
+
+    r *= s * s;
+
+    uint64_t k0 = Base::for_.GetIndex0(MinSize(state.num_qubits()) / 16, m);
+    uint64_t k1 = Base::for_.GetIndex1(MinSize(state.num_qubits()) / 16, m);
+
+    const Half* p = state.get();
+
+    for (uint64_t k = k0; k < k1; ++k) {
+      for (uint64_t j = 0; j < 8; ++j) {
+        double re = HalfToFloat(p[16 * k + j]);
+        double im = HalfToFloat(p[16 * k + j + 8]);
+        csum += re * re + im * im;
+        if (r < csum) {
+          return (8 * k + j) & mask;
+        }
+      }
+    }
+
+    // Return the last bitstring in the unlikely case of underflow.
+    return (8 * k1 - 1) & mask;
+  }
+};
+
+}  // namespace qsim
+
+#endif  // STATESPACE_HALF_AVX_H_
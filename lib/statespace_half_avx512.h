@@ -0,0 +1,492 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef STATESPACE_HALF_AVX512_H_
+#define STATESPACE_HALF_AVX512_H_
+
+#include <immintrin.h>
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <functional>
+
+#include "half.h"
+#include "statespace.h"
+#include "statespace_avx512.h"
+#include "util.h"
+#include "vectorspace.h"
+
+namespace qsim {
+
+namespace detail {
+
+inline __m512 LoadHalfAVX512(const float16* p) {
+  return _mm512_cvtph_ps(_mm256_load_si256((const __m256i*) p));
+}
+
+inline __m512 LoadHalfAVX512(const bfloat16* p) {
+  __m512i u = _mm512_cvtepu16_epi32(_mm256_load_si256((const __m256i*) p));
+  return _mm512_castsi512_ps(_mm512_slli_epi32(u, 16));
+}
+
+inline void StoreHalfAVX512(float16* p, __m512 v) {
+  _mm256_store_si256((__m256i*) p,
+                     _mm512_cvtps_ph(v, _MM_FROUND_TO_NEAREST_INT));
+}
+
+inline void StoreHalfAVX512(bfloat16* p, __m512 v) {
+#ifdef __AVX512BF16__
+  _mm256_store_si256((__m256i*) p, (__m256i) _mm512_cvtneps_pbh(v));
+#else
+  // Round to nearest even; see FloatToHalf<bfloat16>.
+  __m512i u = _mm512_castps_si512(v);
+  __m512i b = _mm512_and_si512(_mm512_srli_epi32(u, 16),
+                               _mm512_set1_epi32(1));
+  u = _mm512_add_epi32(u, _mm512_add_epi32(b, _mm512_set1_epi32(0x7fff)));
+  _mm256_store_si256((__m256i*) p,
+                     _mm512_cvtepi32_epi16(_mm512_srli_epi32(u, 16)));
+#endif
+}
+
+// Returns the sum of all the elements of s1 and s2 accumulated in double
+// precision.
+inline double HorizontalSumHalfAVX512(__m512 s1, __m512 s2) {
+  __m512d l1 = _mm512_cvtps_pd(_mm512_castps512_ps256(s1));
+  __m512d h1 = _mm512_cvtps_pd(_mm256_castpd_ps(
+      _mm512_extractf64x4_pd(_mm512_castps_pd(s1), 1)));
+  __m512d l2 = _mm512_cvtps_pd(_mm512_castps512_ps256(s2));
+  __m512d h2 = _mm512_cvtps_pd(_mm256_castpd_ps(
+      _mm512_extractf64x4_pd(_mm512_castps_pd(s2), 1)));
+
+  return _mm512_reduce_add_pd(
+      _mm512_add_pd(_mm512_add_pd(l1, h1), _mm512_add_pd(l2, h2)));
+}
+
+}  // namespace detail
+
+/**
+ * Object containing context and routines for AVX512 state-vector
+ * manipulations with half-precision storage. The state has the same layout
+ * as the state of StateSpaceAVX512<For, float>, but amplitudes are stored
+ * as float16 or bfloat16 numbers, which halves the memory footprint.
+ * Amplitudes are widened to float on load and narrowed on store; fp_type is
+ * float. Stored amplitudes are multiplied by StorageScale. Products of
+ * widened float16 numbers are exact in float; norms and inner products are
+ * summed in double precision.
+ */
+template <typename For, typename Half>
+class StateSpaceHalfAVX512 :
+    public StateSpace<StateSpaceHalfAVX512<For, Half>, VectorSpace, For, Half> {
+ private:
+  using Base = StateSpace<StateSpaceHalfAVX512<For, Half>,
+                          qsim::VectorSpace, For, Half>;
+
+ public:
+  using State = typename Base::State;
+  using fp_type = float;
+  using storage_type = Half;
+
+  template <typename... ForArgs>
+  explicit StateSpaceHalfAVX512(ForArgs&&... args) : Base(args...) {}
+
+  static uint64_t MinSize(unsigned num_qubits) {
+    return std::max(uint64_t{32}, 2 * (uint64_t{1} << num_qubits));
+  };
+
+  // Amplitudes are stored multiplied by this factor.
+  static fp_type StorageScale(unsigned num_qubits) {
+    return qsim::StorageScale<Half>(num_qubits);
+  }
+
+  void InternalToNormalOrder(State& state) const {
+    __m512i idx1 = _mm512_setr_epi32(
+        0, 16, 1, 17, 2, 18, 3, 19, 4, 20, 5, 21, 6, 22, 7, 23);
+    __m512i idx2 = _mm512_setr_epi32(
+        8, 24, 9, 25, 10, 26, 11, 27, 12, 28, 13, 29, 14, 30, 15, 31);
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                __m512i idx1, __m512i idx2, Half* p) {
+      __m512 v1 = detail::LoadHalfAVX512(p + 32 * i);
+      __m512 v2 = detail::LoadHalfAVX512(p + 32 * i + 16);
+
+      detail::StoreHalfAVX512(
+          p + 32 * i,  _mm512_permutex2var_ps(v1, idx1, v2));
+      detail::StoreHalfAVX512(
+          p + 32 * i + 16,  _mm512_permutex2var_ps(v1, idx2, v2));
+    };
+
+    Base::for_.Run(
+        MinSize(state.num_qubits()) / 32, f, idx1, idx2, state.get());
+  }
+
+  void NormalToInternalOrder(State& state) const {
+    __m512i idx1 = _mm512_setr_epi32(
+        0, 2, 4, 6, 8, 10, 12, 14, 16, 18, 20, 22, 24, 26, 28, 30);
+    __m512i idx2 = _mm512_setr_epi32(
+        1, 3, 5, 7, 9, 11, 13, 15, 17, 19, 21, 23, 25, 27, 29, 31);
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                __m512i idx1, __m512i idx2, Half* p) {
+      __m512 re = detail::LoadHalfAVX512(p + 32 * i);
+      __m512 im = detail::LoadHalfAVX512(p + 32 * i + 16);
+
+      detail::StoreHalfAVX512(
+          p + 32 * i,  _mm512_permutex2var_ps(re, idx1, im));
+      detail::StoreHalfAVX512(
+          p + 32 * i + 16,  _mm512_permutex2var_ps(re, idx2, im));
+    };
+
+    Base::for_.Run(
+        MinSize(state.num_qubits()) / 32, f, idx1, idx2, state.get());
+  }
+
+  void SetAllZeros(State& state) const {
+    __m512i val0 = _mm512_setzero_si512();
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, __m512i val0, Half* p) {
+      _mm512_store_si512((__m512i*) (p + 32 * i), val0);
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 32, f, val0, state.get());
+  }
+
+  // Uniform superposition.
+  void SetStateUniform(State& state) const {
+    __m512 val0 = _mm512_setzero_ps();
+    __m512 valu;
+
+    fp_type v = StorageScale(state.num_qubits())
+        / std::sqrt(uint64_t{1} << state.num_qubits());
+
+    switch (state.num_qubits()) {
+    case 1:
+      valu = _mm512_set_ps(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, v, v);
+      break;
+    case 2:
+      valu = _mm512_set_ps(0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, v, v, v, v);
+      break;
+    case 3:
+      valu = _mm512_set_ps(0, 0, 0, 0, 0, 0, 0, 0, v, v, v, v, v, v, v, v);
+      break;
+    default:
+      valu = _mm512_set1_ps(v);
+      break;
+    }
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const __m512& val0, const __m512& valu, Half* p) {
+      detail::StoreHalfAVX512(p + 32 * i, valu);
+      detail::StoreHalfAVX512(p + 32 * i + 16, val0);
+    };
+
+    Base::for_.Run(
+        MinSize(state.num_qubits()) / 32, f, val0, valu, state.get());
+  }
+
+  // |0> state.
+  void SetStateZero(State& state) const {
+    SetAllZeros(state);
+    state.get()[0] = FloatToHalf<Half>(StorageScale(state.num_qubits()));
+  }
+
+  static std::complex<fp_type> GetAmpl(const State& state, uint64_t i) {
+    uint64_t k = (32 * (i / 16)) + (i % 16);
+    fp_type s = 1 / StorageScale(state.num_qubits());
+    return std::complex<fp_type>(s * HalfToFloat(state.get()[k]),
+                                 s * HalfToFloat(state.get()[k + 16]));
+  }
+
+  static void SetAmpl(
+      State& state, uint64_t i, const std::complex<fp_type>& ampl) {
+    SetAmpl(state, i, std::real(ampl), std::imag(ampl));
+  }
+
+  static void SetAmpl(State& state, uint64_t i, fp_type re, fp_type im) {
+    uint64_t k = (32 * (i / 16)) + (i % 16);
+    fp_type s = StorageScale(state.num_qubits());
+    state.get()[k] = FloatToHalf<Half>(s * re);
+    state.get()[k + 16] = FloatToHalf<Half>(s * im);
+  }
+
+  // Sets state[i] = complex(re, im) where (i & mask) == bits.
+  // if `exclude` is true then the criteria becomes (i & mask) != bits.
+  void BulkSetAmpl(State& state, uint64_t mask, uint64_t bits,
+                   const std::complex<fp_type>& val,
+                   bool exclude = false) const {
+    BulkSetAmpl(state, mask, bits, std::real(val), std::imag(val), exclude);
+  }
+
+  // Sets state[i] = complex(re, im) where (i & mask) == bits.
+  // if `exclude` is true then the criteria becomes (i & mask) != bits.
+  void BulkSetAmpl(State& state, uint64_t mask, uint64_t bits, fp_type re,
+                   fp_type im, bool exclude = false) const {
+    fp_type s = StorageScale(state.num_qubits());
+    __m512 re_reg = _mm512_set1_ps(s * re);
+    __m512 im_reg = _mm512_set1_ps(s * im);
+
+    __mmask16 exclude_n = exclude ? 0xffff : 0;
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, uint64_t maskv,
+                uint64_t bitsv, __m512 re_n, __m512 im_n, __mmask16 exclude_n,
+                Half* p) {
+      __m512 re = detail::LoadHalfAVX512(p + 32 * i);
+      __m512 im = detail::LoadHalfAVX512(p + 32 * i + 16);
+
+      __mmask16 ml =
+          detail::GetZeroMaskAVX512(16 * i, maskv, bitsv) ^ exclude_n;
+
+      re = _mm512_mask_blend_ps(ml, re, re_n);
+      im = _mm512_mask_blend_ps(ml, im, im_n);
+
+      detail::StoreHalfAVX512(p + 32 * i, re);
+      detail::StoreHalfAVX512(p + 32 * i + 16, im);
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 32, f, mask, bits,
+                   re_reg, im_reg, exclude_n, state.get());
+  }
+
+  // Does the equivalent of dest += src elementwise.
+  bool Add(const State& src, State& dest) const {
+    if (src.num_qubits() != dest.num_qubits()) {
+      return false;
+    }
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const Half* p1, Half* p2) {
+      __m512 re1 = detail::LoadHalfAVX512(p1 + 32 * i);
+      __m512 im1 = detail::LoadHalfAVX512(p1 + 32 * i + 16);
+      __m512 re2 = detail::LoadHalfAVX512(p2 + 32 * i);
+      __m512 im2 = detail::LoadHalfAVX512(p2 + 32 * i + 16);
+
+      detail::StoreHalfAVX512(p2 + 32 * i, _mm512_add_ps(re1, re2));
+      detail::StoreHalfAVX512(p2 + 32 * i + 16, _mm512_add_ps(im1, im2));
+    };
+
+    Base::for_.Run(MinSize(src.num_qubits()) / 32, f, src.get(), dest.get());
+
+    return true;
+  }
+
+  // Does the equivalent of state *= a elementwise.
+  void Multiply(fp_type a, State& state) const {
+    __m512 r = _mm512_set1_ps(a);
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, __m512 r, Half* p) {
+      __m512 re = detail::LoadHalfAVX512(p + 32 * i);
+      __m512 im = detail::LoadHalfAVX512(p + 32 * i + 16);
+
+      re = _mm512_mul_ps(re, r);
+      im = _mm512_mul_ps(im, r);
+
+      detail::StoreHalfAVX512(p + 32 * i, re);
+      detail::StoreHalfAVX512(p + 32 * i + 16, im);
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 32, f, r, state.get());
+  }
+
+  std::complex<double> InnerProduct(
+      const State& state1, const State& state2) const {
+    if (state1.num_qubits() != state2.num_qubits()) {
+      return std::nan("");
+    }
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const Half* p1, const Half* p2) -> std::complex<double> {
+      __m512 re1 = detail::LoadHalfAVX512(p1 + 32 * i);
+      __m512 im1 = detail::LoadHalfAVX512(p1 + 32 * i + 16);
+      __m512 re2 = detail::LoadHalfAVX512(p2 + 32 * i);
+      __m512 im2 = detail::LoadHalfAVX512(p2 + 32 * i + 16);
+
+      double re = detail::HorizontalSumHalfAVX512(
+          _mm512_mul_ps(re1, re2), _mm512_mul_ps(im1, im2));
+      double im = detail::HorizontalSumHalfAVX512(
+          _mm512_mul_ps(re1, im2),
+          _mm512_sub_ps(_mm512_setzero_ps(), _mm512_mul_ps(im1, re2)));
+
+      return std::complex<double>{re, im};
+    };
+
+    double s = StorageScale(state1.num_qubits());
+
+    using Op = std::plus<std::complex<double>>;
+    return Base::for_.RunReduce(MinSize(state1.num_qubits()) / 32, f,
+                                Op(), state1.get(), state2.get()) / (s * s);
+  }
+
+  double RealInnerProduct(const State& state1, const State& state2) const {
+    if (state1.num_qubits() != state2.num_qubits()) {
+      return std::nan("");
+    }
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const Half* p1, const Half* p2) -> double {
+      __m512 re1 = detail::LoadHalfAVX512(p1 + 32 * i);
+      __m512 im1 = detail::LoadHalfAVX512(p1 + 32 * i + 16);
+      __m512 re2 = detail::LoadHalfAVX512(p2 + 32 * i);
+      __m512 im2 = detail::LoadHalfAVX512(p2 + 32 * i + 16);
+
+      return detail::HorizontalSumHalfAVX512(
+          _mm512_mul_ps(re1, re2), _mm512_mul_ps(im1, im2));
+    };
+
+    double s = StorageScale(state1.num_qubits());
+
+    using Op = std::plus<double>;
+    return Base::for_.RunReduce(MinSize(state1.num_qubits()) / 32, f,
+                                Op(), state1.get(), state2.get()) / (s * s);
+  }
+
+  template <typename DistrRealType = double>
+  std::vector<uint64_t> Sample(
+      const State& state, uint64_t num_samples, unsigned seed) const {
+    std::vector<uint64_t> bitstrings;
+
+    if (num_samples > 0) {
+      double norm = 0;
+      uint64_t size = MinSize(state.num_qubits()) / 32;
+      const Half* p = state.get();
+
+      for (uint64_t k = 0; k < size; ++k) {
+        for (unsigned j = 0; j < 16; ++j) {
+          double re = HalfToFloat(p[32 * k + j]);
+          double im = HalfToFloat(p[32 * k + 16 + j]);
+          norm += re * re + im * im;
+        }
+      }
+
+      auto rs = GenerateRandomValues<DistrRealType>(num_samples, seed, norm);
+
+      uint64_t m = 0;
+      double csum = 0;
+      bitstrings.reserve(num_samples);
+
+      for (uint64_t k = 0; k < size; ++k) {
+        for (unsigned j = 0; j < 16; ++j) {
+          double re = HalfToFloat(p[32 * k + j]);
+          double im = HalfToFloat(p[32 * k + 16 + j]);
+          csum += re * re + im * im;
+          while (rs[m] < csum && m < num_samples) {
+            bitstrings.emplace_back(16 * k + j);
+            ++m;
+          }
+        }
+      }
+    }
+
+    return bitstrings;
+  }
+
+  using MeasurementResult = typename Base::MeasurementResult;
+
+  void Collapse(const MeasurementResult& mr, State& state) const {
+    auto f1 = [](unsigned n, unsigned m, uint64_t i,
+                 uint64_t mask, uint64_t bits, const Half* p) -> double {
+      __mmask16 ml = detail::GetZeroMaskAVX512(16 * i, mask, bits);
+
+      __m512 re = detail::LoadHalfAVX512(p + 32 * i);
+      __m512 im = detail::LoadHalfAVX512(p + 32 * i + 16);
+
+      re = _mm512_maskz_mov_ps(ml, re);
+      im = _mm512_maskz_mov_ps(ml, im);
+
+      return detail::HorizontalSumHalfAVX512(
+          _mm512_mul_ps(re, re), _mm512_mul_ps(im, im));
+    };
+
+    using Op = std::plus<double>;
+    double norm = Base::for_.RunReduce(MinSize(state.num_qubits()) / 32, f1,
+                                       Op(), mr.mask, mr.bits, state.get());
+
+    fp_type s = StorageScale(state.num_qubits());
+    __m512 renorm = _mm512_set1_ps(s / std::sqrt(norm));
+
+    auto f2 = [](unsigned n, unsigned m, uint64_t i,
+                 uint64_t mask, uint64_t bits, __m512 renorm, Half* p) {
+      __mmask16 ml = detail::GetZeroMaskAVX512(16 * i, mask, bits);
+
+      __m512 re = detail::LoadHalfAVX512(p + 32 * i);
+      __m512 im = detail::LoadHalfAVX512(p + 32 * i + 16);
+
+      re = _mm512_maskz_mov_ps(ml, re);
+      im = _mm512_maskz_mov_ps(ml, im);
+
+      re = _mm512_mul_ps(re, renorm);
+      im = _mm512_mul_ps(im, renorm);
+
+      detail::StoreHalfAVX512(p + 32 * i, re);
+      detail::StoreHalfAVX512(p + 32 * i + 16, im);
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 32, f2,
+                   mr.mask, mr.bits, renorm, state.get());
+  }
+
+  std::vector<double> PartialNorms(const State& state) const {
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                const Half* p) -> double {
+      __m512 re = detail::LoadHalfAVX512(p + 32 * i);
+      __m512 im = detail::LoadHalfAVX512(p + 32 * i + 16);
+
+      return detail::HorizontalSumHalfAVX512(
+          _mm512_mul_ps(re, re), _mm512_mul_ps(im, im));
+    };
+
+    double s = StorageScale(state.num_qubits());
+
+    using Op = std::plus<double>;
+    auto partial_norms = Base::for_.RunReduceP(
+        MinSize(state.num_qubits()) / 32, f, Op(), state.get());
+
+    for (auto& norm : partial_norms) {
+      norm /= s * s;
+    }
+
+    return partial_norms;
+  }
+
+  uint64_t FindMeasuredBits(
+      unsigned m, double r, uint64_t mask, const State& state) const {
+    double s = StorageScale(state.num_qubits());
+    double csum = 0;
+
+    r *= s * s;
+
+    uint64_t k0 = Base::for_.GetIndex0(MinSize(state.num_qubits()) / 32, m);
+    uint64_t k1 = Base::for_.GetIndex1(MinSize(state.num_qubits()) / 32, m);
+
+    const Half* p = state.get();
+
+    for (uint64_t k = k0; k < k1; ++k) {
+      for (uint64_t j = 0; j < 16; ++j) {
+        double re = HalfToFloat(p[32 * k + j]);
+        double im = HalfToFloat(p[32 * k + j + 16]);
+        csum += re * re + im * im;
+        if (r < csum) {
+          return (16 * k + j) & mask;
+        }
+      }
+    }
+
+    // Return the last bitstring in the unlikely case of underflow.
+    return (16 * k1 - 1) & mask;
+  }
+};
+
+}  // namespace qsim
+
+#endif  // STATESPACE_HALF_AVX512_H_
@@ -19,32 +19,38 @@
 # include "unitary_calculator_avx512.h"
   namespace qsim {
   namespace unitary {
-    template <typename For>
-    using UnitaryCalculator = UnitaryCalculatorAVX512<For>;
+    template <typename For, typename FP = float>
+    using UnitaryCalculator = UnitaryCalculatorAVX512<For, FP>;
   }
   }
 #elif __AVX2__
 # include "unitary_calculator_avx.h"
   namespace qsim {
   namespace unitary {
-    template <typename For>
-    using UnitaryCalculator = UnitaryCalculatorAVX<For>;
+    template <typename For, typename FP = float>
+    using UnitaryCalculator = UnitaryCalculatorAVX<For, FP>;
   }
   }
 #elif __SSE4_1__
+# include <type_traits>
+# include "unitary_calculator_basic.h"
 # include "unitary_calculator_sse.h"
   namespace qsim {
   namespace unitary {
-    template <typename For>
-    using UnitaryCalculator = UnitaryCalculatorSSE<For>;
+    // There is no double-precision SSE unitary calculator; fall back to
+    // the basic one.
+    template <typename For, typename FP = float>
+    using UnitaryCalculator = typename std::conditional<
+        std::is_same<FP, float>::value,
+        UnitaryCalculatorSSE<For>, UnitaryCalculatorBasic<For, FP>>::type;
   }
   }
 #else
 # include "unitary_calculator_basic.h"
   namespace qsim {
   namespace unitary {
-    template <typename For>
-    using UnitaryCalculator = UnitaryCalculatorBasic<For>;
+    template <typename For, typename FP = float>
+    using UnitaryCalculator = UnitaryCalculatorBasic<For, FP>;
   }
   }
 #endif
@@ -29,6 +29,9 @@ namespace qsim {
 
 namespace unitary {
 
+template <typename For, typename FP = float>
+struct UnitarySpaceAVX;
+
 /**
  * Object containing context and routines for unitary manipulations.
  * Unitary is a vectorized sequence of eight real components followed by eight
@@ -36,7 +39,7 @@ namespace unitary {
  * into an AVX register.
  */
 template <typename For>
-struct UnitarySpaceAVX :
+struct UnitarySpaceAVX<For, float> :
     public UnitarySpace<UnitarySpaceAVX<For>, VectorSpace, For, float> {
  private:
   using Base = UnitarySpace<UnitarySpaceAVX<For>,
@@ -106,6 +109,84 @@ struct UnitarySpaceAVX :
   }
 };
 
+/**
+ * Object containing context and routines for double-precision unitary
+ * manipulations. Unitary is a vectorized sequence of four real components
+ * followed by four imaginary components. Four double-precison floating numbers
+ * can be loaded into an AVX register.
+ */
+template <typename For>
+struct UnitarySpaceAVX<For, double> :
+    public UnitarySpace<UnitarySpaceAVX<For, double>,
+                        VectorSpace, For, double> {
+ private:
+  using Base = UnitarySpace<UnitarySpaceAVX<For, double>,
+                            qsim::VectorSpace, For, double>;
+
+ public:
+  using Unitary = typename Base::Unitary;
+  using fp_type = typename Base::fp_type;
+
+  template <typename... ForArgs>
+  explicit UnitarySpaceAVX(ForArgs&&... args) : Base(args...) {}
+
+  static uint64_t MinRowSize(unsigned num_qubits) {
+    return std::max(uint64_t{8}, 2 * (uint64_t{1} << num_qubits));
+  };
+
+  static uint64_t MinSize(unsigned num_qubits) {
+    return Base::Size(num_qubits) * MinRowSize(num_qubits);
+  };
+
+  void SetAllZeros(Unitary& state) const {
+    __m256d val0 = _mm256_setzero_pd();
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, __m256d val0, fp_type* p) {
+      _mm256_store_pd(p + 8 * i, val0);
+      _mm256_store_pd(p + 8 * i + 4, val0);
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 8, f, val0, state.get());
+  }
+
+  void SetIdentity(Unitary& state) {
+    SetAllZeros(state);
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                uint64_t row_size, fp_type* p) {
+      p[row_size * i + (8 * (i / 4)) + (i % 4)] = 1;
+    };
+
+    uint64_t size = Base::Size(state.num_qubits());
+    uint64_t row_size = MinRowSize(state.num_qubits());
+    Base::for_.Run(size, f, row_size, state.get());
+  }
+
+  static std::complex<fp_type> GetEntry(const Unitary& state,
+                                        uint64_t i, uint64_t j) {
+    uint64_t row_size = MinRowSize(state.num_qubits());
+    uint64_t k = (8 * (j / 4)) + (j % 4);
+    return std::complex<fp_type>(state.get()[row_size * i + k],
+                                 state.get()[row_size * i + k + 4]);
+  }
+
+  static void SetEntry(Unitary& state, uint64_t i, uint64_t j,
+                       const std::complex<fp_type>& ampl) {
+    uint64_t row_size = MinRowSize(state.num_qubits());
+    uint64_t k = (8 * (j / 4)) + (j % 4);
+    state.get()[row_size * i + k] = std::real(ampl);
+    state.get()[row_size * i + k + 4] = std::imag(ampl);
+  }
+
+  static void SetEntry(Unitary& state, uint64_t i, uint64_t j, fp_type re,
+                       fp_type im) {
+    uint64_t row_size = MinRowSize(state.num_qubits());
+    uint64_t k = (8 * (j / 4)) + (j % 4);
+    state.get()[row_size * i + k] = re;
+    state.get()[row_size * i + k + 4] = im;
+  }
+};
+
 }  // namespace unitary
 }  // namespace qsim
 
@@ -29,6 +29,9 @@ namespace qsim {
 
 namespace unitary {
 
+template <typename For, typename FP = float>
+struct UnitarySpaceAVX512;
+
 /**
  * Object containing context and routines for unitary manipulations.
  * State is a vectorized sequence of sixteen real components followed by
@@ -36,7 +39,7 @@ namespace unitary {
  * be loaded into an AVX512 register.
  */
 template <typename For>
-struct UnitarySpaceAVX512 :
+struct UnitarySpaceAVX512<For, float> :
     public UnitarySpace<UnitarySpaceAVX512<For>, VectorSpace, For, float> {
  private:
   using Base = UnitarySpace<UnitarySpaceAVX512<For>,
@@ -106,6 +109,84 @@ struct UnitarySpaceAVX512 :
   }
 };
 
+/**
+ * Object containing context and routines for double-precision unitary
+ * manipulations. Unitary is a vectorized sequence of eight real components
+ * followed by eight imaginary components. Eight double-precison floating
+ * numbers can be loaded into an AVX512 register.
+ */
+template <typename For>
+struct UnitarySpaceAVX512<For, double> :
+    public UnitarySpace<UnitarySpaceAVX512<For, double>,
+                        VectorSpace, For, double> {
+ private:
+  using Base = UnitarySpace<UnitarySpaceAVX512<For, double>,
+                            qsim::VectorSpace, For, double>;
+
+ public:
+  using Unitary = typename Base::Unitary;
+  using fp_type = typename Base::fp_type;
+
+  template <typename... ForArgs>
+  explicit UnitarySpaceAVX512(ForArgs&&... args) : Base(args...) {}
+
+  static uint64_t MinRowSize(unsigned num_qubits) {
+    return std::max(uint64_t{16}, 2 * (uint64_t{1} << num_qubits));
+  };
+
+  static uint64_t MinSize(unsigned num_qubits) {
+    return Base::Size(num_qubits) * MinRowSize(num_qubits);
+  };
+
+  void SetAllZeros(Unitary& state) const {
+    __m512d val0 = _mm512_setzero_pd();
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, __m512d& val, fp_type* p) {
+      _mm512_store_pd(p + 16 * i, val);
+      _mm512_store_pd(p + 16 * i + 8, val);
+    };
+
+    Base::for_.Run(MinSize(state.num_qubits()) / 16, f, val0, state.get());
+  }
+
+  void SetIdentity(Unitary& state) {
+    SetAllZeros(state);
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                uint64_t row_size, fp_type* p) {
+      p[row_size * i + (16 * (i / 8)) + (i % 8)] = 1;
+    };
+
+    uint64_t size = Base::Size(state.num_qubits());
+    uint64_t row_size = MinRowSize(state.num_qubits());
+    Base::for_.Run(size, f, row_size, state.get());
+  }
+
+  static std::complex<fp_type> GetEntry(const Unitary& state,
+                                        uint64_t i, uint64_t j) {
+    uint64_t row_size = MinRowSize(state.num_qubits());
+    uint64_t k = (16 * (j / 8)) + (j % 8);
+    return std::complex<fp_type>(state.get()[row_size * i + k],
+                                 state.get()[row_size * i + k + 8]);
+  }
+
+  static void SetEntry(Unitary& state, uint64_t i, uint64_t j,
+                       const std::complex<fp_type>& ampl) {
+    uint64_t row_size = MinRowSize(state.num_qubits());
+    uint64_t k = (16 * (j / 8)) + (j % 8);
+    state.get()[row_size * i + k] = std::real(ampl);
+    state.get()[row_size * i + k + 8] = std::imag(ampl);
+  }
+
+  static void SetEntry(Unitary& state, uint64_t i, uint64_t j, fp_type re,
+                       fp_type im) {
+    uint64_t row_size = MinRowSize(state.num_qubits());
+    uint64_t k = (16 * (j / 8)) + (j % 8);
+    state.get()[row_size * i + k] = re;
+    state.get()[row_size * i + k + 8] = im;
+  }
+};
+
 }  // namespace unitary
 }  // namespace qsim
 
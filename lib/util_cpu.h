@@ -15,10 +15,18 @@
 #ifndef UTIL_CPU_H_
 #define UTIL_CPU_H_
 
+#include <cstdint>
+
 #ifdef __SSE2__
 # include <immintrin.h>
 #endif
 
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+# include <intrin.h>
+#elif defined(__x86_64__) || defined(__i386__)
+# include <cpuid.h>
+#endif
+
 namespace qsim {
 
 // This function sets flush-to-zero and denormals-are-zeros MXCSR control
@@ -38,6 +46,113 @@ inline void ClearFlushToZeroAndDenormalsAreZeros() {
 #endif
 }
 
+/**
+ * SIMD instruction sets for which qsim has state-vector simulators,
+ * from the narrowest to the widest.
+ */
+enum SimdInstructions {
+  kBasic = 0,
+  kSSE4_1 = 1,
+  kAVX2 = 2,      // Also requires FMA and BMI2.
+  kAVX512F = 3,   // Also requires AVX2, FMA and BMI2.
+};
+
+namespace detail {
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+
+inline void CpuId(unsigned leaf, unsigned info[4]) {
+  int r[4];
+  __cpuidex(r, leaf, 0);
+  for (unsigned i = 0; i < 4; ++i) {
+    info[i] = r[i];
+  }
+}
+
+inline uint64_t XGetBV() {
+  return _xgetbv(0);
+}
+
+#elif defined(__x86_64__) || defined(__i386__)
+
+inline void CpuId(unsigned leaf, unsigned info[4]) {
+  __cpuid_count(leaf, 0, info[0], info[1], info[2], info[3]);
+}
+
+inline uint64_t XGetBV() {
+  unsigned eax, edx;
+  __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+  return (uint64_t{edx} << 32) | eax;
+}
+
+#endif
+
+}  // namespace detail
+
+/**
+ * Detects the widest SIMD instruction set supported by the CPU and enabled
+ * by the operating system. Returns kBasic on non-x86 platforms.
+ */
+inline SimdInstructions DetectSimdInstructions() {
+#if defined(__x86_64__) || defined(__i386__) \
+    || (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+  unsigned info[4];
+
+  detail::CpuId(0, info);
+  unsigned num_leaves = info[0];
+
+  if (num_leaves < 1) {
+    return kBasic;
+  }
+
+  detail::CpuId(1, info);
+
+  bool sse4_1 = (info[2] & (1 << 19)) != 0;
+  bool fma = (info[2] & (1 << 12)) != 0;
+  bool osxsave = (info[2] & (1 << 27)) != 0;
+  bool avx = (info[2] & (1 << 28)) != 0;
+
+  if (!sse4_1) {
+    return kBasic;
+  }
+
+  if (num_leaves < 7 || !osxsave || !avx || !fma) {
+    return kSSE4_1;
+  }
+
+  // The OS should save the SSE and AVX registers (XCR0 bits 1 and 2) and,
+  // for AVX512, the opmask and ZMM registers (XCR0 bits 5, 6 and 7).
+  uint64_t xcr0 = detail::XGetBV();
+  if ((xcr0 & 0x6) != 0x6) {
+    return kSSE4_1;
+  }
+
+  detail::CpuId(7, info);
+
+  bool avx2 = (info[1] & (1 << 5)) != 0;
+  bool bmi2 = (info[1] & (1 << 8)) != 0;
+  bool avx512f = (info[1] & (1 << 16)) != 0;
+
+  if (!avx2 || !bmi2) {
+    return kSSE4_1;
+  }
+
+  if (!avx512f || (xcr0 & 0xe0) != 0xe0) {
+    return kAVX2;
+  }
+
+  return kAVX512F;
+#else
+  return kBasic;
+#endif
+}
+
+// Returns the result of DetectSimdInstructions; the detection is done once.
+inline SimdInstructions GetSimdInstructions() {
+  static const SimdInstructions instructions = DetectSimdInstructions();
+  return instructions;
+}
+
 }  // namespace qsim
 
 #endif  // UTIL_CPU_H_
@@ -24,8 +24,24 @@
 #include <memory>
 #include <utility>
 
+#include "numa.h"
+
 namespace qsim {
 
+/**
+ * Placement of state vectors on NUMA nodes, see VectorSpace::Create.
+ */
+enum NumaPolicy {
+  // The pages are placed by the operating system, usually on the node of
+  // the thread that touches them first.
+  kNumaDefault = 0,
+  // The pages are interleaved across all the NUMA nodes.
+  kNumaInterleave,
+  // The pages are touched by the threads of For, such that each thread gets
+  // its part of the vector (as given by For::GetIndex0/1) on its own node.
+  kNumaFirstTouch,
+};
+
 namespace detail {
 
 inline void do_not_free(void*) {}
@@ -101,6 +117,48 @@ class VectorSpace {
     #endif
   }
 
+  /**
+   * Creates a vector with the pages placed on NUMA nodes according to
+   * `policy`. The memory is page aligned. kNumaFirstTouch zero-initializes
+   * the vector and is useful only if the threads of For stay on their
+   * nodes, that is, with PoolFor with pinned threads,
+   * PoolFor(num_threads, true). With unpinned threads, the pages end up on
+   * whatever nodes the threads happen to run on.
+   */
+  Vector Create(unsigned num_qubits, NumaPolicy policy) const {
+#ifdef _WIN32
+    return Create(num_qubits);
+#else
+    if (policy == kNumaDefault) {
+      return Create(num_qubits);
+    }
+
+    constexpr uint64_t kPageSize = 4096;
+
+    uint64_t size = sizeof(fp_type) * Impl::MinSize(num_qubits);
+    size = (size + kPageSize - 1) & ~(kPageSize - 1);
+
+    void* p = nullptr;
+    if (posix_memalign(&p, kPageSize, size) != 0) {
+      return Null();
+    }
+
+    if (policy == kNumaInterleave) {
+      InterleaveMemory(p, size);
+    } else if (policy == kNumaFirstTouch) {
+      // Touches the memory with the same partition as gate applications,
+      // which split the vector proportionally between the threads.
+      auto f = [](unsigned n, unsigned m, uint64_t i, fp_type* p) {
+        p[i] = 0;
+      };
+
+      for_.Run(Impl::MinSize(num_qubits), f, (fp_type*) p);
+    }
+
+    return Vector{Pointer{(fp_type*) p, &detail::free}, num_qubits};
+#endif
+  }
+
   // It is the client's responsibility to make sure that p has at least
   // 2 * 2^num_qubits elements.
   static Vector Create(fp_type* p, unsigned num_qubits) {
@@ -19,19 +19,20 @@
 #include "../../lib/util_cpu.h"
 
 namespace qsim {
-  template <typename For>
-  using Simulator = SimulatorAVX<For>;
+  template <typename For, typename FP = float>
+  using Simulator = SimulatorAVX<For, FP>;
 
-  struct Factory {
+  template <typename FP>
+  struct FactoryT {
     // num_state_threads and num_dblocks are unused, but kept for consistency
     // with the GPU Factory.
-    Factory(
+    FactoryT(
       unsigned num_sim_threads,
       unsigned num_state_threads,
       unsigned num_dblocks) : num_threads(num_sim_threads) {}
 
-    using Simulator = qsim::Simulator<For>;
-    using StateSpace = Simulator::StateSpace;
+    using Simulator = qsim::Simulator<For, FP>;
+    using StateSpace = typename Simulator::StateSpace;
 
     StateSpace CreateStateSpace() const {
       return StateSpace(num_threads);
@@ -43,6 +44,8 @@ namespace qsim {
 
     unsigned num_threads;
   };
+
+  using Factory = FactoryT<float>;
 }
 
 #include "../pybind_main.cpp"
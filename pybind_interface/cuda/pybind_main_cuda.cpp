@@ -17,13 +17,15 @@
 #include "../../lib/simulator_cuda.h"
 
 namespace qsim {
-  using Simulator = SimulatorCUDA<float>;
+  template <typename FP = float>
+  using Simulator = SimulatorCUDA<FP>;
 
-  struct Factory {
-    using Simulator = qsim::Simulator;
-    using StateSpace = Simulator::StateSpace;
+  template <typename FP>
+  struct FactoryT {
+    using Simulator = qsim::Simulator<FP>;
+    using StateSpace = typename Simulator::StateSpace;
 
-    Factory(
+    FactoryT(
       unsigned num_sim_threads,
       unsigned num_state_threads,
       unsigned num_dblocks
@@ -37,9 +39,11 @@ namespace qsim {
       return Simulator();
     }
 
-    StateSpace::Parameter ss_params;
+    typename StateSpace::Parameter ss_params;
   };
 
+  using Factory = FactoryT<float>;
+
   inline void SetFlushToZeroAndDenormalsAreZeros() {}
   inline void ClearFlushToZeroAndDenormalsAreZeros() {}
 }
@@ -21,22 +21,24 @@
 
 namespace qsim {
 
-using Simulator = SimulatorCuStateVec<float>;
+template <typename FP = float>
+using Simulator = SimulatorCuStateVec<FP>;
 
-struct Factory {
-  using Simulator = qsim::Simulator;
-  using StateSpace = Simulator::StateSpace;
+template <typename FP>
+struct FactoryT {
+  using Simulator = qsim::Simulator<FP>;
+  using StateSpace = typename Simulator::StateSpace;
 
   // num_sim_threads, num_state_threads and num_dblocks are unused, but kept
   // for consistency with other factories.
-  Factory(unsigned num_sim_threads,
+  FactoryT(unsigned num_sim_threads,
           unsigned num_state_threads,
           unsigned num_dblocks) {
     ErrorCheck(cublasCreate(&cublas_handle));
     ErrorCheck(custatevecCreate(&custatevec_handle));
   }
 
-  ~Factory() {
+  ~FactoryT() {
     ErrorCheck(cublasDestroy(cublas_handle));
     ErrorCheck(custatevecDestroy(custatevec_handle));
   }
@@ -53,6 +55,8 @@ struct Factory {
   custatevecHandle_t custatevec_handle;
 };
 
+using Factory = FactoryT<float>;
+
 inline void SetFlushToZeroAndDenormalsAreZeros() {}
 inline void ClearFlushToZeroAndDenormalsAreZeros() {}
 
@@ -19,10 +19,12 @@
 #include <cmath>
 #include <algorithm>
 #include <string>
+#include <type_traits>
 #include <vector>
 
 #include "../lib/bitstring.h"
 #include "../lib/channel.h"
+#include "../lib/density_matrix.h"
 #include "../lib/expect.h"
 #include "../lib/formux.h"
 #include "../lib/fuser_mqubit.h"
@@ -80,6 +82,67 @@ std::vector<Bitstring> getBitstrings(const py::dict &options, int num_qubits) {
   return bitstrings;
 }
 
+// Returns true if the double-precision simulator is requested.
+bool useDoublePrecision(const py::dict &options) {
+  return options.contains("dp\0") && parseOptions<unsigned>(options, "dp\0");
+}
+
+template <typename FP>
+Cirq::GateCirq<FP> convertGate(const Cirq::GateCirq<float>& gate) {
+  Cirq::GateCirq<FP> converted;
+  converted.kind = gate.kind;
+  converted.time = gate.time;
+  converted.qubits = gate.qubits;
+  converted.controlled_by = gate.controlled_by;
+  converted.cmask = gate.cmask;
+  converted.params.assign(gate.params.begin(), gate.params.end());
+  converted.matrix.assign(gate.matrix.begin(), gate.matrix.end());
+  converted.unfusible = gate.unfusible;
+  converted.swapped = gate.swapped;
+  return converted;
+}
+
+template <typename FP>
+Circuit<Cirq::GateCirq<FP>> convertCircuit(
+    const Circuit<Cirq::GateCirq<float>>& circuit) {
+  Circuit<Cirq::GateCirq<FP>> converted;
+  converted.num_qubits = circuit.num_qubits;
+  converted.gates.reserve(circuit.gates.size());
+  for (const auto& gate : circuit.gates) {
+    converted.gates.push_back(convertGate<FP>(gate));
+  }
+  return converted;
+}
+
+template <typename FP>
+NoisyCircuit<Cirq::GateCirq<FP>> convertNoisyCircuit(
+    const NoisyCircuit<Cirq::GateCirq<float>>& ncircuit) {
+  using Gate = Cirq::GateCirq<FP>;
+  using KrausOp = KrausOperator<Gate>;
+
+  NoisyCircuit<Gate> converted;
+  converted.num_qubits = ncircuit.num_qubits;
+  converted.channels.reserve(ncircuit.channels.size());
+  for (const auto& channel : ncircuit.channels) {
+    Channel<Gate> converted_channel;
+    converted_channel.reserve(channel.size());
+    for (const auto& kop : channel) {
+      KrausOp converted_kop;
+      converted_kop.kind = static_cast<typename KrausOp::Kind>(kop.kind);
+      converted_kop.unitary = kop.unitary;
+      converted_kop.prob = kop.prob;
+      for (const auto& op : kop.ops) {
+        converted_kop.ops.push_back(convertGate<FP>(op));
+      }
+      converted_kop.kd_k.assign(kop.kd_k.begin(), kop.kd_k.end());
+      converted_kop.qubits = kop.qubits;
+      converted_channel.push_back(std::move(converted_kop));
+    }
+    converted.channels.push_back(std::move(converted_channel));
+  }
+  return converted;
+}
+
 }  // namespace
 
 Cirq::GateCirq<float> create_gate(const qsim::Cirq::GateKind gate_kind,
@@ -207,6 +270,17 @@ Cirq::GateCirq<float> create_gate(const qsim::Cirq::GateKind gate_kind,
       return gate::Measurement<Cirq::GateCirq<float>>::Create(
         time, std::move(qubits_));
       }
+    case Cirq::kPauliRotation: {
+      // The Pauli operators acting on the qubits are passed as "pauli_<k>"
+      // parameters: 0 for I, 1 for X, 2 for Y and 3 for Z.
+      std::vector<unsigned> paulis;
+      paulis.reserve(qubits.size());
+      for (std::size_t k = 0; k < qubits.size(); ++k) {
+        paulis.push_back(unsigned(params.at("pauli_" + std::to_string(k))));
+      }
+      return Cirq::PauliRotation<float>::Create(
+        time, qubits, paulis, params.at("theta"));
+      }
     // Matrix gates are handled in the add_matrix methods below.
     default:
       throw std::invalid_argument("GateKind not supported.");
@@ -355,20 +429,13 @@ void add_gate_to_opstring(const Cirq::GateKind gate_kind,
 
 // Methods for simulating amplitudes.
 
-std::vector<std::complex<float>> qsim_simulate(const py::dict &options) {
-  Circuit<Cirq::GateCirq<float>> circuit;
-  std::vector<Bitstring> bitstrings;
-  try {
-    circuit = getCircuit(options);
-    bitstrings = getBitstrings(options, circuit.num_qubits);
-  } catch (const std::invalid_argument &exp) {
-    IO::errorf(exp.what());
-    return {};
-  }
-
-  using Simulator = Factory::Simulator;
-  using StateSpace = Simulator::StateSpace;
-  using State = StateSpace::State;
+template <typename Factory, typename Gate>
+std::vector<std::complex<float>> qsim_simulate_impl(
+    const py::dict &options, const Circuit<Gate> &circuit,
+    const std::vector<Bitstring> &bitstrings) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Simulator::StateSpace;
+  using State = typename StateSpace::State;
 
   // Define container for amplitudes
   std::vector<std::complex<float>> amplitudes;
@@ -378,12 +445,11 @@ std::vector<std::complex<float>> qsim_simulate(const py::dict &options) {
                      unsigned k, const StateSpace &state_space,
                      const State &state) {
     for (const auto &b : bitstrings) {
-      amplitudes.push_back(state_space.GetAmpl(state, b));
+      amplitudes.emplace_back(state_space.GetAmpl(state, b));
     }
   };
 
-  using Runner = QSimRunner<IO, MultiQubitGateFuser<IO, Cirq::GateCirq<float>>,
-                            Factory>;
+  using Runner = QSimRunner<IO, MultiQubitGateFuser<IO, Gate>, Factory>;
 
   bool use_gpu;
   bool denormals_are_zeros;
@@ -391,7 +457,7 @@ std::vector<std::complex<float>> qsim_simulate(const py::dict &options) {
   unsigned num_sim_threads = 0;
   unsigned num_state_threads = 0;
   unsigned num_dblocks = 0;
-  Runner::Parameter param;
+  typename Runner::Parameter param;
   try {
     use_gpu = parseOptions<unsigned>(options, "g\0");
     gpu_mode = parseOptions<unsigned>(options, "gmode\0");
@@ -422,32 +488,44 @@ std::vector<std::complex<float>> qsim_simulate(const py::dict &options) {
   return amplitudes;
 }
 
-std::vector<std::complex<float>> qtrajectory_simulate(const py::dict &options) {
-  NoisyCircuit<Cirq::GateCirq<float>> ncircuit;
-  unsigned num_qubits;
+std::vector<std::complex<float>> qsim_simulate(const py::dict &options) {
+  Circuit<Cirq::GateCirq<float>> circuit;
   std::vector<Bitstring> bitstrings;
+  bool use_double;
   try {
-    ncircuit = getNoisyCircuit(options);
-    num_qubits = ncircuit.num_qubits;
-    bitstrings = getBitstrings(options, num_qubits);
+    circuit = getCircuit(options);
+    bitstrings = getBitstrings(options, circuit.num_qubits);
+    use_double = useDoublePrecision(options);
   } catch (const std::invalid_argument &exp) {
     IO::errorf(exp.what());
     return {};
   }
 
-  using Simulator = Factory::Simulator;
-  using StateSpace = Simulator::StateSpace;
-  using State = StateSpace::State;
+  if (use_double) {
+    return qsim_simulate_impl<FactoryT<double>>(
+        options, convertCircuit<double>(circuit), bitstrings);
+  } else {
+    return qsim_simulate_impl<Factory>(options, circuit, bitstrings);
+  }
+}
+
+template <typename Factory, typename Gate>
+std::vector<std::complex<float>> qtrajectory_simulate_impl(
+    const py::dict &options, const NoisyCircuit<Gate> &ncircuit,
+    const std::vector<Bitstring> &bitstrings) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Simulator::StateSpace;
+  using State = typename StateSpace::State;
 
   // Define container for amplitudes
   std::vector<std::complex<float>> amplitudes;
   amplitudes.reserve(bitstrings.size());
 
-  using Runner = qsim::QuantumTrajectorySimulator<IO, Cirq::GateCirq<float>,
+  using Runner = qsim::QuantumTrajectorySimulator<IO, Gate,
                                                   MultiQubitGateFuser,
                                                   Simulator>;
 
-  Runner::Parameter param;
+  typename Runner::Parameter param;
   bool use_gpu;
   bool denormals_are_zeros;
   unsigned gpu_mode;
@@ -479,9 +557,10 @@ std::vector<std::complex<float>> qtrajectory_simulate(const py::dict &options) {
   StateSpace state_space = factory.CreateStateSpace();
 
   auto measure = [&bitstrings, &ncircuit, &amplitudes, &state_space](
-                  unsigned k, const State &state, Runner::Stat& stat) {
+                  unsigned k, const State &state,
+                  typename Runner::Stat& stat) {
     for (const auto &b : bitstrings) {
-      amplitudes.push_back(state_space.GetAmpl(state, b));
+      amplitudes.emplace_back(state_space.GetAmpl(state, b));
     }
   };
 
@@ -499,6 +578,27 @@ std::vector<std::complex<float>> qtrajectory_simulate(const py::dict &options) {
   return amplitudes;
 }
 
+std::vector<std::complex<float>> qtrajectory_simulate(const py::dict &options) {
+  NoisyCircuit<Cirq::GateCirq<float>> ncircuit;
+  std::vector<Bitstring> bitstrings;
+  bool use_double;
+  try {
+    ncircuit = getNoisyCircuit(options);
+    bitstrings = getBitstrings(options, ncircuit.num_qubits);
+    use_double = useDoublePrecision(options);
+  } catch (const std::invalid_argument &exp) {
+    IO::errorf(exp.what());
+    return {};
+  }
+
+  if (use_double) {
+    return qtrajectory_simulate_impl<FactoryT<double>>(
+        options, convertNoisyCircuit<double>(ncircuit), bitstrings);
+  } else {
+    return qtrajectory_simulate_impl<Factory>(options, ncircuit, bitstrings);
+  }
+}
+
 // Helper class for simulating circuits of all types.
 class SimulatorHelper {
  public:
@@ -550,23 +650,38 @@ class SimulatorHelper {
       return helper.get_expectation_value(opsums_and_qubit_counts);
     }
 
-    // Aggregate expectation values for noisy circuits.
-    std::vector<std::complex<double>> results(
-      opsums_and_qubit_counts.size(), 0);
-    for (unsigned rep = 0; rep < helper.noisy_reps; ++rep) {
-      if (!helper.simulate(input_state)) {
-        return {};
-      }
-      auto evs = helper.get_expectation_value(opsums_and_qubit_counts);
-      for (unsigned i = 0; i < evs.size(); ++i) {
-        results[i] += evs[i];
-      }
+    TrajectoryEstimator estimator(opsums_and_qubit_counts.size(),
+                                  helper.get_estimator_params());
+    if (!helper.estimate_expectation_values(
+            opsums_and_qubit_counts, input_state, estimator)) {
+      return {};
     }
-    double inverse_num_reps = 1.0 / helper.noisy_reps;
-    for (unsigned i = 0; i < results.size(); ++i) {
-      results[i] *= inverse_num_reps;
+    return estimator.Means();
+  }
+
+  // Returns the expectation values of a noisy circuit, their standard errors
+  // and the number of repetitions performed.
+  template <typename StateType>
+  static std::tuple<std::vector<std::complex<double>>, std::vector<double>,
+                    uint64_t>
+  simulate_expectation_values_with_errors(
+      const py::dict &options,
+      const std::vector<std::tuple<
+                            std::vector<OpString<Cirq::GateCirq<float>>>,
+                            unsigned>>& opsums_and_qubit_counts,
+      const StateType& input_state) {
+    auto helper = SimulatorHelper(options, true);
+    if (!helper.is_valid) {
+      return {};
     }
-    return results;
+    TrajectoryEstimator estimator(opsums_and_qubit_counts.size(),
+                                  helper.get_estimator_params());
+    if (!helper.estimate_expectation_values(
+            opsums_and_qubit_counts, input_state, estimator)) {
+      return {};
+    }
+    return std::make_tuple(estimator.Means(), estimator.StdErrors(),
+                           estimator.NumRepetitions());
   }
 
   template <typename StateType>
@@ -601,15 +716,34 @@ class SimulatorHelper {
       return results;
     }
 
-    // Aggregate expectation values for noisy circuits.
+    // Aggregate expectation values for noisy circuits. The expectation
+    // values after each moment are computed only once for the primary
+    // trajectory. The last deferred operators are always applied, as the
+    // state is needed for the next moments. The results after each moment
+    // are weighted by the product of the likelihood ratios of the moments
+    // so far. Repetitions stop once the expectation values after all
+    // the moments converge.
+    std::vector<PrimaryTrajectoryCache<std::vector<std::complex<double>>>>
+        caches(opsums_and_qubit_counts.size());
+    std::vector<TrajectoryEstimator> estimators;
+    estimators.reserve(opsums_and_qubit_counts.size());
+    helper.use_error_sampling = true;
     for (unsigned i = 0; i < opsums_and_qubit_counts.size(); ++i) {
       auto& counts = std::get<1>(opsums_and_qubit_counts[i]);
-      results[i].resize(counts.size(), 0);
+      estimators.emplace_back(counts.size(), helper.get_estimator_params());
     }
-    for (unsigned rep = 0; rep < helper.noisy_reps; ++rep) {
+    auto done = [&estimators]() {
+      for (const auto& estimator : estimators) {
+        if (!estimator.Done()) return false;
+      }
+      return !estimators.empty();
+    };
+    for (unsigned rep = 0; rep < helper.noisy_reps && !done(); ++rep) {
       // Init outside of simulation to enable stepping.
       helper.init_state(input_state);
       uint64_t begin = 0;
+      bool primary = true;
+      double weight = 1;
       for (unsigned i = 0; i < opsums_and_qubit_counts.size(); ++i) {
         auto& pair = opsums_and_qubit_counts[i];
         uint64_t end = std::get<0>(pair);
@@ -617,18 +751,21 @@ class SimulatorHelper {
         if (!helper.simulate_subcircuit(begin, end)) {
           return {};
         }
-        auto evs = helper.get_expectation_value(counts);
-        for (unsigned j = 0; j < evs.size(); ++j) {
-          results[i][j] += evs[j];
-        }
+        primary = primary && helper.stat.primary;
+        weight *= helper.stat.weight;
+        auto evs = caches[i].Get(primary, [&helper, &counts]() {
+          return helper.get_expectation_value(counts);
+        });
+        estimators[i].Add(evs, weight);
         begin = end;
       }
     }
-    double inverse_num_reps = 1.0 / helper.noisy_reps;
+    if (!caches.empty()) {
+      helper.report_primary_stat(caches.back());
+      helper.report_estimator_stat(estimators.back());
+    }
     for (unsigned i = 0; i < results.size(); ++i) {
-      for (unsigned j = 0; j < results[i].size(); ++j) {
-        results[i][j] *= inverse_num_reps;
-      }
+      results[i] = estimators[i].Means();
     }
     return results;
   }
@@ -646,6 +783,18 @@ class SimulatorHelper {
         ncircuit = getNoisyCircuit(options);
         num_qubits = ncircuit.num_qubits;
         noisy_reps = parseOptions<unsigned>(options, "r\0");
+        if (options.contains("eb\0")) {
+          error_bias = parseOptions<double>(options, "eb\0");
+        }
+        if (options.contains("es\0")) {
+          num_error_strata = parseOptions<unsigned>(options, "es\0");
+        }
+        if (options.contains("se\0")) {
+          target_std_error = parseOptions<double>(options, "se\0");
+        }
+        if (options.contains("tmax\0")) {
+          max_time = parseOptions<double>(options, "tmax\0");
+        }
       } else {
         circuit = getCircuit(options);
         num_qubits = circuit.num_qubits;
@@ -707,16 +856,75 @@ class SimulatorHelper {
     NoisyRunner::Parameter params;
     params.max_fused_size = max_fused_size;
     params.verbosity = verbosity;
+    params.apply_last_deferred_ops = apply_last_deferred_ops;
+    if (use_error_sampling) {
+      params.error_bias = error_bias;
+      params.num_error_strata = num_error_strata;
+    }
     return params;
   }
 
+  template <typename Cache>
+  void report_primary_stat(const Cache& cache) const {
+    if (verbosity > 0) {
+      IO::messagef("primary trajectory: %lu of %lu repetitions, "
+                   "hit rate %g\n", cache.NumPrimary(),
+                   cache.NumRepetitions(), cache.HitRate());
+    }
+  }
+
+  void report_estimator_stat(const TrajectoryEstimator& estimator) const {
+    if (verbosity > 0) {
+      IO::messagef("expectation values: %lu repetitions, max standard error "
+                   "%g, effective sample size %g, %g s\n",
+                   estimator.NumRepetitions(), estimator.MaxStdError(),
+                   estimator.EffectiveSampleSize(), estimator.ElapsedTime());
+    }
+  }
+
+  TrajectoryEstimator::Parameter get_estimator_params() const {
+    TrajectoryEstimator::Parameter params;
+    params.target_std_error = target_std_error;
+    params.max_repetitions = noisy_reps;
+    params.max_time = max_time;
+    if (num_error_strata > 1) {
+      params.block_size = num_error_strata;
+    }
+    return params;
+  }
+
+  // Aggregates expectation values of noisy circuits. The expectation values
+  // of the primary trajectory are computed only once. The results of
+  // the repetitions are weighted by the likelihood ratios of importance
+  // sampling (all weights are equal to one if it is disabled).
+  template <typename StateType>
+  bool estimate_expectation_values(
+      const std::vector<std::tuple<std::vector<OpString<Gate>>,
+                                   unsigned>>& opsums_and_qubit_counts,
+      const StateType& input_state, TrajectoryEstimator& estimator) {
+    PrimaryTrajectoryCache<std::vector<std::complex<double>>> cache;
+    use_error_sampling = true;
+    for (unsigned rep = 0; rep < noisy_reps && !estimator.Done(); ++rep) {
+      apply_last_deferred_ops = !cache.HasResult();
+      if (!simulate(input_state)) {
+        return false;
+      }
+      auto evs = cache.Get(stat.primary, [&]() {
+        return get_expectation_value(opsums_and_qubit_counts);
+      });
+      estimator.Add(evs, stat.weight);
+    }
+    report_primary_stat(cache);
+    report_estimator_stat(estimator);
+    return true;
+  }
+
   template <typename StateType>
   bool simulate(const StateType& input_state) {
     init_state(input_state);
     bool result = false;
 
     if (is_noisy) {
-      NoisyRunner::Stat stat;
       auto params = get_noisy_params();
 
       Simulator simulator = factory.CreateSimulator();
@@ -735,8 +943,10 @@ class SimulatorHelper {
     bool result = false;
 
     if (is_noisy) {
-      NoisyRunner::Stat stat;
       auto params = get_noisy_params();
+      // Each subcircuit is run with a different seed, so repetitions cannot
+      // be stratified consistently.
+      params.num_error_strata = 0;
       Simulator simulator = factory.CreateSimulator();
       StateSpace state_space = factory.CreateStateSpace();
 
@@ -790,12 +1000,19 @@ class SimulatorHelper {
     StateSpace state_space = factory.CreateStateSpace();
     using Fuser = MultiQubitGateFuser<IO, Gate>;
 
+    using HasKernel = std::integral_constant<
+        bool, HasPauliExpectationKernel<Simulator>::value>;
+
     std::vector<std::complex<double>> results;
     results.reserve(opsums_and_qubit_counts.size());
     for (const auto& opsum_qubit_count_pair : opsums_and_qubit_counts) {
       const auto& opsum = std::get<0>(opsum_qubit_count_pair);
       const auto& opsum_qubits = std::get<1>(opsum_qubit_count_pair);
-      if (opsum_qubits <= 6) {
+      std::complex<double> result;
+      if (get_pauli_expectation_value(
+              HasKernel{}, opsum, simulator, state, result)) {
+        results.push_back(result);
+      } else if (opsum_qubits <= 6) {
         results.push_back(ExpectationValue<IO, Fuser>(opsum, simulator, state));
       } else {
         Fuser::Parameter params;
@@ -808,6 +1025,52 @@ class SimulatorHelper {
     return results;
   }
 
+  // Evaluates opsums of Pauli operators in one pass over the state per group
+  // of strings with the same X and Y operators.
+  static bool get_pauli_expectation_value(
+      std::true_type, const std::vector<OpString<Gate>>& opsum,
+      const Simulator& simulator, const State& state,
+      std::complex<double>& result) {
+    std::vector<PauliString> strings;
+    strings.reserve(opsum.size());
+    for (const auto& opstring : opsum) {
+      strings.push_back({opstring.weight, {}, {}});
+      for (const auto& op : opstring.ops) {
+        if (op.qubits.size() != 1 || !op.controlled_by.empty()) {
+          return false;
+        }
+        unsigned pauli;
+        switch (op.kind) {
+        case Cirq::kI1:
+          pauli = 0;
+          break;
+        case Cirq::kX:
+          pauli = 1;
+          break;
+        case Cirq::kY:
+          pauli = 2;
+          break;
+        case Cirq::kZ:
+          pauli = 3;
+          break;
+        default:
+          return false;
+        }
+        strings.back().qubits.push_back(op.qubits[0]);
+        strings.back().paulis.push_back(pauli);
+      }
+    }
+    result = ExpectationValue<IO>(strings, simulator, state);
+    return true;
+  }
+
+  static bool get_pauli_expectation_value(
+      std::false_type, const std::vector<OpString<Gate>>& opsum,
+      const Simulator& simulator, const State& state,
+      std::complex<double>& result) {
+    return false;
+  }
+
   bool is_noisy;
   // Only one of these will be populated, as specified by is_noisy.
   Circuit<Gate> circuit;
@@ -817,6 +1080,21 @@ class SimulatorHelper {
   State state;
   State scratch;
 
+  // Statistics of the last noisy simulation.
+  NoisyRunner::Stat stat;
+  // See NoisyRunner::Parameter::apply_last_deferred_ops.
+  bool apply_last_deferred_ops = true;
+  // Importance sampling of errors is only used for expectation values,
+  // see NoisyRunner::Parameter::error_bias and
+  // NoisyRunner::Parameter::num_error_strata.
+  bool use_error_sampling = false;
+  double error_bias = 1;
+  unsigned num_error_strata = 0;
+  // Early stopping of expectation value estimates, see
+  // TrajectoryEstimator::Parameter.
+  double target_std_error = 0;
+  double max_time = 0;
+
   bool use_gpu;
   unsigned gpu_mode;
   unsigned num_qubits;
@@ -918,6 +1196,28 @@ std::vector<std::complex<double>> qtrajectory_simulate_expectation_values(
     options, opsums_and_qubit_counts, true, input_vector);
 }
 
+std::tuple<std::vector<std::complex<double>>, std::vector<double>, uint64_t>
+qtrajectory_simulate_expectation_values_with_errors(
+    const py::dict &options,
+    const std::vector<std::tuple<
+                          std::vector<OpString<Cirq::GateCirq<float>>>,
+                          unsigned>>& opsums_and_qubit_counts,
+    uint64_t input_state) {
+  return SimulatorHelper::simulate_expectation_values_with_errors(
+    options, opsums_and_qubit_counts, input_state);
+}
+
+std::tuple<std::vector<std::complex<double>>, std::vector<double>, uint64_t>
+qtrajectory_simulate_expectation_values_with_errors(
+    const py::dict &options,
+    const std::vector<std::tuple<
+                          std::vector<OpString<Cirq::GateCirq<float>>>,
+                          unsigned>>& opsums_and_qubit_counts,
+    const py::array_t<float> &input_vector) {
+  return SimulatorHelper::simulate_expectation_values_with_errors(
+    options, opsums_and_qubit_counts, input_vector);
+}
+
 std::vector<std::vector<std::complex<double>>>
 qtrajectory_simulate_moment_expectation_values(
     const py::dict &options,
@@ -952,6 +1252,135 @@ std::vector<uint64_t> qtrajectory_sample_final(
   return SimulatorHelper::sample_final_state(options, true, num_samples);
 }
 
+// Helper class for simulating small noisy circuits with the density matrix
+// simulator.
+class DensityMatrixHelper {
+ public:
+  using Simulator = Factory::Simulator;
+  using StateSpace = Factory::StateSpace;
+  using State = StateSpace::State;
+
+  using Gate = Cirq::GateCirq<float>;
+  using DMSimulator = DensityMatrixSimulator<
+      IO, Gate, MultiQubitGateFuser, Simulator>;
+
+  DensityMatrixHelper() = delete;
+
+  static std::vector<uint64_t> sample_final_state(
+      const py::dict &options, uint64_t num_samples) {
+    auto helper = DensityMatrixHelper(options);
+    if (!helper.is_valid || !helper.simulate(0)) {
+      return {};
+    }
+    StateSpace state_space = helper.factory.CreateStateSpace();
+    return DMSimulator::Sample(
+        state_space, helper.state, num_samples, helper.seed);
+  }
+
+  static std::vector<std::complex<double>> simulate_expectation_values(
+      const py::dict &options,
+      const std::vector<std::tuple<std::vector<OpString<Gate>>,
+                                   unsigned>>& opsums_and_qubit_counts,
+      uint64_t input_state) {
+    auto helper = DensityMatrixHelper(options);
+    if (!helper.is_valid || !helper.simulate(input_state)) {
+      return {};
+    }
+    Simulator simulator = helper.factory.CreateSimulator();
+    StateSpace state_space = helper.factory.CreateStateSpace();
+    State ket = StateSpace::Null();
+    std::vector<std::complex<double>> results;
+    results.reserve(opsums_and_qubit_counts.size());
+    for (const auto& opsum_qubit_count_pair : opsums_and_qubit_counts) {
+      const auto& opsum = std::get<0>(opsum_qubit_count_pair);
+      results.push_back(DMSimulator::ExpectationValue(
+          helper.param, opsum, state_space, simulator, helper.state, ket));
+    }
+    return results;
+  }
+
+ private:
+  DensityMatrixHelper(const py::dict &options)
+      : factory(Factory(1, 1, 1)),
+        state(StateSpace::Null()) {
+    bool denormals_are_zeros;
+    unsigned num_sim_threads = 0;
+    unsigned num_state_threads = 0;
+    unsigned num_dblocks = 0;
+    is_valid = false;
+    try {
+      ncircuit = getNoisyCircuit(options);
+
+      unsigned use_gpu = parseOptions<unsigned>(options, "g\0");
+      unsigned gpu_mode = parseOptions<unsigned>(options, "gmode\0");
+      denormals_are_zeros = parseOptions<unsigned>(options, "z\0");
+      if (use_gpu == 0) {
+        num_sim_threads = parseOptions<unsigned>(options, "t\0");
+      } else if (gpu_mode == 0) {
+        num_state_threads = parseOptions<unsigned>(options, "gsst\0");
+        num_dblocks = parseOptions<unsigned>(options, "gdb\0");
+      }
+      param.max_fused_size = parseOptions<unsigned>(options, "f\0");
+      param.verbosity = parseOptions<unsigned>(options, "v\0");
+      seed = parseOptions<unsigned>(options, "s\0");
+
+      if (use_gpu == 0 || gpu_mode == 0) {
+        factory = Factory(num_sim_threads, num_state_threads, num_dblocks);
+      }
+
+      StateSpace state_space = factory.CreateStateSpace();
+      state = DMSimulator::Create(ncircuit.num_qubits, state_space);
+      is_valid = !state_space.IsNull(state);
+
+      if (denormals_are_zeros) {
+        SetFlushToZeroAndDenormalsAreZeros();
+      } else {
+        ClearFlushToZeroAndDenormalsAreZeros();
+      }
+    } catch (const std::invalid_argument &exp) {
+      // If this triggers, is_valid is false.
+      IO::errorf(exp.what());
+    }
+  }
+
+  bool simulate(uint64_t input_state) {
+    Simulator simulator = factory.CreateSimulator();
+    StateSpace state_space = factory.CreateStateSpace();
+    DMSimulator::SetBasisState(state_space, input_state, state);
+    if (!DMSimulator::Run(param, ncircuit, state_space, simulator, state)) {
+      IO::errorf("density matrix simulation of the circuit errored out.\n");
+      return false;
+    }
+    return true;
+  }
+
+  NoisyCircuit<Gate> ncircuit;
+
+  Factory factory;
+  State state;
+
+  DMSimulator::Parameter param;
+  unsigned seed;
+
+  // Only set to "true" once initialization is complete.
+  bool is_valid;
+};
+
+std::vector<uint64_t> density_matrix_sample_final(
+    const py::dict &options, uint64_t num_samples) {
+  return DensityMatrixHelper::sample_final_state(options, num_samples);
+}
+
+std::vector<std::complex<double>> density_matrix_simulate_expectation_values(
+    const py::dict &options,
+    const std::vector<std::tuple<
+                          std::vector<OpString<Cirq::GateCirq<float>>>,
+                          unsigned>>& opsums_and_qubit_counts,
+    uint64_t input_state) {
+  return DensityMatrixHelper::simulate_expectation_values(
+    options, opsums_and_qubit_counts, input_state);
+}
+
 std::vector<unsigned> qsim_sample(const py::dict &options) {
   Circuit<Cirq::GateCirq<float>> circuit;
   try {
@@ -105,6 +105,11 @@ std::vector<unsigned> qtrajectory_sample(const py::dict &options);
 std::vector<uint64_t> qtrajectory_sample_final(
   const py::dict &options, uint64_t num_samples);
 
+// Methods for simulating small noisy circuits with the density matrix
+// simulator.
+std::vector<uint64_t> density_matrix_sample_final(
+  const py::dict &options, uint64_t num_samples);
+
 // As above, but returning expectation values instead.
 std::vector<std::complex<double>> qsim_simulate_expectation_values(
     const py::dict &options,
@@ -152,6 +157,24 @@ std::vector<std::complex<double>> qtrajectory_simulate_expectation_values(
                               qsim::Cirq::GateCirq<float>>>,
                           unsigned>>& opsums_and_qubit_counts,
     const py::array_t<float> &input_vector);
+// As above, but also returning the standard errors of the expectation values
+// and the number of repetitions performed.
+std::tuple<std::vector<std::complex<double>>, std::vector<double>, uint64_t>
+qtrajectory_simulate_expectation_values_with_errors(
+    const py::dict &options,
+    const std::vector<std::tuple<
+                          std::vector<qsim::OpString<
+                              qsim::Cirq::GateCirq<float>>>,
+                          unsigned>>& opsums_and_qubit_counts,
+    uint64_t input_state);
+std::tuple<std::vector<std::complex<double>>, std::vector<double>, uint64_t>
+qtrajectory_simulate_expectation_values_with_errors(
+    const py::dict &options,
+    const std::vector<std::tuple<
+                          std::vector<qsim::OpString<
+                              qsim::Cirq::GateCirq<float>>>,
+                          unsigned>>& opsums_and_qubit_counts,
+    const py::array_t<float> &input_vector);
 std::vector<std::vector<std::complex<double>>>
 qtrajectory_simulate_moment_expectation_values(
     const py::dict &options,
@@ -171,6 +194,14 @@ qtrajectory_simulate_moment_expectation_values(
     >>>>& opsums_and_qubit_counts,
     const py::array_t<float> &input_vector);
 
+std::vector<std::complex<double>> density_matrix_simulate_expectation_values(
+    const py::dict &options,
+    const std::vector<std::tuple<
+                          std::vector<qsim::OpString<
+                              qsim::Cirq::GateCirq<float>>>,
+                          unsigned>>& opsums_and_qubit_counts,
+    uint64_t input_state);
+
 // Hybrid simulator.
 std::vector<std::complex<float>> qsimh_simulate(const py::dict &options);
 
@@ -210,6 +241,8 @@ std::vector<std::complex<float>> qsimh_simulate(const py::dict &options);
             "Call the qtrajectory sampler");                                          \
       m.def("qtrajectory_sample_final", &qtrajectory_sample_final,                    \
             "Call the qtrajectory final-state sampler");                              \
+      m.def("density_matrix_sample_final", &density_matrix_sample_final,              \
+            "Call the density matrix final-state sampler");                           \
                                                                                       \
       using GateCirq = qsim::Cirq::GateCirq<float>;                                   \
       using OpString = qsim::OpString<GateCirq>;                                      \
@@ -263,6 +296,24 @@ std::vector<std::complex<float>> qsimh_simulate(const py::dict &options);
                 const py::array_t<float>&)>(                                          \
               &qtrajectory_simulate_expectation_values),                              \
             "Call the qtrajectory simulator for expectation value simulation");       \
+      m.def("qtrajectory_simulate_expectation_values_with_errors",                    \
+            static_cast<std::tuple<std::vector<std::complex<double>>,                 \
+                                   std::vector<double>, uint64_t>(*)(                 \
+                const py::dict&,                                                      \
+                const std::vector<std::tuple<std::vector<OpString>, unsigned>>&,      \
+                uint64_t)>(                                                           \
+              &qtrajectory_simulate_expectation_values_with_errors),                  \
+            "Call the qtrajectory simulator for expectation value simulation "        \
+            "with standard errors");                                                  \
+      m.def("qtrajectory_simulate_expectation_values_with_errors",                    \
+            static_cast<std::tuple<std::vector<std::complex<double>>,                 \
+                                   std::vector<double>, uint64_t>(*)(                 \
+                const py::dict&,                                                      \
+                const std::vector<std::tuple<std::vector<OpString>, unsigned>>&,      \
+                const py::array_t<float>&)>(                                          \
+              &qtrajectory_simulate_expectation_values_with_errors),                  \
+            "Call the qtrajectory simulator for expectation value simulation "        \
+            "with standard errors");                                                  \
                                                                                       \
       m.def("qtrajectory_simulate_moment_expectation_values",                         \
             static_cast<std::vector<std::vector<std::complex<double>>>(*)(            \
@@ -285,6 +336,11 @@ std::vector<std::complex<float>> qsimh_simulate(const py::dict &options);
             "Call the qtrajectory simulator for step-by-step "                        \
             "expectation value simulation");                                          \
                                                                                       \
+      m.def("density_matrix_simulate_expectation_values",                             \
+            &density_matrix_simulate_expectation_values,                              \
+            "Call the density matrix simulator for expectation value "                \
+            "simulation");                                                            \
+                                                                                      \
       /* Method for hybrid simulation */                                              \
       m.def("qsimh_simulate", &qsimh_simulate, "Call the qsimh simulator");           \
                                                                                       \
@@ -353,6 +409,8 @@ std::vector<std::complex<float>> qsimh_simulate(const py::dict &options);
         .value("kCCX", GateKind::kCCX)                                                \
         .value("kMatrixGate", GateKind::kMatrixGate)                                  \
         .value("kMeasurement", GateKind::kMeasurement)                                \
+        .value("kPauliRotation", GateKind::kPauliRotation)                            \
+        .value("kMatrix", GateKind::kMatrix)                                          \
         .export_values();                                                             \
                                                                                       \
       m.def("add_gate", &add_gate, "Adds a gate to the given circuit.");              \
@@ -414,6 +472,8 @@ std::vector<std::complex<float>> qsimh_simulate(const py::dict &options);
             "Call the qtrajectory sampler");                                          \
       m.def("qtrajectory_sample_final", &qtrajectory_sample_final,                    \
             "Call the qtrajectory final-state sampler");                              \
+      m.def("density_matrix_sample_final", &density_matrix_sample_final,              \
+            "Call the density matrix final-state sampler");                           \
                                                                                       \
       using GateCirq = qsim::Cirq::GateCirq<float>;                                   \
       using OpString = qsim::OpString<GateCirq>;                                      \
@@ -468,6 +528,24 @@ std::vector<std::complex<float>> qsimh_simulate(const py::dict &options);
                 const py::array_t<float>&)>(                                          \
               &qtrajectory_simulate_expectation_values),                              \
             "Call the qtrajectory simulator for expectation value simulation");       \
+      m.def("qtrajectory_simulate_expectation_values_with_errors",                    \
+            static_cast<std::tuple<std::vector<std::complex<double>>,                 \
+                                   std::vector<double>, uint64_t>(*)(                 \
+                const py::dict&,                                                      \
+                const std::vector<std::tuple<std::vector<OpString>, unsigned>>&,      \
+                uint64_t)>(                                                           \
+              &qtrajectory_simulate_expectation_values_with_errors),                  \
+            "Call the qtrajectory simulator for expectation value simulation "        \
+            "with standard errors");                                                  \
+      m.def("qtrajectory_simulate_expectation_values_with_errors",                    \
+            static_cast<std::tuple<std::vector<std::complex<double>>,                 \
+                                   std::vector<double>, uint64_t>(*)(                 \
+                const py::dict&,                                                      \
+                const std::vector<std::tuple<std::vector<OpString>, unsigned>>&,      \
+                const py::array_t<float>&)>(                                          \
+              &qtrajectory_simulate_expectation_values_with_errors),                  \
+            "Call the qtrajectory simulator for expectation value simulation "        \
+            "with standard errors");                                                  \
                                                                                       \
       m.def("qtrajectory_simulate_moment_expectation_values",                         \
             static_cast<std::vector<std::vector<std::complex<double>>>(*)(            \
@@ -490,6 +568,11 @@ std::vector<std::complex<float>> qsimh_simulate(const py::dict &options);
             "Call the qtrajectory simulator for step-by-step "                        \
             "expectation value simulation");                                          \
                                                                                       \
+      m.def("density_matrix_simulate_expectation_values",                             \
+            &density_matrix_simulate_expectation_values,                              \
+            "Call the density matrix simulator for expectation value "                \
+            "simulation");                                                            \
+                                                                                      \
       /* Method for hybrid simulation */                                              \
       m.def("qsimh_simulate", &qsimh_simulate, "Call the qsimh simulator");
 #endif
@@ -14,24 +14,31 @@
 
 #include "pybind_main_sse.h"
 
+#include <type_traits>
+
 #include "../../lib/formux.h"
+#include "../../lib/simulator_basic.h"
 #include "../../lib/simulator_sse.h"
 #include "../../lib/util_cpu.h"
 
 namespace qsim {
-  template <typename For>
-  using Simulator = SimulatorSSE<For>;
-
-  struct Factory {
+  // There is no double-precision SSE simulator; fall back to the basic one.
+  template <typename For, typename FP = float>
+  using Simulator = typename std::conditional<std::is_same<FP, float>::value,
+                                              SimulatorSSE<For>,
+                                              SimulatorBasic<For, FP>>::type;
+
+  template <typename FP>
+  struct FactoryT {
     // num_state_threads and num_dblocks are unused, but kept for consistency
     // with the GPU Factory.
-    Factory(
+    FactoryT(
       unsigned num_sim_threads,
       unsigned num_state_threads,
       unsigned num_dblocks) : num_threads(num_sim_threads) {}
 
-    using Simulator = qsim::Simulator<For>;
-    using StateSpace = Simulator::StateSpace;
+    using Simulator = qsim::Simulator<For, FP>;
+    using StateSpace = typename Simulator::StateSpace;
 
     StateSpace CreateStateSpace() const {
       return StateSpace(num_threads);
@@ -43,6 +50,8 @@ namespace qsim {
 
     unsigned num_threads;
   };
+
+  using Factory = FactoryT<float>;
 }
 
 #include "../pybind_main.cpp"
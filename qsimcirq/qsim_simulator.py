@@ -58,6 +58,23 @@ class QSimOptions:
         ev_noisy_repetitions: number of repetitions used for estimating
             expectation values of a noisy circuit. Does not affect other
             simulation modes.
+        ev_error_bias: if not 1, estimate expectation values of a noisy
+            circuit with importance sampling: the odds of errors in channels
+            of unitary Kraus operators (depolarizing, bit flip, etc.) are
+            multiplied by this factor and each repetition is weighted by its
+            likelihood ratio. Values greater than 1 reduce the number of
+            repetitions needed for circuits with weak noise.
+        ev_error_strata: if greater than 1, stratify the repetitions used for
+            estimating expectation values of a noisy circuit by the number of
+            errors in channels of unitary Kraus operators: 0, 1, ... and
+            ev_error_strata - 1 or more errors. ev_noisy_repetitions should
+            be a multiple of this value. Takes precedence over ev_error_bias.
+        ev_target_std_error: if positive, stop the repetitions for estimating
+            expectation values of a noisy circuit as soon as the standard
+            errors of all the expectation values are at most this value.
+            ev_noisy_repetitions is the maximum number of repetitions then.
+        ev_max_time: if positive, the time budget in seconds for estimating
+            expectation values of a noisy circuit.
         use_gpu: whether to use GPU instead of CPU for simulation. The "gpu_*"
             arguments below are only considered if this is set to True.
         gpu_mode: use CUDA if set to 0 (default value) or use the NVIDIA
@@ -71,17 +88,25 @@ class QSimOptions:
         denormals_are_zeros: if true, set flush-to-zero and denormals-are-zeros
             MXCSR control flags. This prevents rare cases of performance
             slowdown potentially at the cost of a tiny precision loss.
+        use_double_precision: if true, compute_amplitudes evolves the state
+            in double precision. Gate matrices and returned amplitudes remain
+            single precision. Other simulation methods ignore this option.
     """
 
     max_fused_gate_size: int = 2
     cpu_threads: int = 1
     ev_noisy_repetitions: int = 1
+    ev_error_bias: float = 1.0
+    ev_error_strata: int = 0
+    ev_target_std_error: float = 0.0
+    ev_max_time: float = 0.0
     use_gpu: bool = False
     gpu_mode: int = 0
     gpu_state_threads: int = 512
     gpu_data_blocks: int = 16
     verbosity: int = 0
     denormals_are_zeros: bool = False
+    use_double_precision: bool = False
 
     def as_dict(self):
         """Generates an options dict from this object.
@@ -92,12 +117,17 @@ class QSimOptions:
             "f": self.max_fused_gate_size,
             "t": self.cpu_threads,
             "r": self.ev_noisy_repetitions,
+            "eb": self.ev_error_bias,
+            "es": self.ev_error_strata,
+            "se": self.ev_target_std_error,
+            "tmax": self.ev_max_time,
             "g": self.use_gpu,
             "gmode": self.gpu_mode,
             "gsst": self.gpu_state_threads,
             "gdb": self.gpu_data_blocks,
             "v": self.verbosity,
             "z": self.denormals_are_zeros,
+            "dp": self.use_double_precision,
         }
 
 
@@ -208,6 +208,33 @@ def test_cirq_qsim_simulate(mode: str):
     assert np.allclose(result, [0.5j, 0j])
 
 
+@pytest.mark.parametrize("mode", ["noiseless", "noisy"])
+def test_cirq_qsim_simulate_double_precision(mode: str):
+    # Pick qubits.
+    a, b, c, d = [
+        cirq.GridQubit(0, 0),
+        cirq.GridQubit(0, 1),
+        cirq.GridQubit(1, 1),
+        cirq.GridQubit(1, 0),
+    ]
+
+    # Create a circuit
+    cirq_circuit = cirq.Circuit(
+        cirq.X(a) ** 0.5,  # Square root of X.
+        cirq.Y(b) ** 0.5,  # Square root of Y.
+        cirq.Z(c),  # Z.
+        cirq.CZ(a, d),  # ControlZ.
+    )
+
+    if mode == "noisy":
+        cirq_circuit.append(NoiseTrigger().on(a))
+
+    options = qsimcirq.QSimOptions(use_double_precision=True)
+    qsimSim = qsimcirq.QSimSimulator(qsim_options=options)
+    result = qsimSim.compute_amplitudes(cirq_circuit, bitstrings=[0b0100, 0b1011])
+    assert np.allclose(result, [0.5j, 0j])
+
+
 @pytest.mark.parametrize("mode", ["noiseless", "noisy"])
 def test_cirq_qsim_simulate_fullstate(mode: str):
     # Pick qubits.
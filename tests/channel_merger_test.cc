@@ -0,0 +1,215 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "density_matrix_testfixture.h"
+
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "../lib/channel.h"
+#include "../lib/channel_merger.h"
+#include "../lib/channels_cirq.h"
+#include "../lib/circuit_noisy.h"
+#include "../lib/gates_cirq.h"
+#include "../lib/matrix.h"
+#include "../lib/seqfor.h"
+#include "../lib/simulator_basic.h"
+
+namespace qsim {
+
+namespace {
+
+using fp_type = float;
+using CirqGate = Cirq::GateCirq<fp_type>;
+using Merger = ChannelMerger<CirqGate>;
+
+struct Factory {
+  using Simulator = SimulatorBasic<SequentialFor, fp_type>;
+  using StateSpace = Simulator::StateSpace;
+
+  StateSpace CreateStateSpace() const {
+    return StateSpace(1);
+  }
+
+  Simulator CreateSimulator() const {
+    return Simulator(1);
+  }
+};
+
+void AddGate(CirqGate&& gate, NoisyCircuit<CirqGate>& ncircuit) {
+  ncircuit.channels.push_back(MakeChannelFromGate(gate.time, gate));
+}
+
+void CompareDensityMatrices(const NoisyCircuit<CirqGate>& ncircuit1,
+                            const NoisyCircuit<CirqGate>& ncircuit2) {
+  auto rho1 = ComputeDensityMatrix(Factory(), ncircuit1);
+  auto rho2 = ComputeDensityMatrix(Factory(), ncircuit2);
+
+  ASSERT_EQ(rho1.size(), rho2.size());
+
+  for (std::size_t i = 0; i < rho1.size(); ++i) {
+    EXPECT_NEAR(std::real(rho1[i]), std::real(rho2[i]), 1e-6);
+    EXPECT_NEAR(std::imag(rho1[i]), std::imag(rho2[i]), 1e-6);
+  }
+}
+
+}  // namespace
+
+TEST(ChannelMergerTest, MergeChannels) {
+  NoisyCircuit<CirqGate> ncircuit;
+  ncircuit.num_qubits = 3;
+
+  AddGate(Cirq::H<fp_type>::Create(0, 0), ncircuit);
+  AddGate(Cirq::rx<fp_type>::Create(0, 1, 0.4), ncircuit);
+  // Merged into the H gate.
+  AddGate(Cirq::ry<fp_type>::Create(1, 0, 0.7), ncircuit);
+  // The rx gate is merged into the two-qubit gate.
+  AddGate(Cirq::CZ<fp_type>::Create(2, 0, 1), ncircuit);
+  AddGate(Cirq::rz<fp_type>::Create(3, 1, 0.5), ncircuit);
+  // Amplitude damping and phase damping on qubit 0 with a channel on
+  // qubit 1 in between are merged. One of the products of the Kraus
+  // operators vanishes.
+  ncircuit.channels.push_back(
+      Cirq::amplitude_damp<fp_type>(0.2).Create(4, 0));
+  ncircuit.channels.push_back(Cirq::depolarize<fp_type>(0.1).Create(4, 1));
+  ncircuit.channels.push_back(Cirq::phase_damp<fp_type>(0.3).Create(5, 0));
+  // Merged depolarizing channels; the products of the Kraus operators are
+  // proportional to Pauli operators, so only four operators remain.
+  ncircuit.channels.push_back(Cirq::depolarize<fp_type>(0.2).Create(5, 1));
+  // The identity channel, the X gates and the H gate are merged.
+  ncircuit.channels.push_back(Cirq::depolarize<fp_type>(0).Create(6, 2));
+  AddGate(Cirq::X<fp_type>::Create(7, 2), ncircuit);
+  AddGate(Cirq::X<fp_type>::Create(8, 2), ncircuit);
+  AddGate(Cirq::H<fp_type>::Create(9, 2), ncircuit);
+  // Not merged with the depolarizing channel.
+  AddGate(Cirq::H<fp_type>::Create(9, 1), ncircuit);
+  // Measurements are not merged.
+  AddGate(gate::Measurement<CirqGate>::Create(10, {2}), ncircuit);
+  AddGate(Cirq::H<fp_type>::Create(11, 2), ncircuit);
+
+  Merger::Parameter param;
+  auto mcircuit = Merger::MergeChannels(param, ncircuit);
+
+  EXPECT_EQ(mcircuit.num_qubits, ncircuit.num_qubits);
+  ASSERT_EQ(mcircuit.channels.size(), 8);
+
+  const auto& channels = mcircuit.channels;
+
+  // H(0) and ry(0).
+  ASSERT_EQ(channels[0].size(), 1);
+  ASSERT_EQ(channels[0][0].ops.size(), 1);
+  EXPECT_EQ(channels[0][0].ops[0].qubits, std::vector<unsigned>({0}));
+  EXPECT_EQ(channels[0][0].ops[0].kind, gate::kMatrix);
+
+  // rx(1), CZ(0, 1) and rz(1).
+  ASSERT_EQ(channels[1].size(), 1);
+  ASSERT_EQ(channels[1][0].ops.size(), 1);
+  EXPECT_EQ(channels[1][0].ops[0].qubits, std::vector<unsigned>({0, 1}));
+  EXPECT_EQ(channels[1][0].ops[0].kind, gate::kMatrix);
+
+  // Amplitude damping and phase damping.
+  ASSERT_EQ(channels[2].size(), 3);
+  for (const auto& kop : channels[2]) {
+    EXPECT_FALSE(kop.unitary);
+    ASSERT_EQ(kop.ops.size(), 1);
+    EXPECT_EQ(kop.ops[0].qubits, std::vector<unsigned>({0}));
+    EXPECT_EQ(kop.ops[0].kind, gate::kMatrix);
+    EXPECT_EQ(kop.qubits, std::vector<unsigned>({0}));
+  }
+
+  // Depolarizing channels.
+  ASSERT_EQ(channels[3].size(), 4);
+  EXPECT_EQ(channels[3][0].ops.size(), 0);
+  double p = 0;
+  for (const auto& kop : channels[3]) {
+    EXPECT_TRUE(kop.unitary);
+    p += kop.prob;
+  }
+  EXPECT_NEAR(p, 1, 1e-6);
+  EXPECT_NEAR(channels[3][0].prob, 0.9 * 0.8 + 3 * (0.1 / 3) * (0.2 / 3),
+              1e-6);
+
+  // H(2), H(1), measurement and H(2).
+  ASSERT_EQ(channels[4].size(), 1);
+  EXPECT_EQ(channels[4][0].ops[0].qubits, std::vector<unsigned>({2}));
+  ASSERT_EQ(channels[5].size(), 1);
+  EXPECT_EQ(channels[5][0].ops[0].qubits, std::vector<unsigned>({1}));
+  // Unmodified channels keep their gate kinds.
+  EXPECT_EQ(channels[5][0].ops[0].kind, Cirq::kH);
+  EXPECT_EQ(channels[6][0].kind, gate::kMeasurement);
+  EXPECT_EQ(channels[7][0].ops[0].qubits, std::vector<unsigned>({2}));
+
+  // Drop the measurement to compare the density matrices.
+  // The H gates on qubit 2 cancel each other.
+  ncircuit.channels.erase(ncircuit.channels.end() - 2);
+  mcircuit = Merger::MergeChannels(param, ncircuit);
+  EXPECT_EQ(mcircuit.channels.size(), 5);
+
+  CompareDensityMatrices(ncircuit, mcircuit);
+}
+
+TEST(ChannelMergerTest, MaxKrausOperators) {
+  NoisyCircuit<CirqGate> ncircuit;
+  ncircuit.num_qubits = 2;
+
+  AddGate(Cirq::H<fp_type>::Create(0, 0), ncircuit);
+  ncircuit.channels.push_back(Cirq::depolarize<fp_type>(0.1).Create(1, 0));
+  ncircuit.channels.push_back(
+      Cirq::amplitude_damp<fp_type>(0.2).Create(1, 0));
+  ncircuit.channels.push_back(Cirq::bit_flip<fp_type>(0.1).Create(2, 0));
+
+  Merger::Parameter param;
+
+  param.max_kraus_operators = 4;
+  auto mcircuit = Merger::MergeChannels(param, ncircuit);
+
+  // The depolarizing channel is not merged with amplitude damping
+  // (eight Kraus operators).
+  ASSERT_EQ(mcircuit.channels.size(), 3);
+  EXPECT_EQ(mcircuit.channels[1].size(), 4);
+  EXPECT_EQ(mcircuit.channels[2].size(), 4);
+
+  CompareDensityMatrices(ncircuit, mcircuit);
+
+  param.max_kraus_operators = 16;
+  mcircuit = Merger::MergeChannels(param, ncircuit);
+
+  ASSERT_EQ(mcircuit.channels.size(), 2);
+
+  CompareDensityMatrices(ncircuit, mcircuit);
+}
+
+TEST(ChannelMergerTest, DensityMatrixTestCircuit) {
+  auto ncircuit = GenerateDensityMatrixTestCircuit<CirqGate>();
+
+  Merger::Parameter param;
+  auto mcircuit = Merger::MergeChannels(param, ncircuit);
+
+  // None of the channels are adjacent to a channel they can be merged with;
+  // the channels with a Pauli rotation gate, a controlled gate or on four
+  // qubits are not merged.
+  EXPECT_EQ(mcircuit.channels.size(), ncircuit.channels.size());
+
+  CompareDensityMatrices(ncircuit, mcircuit);
+}
+
+}  // namespace qsim
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,286 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef DENSITY_MATRIX_TESTFIXTURE_H_
+#define DENSITY_MATRIX_TESTFIXTURE_H_
+
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "../lib/channel.h"
+#include "../lib/channels_cirq.h"
+#include "../lib/circuit_noisy.h"
+#include "../lib/density_matrix.h"
+#include "../lib/expect.h"
+#include "../lib/fuser_mqubit.h"
+#include "../lib/gate_appl.h"
+#include "../lib/gates_cirq.h"
+#include "../lib/io.h"
+
+namespace qsim {
+
+template <typename Gate>
+NoisyCircuit<Gate> GenerateDensityMatrixTestCircuit() {
+  using fp_type = typename Gate::fp_type;
+
+  NoisyCircuit<Gate> ncircuit;
+  ncircuit.num_qubits = 4;
+
+  auto normal = KrausOperator<Gate>::kNormal;
+
+  auto add_gate = [&ncircuit](Gate&& gate) {
+    ncircuit.channels.push_back(MakeChannelFromGate(gate.time, gate));
+  };
+
+  add_gate(Cirq::H<fp_type>::Create(0, 0));
+  add_gate(Cirq::H<fp_type>::Create(0, 1));
+  add_gate(Cirq::rx<fp_type>::Create(0, 2, 0.7));
+  add_gate(Cirq::ry<fp_type>::Create(0, 3, 0.4));
+  ncircuit.channels.push_back(Cirq::amplitude_damp<fp_type>(0.2).Create(1, 0));
+  ncircuit.channels.push_back(Cirq::depolarize<fp_type>(0.1).Create(1, 1));
+  add_gate(Cirq::ISWAP<fp_type>::Create(2, 0, 1));
+  add_gate(Cirq::X<fp_type>::Create(2, 2).ControlledBy({3}));
+  ncircuit.channels.push_back(Cirq::phase_damp<fp_type>(0.3).Create(3, 2));
+  // A two-qubit Pauli channel.
+  ncircuit.channels.push_back(
+      {{normal, 1, 0.8, {}},
+       {normal, 1, 0.2, {Cirq::X<fp_type>::Create(3, 0),
+                         Cirq::Z<fp_type>::Create(3, 3)}}});
+  add_gate(gate::PauliRotation<Gate>::Create(4, {0, 1, 3}, {1, 2, 3}, 0.3));
+  add_gate(Cirq::ry<fp_type>::Create(5, 1, 0.6));
+  // A channel on four qubits, which is not applied as a superoperator.
+  ncircuit.channels.push_back(
+      {{normal, 1, 0.9, {}},
+       {normal, 1, 0.1, {Cirq::X<fp_type>::Create(5, 0),
+                         Cirq::Y<fp_type>::Create(5, 2),
+                         Cirq::X<fp_type>::Create(5, 3)}},
+       {normal, 1, 0, {Cirq::H<fp_type>::Create(5, 1)}}});
+  // A channel with a controlled gate, which is not applied as
+  // a superoperator.
+  ncircuit.channels.push_back(
+      {{normal, 1, 0.7, {}},
+       {normal, 1, 0.3, {Cirq::Y<fp_type>::Create(6, 1).ControlledBy({2})}}});
+  add_gate(Cirq::CZ<fp_type>::Create(7, 2, 3));
+
+  return ncircuit;
+}
+
+// Computes the density matrix as the sum over all the sequences of Kraus
+// operators of the respective (unnormalized) pure states.
+template <typename Factory, typename Gate>
+std::vector<std::complex<double>> ComputeDensityMatrix(
+    const Factory& factory, const NoisyCircuit<Gate>& ncircuit) {
+  using StateSpace = typename Factory::StateSpace;
+
+  unsigned num_qubits = ncircuit.num_qubits;
+  uint64_t size = uint64_t{1} << num_qubits;
+
+  auto simulator = factory.CreateSimulator();
+  StateSpace state_space = factory.CreateStateSpace();
+
+  auto state = state_space.Create(num_qubits);
+
+  std::vector<std::complex<double>> rho(size * size, 0);
+  std::vector<std::size_t> kops(ncircuit.channels.size(), 0);
+
+  while (true) {
+    state_space.SetStateZero(state);
+    double weight = 1;
+
+    for (std::size_t i = 0; i < kops.size(); ++i) {
+      const auto& kop = ncircuit.channels[i][kops[i]];
+
+      for (const auto& op : kop.ops) {
+        ApplyGate(simulator, op, state);
+      }
+
+      if (kop.unitary) {
+        weight *= kop.prob;
+      }
+    }
+
+    for (uint64_t r = 0; r < size; ++r) {
+      std::complex<double> ar = state_space.GetAmpl(state, r);
+
+      for (uint64_t c = 0; c < size; ++c) {
+        std::complex<double> ac = state_space.GetAmpl(state, c);
+        rho[r * size + c] += weight * ar * std::conj(ac);
+      }
+    }
+
+    std::size_t i = 0;
+    for (; i < kops.size(); ++i) {
+      if (++kops[i] < ncircuit.channels[i].size()) break;
+      kops[i] = 0;
+    }
+
+    if (i == kops.size()) break;
+  }
+
+  return rho;
+}
+
+template <typename Factory>
+void TestDensityMatrix(const Factory& factory) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Factory::StateSpace;
+  using fp_type = typename StateSpace::fp_type;
+  using Gate = Cirq::GateCirq<fp_type>;
+  using DMSimulator =
+      DensityMatrixSimulator<IO, Gate, MultiQubitGateFuser, Simulator>;
+
+  auto ncircuit = GenerateDensityMatrixTestCircuit<Gate>();
+
+  unsigned num_qubits = ncircuit.num_qubits;
+  uint64_t size = uint64_t{1} << num_qubits;
+
+  auto expected_rho = ComputeDensityMatrix(factory, ncircuit);
+
+  Simulator simulator = factory.CreateSimulator();
+  StateSpace state_space = factory.CreateStateSpace();
+
+  for (unsigned max_fused_size : {2, 4}) {
+    typename DMSimulator::Parameter param;
+    param.max_fused_size = max_fused_size;
+
+    auto state = DMSimulator::Create(num_qubits, state_space);
+    ASSERT_FALSE(state_space.IsNull(state));
+
+    DMSimulator::SetBasisState(state_space, 0, state);
+
+    EXPECT_TRUE(DMSimulator::Run(param, ncircuit, state_space, simulator,
+                                 state));
+
+    for (uint64_t r = 0; r < size; ++r) {
+      for (uint64_t c = 0; c < size; ++c) {
+        auto a = DMSimulator::GetElement(state_space, state, r, c);
+        auto e = expected_rho[r * size + c];
+        EXPECT_NEAR(std::real(a), std::real(e), 1e-6);
+        EXPECT_NEAR(std::imag(a), std::imag(e), 1e-6);
+      }
+    }
+
+    auto trace = DMSimulator::Trace(state_space, state);
+    EXPECT_NEAR(std::real(trace), 1, 1e-6);
+    EXPECT_NEAR(std::imag(trace), 0, 1e-6);
+  }
+}
+
+template <typename Factory>
+void TestDensityMatrixMeasurement(const Factory& factory) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Factory::StateSpace;
+  using fp_type = typename StateSpace::fp_type;
+  using Gate = Cirq::GateCirq<fp_type>;
+  using DMSimulator =
+      DensityMatrixSimulator<IO, Gate, MultiQubitGateFuser, Simulator>;
+
+  NoisyCircuit<Gate> ncircuit;
+  ncircuit.num_qubits = 3;
+
+  ncircuit.channels.push_back(
+      MakeChannelFromGate(0, Cirq::H<fp_type>::Create(0, 0)));
+  ncircuit.channels.push_back(
+      MakeChannelFromGate(0, Cirq::H<fp_type>::Create(0, 2)));
+  ncircuit.channels.push_back(
+      MakeChannelFromGate(1, Cirq::CX<fp_type>::Create(1, 0, 1)));
+  ncircuit.channels.push_back(
+      MakeChannelFromGate(2, gate::Measurement<Gate>::Create(2, {0})));
+
+  Simulator simulator = factory.CreateSimulator();
+  StateSpace state_space = factory.CreateStateSpace();
+
+  typename DMSimulator::Parameter param;
+
+  auto state = DMSimulator::Create(ncircuit.num_qubits, state_space);
+  DMSimulator::SetBasisState(state_space, 0, state);
+
+  EXPECT_TRUE(DMSimulator::Run(param, ncircuit, state_space, simulator,
+                               state));
+
+  // (|00><00| + |11><11|) / 2 on qubits 0 and 1 and |+><+| on qubit 2.
+  for (uint64_t r = 0; r < 8; ++r) {
+    for (uint64_t c = 0; c < 8; ++c) {
+      bool diagonal01 = (r & 3) == (c & 3) && ((r & 3) == 0 || (r & 3) == 3);
+      double expected = diagonal01 ? 0.25 : 0;
+      auto a = DMSimulator::GetElement(state_space, state, r, c);
+      EXPECT_NEAR(std::real(a), expected, 1e-6);
+      EXPECT_NEAR(std::imag(a), 0, 1e-6);
+    }
+  }
+
+  // Expectation values.
+
+  std::vector<OpString<Gate>> strings1 = {
+    {{1.0, 0}, {Cirq::Z<fp_type>::Create(0, 0)}},
+  };
+  std::vector<OpString<Gate>> strings2 = {
+    {{1.0, 0}, {Cirq::Z<fp_type>::Create(0, 0),
+                Cirq::Z<fp_type>::Create(0, 1)}},
+    {{0.5, 0}, {Cirq::X<fp_type>::Create(0, 2)}},
+  };
+  std::vector<OpString<Gate>> strings3 = {
+    {{1.0, 0}, {Cirq::X<fp_type>::Create(0, 0),
+                Cirq::X<fp_type>::Create(0, 1)}},
+    {{2.0, 0}, {}},
+  };
+
+  auto ket = state_space.Null();
+
+  auto ev1 = DMSimulator::ExpectationValue(param, strings1, state_space,
+                                           simulator, state, ket);
+  EXPECT_NEAR(std::real(ev1), 0, 1e-6);
+  EXPECT_NEAR(std::imag(ev1), 0, 1e-6);
+
+  auto ev2 = DMSimulator::ExpectationValue(param, strings2, state_space,
+                                           simulator, state, ket);
+  EXPECT_NEAR(std::real(ev2), 1.5, 1e-6);
+  EXPECT_NEAR(std::imag(ev2), 0, 1e-6);
+
+  // The coherence between |00> and |11> is lost.
+  auto ev3 = DMSimulator::ExpectationValue(param, strings3, state_space,
+                                           simulator, state, ket);
+  EXPECT_NEAR(std::real(ev3), 2, 1e-6);
+  EXPECT_NEAR(std::imag(ev3), 0, 1e-6);
+
+  // Sampling.
+
+  uint64_t num_samples = 10000;
+  auto samples = DMSimulator::Sample(state_space, state, num_samples, 1);
+
+  ASSERT_EQ(samples.size(), num_samples);
+
+  std::vector<uint64_t> histogram(8, 0);
+  for (auto s : samples) {
+    ASSERT_LT(s, 8);
+    ++histogram[s];
+  }
+
+  for (uint64_t i = 0; i < 8; ++i) {
+    bool allowed = (i & 3) == 0 || (i & 3) == 3;
+    if (allowed) {
+      EXPECT_NEAR(double(histogram[i]) / num_samples, 0.25, 0.02);
+    } else {
+      EXPECT_EQ(histogram[i], 0);
+    }
+  }
+}
+
+}  // namespace qsim
+
+#endif  // DENSITY_MATRIX_TESTFIXTURE_H_
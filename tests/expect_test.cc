@@ -100,8 +100,12 @@ TEST(ExpectTest, ExpectationValue) {
     std::vector<OpString<GateQSim<fp_type>>> strings;
     strings.reserve(num_qubits);
 
+    std::vector<PauliString> pauli_strings;
+    pauli_strings.reserve(num_qubits);
+
     for (unsigned i = 0; i <= num_qubits - k; ++i) {
       strings.push_back({{0.1 + 0.2 * i, 0}, {}});
+      pauli_strings.push_back({{0.1 + 0.2 * i, 0}, {}, {}});
 
       strings.back().ops.reserve(k);
 
@@ -117,6 +121,9 @@ TEST(ExpectTest, ExpectationValue) {
           strings.back().ops.push_back(GateZ<fp_type>::Create(0, i + j));
           break;
         }
+
+        pauli_strings.back().qubits.push_back(i + j);
+        pauli_strings.back().paulis.push_back(1 + j % 3);
       }
     }
 
@@ -134,6 +141,24 @@ TEST(ExpectTest, ExpectationValue) {
 
     EXPECT_NEAR(std::real(evalb), expected_real[k - 1], 1e-6);
     EXPECT_NEAR(std::imag(evalb), 0, 1e-8);
+
+    auto evalc = ExpectationValue<IO>(pauli_strings, simulator, state);
+
+    EXPECT_NEAR(std::real(evalc), expected_real[k - 1], 1e-6);
+    EXPECT_NEAR(std::imag(evalc), 0, 1e-8);
+  }
+
+  // Invalid Pauli strings.
+  std::vector<std::vector<PauliString>> invalid_strings = {
+    {{1, {0, 1}, {1}}},
+    {{1, {0, 0}, {1, 3}}},
+    {{1, {0, num_qubits}, {1, 3}}},
+    {{1, {0, 1}, {1, 4}}},
+  };
+
+  for (const auto& strings : invalid_strings) {
+    auto eval = ExpectationValue<IO>(strings, simulator, state);
+    EXPECT_EQ(eval, std::complex<double>(0));
   }
 }
 
@@ -1166,6 +1166,57 @@ bool TestFusedGates(unsigned num_qubits,
 
 }  // namespace
 
+TEST(FuserBasicTest, PauliRotationGate) {
+  using Gate = GateQSim<float>;
+
+  unsigned num_qubits = 3;
+
+  std::vector<Gate> circuit = {
+    GateHd<float>::Create(0, 0),
+    GateHd<float>::Create(0, 1),
+    GateHd<float>::Create(0, 2),
+    gate::PauliRotation<Gate>::Create(1, {2}, {1}, 0.3),
+    GateCZ<float>::Create(2, 0, 1),
+    gate::PauliRotation<Gate>::Create(3, {0, 1, 2}, {1, 2, 3}, 0.4),
+    GateT<float>::Create(4, 2),
+  };
+
+  using Fuser = BasicGateFuser<IO, Gate>;
+  Fuser::Parameter param;
+  auto fused_gates = Fuser::FuseGates(param, num_qubits, circuit);
+
+  EXPECT_EQ(fused_gates.size(), 5);
+
+  EXPECT_EQ(fused_gates[0].kind, kGateHd);
+  EXPECT_EQ(fused_gates[0].qubits.size(), 1);
+  EXPECT_EQ(fused_gates[0].qubits[0], 2);
+  EXPECT_EQ(fused_gates[0].gates.size(), 1);
+
+  EXPECT_EQ(fused_gates[1].kind, gate::kPauliRotation);
+  EXPECT_EQ(fused_gates[1].time, 1);
+  EXPECT_EQ(fused_gates[1].qubits.size(), 1);
+  EXPECT_EQ(fused_gates[1].qubits[0], 2);
+  EXPECT_EQ(fused_gates[1].gates.size(), 1);
+  EXPECT_EQ(fused_gates[1].gates[0], &circuit[3]);
+  EXPECT_EQ(fused_gates[1].matrix.size(), 0);
+
+  EXPECT_EQ(fused_gates[2].kind, kGateCZ);
+  EXPECT_EQ(fused_gates[2].qubits.size(), 2);
+  EXPECT_EQ(fused_gates[2].gates.size(), 3);
+
+  EXPECT_EQ(fused_gates[3].kind, gate::kPauliRotation);
+  EXPECT_EQ(fused_gates[3].time, 3);
+  EXPECT_EQ(fused_gates[3].qubits.size(), 3);
+  EXPECT_EQ(fused_gates[3].gates.size(), 1);
+  EXPECT_EQ(fused_gates[3].gates[0], &circuit[5]);
+  EXPECT_EQ(fused_gates[3].matrix.size(), 0);
+
+  EXPECT_EQ(fused_gates[4].kind, kGateT);
+  EXPECT_EQ(fused_gates[4].qubits.size(), 1);
+  EXPECT_EQ(fused_gates[4].qubits[0], 2);
+  EXPECT_EQ(fused_gates[4].gates.size(), 1);
+}
+
 TEST(FuserBasicTest, ValidTimeOrder) {
   using Gate = GateQSim<float>;
   using Fuser = BasicGateFuser<IO, Gate>;
@@ -25,6 +25,7 @@
 #include "../lib/fuser_mqubit.h"
 #include "../lib/gate.h"
 #include "../lib/gate_appl.h"
+#include "../lib/gates_cirq.h"
 #include "../lib/matrix.h"
 #include "../lib/simmux.h"
 
@@ -206,6 +207,15 @@ bool TestFusedGates(unsigned num_qubits,
       return false;
     }
 
+    // Test if fused gate qubits are distinct.
+    if (g.kind != gate::kMeasurement) {
+      auto qubits = g.qubits;
+      std::sort(qubits.begin(), qubits.end());
+      if (std::adjacent_find(qubits.begin(), qubits.end()) != qubits.end()) {
+        return false;
+      }
+    }
+
     for (auto p : g.gates) {
       auto k = (std::size_t(p) - std::size_t(gates.data())) / sizeof(*p);
 
@@ -261,7 +271,7 @@ TEST(FuserMultiQubitTest, RandomCircuit1) {
   Fuser::Parameter param;
   param.verbosity = 0;
 
-  for (unsigned q = 2; q <= 6; ++q) {
+  for (unsigned q = 2; q <= 8; ++q) {
     param.max_fused_size = q;
     auto fused_gates = Fuser::FuseGates(
         param, num_qubits, circuit.begin(), circuit.end(), false);
@@ -269,7 +279,7 @@ TEST(FuserMultiQubitTest, RandomCircuit1) {
     EXPECT_TRUE(TestFusedGates(num_qubits, circuit, fused_gates));
   }
 
-  for (unsigned q = 2; q <= 6; ++q) {
+  for (unsigned q = 2; q <= 8; ++q) {
     param.max_fused_size = q;
     auto fused_gates = Fuser::FuseGates(
         param, num_qubits, circuit.begin(), circuit.end(),
@@ -299,7 +309,7 @@ TEST(FuserMultiQubitTest, RandomCircuit2) {
   Fuser::Parameter param;
   param.verbosity = 0;
 
-  for (unsigned q = 2; q <= 6; ++q) {
+  for (unsigned q = 2; q <= 8; ++q) {
     param.max_fused_size = q;
     auto fused_gates = Fuser::FuseGates(
         param, num_qubits, pcircuit.begin(), pcircuit.end(), false);
@@ -307,7 +317,7 @@ TEST(FuserMultiQubitTest, RandomCircuit2) {
     EXPECT_TRUE(TestFusedGates(num_qubits, circuit, fused_gates));
   }
 
-  for (unsigned q = 2; q <= 6; ++q) {
+  for (unsigned q = 2; q <= 8; ++q) {
     param.max_fused_size = q;
     auto fused_gates = Fuser::FuseGates(
         param, num_qubits, pcircuit.begin(), pcircuit.end(),
@@ -364,7 +374,7 @@ TEST(FuserMultiQubitTest, Simulation) {
 
   auto state1 = state_space.Create(num_qubits);
 
-  for (unsigned q = 2; q <= 6; ++q) {
+  for (unsigned q = 2; q <= 8; ++q) {
     state_space.SetStateZero(state1);
 
     param.max_fused_size = q;
@@ -387,6 +397,91 @@ TEST(FuserMultiQubitTest, Simulation) {
   }
 }
 
+TEST(FuserMultiQubitTest, SimulationPermutationGates) {
+  using Fuser = MultiQubitGateFuser<IO, DummyGate>;
+
+  unsigned num_qubits = 12;
+  unsigned depth = 200;
+
+  auto circuit = GenerateRandomCircuit2(num_qubits, depth, 6);
+
+  std::mt19937 rgen(1);
+  std::uniform_real_distribution<double> distr(0, 1);
+
+  for (auto& gate : circuit) {
+    if (gate.kind == kMeasurement) continue;
+
+    if (gate.controlled_by.size() > 0) {
+      gate.cmask = (uint64_t{1} << gate.controlled_by.size()) - 1;
+    }
+
+    unsigned n = unsigned{1} << gate.qubits.size();
+
+    std::vector<unsigned> perm(n);
+    std::vector<float> phases;
+    phases.reserve(2 * n);
+
+    // Random permutations with random phases.
+    for (unsigned i = 0; i < n; ++i) {
+      double phi = 2 * M_PI * distr(rgen);
+      perm[i] = i;
+      phases.push_back(std::cos(phi));
+      phases.push_back(std::sin(phi));
+    }
+
+    std::shuffle(perm.begin(), perm.end(), rgen);
+
+    MatrixFromPermutation(n, perm, phases, gate.matrix);
+  };
+
+  using StateSpace = typename Simulator<For>::StateSpace;
+
+  Simulator<For> simulator(1);
+  StateSpace state_space(1);
+
+  auto state0 = state_space.Create(num_qubits);
+  state_space.SetStateUniform(state0);
+
+  // Simulate unfused gates.
+  for (const auto& gate : circuit) {
+    ApplyGate(simulator, gate, state0);
+  }
+
+  Fuser::Parameter param;
+  param.verbosity = 0;
+
+  auto state1 = state_space.Create(num_qubits);
+
+  for (unsigned q = 2; q <= 8; ++q) {
+    state_space.SetStateUniform(state1);
+
+    param.max_fused_size = q;
+    auto fused_gates = Fuser::FuseGates(
+        param, num_qubits, circuit.begin(), circuit.end());
+
+    EXPECT_TRUE(TestFusedGates(num_qubits, circuit, fused_gates));
+
+    std::vector<unsigned> perm;
+    std::vector<float> phases;
+
+    // Simulate fused gates.
+    for (const auto& gate : fused_gates) {
+      if (gate.kind != kMeasurement) {
+        // Fused products of permutation gates are permutation gates.
+        unsigned n = unsigned{1} << gate.qubits.size();
+        EXPECT_TRUE(MatrixGetPermutation(n, gate.matrix, perm, phases));
+      }
+
+      ApplyFusedGate(simulator, gate, state1);
+    }
+
+    unsigned size = 1 << (num_qubits + 1);
+    for (unsigned i = 0; i < size; ++i) {
+      EXPECT_NEAR(state0.get()[i], state1.get()[i], 1e-5);
+    }
+  }
+}
+
 TEST(FuserMultiQubitTest, SmallCircuits) {
   using Fuser = MultiQubitGateFuser<IO, DummyGate>;
 
@@ -1106,6 +1201,90 @@ TEST(FuserMultiQubitTest, OrphanedGates) {
   }
 }
 
+TEST(FuserMultiQubitTest, PauliRotationGates) {
+  using Gate = Cirq::GateCirq<float>;
+  using Fuser = MultiQubitGateFuser<IO, Gate>;
+
+  unsigned num_qubits = 8;
+
+  std::vector<Gate> circuit;
+
+  for (unsigned q = 0; q < num_qubits; ++q) {
+    circuit.push_back(Cirq::H<float>::Create(0, q));
+  }
+
+  circuit.push_back(Cirq::PauliRotation<float>::Create(
+      1, {0, 2, 4, 5, 7}, {1, 2, 3, 1, 2}, 0.3));
+
+  for (unsigned q = 0; q < num_qubits; q += 2) {
+    circuit.push_back(Cirq::CZ<float>::Create(2, q, q + 1));
+  }
+
+  circuit.push_back(Cirq::PauliRotation<float>::Create(3, {1, 6}, {2, 2}, 0.5));
+  circuit.push_back(Cirq::PauliRotation<float>::Create(3, {3}, {1}, 0.7));
+  circuit.push_back(Cirq::T<float>::Create(3, 0));
+  circuit.push_back(Cirq::T<float>::Create(3, 2));
+
+  circuit.push_back(Cirq::PauliRotation<float>::Create(
+      4, {0, 1, 2, 3, 4, 5, 6, 7}, {3, 1, 2, 3, 1, 2, 3, 1}, 0.2));
+
+  for (unsigned q = 0; q < num_qubits; ++q) {
+    circuit.push_back(Cirq::H<float>::Create(5, q));
+  }
+
+  using StateSpace = typename Simulator<For>::StateSpace;
+
+  Simulator<For> simulator(1);
+  StateSpace state_space(1);
+
+  auto state0 = state_space.Create(num_qubits);
+  state_space.SetStateZero(state0);
+
+  // Simulate unfused gates.
+  for (const auto& gate : circuit) {
+    ApplyGate(simulator, gate, state0);
+  }
+
+  Fuser::Parameter param;
+  param.verbosity = 0;
+
+  auto state1 = state_space.Create(num_qubits);
+
+  for (unsigned q = 2; q <= 6; ++q) {
+    state_space.SetStateZero(state1);
+
+    param.max_fused_size = q;
+    auto fused_gates = Fuser::FuseGates(
+        param, num_qubits, circuit.begin(), circuit.end());
+
+    unsigned num_pauli_rotation_gates = 0;
+
+    for (const auto& gate : fused_gates) {
+      if (gate.kind == gate::kPauliRotation) {
+        // Pauli rotation gates are not fused with other gates.
+        EXPECT_EQ(gate.gates.size(), 1);
+        EXPECT_EQ(gate.gates[0], gate.parent);
+        EXPECT_EQ(gate.matrix.size(), 0);
+        ++num_pauli_rotation_gates;
+      } else {
+        for (const auto* pgate : gate.gates) {
+          EXPECT_NE(pgate->kind, gate::kPauliRotation);
+        }
+      }
+
+      // Simulate fused gates.
+      ApplyFusedGate(simulator, gate, state1);
+    }
+
+    EXPECT_EQ(num_pauli_rotation_gates, 4);
+
+    unsigned size = 1 << (num_qubits + 1);
+    for (unsigned i = 0; i < size; ++i) {
+      EXPECT_NEAR(state0.get()[i], state1.get()[i], 1e-6);
+    }
+  }
+}
+
 }  // namespace qsim
 
 int main(int argc, char** argv) {
@@ -236,6 +236,49 @@ TEST(MatrixTest, MatrixDagger) {
   EXPECT_FLOAT_EQ(m2[31], -32);
 }
 
+TEST(MatrixTest, MatrixGetPermutation) {
+  // ISWAP.
+  Matrix<float> m1 = {1, 0, 0, 0, 0, 0, 0, 0,
+                      0, 0, 0, 0, 0, 1, 0, 0,
+                      0, 0, 0, 1, 0, 0, 0, 0,
+                      0, 0, 0, 0, 0, 0, 1, 0};
+
+  std::vector<unsigned> perm;
+  std::vector<float> phases;
+
+  EXPECT_TRUE(MatrixGetPermutation(4, m1, perm, phases));
+
+  std::array<unsigned, 4> expected_perm = {0, 2, 1, 3};
+  std::array<float, 8> expected_phases = {1, 0, 0, 1, 0, 1, 1, 0};
+
+  for (unsigned i = 0; i < 4; ++i) {
+    EXPECT_EQ(perm[i], expected_perm[i]);
+  }
+
+  for (unsigned i = 0; i < 8; ++i) {
+    EXPECT_FLOAT_EQ(phases[i], expected_phases[i]);
+  }
+
+  Matrix<float> m2;
+  MatrixFromPermutation(4, perm, phases, m2);
+
+  for (unsigned i = 0; i < 32; ++i) {
+    EXPECT_FLOAT_EQ(m2[i], m1[i]);
+  }
+
+  // Two nonzero elements in the first row.
+  Matrix<float> m3 = {1, 0, 1, 0, 0, 0, 1, 0};
+  EXPECT_FALSE(MatrixGetPermutation(2, m3, perm, phases));
+
+  // Two nonzero elements in the first column.
+  Matrix<float> m4 = {1, 0, 0, 0, 0, 1, 0, 0};
+  EXPECT_FALSE(MatrixGetPermutation(2, m4, perm, phases));
+
+  // Zero row.
+  Matrix<float> m5 = {1, 0, 0, 0, 0, 0, 0, 0};
+  EXPECT_FALSE(MatrixGetPermutation(2, m5, perm, phases));
+}
+
 TEST(MatrixTest, MatrixShuffle) {
   Matrix<float> sw = {1, 0, 0, 0, 0, 0, 0, 0,
                       0, 0, 0, 0, 1, 0, 0, 0,
@@ -0,0 +1,200 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../lib/poolfor.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+namespace qsim {
+
+TEST(PoolForTest, Run) {
+  for (unsigned num_threads : {1, 2, 3, 4}) {
+    PoolFor for_(num_threads);
+
+    for (uint64_t size : {0, 1, 100, 1023, 1024, 5000}) {
+      std::vector<unsigned> visits(size, 0);
+      std::vector<unsigned> thread_ids(size, 0);
+      std::vector<unsigned> nums_threads(size, 0);
+
+      auto f = [](unsigned n, unsigned m, uint64_t i,
+                  std::vector<unsigned>& visits,
+                  std::vector<unsigned>& thread_ids,
+                  std::vector<unsigned>& nums_threads) {
+        ++visits[i];
+        thread_ids[i] = m;
+        nums_threads[i] = n;
+      };
+
+      for_.Run(size, f, visits, thread_ids, nums_threads);
+
+      bool parallel = num_threads > 1 && size >= 1024;
+
+      for (unsigned m = 0; m < (parallel ? num_threads : 1); ++m) {
+        uint64_t i0 = for_.GetIndex0(size, m);
+        uint64_t i1 = for_.GetIndex1(size, m);
+
+        for (uint64_t i = i0; i < i1; ++i) {
+          EXPECT_EQ(visits[i], 1);
+          EXPECT_EQ(thread_ids[i], m);
+          EXPECT_EQ(nums_threads[i], parallel ? num_threads : 1);
+        }
+      }
+    }
+  }
+}
+
+TEST(PoolForTest, RunReduce) {
+  for (unsigned num_threads : {1, 2, 3, 4}) {
+    PoolFor for_(num_threads);
+
+    for (uint64_t size : {0, 100, 1024, 5000}) {
+      auto f = [](unsigned n, unsigned m, uint64_t i) -> uint64_t {
+        return i;
+      };
+
+      using Op = std::plus<uint64_t>;
+      auto partial_sums = for_.RunReduceP(size, f, Op());
+
+      bool parallel = num_threads > 1 && size >= 1024;
+      ASSERT_EQ(partial_sums.size(), parallel ? num_threads : 1);
+
+      for (unsigned m = 0; m < partial_sums.size(); ++m) {
+        uint64_t i0 = for_.GetIndex0(size, m);
+        uint64_t i1 = for_.GetIndex1(size, m);
+        EXPECT_EQ(partial_sums[m], (i1 * (i1 - 1) - i0 * (i0 - 1)) / 2);
+      }
+
+      EXPECT_EQ(for_.RunReduce(size, f, Op()),
+                size > 0 ? size * (size - 1) / 2 : 0);
+    }
+  }
+}
+
+TEST(PoolForTest, NestedRun) {
+  PoolFor for_(4);
+
+  uint64_t size = 1024;
+  std::vector<std::atomic<unsigned>> visits(size * size);
+
+  for (auto& v : visits) {
+    v = 0;
+  }
+
+  auto f2 = [](unsigned n, unsigned m, uint64_t j, uint64_t i, uint64_t size,
+               std::vector<std::atomic<unsigned>>& visits) {
+    ++visits[i * size + j];
+  };
+
+  auto f1 = [&f2, &for_](unsigned n, unsigned m, uint64_t i, uint64_t size,
+                         std::vector<std::atomic<unsigned>>& visits) {
+    // Nested loops are run sequentially by the calling worker.
+    for_.Run(size, f2, i, size, visits);
+  };
+
+  for_.Run(size, f1, size, visits);
+
+  for (auto& v : visits) {
+    EXPECT_EQ(v, 1);
+  }
+}
+
+TEST(PoolForTest, ConcurrentCallers) {
+  PoolFor for_(3);
+
+  auto f = [](unsigned n, unsigned m, uint64_t i) -> uint64_t {
+    return 1;
+  };
+
+  std::vector<uint64_t> sums(4, 0);
+  std::vector<std::thread> threads;
+
+  for (unsigned k = 0; k < sums.size(); ++k) {
+    threads.emplace_back([&for_, &f, &sums, k]() {
+      for (unsigned r = 0; r < 100; ++r) {
+        sums[k] += for_.RunReduce(4096, f, std::plus<uint64_t>());
+      }
+    });
+  }
+
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  for (auto sum : sums) {
+    EXPECT_EQ(sum, 100 * 4096);
+  }
+}
+
+TEST(PoolForTest, ManySmallLoops) {
+  // Exercises the dispatch path: back-to-back loops with sleeping and
+  // spinning workers.
+  for (bool pin_threads : {false, true}) {
+    PoolFor for_(4, pin_threads);
+
+    std::vector<uint64_t> v(1024, 0);
+
+    auto f = [](unsigned n, unsigned m, uint64_t i, std::vector<uint64_t>& v) {
+      ++v[i];
+    };
+
+    for (unsigned r = 0; r < 10000; ++r) {
+      for_.Run(v.size(), f, v);
+
+      if (r % 1000 == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+      }
+    }
+
+    for (auto x : v) {
+      EXPECT_EQ(x, 10000);
+    }
+  }
+}
+
+#ifdef __linux__
+TEST(PoolForTest, PinnedThreadZero) {
+  // With pinned threads, thread 0 is a pinned worker rather than the calling
+  // thread, which can migrate between CPUs.
+  for (bool pin_threads : {false, true}) {
+    PoolFor for_(3, pin_threads);
+
+    std::vector<std::thread::id> ids(3);
+
+    auto f = [](unsigned n, unsigned m, uint64_t i,
+                std::vector<std::thread::id>& ids) {
+      ids[m] = std::this_thread::get_id();
+    };
+
+    for_.Run(4096, f, ids);
+
+    EXPECT_EQ(ids[0] == std::this_thread::get_id(), !pin_threads);
+    EXPECT_NE(ids[1], std::this_thread::get_id());
+    EXPECT_NE(ids[2], std::this_thread::get_id());
+  }
+}
+#endif
+
+}  // namespace qsim
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -64,6 +64,38 @@ TEST(QTrajectoryAVXTest, UncomputeFinalState) {
   TestUncomputeFinalState(qsim::Factory<SequentialFor>());
 }
 
+TEST(QTrajectoryAVXTest, RelabelSwapGates) {
+  TestRelabelSwapGates(qsim::Factory<SequentialFor>());
+}
+
+TEST(QTrajectoryAVXTest, RunBatchParallel) {
+  TestRunBatchParallel(qsim::Factory<SequentialFor>());
+}
+
+TEST(QTrajectoryAVXTest, FusionCache) {
+  TestFusionCache(qsim::Factory<SequentialFor>());
+}
+
+TEST(QTrajectoryAVXTest, FoldPauliErrors) {
+  TestFoldPauliErrors(qsim::Factory<SequentialFor>());
+}
+
+TEST(QTrajectoryAVXTest, Checkpoints) {
+  TestCheckpoints(qsim::Factory<SequentialFor>());
+}
+
+TEST(QTrajectoryAVXTest, ImportanceSampling) {
+  TestImportanceSampling(qsim::Factory<SequentialFor>());
+}
+
+TEST(QTrajectoryAVXTest, TrajectoryEstimator) {
+  TestTrajectoryEstimator(qsim::Factory<SequentialFor>());
+}
+
+TEST(QTrajectoryAVXTest, PrimaryTrajectoryCache) {
+  TestPrimaryTrajectoryCache(qsim::Factory<SequentialFor>());
+}
+
 }  // namespace qsim
 
 int main(int argc, char** argv) {
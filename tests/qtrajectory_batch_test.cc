@@ -0,0 +1,448 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "density_matrix_testfixture.h"
+
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "../lib/channels_cirq.h"
+#include "../lib/fuser_mqubit.h"
+#include "../lib/gate_appl.h"
+#include "../lib/gates_cirq.h"
+#include "../lib/io.h"
+#include "../lib/matrix.h"
+#include "../lib/qtrajectory.h"
+#include "../lib/qtrajectory_batch.h"
+#include "../lib/seqfor.h"
+#include "../lib/simulator_basic.h"
+#include "../lib/simulator_batch.h"
+
+namespace qsim {
+
+constexpr unsigned kBatchSize = 8;
+
+using fp_type = float;
+using CirqGate = Cirq::GateCirq<fp_type>;
+using BatchSimulator = SimulatorBatch<SequentialFor, fp_type, kBatchSize>;
+using BatchStateSpace = BatchSimulator::StateSpace;
+using BasicSimulator = SimulatorBasic<SequentialFor, fp_type>;
+using BasicStateSpace = BasicSimulator::StateSpace;
+
+// Sets lane l of the batch to a state that depends on l.
+void SetTestStates(const BatchStateSpace& state_space,
+                   BatchStateSpace::State& state) {
+  uint64_t size = uint64_t{1} << state.num_qubits();
+
+  for (unsigned l = 0; l < kBatchSize; ++l) {
+    double norm = 0;
+
+    for (uint64_t i = 0; i < size; ++i) {
+      std::complex<double> a(std::cos(0.3 * i + l), std::sin(0.7 * i * l));
+      norm += std::norm(a);
+    }
+
+    for (uint64_t i = 0; i < size; ++i) {
+      std::complex<double> a(std::cos(0.3 * i + l), std::sin(0.7 * i * l));
+      a /= std::sqrt(norm);
+      state_space.SetAmpl(state, l, i, {fp_type(a.real()), fp_type(a.imag())});
+    }
+  }
+}
+
+TEST(QTrajectoryBatchTest, GateKernels) {
+  unsigned num_qubits = 5;
+
+  BatchStateSpace batch_state_space(1);
+  BatchSimulator batch_simulator(1);
+  BasicStateSpace state_space(1);
+  BasicSimulator simulator(1);
+
+  auto batch = batch_state_space.Create(num_qubits);
+  auto state = state_space.Create(num_qubits);
+  std::vector<fp_type> vec(state_space.MinSize(num_qubits));
+
+  std::vector<CirqGate> gates = {
+    Cirq::H<fp_type>::Create(0, 0),
+    Cirq::rx<fp_type>::Create(0, 4, 0.3),
+    Cirq::ISWAP<fp_type>::Create(0, 1, 3),
+    Cirq::FSimGate<fp_type>::Create(0, 2, 4, 0.4, 0.5),
+    Cirq::CCZ<fp_type>::Create(0, 0, 2, 3),
+    Cirq::Y<fp_type>::Create(0, 1).ControlledBy({4, 0}, {0, 1}),
+  };
+
+  fp_type mask[kBatchSize] = {1, 0, 0, 1, 1, 0, 1, 0};
+
+  for (const auto& gate : gates) {
+    for (bool masked : {false, true}) {
+      SetTestStates(batch_state_space, batch);
+
+      std::vector<std::vector<fp_type>> expected;
+
+      for (unsigned l = 0; l < kBatchSize; ++l) {
+        batch_state_space.CopyLane(batch, l, vec.data());
+        state_space.Copy(vec.data(), state);
+
+        if (!masked || mask[l] != 0) {
+          ApplyGate(simulator, gate, state);
+        }
+
+        state_space.InternalToNormalOrder(state);
+        expected.emplace_back(state.get(),
+                              state.get() + state_space.MinSize(num_qubits));
+      }
+
+      if (masked) {
+        batch_simulator.ApplyGateMasked(gate.qubits, gate.controlled_by,
+                                        gate.cmask, gate.matrix.data(), mask,
+                                        batch);
+      } else {
+        ApplyGate(batch_simulator, gate, batch);
+      }
+
+      for (unsigned l = 0; l < kBatchSize; ++l) {
+        batch_state_space.CopyLane(batch, l, vec.data());
+
+        for (uint64_t i = 0; i < 2 * (uint64_t{1} << num_qubits); ++i) {
+          EXPECT_NEAR(vec[i], expected[l][i], 1e-6);
+        }
+      }
+    }
+  }
+
+  // Gates with per-lane matrices; the masked lanes get the identity.
+
+  for (const auto& gate : gates) {
+    if (!gate.controlled_by.empty()) continue;
+
+    SetTestStates(batch_state_space, batch);
+
+    std::vector<std::vector<fp_type>> expected;
+
+    for (unsigned l = 0; l < kBatchSize; ++l) {
+      batch_state_space.CopyLane(batch, l, vec.data());
+      state_space.Copy(vec.data(), state);
+
+      if (mask[l] != 0) {
+        ApplyGate(simulator, gate, state);
+      }
+
+      state_space.InternalToNormalOrder(state);
+      expected.emplace_back(state.get(),
+                            state.get() + state_space.MinSize(num_qubits));
+    }
+
+    unsigned dim = unsigned{1} << gate.qubits.size();
+
+    Matrix<fp_type> identity;
+    MatrixIdentity(dim, identity);
+
+    std::vector<fp_type> matrices(kBatchSize * gate.matrix.size());
+
+    for (unsigned l = 0; l < kBatchSize; ++l) {
+      const auto& matrix = mask[l] != 0 ? gate.matrix : identity;
+
+      for (std::size_t j = 0; j < matrix.size(); ++j) {
+        matrices[kBatchSize * j + l] = matrix[j];
+      }
+    }
+
+    batch_simulator.ApplyLaneGate(gate.qubits, matrices.data(), batch);
+
+    for (unsigned l = 0; l < kBatchSize; ++l) {
+      batch_state_space.CopyLane(batch, l, vec.data());
+
+      for (uint64_t i = 0; i < 2 * (uint64_t{1} << num_qubits); ++i) {
+        EXPECT_NEAR(vec[i], expected[l][i], 1e-6);
+      }
+    }
+  }
+
+  // Expectation values and norms.
+
+  SetTestStates(batch_state_space, batch);
+
+  auto norms = batch_state_space.Norms(batch);
+  ASSERT_EQ(norms.size(), kBatchSize);
+
+  for (const auto& gate : gates) {
+    if (!gate.controlled_by.empty()) continue;
+
+    auto evs = batch_simulator.ExpectationValues(gate.qubits,
+                                                 gate.matrix.data(), batch);
+    ASSERT_EQ(evs.size(), kBatchSize);
+
+    for (unsigned l = 0; l < kBatchSize; ++l) {
+      batch_state_space.CopyLane(batch, l, vec.data());
+      state_space.Copy(vec.data(), state);
+
+      auto expected = simulator.ExpectationValue(gate.qubits,
+                                                 gate.matrix.data(), state);
+
+      EXPECT_NEAR(std::real(evs[l]), std::real(expected), 1e-6);
+      EXPECT_NEAR(std::imag(evs[l]), std::imag(expected), 1e-6);
+      EXPECT_NEAR(norms[l], 1, 1e-6);
+    }
+  }
+
+  // Per-lane normalization.
+
+  fp_type factors[kBatchSize];
+  for (unsigned l = 0; l < kBatchSize; ++l) {
+    factors[l] = l + 1;
+  }
+
+  batch_state_space.Multiply(factors, batch);
+  norms = batch_state_space.Norms(batch);
+
+  for (unsigned l = 0; l < kBatchSize; ++l) {
+    EXPECT_NEAR(norms[l], (l + 1) * (l + 1), 1e-4);
+  }
+}
+
+TEST(QTrajectoryBatchTest, CompareWithQTrajectorySimulator) {
+  using QTSimulator = QuantumTrajectorySimulator<IO, CirqGate,
+                                                 MultiQubitGateFuser,
+                                                 BasicSimulator>;
+  using BatchQTSimulator = BatchedTrajectorySimulator<IO, CirqGate,
+                                                      MultiQubitGateFuser,
+                                                      BatchSimulator>;
+
+  // A circuit with gates, mixed unitary channels, non-unitary channels,
+  // a Pauli rotation gate and a channel with a controlled gate.
+  auto ncircuit = GenerateDensityMatrixTestCircuit<CirqGate>();
+  unsigned num_qubits = ncircuit.num_qubits;
+  uint64_t size = uint64_t{1} << num_qubits;
+
+  BatchStateSpace batch_state_space(1);
+  BatchSimulator batch_simulator(1);
+  BasicStateSpace state_space(1);
+  BasicSimulator simulator(1);
+
+  // Not a multiple of the batch size.
+  uint64_t r0 = 5;
+  uint64_t r1 = r0 + 5 * kBatchSize + 3;
+
+  std::vector<std::vector<fp_type>> batch_results(r1 - r0);
+
+  auto measure = [&](uint64_t r, unsigned num_reps,
+                     const BatchStateSpace::State& batch) {
+    EXPECT_EQ(num_reps, std::min(uint64_t{kBatchSize}, r1 - r));
+
+    for (unsigned l = 0; l < num_reps; ++l) {
+      auto& vec = batch_results[r + l - r0];
+      vec.resize(2 * size);
+      batch_state_space.CopyLane(batch, l, vec.data());
+    }
+  };
+
+  for (unsigned max_fused_size : {2, 4}) {
+    BatchQTSimulator::Parameter batch_param;
+    batch_param.max_fused_size = max_fused_size;
+
+    EXPECT_TRUE(BatchQTSimulator::RunBatch(batch_param, ncircuit, r0, r1,
+                                           batch_state_space, batch_simulator,
+                                           measure));
+
+    QTSimulator::Parameter param;
+    param.max_fused_size = max_fused_size;
+
+    auto state = state_space.Create(num_qubits);
+    QTSimulator::Stat stat;
+
+    for (uint64_t r = r0; r < r1; ++r) {
+      state_space.SetStateZero(state);
+      ASSERT_TRUE(QTSimulator::RunOnce(param, ncircuit, r, state_space,
+                                       simulator, state, stat));
+
+      const auto& vec = batch_results[r - r0];
+      ASSERT_EQ(vec.size(), 2 * size);
+
+      for (uint64_t i = 0; i < size; ++i) {
+        auto a = state_space.GetAmpl(state, i);
+        EXPECT_NEAR(vec[2 * i], std::real(a), 1e-5);
+        EXPECT_NEAR(vec[2 * i + 1], std::imag(a), 1e-5);
+      }
+    }
+  }
+}
+
+TEST(QTrajectoryBatchTest, LargeFusedGates) {
+  using BatchQTSimulator = BatchedTrajectorySimulator<IO, CirqGate,
+                                                      MultiQubitGateFuser,
+                                                      BatchSimulator>;
+  using QTSimulator = QuantumTrajectorySimulator<IO, CirqGate,
+                                                 MultiQubitGateFuser,
+                                                 BasicSimulator>;
+
+  unsigned num_qubits = 8;
+  uint64_t size = uint64_t{1} << num_qubits;
+
+  NoisyCircuit<CirqGate> ncircuit;
+  ncircuit.num_qubits = num_qubits;
+
+  unsigned time = 0;
+
+  for (unsigned k = 0; k < 3; ++k) {
+    for (unsigned q = 0; q < num_qubits; ++q) {
+      ncircuit.channels.push_back(MakeChannelFromGate(
+          time, Cirq::rx<fp_type>::Create(time, q, 0.3 + 0.1 * q + k)));
+    }
+    ++time;
+
+    for (unsigned q = k % 2; q + 1 < num_qubits; q += 2) {
+      ncircuit.channels.push_back(MakeChannelFromGate(
+          time, Cirq::CZ<fp_type>::Create(time, q, q + 1)));
+    }
+    ++time;
+
+    ncircuit.channels.push_back(
+        Cirq::depolarize<fp_type>(0.1).Create(time, k));
+    ncircuit.channels.push_back(
+        Cirq::amplitude_damp<fp_type>(0.2).Create(time, num_qubits - 1 - k));
+    ++time;
+  }
+
+  BatchStateSpace batch_state_space(1);
+  BatchSimulator batch_simulator(1);
+  BasicStateSpace state_space(1);
+  BasicSimulator simulator(1);
+
+  uint64_t num_reps = 2 * kBatchSize;
+
+  std::vector<std::vector<fp_type>> batch_results(num_reps);
+
+  auto measure = [&](uint64_t r, unsigned num_reps,
+                     const BatchStateSpace::State& batch) {
+    for (unsigned l = 0; l < num_reps; ++l) {
+      auto& vec = batch_results[r + l];
+      vec.resize(2 * size);
+      batch_state_space.CopyLane(batch, l, vec.data());
+    }
+  };
+
+  // Fused gates are limited to BatchSimulator::kMaxGateQubits qubits.
+  BatchQTSimulator::Parameter batch_param;
+  batch_param.max_fused_size = 8;
+
+  EXPECT_TRUE(BatchQTSimulator::RunBatch(batch_param, ncircuit, 0, num_reps,
+                                         batch_state_space, batch_simulator,
+                                         measure));
+
+  QTSimulator::Parameter param;
+  param.max_fused_size = 4;
+
+  auto state = state_space.Create(num_qubits);
+  QTSimulator::Stat stat;
+
+  for (uint64_t r = 0; r < num_reps; ++r) {
+    state_space.SetStateZero(state);
+    ASSERT_TRUE(QTSimulator::RunOnce(param, ncircuit, r, state_space,
+                                     simulator, state, stat));
+
+    const auto& vec = batch_results[r];
+    ASSERT_EQ(vec.size(), 2 * size);
+
+    for (uint64_t i = 0; i < size; ++i) {
+      auto a = state_space.GetAmpl(state, i);
+      EXPECT_NEAR(vec[2 * i], std::real(a), 1e-5);
+      EXPECT_NEAR(vec[2 * i + 1], std::imag(a), 1e-5);
+    }
+  }
+
+  // Gates on more than BatchSimulator::kMaxGateQubits qubits are rejected.
+  unsigned num_gate_qubits = BatchSimulator::kMaxGateQubits + 1;
+  std::vector<unsigned> qubits;
+  for (unsigned q = 0; q < num_gate_qubits; ++q) {
+    qubits.push_back(q);
+  }
+
+  Matrix<fp_type> matrix;
+  MatrixIdentity(unsigned{1} << num_gate_qubits, matrix);
+
+  ncircuit.channels.push_back(MakeChannelFromGate(
+      time, Cirq::MatrixGate<fp_type>::Create(time, qubits, matrix)));
+
+  EXPECT_FALSE(BatchQTSimulator::RunBatch(batch_param, ncircuit, 0, num_reps,
+                                          batch_state_space, batch_simulator,
+                                          measure));
+}
+
+TEST(QTrajectoryBatchTest, MeasurementsNotSupported) {
+  NoisyCircuit<CirqGate> ncircuit;
+  ncircuit.num_qubits = 2;
+  ncircuit.channels.push_back(
+      MakeChannelFromGate(0, Cirq::H<fp_type>::Create(0, 0)));
+  ncircuit.channels.push_back(
+      MakeChannelFromGate(1, gate::Measurement<CirqGate>::Create(1, {0})));
+
+  using BatchQTSimulator = BatchedTrajectorySimulator<IO, CirqGate,
+                                                      MultiQubitGateFuser,
+                                                      BatchSimulator>;
+
+  BatchStateSpace batch_state_space(1);
+  BatchSimulator batch_simulator(1);
+
+  auto measure = [](uint64_t r, unsigned num_reps,
+                    const BatchStateSpace::State& batch) {};
+
+  BatchQTSimulator::Parameter param;
+  EXPECT_FALSE(BatchQTSimulator::RunBatch(param, ncircuit, 0, 8,
+                                          batch_state_space, batch_simulator,
+                                          measure));
+}
+
+TEST(QTrajectoryBatchTest, TooManyQubits) {
+  using BatchQTSimulator = BatchedTrajectorySimulator<IO, CirqGate,
+                                                      MultiQubitGateFuser,
+                                                      BatchSimulator>;
+
+  // The batch of eight single-precision state vectors on 13 qubits takes
+  // 512 KB.
+  unsigned max_num_qubits = BatchQTSimulator::MaxNumQubits();
+  EXPECT_EQ(max_num_qubits, 13);
+
+  BatchStateSpace batch_state_space(1);
+  BatchSimulator batch_simulator(1);
+
+  auto measure = [](uint64_t r, unsigned num_reps,
+                    const BatchStateSpace::State& batch) {};
+
+  BatchQTSimulator::Parameter param;
+
+  for (unsigned num_qubits : {max_num_qubits, max_num_qubits + 1}) {
+    NoisyCircuit<CirqGate> ncircuit;
+    ncircuit.num_qubits = num_qubits;
+    ncircuit.channels.push_back(
+        MakeChannelFromGate(0, Cirq::H<fp_type>::Create(0, 0)));
+    ncircuit.channels.push_back(
+        Cirq::depolarize<fp_type>(0.01).Create(1, num_qubits - 1));
+
+    bool rc = BatchQTSimulator::RunBatch(param, ncircuit, 0, 8,
+                                         batch_state_space, batch_simulator,
+                                         measure);
+    EXPECT_EQ(rc, num_qubits <= max_num_qubits);
+  }
+}
+
+}  // namespace qsim
+
+int main(int argc, char** argv) {
+  testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
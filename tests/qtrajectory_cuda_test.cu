@@ -88,6 +88,13 @@ TEST(QTrajectoryCUDATest, UncomputeFinalState) {
   TestUncomputeFinalState(factory);
 }
 
+TEST(QTrajectoryCUDATest, RelabelSwapGates) {
+  using Factory = qsim::Factory<float>;
+  Factory::StateSpace::Parameter param;
+  Factory factory(param);
+  TestRelabelSwapGates(factory);
+}
+
 }  // namespace qsim
 
 int main(int argc, char** argv) {
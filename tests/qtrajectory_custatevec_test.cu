@@ -79,6 +79,10 @@ TEST(QTrajectoryCuStateVecTest, UncomputeFinalState) {
   TestUncomputeFinalState(qsim::Factory<float>());
 }
 
+TEST(QTrajectoryCuStateVecTest, RelabelSwapGates) {
+  TestRelabelSwapGates(qsim::Factory<float>());
+}
+
 }  // namespace qsim
 
 int main(int argc, char** argv) {
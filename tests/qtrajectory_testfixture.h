@@ -16,6 +16,7 @@
 #define QTRAJECTORY_TESTFIXTURE_H_
 
 #include <cmath>
+#include <complex>
 #include <cstdint>
 #include <vector>
 
@@ -24,6 +25,7 @@
 #include "../lib/channel.h"
 #include "../lib/channels_cirq.h"
 #include "../lib/circuit_noisy.h"
+#include "../lib/density_matrix.h"
 #include "../lib/expect.h"
 #include "../lib/fuser_mqubit.h"
 #include "../lib/gate_appl.h"
@@ -1018,6 +1020,874 @@ void TestUncomputeFinalState(const Factory& factory) {
   }
 }
 
+template <typename Factory>
+void TestRelabelSwapGates(const Factory& factory) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Factory::StateSpace;
+  using State = typename StateSpace::State;
+  using fp_type = typename StateSpace::fp_type;
+  using GateCirq = Cirq::GateCirq<fp_type>;
+  using QTSimulator = QuantumTrajectorySimulator<IO, GateCirq,
+                                                 MultiQubitGateFuser,
+                                                 Simulator>;
+
+  unsigned num_qubits = 4;
+
+  // Qubit 3 is an ancilla in the state |1> that is swapped around and
+  // measured, so the measurement outcome is deterministic.
+  std::vector<GateCirq> circuit = {
+    Cirq::H<fp_type>::Create(0, 0),
+    Cirq::H<fp_type>::Create(0, 1),
+    Cirq::H<fp_type>::Create(0, 2),
+    Cirq::X<fp_type>::Create(0, 3),
+    Cirq::CZ<fp_type>::Create(1, 0, 1),
+    Cirq::SWAP<fp_type>::Create(1, 2, 3),
+    Cirq::rx<fp_type>::Create(2, 0, 0.3),
+    Cirq::ry<fp_type>::Create(2, 3, 0.4),
+    Cirq::SWAP<fp_type>::Create(2, 1, 2),
+    gate::Measurement<GateCirq>::Create(3, {1}),
+    Cirq::FSimGate<fp_type>::Create(4, 0, 3, 0.5, 0.6),
+    Cirq::rz<fp_type>::Create(4, 2, 0.7),
+    Cirq::SWAP<fp_type>::Create(5, 0, 2),
+    Cirq::rx<fp_type>::Create(5, 3, 0.8).ControlledBy({1}),
+    Cirq::ISWAP<fp_type>::Create(6, 0, 3),
+    Cirq::H<fp_type>::Create(6, 2),
+  };
+
+  auto channel = Cirq::amplitude_damp<fp_type>(0.2);
+
+  NoisyCircuit<GateCirq> ncircuit;
+  ncircuit.num_qubits = num_qubits;
+
+  // Add noise after all the gates that do not act on the ancilla.
+  for (const auto& gate : circuit) {
+    ncircuit.channels.push_back(MakeChannelFromGate(2 * gate.time, gate));
+
+    if (gate.kind == gate::kMeasurement || gate.kind == Cirq::kSWAP
+        || gate.kind == Cirq::kX) continue;
+
+    for (auto q : gate.qubits) {
+      ncircuit.channels.push_back(channel.Create(2 * gate.time + 1, q));
+    }
+  }
+
+  Simulator simulator = factory.CreateSimulator();
+  StateSpace state_space = factory.CreateStateSpace();
+
+  State state1 = state_space.Create(num_qubits);
+  State state2 = state_space.Create(num_qubits);
+
+  EXPECT_FALSE(state_space.IsNull(state1));
+  EXPECT_FALSE(state_space.IsNull(state2));
+
+  typename QTSimulator::Parameter param;
+  param.collect_kop_stat = true;
+  param.collect_mea_stat = true;
+
+  typename QTSimulator::Stat stat1;
+  typename QTSimulator::Stat stat2;
+
+  unsigned size = 1 << num_qubits;
+
+  for (unsigned r = 0; r < 20; ++r) {
+    state_space.SetStateZero(state1);
+    state_space.SetStateZero(state2);
+
+    param.relabel_swap_gates = false;
+    EXPECT_TRUE(QTSimulator::RunOnce(
+        param, ncircuit, r, state_space, simulator, state1, stat1));
+
+    param.relabel_swap_gates = true;
+    EXPECT_TRUE(QTSimulator::RunOnce(
+        param, ncircuit, r, state_space, simulator, state2, stat2));
+
+    EXPECT_EQ(stat1.samples, stat2.samples);
+    EXPECT_EQ(stat1.primary, stat2.primary);
+
+    for (unsigned i = 0; i < size; ++i) {
+      auto a1 = state_space.GetAmpl(state1, i);
+      auto a2 = state_space.GetAmpl(state2, i);
+      EXPECT_NEAR(std::real(a1), std::real(a2), 1e-6);
+      EXPECT_NEAR(std::imag(a1), std::imag(a2), 1e-6);
+    }
+  }
+}
+
+template <typename Factory>
+void TestRunBatchParallel(const Factory& factory) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Factory::StateSpace;
+  using State = typename StateSpace::State;
+  using fp_type = typename StateSpace::fp_type;
+  using Gate = Cirq::GateCirq<fp_type>;
+  using QTSimulator = QuantumTrajectorySimulator<IO, Gate, MultiQubitGateFuser,
+                                                 Simulator>;
+
+  unsigned num_qubits = 2;
+  unsigned num_reps = 1000;
+  unsigned size = 1 << num_qubits;
+
+  auto ncircuit = GenerateNoisyCircuit<Gate>(0.1, AddGenAmplDumpNoise1<Gate>,
+                                             AddGenAmplDumpNoise2<Gate>);
+
+  using Samples = std::vector<std::vector<uint64_t>>;
+  using Amplitudes = std::vector<std::vector<std::complex<fp_type>>>;
+
+  // Results are stored at the position given by repetition ID, so the
+  // measure function can be called concurrently.
+  auto measure = [](uint64_t r, const State& state,
+                    const typename QTSimulator::Stat& stat,
+                    unsigned size, Samples& samples, Amplitudes& amplitudes) {
+    samples[r] = stat.samples;
+    amplitudes[r].reserve(size);
+
+    for (unsigned i = 0; i < size; ++i) {
+      amplitudes[r].push_back(StateSpace::GetAmpl(state, i));
+    }
+  };
+
+  typename QTSimulator::Parameter param;
+  param.collect_kop_stat = true;
+  param.collect_mea_stat = true;
+
+  Simulator simulator = factory.CreateSimulator();
+  StateSpace state_space = factory.CreateStateSpace();
+
+  Samples samples1(num_reps);
+  Amplitudes amplitudes1(num_reps);
+
+  EXPECT_TRUE(QTSimulator::RunBatch(param, ncircuit, 0, num_reps, state_space,
+                                    simulator, measure, size, samples1,
+                                    amplitudes1));
+
+  for (unsigned num_threads : {1, 4}) {
+    Samples samples2(num_reps);
+    Amplitudes amplitudes2(num_reps);
+
+    EXPECT_TRUE(QTSimulator::RunBatchParallel(param, ncircuit, 0, num_reps,
+                                              num_threads, measure, size,
+                                              samples2, amplitudes2));
+
+    for (unsigned r = 0; r < num_reps; ++r) {
+      EXPECT_EQ(samples1[r], samples2[r]);
+      ASSERT_EQ(amplitudes2[r].size(), size);
+
+      for (unsigned i = 0; i < size; ++i) {
+        auto a1 = amplitudes1[r][i];
+        auto a2 = amplitudes2[r][i];
+        EXPECT_NEAR(std::real(a1), std::real(a2), 1e-6);
+        EXPECT_NEAR(std::imag(a1), std::imag(a2), 1e-6);
+      }
+    }
+  }
+
+  // The last deferred operators are applied for the first occurence of
+  // the primary trajectory on each thread and for all the other trajectories.
+  // The primary trajectory does not occur in circuits with measurements.
+  ncircuit = GenerateNoisyCircuit<Gate>(0.02, AddAmplDumpNoise1<Gate>,
+                                        AddAmplDumpNoise2<Gate>, false);
+
+  Samples samples3(num_reps);
+  Amplitudes amplitudes3(num_reps);
+
+  EXPECT_TRUE(QTSimulator::RunBatch(param, ncircuit, 0, num_reps, state_space,
+                                    simulator, measure, size, samples3,
+                                    amplitudes3));
+
+  param.apply_last_deferred_ops = false;
+
+  for (unsigned num_threads : {1, 4}) {
+    Amplitudes amplitudes2(num_reps);
+    std::vector<char> primary(num_reps, 0);
+
+    auto measure2 = [&](uint64_t r, const State& state,
+                        const typename QTSimulator::Stat& stat) {
+      primary[r] = stat.primary;
+      amplitudes2[r].reserve(size);
+
+      for (unsigned i = 0; i < size; ++i) {
+        amplitudes2[r].push_back(StateSpace::GetAmpl(state, i));
+      }
+    };
+
+    EXPECT_TRUE(QTSimulator::RunBatchParallel(param, ncircuit, 0, num_reps,
+                                              num_threads, measure2));
+
+    unsigned num_primary = 0;
+    unsigned num_complete_primary = 0;
+
+    for (unsigned r = 0; r < num_reps; ++r) {
+      bool complete = true;
+
+      for (unsigned i = 0; i < size; ++i) {
+        auto a1 = amplitudes3[r][i];
+        auto a2 = amplitudes2[r][i];
+        if (std::abs(a1 - a2) > 1e-6) {
+          complete = false;
+        }
+      }
+
+      if (primary[r]) {
+        ++num_primary;
+        num_complete_primary += complete;
+      } else {
+        EXPECT_TRUE(complete);
+      }
+    }
+
+    EXPECT_GT(num_primary, num_threads);
+    EXPECT_GE(num_complete_primary, 1);
+    EXPECT_LE(num_complete_primary, num_threads);
+  }
+}
+
+template <typename Factory>
+void TestFusionCache(const Factory& factory) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Factory::StateSpace;
+  using State = typename StateSpace::State;
+  using fp_type = typename StateSpace::fp_type;
+  using Gate = Cirq::GateCirq<fp_type>;
+  using QTSimulator = QuantumTrajectorySimulator<IO, Gate, MultiQubitGateFuser,
+                                                 Simulator>;
+
+  unsigned num_qubits = 2;
+  unsigned num_reps = 1000;
+  unsigned size = 1 << num_qubits;
+
+  auto ncircuit = GenerateNoisyCircuit<Gate>(0.1, AddBitFlipNoise1<Gate>,
+                                             AddAmplDumpNoise2<Gate>);
+
+  using Samples = std::vector<std::vector<uint64_t>>;
+  using Amplitudes = std::vector<std::vector<std::complex<fp_type>>>;
+
+  auto measure = [](uint64_t r, const State& state,
+                    const typename QTSimulator::Stat& stat,
+                    unsigned size, Samples& samples, Amplitudes& amplitudes) {
+    samples[r] = stat.samples;
+    amplitudes[r].reserve(size);
+
+    for (unsigned i = 0; i < size; ++i) {
+      amplitudes[r].push_back(StateSpace::GetAmpl(state, i));
+    }
+  };
+
+  Simulator simulator = factory.CreateSimulator();
+  StateSpace state_space = factory.CreateStateSpace();
+
+  typename QTSimulator::Parameter param;
+  param.collect_kop_stat = true;
+  param.collect_mea_stat = true;
+  param.max_fusion_cache_size = 0;
+
+  Samples samples1(num_reps);
+  Amplitudes amplitudes1(num_reps);
+
+  EXPECT_TRUE(QTSimulator::RunBatch(param, ncircuit, 0, num_reps, state_space,
+                                    simulator, measure, size, samples1,
+                                    amplitudes1));
+
+  // The cache with two entries gets full quickly.
+  for (unsigned max_fusion_cache_size : {2, 64}) {
+    param.max_fusion_cache_size = max_fusion_cache_size;
+
+    Samples samples2(num_reps);
+    Amplitudes amplitudes2(num_reps);
+
+    EXPECT_TRUE(QTSimulator::RunBatch(param, ncircuit, 0, num_reps,
+                                      state_space, simulator, measure, size,
+                                      samples2, amplitudes2));
+
+    for (unsigned r = 0; r < num_reps; ++r) {
+      EXPECT_EQ(samples1[r], samples2[r]);
+      ASSERT_EQ(amplitudes2[r].size(), size);
+
+      for (unsigned i = 0; i < size; ++i) {
+        auto a1 = amplitudes1[r][i];
+        auto a2 = amplitudes2[r][i];
+        EXPECT_FLOAT_EQ(std::real(a1), std::real(a2));
+        EXPECT_FLOAT_EQ(std::imag(a1), std::imag(a2));
+      }
+    }
+  }
+}
+
+template <typename Factory>
+void TestFoldPauliErrors(const Factory& factory) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Factory::StateSpace;
+  using State = typename StateSpace::State;
+  using fp_type = typename StateSpace::fp_type;
+  using Gate = Cirq::GateCirq<fp_type>;
+  using QTSimulator = QuantumTrajectorySimulator<IO, Gate, MultiQubitGateFuser,
+                                                 Simulator>;
+
+  unsigned num_qubits = 2;
+  unsigned num_reps = 1000;
+  unsigned size = 1 << num_qubits;
+
+  using Samples = std::vector<std::vector<uint64_t>>;
+  using Amplitudes = std::vector<std::vector<std::complex<fp_type>>>;
+
+  auto measure = [](uint64_t r, const State& state,
+                    const typename QTSimulator::Stat& stat,
+                    unsigned size, Samples& samples, Amplitudes& amplitudes) {
+    samples[r] = stat.samples;
+    amplitudes[r].reserve(size);
+
+    for (unsigned i = 0; i < size; ++i) {
+      amplitudes[r].push_back(StateSpace::GetAmpl(state, i));
+    }
+  };
+
+  Simulator simulator = factory.CreateSimulator();
+  StateSpace state_space = factory.CreateStateSpace();
+
+  for (bool add_measurement : {false, true}) {
+    // Bit flip channels are Pauli channels; amplitude damping channels
+    // are not.
+    auto ncircuit1 = GenerateNoisyCircuit<Gate>(
+        0.1, AddBitFlipNoise1<Gate>, AddBitFlipNoise2<Gate>, add_measurement);
+    auto ncircuit2 = GenerateNoisyCircuit<Gate>(
+        0.1, AddBitFlipNoise1<Gate>, AddAmplDumpNoise2<Gate>, add_measurement);
+
+    for (const auto& ncircuit : {ncircuit1, ncircuit2}) {
+      typename QTSimulator::Parameter param;
+      param.collect_kop_stat = true;
+      param.collect_mea_stat = true;
+      param.fold_pauli_errors = false;
+
+      Samples samples1(num_reps);
+      Amplitudes amplitudes1(num_reps);
+
+      EXPECT_TRUE(QTSimulator::RunBatch(param, ncircuit, 0, num_reps,
+                                        state_space, simulator, measure, size,
+                                        samples1, amplitudes1));
+
+      param.fold_pauli_errors = true;
+
+      // The cache with two entries gets full quickly.
+      for (unsigned max_fusion_cache_size : {2, 64}) {
+        param.max_fusion_cache_size = max_fusion_cache_size;
+
+        Samples samples2(num_reps);
+        Amplitudes amplitudes2(num_reps);
+        Samples samples3(num_reps);
+        Amplitudes amplitudes3(num_reps);
+
+        EXPECT_TRUE(QTSimulator::RunBatch(param, ncircuit, 0, num_reps,
+                                          state_space, simulator, measure,
+                                          size, samples2, amplitudes2));
+        EXPECT_TRUE(QTSimulator::RunBatchParallel(param, ncircuit, 0,
+                                                  num_reps, 2, measure, size,
+                                                  samples3, amplitudes3));
+
+        for (unsigned r = 0; r < num_reps; ++r) {
+          EXPECT_EQ(samples1[r], samples2[r]);
+          EXPECT_EQ(samples1[r], samples3[r]);
+          ASSERT_EQ(amplitudes2[r].size(), size);
+          ASSERT_EQ(amplitudes3[r].size(), size);
+
+          for (unsigned i = 0; i < size; ++i) {
+            auto a1 = amplitudes1[r][i];
+            auto a2 = amplitudes2[r][i];
+            auto a3 = amplitudes3[r][i];
+            EXPECT_NEAR(std::real(a1), std::real(a2), 1e-6);
+            EXPECT_NEAR(std::imag(a1), std::imag(a2), 1e-6);
+            EXPECT_NEAR(std::real(a1), std::real(a3), 1e-6);
+            EXPECT_NEAR(std::imag(a1), std::imag(a3), 1e-6);
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Factory>
+void TestCheckpoints(const Factory& factory) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Factory::StateSpace;
+  using State = typename StateSpace::State;
+  using fp_type = typename StateSpace::fp_type;
+  using Gate = Cirq::GateCirq<fp_type>;
+  using QTSimulator = QuantumTrajectorySimulator<IO, Gate, MultiQubitGateFuser,
+                                                 Simulator>;
+
+  unsigned num_qubits = 2;
+  unsigned num_reps = 1000;
+  unsigned size = 1 << num_qubits;
+
+  using Samples = std::vector<std::vector<uint64_t>>;
+  using Amplitudes = std::vector<std::vector<std::complex<fp_type>>>;
+
+  auto measure = [](uint64_t r, const State& state,
+                    const typename QTSimulator::Stat& stat,
+                    unsigned size, Samples& samples, Amplitudes& amplitudes,
+                    std::vector<bool>& primary) {
+    samples[r] = stat.samples;
+    primary[r] = stat.primary;
+    amplitudes[r].reserve(size);
+
+    for (unsigned i = 0; i < size; ++i) {
+      amplitudes[r].push_back(StateSpace::GetAmpl(state, i));
+    }
+  };
+
+  Simulator simulator = factory.CreateSimulator();
+  StateSpace state_space = factory.CreateStateSpace();
+
+  for (bool add_measurement : {false, true}) {
+    auto ncircuit = GenerateNoisyCircuit<Gate>(
+        0.05, AddBitFlipNoise1<Gate>, AddAmplDumpNoise2<Gate>,
+        add_measurement);
+
+    for (bool relabel_swap_gates : {false, true}) {
+      typename QTSimulator::Parameter param;
+      param.collect_kop_stat = true;
+      param.collect_mea_stat = true;
+      param.relabel_swap_gates = relabel_swap_gates;
+
+      Samples samples1(num_reps);
+      Amplitudes amplitudes1(num_reps);
+      std::vector<bool> primary1(num_reps);
+
+      EXPECT_TRUE(QTSimulator::RunBatch(param, ncircuit, 0, num_reps,
+                                        state_space, simulator, measure, size,
+                                        samples1, amplitudes1, primary1));
+
+      for (unsigned max_checkpoints : {1, 3, 100}) {
+        param.max_checkpoints = max_checkpoints;
+
+        for (bool parallel : {false, true}) {
+          Samples samples2(num_reps);
+          Amplitudes amplitudes2(num_reps);
+          std::vector<bool> primary2(num_reps);
+
+          if (parallel) {
+            EXPECT_TRUE(QTSimulator::RunBatchParallel(
+                param, ncircuit, 0, num_reps, 2, measure, size, samples2,
+                amplitudes2, primary2));
+          } else {
+            EXPECT_TRUE(QTSimulator::RunBatch(
+                param, ncircuit, 0, num_reps, state_space, simulator, measure,
+                size, samples2, amplitudes2, primary2));
+          }
+
+          for (unsigned r = 0; r < num_reps; ++r) {
+            EXPECT_EQ(samples1[r], samples2[r]);
+            EXPECT_EQ(primary1[r], primary2[r]);
+            ASSERT_EQ(amplitudes2[r].size(), size);
+
+            for (unsigned i = 0; i < size; ++i) {
+              auto a1 = amplitudes1[r][i];
+              auto a2 = amplitudes2[r][i];
+              EXPECT_NEAR(std::real(a1), std::real(a2), 1e-6);
+              EXPECT_NEAR(std::imag(a1), std::imag(a2), 1e-6);
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Factory>
+void TestImportanceSampling(const Factory& factory) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Factory::StateSpace;
+  using State = typename StateSpace::State;
+  using fp_type = typename StateSpace::fp_type;
+  using Gate = Cirq::GateCirq<fp_type>;
+  using Fuser = MultiQubitGateFuser<IO, Gate>;
+  using QTSimulator = QuantumTrajectorySimulator<IO, Gate, MultiQubitGateFuser,
+                                                 Simulator>;
+  using DMSimulator =
+      DensityMatrixSimulator<IO, Gate, MultiQubitGateFuser, Simulator>;
+
+  unsigned num_qubits = 2;
+  unsigned num_reps = 1000;
+
+  auto ncircuit = GenerateNoisyCircuit<Gate>(
+      0.002, AddBitFlipNoise1<Gate>, AddBitFlipNoise2<Gate>, false);
+
+  using Y = qsim::Cirq::Y<fp_type>;
+  using Z = qsim::Cirq::Z<fp_type>;
+
+  std::vector<std::vector<qsim::OpString<Gate>>> observables = {
+    {{{1.0, 0.0}, {Z::Create(0, 0)}}},
+    {{{1.0, 0.0}, {Y::Create(0, 1)}}},
+    {{{1.0, 0.0}, {Z::Create(0, 0), Z::Create(0, 1)}}},
+  };
+
+  Simulator simulator = factory.CreateSimulator();
+  StateSpace state_space = factory.CreateStateSpace();
+
+  // Exact expectation values.
+  std::vector<double> expected_results;
+
+  {
+    typename DMSimulator::Parameter param;
+    auto rho = DMSimulator::Create(num_qubits, state_space);
+    DMSimulator::SetBasisState(state_space, 0, rho);
+
+    EXPECT_TRUE(DMSimulator::Run(param, ncircuit, state_space, simulator,
+                                 rho));
+
+    auto ket = state_space.Null();
+
+    for (const auto& obs : observables) {
+      expected_results.push_back(std::real(DMSimulator::ExpectationValue(
+          param, obs, state_space, simulator, rho, ket)));
+    }
+  }
+
+  using Results = std::vector<std::vector<double>>;
+
+  auto measure = [](uint64_t r, const State& state,
+                    const typename QTSimulator::Stat& stat,
+                    const Simulator& simulator,
+                    const std::vector<std::vector<OpString<Gate>>>& observables,
+                    std::vector<double>& weights, Results& results) {
+    weights[r] = stat.weight;
+    for (const auto& obs : observables) {
+      results[r].push_back(
+          std::real(ExpectationValue<IO, Fuser>(obs, simulator, state)));
+    }
+  };
+
+  auto run = [&](const typename QTSimulator::Parameter& param, bool parallel,
+                 std::vector<double>& weights, Results& results) {
+    weights.assign(num_reps, 0);
+    results.assign(num_reps, {});
+
+    if (parallel) {
+      EXPECT_TRUE(QTSimulator::RunBatchParallel(
+          param, ncircuit, 0, num_reps, 2, measure, simulator, observables,
+          weights, results));
+    } else {
+      EXPECT_TRUE(QTSimulator::RunBatch(
+          param, ncircuit, 0, num_reps, state_space, simulator, measure,
+          simulator, observables, weights, results));
+    }
+  };
+
+  // The maximum error of the self-normalized weighted means.
+  auto error = [&](const std::vector<double>& weights,
+                   const Results& results) {
+    double max_error = 0;
+
+    for (std::size_t k = 0; k < observables.size(); ++k) {
+      double sum = 0;
+      double sum_weights = 0;
+      for (unsigned r = 0; r < num_reps; ++r) {
+        sum += weights[r] * results[r][k];
+        sum_weights += weights[r];
+      }
+
+      max_error = std::max(
+          max_error, std::abs(sum / sum_weights - expected_results[k]));
+    }
+
+    return max_error;
+  };
+
+  typename QTSimulator::Parameter param;
+
+  std::vector<double> weights0;
+  Results results0;
+  run(param, false, weights0, results0);
+
+  for (auto w : weights0) {
+    EXPECT_EQ(w, 1);
+  }
+
+  double error0 = error(weights0, results0);
+
+  param.error_bias = 20;
+
+  std::vector<double> weights1;
+  Results results1;
+  run(param, false, weights1, results1);
+
+  double error1 = error(weights1, results1);
+
+  param.error_bias = 1;
+  param.num_error_strata = 4;
+
+  std::vector<double> weights2;
+  Results results2;
+  run(param, false, weights2, results2);
+
+  double sum_weights = 0;
+  for (auto w : weights2) {
+    sum_weights += w;
+  }
+
+  // The number of repetitions is a multiple of the number of strata.
+  EXPECT_NEAR(sum_weights / num_reps, 1, 1e-9);
+
+  double error2 = error(weights2, results2);
+
+  EXPECT_LT(error1, 0.2 * error0);
+  EXPECT_LT(error2, 0.2 * error0);
+
+  // Checkpoints and parallel repetitions give the same trajectories.
+  for (double error_bias : {20, 1}) {
+    param.error_bias = error_bias;
+    param.num_error_strata = error_bias == 1 ? 4 : 0;
+
+    const auto& weights = error_bias == 1 ? weights2 : weights1;
+    const auto& results = error_bias == 1 ? results2 : results1;
+
+    for (bool parallel : {false, true}) {
+      param.max_checkpoints = parallel ? 0 : 3;
+
+      std::vector<double> weights3;
+      Results results3;
+      run(param, parallel, weights3, results3);
+
+      for (unsigned r = 0; r < num_reps; ++r) {
+        EXPECT_NEAR(weights[r], weights3[r], 1e-9 * weights[r]);
+        ASSERT_EQ(results3[r].size(), observables.size());
+
+        for (std::size_t k = 0; k < observables.size(); ++k) {
+          EXPECT_NEAR(results[r][k], results3[r][k], 1e-6);
+        }
+      }
+    }
+  }
+}
+
+template <typename Factory>
+void TestTrajectoryEstimator(const Factory& factory) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Factory::StateSpace;
+  using State = typename StateSpace::State;
+  using fp_type = typename StateSpace::fp_type;
+  using Gate = Cirq::GateCirq<fp_type>;
+  using Fuser = MultiQubitGateFuser<IO, Gate>;
+  using QTSimulator = QuantumTrajectorySimulator<IO, Gate, MultiQubitGateFuser,
+                                                 Simulator>;
+
+  // Weighted means and standard errors.
+  {
+    std::vector<std::vector<std::complex<double>>> values = {
+      {{0.5, 0.1}, 1.0}, {{-0.2, 0.3}, 2.0}, {{0.7, -0.4}, 0.0},
+      {{0.1, 0.0}, 1.5}, {{0.3, 0.2}, 2.5},
+    };
+    std::vector<double> weights = {1.0, 0.5, 2.0, 0.0, 1.5};
+
+    for (bool weighted : {false, true}) {
+      TrajectoryEstimator::Parameter param;
+      TrajectoryEstimator estimator(2, param);
+
+      std::size_t n = values.size();
+
+      for (std::size_t r = 0; r < n; ++r) {
+        estimator.Add(values[r], weighted ? weights[r] : 1);
+      }
+
+      EXPECT_EQ(estimator.NumRepetitions(), n);
+
+      double sum_weights = 0;
+      double sum_weights2 = 0;
+      for (std::size_t r = 0; r < n; ++r) {
+        double w = weighted ? weights[r] : 1;
+        sum_weights += w;
+        sum_weights2 += w * w;
+      }
+
+      EXPECT_NEAR(estimator.EffectiveSampleSize(),
+                  sum_weights * sum_weights / sum_weights2, 1e-12);
+
+      for (unsigned i = 0; i < 2; ++i) {
+        std::complex<double> mean = 0;
+        for (std::size_t r = 0; r < n; ++r) {
+          mean += (weighted ? weights[r] : 1) * values[r][i];
+        }
+        mean /= sum_weights;
+
+        double s = 0;
+        for (std::size_t r = 0; r < n; ++r) {
+          double w = weighted ? weights[r] : 1;
+          s += w * w * std::norm(values[r][i] - mean);
+        }
+
+        // The sample standard deviation over sqrt(n) without weights.
+        double std_error =
+            std::sqrt(s / (sum_weights * sum_weights) * n / (n - 1));
+
+        EXPECT_NEAR(std::real(estimator.Mean(i)), std::real(mean), 1e-12);
+        EXPECT_NEAR(std::imag(estimator.Mean(i)), std::imag(mean), 1e-12);
+        EXPECT_NEAR(estimator.StdError(i), std_error, 1e-12);
+      }
+    }
+  }
+
+  // Stopping on the target standard error.
+
+  unsigned max_reps = 20000;
+
+  auto ncircuit = GenerateNoisyCircuit<Gate>(0.05, AddBitFlipNoise1<Gate>,
+                                             AddAmplDumpNoise2<Gate>, false);
+
+  using Z = qsim::Cirq::Z<fp_type>;
+
+  std::vector<std::vector<qsim::OpString<Gate>>> observables = {
+    {{{1.0, 0.0}, {Z::Create(0, 0)}}},
+    {{{1.0, 0.0}, {Z::Create(0, 0), Z::Create(0, 1)}}},
+  };
+
+  Simulator simulator = factory.CreateSimulator();
+  StateSpace state_space = factory.CreateStateSpace();
+
+  auto measure = [&simulator, &observables](
+      uint64_t r, const State& state, const typename QTSimulator::Stat& stat,
+      TrajectoryEstimator& estimator,
+      std::vector<std::vector<std::complex<double>>>& results) {
+    std::vector<std::complex<double>> evs;
+    for (const auto& obs : observables) {
+      evs.push_back(ExpectationValue<IO, Fuser>(obs, simulator, state));
+    }
+
+    estimator.Add(evs, stat.weight);
+    results.push_back(std::move(evs));
+  };
+
+  typename QTSimulator::Parameter param;
+
+  for (uint64_t block_size : {1, 3}) {
+    TrajectoryEstimator::Parameter eparam;
+    eparam.target_std_error = 0.01;
+    eparam.max_repetitions = max_reps;
+    eparam.block_size = block_size;
+
+    TrajectoryEstimator estimator(observables.size(), eparam);
+    std::vector<std::vector<std::complex<double>>> results;
+
+    auto stop = [&estimator](uint64_t r) { return estimator.Done(); };
+
+    EXPECT_TRUE(QTSimulator::RunBatchUntil(param, ncircuit, 0, stop,
+                                           state_space, simulator, measure,
+                                           estimator, results));
+
+    uint64_t num_reps = estimator.NumRepetitions();
+
+    EXPECT_EQ(results.size(), num_reps);
+    EXPECT_GT(num_reps, eparam.min_repetitions);
+    EXPECT_LT(num_reps, max_reps);
+    EXPECT_EQ(num_reps % block_size, 0);
+    EXPECT_LE(estimator.MaxStdError(), eparam.target_std_error);
+
+    // The standard error is above the target one repetition block earlier.
+    TrajectoryEstimator estimator2(observables.size(), eparam);
+    for (uint64_t r = 0; r + block_size < num_reps; ++r) {
+      estimator2.Add(results[r]);
+    }
+
+    EXPECT_GT(estimator2.MaxStdError(), eparam.target_std_error);
+
+    for (unsigned i = 0; i < observables.size(); ++i) {
+      std::complex<double> mean = 0;
+      for (uint64_t r = 0; r < num_reps; ++r) {
+        mean += results[r][i];
+      }
+      mean /= double(num_reps);
+
+      EXPECT_NEAR(std::real(estimator.Mean(i)), std::real(mean), 1e-9);
+      EXPECT_NEAR(std::imag(estimator.Mean(i)), std::imag(mean), 1e-9);
+    }
+  }
+
+  // Stopping on the repetition budget.
+  {
+    TrajectoryEstimator::Parameter eparam;
+    eparam.target_std_error = 1e-6;
+    eparam.max_repetitions = 50;
+
+    TrajectoryEstimator estimator(observables.size(), eparam);
+    std::vector<std::vector<std::complex<double>>> results;
+
+    auto stop = [&estimator](uint64_t r) { return estimator.Done(); };
+
+    EXPECT_TRUE(QTSimulator::RunBatchUntil(param, ncircuit, 0, stop,
+                                           state_space, simulator, measure,
+                                           estimator, results));
+
+    EXPECT_EQ(estimator.NumRepetitions(), eparam.max_repetitions);
+    EXPECT_GT(estimator.MaxStdError(), eparam.target_std_error);
+  }
+}
+
+template <typename Factory>
+void TestPrimaryTrajectoryCache(const Factory& factory) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Factory::StateSpace;
+  using State = typename StateSpace::State;
+  using fp_type = typename StateSpace::fp_type;
+  using Gate = Cirq::GateCirq<fp_type>;
+  using Fuser = MultiQubitGateFuser<IO, Gate>;
+  using QTSimulator = QuantumTrajectorySimulator<IO, Gate, MultiQubitGateFuser,
+                                                 Simulator>;
+
+  unsigned num_qubits = 2;
+  unsigned num_reps = 25000;
+
+  auto ncircuit = GenerateNoisyCircuit<Gate>(0.02, AddAmplDumpNoise1<Gate>,
+                                             AddAmplDumpNoise2<Gate>, false);
+
+  using rx = qsim::Cirq::rx<fp_type>;
+
+  std::vector<std::vector<qsim::OpString<Gate>>> observables;
+  observables.reserve(num_qubits);
+
+  for (unsigned q = 0; q < num_qubits; ++q) {
+    observables.push_back({{{1.0, 0.0}, {rx::Create(0, q, 1.7 + 0.6 * q)}}});
+  }
+
+  using Results = std::vector<std::complex<double>>;
+
+  Simulator simulator = factory.CreateSimulator();
+  StateSpace state_space = factory.CreateStateSpace();
+
+  PrimaryTrajectoryCache<Results> cache;
+  Results results(observables.size(), 0);
+
+  auto measure = [&](uint64_t r, const State& state,
+                     const typename QTSimulator::Stat& stat) {
+    auto evs = cache.Get(stat.primary, [&]() {
+      Results evs;
+      for (const auto& obs : observables) {
+        evs.push_back(ExpectationValue<IO, Fuser>(obs, simulator, state));
+      }
+      return evs;
+    });
+
+    for (std::size_t k = 0; k < evs.size(); ++k) {
+      results[k] += evs[k] / double(num_reps);
+    }
+  };
+
+  typename QTSimulator::Parameter param;
+  param.apply_last_deferred_ops = false;
+
+  EXPECT_TRUE(QTSimulator::RunBatch(param, ncircuit, 0, num_reps, state_space,
+                                    simulator, measure));
+
+  EXPECT_TRUE(cache.HasResult());
+  EXPECT_EQ(cache.NumRepetitions(), num_reps);
+  EXPECT_GT(cache.NumPrimary(), num_reps / 2);
+  EXPECT_EQ(cache.NumHits(), cache.NumPrimary() - 1);
+  EXPECT_NEAR(cache.HitRate(), double(cache.NumHits()) / num_reps, 1e-12);
+
+  auto expected_results = ExpValsRunOnceRepeatedly(factory, ncircuit, false);
+
+  for (std::size_t k = 0; k < results.size(); ++k) {
+    EXPECT_NEAR(std::real(results[k]), std::real(expected_results[k]), 1e-6);
+    EXPECT_NEAR(std::imag(results[k]), std::imag(expected_results[k]), 1e-6);
+  }
+}
+
 }  // namespace qsim
 
 #endif  // QTRAJECTORY_TESTFIXTURE_H_
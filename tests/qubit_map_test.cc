@@ -0,0 +1,359 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "../lib/gate_appl.h"
+#include "../lib/gates_cirq.h"
+#include "../lib/gates_qsim.h"
+#include "../lib/qubit_map.h"
+#include "../lib/seqfor.h"
+#include "../lib/simulator_basic.h"
+
+namespace qsim {
+
+using Simulator = SimulatorBasic<SequentialFor, float>;
+using BasicStateSpace = Simulator::StateSpace;
+using BasicState = BasicStateSpace::State;
+
+namespace {
+
+void FillRandomState(unsigned seed, const BasicStateSpace& state_space,
+                     BasicState& state) {
+  std::mt19937 rgen(seed);
+  std::uniform_real_distribution<float> distr(-1, 1);
+
+  uint64_t size = uint64_t{1} << state.num_qubits();
+
+  for (uint64_t i = 0; i < size; ++i) {
+    state_space.SetAmpl(state, i, distr(rgen), distr(rgen));
+  }
+}
+
+// Returns the physical index of the amplitude with the given logical index.
+uint64_t PhysicalIndex(const QubitMap& map, uint64_t i) {
+  uint64_t j = 0;
+
+  for (unsigned q = 0; q < map.size(); ++q) {
+    j |= ((i >> q) & 1) << map[q];
+  }
+
+  return j;
+}
+
+void PermuteState(const QubitMap& map, const BasicStateSpace& state_space,
+                  const BasicState& src, BasicState& dest) {
+  uint64_t size = uint64_t{1} << src.num_qubits();
+
+  for (uint64_t i = 0; i < size; ++i) {
+    state_space.SetAmpl(dest, PhysicalIndex(map, i),
+                        state_space.GetAmpl(src, i));
+  }
+}
+
+}  // namespace
+
+TEST(QubitMapTest, IsSwapGate) {
+  EXPECT_TRUE(IsSwapGate(GateSwap<float>::Create(0, 1, 3)));
+  EXPECT_TRUE(IsSwapGate(Cirq::SWAP<float>::Create(0, 2, 0)));
+  EXPECT_TRUE(IsSwapGate(Cirq::SwapPowGate<float>::Create(0, 0, 1, 1)));
+
+  EXPECT_FALSE(IsSwapGate(Cirq::SwapPowGate<float>::Create(0, 0, 1, 0.5)));
+  EXPECT_FALSE(IsSwapGate(Cirq::SwapPowGate<float>::Create(0, 0, 1, 1, 0.5)));
+  EXPECT_FALSE(IsSwapGate(Cirq::ISWAP<float>::Create(0, 0, 1)));
+  EXPECT_FALSE(IsSwapGate(GateCZ<float>::Create(0, 0, 1)));
+  EXPECT_FALSE(IsSwapGate(GateSwap<float>::Create(0, 1, 3).ControlledBy({0})));
+}
+
+TEST(QubitMapTest, RelabelGate) {
+  unsigned num_qubits = 5;
+  QubitMap map = {3, 0, 4, 1, 2};
+
+  std::vector<Cirq::GateCirq<float>> gates = {
+    Cirq::FSimGate<float>::Create(0, 0, 2, 0.3, 0.7),
+    Cirq::MatrixGate2<float>::Create(1, 4, 1, {0.5, 0.1, 0.2, 0.3,
+                                               0.1, 0.4, 0.3, 0.2,
+                                               0.2, 0.7, 0.6, 0.1,
+                                               0.6, 0.3, 0.1, 0.2,
+                                               0.8, 0.5, 0.9, 0.6,
+                                               0.7, 0.2, 0.5, 0.1,
+                                               0.3, 0.9, 0.3, 0.8,
+                                               0.4, 0.6, 0.8, 0.7}),
+    Cirq::rx<float>::Create(2, 3, 0.4).ControlledBy({4, 0}, {1, 0}),
+    Cirq::CCZ<float>::Create(3, 2, 1, 0),
+    Cirq::PauliRotation<float>::Create(4, {0, 2, 3, 4}, {1, 2, 3, 2}, 0.6),
+  };
+
+  BasicStateSpace state_space(1);
+  Simulator simulator(1);
+
+  BasicState state1 = state_space.Create(num_qubits);
+  BasicState state2 = state_space.Create(num_qubits);
+  BasicState state3 = state_space.Create(num_qubits);
+
+  FillRandomState(1, state_space, state1);
+  PermuteState(map, state_space, state1, state2);
+
+  for (const auto& gate : gates) {
+    auto rgate = gate;
+    RelabelGate(map, rgate);
+
+    for (std::size_t i = 0; i < gate.qubits.size(); ++i) {
+      EXPECT_LT(rgate.qubits[i], num_qubits);
+      if (i > 0) {
+        EXPECT_LT(rgate.qubits[i - 1], rgate.qubits[i]);
+      }
+    }
+
+    ApplyGate(simulator, gate, state1);
+    ApplyGate(simulator, rgate, state2);
+  }
+
+  PermuteState(map, state_space, state1, state3);
+
+  uint64_t size = uint64_t{1} << num_qubits;
+
+  for (uint64_t i = 0; i < size; ++i) {
+    auto a2 = state_space.GetAmpl(state2, i);
+    auto a3 = state_space.GetAmpl(state3, i);
+    EXPECT_NEAR(std::real(a2), std::real(a3), 1e-6);
+    EXPECT_NEAR(std::imag(a2), std::imag(a3), 1e-6);
+  }
+}
+
+TEST(QubitMapTest, ResolveQubitMap) {
+  unsigned num_qubits = 6;
+  std::vector<QubitMap> maps = {
+    {0, 1, 2, 3, 4, 5},
+    {1, 0, 2, 3, 4, 5},
+    {5, 4, 3, 2, 1, 0},
+    {2, 5, 0, 4, 1, 3},
+    {1, 2, 3, 4, 5, 0},
+  };
+
+  BasicStateSpace state_space(1);
+  Simulator simulator(1);
+
+  BasicState state1 = state_space.Create(num_qubits);
+  BasicState state2 = state_space.Create(num_qubits);
+
+  FillRandomState(2, state_space, state1);
+
+  uint64_t size = uint64_t{1} << num_qubits;
+
+  for (const auto& map : maps) {
+    PermuteState(map, state_space, state1, state2);
+    ResolveQubitMap(simulator, map, state2);
+
+    for (uint64_t i = 0; i < size; ++i) {
+      auto a1 = state_space.GetAmpl(state1, i);
+      auto a2 = state_space.GetAmpl(state2, i);
+      EXPECT_FLOAT_EQ(std::real(a1), std::real(a2));
+      EXPECT_FLOAT_EQ(std::imag(a1), std::imag(a2));
+    }
+  }
+}
+
+TEST(QubitMapTest, PermuteQubits) {
+  unsigned num_qubits = 9;
+  std::vector<QubitMap> perms = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8},
+    {0, 1, 2, 3, 4, 5, 6, 8, 7},
+    {6, 1, 2, 0, 4, 5, 3, 7, 8},
+    {7, 8, 2, 3, 4, 5, 6, 0, 1},
+    {1, 2, 0, 3, 8, 5, 6, 7, 4},
+    {8, 7, 6, 5, 4, 3, 2, 1, 0},
+    {1, 2, 3, 4, 5, 6, 7, 8, 0},
+  };
+
+  BasicStateSpace state_space(1);
+  Simulator simulator(1);
+
+  BasicState state1 = state_space.Create(num_qubits);
+  BasicState state2 = state_space.Create(num_qubits);
+  BasicState state3 = state_space.Create(num_qubits);
+
+  FillRandomState(3, state_space, state1);
+
+  uint64_t size = uint64_t{1} << num_qubits;
+
+  for (const auto& perm : perms) {
+    state_space.Copy(state1, state2);
+    PermuteQubits(simulator, perm, state2);
+
+    // Physical qubit p moves to perm[p].
+    PermuteState(perm, state_space, state1, state3);
+
+    for (uint64_t i = 0; i < size; ++i) {
+      auto a2 = state_space.GetAmpl(state2, i);
+      auto a3 = state_space.GetAmpl(state3, i);
+      EXPECT_FLOAT_EQ(std::real(a2), std::real(a3));
+      EXPECT_FLOAT_EQ(std::imag(a2), std::imag(a3));
+    }
+  }
+}
+
+TEST(QubitMapTest, MeasureRelabeled) {
+  unsigned num_qubits = 4;
+  QubitMap map = {2, 3, 1, 0};
+
+  BasicStateSpace state_space(1);
+  std::mt19937 rgen(1);
+
+  BasicState state = state_space.Create(num_qubits);
+
+  // Logical basis state |0101> (qubit 0 is the least significant bit).
+  state_space.SetAllZeros(state);
+  state_space.SetAmpl(state, PhysicalIndex(map, 5), 1, 0);
+
+  auto result = MeasureRelabeled(state_space, map, {2, 0, 1}, rgen, state);
+
+  EXPECT_TRUE(result.valid);
+  EXPECT_EQ(result.mask, 7);
+  EXPECT_EQ(result.bits, 5);
+  ASSERT_EQ(result.bitstring.size(), 3);
+  EXPECT_EQ(result.bitstring[0], 1);
+  EXPECT_EQ(result.bitstring[1], 1);
+  EXPECT_EQ(result.bitstring[2], 0);
+}
+
+TEST(QubitMapTest, RelabelSwapGates) {
+  unsigned num_qubits = 3;
+
+  std::vector<GateQSim<float>> gates = {
+    GateHd<float>::Create(0, 0),
+    GateSwap<float>::Create(1, 0, 1),
+    GateT<float>::Create(2, 1),
+    GateSwap<float>::Create(3, 1, 2),
+    gate::Measurement<GateQSim<float>>::Create(4, {2}),
+    GateCZ<float>::Create(5, 0, 2),
+    GateSwap<float>::Create(6, 0, 2),
+    GateT<float>::Create(7, 2),
+  };
+
+  auto rcircuit = RelabelSwapGates(num_qubits, gates, {5});
+
+  ASSERT_EQ(rcircuit.gates.size(), 5);
+
+  EXPECT_EQ(rcircuit.gates[1].kind, kGateT);
+  ASSERT_EQ(rcircuit.gates[1].qubits.size(), 1);
+  EXPECT_EQ(rcircuit.gates[1].qubits[0], 0);
+
+  // Measurement gates act on logical qubits.
+  EXPECT_EQ(rcircuit.gates[2].kind, gate::kMeasurement);
+  ASSERT_EQ(rcircuit.gates[2].qubits.size(), 1);
+  EXPECT_EQ(rcircuit.gates[2].qubits[0], 2);
+
+  ASSERT_EQ(rcircuit.mea_maps.size(), 1);
+  EXPECT_EQ(rcircuit.mea_maps[0][2], 0);
+
+  // The map is resolved after time 5, so the CZ gate is still relabeled.
+  EXPECT_EQ(rcircuit.gates[3].kind, kGateCZ);
+  EXPECT_EQ(rcircuit.gates[3].qubits, std::vector<unsigned>({0, 1}));
+
+  EXPECT_EQ(rcircuit.gates[4].kind, kGateT);
+  ASSERT_EQ(rcircuit.gates[4].qubits.size(), 1);
+  EXPECT_EQ(rcircuit.gates[4].qubits[0], 0);
+
+  ASSERT_EQ(rcircuit.maps.size(), 2);
+  EXPECT_EQ(rcircuit.maps[0], QubitMap({1, 2, 0}));
+  EXPECT_EQ(rcircuit.maps[1], QubitMap({2, 1, 0}));
+}
+
+TEST(QubitMapTest, ReorderQubits) {
+  unsigned num_qubits = 6;
+
+  std::vector<GateQSim<float>> gates = {
+    GateHd<float>::Create(0, 0),
+    GateHd<float>::Create(0, 1),
+    GateHd<float>::Create(0, 4),
+    GateHd<float>::Create(0, 5),
+    GateCZ<float>::Create(1, 4, 5),
+    GateT<float>::Create(2, 5),
+    GateCZ<float>::Create(3, 3, 5),
+    GateT<float>::Create(4, 1),
+    GateCZ<float>::Create(5, 0, 1),
+    GateT<float>::Create(6, 0),
+    GateT<float>::Create(6, 1),
+  };
+
+  auto rcircuit = RelabelCircuit(num_qubits, gates, {}, false, 2, 4);
+
+  ASSERT_EQ(rcircuit.gates.size(), gates.size());
+
+  // Qubit 5 replaces qubit 0 after the first four gates (qubit 4 is not
+  // used more often than qubit 1). Then qubit 0 is moved back after the next
+  // four gates.
+  ASSERT_EQ(rcircuit.reorder_times.size(), 2);
+  EXPECT_EQ(rcircuit.reorder_times[0], 0);
+  EXPECT_EQ(rcircuit.reorder_perms[0], QubitMap({5, 1, 2, 3, 4, 0}));
+  EXPECT_EQ(rcircuit.reorder_times[1], 4);
+  EXPECT_EQ(rcircuit.reorder_perms[1], QubitMap({5, 1, 2, 3, 4, 0}));
+
+  EXPECT_EQ(rcircuit.gates[4].qubits, std::vector<unsigned>({0, 4}));
+  EXPECT_EQ(rcircuit.gates[5].qubits, std::vector<unsigned>({0}));
+  EXPECT_EQ(rcircuit.gates[6].qubits, std::vector<unsigned>({0, 3}));
+  EXPECT_EQ(rcircuit.gates[8].qubits, std::vector<unsigned>({0, 1}));
+
+  ASSERT_EQ(rcircuit.maps.size(), 1);
+  EXPECT_EQ(rcircuit.maps[0], IdentityQubitMap(num_qubits));
+
+  // Reordering the qubits of a state and applying the relabeled gates
+  // is equivalent to applying the original gates.
+  BasicStateSpace state_space(1);
+  Simulator simulator(1);
+
+  BasicState state1 = state_space.Create(num_qubits);
+  BasicState state2 = state_space.Create(num_qubits);
+
+  FillRandomState(4, state_space, state1);
+  state_space.Copy(state1, state2);
+
+  std::size_t k = 0;
+
+  for (std::size_t i = 0; i < gates.size(); ++i) {
+    ApplyGate(simulator, gates[i], state1);
+    ApplyGate(simulator, rcircuit.gates[i], state2);
+
+    if (k < rcircuit.reorder_times.size()
+        && (i + 1 == gates.size()
+            || rcircuit.reorder_times[k] < gates[i + 1].time)) {
+      PermuteQubits(simulator, rcircuit.reorder_perms[k++], state2);
+    }
+  }
+
+  ResolveQubitMap(simulator, rcircuit.maps.back(), state2);
+
+  uint64_t size = uint64_t{1} << num_qubits;
+
+  for (uint64_t i = 0; i < size; ++i) {
+    auto a1 = state_space.GetAmpl(state1, i);
+    auto a2 = state_space.GetAmpl(state2, i);
+    EXPECT_NEAR(std::real(a1), std::real(a2), 1e-6);
+    EXPECT_NEAR(std::imag(a1), std::imag(a2), 1e-6);
+  }
+}
+
+}  // namespace qsim
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -12,10 +12,12 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <cmath>
 #include <complex>
 #include <cstdint>
 #include <sstream>
+#include <vector>
 
 #include "gates_cirq_testfixture.h"
 
@@ -24,8 +26,10 @@
 #include "../lib/circuit_qsim_parser.h"
 #include "../lib/formux.h"
 #include "../lib/fuser_basic.h"
+#include "../lib/fuser_mqubit.h"
 #include "../lib/gates_qsim.h"
 #include "../lib/io.h"
+#include "../lib/poolfor.h"
 #include "../lib/run_qsim.h"
 #include "../lib/simmux.h"
 
@@ -77,6 +81,20 @@ struct Factory {
   }
 };
 
+// Splits loops of any size over three threads.
+struct FactoryThreads {
+  using Simulator = qsim::Simulator<PoolForT<1>>;
+  using StateSpace = Simulator::StateSpace;
+
+  static StateSpace CreateStateSpace() {
+    return StateSpace(3);
+  }
+
+  static Simulator CreateSimulator() {
+    return Simulator(3);
+  }
+};
+
 TEST(RunQSimTest, QSimRunner1) {
   std::stringstream ss(circuit_string);
   Circuit<GateQSim<float>> circuit;
@@ -246,6 +264,493 @@ TEST(RunQSimTest, CirqGates) {
   }
 }
 
+Circuit<GateQSim<float>> CreateTileTestCircuit() {
+  unsigned num_qubits = 10;
+
+  Circuit<GateQSim<float>> circuit{num_qubits, {}};
+
+  for (unsigned q = 0; q < num_qubits; ++q) {
+    circuit.gates.push_back(GateHd<float>::Create(0, q));
+  }
+
+  for (unsigned l = 0; l < 12; ++l) {
+    unsigned time = 2 * l + 1;
+    // Every fourth layer entangles the high qubits with the low qubits.
+    unsigned n = l % 4 == 3 ? num_qubits : 7;
+
+    for (unsigned q = l % 2; q + 1 < n; q += 2) {
+      circuit.gates.push_back(GateCZ<float>::Create(time, q, q + 1));
+    }
+
+    for (unsigned q = 0; q < n; ++q) {
+      float phi = 0.1f * (q + 1) + 0.37f * l;
+      circuit.gates.push_back(GateRX<float>::Create(time + 1, q, phi));
+    }
+  }
+
+  return circuit;
+}
+
+TEST(RunQSimTest, QSimRunnerTiles) {
+  auto circuit = CreateTileTestCircuit();
+
+  using Simulator = Factory::Simulator;
+  using StateSpace = Simulator::StateSpace;
+  using State = StateSpace::State;
+  using Runner = QSimRunner<IO, BasicGateFuser<IO, GateQSim<float>>, Factory>;
+
+  StateSpace state_space = Factory::CreateStateSpace();
+  State state1 = state_space.Create(circuit.num_qubits);
+  State state2 = state_space.Create(circuit.num_qubits);
+
+  EXPECT_FALSE(state_space.IsNull(state1));
+  EXPECT_FALSE(state_space.IsNull(state2));
+
+  state_space.SetStateZero(state1);
+  state_space.SetStateZero(state2);
+
+  Runner::Parameter param;
+  param.seed = 1;
+  param.verbosity = 0;
+
+  EXPECT_TRUE(Runner::Run(param, Factory(), circuit, state1));
+
+  param.tile_qubits = 7;
+
+  uint64_t size = uint64_t{1} << circuit.num_qubits;
+
+  EXPECT_TRUE(Runner::Run(param, Factory(), circuit, state2));
+
+  for (uint64_t i = 0; i < size; ++i) {
+    auto ampl1 = state_space.GetAmpl(state1, i);
+    auto ampl2 = state_space.GetAmpl(state2, i);
+    EXPECT_NEAR(std::real(ampl1), std::real(ampl2), 1e-6);
+    EXPECT_NEAR(std::imag(ampl1), std::imag(ampl2), 1e-6);
+  }
+
+  // Tiles are distributed over threads.
+  using Runner3 = QSimRunner<IO, BasicGateFuser<IO, GateQSim<float>>,
+                             FactoryThreads>;
+  using StateSpace3 = FactoryThreads::StateSpace;
+
+  StateSpace3 state_space3 = FactoryThreads::CreateStateSpace();
+  auto state3 = state_space3.Create(circuit.num_qubits);
+
+  EXPECT_FALSE(state_space3.IsNull(state3));
+
+  state_space3.SetStateZero(state3);
+
+  Runner3::Parameter param3;
+  param3.seed = 1;
+  param3.verbosity = 0;
+  param3.tile_qubits = 7;
+
+  EXPECT_TRUE(Runner3::Run(param3, FactoryThreads(), circuit, state3));
+
+  for (uint64_t i = 0; i < size; ++i) {
+    auto ampl1 = state_space.GetAmpl(state1, i);
+    auto ampl3 = state_space3.GetAmpl(state3, i);
+    EXPECT_NEAR(std::real(ampl1), std::real(ampl3), 1e-6);
+    EXPECT_NEAR(std::imag(ampl1), std::imag(ampl3), 1e-6);
+  }
+
+  // Measure at intermediate times; tiles should not cross them.
+  std::vector<unsigned> times = {4, 9, 14, 24};
+  std::vector<std::vector<std::complex<float>>> results1(times.size());
+  std::vector<std::vector<std::complex<float>>> results2(times.size());
+
+  auto measure = [&size](unsigned k, const StateSpace& state_space,
+                         const State& state,
+                         std::vector<std::vector<std::complex<float>>>& r) {
+    r[k].reserve(size);
+    for (uint64_t i = 0; i < size; ++i) {
+      r[k].push_back(state_space.GetAmpl(state, i));
+    }
+  };
+
+  auto measure1 = [&measure, &results1](
+      unsigned k, const StateSpace& state_space, const State& state) {
+    measure(k, state_space, state, results1);
+  };
+
+  auto measure2 = [&measure, &results2](
+      unsigned k, const StateSpace& state_space, const State& state) {
+    measure(k, state_space, state, results2);
+  };
+
+  param.tile_qubits = 0;
+  EXPECT_TRUE(Runner::Run(param, Factory(), times, circuit, measure1));
+
+  param.tile_qubits = 7;
+  EXPECT_TRUE(Runner::Run(param, Factory(), times, circuit, measure2));
+
+  for (std::size_t k = 0; k < times.size(); ++k) {
+    EXPECT_EQ(results1[k].size(), size);
+    EXPECT_EQ(results2[k].size(), size);
+
+    for (uint64_t i = 0; i < std::min(size, results2[k].size()); ++i) {
+      EXPECT_NEAR(std::real(results1[k][i]), std::real(results2[k][i]), 1e-6);
+      EXPECT_NEAR(std::imag(results1[k][i]), std::imag(results2[k][i]), 1e-6);
+    }
+  }
+
+  for (uint64_t i = 0; i < size; ++i) {
+    auto ampl = state_space.GetAmpl(state1, i);
+    EXPECT_NEAR(std::real(ampl), std::real(results2.back()[i]), 1e-6);
+    EXPECT_NEAR(std::imag(ampl), std::imag(results2.back()[i]), 1e-6);
+  }
+}
+
+// A simulator that can apply gates on up to six qubits only.
+struct SimulatorMax6 {
+  using Simulator = Factory::Simulator;
+  using StateSpace = Simulator::StateSpace;
+  using State = StateSpace::State;
+  using fp_type = Simulator::fp_type;
+
+  static constexpr unsigned kMaxGateQubits = 6;
+
+  explicit SimulatorMax6(unsigned& max_gate_qubits)
+      : simulator(1), max_gate_qubits(max_gate_qubits) {}
+
+  void ApplyGate(const std::vector<unsigned>& qs,
+                 const fp_type* matrix, State& state) const {
+    EXPECT_LE(qs.size(), 6);
+    max_gate_qubits = std::max(max_gate_qubits, unsigned(qs.size()));
+    simulator.ApplyGate(qs, matrix, state);
+  }
+
+  void ApplyControlledGate(const std::vector<unsigned>& qs,
+                           const std::vector<unsigned>& cqs, uint64_t cvals,
+                           const fp_type* matrix, State& state) const {
+    EXPECT_LE(qs.size(), 6);
+    max_gate_qubits = std::max(max_gate_qubits, unsigned(qs.size()));
+    simulator.ApplyControlledGate(qs, cqs, cvals, matrix, state);
+  }
+
+  Simulator simulator;
+  unsigned& max_gate_qubits;
+};
+
+struct FactoryMax6 {
+  using Simulator = SimulatorMax6;
+  using StateSpace = Simulator::StateSpace;
+
+  StateSpace CreateStateSpace() const {
+    return StateSpace(1);
+  }
+
+  Simulator CreateSimulator() const {
+    return Simulator(max_gate_qubits);
+  }
+
+  unsigned& max_gate_qubits;
+};
+
+TEST(RunQSimTest, QSimRunnerLimitFusedSize) {
+  auto circuit = CreateTileTestCircuit();
+
+  using Fuser = MultiQubitGateFuser<IO, GateQSim<float>>;
+  using Runner1 = QSimRunner<IO, BasicGateFuser<IO, GateQSim<float>>, Factory>;
+  using Runner2 = QSimRunner<IO, Fuser, FactoryMax6>;
+
+  using StateSpace = Factory::StateSpace;
+  using State = StateSpace::State;
+
+  StateSpace state_space = Factory::CreateStateSpace();
+  State state1 = state_space.Create(circuit.num_qubits);
+  State state2 = state_space.Create(circuit.num_qubits);
+
+  EXPECT_FALSE(state_space.IsNull(state1));
+  EXPECT_FALSE(state_space.IsNull(state2));
+
+  state_space.SetStateZero(state1);
+  state_space.SetStateZero(state2);
+
+  Runner1::Parameter param1;
+  param1.seed = 1;
+  param1.verbosity = 0;
+
+  EXPECT_TRUE(Runner1::Run(param1, Factory(), circuit, state1));
+
+  // Gates that would be fused into seven- and eight-qubit gates should
+  // be fused into gates of at most six qubits.
+  Runner2::Parameter param2;
+  param2.seed = 1;
+  param2.verbosity = 0;
+  param2.max_fused_size = 8;
+
+  unsigned max_gate_qubits = 0;
+  FactoryMax6 factory{max_gate_qubits};
+
+  EXPECT_TRUE(Runner2::Run(param2, factory, circuit, state2));
+  EXPECT_EQ(max_gate_qubits, 6);
+
+  uint64_t size = uint64_t{1} << circuit.num_qubits;
+
+  for (uint64_t i = 0; i < size; ++i) {
+    auto ampl1 = state_space.GetAmpl(state1, i);
+    auto ampl2 = state_space.GetAmpl(state2, i);
+    EXPECT_NEAR(std::real(ampl1), std::real(ampl2), 1e-5);
+    EXPECT_NEAR(std::imag(ampl1), std::imag(ampl2), 1e-5);
+  }
+}
+
+Circuit<GateQSim<float>> CreateSwapTestCircuit() {
+  unsigned num_qubits = 8;
+
+  Circuit<GateQSim<float>> circuit{num_qubits, {}};
+
+  for (unsigned q = 0; q < 6; ++q) {
+    circuit.gates.push_back(GateHd<float>::Create(0, q));
+  }
+
+  // Qubits 6 and 7 are swapped in before measurements to make measurement
+  // results deterministic.
+  circuit.gates.push_back(GateX<float>::Create(0, 6));
+  circuit.gates.push_back(GateX<float>::Create(0, 7));
+
+  for (unsigned l = 0; l < 8; ++l) {
+    unsigned time = 4 * l + 1;
+
+    for (unsigned q = l % 2; q + 1 < 6; q += 2) {
+      circuit.gates.push_back(GateCZ<float>::Create(time, q, q + 1));
+    }
+
+    for (unsigned q = 0; q < 6; ++q) {
+      float phi = 0.1f * (q + 1) + 0.37f * l;
+      circuit.gates.push_back(GateRX<float>::Create(time + 1, q, phi));
+    }
+
+    unsigned q0 = l % 6;
+    unsigned q1 = (l + 1) % 6;
+    unsigned q2 = (q0 + 3) % 6;
+    unsigned q3 = (q1 + 4) % 6;
+
+    circuit.gates.push_back(GateSwap<float>::Create(time + 2, q0, q2));
+    circuit.gates.push_back(GateSwap<float>::Create(time + 2, q1, q3));
+
+    if (l == 3) {
+      circuit.gates.push_back(GateSwap<float>::Create(time + 2, 6, 1));
+      circuit.gates.push_back(
+          gate::Measurement<GateQSim<float>>::Create(time + 3, {1}));
+      circuit.gates.push_back(
+          GateIS<float>::Create(time + 3, 3, 4).ControlledBy({0}, {0}));
+    } else if (l == 6) {
+      circuit.gates.push_back(GateSwap<float>::Create(time + 2, 7, 4));
+      circuit.gates.push_back(
+          gate::Measurement<GateQSim<float>>::Create(time + 3, {4}));
+    }
+  }
+
+  return circuit;
+}
+
+TEST(RunQSimTest, QSimRunnerRelabelSwapGates) {
+  auto circuit = CreateSwapTestCircuit();
+
+  using Simulator = Factory::Simulator;
+  using StateSpace = Simulator::StateSpace;
+  using Result = StateSpace::MeasurementResult;
+  using State = StateSpace::State;
+  using Runner = QSimRunner<IO, BasicGateFuser<IO, GateQSim<float>>, Factory>;
+
+  StateSpace state_space = Factory::CreateStateSpace();
+  State state1 = state_space.Create(circuit.num_qubits);
+  State state2 = state_space.Create(circuit.num_qubits);
+
+  EXPECT_FALSE(state_space.IsNull(state1));
+  EXPECT_FALSE(state_space.IsNull(state2));
+
+  state_space.SetStateZero(state1);
+  state_space.SetStateZero(state2);
+
+  std::vector<Result> results1;
+  std::vector<Result> results2;
+
+  Runner::Parameter param;
+  param.seed = 1;
+  param.verbosity = 0;
+
+  EXPECT_TRUE(Runner::Run(param, Factory(), circuit, state1, results1));
+
+  param.relabel_swap_gates = true;
+
+  EXPECT_TRUE(Runner::Run(param, Factory(), circuit, state2, results2));
+
+  ASSERT_EQ(results1.size(), 2);
+  ASSERT_EQ(results2.size(), 2);
+
+  for (std::size_t k = 0; k < results1.size(); ++k) {
+    EXPECT_EQ(results1[k].mask, results2[k].mask);
+    EXPECT_EQ(results1[k].bits, results2[k].bits);
+    EXPECT_EQ(results1[k].bitstring, results2[k].bitstring);
+  }
+
+  uint64_t size = uint64_t{1} << circuit.num_qubits;
+
+  for (uint64_t i = 0; i < size; ++i) {
+    auto ampl1 = state_space.GetAmpl(state1, i);
+    auto ampl2 = state_space.GetAmpl(state2, i);
+    EXPECT_NEAR(std::real(ampl1), std::real(ampl2), 1e-6);
+    EXPECT_NEAR(std::imag(ampl1), std::imag(ampl2), 1e-6);
+  }
+
+  // Measure at intermediate times, including times without gates
+  // after relabeling.
+  std::vector<unsigned> times = {3, 11, 19, 28, 33};
+  std::vector<std::vector<std::complex<float>>> amplitudes1(times.size());
+  std::vector<std::vector<std::complex<float>>> amplitudes2(times.size());
+
+  auto measure = [&size](unsigned k, const StateSpace& state_space,
+                         const State& state,
+                         std::vector<std::vector<std::complex<float>>>& r) {
+    r[k].reserve(size);
+    for (uint64_t i = 0; i < size; ++i) {
+      r[k].push_back(state_space.GetAmpl(state, i));
+    }
+  };
+
+  auto measure1 = [&measure, &amplitudes1](
+      unsigned k, const StateSpace& state_space, const State& state) {
+    measure(k, state_space, state, amplitudes1);
+  };
+
+  auto measure2 = [&measure, &amplitudes2](
+      unsigned k, const StateSpace& state_space, const State& state) {
+    measure(k, state_space, state, amplitudes2);
+  };
+
+  param.relabel_swap_gates = false;
+  EXPECT_TRUE(Runner::Run(param, Factory(), times, circuit, measure1));
+
+  param.relabel_swap_gates = true;
+  EXPECT_TRUE(Runner::Run(param, Factory(), times, circuit, measure2));
+
+  for (std::size_t k = 0; k < times.size(); ++k) {
+    ASSERT_EQ(amplitudes1[k].size(), size);
+    ASSERT_EQ(amplitudes2[k].size(), size);
+
+    for (uint64_t i = 0; i < size; ++i) {
+      EXPECT_NEAR(std::real(amplitudes1[k][i]),
+                  std::real(amplitudes2[k][i]), 1e-6);
+      EXPECT_NEAR(std::imag(amplitudes1[k][i]),
+                  std::imag(amplitudes2[k][i]), 1e-6);
+    }
+  }
+}
+
+TEST(RunQSimTest, QSimRunnerReorderQubits) {
+  auto circuit = CreateSwapTestCircuit();
+
+  using Simulator = Factory::Simulator;
+  using StateSpace = Simulator::StateSpace;
+  using Result = StateSpace::MeasurementResult;
+  using State = StateSpace::State;
+  using Runner = QSimRunner<IO, BasicGateFuser<IO, GateQSim<float>>, Factory>;
+
+  StateSpace state_space = Factory::CreateStateSpace();
+  State state1 = state_space.Create(circuit.num_qubits);
+  State state2 = state_space.Create(circuit.num_qubits);
+
+  EXPECT_FALSE(state_space.IsNull(state1));
+  EXPECT_FALSE(state_space.IsNull(state2));
+
+  uint64_t size = uint64_t{1} << circuit.num_qubits;
+  std::vector<unsigned> times = {3, 11, 19, 28, 33};
+
+  using Amplitudes = std::vector<std::vector<std::complex<float>>>;
+
+  auto measure = [&size](unsigned k, const StateSpace& state_space,
+                         const State& state, Amplitudes& r) {
+    r[k].reserve(size);
+    for (uint64_t i = 0; i < size; ++i) {
+      r[k].push_back(state_space.GetAmpl(state, i));
+    }
+  };
+
+  Runner::Parameter param;
+  param.seed = 1;
+  param.verbosity = 0;
+
+  // Reference results.
+  state_space.SetStateZero(state1);
+  std::vector<Result> results1;
+  EXPECT_TRUE(Runner::Run(param, Factory(), circuit, state1, results1));
+
+  Amplitudes amplitudes1(times.size());
+  auto measure1 = [&measure, &amplitudes1](
+      unsigned k, const StateSpace& state_space, const State& state) {
+    measure(k, state_space, state, amplitudes1);
+  };
+  EXPECT_TRUE(Runner::Run(param, Factory(), times, circuit, measure1));
+
+  struct Config {
+    unsigned reorder_qubits;
+    unsigned reorder_window;
+    bool relabel_swap_gates;
+    unsigned tile_qubits;
+  };
+
+  std::vector<Config> configs = {
+    {2, 5, false, 0},
+    {3, 8, true, 0},
+    {3, 3, false, 6},
+    {5, 10, true, 0},
+  };
+
+  for (const auto& config : configs) {
+    param.reorder_qubits = config.reorder_qubits;
+    param.reorder_window = config.reorder_window;
+    param.relabel_swap_gates = config.relabel_swap_gates;
+    param.tile_qubits = config.tile_qubits;
+
+    // Make sure that qubits are actually reordered.
+    auto rcircuit = RelabelCircuit(circuit.num_qubits, circuit.gates, times,
+                                   config.relabel_swap_gates,
+                                   config.reorder_qubits,
+                                   config.reorder_window);
+    EXPECT_GT(rcircuit.reorder_times.size(), 1);
+
+    state_space.SetStateZero(state2);
+    std::vector<Result> results2;
+    EXPECT_TRUE(Runner::Run(param, Factory(), circuit, state2, results2));
+
+    ASSERT_EQ(results1.size(), results2.size());
+
+    for (std::size_t k = 0; k < results1.size(); ++k) {
+      EXPECT_EQ(results1[k].mask, results2[k].mask);
+      EXPECT_EQ(results1[k].bits, results2[k].bits);
+    }
+
+    for (uint64_t i = 0; i < size; ++i) {
+      auto ampl1 = state_space.GetAmpl(state1, i);
+      auto ampl2 = state_space.GetAmpl(state2, i);
+      EXPECT_NEAR(std::real(ampl1), std::real(ampl2), 1e-6);
+      EXPECT_NEAR(std::imag(ampl1), std::imag(ampl2), 1e-6);
+    }
+
+    Amplitudes amplitudes2(times.size());
+    auto measure2 = [&measure, &amplitudes2](
+        unsigned k, const StateSpace& state_space, const State& state) {
+      measure(k, state_space, state, amplitudes2);
+    };
+    EXPECT_TRUE(Runner::Run(param, Factory(), times, circuit, measure2));
+
+    for (std::size_t k = 0; k < times.size(); ++k) {
+      ASSERT_EQ(amplitudes1[k].size(), size);
+      ASSERT_EQ(amplitudes2[k].size(), size);
+
+      for (uint64_t i = 0; i < size; ++i) {
+        EXPECT_NEAR(std::real(amplitudes1[k][i]),
+                    std::real(amplitudes2[k][i]), 1e-6);
+        EXPECT_NEAR(std::imag(amplitudes1[k][i]),
+                    std::imag(amplitudes2[k][i]), 1e-6);
+      }
+    }
+  }
+}
+
 }  // namespace qsim
 
 int main(int argc, char** argv) {
@@ -0,0 +1,172 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "../lib/simdispatch.h"
+
+#include <complex>
+#include <cstdint>
+#include <sstream>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "../lib/circuit_qsim_parser.h"
+#include "../lib/formux.h"
+#include "../lib/fuser_mqubit.h"
+#include "../lib/gates_qsim.h"
+#include "../lib/io.h"
+#include "../lib/run_qsim.h"
+#include "../lib/util_cpu.h"
+
+namespace qsim {
+
+constexpr char provider[] = "simdispatch_test";
+
+constexpr char circuit_string[] =
+R"(6
+0 h 0
+0 h 1
+0 h 2
+0 h 3
+0 h 4
+0 h 5
+1 cz 0 1
+1 cz 2 3
+1 cz 4 5
+2 t 0
+2 x 1
+2 y 2
+2 t 3
+2 x 4
+2 y 5
+3 cz 1 2
+3 cz 3 4
+3 cz 5 0
+4 t 1
+4 t 2
+4 x 3
+4 y 4
+5 cz 0 3
+5 cz 1 4
+5 cz 2 5
+6 h 0
+6 h 3
+)";
+
+// Runs the circuit and returns the amplitudes of the final state.
+struct RunCircuit {
+  template <typename Factory>
+  std::vector<std::complex<float>> operator()(
+      const Factory& factory, const Circuit<GateQSim<float>>& circuit) const {
+    using Fuser = MultiQubitGateFuser<IO, GateQSim<float>>;
+    using Runner = QSimRunner<IO, Fuser, Factory>;
+
+    auto state_space = factory.CreateStateSpace();
+    auto state = state_space.Create(circuit.num_qubits);
+    state_space.SetStateZero(state);
+
+    typename Runner::Parameter param;
+    param.max_fused_size = 3;
+
+    std::vector<std::complex<float>> amplitudes;
+
+    if (Runner::Run(param, factory, circuit, state)) {
+      uint64_t size = uint64_t{1} << circuit.num_qubits;
+      amplitudes.reserve(size);
+
+      for (uint64_t i = 0; i < size; ++i) {
+        amplitudes.push_back(state_space.GetAmpl(state, i));
+      }
+    }
+
+    return amplitudes;
+  }
+};
+
+struct RegisterSize {
+  template <typename Factory>
+  unsigned operator()(const Factory& factory) const {
+    return Factory::Simulator::SIMDRegisterSize();
+  }
+};
+
+TEST(SimDispatchTest, DetectSimdInstructions) {
+  SimdInstructions instructions = DetectSimdInstructions();
+
+  EXPECT_EQ(instructions, GetSimdInstructions());
+
+  // The test should run on the machine it was compiled for.
+#if defined(__AVX512F__)
+  EXPECT_EQ(instructions, kAVX512F);
+#elif defined(__AVX2__) && defined(__FMA__) && defined(__BMI2__)
+  EXPECT_GE(instructions, kAVX2);
+#elif defined(__SSE4_1__)
+  EXPECT_GE(instructions, kSSE4_1);
+#endif
+}
+
+TEST(SimDispatchTest, SimulatorSelection) {
+  using Dispatch = SimulatorDispatch<For>;
+
+  EXPECT_EQ(Dispatch::Run(kBasic, 1, RegisterSize()), 1);
+
+#if defined(__x86_64__) || defined(_M_X64)
+  SimdInstructions instructions = GetSimdInstructions();
+
+  if (instructions >= kSSE4_1) {
+    EXPECT_EQ(Dispatch::Run(kSSE4_1, 1, RegisterSize()), 4);
+  }
+  if (instructions >= kAVX2) {
+    EXPECT_EQ(Dispatch::Run(kAVX2, 1, RegisterSize()), 8);
+  }
+  if (instructions >= kAVX512F) {
+    EXPECT_EQ(Dispatch::Run(kAVX512F, 1, RegisterSize()), 16);
+  }
+
+  EXPECT_EQ(Dispatch::Run(1, RegisterSize()),
+            Dispatch::Run(instructions, 1, RegisterSize()));
+#endif
+}
+
+TEST(SimDispatchTest, RunCircuit) {
+  std::stringstream ss(circuit_string);
+  Circuit<GateQSim<float>> circuit;
+
+  EXPECT_TRUE(CircuitQsimParser<IO>::FromStream(99, provider, ss, circuit));
+
+  using Dispatch = SimulatorDispatch<For>;
+
+  auto expected = Dispatch::Run(kBasic, 1, RunCircuit(), circuit);
+  ASSERT_EQ(expected.size(), uint64_t{1} << circuit.num_qubits);
+
+  for (unsigned k = kSSE4_1; k <= GetSimdInstructions(); ++k) {
+    for (unsigned num_threads : {1, 2}) {
+      auto amplitudes = Dispatch::Run(
+          SimdInstructions(k), num_threads, RunCircuit(), circuit);
+      ASSERT_EQ(amplitudes.size(), expected.size());
+
+      for (uint64_t i = 0; i < expected.size(); ++i) {
+        EXPECT_NEAR(std::real(amplitudes[i]), std::real(expected[i]), 1e-6);
+        EXPECT_NEAR(std::imag(amplitudes[i]), std::imag(expected[i]), 1e-6);
+      }
+    }
+  }
+}
+
+}  // namespace qsim
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
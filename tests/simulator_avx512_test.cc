@@ -29,16 +29,9 @@ namespace qsim {
 template <class T>
 class SimulatorAVX512Test : public testing::Test {};
 
-using ::testing::Types;
-#ifdef _OPENMP
-typedef Types<ParallelFor, SequentialFor> for_impl;
-#else
-typedef Types<SequentialFor> for_impl;
-#endif
-
-template <typename For>
+template <typename For, typename FP>
 struct Factory {
-  using Simulator = SimulatorAVX512<For>;
+  using Simulator = SimulatorAVX512<For, FP>;
   using StateSpace = typename Simulator::StateSpace;
 
   static StateSpace CreateStateSpace() {
@@ -50,46 +43,82 @@ struct Factory {
   }
 };
 
-TYPED_TEST_SUITE(SimulatorAVX512Test, for_impl);
+using ::testing::Types;
+#ifdef _OPENMP
+typedef Types<Factory<ParallelFor, float>, Factory<ParallelFor, double>,
+              Factory<SequentialFor, float>, Factory<SequentialFor, double>>
+    factory_impl;
+#else
+typedef Types<Factory<SequentialFor, float>, Factory<SequentialFor, double>>
+    factory_impl;
+#endif
+
+TYPED_TEST_SUITE(SimulatorAVX512Test, factory_impl);
 
 TYPED_TEST(SimulatorAVX512Test, ApplyGate1) {
-  TestApplyGate1(Factory<TypeParam>());
+  TestApplyGate1(TypeParam());
 }
 
 TYPED_TEST(SimulatorAVX512Test, ApplyGate2) {
-  TestApplyGate2(Factory<TypeParam>());
+  TestApplyGate2(TypeParam());
 }
 
 TYPED_TEST(SimulatorAVX512Test, ApplyGate3) {
-  TestApplyGate3(Factory<TypeParam>());
+  TestApplyGate3(TypeParam());
 }
 
 TYPED_TEST(SimulatorAVX512Test, ApplyGate5) {
-  TestApplyGate5(Factory<TypeParam>());
+  TestApplyGate5(TypeParam());
 }
 
 TYPED_TEST(SimulatorAVX512Test, CircuitWithControlledGates) {
-  TestCircuitWithControlledGates(Factory<TypeParam>());
+  TestCircuitWithControlledGates(TypeParam());
 }
 
 TYPED_TEST(SimulatorAVX512Test, CircuitWithControlledGatesDagger) {
-  TestCircuitWithControlledGatesDagger(Factory<TypeParam>());
+  TestCircuitWithControlledGatesDagger(TypeParam());
 }
 
 TYPED_TEST(SimulatorAVX512Test, MultiQubitGates) {
-  TestMultiQubitGates(Factory<TypeParam>());
+  TestMultiQubitGates(TypeParam(), 8);
+}
+
+TYPED_TEST(SimulatorAVX512Test, DiagonalGates) {
+  TestDiagonalGates(TypeParam());
+}
+
+TYPED_TEST(SimulatorAVX512Test, PermutationGates) {
+  TestPermutationGates(TypeParam());
+}
+
+TYPED_TEST(SimulatorAVX512Test, PauliRotations) {
+  TestPauliRotations(TypeParam());
 }
 
 TYPED_TEST(SimulatorAVX512Test, ControlledGates) {
-  TestControlledGates(Factory<TypeParam>(), false);
+  TestControlledGates(TypeParam(), false);
 }
 
 TYPED_TEST(SimulatorAVX512Test, ExpectationValue1) {
-  TestExpectationValue1(Factory<TypeParam>());
+  TestExpectationValue1(TypeParam(), 8);
 }
 
 TYPED_TEST(SimulatorAVX512Test, ExpectationValue2) {
-  TestExpectationValue2(Factory<TypeParam>());
+  TestExpectationValue2(TypeParam());
+}
+
+TYPED_TEST(SimulatorAVX512Test, ExpectationValuePauli) {
+  TestExpectationValuePauli(TypeParam());
+}
+
+TYPED_TEST(SimulatorAVX512Test, ReducedDensityMatrix) {
+  TestReducedDensityMatrix(TypeParam());
+}
+
+TYPED_TEST(SimulatorAVX512Test, UnexpandedGates) {
+  using fp_type = typename TypeParam::Simulator::fp_type;
+  // A SIMD register holds 2^4 floats or 2^3 doubles.
+  TestUnexpandedGates<sizeof(fp_type) == 4 ? 4 : 3>(TypeParam());
 }
 
 }  // namespace qsim
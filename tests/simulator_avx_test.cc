@@ -27,16 +27,9 @@ namespace qsim {
 template <class T>
 class SimulatorAVXTest : public testing::Test {};
 
-using ::testing::Types;
-#ifdef _OPENMP
-typedef Types<ParallelFor, SequentialFor> for_impl;
-#else
-typedef Types<SequentialFor> for_impl;
-#endif
-
-template <typename For>
+template <typename For, typename FP>
 struct Factory {
-  using Simulator = SimulatorAVX<For>;
+  using Simulator = SimulatorAVX<For, FP>;
   using StateSpace = typename Simulator::StateSpace;
 
   static StateSpace CreateStateSpace() {
@@ -48,46 +41,82 @@ struct Factory {
   }
 };
 
-TYPED_TEST_SUITE(SimulatorAVXTest, for_impl);
+using ::testing::Types;
+#ifdef _OPENMP
+typedef Types<Factory<ParallelFor, float>, Factory<ParallelFor, double>,
+              Factory<SequentialFor, float>, Factory<SequentialFor, double>>
+    factory_impl;
+#else
+typedef Types<Factory<SequentialFor, float>, Factory<SequentialFor, double>>
+    factory_impl;
+#endif
+
+TYPED_TEST_SUITE(SimulatorAVXTest, factory_impl);
 
 TYPED_TEST(SimulatorAVXTest, ApplyGate1) {
-  TestApplyGate1(Factory<TypeParam>());
+  TestApplyGate1(TypeParam());
 }
 
 TYPED_TEST(SimulatorAVXTest, ApplyGate2) {
-  TestApplyGate2(Factory<TypeParam>());
+  TestApplyGate2(TypeParam());
 }
 
 TYPED_TEST(SimulatorAVXTest, ApplyGate3) {
-  TestApplyGate3(Factory<TypeParam>());
+  TestApplyGate3(TypeParam());
 }
 
 TYPED_TEST(SimulatorAVXTest, ApplyGate5) {
-  TestApplyGate5(Factory<TypeParam>());
+  TestApplyGate5(TypeParam());
 }
 
 TYPED_TEST(SimulatorAVXTest, CircuitWithControlledGates) {
-  TestCircuitWithControlledGates(Factory<TypeParam>());
+  TestCircuitWithControlledGates(TypeParam());
 }
 
 TYPED_TEST(SimulatorAVXTest, CircuitWithControlledGatesDagger) {
-  TestCircuitWithControlledGatesDagger(Factory<TypeParam>());
+  TestCircuitWithControlledGatesDagger(TypeParam());
 }
 
 TYPED_TEST(SimulatorAVXTest, MultiQubitGates) {
-  TestMultiQubitGates(Factory<TypeParam>());
+  TestMultiQubitGates(TypeParam(), 8);
+}
+
+TYPED_TEST(SimulatorAVXTest, DiagonalGates) {
+  TestDiagonalGates(TypeParam());
+}
+
+TYPED_TEST(SimulatorAVXTest, PermutationGates) {
+  TestPermutationGates(TypeParam());
+}
+
+TYPED_TEST(SimulatorAVXTest, PauliRotations) {
+  TestPauliRotations(TypeParam());
 }
 
 TYPED_TEST(SimulatorAVXTest, ControlledGates) {
-  TestControlledGates(Factory<TypeParam>(), false);
+  TestControlledGates(TypeParam(), false);
 }
 
 TYPED_TEST(SimulatorAVXTest, ExpectationValue1) {
-  TestExpectationValue1(Factory<TypeParam>());
+  TestExpectationValue1(TypeParam(), 8);
 }
 
 TYPED_TEST(SimulatorAVXTest, ExpectationValue2) {
-  TestExpectationValue2(Factory<TypeParam>());
+  TestExpectationValue2(TypeParam());
+}
+
+TYPED_TEST(SimulatorAVXTest, ExpectationValuePauli) {
+  TestExpectationValuePauli(TypeParam());
+}
+
+TYPED_TEST(SimulatorAVXTest, ReducedDensityMatrix) {
+  TestReducedDensityMatrix(TypeParam());
+}
+
+TYPED_TEST(SimulatorAVXTest, UnexpandedGates) {
+  using fp_type = typename TypeParam::Simulator::fp_type;
+  // A SIMD register holds 2^3 floats or 2^2 doubles.
+  TestUnexpandedGates<sizeof(fp_type) == 4 ? 3 : 2>(TypeParam());
 }
 
 }  // namespace qsim
@@ -19,6 +19,7 @@
 #ifdef _OPENMP
 #include "../lib/parfor.h"
 #endif
+#include "../lib/poolfor.h"
 #include "../lib/seqfor.h"
 #include "../lib/simulator_basic.h"
 
@@ -29,9 +30,9 @@ class SimulatorBasicTest : public testing::Test {};
 
 using ::testing::Types;
 #ifdef _OPENMP
-typedef Types<ParallelFor, SequentialFor> for_impl;
+typedef Types<ParallelFor, PoolFor, SequentialFor> for_impl;
 #else
-typedef Types<SequentialFor> for_impl;
+typedef Types<PoolFor, SequentialFor> for_impl;
 #endif
 
 template <typename For>
@@ -75,7 +76,19 @@ TYPED_TEST(SimulatorBasicTest, CircuitWithControlledGatesDagger) {
 }
 
 TYPED_TEST(SimulatorBasicTest, MultiQubitGates) {
-  TestMultiQubitGates(Factory<TypeParam>());
+  TestMultiQubitGates(Factory<TypeParam>(), 8);
+}
+
+TYPED_TEST(SimulatorBasicTest, DiagonalGates) {
+  TestDiagonalGates(Factory<TypeParam>());
+}
+
+TYPED_TEST(SimulatorBasicTest, PermutationGates) {
+  TestPermutationGates(Factory<TypeParam>());
+}
+
+TYPED_TEST(SimulatorBasicTest, PauliRotations) {
+  TestPauliRotations(Factory<TypeParam>());
 }
 
 TYPED_TEST(SimulatorBasicTest, ControlledGates) {
@@ -83,13 +96,21 @@ TYPED_TEST(SimulatorBasicTest, ControlledGates) {
 }
 
 TYPED_TEST(SimulatorBasicTest, ExpectationValue1) {
-  TestExpectationValue1(Factory<TypeParam>());
+  TestExpectationValue1(Factory<TypeParam>(), 8);
 }
 
 TYPED_TEST(SimulatorBasicTest, ExpectationValue2) {
   TestExpectationValue2(Factory<TypeParam>());
 }
 
+TYPED_TEST(SimulatorBasicTest, ExpectationValuePauli) {
+  TestExpectationValuePauli(Factory<TypeParam>());
+}
+
+TYPED_TEST(SimulatorBasicTest, ReducedDensityMatrix) {
+  TestReducedDensityMatrix(Factory<TypeParam>());
+}
+
 }  // namespace qsim
 
 int main(int argc, char** argv) {
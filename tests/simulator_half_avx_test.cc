@@ -0,0 +1,97 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "simulator_half_testfixture.h"
+
+#include "gtest/gtest.h"
+
+#ifdef _OPENMP
+#include "../lib/parfor.h"
+#endif
+#include "../lib/half.h"
+#include "../lib/seqfor.h"
+#include "../lib/simulator_avx.h"
+#include "../lib/simulator_half_avx.h"
+
+namespace qsim {
+
+template <class T>
+class SimulatorHalfAVXTest : public testing::Test {};
+
+template <typename For>
+struct RefFactory {
+  using Simulator = SimulatorAVX<For, float>;
+  using StateSpace = typename Simulator::StateSpace;
+
+  static StateSpace CreateStateSpace() {
+    return StateSpace(2);
+  }
+
+  static Simulator CreateSimulator() {
+    return Simulator(2);
+  }
+};
+
+template <typename For, typename Half>
+struct Factory {
+  using Simulator = SimulatorHalfAVX<For, Half>;
+  using StateSpace = typename Simulator::StateSpace;
+  using RefFactory = qsim::RefFactory<For>;
+
+  static StateSpace CreateStateSpace() {
+    return StateSpace(2);
+  }
+
+  static Simulator CreateSimulator() {
+    return Simulator(2);
+  }
+
+  RefFactory ref_factory;
+};
+
+using ::testing::Types;
+#ifdef _OPENMP
+typedef Types<Factory<ParallelFor, float16>, Factory<ParallelFor, bfloat16>,
+              Factory<SequentialFor, float16>,
+              Factory<SequentialFor, bfloat16>> factory_impl;
+#else
+typedef Types<Factory<SequentialFor, float16>,
+              Factory<SequentialFor, bfloat16>> factory_impl;
+#endif
+
+TYPED_TEST_SUITE(SimulatorHalfAVXTest, factory_impl);
+
+TYPED_TEST(SimulatorHalfAVXTest, StateSpace) {
+  TestHalfStateSpace(TypeParam());
+}
+
+TYPED_TEST(SimulatorHalfAVXTest, ApplyGates) {
+  TestHalfApplyGates(TypeParam());
+}
+
+TYPED_TEST(SimulatorHalfAVXTest, SpecialGates) {
+  TestHalfSpecialGates(TypeParam());
+}
+
+TYPED_TEST(SimulatorHalfAVXTest, Runner) {
+  TestHalfRunner(TypeParam());
+}
+
+}  // namespace qsim
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
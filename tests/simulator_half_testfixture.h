@@ -0,0 +1,601 @@
+// Copyright 2019 Google LLC. All Rights Reserved.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+//     https://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#ifndef SIMULATOR_HALF_TESTFIXTURE_H_
+#define SIMULATOR_HALF_TESTFIXTURE_H_
+
+#include <algorithm>
+#include <cmath>
+#include <complex>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "../lib/circuit.h"
+#include "../lib/fuser_mqubit.h"
+#include "../lib/gates_qsim.h"
+#include "../lib/half.h"
+#include "../lib/io.h"
+#include "../lib/run_qsim.h"
+
+namespace qsim {
+
+// Half-precision simulators are tested against the single-precision
+// simulators with the same state layout. The factories provide the
+// half-precision simulator (Simulator) and the single-precision one
+// (RefFactory::Simulator).
+
+inline double UnitRoundoff(float16) {
+  return std::ldexp(1.0, -11);
+}
+
+inline double UnitRoundoff(bfloat16) {
+  return std::ldexp(1.0, -8);
+}
+
+template <typename StateSpace>
+double UnitRoundoff() {
+  return UnitRoundoff(typename StateSpace::storage_type{});
+}
+
+// Fills the half-precision state with random normalized amplitudes and
+// copies them to the single-precision state.
+template <typename StateSpace, typename RefStateSpace, typename RGen>
+void FillRandomState(const StateSpace& state_space,
+                     const RefStateSpace& ref_state_space, RGen& rgen,
+                     typename StateSpace::State& state,
+                     typename RefStateSpace::State& ref_state) {
+  std::normal_distribution<double> distr;
+
+  uint64_t size = uint64_t{1} << state.num_qubits();
+  std::vector<double> vec(2 * size);
+
+  double norm = 0;
+
+  for (uint64_t i = 0; i < 2 * size; ++i) {
+    vec[i] = distr(rgen);
+    norm += vec[i] * vec[i];
+  }
+
+  state_space.SetAllZeros(state);
+
+  for (uint64_t i = 0; i < size; ++i) {
+    double s = 1 / std::sqrt(norm);
+    state_space.SetAmpl(state, i, s * vec[2 * i], s * vec[2 * i + 1]);
+  }
+
+  ref_state_space.SetAllZeros(ref_state);
+
+  for (uint64_t i = 0; i < size; ++i) {
+    ref_state_space.SetAmpl(ref_state, i, state_space.GetAmpl(state, i));
+  }
+}
+
+// Copies the amplitudes of the half-precision state to the single-precision
+// state.
+template <typename StateSpace, typename RefStateSpace>
+void CopyState(const StateSpace& state_space,
+               const RefStateSpace& ref_state_space,
+               const typename StateSpace::State& state,
+               typename RefStateSpace::State& ref_state) {
+  uint64_t size = uint64_t{1} << state.num_qubits();
+
+  for (uint64_t i = 0; i < size; ++i) {
+    ref_state_space.SetAmpl(ref_state, i, state_space.GetAmpl(state, i));
+  }
+}
+
+// Returns the Euclidean distance between the states.
+template <typename StateSpace, typename RefStateSpace>
+double StateDistance(const StateSpace& state_space,
+                     const RefStateSpace& ref_state_space,
+                     const typename StateSpace::State& state,
+                     const typename RefStateSpace::State& ref_state) {
+  uint64_t size = uint64_t{1} << state.num_qubits();
+
+  double d = 0;
+
+  for (uint64_t i = 0; i < size; ++i) {
+    std::complex<double> a1 = state_space.GetAmpl(state, i);
+    std::complex<double> a2 = ref_state_space.GetAmpl(ref_state, i);
+    d += std::norm(a1 - a2);
+  }
+
+  return std::sqrt(d);
+}
+
+// Generates a random unitary matrix by orthonormalizing a random complex
+// matrix.
+template <typename fp_type, typename RGen>
+void GenerateRandomUnitary(unsigned num_qubits, RGen& rgen,
+                           std::vector<fp_type>& matrix) {
+  std::normal_distribution<double> distr;
+
+  unsigned size = 1 << num_qubits;
+  std::vector<std::complex<double>> m(size * size);
+
+  for (auto& v : m) {
+    v = std::complex<double>(distr(rgen), distr(rgen));
+  }
+
+  for (unsigned i = 0; i < size; ++i) {
+    for (unsigned k = 0; k < i; ++k) {
+      std::complex<double> p = 0;
+
+      for (unsigned j = 0; j < size; ++j) {
+        p += std::conj(m[size * k + j]) * m[size * i + j];
+      }
+
+      for (unsigned j = 0; j < size; ++j) {
+        m[size * i + j] -= p * m[size * k + j];
+      }
+    }
+
+    double norm = 0;
+
+    for (unsigned j = 0; j < size; ++j) {
+      norm += std::norm(m[size * i + j]);
+    }
+
+    for (unsigned j = 0; j < size; ++j) {
+      m[size * i + j] /= std::sqrt(norm);
+    }
+  }
+
+  matrix.resize(0);
+
+  for (const auto& v : m) {
+    matrix.push_back(std::real(v));
+    matrix.push_back(std::imag(v));
+  }
+}
+
+template <typename Factory>
+void TestHalfStateSpace(const Factory& factory) {
+  using StateSpace = typename Factory::StateSpace;
+  using RefStateSpace = typename Factory::RefFactory::StateSpace;
+  using Half = typename StateSpace::storage_type;
+
+  StateSpace state_space = factory.CreateStateSpace();
+  RefStateSpace ref_state_space = factory.ref_factory.CreateStateSpace();
+
+  double eps = UnitRoundoff<StateSpace>();
+
+  // Rounding to nearest even.
+  float x = 1 + eps;
+  EXPECT_EQ(HalfToFloat(FloatToHalf<Half>(x)), 1);
+  EXPECT_EQ(HalfToFloat(FloatToHalf<Half>(-x)), -1);
+  x = 1 + 3 * eps;
+  EXPECT_EQ(HalfToFloat(FloatToHalf<Half>(x)), 1 + 4 * eps);
+  x = 1 + 1.5 * eps;
+  EXPECT_EQ(HalfToFloat(FloatToHalf<Half>(x)), 1 + 2 * eps);
+
+  std::mt19937 rgen(1);
+
+  for (unsigned num_qubits : {1, 2, 3, 4, 5, 9, 16}) {
+    uint64_t size = uint64_t{1} << num_qubits;
+
+    auto state1 = state_space.Create(num_qubits);
+    auto state2 = state_space.Create(num_qubits);
+    auto ref_state1 = ref_state_space.Create(num_qubits);
+    auto ref_state2 = ref_state_space.Create(num_qubits);
+
+    EXPECT_EQ(state_space.MinSize(num_qubits),
+              ref_state_space.MinSize(num_qubits));
+
+    // The storage is half the size of single-precision storage.
+    EXPECT_EQ(sizeof(*state1.get()), sizeof(*ref_state1.get()) / 2);
+
+    state_space.SetStateZero(state1);
+    EXPECT_EQ(state_space.GetAmpl(state1, 0), std::complex<float>(1, 0));
+    EXPECT_EQ(state_space.Norm(state1), 1);
+
+    for (uint64_t i = 1; i < size; ++i) {
+      EXPECT_EQ(state_space.GetAmpl(state1, i), std::complex<float>(0, 0));
+    }
+
+    state_space.SetStateUniform(state1);
+    EXPECT_NEAR(state_space.Norm(state1), 1, 2 * eps);
+
+    // Vectorized narrowing rounds as FloatToHalf does.
+    float scale = state_space.StorageScale(num_qubits);
+    float v = HalfToFloat(FloatToHalf<Half>(scale / std::sqrt(size))) / scale;
+
+    for (uint64_t i = 0; i < size; ++i) {
+      auto a = state_space.GetAmpl(state1, i);
+      EXPECT_NEAR(std::real(a) * std::sqrt(size), 1, eps);
+      EXPECT_EQ(std::real(a), v);
+      EXPECT_EQ(std::imag(a), 0);
+    }
+
+    // Amplitudes are rounded to the nearest Half numbers.
+    for (uint64_t i = 0; i < size; ++i) {
+      float re = 0.7 * std::cos(0.3 * i) / std::sqrt(size);
+      float im = 0.7 * std::sin(0.5 * i) / std::sqrt(size);
+      state_space.SetAmpl(state1, i, re, im);
+      auto a = state_space.GetAmpl(state1, i);
+      EXPECT_NEAR(std::real(a), re, eps * std::abs(re));
+      EXPECT_NEAR(std::imag(a), im, eps * std::abs(im));
+    }
+
+    FillRandomState(state_space, ref_state_space, rgen, state1, ref_state1);
+    FillRandomState(state_space, ref_state_space, rgen, state2, ref_state2);
+
+    EXPECT_NEAR(state_space.Norm(state1), ref_state_space.Norm(ref_state1),
+                1e-6);
+
+    auto ip1 = state_space.InnerProduct(state1, state2);
+    auto ip2 = ref_state_space.InnerProduct(ref_state1, ref_state2);
+    EXPECT_NEAR(std::real(ip1), std::real(ip2), 1e-6);
+    EXPECT_NEAR(std::imag(ip1), std::imag(ip2), 1e-6);
+
+    EXPECT_NEAR(state_space.RealInnerProduct(state1, state2),
+                ref_state_space.RealInnerProduct(ref_state1, ref_state2),
+                1e-6);
+
+    // Multiplication by powers of two is exact.
+    state_space.Multiply(2, state1);
+    ref_state_space.Multiply(2, ref_state1);
+    EXPECT_EQ(StateDistance(
+        state_space, ref_state_space, state1, ref_state1), 0);
+
+    state_space.Multiply(0.5, state1);
+    ref_state_space.Multiply(0.5, ref_state1);
+
+    state_space.Add(state1, state2);
+    ref_state_space.Add(ref_state1, ref_state2);
+    EXPECT_LT(StateDistance(
+        state_space, ref_state_space, state2, ref_state2), 2 * eps);
+
+    CopyState(state_space, ref_state_space, state2, ref_state2);
+
+    state_space.BulkSetAmpl(state2, 1, 1, 0.5, -0.25);
+    ref_state_space.BulkSetAmpl(ref_state2, 1, 1, 0.5, -0.25);
+    EXPECT_EQ(StateDistance(
+        state_space, ref_state_space, state2, ref_state2), 0);
+
+    state_space.BulkSetAmpl(state2, 1, 1, 0.25, 0.125, true);
+    ref_state_space.BulkSetAmpl(ref_state2, 1, 1, 0.25, 0.125, true);
+    EXPECT_EQ(StateDistance(
+        state_space, ref_state_space, state2, ref_state2), 0);
+
+    // The order conversions do not change amplitudes.
+    state_space.Copy(state1, state2);
+    state_space.InternalToNormalOrder(state2);
+    state_space.NormalToInternalOrder(state2);
+    EXPECT_EQ(StateDistance(
+        state_space, ref_state_space, state2, ref_state1), 0);
+
+    state_space.InternalToNormalOrder(state2);
+    ref_state_space.InternalToNormalOrder(ref_state1);
+
+    for (uint64_t i = 0; i < size; ++i) {
+      Half re = state2.get()[2 * i];
+      Half im = state2.get()[2 * i + 1];
+      float s = 1 / state_space.StorageScale(num_qubits);
+      EXPECT_EQ(s * HalfToFloat(re), ref_state1.get()[2 * i]);
+      EXPECT_EQ(s * HalfToFloat(im), ref_state1.get()[2 * i + 1]);
+    }
+
+    ref_state_space.NormalToInternalOrder(ref_state1);
+
+    // Measurements.
+    std::vector<unsigned> qubits = {0, num_qubits - 1};
+    if (num_qubits == 1) qubits.pop_back();
+
+    uint64_t mask = 1 | (uint64_t{1} << (num_qubits - 1));
+
+    for (unsigned k = 0; k < 4; ++k) {
+      FillRandomState(state_space, ref_state_space, rgen, state1, ref_state1);
+
+      auto mr = state_space.Measure(qubits, rgen, state1);
+
+      EXPECT_TRUE(mr.valid);
+      EXPECT_EQ(mr.mask, mask);
+      EXPECT_NEAR(state_space.Norm(state1), 1, 4 * eps);
+
+      for (uint64_t i = 0; i < size; ++i) {
+        if ((i & mask) != mr.bits) {
+          EXPECT_EQ(state_space.GetAmpl(state1, i),
+                    std::complex<float>(0, 0));
+        }
+      }
+    }
+
+    // Sampling.
+    state_space.SetAllZeros(state1);
+    state_space.SetAmpl(state1, size - 1, 0, 1);
+
+    auto samples = state_space.Sample(state1, 10, 1);
+
+    EXPECT_EQ(samples.size(), 10);
+    for (auto s : samples) {
+      EXPECT_EQ(s, size - 1);
+    }
+  }
+}
+
+template <typename Factory>
+void TestHalfApplyGates(const Factory& factory) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Simulator::StateSpace;
+  using RefSimulator = typename Factory::RefFactory::Simulator;
+  using RefStateSpace = typename RefSimulator::StateSpace;
+  using fp_type = typename StateSpace::fp_type;
+
+  unsigned max_gate_qubits = 5;
+  unsigned max_control_qubits = 2;
+  unsigned max_num_qubits = 6 + std::log2(Simulator::SIMDRegisterSize());
+
+  StateSpace state_space = factory.CreateStateSpace();
+  Simulator simulator = factory.CreateSimulator();
+  RefStateSpace ref_state_space = factory.ref_factory.CreateStateSpace();
+  RefSimulator ref_simulator = factory.ref_factory.CreateSimulator();
+
+  double eps = UnitRoundoff<StateSpace>();
+
+  std::mt19937 rgen(1);
+  std::vector<fp_type> matrix;
+
+  for (unsigned num_qubits = 1; num_qubits <= max_num_qubits; ++num_qubits) {
+    auto state = state_space.Create(num_qubits);
+    auto ref_state = ref_state_space.Create(num_qubits);
+
+    FillRandomState(state_space, ref_state_space, rgen, state, ref_state);
+
+    unsigned max_gate_qubits2 = std::min(max_gate_qubits, num_qubits);
+
+    for (unsigned q = 1; q <= max_gate_qubits2; ++q) {
+      unsigned max_minq = num_qubits - q;
+
+      for (unsigned k = 0; k <= max_minq; ++k) {
+        // Spread the gate qubits over the state to mix low and high qubits.
+        unsigned stride = q > 1 ? std::min(3u, (num_qubits - 1 - k) / (q - 1))
+                                : 1;
+
+        std::vector<unsigned> qubits;
+        uint64_t qmask = 0;
+
+        for (unsigned i = 0; i < q; ++i) {
+          qubits.push_back(k + i * stride);
+          qmask |= uint64_t{1} << qubits.back();
+        }
+
+        GenerateRandomUnitary(q, rgen, matrix);
+
+        simulator.ApplyGate(qubits, matrix.data(), state);
+        ref_simulator.ApplyGate(qubits, matrix.data(), ref_state);
+
+        // Rounding to Half numbers is the only source of large errors.
+        EXPECT_LT(StateDistance(state_space, ref_state_space,
+                                state, ref_state), 2 * eps);
+
+        CopyState(state_space, ref_state_space, state, ref_state);
+
+        auto ev1 = simulator.ExpectationValue(qubits, matrix.data(), state);
+        auto ev2 = ref_simulator.ExpectationValue(
+            qubits, matrix.data(), ref_state);
+
+        EXPECT_NEAR(std::real(ev1), std::real(ev2), 1e-6);
+        EXPECT_NEAR(std::imag(ev1), std::imag(ev2), 1e-6);
+
+        // Controlled gates with low and high control qubits.
+        std::vector<unsigned> cqubits;
+
+        for (unsigned i = 0; i < num_qubits; ++i) {
+          unsigned c = (i % 2) == 0 ? i / 2 : num_qubits - 1 - i / 2;
+          if (((qmask >> c) & 1) == 0
+              && std::find(cqubits.begin(), cqubits.end(), c)
+                 == cqubits.end()) {
+            cqubits.push_back(c);
+          }
+          if (cqubits.size() == max_control_qubits) break;
+        }
+
+        if (cqubits.size() == 0) continue;
+
+        std::sort(cqubits.begin(), cqubits.end());
+        uint64_t cvals = k & ((1 << cqubits.size()) - 1);
+
+        simulator.ApplyControlledGate(
+            qubits, cqubits, cvals, matrix.data(), state);
+        ref_simulator.ApplyControlledGate(
+            qubits, cqubits, cvals, matrix.data(), ref_state);
+
+        EXPECT_LT(StateDistance(state_space, ref_state_space,
+                                state, ref_state), 2 * eps);
+
+        CopyState(state_space, ref_state_space, state, ref_state);
+      }
+    }
+
+    EXPECT_NEAR(state_space.Norm(state), 1, 1e-2);
+  }
+}
+
+template <typename Factory>
+void TestHalfSpecialGates(const Factory& factory) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Simulator::StateSpace;
+  using RefSimulator = typename Factory::RefFactory::Simulator;
+  using RefStateSpace = typename RefSimulator::StateSpace;
+  using fp_type = typename StateSpace::fp_type;
+
+  unsigned max_gate_qubits = 4;
+  unsigned max_num_qubits = 6 + std::log2(Simulator::SIMDRegisterSize());
+
+  StateSpace state_space = factory.CreateStateSpace();
+  Simulator simulator = factory.CreateSimulator();
+  RefStateSpace ref_state_space = factory.ref_factory.CreateStateSpace();
+  RefSimulator ref_simulator = factory.ref_factory.CreateSimulator();
+
+  double eps = UnitRoundoff<StateSpace>();
+
+  std::mt19937 rgen(1);
+
+  for (unsigned num_qubits = 1; num_qubits <= max_num_qubits; ++num_qubits) {
+    auto state = state_space.Create(num_qubits);
+    auto ref_state = ref_state_space.Create(num_qubits);
+
+    FillRandomState(state_space, ref_state_space, rgen, state, ref_state);
+
+    unsigned max_gate_qubits2 = std::min(max_gate_qubits, num_qubits);
+
+    for (unsigned q = 1; q <= max_gate_qubits2; ++q) {
+      unsigned size1 = 1 << q;
+      unsigned max_minq = num_qubits - q;
+
+      for (unsigned k = 0; k <= max_minq; ++k) {
+        unsigned stride = q > 1 ? std::min(3u, (num_qubits - 1 - k) / (q - 1))
+                                : 1;
+
+        std::vector<unsigned> qubits;
+        std::vector<unsigned> paulis;
+
+        for (unsigned i = 0; i < q; ++i) {
+          qubits.push_back(k + i * stride);
+          paulis.push_back(1 + (i + k + q) % 3);
+        }
+
+        std::vector<fp_type> diag;
+        std::vector<unsigned> perm;
+
+        for (unsigned i = 0; i < size1; ++i) {
+          fp_type phi = 0.3 + 0.7 * i + 0.1 * k;
+          diag.push_back(std::cos(phi));
+          diag.push_back(std::sin(phi));
+          perm.push_back((5 * i + 3) % size1);
+        }
+
+        simulator.ApplyDiagonalGate(qubits, diag.data(), state);
+        ref_simulator.ApplyDiagonalGate(qubits, diag.data(), ref_state);
+
+        EXPECT_LT(StateDistance(state_space, ref_state_space,
+                                state, ref_state), 2 * eps);
+
+        CopyState(state_space, ref_state_space, state, ref_state);
+
+        simulator.ApplyPermutationGate(
+            qubits, perm.data(), diag.data(), state);
+        ref_simulator.ApplyPermutationGate(
+            qubits, perm.data(), diag.data(), ref_state);
+
+        EXPECT_LT(StateDistance(state_space, ref_state_space,
+                                state, ref_state), 2 * eps);
+
+        CopyState(state_space, ref_state_space, state, ref_state);
+
+        fp_type theta = 0.2 + 0.1 * q + 0.05 * k;
+
+        simulator.ApplyPauliRotation(qubits, paulis.data(), theta, state);
+        ref_simulator.ApplyPauliRotation(
+            qubits, paulis.data(), theta, ref_state);
+
+        EXPECT_LT(StateDistance(state_space, ref_state_space,
+                                state, ref_state), 2 * eps);
+
+        CopyState(state_space, ref_state_space, state, ref_state);
+
+        EXPECT_NEAR(
+            simulator.ExpectationValuePauli(qubits, paulis.data(), state),
+            ref_simulator.ExpectationValuePauli(
+                qubits, paulis.data(), ref_state), 1e-6);
+      }
+    }
+  }
+}
+
+template <typename Factory>
+void TestHalfRunner(const Factory& factory) {
+  using StateSpace = typename Factory::StateSpace;
+  using RefStateSpace = typename Factory::RefFactory::StateSpace;
+  using Gate = GateQSim<float>;
+  using Fuser = MultiQubitGateFuser<IO, Gate>;
+  using Runner = QSimRunner<IO, Fuser, Factory>;
+  using RefRunner = QSimRunner<IO, Fuser, typename Factory::RefFactory>;
+
+  unsigned num_qubits = 14;
+  unsigned depth = 16;
+
+  Circuit<Gate> circuit;
+  circuit.num_qubits = num_qubits;
+
+  for (unsigned q = 0; q < num_qubits; ++q) {
+    circuit.gates.push_back(GateHd<float>::Create(0, q));
+  }
+
+  for (unsigned t = 1; t <= depth; ++t) {
+    for (unsigned q = t % 2; q + 1 < num_qubits; q += 2) {
+      circuit.gates.push_back(GateCZ<float>::Create(2 * t - 1, q, q + 1));
+    }
+
+    for (unsigned q = 0; q < num_qubits; ++q) {
+      switch ((q + 3 * t) % 3) {
+      case 0:
+        circuit.gates.push_back(GateX2<float>::Create(2 * t, q));
+        break;
+      case 1:
+        circuit.gates.push_back(GateY2<float>::Create(2 * t, q));
+        break;
+      default:
+        circuit.gates.push_back(GateT<float>::Create(2 * t, q));
+        break;
+      }
+    }
+  }
+
+  StateSpace state_space = factory.CreateStateSpace();
+  RefStateSpace ref_state_space = factory.ref_factory.CreateStateSpace();
+
+  auto state = state_space.Create(num_qubits);
+  auto ref_state = ref_state_space.Create(num_qubits);
+
+  state_space.SetStateZero(state);
+  ref_state_space.SetStateZero(ref_state);
+
+  typename Runner::Parameter param;
+  param.max_fused_size = 3;
+  param.seed = 1;
+  param.verbosity = 0;
+
+  typename RefRunner::Parameter ref_param;
+  ref_param.max_fused_size = param.max_fused_size;
+  ref_param.seed = param.seed;
+  ref_param.verbosity = param.verbosity;
+
+  EXPECT_TRUE(Runner::Run(param, factory, circuit, state));
+  EXPECT_TRUE(RefRunner::Run(
+      ref_param, factory.ref_factory, circuit, ref_state));
+
+  std::complex<double> ip = 0;
+  uint64_t size = uint64_t{1} << num_qubits;
+
+  for (uint64_t i = 0; i < size; ++i) {
+    std::complex<double> a1 = state_space.GetAmpl(state, i);
+    std::complex<double> a2 = ref_state_space.GetAmpl(ref_state, i);
+    ip += std::conj(a2) * a1;
+  }
+
+  double eps = UnitRoundoff<StateSpace>();
+
+  // Rounding errors accumulate over the fused gates.
+  EXPECT_NEAR(state_space.Norm(state), 1, 0.1 * depth * eps);
+  EXPECT_GT(std::norm(ip), 1 - 0.1 * depth * eps);
+}
+
+}  // namespace qsim
+
+#endif  // SIMULATOR_HALF_TESTFIXTURE_H_
@@ -75,7 +75,19 @@ TYPED_TEST(SimulatorSSETest, CircuitWithControlledGatesDagger) {
 }
 
 TYPED_TEST(SimulatorSSETest, MultiQubitGates) {
-  TestMultiQubitGates(Factory<TypeParam>());
+  TestMultiQubitGates(Factory<TypeParam>(), 8);
+}
+
+TYPED_TEST(SimulatorSSETest, DiagonalGates) {
+  TestDiagonalGates(Factory<TypeParam>());
+}
+
+TYPED_TEST(SimulatorSSETest, PermutationGates) {
+  TestPermutationGates(Factory<TypeParam>());
+}
+
+TYPED_TEST(SimulatorSSETest, PauliRotations) {
+  TestPauliRotations(Factory<TypeParam>());
 }
 
 TYPED_TEST(SimulatorSSETest, ControlledGates) {
@@ -83,13 +95,25 @@ TYPED_TEST(SimulatorSSETest, ControlledGates) {
 }
 
 TYPED_TEST(SimulatorSSETest, ExpectationValue1) {
-  TestExpectationValue1(Factory<TypeParam>());
+  TestExpectationValue1(Factory<TypeParam>(), 8);
 }
 
 TYPED_TEST(SimulatorSSETest, ExpectationValue2) {
   TestExpectationValue2(Factory<TypeParam>());
 }
 
+TYPED_TEST(SimulatorSSETest, ExpectationValuePauli) {
+  TestExpectationValuePauli(Factory<TypeParam>());
+}
+
+TYPED_TEST(SimulatorSSETest, ReducedDensityMatrix) {
+  TestReducedDensityMatrix(Factory<TypeParam>());
+}
+
+TYPED_TEST(SimulatorSSETest, UnexpandedGates) {
+  TestUnexpandedGates<2>(Factory<TypeParam>());
+}
+
 }  // namespace qsim
 
 int main(int argc, char** argv) {
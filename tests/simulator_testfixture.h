@@ -27,6 +27,8 @@
 #include "../lib/gate_appl.h"
 #include "../lib/gates_qsim.h"
 #include "../lib/io.h"
+#include "../lib/seqfor.h"
+#include "../lib/simulator.h"
 #include "../lib/util_cpu.h"
 
 namespace qsim {
@@ -1142,12 +1144,11 @@ if __name__ == '__main__':
 }
 
 template <typename Factory>
-void TestMultiQubitGates(const Factory& factory) {
+void TestMultiQubitGates(const Factory& factory, unsigned max_gate_qubits = 6) {
   using Simulator = typename Factory::Simulator;
   using StateSpace = typename Simulator::StateSpace;
   using fp_type = typename StateSpace::fp_type;
 
-  unsigned max_gate_qubits = 6;
   unsigned max_num_qubits = 10 + std::log2(Simulator::SIMDRegisterSize());
 
   StateSpace state_space = factory.CreateStateSpace();
@@ -1210,6 +1211,381 @@ void TestMultiQubitGates(const Factory& factory) {
   }
 }
 
+// A simulator that applies diagonal gates only; diagonal matrices should
+// never reach the dense gate kernels.
+template <typename Simulator>
+struct DiagonalGateSimulator {
+  using State = typename Simulator::State;
+  using fp_type = typename Simulator::fp_type;
+
+  void ApplyGate(const std::vector<unsigned>& qs,
+                 const fp_type* matrix, State& state) const {
+    ADD_FAILURE() << "diagonal gate applied by the dense gate kernel";
+  }
+
+  void ApplyControlledGate(const std::vector<unsigned>& qs,
+                           const std::vector<unsigned>& cqs, uint64_t cvals,
+                           const fp_type* matrix, State& state) const {
+    ADD_FAILURE() << "diagonal gate applied by the dense gate kernel";
+  }
+
+  void ApplyDiagonalGate(const std::vector<unsigned>& qs,
+                         const fp_type* diag, State& state) const {
+    simulator.ApplyDiagonalGate(qs, diag, state);
+  }
+
+  const Simulator& simulator;
+};
+
+template <typename Factory>
+void TestDiagonalGates(const Factory& factory) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Simulator::StateSpace;
+  using fp_type = typename StateSpace::fp_type;
+
+  unsigned max_gate_qubits = 8;
+  unsigned max_num_qubits = 10 + std::log2(Simulator::SIMDRegisterSize());
+
+  StateSpace state_space = factory.CreateStateSpace();
+  Simulator simulator = factory.CreateSimulator();
+  DiagonalGateSimulator<Simulator> dsimulator{simulator};
+
+  std::vector<fp_type> diag;
+  diag.reserve(1 << (max_gate_qubits + 1));
+
+  std::vector<fp_type> matrix;
+  matrix.reserve(1 << (2 * max_gate_qubits + 1));
+
+  std::vector<unsigned> qubits;
+  qubits.reserve(max_gate_qubits);
+
+  std::vector<fp_type> vec1(state_space.MinSize(max_num_qubits));
+  std::vector<fp_type> vec2(state_space.MinSize(max_num_qubits));
+  std::vector<fp_type> vec3(state_space.MinSize(max_num_qubits));
+
+  for (unsigned num_qubits = 1; num_qubits <= max_num_qubits; ++num_qubits) {
+    auto state1 = state_space.Create(num_qubits);
+    auto state2 = state_space.Create(num_qubits);
+    auto state3 = state_space.Create(num_qubits);
+
+    unsigned size = 1 << num_qubits;
+    unsigned max_gate_qubits2 = std::min(max_gate_qubits, num_qubits);
+
+    for (unsigned q = 1; q <= max_gate_qubits2; ++q) {
+      unsigned size1 = 1 << q;
+
+      diag.resize(0);
+
+      for (unsigned i = 0; i < size1; ++i) {
+        fp_type phi = 0.3 + 0.7 * i;
+        diag.push_back(std::cos(phi));
+        diag.push_back(std::sin(phi));
+      }
+
+      matrix.resize(0);
+      matrix.resize(2 * size1 * size1, 0);
+
+      for (unsigned i = 0; i < size1; ++i) {
+        matrix[2 * (size1 * i + i)] = diag[2 * i];
+        matrix[2 * (size1 * i + i) + 1] = diag[2 * i + 1];
+      }
+
+      unsigned max_minq = num_qubits - q;
+
+      for (unsigned k = 0; k <= max_minq; ++k) {
+        // Spread the gate qubits over the state to mix low and high qubits.
+        unsigned stride = q > 1 ? std::min(3u, (num_qubits - 1 - k) / (q - 1))
+                                : 1;
+
+        qubits.resize(0);
+
+        for (unsigned i = 0; i < q; ++i) {
+          qubits.push_back(k + i * stride);
+        }
+
+        for (unsigned i = 0; i < size; ++i) {
+          vec1[2 * i] = std::cos(0.1 * i);
+          vec1[2 * i + 1] = std::sin(0.2 * i);
+        }
+
+        state_space.Copy(vec1.data(), state1);
+        state_space.NormalToInternalOrder(state1);
+        state_space.Copy(state1, state2);
+        state_space.Copy(state1, state3);
+
+        simulator.ApplyDiagonalGate(qubits, diag.data(), state1);
+        simulator.ApplyGate(qubits, matrix.data(), state2);
+        // Diagonal gate matrices of any size should be dispatched to
+        // the diagonal gate kernel.
+        detail::ApplyGateMatrix(dsimulator, qubits, {}, 0, matrix, state3);
+
+        state_space.InternalToNormalOrder(state1);
+        state_space.InternalToNormalOrder(state2);
+        state_space.InternalToNormalOrder(state3);
+        state_space.Copy(state1, vec1.data());
+        state_space.Copy(state2, vec2.data());
+        state_space.Copy(state3, vec3.data());
+
+        for (unsigned i = 0; i < 2 * size; ++i) {
+          EXPECT_NEAR(vec1[i], vec2[i], 1e-6);
+          EXPECT_NEAR(vec1[i], vec3[i], 1e-6);
+        }
+      }
+    }
+  }
+}
+
+template <typename Factory>
+void TestPermutationGates(const Factory& factory) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Simulator::StateSpace;
+  using fp_type = typename StateSpace::fp_type;
+
+  unsigned max_gate_qubits = 6;
+  unsigned max_num_qubits = 10 + std::log2(Simulator::SIMDRegisterSize());
+
+  StateSpace state_space = factory.CreateStateSpace();
+  Simulator simulator = factory.CreateSimulator();
+
+  std::vector<unsigned> perm;
+  perm.reserve(1 << max_gate_qubits);
+
+  std::vector<fp_type> phases;
+  phases.reserve(1 << (max_gate_qubits + 1));
+
+  std::vector<fp_type> matrix;
+  matrix.reserve(1 << (2 * max_gate_qubits + 1));
+
+  std::vector<unsigned> qubits;
+  qubits.reserve(max_gate_qubits);
+
+  std::vector<fp_type> vec1(state_space.MinSize(max_num_qubits));
+  std::vector<fp_type> vec2(state_space.MinSize(max_num_qubits));
+
+  for (unsigned num_qubits = 1; num_qubits <= max_num_qubits; ++num_qubits) {
+    auto state1 = state_space.Create(num_qubits);
+    auto state2 = state_space.Create(num_qubits);
+
+    unsigned size = 1 << num_qubits;
+    unsigned max_gate_qubits2 = std::min(max_gate_qubits, num_qubits);
+
+    for (unsigned q = 1; q <= max_gate_qubits2; ++q) {
+      unsigned size1 = 1 << q;
+
+      // A permutation that mixes all the gate qubits.
+      perm.resize(0);
+      phases.resize(0);
+
+      for (unsigned i = 0; i < size1; ++i) {
+        fp_type phi = 0.3 + 0.7 * i;
+        perm.push_back((5 * i + 3) % size1);
+        phases.push_back(std::cos(phi));
+        phases.push_back(std::sin(phi));
+      }
+
+      matrix.resize(0);
+      matrix.resize(2 * size1 * size1, 0);
+
+      for (unsigned i = 0; i < size1; ++i) {
+        matrix[2 * (size1 * i + perm[i])] = phases[2 * i];
+        matrix[2 * (size1 * i + perm[i]) + 1] = phases[2 * i + 1];
+      }
+
+      unsigned max_minq = num_qubits - q;
+
+      for (unsigned k = 0; k <= max_minq; ++k) {
+        // Spread the gate qubits over the state to mix low and high qubits.
+        unsigned stride = q > 1 ? std::min(3u, (num_qubits - 1 - k) / (q - 1))
+                                : 1;
+
+        qubits.resize(0);
+
+        for (unsigned i = 0; i < q; ++i) {
+          qubits.push_back(k + i * stride);
+        }
+
+        for (unsigned i = 0; i < size; ++i) {
+          vec1[2 * i] = std::cos(0.1 * i);
+          vec1[2 * i + 1] = std::sin(0.2 * i);
+        }
+
+        state_space.Copy(vec1.data(), state1);
+        state_space.NormalToInternalOrder(state1);
+        state_space.Copy(state1, state2);
+
+        simulator.ApplyPermutationGate(
+            qubits, perm.data(), phases.data(), state1);
+        simulator.ApplyGate(qubits, matrix.data(), state2);
+
+        state_space.InternalToNormalOrder(state1);
+        state_space.InternalToNormalOrder(state2);
+        state_space.Copy(state1, vec1.data());
+        state_space.Copy(state2, vec2.data());
+
+        for (unsigned i = 0; i < 2 * size; ++i) {
+          EXPECT_NEAR(vec1[i], vec2[i], 1e-6);
+        }
+      }
+    }
+  }
+}
+
+template <typename Factory>
+void TestPauliRotations(const Factory& factory) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Simulator::StateSpace;
+  using fp_type = typename StateSpace::fp_type;
+  using Gate = GateQSim<fp_type>;
+
+  unsigned max_gate_qubits = 8;
+  unsigned max_num_qubits = 9 + std::log2(Simulator::SIMDRegisterSize());
+
+  StateSpace state_space = factory.CreateStateSpace();
+  Simulator simulator = factory.CreateSimulator();
+
+  std::vector<unsigned> paulis;
+  std::vector<unsigned> qubits;
+
+  std::vector<fp_type> vec1(state_space.MinSize(max_num_qubits));
+  std::vector<fp_type> vec2(state_space.MinSize(max_num_qubits));
+  std::vector<fp_type> vec3(state_space.MinSize(max_num_qubits));
+
+  for (unsigned num_qubits = 1; num_qubits <= max_num_qubits; ++num_qubits) {
+    auto state1 = state_space.Create(num_qubits);
+    auto state2 = state_space.Create(num_qubits);
+    auto state3 = state_space.Create(num_qubits);
+
+    unsigned size = 1 << num_qubits;
+    unsigned max_gate_qubits2 = std::min(max_gate_qubits, num_qubits);
+
+    for (unsigned q = 1; q <= max_gate_qubits2; ++q) {
+      unsigned max_minq = num_qubits - q;
+
+      for (unsigned k = 0; k <= max_minq; ++k) {
+        // Spread the gate qubits over the state to mix low and high qubits.
+        unsigned stride = q > 1 ? std::min(3u, (num_qubits - 1 - k) / (q - 1))
+                                : 1;
+
+        qubits.resize(0);
+        paulis.resize(0);
+
+        for (unsigned i = 0; i < q; ++i) {
+          qubits.push_back(k + i * stride);
+          paulis.push_back(1 + (i + k + q) % 3);
+        }
+
+        fp_type theta = 0.2 + 0.1 * q + 0.05 * k;
+
+        for (unsigned i = 0; i < size; ++i) {
+          vec1[2 * i] = std::cos(0.1 * i);
+          vec1[2 * i + 1] = std::sin(0.2 * i);
+        }
+
+        state_space.Copy(vec1.data(), state1);
+        state_space.NormalToInternalOrder(state1);
+        state_space.Copy(state1, state2);
+        state_space.Copy(state1, state3);
+
+        simulator.ApplyPauliRotation(qubits, paulis.data(), theta, state1);
+        detail::ApplyPauliRotationGates(
+            simulator, qubits, {}, 0, paulis, theta, state2);
+
+        auto gate = gate::PauliRotation<Gate>::Create(
+            0, qubits, paulis, theta);
+
+        if (q <= gate::PauliRotation<Gate>::kMaxMatrixQubits) {
+          simulator.ApplyGate(qubits, gate.matrix.data(), state3);
+        } else {
+          EXPECT_EQ(gate.matrix.size(), 0);
+          ApplyGate(simulator, gate, state3);
+        }
+
+        state_space.InternalToNormalOrder(state1);
+        state_space.InternalToNormalOrder(state2);
+        state_space.InternalToNormalOrder(state3);
+        state_space.Copy(state1, vec1.data());
+        state_space.Copy(state2, vec2.data());
+        state_space.Copy(state3, vec3.data());
+
+        for (unsigned i = 0; i < 2 * size; ++i) {
+          EXPECT_NEAR(vec1[i], vec2[i], 1e-6);
+          EXPECT_NEAR(vec1[i], vec3[i], 1e-6);
+        }
+      }
+    }
+  }
+
+  unsigned num_qubits = 8;
+  unsigned size = 1 << num_qubits;
+
+  auto state1 = state_space.Create(num_qubits);
+  auto state2 = state_space.Create(num_qubits);
+
+  for (unsigned i = 0; i < size; ++i) {
+    vec1[2 * i] = std::cos(0.3 * i);
+    vec1[2 * i + 1] = std::sin(0.4 * i);
+  }
+
+  // Controlled Pauli rotations are applied as gate matrices (the first gate)
+  // or as sequences of one- and two-qubit gates (the second gate).
+  std::vector<Gate> gates = {
+    gate::PauliRotation<Gate>::Create(
+        0, {6, 1, 3}, {2, 1, 3}, 0.7).ControlledBy({0, 5}, {1, 0}),
+    gate::PauliRotation<Gate>::Create(
+        1, {7, 1, 2, 3, 4, 5, 6}, {1, 2, 3, 1, 2, 3, 1}, 0.4).ControlledBy({0}),
+  };
+
+  for (const auto& gate : gates) {
+    std::vector<unsigned> paulis(gate.params.begin() + 1, gate.params.end());
+
+    state_space.Copy(vec1.data(), state1);
+    state_space.NormalToInternalOrder(state1);
+    state_space.Copy(state1, state2);
+
+    ApplyGate(simulator, gate, state1);
+    simulator.ApplyPauliRotation(
+        gate.qubits, paulis.data(), gate.params[0], state2);
+
+    state_space.InternalToNormalOrder(state1);
+    state_space.InternalToNormalOrder(state2);
+    state_space.Copy(state1, vec2.data());
+    state_space.Copy(state2, vec3.data());
+
+    for (unsigned i = 0; i < size; ++i) {
+      bool active = true;
+
+      for (std::size_t j = 0; j < gate.controlled_by.size(); ++j) {
+        if (((i >> gate.controlled_by[j]) & 1) != ((gate.cmask >> j) & 1)) {
+          active = false;
+        }
+      }
+
+      // The rotation is applied only if the control values are matched.
+      const auto& v = active ? vec3 : vec1;
+
+      EXPECT_NEAR(vec2[2 * i], v[2 * i], 1e-6);
+      EXPECT_NEAR(vec2[2 * i + 1], v[2 * i + 1], 1e-6);
+    }
+  }
+
+  // The dagger of a Pauli rotation is its inverse.
+  auto gate = gate::PauliRotation<Gate>::Create(
+      0, {0, 1, 2, 4, 5, 6, 7}, {3, 2, 1, 1, 3, 2, 1}, 0.9);
+
+  state_space.Copy(vec1.data(), state1);
+  state_space.NormalToInternalOrder(state1);
+
+  ApplyGate(simulator, gate, state1);
+  ApplyGateDagger(simulator, gate, state1);
+
+  state_space.InternalToNormalOrder(state1);
+  state_space.Copy(state1, vec2.data());
+
+  for (unsigned i = 0; i < 2 * size; ++i) {
+    EXPECT_NEAR(vec1[i], vec2[i], 1e-6);
+  }
+}
+
 template <typename Factory>
 void TestControlledGates(const Factory& factory, bool high_precision) {
   using Simulator = typename Factory::Simulator;
@@ -1358,13 +1734,12 @@ void TestControlledGates(const Factory& factory, bool high_precision) {
 }
 
 template <typename Factory>
-void TestExpectationValue1(const Factory& factory) {
+void TestExpectationValue1(const Factory& factory, unsigned max_gate_qubits = 6) {
   using Simulator = typename Factory::Simulator;
   using StateSpace = typename Simulator::StateSpace;
   using fp_type = typename StateSpace::fp_type;
 
   unsigned rsize = std::log2(Simulator::SIMDRegisterSize());
-  unsigned max_gate_qubits = 6;
   unsigned max_num_qubits = 10 + rsize;
 
   StateSpace state_space = factory.CreateStateSpace();
@@ -1566,6 +1941,351 @@ for k in range(1, 7):
     EXPECT_NEAR(std::real(eval), expected_real[k - 1], 1e-6);
     EXPECT_NEAR(std::imag(eval), 0, 1e-8);
   }
+
+  // Pauli strings are not limited to six qubits.
+  State ket = state_space.Null();
+  typename Fuser::Parameter param;
+
+  for (unsigned k = 1; k <= num_qubits; ++k) {
+    std::vector<OpString<GateQSim<fp_type>>> strings;
+    std::vector<PauliString> pauli_strings;
+
+    for (unsigned i = 0; i <= num_qubits - k; ++i) {
+      strings.push_back({{0.1 + 0.2 * i, 0}, {}});
+      pauli_strings.push_back({{0.1 + 0.2 * i, 0}, {}, {}});
+
+      for (unsigned j = 0; j < k; ++j) {
+        switch (j % 3) {
+        case 0:
+          strings.back().ops.push_back(GateX<fp_type>::Create(0, i + j));
+          break;
+        case 1:
+          strings.back().ops.push_back(GateY<fp_type>::Create(0, i + j));
+          break;
+        case 2:
+          strings.back().ops.push_back(GateZ<fp_type>::Create(0, i + j));
+          break;
+        }
+
+        pauli_strings.back().qubits.push_back(i + j);
+        pauli_strings.back().paulis.push_back(1 + j % 3);
+      }
+    }
+
+    auto eval = ExpectationValue<IO>(pauli_strings, simulator, state);
+
+    if (k <= 6) {
+      EXPECT_NEAR(std::real(eval), expected_real[k - 1], 1e-6);
+    }
+
+    auto expected = ExpectationValue<IO, Fuser>(
+        param, strings, state_space, simulator, state, ket);
+
+    EXPECT_NEAR(std::real(eval), std::real(expected), 1e-6);
+    EXPECT_NEAR(std::imag(eval), 0, 1e-8);
+  }
+}
+
+template <typename Factory>
+void TestExpectationValuePauli(const Factory& factory) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Simulator::StateSpace;
+  using fp_type = typename StateSpace::fp_type;
+
+  unsigned max_num_qubits = 9 + std::log2(Simulator::SIMDRegisterSize());
+
+  StateSpace state_space = factory.CreateStateSpace();
+  Simulator simulator = factory.CreateSimulator();
+
+  std::vector<unsigned> paulis;
+  std::vector<unsigned> qubits;
+
+  std::vector<fp_type> vec(state_space.MinSize(max_num_qubits));
+
+  for (unsigned num_qubits = 1; num_qubits <= max_num_qubits; ++num_qubits) {
+    auto state1 = state_space.Create(num_qubits);
+    auto state2 = state_space.Create(num_qubits);
+
+    unsigned size = 1 << num_qubits;
+    fp_type norm = 1 / std::sqrt(fp_type(size));
+
+    for (unsigned i = 0; i < size; ++i) {
+      vec[2 * i] = norm * std::cos(0.1 * i);
+      vec[2 * i + 1] = norm * std::sin(0.2 * i);
+    }
+
+    state_space.Copy(vec.data(), state1);
+    state_space.NormalToInternalOrder(state1);
+
+    for (unsigned q = 1; q <= num_qubits; ++q) {
+      for (unsigned k = 0; k <= num_qubits - q; ++k) {
+        // Spread the qubits over the state to mix low and high qubits.
+        unsigned stride = q > 1 ? std::min(3u, (num_qubits - 1 - k) / (q - 1))
+                                : 1;
+
+        qubits.resize(0);
+        paulis.resize(0);
+
+        state_space.Copy(state1, state2);
+
+        for (unsigned i = 0; i < q; ++i) {
+          unsigned qubit = k + i * stride;
+          unsigned pauli = (i + k + q) % 4;
+
+          qubits.push_back(qubit);
+          paulis.push_back(pauli);
+
+          switch (pauli) {
+          case 1:
+            ApplyGate(simulator, GateX<fp_type>::Create(0, qubit), state2);
+            break;
+          case 2:
+            ApplyGate(simulator, GateY<fp_type>::Create(0, qubit), state2);
+            break;
+          case 3:
+            ApplyGate(simulator, GateZ<fp_type>::Create(0, qubit), state2);
+            break;
+          }
+        }
+
+        auto eval = simulator.ExpectationValuePauli(
+            qubits, paulis.data(), state1);
+        auto expected = state_space.InnerProduct(state1, state2);
+
+        EXPECT_NEAR(eval, std::real(expected), 1e-6);
+        EXPECT_NEAR(std::imag(expected), 0, 1e-6);
+      }
+    }
+  }
+
+  // Pauli strings with the same X and Y operators are evaluated together;
+  // 21 strings are evaluated in batches of 16, 4 and 1 strings.
+  unsigned num_qubits = max_num_qubits;
+  uint64_t full_mask = (uint64_t{1} << num_qubits) - 1;
+
+  auto state1 = state_space.Create(num_qubits);
+  auto state2 = state_space.Create(num_qubits);
+
+  unsigned size = 1 << num_qubits;
+  fp_type norm = 1 / std::sqrt(fp_type(size));
+
+  for (unsigned i = 0; i < size; ++i) {
+    vec[2 * i] = norm * std::cos(0.3 * i);
+    vec[2 * i + 1] = norm * std::sin(0.4 * i);
+  }
+
+  state_space.Copy(vec.data(), state1);
+  state_space.NormalToInternalOrder(state1);
+
+  std::vector<uint64_t> xmasks = {0, 5, 0x188 & full_mask, full_mask - 2};
+
+  for (uint64_t xmask : xmasks) {
+    std::vector<uint64_t> zmasks;
+
+    for (unsigned k = 0; k < 21; ++k) {
+      zmasks.push_back((0x9e3779b9 * (k + 1) >> 7) & full_mask);
+    }
+
+    auto evals = simulator.ExpectationValuesPauli(xmask, zmasks, state1);
+
+    ASSERT_EQ(evals.size(), zmasks.size());
+
+    for (unsigned k = 0; k < zmasks.size(); ++k) {
+      state_space.Copy(state1, state2);
+
+      for (unsigned q = 0; q < num_qubits; ++q) {
+        unsigned pauli = ((xmask >> q) & 1) + 2 * ((zmasks[k] >> q) & 1);
+
+        // pauli is 1 for X, 2 for Z and 3 for Y here.
+        switch (pauli) {
+        case 1:
+          ApplyGate(simulator, GateX<fp_type>::Create(0, q), state2);
+          break;
+        case 2:
+          ApplyGate(simulator, GateZ<fp_type>::Create(0, q), state2);
+          break;
+        case 3:
+          ApplyGate(simulator, GateY<fp_type>::Create(0, q), state2);
+          break;
+        }
+      }
+
+      auto expected = state_space.InnerProduct(state1, state2);
+
+      EXPECT_NEAR(evals[k], std::real(expected), 1e-6);
+    }
+  }
+}
+
+template <typename Factory>
+void TestReducedDensityMatrix(const Factory& factory) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Simulator::StateSpace;
+  using fp_type = typename StateSpace::fp_type;
+
+  unsigned max_num_qubits = 6 + std::log2(Simulator::SIMDRegisterSize());
+
+  StateSpace state_space = factory.CreateStateSpace();
+  Simulator simulator = factory.CreateSimulator();
+
+  std::vector<unsigned> qubits;
+  std::vector<fp_type> vec(state_space.MinSize(max_num_qubits));
+
+  for (unsigned num_qubits = 1; num_qubits <= max_num_qubits; ++num_qubits) {
+    auto state = state_space.Create(num_qubits);
+
+    unsigned size = 1 << num_qubits;
+    fp_type norm = 1 / std::sqrt(fp_type(size));
+
+    for (unsigned i = 0; i < size; ++i) {
+      vec[2 * i] = norm * std::cos(0.1 * i);
+      vec[2 * i + 1] = norm * std::sin(0.2 * i);
+    }
+
+    state_space.Copy(vec.data(), state);
+    state_space.NormalToInternalOrder(state);
+
+    for (unsigned q = 0; q <= std::min(num_qubits, 4u); ++q) {
+      for (unsigned k = 0; k <= num_qubits - q; ++k) {
+        // Spread the qubits over the state to mix low and high qubits.
+        unsigned stride = q > 1 ? std::min(3u, (num_qubits - 1 - k) / (q - 1))
+                                : 1;
+
+        qubits.resize(0);
+
+        for (unsigned i = 0; i < q; ++i) {
+          qubits.push_back(k + i * stride);
+        }
+
+        auto rho = simulator.ReducedDensityMatrix(qubits, state);
+
+        unsigned dsize = 1 << q;
+        ASSERT_EQ(rho.size(), dsize * dsize);
+
+        uint64_t mask = 0;
+        for (unsigned qubit : qubits) {
+          mask |= uint64_t{1} << qubit;
+        }
+
+        for (unsigned r = 0; r < dsize; ++r) {
+          for (unsigned c = 0; c < dsize; ++c) {
+            uint64_t ir = 0;
+            uint64_t ic = 0;
+
+            for (unsigned j = 0; j < q; ++j) {
+              ir |= uint64_t((r >> j) & 1) << qubits[j];
+              ic |= uint64_t((c >> j) & 1) << qubits[j];
+            }
+
+            std::complex<double> expected = 0;
+
+            for (uint64_t i = 0; i < size; ++i) {
+              if ((i & mask) != 0) continue;
+
+              std::complex<double> ar(vec[2 * (i | ir)],
+                                      vec[2 * (i | ir) + 1]);
+              std::complex<double> ac(vec[2 * (i | ic)],
+                                      vec[2 * (i | ic) + 1]);
+
+              expected += ar * std::conj(ac);
+            }
+
+            EXPECT_NEAR(std::real(rho[r * dsize + c]), std::real(expected),
+                        1e-6);
+            EXPECT_NEAR(std::imag(rho[r * dsize + c]), std::imag(expected),
+                        1e-6);
+          }
+        }
+      }
+    }
+  }
+
+  // Too many qubits.
+  auto state = state_space.Create(max_num_qubits);
+  state_space.SetStateZero(state);
+  EXPECT_TRUE(simulator.ReducedDensityMatrix({0, 1, 2, 3, 4}, state).empty());
+}
+
+// Exposes the kernels the SIMD simulators fall back to if the expanded
+// matrix cannot be allocated.
+struct UnexpandedKernels : public SimulatorBase {
+  using SimulatorBase::ApplyGateUnexpanded;
+  using SimulatorBase::ExpectationValueUnexpanded;
+};
+
+template <unsigned R, typename Factory>
+void TestUnexpandedGates(const Factory& factory) {
+  using Simulator = typename Factory::Simulator;
+  using StateSpace = typename Simulator::StateSpace;
+  using fp_type = typename StateSpace::fp_type;
+
+  unsigned max_gate_qubits = 8;
+  unsigned num_qubits = 11 + R;
+
+  StateSpace state_space = factory.CreateStateSpace();
+  Simulator simulator = factory.CreateSimulator();
+  SequentialFor for_(1);
+
+  auto state1 = state_space.Create(num_qubits);
+  auto state2 = state_space.Create(num_qubits);
+
+  uint64_t size = uint64_t{1} << num_qubits;
+  std::vector<fp_type> vec1(state_space.MinSize(num_qubits));
+  std::vector<fp_type> vec2(state_space.MinSize(num_qubits));
+
+  std::vector<fp_type> matrix;
+  std::vector<unsigned> qubits;
+
+  for (unsigned q = 1; q <= max_gate_qubits; ++q) {
+    unsigned size1 = 1 << q;
+
+    matrix.resize(0);
+
+    for (unsigned i = 0; i < 2 * size1 * size1; ++i) {
+      matrix.push_back(std::cos(0.3 * i) / size1);
+    }
+
+    for (unsigned k = 0; k + q <= num_qubits; k += 2) {
+      // Spread the gate qubits over the state to mix low and high qubits.
+      unsigned stride = q > 1 ? std::min(2u, (num_qubits - 1 - k) / (q - 1))
+                              : 1;
+
+      qubits.resize(0);
+
+      for (unsigned i = 0; i < q; ++i) {
+        qubits.push_back(k + i * stride);
+      }
+
+      for (uint64_t i = 0; i < size; ++i) {
+        vec1[2 * i] = std::cos(0.1 * i);
+        vec1[2 * i + 1] = std::sin(0.2 * i);
+      }
+
+      state_space.Copy(vec1.data(), state1);
+      state_space.NormalToInternalOrder(state1);
+      state_space.Copy(state1, state2);
+
+      auto eval1 = simulator.ExpectationValue(qubits, matrix.data(), state1);
+      auto eval2 = UnexpandedKernels::ExpectationValueUnexpanded<R>(
+          for_, num_qubits, qubits, matrix.data(), state2.get());
+
+      EXPECT_NEAR(std::real(eval1), std::real(eval2), 1e-6 * size);
+      EXPECT_NEAR(std::imag(eval1), std::imag(eval2), 1e-6 * size);
+
+      simulator.ApplyGate(qubits, matrix.data(), state1);
+      UnexpandedKernels::ApplyGateUnexpanded<R>(
+          for_, num_qubits, qubits, matrix.data(), state2.get());
+
+      state_space.InternalToNormalOrder(state1);
+      state_space.InternalToNormalOrder(state2);
+      state_space.Copy(state1, vec1.data());
+      state_space.Copy(state2, vec2.data());
+
+      for (uint64_t i = 0; i < 2 * size; ++i) {
+        EXPECT_NEAR(vec1[i], vec2[i], 1e-5);
+      }
+    }
+  }
 }
 
 }  // namespace qsim
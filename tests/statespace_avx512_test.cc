@@ -30,16 +30,9 @@ namespace qsim {
 template <class T>
 class StateSpaceAVX512Test : public testing::Test {};
 
-using ::testing::Types;
-#ifdef _OPENMP
-typedef Types<ParallelFor, SequentialFor> for_impl;
-#else
-typedef Types<SequentialFor> for_impl;
-#endif
-
-template <typename For>
+template <typename For, typename FP>
 struct Factory {
-  using Simulator = SimulatorAVX512<For>;
+  using Simulator = SimulatorAVX512<For, FP>;
   using StateSpace = typename Simulator::StateSpace;
 
   static StateSpace CreateStateSpace() {
@@ -51,66 +44,76 @@ struct Factory {
   }
 };
 
-TYPED_TEST_SUITE(StateSpaceAVX512Test, for_impl);
+using ::testing::Types;
+#ifdef _OPENMP
+typedef Types<Factory<ParallelFor, float>, Factory<ParallelFor, double>,
+              Factory<SequentialFor, float>, Factory<SequentialFor, double>>
+    factory_impl;
+#else
+typedef Types<Factory<SequentialFor, float>, Factory<SequentialFor, double>>
+    factory_impl;
+#endif
+
+TYPED_TEST_SUITE(StateSpaceAVX512Test, factory_impl);
 
 TYPED_TEST(StateSpaceAVX512Test, Add) {
-  TestAdd(Factory<TypeParam>());
+  TestAdd(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVX512Test, NormSmall) {
-  TestNormSmall(Factory<TypeParam>());
+  TestNormSmall(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVX512Test, NormAndInnerProductSmall) {
-  TestNormAndInnerProductSmall(Factory<TypeParam>());
+  TestNormAndInnerProductSmall(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVX512Test, NormAndInnerProduct) {
-  TestNormAndInnerProduct(Factory<TypeParam>());
+  TestNormAndInnerProduct(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVX512Test, SamplingSmall) {
-  TestSamplingSmall(Factory<TypeParam>());
+  TestSamplingSmall(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVX512Test, SamplingCrossEntropyDifference) {
-  TestSamplingCrossEntropyDifference(Factory<TypeParam>());
+  TestSamplingCrossEntropyDifference(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVX512Test, Ordering) {
-  TestOrdering(Factory<TypeParam>());
+  TestOrdering(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVX512Test, MeasurementSmall) {
-  TestMeasurementSmall(Factory<TypeParam>());
+  TestMeasurementSmall(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVX512Test, MeasurementLarge) {
-  TestMeasurementLarge(Factory<TypeParam>());
+  TestMeasurementLarge(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVX512Test, Collapse) {
-  TestCollapse(Factory<TypeParam>());
+  TestCollapse(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVX512Test, InvalidStateSize) {
-  TestInvalidStateSize(Factory<TypeParam>());
+  TestInvalidStateSize(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVX512Test, BulkSetAmpl) {
-  TestBulkSetAmplitude(Factory<TypeParam>());
+  TestBulkSetAmplitude(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVX512Test, BulkSetAmplExclude) {
-  TestBulkSetAmplitudeExclusion(Factory<TypeParam>());
+  TestBulkSetAmplitudeExclusion(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVX512Test, BulkSetAmplDefault) {
-  TestBulkSetAmplitudeDefault(Factory<TypeParam>());
+  TestBulkSetAmplitudeDefault(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVX512Test, ThreadThrashing) {
-  TestThreadThrashing<StateSpaceAVX512<TypeParam>>();
+  TestThreadThrashing<typename TypeParam::StateSpace>();
 }
 
 }  // namespace qsim
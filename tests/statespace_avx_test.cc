@@ -28,16 +28,9 @@ namespace qsim {
 template <class T>
 class StateSpaceAVXTest : public testing::Test {};
 
-using ::testing::Types;
-#ifdef _OPENMP
-typedef Types<ParallelFor, SequentialFor> for_impl;
-#else
-typedef Types<SequentialFor> for_impl;
-#endif
-
-template <typename For>
+template <typename For, typename FP>
 struct Factory {
-  using Simulator = SimulatorAVX<For>;
+  using Simulator = SimulatorAVX<For, FP>;
   using StateSpace = typename Simulator::StateSpace;
 
   static StateSpace CreateStateSpace() {
@@ -49,66 +42,76 @@ struct Factory {
   }
 };
 
-TYPED_TEST_SUITE(StateSpaceAVXTest, for_impl);
+using ::testing::Types;
+#ifdef _OPENMP
+typedef Types<Factory<ParallelFor, float>, Factory<ParallelFor, double>,
+              Factory<SequentialFor, float>, Factory<SequentialFor, double>>
+    factory_impl;
+#else
+typedef Types<Factory<SequentialFor, float>, Factory<SequentialFor, double>>
+    factory_impl;
+#endif
+
+TYPED_TEST_SUITE(StateSpaceAVXTest, factory_impl);
 
 TYPED_TEST(StateSpaceAVXTest, Add) {
-  TestAdd(Factory<TypeParam>());
+  TestAdd(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVXTest, NormSmall) {
-  TestNormSmall(Factory<TypeParam>());
+  TestNormSmall(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVXTest, NormAndInnerProductSmall) {
-  TestNormAndInnerProductSmall(Factory<TypeParam>());
+  TestNormAndInnerProductSmall(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVXTest, NormAndInnerProduct) {
-  TestNormAndInnerProduct(Factory<TypeParam>());
+  TestNormAndInnerProduct(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVXTest, SamplingSmall) {
-  TestSamplingSmall(Factory<TypeParam>());
+  TestSamplingSmall(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVXTest, SamplingCrossEntropyDifference) {
-  TestSamplingCrossEntropyDifference(Factory<TypeParam>());
+  TestSamplingCrossEntropyDifference(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVXTest, Ordering) {
-  TestOrdering(Factory<TypeParam>());
+  TestOrdering(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVXTest, MeasurementSmall) {
-  TestMeasurementSmall(Factory<TypeParam>());
+  TestMeasurementSmall(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVXTest, MeasurementLarge) {
-  TestMeasurementLarge(Factory<TypeParam>());
+  TestMeasurementLarge(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVXTest, Collapse) {
-  TestCollapse(Factory<TypeParam>());
+  TestCollapse(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVXTest, InvalidStateSize) {
-  TestInvalidStateSize(Factory<TypeParam>());
+  TestInvalidStateSize(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVXTest, BulkSetAmpl) {
-  TestBulkSetAmplitude(Factory<TypeParam>());
+  TestBulkSetAmplitude(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVXTest, BulkSetAmplExclude) {
-  TestBulkSetAmplitudeExclusion(Factory<TypeParam>());
+  TestBulkSetAmplitudeExclusion(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVXTest, BulkSetAmplDefault) {
-  TestBulkSetAmplitudeDefault(Factory<TypeParam>());
+  TestBulkSetAmplitudeDefault(TypeParam());
 }
 
 TYPED_TEST(StateSpaceAVXTest, ThreadThrashing) {
-  TestThreadThrashing<StateSpaceAVX<TypeParam>>();
+  TestThreadThrashing<typename TypeParam::StateSpace>();
 }
 
 }  // namespace qsim
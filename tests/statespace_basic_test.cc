@@ -19,6 +19,7 @@
 #ifdef _OPENMP
 #include "../lib/parfor.h"
 #endif
+#include "../lib/poolfor.h"
 #include "../lib/seqfor.h"
 #include "../lib/simulator_basic.h"
 #include "../lib/statespace_basic.h"
@@ -30,9 +31,9 @@ class StateSpaceBasicTest : public testing::Test {};
 
 using ::testing::Types;
 #ifdef _OPENMP
-typedef Types<ParallelFor, SequentialFor> for_impl;
+typedef Types<ParallelFor, PoolFor, SequentialFor> for_impl;
 #else
-typedef Types<SequentialFor> for_impl;
+typedef Types<PoolFor, SequentialFor> for_impl;
 #endif
 
 template <typename For>
@@ -1045,6 +1045,7 @@ void TestBulkSetAmplitudeDefault(const Factory& factory) {
 template <typename StateSpace>
 void TestThreadThrashing() {
   using State = typename StateSpace::State;
+  using fp_type = typename StateSpace::fp_type;
 
   StateSpace state_space(1024);
 
@@ -1055,11 +1056,11 @@ void TestThreadThrashing() {
     state_space.SetStateZero(state);
   }
 
-  EXPECT_EQ(state_space.GetAmpl(state, 0), std::complex<float>(1, 0));
+  EXPECT_EQ(state_space.GetAmpl(state, 0), std::complex<fp_type>(1, 0));
 
   unsigned size = 1 << num_qubits;
   for (unsigned i = 1; i < size; ++i) {
-    EXPECT_EQ(state_space.GetAmpl(state, i), std::complex<float>(0, 0));
+    EXPECT_EQ(state_space.GetAmpl(state, i), std::complex<fp_type>(0, 0));
   }
 }
 
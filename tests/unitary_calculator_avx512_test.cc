@@ -25,36 +25,45 @@ namespace qsim {
 namespace unitary {
 namespace {
 
-TEST(UnitaryCalculatorAVX512Test, ApplyGate1) {
-  TestApplyGate1<UnitaryCalculatorAVX512<For>>();
+template <class T>
+class UnitaryCalculatorAVX512Test : public testing::Test {};
+
+using ::testing::Types;
+typedef Types<UnitaryCalculatorAVX512<For, float>,
+              UnitaryCalculatorAVX512<For, double>> fp_impl;
+
+TYPED_TEST_SUITE(UnitaryCalculatorAVX512Test, fp_impl);
+
+TYPED_TEST(UnitaryCalculatorAVX512Test, ApplyGate1) {
+  TestApplyGate1<TypeParam>();
 }
 
-TEST(UnitaryCalculatorAVX512Test, ApplyControlledGate1) {
-  TestApplyControlledGate1<UnitaryCalculatorAVX512<For>>();
+TYPED_TEST(UnitaryCalculatorAVX512Test, ApplyControlledGate1) {
+  TestApplyControlledGate1<TypeParam>();
 }
 
-TEST(UnitaryCalculatorAVX512Test, ApplyGate2) {
-  TestApplyGate2<UnitaryCalculatorAVX512<For>>();
+TYPED_TEST(UnitaryCalculatorAVX512Test, ApplyGate2) {
+  TestApplyGate2<TypeParam>();
 }
 
-TEST(UnitaryCalculatorAVX512Test, ApplyControlledGate2) {
-  TestApplyControlledGate2<UnitaryCalculatorAVX512<For>>();
+TYPED_TEST(UnitaryCalculatorAVX512Test, ApplyControlledGate2) {
+  TestApplyControlledGate2<TypeParam>();
 }
 
-TEST(UnitaryCalculatorAVX512Test, ApplyFusedGate) {
-  TestApplyFusedGate<UnitaryCalculatorAVX512<For>>();
+TYPED_TEST(UnitaryCalculatorAVX512Test, ApplyFusedGate) {
+  TestApplyFusedGate<TypeParam>();
 }
 
-TEST(UnitaryCalculatorAVX512Test, ApplyGates) {
-  TestApplyGates<UnitaryCalculatorAVX512<For>>(false);
+TYPED_TEST(UnitaryCalculatorAVX512Test, ApplyGates) {
+  TestApplyGates<TypeParam>(false);
 }
 
-TEST(UnitaryCalculatorAVX512Test, ApplyControlledGates) {
-  TestApplyControlledGates<UnitaryCalculatorAVX512<For>>(false);
+TYPED_TEST(UnitaryCalculatorAVX512Test, ApplyControlledGates) {
+  TestApplyControlledGates<TypeParam>(false);
 }
 
-TEST(UnitaryCalculatorAVX512Test, SmallCircuits) {
-  TestSmallCircuits<UnitaryCalculatorAVX512<For>>();
+TYPED_TEST(UnitaryCalculatorAVX512Test, SmallCircuits) {
+  TestSmallCircuits<TypeParam>();
 }
 
 }  // namespace
@@ -23,36 +23,45 @@ namespace qsim {
 namespace unitary {
 namespace {
 
-TEST(UnitaryCalculatorAVXTest, ApplyGate1) {
-  TestApplyGate1<UnitaryCalculatorAVX<For>>();
+template <class T>
+class UnitaryCalculatorAVXTest : public testing::Test {};
+
+using ::testing::Types;
+typedef Types<UnitaryCalculatorAVX<For, float>,
+              UnitaryCalculatorAVX<For, double>> fp_impl;
+
+TYPED_TEST_SUITE(UnitaryCalculatorAVXTest, fp_impl);
+
+TYPED_TEST(UnitaryCalculatorAVXTest, ApplyGate1) {
+  TestApplyGate1<TypeParam>();
 }
 
-TEST(UnitaryCalculatorAVXTest, ApplyControlledGate1) {
-  TestApplyControlledGate1<UnitaryCalculatorAVX<For>>();
+TYPED_TEST(UnitaryCalculatorAVXTest, ApplyControlledGate1) {
+  TestApplyControlledGate1<TypeParam>();
 }
 
-TEST(UnitaryCalculatorAVXTest, ApplyGate2) {
-  TestApplyGate2<UnitaryCalculatorAVX<For>>();
+TYPED_TEST(UnitaryCalculatorAVXTest, ApplyGate2) {
+  TestApplyGate2<TypeParam>();
 }
 
-TEST(UnitaryCalculatorAVXTest, ApplyControlledGate2) {
-  TestApplyControlledGate2<UnitaryCalculatorAVX<For>>();
+TYPED_TEST(UnitaryCalculatorAVXTest, ApplyControlledGate2) {
+  TestApplyControlledGate2<TypeParam>();
 }
 
-TEST(UnitaryCalculatorAVXTest, ApplyFusedGate) {
-  TestApplyFusedGate<UnitaryCalculatorAVX<For>>();
+TYPED_TEST(UnitaryCalculatorAVXTest, ApplyFusedGate) {
+  TestApplyFusedGate<TypeParam>();
 }
 
-TEST(UnitaryCalculatorAVXTest, ApplyGates) {
-  TestApplyGates<UnitaryCalculatorAVX<For>>(false);
+TYPED_TEST(UnitaryCalculatorAVXTest, ApplyGates) {
+  TestApplyGates<TypeParam>(false);
 }
 
-TEST(UnitaryCalculatorAVXTest, ApplyControlledGates) {
-  TestApplyControlledGates<UnitaryCalculatorAVX<For>>(false);
+TYPED_TEST(UnitaryCalculatorAVXTest, ApplyControlledGates) {
+  TestApplyControlledGates<TypeParam>(false);
 }
 
-TEST(UnitaryCalculatorAVXTest, SmallCircuits) {
-  TestSmallCircuits<UnitaryCalculatorAVX<For>>();
+TYPED_TEST(UnitaryCalculatorAVXTest, SmallCircuits) {
+  TestSmallCircuits<TypeParam>();
 }
 
 }  // namespace
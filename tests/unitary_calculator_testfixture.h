@@ -53,14 +53,14 @@ void FillMatrix2(UnitarySpace& us, Unitary& u, uint64_t size, uint64_t delta) {
   }
 }
 
-template <typename UnitarySpace, typename Unitary>
-void EUnitaryEQ(UnitarySpace& us, Unitary& u, int n, float* expected) {
+template <typename UnitarySpace, typename Unitary, typename fp_type>
+void EUnitaryEQ(UnitarySpace& us, Unitary& u, int n, fp_type* expected) {
   for (int i = 0; i < (1 << n); i++) {
     for (int j = 0; j < (1 << n); j++) {
       int ind = 2 * j * (1 << n) + 2 * i;
       auto out = us.GetEntry(u, i, j);
-      std::complex<float> e_val =
-          std::complex<float>(expected[ind], expected[ind + 1]);
+      std::complex<fp_type> e_val =
+          std::complex<fp_type>(expected[ind], expected[ind + 1]);
       EXPECT_EQ(out, e_val) << "Mismatch in unitary at: " << i << "," << j
                             << " Expected: " << e_val << " Got: " << out;
     }
@@ -75,17 +75,18 @@ void TestApplyGate1() {
 
   using UnitarySpace = typename UC::UnitarySpace;
   using Unitary = typename UC::Unitary;
+  using fp_type = typename UC::fp_type;
 
   UC uc(1);
   UnitarySpace us(1);
   Unitary u = us.CreateUnitary(num_qubits);
 
-  float ref_gate[] = {1, 2, 3, 4, 5, 6, 7, 8};
+  fp_type ref_gate[] = {1, 2, 3, 4, 5, 6, 7, 8};
 
   // Test applying on qubit 0.
   FillMatrix(us, u, num_qubits);
   // clang-format off
-  float expected_mat_0[] = {
+  fp_type expected_mat_0[] = {
     -22,116,-26,136,-30,156,-34,176,-38,196,-42,216,-46,236,-50,256,
     -30,252,-34,304,-38,356,-42,408,-46,460,-50,512,-54,564,-58,616,
     -86,436,-90,456,-94,476,-98,496,-102,516,-106,536,-110,556,-114,576,
@@ -102,7 +103,7 @@ void TestApplyGate1() {
   // Test applying on qubit 1.
   FillMatrix(us, u, num_qubits);
   // clang-format off
-  float expected_mat_1[] = {
+  fp_type expected_mat_1[] = {
     -38,228,-42,248,-46,268,-50,288,-54,308,-58,328,-62,348,-66,368,
     -70,388,-74,408,-78,428,-82,448,-86,468,-90,488,-94,508,-98,528,
     -46,492,-50,544,-54,596,-58,648,-62,700,-66,752,-70,804,-74,856,
@@ -119,7 +120,7 @@ void TestApplyGate1() {
   // Test applying on qubit 2.
   FillMatrix(us, u, num_qubits);
   // clang-format off
-  float expected_mat_2[] = {
+  fp_type expected_mat_2[] = {
     -70,452,-74,472,-78,492,-82,512,-86,532,-90,552,-94,572,-98,592,
     -102,612,-106,632,-110,652,-114,672,-118,692,-122,712,-126,732,-130,752,
     -134,772,-138,792,-142,812,-146,832,-150,852,-154,872,-158,892,-162,912,
@@ -140,17 +141,18 @@ void TestApplyControlledGate1() {
 
   using UnitarySpace = typename UC::UnitarySpace;
   using Unitary = typename UC::Unitary;
+  using fp_type = typename UC::fp_type;
 
   UC uc(1);
   UnitarySpace us(1);
   Unitary u = us.CreateUnitary(num_qubits);
 
-  float ref_gate[] = {1, 2, 3, 4, 5, 6, 7, 8};
+  fp_type ref_gate[] = {1, 2, 3, 4, 5, 6, 7, 8};
 
   // Test applying on qubit 0 controlling 1.
   FillMatrix(us, u, num_qubits);
   // clang-format off
-  float expected_mat_0[] = {
+  fp_type expected_mat_0[] = {
     0.0,1.0,2.0,3.0,4.0,5.0,6.0,7.0,8.0,9.0,10.0,11.0,12.0,13.0,14.0,15.0,
     16.0,17.0,18.0,19.0,20.0,21.0,22.0,23.0,24.0,25.0,26.0,27.0,28.0,29.0,30.0,31.0,
     -86.0,436.0,-90.0,456.0,-94.0,476.0,-98.0,496.0,-102.0,516.0,-106.0,536.0,-110.0,556.0,-114.0,576.0,
@@ -167,7 +169,7 @@ void TestApplyControlledGate1() {
   // Test applying on qubit 0 controlling 2.
   FillMatrix(us, u, num_qubits);
   // clang-format off
-  float expected_mat_1[] = {
+  fp_type expected_mat_1[] = {
     0.0,1.0,2.0,3.0,4.0,5.0,6.0,7.0,8.0,9.0,10.0,11.0,12.0,13.0,14.0,15.0,
     16.0,17.0,18.0,19.0,20.0,21.0,22.0,23.0,24.0,25.0,26.0,27.0,28.0,29.0,30.0,31.0,
     32.0,33.0,34.0,35.0,36.0,37.0,38.0,39.0,40.0,41.0,42.0,43.0,44.0,45.0,46.0,47.0,
@@ -184,7 +186,7 @@ void TestApplyControlledGate1() {
   // Test applying on qubit 0 controlling on 1 and 2.
   FillMatrix(us, u, num_qubits);
   // clang-format off
-  float expected_mat_2[] = {
+  fp_type expected_mat_2[] = {
     0.0,1.0,2.0,3.0,4.0,5.0,6.0,7.0,8.0,9.0,10.0,11.0,12.0,13.0,14.0,15.0,
     16.0,17.0,18.0,19.0,20.0,21.0,22.0,23.0,24.0,25.0,26.0,27.0,28.0,29.0,30.0,31.0,
     32.0,33.0,34.0,35.0,36.0,37.0,38.0,39.0,40.0,41.0,42.0,43.0,44.0,45.0,46.0,47.0,
@@ -201,7 +203,7 @@ void TestApplyControlledGate1() {
   // Test applying on qubit 1 controlling on 0.
   FillMatrix(us, u, num_qubits);
   // clang-format off
-  float expected_mat_3[] = {
+  fp_type expected_mat_3[] = {
     0.0,1.0,2.0,3.0,4.0,5.0,6.0,7.0,8.0,9.0,10.0,11.0,12.0,13.0,14.0,15.0,
     -70.0,388.0,-74.0,408.0,-78.0,428.0,-82.0,448.0,-86.0,468.0,-90.0,488.0,-94.0,508.0,-98.0,528.0,
     32.0,33.0,34.0,35.0,36.0,37.0,38.0,39.0,40.0,41.0,42.0,43.0,44.0,45.0,46.0,47.0,
@@ -218,7 +220,7 @@ void TestApplyControlledGate1() {
   // Test applying on qubit 1 controlling on 0 and 2.
   FillMatrix(us, u, num_qubits);
   // clang-format off
-  float expected_mat_4[] = {
+  fp_type expected_mat_4[] = {
     0.0,1.0,2.0,3.0,4.0,5.0,6.0,7.0,8.0,9.0,10.0,11.0,12.0,13.0,14.0,15.0,
     16.0,17.0,18.0,19.0,20.0,21.0,22.0,23.0,24.0,25.0,26.0,27.0,28.0,29.0,30.0,31.0,
     32.0,33.0,34.0,35.0,36.0,37.0,38.0,39.0,40.0,41.0,42.0,43.0,44.0,45.0,46.0,47.0,
@@ -235,7 +237,7 @@ void TestApplyControlledGate1() {
   // Test applying on qubit 2 controlling on 1.
   FillMatrix(us, u, num_qubits);
   // clang-format off
-  float expected_mat_5[] = {
+  fp_type expected_mat_5[] = {
     0.0,1.0,2.0,3.0,4.0,5.0,6.0,7.0,8.0,9.0,10.0,11.0,12.0,13.0,14.0,15.0,
     16.0,17.0,18.0,19.0,20.0,21.0,22.0,23.0,24.0,25.0,26.0,27.0,28.0,29.0,30.0,31.0,
     -134.0,772.0,-138.0,792.0,-142.0,812.0,-146.0,832.0,-150.0,852.0,-154.0,872.0,-158.0,892.0,-162.0,912.0,
@@ -252,7 +254,7 @@ void TestApplyControlledGate1() {
   // Test applying on qubit 2 controlling on 0 and 1.
   FillMatrix(us, u, num_qubits);
   // clang-format off
-  float expected_mat_6[] = {
+  fp_type expected_mat_6[] = {
     0.0,1.0,2.0,3.0,4.0,5.0,6.0,7.0,8.0,9.0,10.0,11.0,12.0,13.0,14.0,15.0,
     16.0,17.0,18.0,19.0,20.0,21.0,22.0,23.0,24.0,25.0,26.0,27.0,28.0,29.0,30.0,31.0,
     32.0,33.0,34.0,35.0,36.0,37.0,38.0,39.0,40.0,41.0,42.0,43.0,44.0,45.0,46.0,47.0,
@@ -273,13 +275,14 @@ void TestApplyGate2() {
 
   using UnitarySpace = typename UC::UnitarySpace;
   using Unitary = typename UC::Unitary;
+  using fp_type = typename UC::fp_type;
 
   UC uc(1);
   UnitarySpace us(1);
   Unitary u = us.CreateUnitary(num_qubits);
 
   // clang-format off
-  float ref_gate[] = {1,2,3,4,5,6,7,8,
+  fp_type ref_gate[] = {1,2,3,4,5,6,7,8,
                       9,10,11,12,13,14,15,16,
                       17,18,19,20,21,22,23,24,
                       25,26,27,28,29,30,31,32};
@@ -288,7 +291,7 @@ void TestApplyGate2() {
   // Test applying on qubit 0, 1
   FillMatrix(us, u, num_qubits);
   // clang-format off
-  float expected_mat_01[] = {
+  fp_type expected_mat_01[] = {
     -116,1200,-124,1272,-132,1344,-140,1416,-148,1488,-156,1560,-164,1632,-172,1704,
     -148,2768,-156,2968,-164,3168,-172,3368,-180,3568,-188,3768,-196,3968,-204,4168,
     -180,4336,-188,4664,-196,4992,-204,5320,-212,5648,-220,5976,-228,6304,-236,6632,
@@ -305,7 +308,7 @@ void TestApplyGate2() {
   // Test applying on qubit 1, 2
   FillMatrix(us, u, num_qubits);
   // clang-format off
-  float expected_mat_12[] = {
+  fp_type expected_mat_12[] = {
     -212,2384,-220,2456,-228,2528,-236,2600,-244,2672,-252,2744,-260,2816,-268,2888,
     -276,2960,-284,3032,-292,3104,-300,3176,-308,3248,-316,3320,-324,3392,-332,3464,
     -244,5488,-252,5688,-260,5888,-268,6088,-276,6288,-284,6488,-292,6688,-300,6888,
@@ -322,7 +325,7 @@ void TestApplyGate2() {
   // Test applying on qubit 0, 2
   FillMatrix(us, u, num_qubits);
   // clang-format off
-  float expected_mat_02[] = {
+  fp_type expected_mat_02[] = {
     -180,2032,-188,2104,-196,2176,-204,2248,-212,2320,-220,2392,-228,2464,-236,2536,
     -212,4624,-220,4824,-228,5024,-236,5224,-244,5424,-252,5624,-260,5824,-268,6024,
     -308,3184,-316,3256,-324,3328,-332,3400,-340,3472,-348,3544,-356,3616,-364,3688,
@@ -343,13 +346,14 @@ void TestApplyControlledGate2() {
 
   using UnitarySpace = typename UC::UnitarySpace;
   using Unitary = typename UC::Unitary;
+  using fp_type = typename UC::fp_type;
 
   UC uc(1);
   UnitarySpace us(1);
   Unitary u = us.CreateUnitary(num_qubits);
 
   // clang-format off
-  float ref_gate[] = {1,2,3,4,5,6,7,8,
+  fp_type ref_gate[] = {1,2,3,4,5,6,7,8,
                       9,10,11,12,13,14,15,16,
                       17,18,19,20,21,22,23,24,
                       25,26,27,28,29,30,31,32};
@@ -358,7 +362,7 @@ void TestApplyControlledGate2() {
   // Test applying on qubit 0, 1
   FillMatrix(us, u, num_qubits);
   // clang-format off
-  float expected_mat_01[] = {
+  fp_type expected_mat_01[] = {
     0.0,1.0,2.0,3.0,4.0,5.0,6.0,7.0,8.0,9.0,10.0,11.0,12.0,13.0,14.0,15.0,
     16.0,17.0,18.0,19.0,20.0,21.0,22.0,23.0,24.0,25.0,26.0,27.0,28.0,29.0,30.0,31.0,
     32.0,33.0,34.0,35.0,36.0,37.0,38.0,39.0,40.0,41.0,42.0,43.0,44.0,45.0,46.0,47.0,
@@ -375,7 +379,7 @@ void TestApplyControlledGate2() {
   // Test applying on qubit 1, 2
   FillMatrix(us, u, num_qubits);
   // clang-format off
-  float expected_mat_12[] = {
+  fp_type expected_mat_12[] = {
     0.0,1.0,2.0,3.0,4.0,5.0,6.0,7.0,8.0,9.0,10.0,11.0,12.0,13.0,14.0,15.0,
     -276.0,2960.0,-284.0,3032.0,-292.0,3104.0,-300.0,3176.0,-308.0,3248.0,-316.0,3320.0,-324.0,3392.0,-332.0,3464.0,
     32.0,33.0,34.0,35.0,36.0,37.0,38.0,39.0,40.0,41.0,42.0,43.0,44.0,45.0,46.0,47.0,
@@ -392,7 +396,7 @@ void TestApplyControlledGate2() {
   // Test applying on qubit 0, 2
   FillMatrix(us, u, num_qubits);
   // clang-format off
-  float expected_mat_02[] = {
+  fp_type expected_mat_02[] = {
     0.0,1.0,2.0,3.0,4.0,5.0,6.0,7.0,8.0,9.0,10.0,11.0,12.0,13.0,14.0,15.0,
     16.0,17.0,18.0,19.0,20.0,21.0,22.0,23.0,24.0,25.0,26.0,27.0,28.0,29.0,30.0,31.0,
     -308.0,3184.0,-316.0,3256.0,-324.0,3328.0,-332.0,3400.0,-340.0,3472.0,-348.0,3544.0,-356.0,3616.0,-364.0,3688.0,
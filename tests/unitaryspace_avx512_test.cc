@@ -25,16 +25,25 @@ namespace qsim {
 namespace unitary {
 namespace {
 
-TEST(UnitarySpaceAVX512Test, SetZero) {
-  TestSetZeros<UnitarySpaceAVX512<For>>();
+template <class T>
+class UnitarySpaceAVX512Test : public testing::Test {};
+
+using ::testing::Types;
+typedef Types<UnitarySpaceAVX512<For, float>,
+              UnitarySpaceAVX512<For, double>> fp_impl;
+
+TYPED_TEST_SUITE(UnitarySpaceAVX512Test, fp_impl);
+
+TYPED_TEST(UnitarySpaceAVX512Test, SetZero) {
+  TestSetZeros<TypeParam>();
 }
 
-TEST(UnitarySpaceAVX512Test, SetIdentity) {
-  TestSetIdentity<UnitarySpaceAVX512<For>>();
+TYPED_TEST(UnitarySpaceAVX512Test, SetIdentity) {
+  TestSetIdentity<TypeParam>();
 }
 
-TEST(UnitarySpaceAVX512Test, GetEntry) {
-  TestSetEntry<UnitarySpaceAVX512<For>>();
+TYPED_TEST(UnitarySpaceAVX512Test, GetEntry) {
+  TestSetEntry<TypeParam>();
 }
 
 }  // namspace
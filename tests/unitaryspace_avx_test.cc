@@ -24,16 +24,25 @@ namespace qsim {
 namespace unitary {
 namespace {
 
-TEST(UnitarySpaceAVXTest, SetZero) {
-  TestSetZeros<UnitarySpaceAVX<For>>();
+template <class T>
+class UnitarySpaceAVXTest : public testing::Test {};
+
+using ::testing::Types;
+typedef Types<UnitarySpaceAVX<For, float>,
+              UnitarySpaceAVX<For, double>> fp_impl;
+
+TYPED_TEST_SUITE(UnitarySpaceAVXTest, fp_impl);
+
+TYPED_TEST(UnitarySpaceAVXTest, SetZero) {
+  TestSetZeros<TypeParam>();
 }
 
-TEST(UnitarySpaceAVXTest, SetIdentity) {
-  TestSetIdentity<UnitarySpaceAVX<For>>();
+TYPED_TEST(UnitarySpaceAVXTest, SetIdentity) {
+  TestSetIdentity<TypeParam>();
 }
 
-TEST(UnitarySpaceAVXTest, GetEntry) {
-  TestSetEntry<UnitarySpaceAVX<For>>();
+TYPED_TEST(UnitarySpaceAVXTest, GetEntry) {
+  TestSetEntry<TypeParam>();
 }
 
 }  // namspace
@@ -26,6 +26,7 @@ namespace unitary {
 template <typename UnitarySpace>
 void TestSetZeros() {
   using Unitary = typename UnitarySpace::Unitary;
+  using fp_type = typename UnitarySpace::fp_type;
 
   for (unsigned nq = 1; nq <= 5; ++nq) {
     UnitarySpace us(1);
@@ -36,7 +37,7 @@ void TestSetZeros() {
     unsigned size = 1 << nq;
     for (unsigned i = 0; i < size; ++i) {
       for (unsigned j = 0; j < size; ++j) {
-        EXPECT_EQ(us.GetEntry(u, i, j), std::complex<float>(0, 0));
+        EXPECT_EQ(us.GetEntry(u, i, j), std::complex<fp_type>(0, 0));
       }
     }
   }
@@ -45,6 +46,7 @@ void TestSetZeros() {
 template <typename UnitarySpace>
 void TestSetIdentity() {
   using Unitary = typename UnitarySpace::Unitary;
+  using fp_type = typename UnitarySpace::fp_type;
 
   for (unsigned nq = 1; nq <= 5; ++nq) {
     UnitarySpace us(1);
@@ -56,9 +58,9 @@ void TestSetIdentity() {
     for (unsigned i = 0; i < size; ++i) {
       for (unsigned j = 0; j < size; ++j) {
         if (i == j) {
-          EXPECT_EQ(us.GetEntry(u, i, j), std::complex<float>(1, 0));
+          EXPECT_EQ(us.GetEntry(u, i, j), std::complex<fp_type>(1, 0));
         } else {
-          EXPECT_EQ(us.GetEntry(u, i, j), std::complex<float>(0, 0));
+          EXPECT_EQ(us.GetEntry(u, i, j), std::complex<fp_type>(0, 0));
         }
       }
     }
@@ -68,6 +70,7 @@ void TestSetIdentity() {
 template <typename UnitarySpace>
 void TestSetEntry() {
   using Unitary = typename UnitarySpace::Unitary;
+  using fp_type = typename UnitarySpace::fp_type;
 
   for (unsigned nq = 1; nq <= 5; ++nq) {
     UnitarySpace us(1);
@@ -86,7 +89,7 @@ void TestSetEntry() {
       for (unsigned j = 0; j < size; ++j) {
         unsigned val = i * size + j;
         EXPECT_EQ(
-          us.GetEntry(u, i, j), std::complex<float>(2 * val, 2 * val + 1));
+          us.GetEntry(u, i, j), std::complex<fp_type>(2 * val, 2 * val + 1));
       }
     }
   }
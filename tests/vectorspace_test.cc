@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
 #include <cstdint>
 #include <utility>
 #include <vector>
@@ -19,6 +20,8 @@
 #include "gtest/gtest.h"
 
 #include "../lib/formux.h"
+#include "../lib/numa.h"
+#include "../lib/poolfor.h"
 #include "../lib/vectorspace.h"
 
 namespace qsim {
@@ -96,6 +99,70 @@ TEST(VectorSpaceTest, BasicTest) {
   vector_space.Free(p3);
 }
 
+TEST(VectorSpaceTest, NumaPolicies) {
+  struct DummyImplementation {
+    static uint64_t MinSize(unsigned num_qubits) {
+      return uint64_t{1} << num_qubits;
+    }
+  };
+
+  unsigned num_qubits = 12;
+  uint64_t size = uint64_t{1} << num_qubits;
+
+  VectorSpace<DummyImplementation, PoolFor, float> vector_space(2);
+
+  auto nodes = NumaNodes();
+
+  for (auto policy : {kNumaDefault, kNumaInterleave, kNumaFirstTouch}) {
+    auto vector1 = vector_space.Create(num_qubits, policy);
+
+    EXPECT_FALSE(vector_space.IsNull(vector1));
+    EXPECT_EQ(uint64_t(vector1.get()) % 64, 0);
+    EXPECT_EQ(vector1.num_qubits(), num_qubits);
+
+    if (policy == kNumaFirstTouch) {
+      for (uint64_t i = 0; i < size; ++i) {
+        EXPECT_EQ(vector1.get()[i], 0);
+      }
+    }
+
+    for (uint64_t i = 0; i < size; ++i) {
+      vector1.get()[i] = i + 1;
+    }
+
+    int node = NumaNodeOfAddress(vector1.get());
+    if (node >= 0) {
+      EXPECT_NE(std::find(nodes.begin(), nodes.end(), node), nodes.end());
+    }
+
+    auto vector2 = vector_space.Create(num_qubits);
+    vector_space.Copy(vector1, vector2);
+
+    for (uint64_t i = 0; i < size; ++i) {
+      EXPECT_FLOAT_EQ(vector2.get()[i], i + 1);
+    }
+  }
+}
+
+TEST(VectorSpaceTest, NumaHelpers) {
+  std::vector<unsigned> expected = {0, 1, 2, 3, 8, 10, 11};
+  EXPECT_EQ(detail::ParseIndexList("0-3,8,10-11\n"), expected);
+  EXPECT_TRUE(detail::ParseIndexList("").empty());
+
+  auto nodes = NumaNodes();
+  EXPECT_FALSE(nodes.empty());
+
+#ifdef __linux__
+  auto cpus = AvailableCpusByNode();
+  EXPECT_FALSE(cpus.empty());
+
+  // The CPUs should be sorted by node.
+  for (std::size_t k = 1; k < cpus.size(); ++k) {
+    EXPECT_LE(NumaNodeOfCpu(cpus[k - 1]), NumaNodeOfCpu(cpus[k]));
+  }
+#endif
+}
+
 }  // namespace qsim
 
 int main(int argc, char** argv) {